@@ -437,6 +437,7 @@ daemonConfigLoadOptions(struct daemonConfig *data,
     GET_CONF_UINT(conf, filename, max_anonymous_clients);
 
     GET_CONF_UINT(conf, filename, prio_workers);
+    GET_CONF_UINT(conf, filename, max_long_workers);
 
     GET_CONF_INT(conf, filename, max_requests);
     GET_CONF_UINT(conf, filename, max_client_requests);
@@ -449,6 +450,7 @@ daemonConfigLoadOptions(struct daemonConfig *data,
     GET_CONF_UINT(conf, filename, log_level);
     GET_CONF_STR(conf, filename, log_filters);
     GET_CONF_STR(conf, filename, log_outputs);
+    GET_CONF_UINT(conf, filename, log_async_buffer_size);
 
     GET_CONF_INT(conf, filename, keepalive_interval);
     GET_CONF_UINT(conf, filename, keepalive_count);
@@ -67,6 +67,7 @@ struct daemonConfig {
     int max_anonymous_clients;
 
     int prio_workers;
+    unsigned int max_long_workers;
 
     int max_requests;
     int max_client_requests;
@@ -74,6 +75,7 @@ struct daemonConfig {
     int log_level;
     char *log_filters;
     char *log_outputs;
+    unsigned int log_async_buffer_size;
 
     int audit_level;
     int audit_logging;
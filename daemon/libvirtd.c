@@ -785,6 +785,15 @@ static void daemonReloadHandler(virNetServerPtr srv ATTRIBUTE_UNUSED,
                                 siginfo_t *sig ATTRIBUTE_UNUSED,
                                 void *opaque ATTRIBUTE_UNUSED)
 {
+    virAccessManagerPtr mgr;
+
+    /* Policy may have changed as well, so forget any cached
+     * access control decisions */
+    if ((mgr = virAccessManagerGetDefault())) {
+        virAccessManagerFlushCache(mgr);
+        virObjectUnref(mgr);
+    }
+
     if (!driversInitialized) {
         VIR_WARN("Drivers are not initialized, reload ignored");
         return;
@@ -797,6 +806,14 @@ static void daemonReloadHandler(virNetServerPtr srv ATTRIBUTE_UNUSED,
         VIR_WARN("Error while reloading drivers");
 }
 
+static void daemonStatsHandler(virNetServerPtr srv,
+                               siginfo_t *sig ATTRIBUTE_UNUSED,
+                               void *opaque ATTRIBUTE_UNUSED)
+{
+    VIR_INFO("Logging RPC statistics on SIGUSR2");
+    virNetServerLogStats(srv);
+}
+
 static int daemonSetupSignals(virNetServerPtr srv)
 {
     if (virNetServerAddSignalHandler(srv, SIGINT, daemonShutdownHandler, NULL) < 0)
@@ -807,6 +824,8 @@ static int daemonSetupSignals(virNetServerPtr srv)
         return -1;
     if (virNetServerAddSignalHandler(srv, SIGHUP, daemonReloadHandler, NULL) < 0)
         return -1;
+    if (virNetServerAddSignalHandler(srv, SIGUSR2, daemonStatsHandler, NULL) < 0)
+        return -1;
     return 0;
 }
 
@@ -1116,6 +1135,7 @@ int main(int argc, char **argv) {
     bool implicit_conf = false;
     char *run_dir = NULL;
     mode_t old_umask;
+    size_t log_async_size;
 
     struct option opts[] = {
         { "verbose", no_argument, &verbose, 'v'},
@@ -1281,6 +1301,10 @@ int main(int argc, char **argv) {
     VIR_DEBUG("Decided on socket paths '%s' and '%s'",
               sock_file, NULLSTR(sock_file_ro));
 
+    /* A size from LIBVIRT_LOG_ASYNC takes precedence over the config */
+    if (!(log_async_size = virLogGetAsync()))
+        log_async_size = (size_t) config->log_async_buffer_size * 1024;
+
     if (godaemon) {
         char ebuf[1024];
 
@@ -1290,6 +1314,10 @@ int main(int argc, char **argv) {
             goto cleanup;
         }
 
+        /* The log writer thread would not survive the fork, and
+         * could hold the log lock while forking */
+        ignore_value(virLogSetAsync(0));
+
         if ((statuswrite = daemonForkIntoBackground(argv[0])) < 0) {
             VIR_ERROR(_("Failed to fork as daemon: %s"),
                       virStrerror(errno, ebuf, sizeof(ebuf)));
@@ -1297,6 +1325,12 @@ int main(int argc, char **argv) {
         }
     }
 
+    /* The writer thread must be started after daemonizing */
+    if (log_async_size && virLogSetAsync(log_async_size) < 0) {
+        VIR_ERROR(_("Can't start asynchronous logging"));
+        goto cleanup;
+    }
+
     /* Ensure the rundir exists (on tmpfs on some systems) */
     if (privileged) {
         if (VIR_STRDUP_QUIET(run_dir, LOCALSTATEDIR "/run/libvirt") < 0) {
@@ -1353,6 +1387,8 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    virNetServerSetLongJobLimit(srv, config->max_long_workers);
+
     /* Beyond this point, nothing should rely on using
      * getuid/geteuid() == 0, for privilege level checks.
      */
@@ -1529,5 +1565,8 @@ int main(int argc, char **argv) {
         virStateCleanup();
     }
 
+    /* Write out anything still queued */
+    ignore_value(virLogSetAsync(0));
+
     return ret;
 }
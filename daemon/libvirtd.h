@@ -69,6 +69,7 @@ struct daemonClientPrivate {
 
     daemonClientStreamPtr streams;
     bool keepalive_supported;
+    bool largeStreamChunks;     /* client accepts large stream packets */
 };
 
 # if WITH_SASL
@@ -4182,6 +4182,14 @@ static int remoteDispatchConnectSupportsFeature(virNetServerPtr server ATTRIBUTE
         supported = 1;
         break;
 
+    case VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_CHUNKS:
+        /* Only clients able to receive them know to ask */
+        virMutexLock(&priv->lock);
+        priv->largeStreamChunks = true;
+        virMutexUnlock(&priv->lock);
+        supported = 1;
+        break;
+
     default:
         if ((supported = virConnectSupportsFeature(priv->conn, args->feature)) < 0)
             goto cleanup;
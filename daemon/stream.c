@@ -709,6 +709,9 @@ static int
 daemonStreamHandleRead(virNetServerClientPtr client,
                        daemonClientStream *stream)
 {
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+    virNetMessagePtr msg = NULL;
     char *buffer;
     size_t bufferLen = VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX;
     int ret;
@@ -728,50 +731,52 @@ daemonStreamHandleRead(virNetServerClientPtr client,
     if (!stream->tx)
         return 0;
 
-    if (VIR_ALLOC_N(buffer, bufferLen) < 0)
+    virMutexLock(&priv->lock);
+    if (priv->largeStreamChunks)
+        bufferLen = VIR_NET_MESSAGE_STREAM_CHUNK_MAX;
+    virMutexUnlock(&priv->lock);
+
+    /* Read the data straight into the message to be sent */
+    if (!(msg = virNetMessageNew(false)) ||
+        virNetServerProgramReserveStreamData(remoteProgram, msg,
+                                             stream->procedure,
+                                             stream->serial,
+                                             bufferLen, &buffer) < 0) {
+        virNetMessageFree(msg);
         return -1;
+    }
 
     ret = virStreamRecv(stream->st, buffer, bufferLen);
     if (ret == -2) {
         /* Should never get this, since we're only called when we know
          * we're readable, but hey things change... */
+        virNetMessageFree(msg);
         ret = 0;
     } else if (ret < 0) {
-        virNetMessagePtr msg;
         virNetMessageError rerr;
 
         memset(&rerr, 0, sizeof(rerr));
 
-        if (!(msg = virNetMessageNew(false)))
-            ret = -1;
-        else
-            ret = virNetServerProgramSendStreamError(remoteProgram,
-                                                     client,
-                                                     msg,
-                                                     &rerr,
-                                                     stream->procedure,
-                                                     stream->serial);
+        virNetMessageClear(msg);
+        ret = virNetServerProgramSendStreamError(remoteProgram,
+                                                 client,
+                                                 msg,
+                                                 &rerr,
+                                                 stream->procedure,
+                                                 stream->serial);
     } else {
-        virNetMessagePtr msg;
         stream->tx = 0;
         if (ret == 0)
             stream->recvEOF = 1;
-        if (!(msg = virNetMessageNew(false)))
-            ret = -1;
 
-        if (msg) {
-            msg->cb = daemonStreamMessageFinished;
-            msg->opaque = stream;
-            stream->refs++;
-            ret = virNetServerProgramSendStreamData(remoteProgram,
-                                                    client,
-                                                    msg,
-                                                    stream->procedure,
-                                                    stream->serial,
-                                                    buffer, ret);
-        }
+        msg->cb = daemonStreamMessageFinished;
+        msg->opaque = stream;
+        stream->refs++;
+        ret = virNetServerProgramSendReservedStreamData(remoteProgram,
+                                                        client,
+                                                        msg,
+                                                        ret);
     }
 
-    VIR_FREE(buffer);
     return ret;
 }
@@ -724,6 +724,18 @@ typedef enum {
  */
 # define VIR_MIGRATE_PARAM_LISTEN_ADDRESS    "listen_address"
 
+/**
+ * VIR_MIGRATE_PARAM_TUNNEL_STREAMS:
+ *
+ * virDomainMigrate* params field: the number of parallel streams the data of
+ * a tunnelled (VIR_MIGRATE_TUNNELLED) migration is striped across, as
+ * VIR_TYPED_PARAM_INT. Each stream is carried over its own connection to the
+ * destination. The default is 1, i.e., a single stream. Some hypervisors do
+ * not support this feature and will return an error if this field is used
+ * with a value other than 1.
+ */
+# define VIR_MIGRATE_PARAM_TUNNEL_STREAMS    "tunnel_streams"
+
 /* Domain migration. */
 virDomainPtr virDomainMigrate (virDomainPtr domain, virConnectPtr dconn,
                                unsigned long flags, const char *dname,
@@ -1700,6 +1712,11 @@ typedef enum {
     VIR_DOMAIN_STATS_VCPU = (1 << 3), /* return domain virtual CPU info */
     VIR_DOMAIN_STATS_INTERFACE = (1 << 4), /* return domain interfaces info */
     VIR_DOMAIN_STATS_BLOCK = (1 << 5), /* return domain block info */
+    VIR_DOMAIN_STATS_AUTOSTART = (1 << 6), /* return domain autostart setting */
+    VIR_DOMAIN_STATS_MANAGEDSAVE = (1 << 7), /* return domain managed save
+                                                image presence */
+    VIR_DOMAIN_STATS_MONITOR = (1 << 8), /* return hypervisor monitor
+                                            connection statistics */
 } virDomainStatsTypes;
 
 typedef enum {
@@ -63,6 +63,10 @@ typedef int (*virAccessDriverCheckStorageVolDrv)(virAccessManagerPtr manager,
 
 typedef int (*virAccessDriverSetupDrv)(virAccessManagerPtr manager);
 typedef void (*virAccessDriverCleanupDrv)(virAccessManagerPtr manager);
+typedef void (*virAccessDriverFlushCacheDrv)(virAccessManagerPtr manager);
+typedef void (*virAccessDriverGetCacheStatsDrv)(virAccessManagerPtr manager,
+                                                unsigned long long *hits,
+                                                unsigned long long *misses);
 
 typedef struct _virAccessDriver virAccessDriver;
 typedef virAccessDriver *virAccessDriverPtr;
@@ -73,6 +77,8 @@ struct _virAccessDriver {
 
     virAccessDriverSetupDrv setup;
     virAccessDriverCleanupDrv cleanup;
+    virAccessDriverFlushCacheDrv flushCache;
+    virAccessDriverGetCacheStatsDrv getCacheStats;
 
     virAccessDriverCheckConnectDrv checkConnect;
     virAccessDriverCheckDomainDrv checkDomain;
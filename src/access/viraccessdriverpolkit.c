@@ -22,12 +22,16 @@
 
 #include "viraccessdriverpolkit.h"
 #include "viralloc.h"
+#include "virbuffer.h"
 #include "vircommand.h"
+#include "virhash.h"
 #include "virlog.h"
 #include "virprocess.h"
 #include "virerror.h"
 #include "virpolkit.h"
 #include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_ACCESS
 
@@ -39,16 +43,85 @@ VIR_LOG_INIT("access.accessdriverpolkit");
 
 #define VIR_ACCESS_DRIVER_POLKIT_ACTION_PREFIX "org.libvirt.api"
 
+/* How long in milliseconds a polkit decision is reused for further
+ * checks of the same action on the same object by the same client
+ * process. This bounds how long a policy change may go unnoticed. */
+#define VIR_ACCESS_DRIVER_POLKIT_CACHE_TTL 5000
+
+/* Upper bound on the number of cached decisions */
+#define VIR_ACCESS_DRIVER_POLKIT_CACHE_MAX 4096
+
 typedef struct _virAccessDriverPolkitPrivate virAccessDriverPolkitPrivate;
 typedef virAccessDriverPolkitPrivate *virAccessDriverPolkitPrivatePtr;
 
 struct _virAccessDriverPolkitPrivate {
     bool ignore;
+
+    virMutex lock;
+    /* virAccessDriverPolkitCacheKey() -> virAccessDriverPolkitDecisionPtr */
+    virHashTablePtr cache;
+    unsigned long long hits;
+    unsigned long long misses;
+};
+
+typedef struct _virAccessDriverPolkitDecision virAccessDriverPolkitDecision;
+typedef virAccessDriverPolkitDecision *virAccessDriverPolkitDecisionPtr;
+
+struct _virAccessDriverPolkitDecision {
+    int result; /* 1 allowed, 0 denied */
+    unsigned long long expires;
 };
 
 
-static void virAccessDriverPolkitCleanup(virAccessManagerPtr manager ATTRIBUTE_UNUSED)
+static int virAccessDriverPolkitSetup(virAccessManagerPtr manager)
+{
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
+
+    if (virMutexInit(&priv->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    if (!(priv->cache = virHashCreate(64, virHashValueFree))) {
+        virMutexDestroy(&priv->lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void virAccessDriverPolkitCleanup(virAccessManagerPtr manager)
+{
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
+
+    virHashFree(priv->cache);
+    virMutexDestroy(&priv->lock);
+}
+
+
+static void virAccessDriverPolkitFlushCache(virAccessManagerPtr manager)
+{
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
+
+    virMutexLock(&priv->lock);
+    VIR_DEBUG("Dropping %zd cached decisions", virHashSize(priv->cache));
+    virHashRemoveAll(priv->cache);
+    virMutexUnlock(&priv->lock);
+}
+
+
+static void virAccessDriverPolkitGetCacheStats(virAccessManagerPtr manager,
+                                               unsigned long long *hits,
+                                               unsigned long long *misses)
 {
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
+
+    virMutexLock(&priv->lock);
+    *hits += priv->hits;
+    *misses += priv->misses;
+    virMutexUnlock(&priv->lock);
 }
 
 
@@ -112,17 +185,121 @@ virAccessDriverPolkitGetCaller(const char *actionid,
 }
 
 
+/*
+ * Build the key a decision is cached under. It identifies the client
+ * process the same way polkit does, plus everything polkit gets told
+ * about the request. All variable length items are length prefixed
+ * so that no two distinct requests can map to the same key.
+ */
+static char *
+virAccessDriverPolkitCacheKey(const char *actionid,
+                              pid_t pid,
+                              unsigned long long startTime,
+                              uid_t uid,
+                              const char **attrs)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    virBufferAsprintf(&buf, "%lld %llu %d %zu:%s",
+                      (long long) pid, startTime, (int) uid,
+                      strlen(actionid), actionid);
+
+    for (i = 0; attrs && attrs[i]; i++)
+        virBufferAsprintf(&buf, " %zu:%s", strlen(attrs[i]), attrs[i]);
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+static int
+virAccessDriverPolkitCacheIsExpired(const void *payload,
+                                    const void *name ATTRIBUTE_UNUSED,
+                                    const void *opaque)
+{
+    const virAccessDriverPolkitDecision *decision = payload;
+    const unsigned long long *now = opaque;
+
+    return decision->expires <= *now;
+}
+
+
+/*
+ * Look up a cached decision for @key.
+ *
+ * Returns 1 if allowed, 0 if denied, -1 if there is no such decision
+ */
+static int
+virAccessDriverPolkitCacheLookup(virAccessDriverPolkitPrivatePtr priv,
+                                 const char *key,
+                                 unsigned long long now)
+{
+    virAccessDriverPolkitDecisionPtr decision;
+    int ret = -1;
+
+    virMutexLock(&priv->lock);
+    decision = virHashLookup(priv->cache, key);
+    if (decision && decision->expires > now) {
+        priv->hits++;
+        ret = decision->result;
+    } else {
+        priv->misses++;
+    }
+    virMutexUnlock(&priv->lock);
+
+    return ret;
+}
+
+
+static void
+virAccessDriverPolkitCacheStore(virAccessDriverPolkitPrivatePtr priv,
+                                const char *key,
+                                int result,
+                                unsigned long long now)
+{
+    virAccessDriverPolkitDecisionPtr decision;
+
+    if (VIR_ALLOC(decision) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    decision->result = result;
+    decision->expires = now + VIR_ACCESS_DRIVER_POLKIT_CACHE_TTL;
+
+    virMutexLock(&priv->lock);
+    if (virHashSize(priv->cache) >= VIR_ACCESS_DRIVER_POLKIT_CACHE_MAX) {
+        virHashRemoveSet(priv->cache, virAccessDriverPolkitCacheIsExpired,
+                         &now);
+        if (virHashSize(priv->cache) >= VIR_ACCESS_DRIVER_POLKIT_CACHE_MAX)
+            virHashRemoveAll(priv->cache);
+    }
+
+    if (virHashUpdateEntry(priv->cache, key, decision) < 0) {
+        VIR_FREE(decision);
+        virResetLastError();
+    }
+    virMutexUnlock(&priv->lock);
+}
+
+
 static int
-virAccessDriverPolkitCheck(virAccessManagerPtr manager ATTRIBUTE_UNUSED,
+virAccessDriverPolkitCheck(virAccessManagerPtr manager,
                            const char *typename,
                            const char *permname,
                            const char **attrs)
 {
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
     char *actionid = NULL;
+    char *key = NULL;
     int ret = -1;
     pid_t pid;
     uid_t uid;
     unsigned long long startTime;
+    unsigned long long now = 0;
     int rv;
 
     if (!(actionid = virAccessDriverPolkitFormatAction(typename, permname)))
@@ -134,6 +311,20 @@ virAccessDriverPolkitCheck(virAccessManagerPtr manager ATTRIBUTE_UNUSED,
                                        &uid) < 0)
         goto cleanup;
 
+    /* Without the start time the PID may have been recycled by
+     * another process, so such callers are never cached */
+    if (startTime != 0 &&
+        virTimeMillisNow(&now) == 0 &&
+        (key = virAccessDriverPolkitCacheKey(actionid, pid, startTime,
+                                             uid, attrs))) {
+        if ((ret = virAccessDriverPolkitCacheLookup(priv, key, now)) >= 0) {
+            VIR_DEBUG("Cached decision %d for action '%s' for process '%lld'",
+                      ret, actionid, (long long) pid);
+            goto cleanup;
+        }
+    }
+    virResetLastError();
+
     VIR_DEBUG("Check action '%s' for process '%lld' time %lld uid %d",
               actionid, (long long) pid, startTime, uid);
 
@@ -154,7 +345,12 @@ virAccessDriverPolkitCheck(virAccessManagerPtr manager ATTRIBUTE_UNUSED,
         }
     }
 
+    /* Errors talking to polkit are transient, so never cache them */
+    if (key && ret >= 0)
+        virAccessDriverPolkitCacheStore(priv, key, ret, now);
+
  cleanup:
+    VIR_FREE(key);
     VIR_FREE(actionid);
     return ret;
 }
@@ -389,7 +585,10 @@ virAccessDriverPolkitCheckStorageVol(virAccessManagerPtr manager,
 virAccessDriver accessDriverPolkit = {
     .privateDataLen = sizeof(virAccessDriverPolkitPrivate),
     .name = "polkit",
+    .setup = virAccessDriverPolkitSetup,
     .cleanup = virAccessDriverPolkitCleanup,
+    .flushCache = virAccessDriverPolkitFlushCache,
+    .getCacheStats = virAccessDriverPolkitGetCacheStats,
     .checkConnect = virAccessDriverPolkitCheckConnect,
     .checkDomain = virAccessDriverPolkitCheckDomain,
     .checkInterface = virAccessDriverPolkitCheckInterface,
@@ -60,6 +60,35 @@ static void virAccessDriverStackCleanup(virAccessManagerPtr manager)
 }
 
 
+static void virAccessDriverStackFlushCache(virAccessManagerPtr manager)
+{
+    virAccessDriverStackPrivatePtr priv = virAccessManagerGetPrivateData(manager);
+    size_t i;
+
+    for (i = 0; i < priv->managersLen; i++)
+        virAccessManagerFlushCache(priv->managers[i]);
+}
+
+
+static void virAccessDriverStackGetCacheStats(virAccessManagerPtr manager,
+                                              unsigned long long *hits,
+                                              unsigned long long *misses)
+{
+    virAccessDriverStackPrivatePtr priv = virAccessManagerGetPrivateData(manager);
+    size_t i;
+
+    for (i = 0; i < priv->managersLen; i++) {
+        unsigned long long childHits;
+        unsigned long long childMisses;
+
+        virAccessManagerGetCacheStats(priv->managers[i],
+                                      &childHits, &childMisses);
+        *hits += childHits;
+        *misses += childMisses;
+    }
+}
+
+
 static int
 virAccessDriverStackCheckConnect(virAccessManagerPtr manager,
                                  const char *driverName,
@@ -271,6 +300,8 @@ virAccessDriver accessDriverStack = {
     .privateDataLen = sizeof(virAccessDriverStackPrivate),
     .name = "stack",
     .cleanup = virAccessDriverStackCleanup,
+    .flushCache = virAccessDriverStackFlushCache,
+    .getCacheStats = virAccessDriverStackGetCacheStats,
     .checkConnect = virAccessDriverStackCheckConnect,
     .checkDomain = virAccessDriverStackCheckDomain,
     .checkInterface = virAccessDriverStackCheckInterface,
@@ -182,6 +182,42 @@ void *virAccessManagerGetPrivateData(virAccessManagerPtr mgr)
 }
 
 
+/**
+ * virAccessManagerFlushCache:
+ * @mgr: the access manager
+ *
+ * Discard any access control decisions the driver has cached,
+ * so that subsequent checks reflect the current policy.
+ */
+void virAccessManagerFlushCache(virAccessManagerPtr mgr)
+{
+    VIR_DEBUG("manager=%p(name=%s)", mgr, mgr->drv->name);
+
+    if (mgr->drv->flushCache)
+        mgr->drv->flushCache(mgr);
+}
+
+
+/**
+ * virAccessManagerGetCacheStats:
+ * @mgr: the access manager
+ * @hits: filled with the number of checks answered from the cache
+ * @misses: filled with the number of checks that had to be evaluated
+ *
+ * Drivers which do not cache their decisions report zero for both.
+ */
+void virAccessManagerGetCacheStats(virAccessManagerPtr mgr,
+                                   unsigned long long *hits,
+                                   unsigned long long *misses)
+{
+    *hits = 0;
+    *misses = 0;
+
+    if (mgr->drv->getCacheStats)
+        mgr->drv->getCacheStats(mgr, hits, misses);
+}
+
+
 static void virAccessManagerDispose(void *object)
 {
     virAccessManagerPtr mgr = object;
@@ -43,6 +43,11 @@ virAccessManagerPtr virAccessManagerNewStack(const char **names);
 
 void *virAccessManagerGetPrivateData(virAccessManagerPtr manager);
 
+void virAccessManagerFlushCache(virAccessManagerPtr manager);
+void virAccessManagerGetCacheStats(virAccessManagerPtr manager,
+                                   unsigned long long *hits,
+                                   unsigned long long *misses);
+
 
 /*
  * The virAccessManagerCheckXXX functions will
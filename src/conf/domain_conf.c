@@ -56,6 +56,8 @@
 #include "network_conf.h"
 #include "virtpm.h"
 #include "virstring.h"
+#include "virthreadpool.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -88,6 +90,9 @@ struct _virDomainXMLOption {
 
     /* XML namespace callbacks */
     virDomainXMLNamespace ns;
+
+    /* Writer coordinating status file updates, may be NULL */
+    virFileWriterPtr statusWriter;
 };
 
 #define VIR_DOMAIN_DEF_FORMAT_COMMON_FLAGS             \
@@ -825,6 +830,8 @@ virDomainXMLOptionClassDispose(void *obj)
 
     if (xmlopt->config.privFree)
         (xmlopt->config.privFree)(xmlopt->config.priv);
+
+    virObjectUnref(xmlopt->statusWriter);
 }
 
 
@@ -870,6 +877,24 @@ virDomainXMLOptionNew(virDomainDefParserConfigPtr config,
     return xmlopt;
 }
 
+/**
+ * virDomainXMLOptionSetStatusWriter:
+ *
+ * @xmlopt: XML parser configuration object
+ * @writer: the writer, or NULL
+ *
+ * Route all status file updates done by virDomainSaveStatus() and
+ * virDomainSaveStatusDeferred() through @writer. Must be called
+ * before any domain status is saved.
+ */
+void
+virDomainXMLOptionSetStatusWriter(virDomainXMLOptionPtr xmlopt,
+                                  virFileWriterPtr writer)
+{
+    virObjectUnref(xmlopt->statusWriter);
+    xmlopt->statusWriter = virObjectRef(writer);
+}
+
 /**
  * virDomainXMLOptionGetNamespace:
  *
@@ -5401,19 +5426,24 @@ static int
 virSecurityDeviceLabelDefParseXML(virSecurityDeviceLabelDefPtr **seclabels_rtn,
                                   size_t *nseclabels_rtn,
                                   virSecurityLabelDefPtr *vmSeclabels,
-                                  int nvmSeclabels, xmlXPathContextPtr ctxt,
+                                  int nvmSeclabels, xmlNodePtr node,
                                   unsigned int flags)
 {
     virSecurityDeviceLabelDefPtr *seclabels = NULL;
     size_t nseclabels = 0;
-    int n;
+    size_t n = 0;
     size_t i, j;
+    xmlNodePtr cur;
     xmlNodePtr *list = NULL;
     virSecurityLabelDefPtr vmDef = NULL;
     char *model, *relabel, *label, *labelskip;
 
-    if ((n = virXPathNodeSet("./seclabel", ctxt, &list)) < 0)
-        goto error;
+    for (cur = node->children; cur; cur = cur->next) {
+        if (cur->type == XML_ELEMENT_NODE &&
+            xmlStrEqual(cur->name, BAD_CAST "seclabel") &&
+            VIR_APPEND_ELEMENT_COPY(list, n, cur) < 0)
+            goto error;
+    }
     if (n == 0)
         return 0;
 
@@ -5481,9 +5511,16 @@ virSecurityDeviceLabelDefParseXML(virSecurityDeviceLabelDefPtr **seclabels_rtn,
             seclabels[i]->labelskip = STREQ(labelskip, "yes");
         VIR_FREE(labelskip);
 
-        ctxt->node = list[i];
-        label = virXPathStringLimit("string(./label)",
-                                    VIR_SECURITY_LABEL_BUFLEN-1, ctxt);
+        label = virXMLChildContent(list[i], "label");
+
+        /* Like virXPathStringLimit, an over-long label is dropped */
+        if (label && strlen(label) >= VIR_SECURITY_LABEL_BUFLEN - 1) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("\'%s\' value longer than %zu bytes"),
+                           "string(./label)",
+                           (size_t) VIR_SECURITY_LABEL_BUFLEN - 1);
+            VIR_FREE(label);
+        }
         seclabels[i]->label = label;
 
         if (label && !seclabels[i]->relabel) {
@@ -5630,14 +5667,10 @@ virDomainDiskSourcePoolDefParse(xmlNodePtr node,
 
 int
 virDomainDiskSourceParse(xmlNodePtr node,
-                         xmlXPathContextPtr ctxt,
                          virStorageSourcePtr src)
 {
     int ret = -1;
     char *protocol = NULL;
-    xmlNodePtr saveNode = ctxt->node;
-
-    ctxt->node = node;
 
     switch ((virStorageType)src->type) {
     case VIR_STORAGE_TYPE_FILE:
@@ -5691,10 +5724,10 @@ virDomainDiskSourceParse(xmlNodePtr node,
         }
 
         /* snapshot currently works only for remote disks */
-        src->snapshot = virXPathString("string(./snapshot/@name)", ctxt);
+        src->snapshot = virXMLChildPropString(node, "snapshot", "name");
 
         /* config file currently only works with remote disks */
-        src->configFile = virXPathString("string(./config/@file)", ctxt);
+        src->configFile = virXMLChildPropString(node, "config", "file");
 
         if (virDomainStorageHostParse(node, &src->hosts, &src->nhosts) < 0)
             goto cleanup;
@@ -5721,23 +5754,29 @@ virDomainDiskSourceParse(xmlNodePtr node,
 
  cleanup:
     VIR_FREE(protocol);
-    ctxt->node = saveNode;
     return ret;
 }
 
 
 static int
-virDomainDiskBackingStoreParse(xmlXPathContextPtr ctxt,
+virDomainDiskBackingStoreParse(xmlNodePtr node,
                                virStorageSourcePtr src)
 {
     virStorageSourcePtr backingStore = NULL;
-    xmlNodePtr save_ctxt = ctxt->node;
+    xmlNodePtr cur;
     xmlNodePtr source;
     char *type = NULL;
     char *format = NULL;
     int ret = -1;
 
-    if (!(ctxt->node = virXPathNode("./backingStore[*]", ctxt))) {
+    /* The first <backingStore> which is not empty */
+    for (cur = node->children; cur; cur = cur->next) {
+        if (cur->type == XML_ELEMENT_NODE &&
+            xmlStrEqual(cur->name, BAD_CAST "backingStore") &&
+            virXMLChildElementCount(cur) > 0)
+            break;
+    }
+    if (!cur) {
         ret = 0;
         goto cleanup;
     }
@@ -5745,7 +5784,7 @@ virDomainDiskBackingStoreParse(xmlXPathContextPtr ctxt,
     if (VIR_ALLOC(backingStore) < 0)
         goto cleanup;
 
-    if (!(type = virXMLPropString(ctxt->node, "type"))) {
+    if (!(type = virXMLPropString(cur, "type"))) {
         virReportError(VIR_ERR_XML_ERROR, "%s",
                        _("missing disk backing store type"));
         goto cleanup;
@@ -5758,7 +5797,7 @@ virDomainDiskBackingStoreParse(xmlXPathContextPtr ctxt,
         goto cleanup;
     }
 
-    if (!(format = virXPathString("string(./format/@type)", ctxt))) {
+    if (!(format = virXMLChildPropString(cur, "format", "type"))) {
         virReportError(VIR_ERR_XML_ERROR, "%s",
                        _("missing disk backing store format"));
         goto cleanup;
@@ -5771,14 +5810,14 @@ virDomainDiskBackingStoreParse(xmlXPathContextPtr ctxt,
         goto cleanup;
     }
 
-    if (!(source = virXPathNode("./source", ctxt))) {
+    if (!(source = virXMLChildElement(cur, "source"))) {
         virReportError(VIR_ERR_XML_ERROR, "%s",
                        _("missing disk backing store source"));
         goto cleanup;
     }
 
-    if (virDomainDiskSourceParse(source, ctxt, backingStore) < 0 ||
-        virDomainDiskBackingStoreParse(ctxt, backingStore) < 0)
+    if (virDomainDiskSourceParse(source, backingStore) < 0 ||
+        virDomainDiskBackingStoreParse(cur, backingStore) < 0)
         goto cleanup;
 
     src->backingStore = backingStore;
@@ -5789,7 +5828,6 @@ virDomainDiskBackingStoreParse(xmlXPathContextPtr ctxt,
         virStorageSourceFree(backingStore);
     VIR_FREE(type);
     VIR_FREE(format);
-    ctxt->node = save_ctxt;
     return ret;
 }
 
@@ -5887,7 +5925,7 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                 xmlStrEqual(cur->name, BAD_CAST "source")) {
                 sourceNode = cur;
 
-                if (virDomainDiskSourceParse(cur, ctxt, def->src) < 0)
+                if (virDomainDiskSourceParse(cur, def->src) < 0)
                     goto error;
                 source = def->src->path;
 
@@ -5913,20 +5951,17 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                     STRPREFIX(target, "ioemu:"))
                     memmove(target, target+6, strlen(target)-5);
             } else if (xmlStrEqual(cur->name, BAD_CAST "geometry")) {
-                if (virXPathUInt("string(./geometry/@cyls)",
-                                 ctxt, &def->geometry.cylinders) < 0) {
+                if (virXMLPropUInt(cur, "cyls", &def->geometry.cylinders) < 0) {
                     virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                                    _("invalid geometry settings (cyls)"));
                     goto error;
                 }
-                if (virXPathUInt("string(./geometry/@heads)",
-                                 ctxt, &def->geometry.heads) < 0) {
+                if (virXMLPropUInt(cur, "heads", &def->geometry.heads) < 0) {
                     virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                                    _("invalid geometry settings (heads)"));
                     goto error;
                 }
-                if (virXPathUInt("string(./geometry/@secs)",
-                                 ctxt, &def->geometry.sectors) < 0) {
+                if (virXMLPropUInt(cur, "secs", &def->geometry.sectors) < 0) {
                     virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                                    _("invalid geometry settings (secs)"));
                     goto error;
@@ -6014,8 +6049,7 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                                          "type '%s'"), mirrorType);
                         goto error;
                     }
-                    mirrorFormat = virXPathString("string(./mirror/format/@type)",
-                                                  ctxt);
+                    mirrorFormat = virXMLChildPropString(cur, "format", "type");
                 } else {
                     /* For back-compat reasons, we handle a file name
                      * encoded as attributes, even though we prefer
@@ -6048,13 +6082,12 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                 if (mirrorType) {
                     xmlNodePtr mirrorNode;
 
-                    if (!(mirrorNode = virXPathNode("./mirror/source", ctxt))) {
+                    if (!(mirrorNode = virXMLChildElement(cur, "source"))) {
                         virReportError(VIR_ERR_XML_ERROR, "%s",
                                        _("mirror requires source element"));
                         goto error;
                     }
-                    if (virDomainDiskSourceParse(mirrorNode, ctxt,
-                                                 def->mirror) < 0)
+                    if (virDomainDiskSourceParse(mirrorNode, def->mirror) < 0)
                         goto error;
                 }
                 ready = virXMLPropString(cur, "ready");
@@ -6081,9 +6114,8 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                     goto error;
                 }
             } else if (xmlStrEqual(cur->name, BAD_CAST "iotune")) {
-                ret = virXPathULongLong("string(./iotune/total_bytes_sec)",
-                                        ctxt,
-                                        &def->blkdeviotune.total_bytes_sec);
+                ret = virXMLChildULongLong(cur, "total_bytes_sec",
+                                           &def->blkdeviotune.total_bytes_sec);
                 if (ret == -2) {
                     virReportError(VIR_ERR_XML_ERROR, "%s",
                                    _("total throughput limit must be an integer"));
@@ -6092,9 +6124,8 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                     def->blkdeviotune.total_bytes_sec = 0;
                 }
 
-                ret = virXPathULongLong("string(./iotune/read_bytes_sec)",
-                                        ctxt,
-                                        &def->blkdeviotune.read_bytes_sec);
+                ret = virXMLChildULongLong(cur, "read_bytes_sec",
+                                           &def->blkdeviotune.read_bytes_sec);
                 if (ret == -2) {
                     virReportError(VIR_ERR_XML_ERROR, "%s",
                                    _("read throughput limit must be an integer"));
@@ -6103,9 +6134,8 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                     def->blkdeviotune.read_bytes_sec = 0;
                 }
 
-                ret = virXPathULongLong("string(./iotune/write_bytes_sec)",
-                                        ctxt,
-                                        &def->blkdeviotune.write_bytes_sec);
+                ret = virXMLChildULongLong(cur, "write_bytes_sec",
+                                           &def->blkdeviotune.write_bytes_sec);
                 if (ret == -2) {
                     virReportError(VIR_ERR_XML_ERROR, "%s",
                                    _("write throughput limit must be an integer"));
@@ -6114,9 +6144,8 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                     def->blkdeviotune.write_bytes_sec = 0;
                 }
 
-                ret = virXPathULongLong("string(./iotune/total_iops_sec)",
-                                        ctxt,
-                                        &def->blkdeviotune.total_iops_sec);
+                ret = virXMLChildULongLong(cur, "total_iops_sec",
+                                           &def->blkdeviotune.total_iops_sec);
                 if (ret == -2) {
                     virReportError(VIR_ERR_XML_ERROR, "%s",
                                    _("total I/O operations limit must be an integer"));
@@ -6125,9 +6154,8 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                     def->blkdeviotune.total_iops_sec = 0;
                 }
 
-                ret = virXPathULongLong("string(./iotune/read_iops_sec)",
-                                        ctxt,
-                                        &def->blkdeviotune.read_iops_sec);
+                ret = virXMLChildULongLong(cur, "read_iops_sec",
+                                           &def->blkdeviotune.read_iops_sec);
                 if (ret == -2) {
                     virReportError(VIR_ERR_XML_ERROR, "%s",
                                    _("read I/O operations limit must be an integer"));
@@ -6136,9 +6164,8 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                     def->blkdeviotune.read_iops_sec = 0;
                 }
 
-                ret = virXPathULongLong("string(./iotune/write_iops_sec)",
-                                        ctxt,
-                                        &def->blkdeviotune.write_iops_sec);
+                ret = virXMLChildULongLong(cur, "write_iops_sec",
+                                           &def->blkdeviotune.write_iops_sec);
                 if (ret == -2) {
                     virReportError(VIR_ERR_XML_ERROR, "%s",
                                    _("write I/O operations limit must be an integer"));
@@ -6147,45 +6174,38 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                     def->blkdeviotune.write_iops_sec = 0;
                 }
 
-                if (virXPathULongLong("string(./iotune/total_bytes_sec_max)",
-                                      ctxt,
-                                      &def->blkdeviotune.total_bytes_sec_max) < 0) {
+                if (virXMLChildULongLong(cur, "total_bytes_sec_max",
+                                         &def->blkdeviotune.total_bytes_sec_max) < 0) {
                     def->blkdeviotune.total_bytes_sec_max = 0;
                 }
 
-                if (virXPathULongLong("string(./iotune/read_bytes_sec_max)",
-                                      ctxt,
-                                      &def->blkdeviotune.read_bytes_sec_max) < 0) {
+                if (virXMLChildULongLong(cur, "read_bytes_sec_max",
+                                         &def->blkdeviotune.read_bytes_sec_max) < 0) {
                     def->blkdeviotune.read_bytes_sec_max = 0;
                 }
 
-                if (virXPathULongLong("string(./iotune/write_bytes_sec_max)",
-                                      ctxt,
-                                      &def->blkdeviotune.write_bytes_sec_max) < 0) {
+                if (virXMLChildULongLong(cur, "write_bytes_sec_max",
+                                         &def->blkdeviotune.write_bytes_sec_max) < 0) {
                     def->blkdeviotune.write_bytes_sec_max = 0;
                 }
 
-                if (virXPathULongLong("string(./iotune/total_iops_sec_max)",
-                                      ctxt,
-                                      &def->blkdeviotune.total_iops_sec_max) < 0) {
+                if (virXMLChildULongLong(cur, "total_iops_sec_max",
+                                         &def->blkdeviotune.total_iops_sec_max) < 0) {
                     def->blkdeviotune.total_iops_sec_max = 0;
                 }
 
-                if (virXPathULongLong("string(./iotune/read_iops_sec_max)",
-                                      ctxt,
-                                      &def->blkdeviotune.read_iops_sec_max) < 0) {
+                if (virXMLChildULongLong(cur, "read_iops_sec_max",
+                                         &def->blkdeviotune.read_iops_sec_max) < 0) {
                     def->blkdeviotune.read_iops_sec_max = 0;
                 }
 
-                if (virXPathULongLong("string(./iotune/write_iops_sec_max)",
-                                      ctxt,
-                                      &def->blkdeviotune.write_iops_sec_max) < 0) {
+                if (virXMLChildULongLong(cur, "write_iops_sec_max",
+                                         &def->blkdeviotune.write_iops_sec_max) < 0) {
                     def->blkdeviotune.write_iops_sec_max = 0;
                 }
 
-                if (virXPathULongLong("string(./iotune/size_iops_sec)",
-                                      ctxt,
-                                      &def->blkdeviotune.size_iops_sec) < 0) {
+                if (virXMLChildULongLong(cur, "size_iops_sec",
+                                         &def->blkdeviotune.size_iops_sec) < 0) {
                     def->blkdeviotune.size_iops_sec = 0;
                 }
 
@@ -6323,16 +6343,13 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
 
     /* If source is present, check for an optional seclabel override.  */
     if (sourceNode) {
-        xmlNodePtr saved_node = ctxt->node;
-        ctxt->node = sourceNode;
         if (virSecurityDeviceLabelDefParseXML(&def->src->seclabels,
                                               &def->src->nseclabels,
                                               vmSeclabels,
                                               nvmSeclabels,
-                                              ctxt,
+                                              sourceNode,
                                               flags) < 0)
             goto error;
-        ctxt->node = saved_node;
     }
 
     if (!target && !(flags & VIR_DOMAIN_DEF_PARSE_DISK_SOURCE)) {
@@ -6660,7 +6677,7 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
             && virDomainDiskDefAssignAddress(xmlopt, def) < 0)
             goto error;
 
-        if (virDomainDiskBackingStoreParse(ctxt, def->src) < 0)
+        if (virDomainDiskBackingStoreParse(node, def->src) < 0)
             goto error;
     }
 
@@ -7303,7 +7320,7 @@ virDomainActualNetDefParseXML(xmlNodePtr node,
         goto error;
     }
 
-    virtPortNode = virXPathNode("./virtualport", ctxt);
+    virtPortNode = virXMLChildElement(node, "virtualport");
     if (virtPortNode) {
         if (actual->type == VIR_DOMAIN_NET_TYPE_BRIDGE ||
             actual->type == VIR_DOMAIN_NET_TYPE_DIRECT ||
@@ -7326,9 +7343,10 @@ virDomainActualNetDefParseXML(xmlNodePtr node,
     }
 
     if (actual->type == VIR_DOMAIN_NET_TYPE_DIRECT) {
-        actual->data.direct.linkdev = virXPathString("string(./source[1]/@dev)", ctxt);
+        actual->data.direct.linkdev = virXMLChildPropString(node, "source",
+                                                            "dev");
 
-        mode = virXPathString("string(./source[1]/@mode)", ctxt);
+        mode = virXMLChildPropString(node, "source", "mode");
         if (mode) {
             int m;
             if ((m = virNetDevMacVLanModeTypeFromString(mode)) < 0) {
@@ -7360,7 +7378,7 @@ virDomainActualNetDefParseXML(xmlNodePtr node,
             goto error;
         }
     } else if (actual->type == VIR_DOMAIN_NET_TYPE_NETWORK) {
-        char *class_id = virXPathString("string(./class/@id)", ctxt);
+        char *class_id = virXMLChildPropString(node, "class", "id");
         if (class_id &&
             virStrToLong_ui(class_id, NULL, 10, &actual->class_id) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -7373,7 +7391,7 @@ virDomainActualNetDefParseXML(xmlNodePtr node,
     }
     if (actual->type == VIR_DOMAIN_NET_TYPE_BRIDGE ||
         actual->type == VIR_DOMAIN_NET_TYPE_NETWORK) {
-        char *brname = virXPathString("string(./source/@bridge)", ctxt);
+        char *brname = virXMLChildPropString(node, "source", "bridge");
 
         if (!brname && actual->type == VIR_DOMAIN_NET_TYPE_BRIDGE) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -7382,7 +7400,8 @@ virDomainActualNetDefParseXML(xmlNodePtr node,
             goto error;
         }
         actual->data.bridge.brname = brname;
-        macTableManager = virXPathString("string(./source/@macTableManager)", ctxt);
+        macTableManager = virXMLChildPropString(node, "source",
+                                                "macTableManager");
         if (macTableManager &&
             (actual->data.bridge.macTableManager
              = virNetworkBridgeMACTableManagerTypeFromString(macTableManager)) <= 0) {
@@ -7394,14 +7413,14 @@ virDomainActualNetDefParseXML(xmlNodePtr node,
         }
     }
 
-    bandwidth_node = virXPathNode("./bandwidth", ctxt);
+    bandwidth_node = virXMLChildElement(node, "bandwidth");
     if (bandwidth_node &&
         virNetDevBandwidthParse(&actual->bandwidth,
                                 bandwidth_node,
                                 actual->type) < 0)
         goto error;
 
-    vlanNode = virXPathNode("./vlan", ctxt);
+    vlanNode = virXMLChildElement(node, "vlan");
     if (vlanNode && virNetDevVlanParse(vlanNode, ctxt, &actual->vlan) < 0)
        goto error;
 
@@ -7495,6 +7514,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
     virNWFilterHashTablePtr filterparams = NULL;
     virDomainActualNetDefPtr actual = NULL;
     xmlNodePtr oldnode = ctxt->node;
+    xmlNodePtr driverNode = NULL;
     int ret, val;
     size_t i;
     size_t nips = 0;
@@ -7629,6 +7649,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             } else if (xmlStrEqual(cur->name, BAD_CAST "model")) {
                 model = virXMLPropString(cur, "type");
             } else if (xmlStrEqual(cur->name, BAD_CAST "driver")) {
+                if (!driverNode)
+                    driverNode = cur;
                 backend = virXMLPropString(cur, "name");
                 txmode = virXMLPropString(cur, "txmode");
                 ioeventfd = virXMLPropString(cur, "ioeventfd");
@@ -8006,7 +8028,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             }
             def->driver.virtio.queues = q;
         }
-        if ((str = virXPathString("string(./driver/host/@csum)", ctxt))) {
+        if ((str = virXMLChildPropString(driverNode, "host", "csum"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host csum mode '%s'"),
@@ -8016,7 +8038,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.csum = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@gso)", ctxt))) {
+        if ((str = virXMLChildPropString(driverNode, "host", "gso"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host gso mode '%s'"),
@@ -8026,7 +8048,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.gso = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@tso4)", ctxt))) {
+        if ((str = virXMLChildPropString(driverNode, "host", "tso4"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host tso4 mode '%s'"),
@@ -8036,7 +8058,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.tso4 = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@tso6)", ctxt))) {
+        if ((str = virXMLChildPropString(driverNode, "host", "tso6"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host tso6 mode '%s'"),
@@ -8046,7 +8068,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.tso6 = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@ecn)", ctxt))) {
+        if ((str = virXMLChildPropString(driverNode, "host", "ecn"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host ecn mode '%s'"),
@@ -8056,7 +8078,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.ecn = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@ufo)", ctxt))) {
+        if ((str = virXMLChildPropString(driverNode, "host", "ufo"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host ufo mode '%s'"),
@@ -8066,7 +8088,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.ufo = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@mrg_rxbuf)", ctxt))) {
+        if ((str = virXMLChildPropString(driverNode, "host", "mrg_rxbuf"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host mrg_rxbuf mode '%s'"),
@@ -8076,7 +8098,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.mrg_rxbuf = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@csum)", ctxt))) {
+        if ((str = virXMLChildPropString(driverNode, "guest", "csum"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest csum mode '%s'"),
@@ -8086,7 +8108,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.guest.csum = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@tso4)", ctxt))) {
+        if ((str = virXMLChildPropString(driverNode, "guest", "tso4"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest tso4 mode '%s'"),
@@ -8096,7 +8118,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.guest.tso4 = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@tso6)", ctxt))) {
+        if ((str = virXMLChildPropString(driverNode, "guest", "tso6"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest tso6 mode '%s'"),
@@ -8106,7 +8128,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.guest.tso6 = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@ecn)", ctxt))) {
+        if ((str = virXMLChildPropString(driverNode, "guest", "ecn"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest ecn mode '%s'"),
@@ -8116,7 +8138,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.guest.ecn = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@ufo)", ctxt))) {
+        if ((str = virXMLChildPropString(driverNode, "guest", "ufo"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest ufo mode '%s'"),
@@ -8393,7 +8415,6 @@ static int
 virDomainChrSourceDefParseXML(virDomainChrSourceDefPtr def,
                               xmlNodePtr cur, unsigned int flags,
                               virDomainChrDefPtr chr_def,
-                              xmlXPathContextPtr ctxt,
                               virSecurityLabelDefPtr* vmSeclabels,
                               int nvmSeclabels)
 {
@@ -8472,20 +8493,14 @@ virDomainChrSourceDefParseXML(virDomainChrSourceDefPtr def,
                 }
 
                 /* Check for an optional seclabel override in <source/>. */
-                if (chr_def) {
-                    xmlNodePtr saved_node = ctxt->node;
-                    ctxt->node = cur;
-                    if (virSecurityDeviceLabelDefParseXML(&chr_def->seclabels,
-                                                          &chr_def->nseclabels,
-                                                          vmSeclabels,
-                                                          nvmSeclabels,
-                                                          ctxt,
-                                                          flags) < 0) {
-                        ctxt->node = saved_node;
-                        goto error;
-                    }
-                    ctxt->node = saved_node;
-                }
+                if (chr_def &&
+                    virSecurityDeviceLabelDefParseXML(&chr_def->seclabels,
+                                                      &chr_def->nseclabels,
+                                                      vmSeclabels,
+                                                      nvmSeclabels,
+                                                      cur,
+                                                      flags) < 0)
+                    goto error;
             } else if (xmlStrEqual(cur->name, BAD_CAST "protocol")) {
                 if (!protocol)
                     protocol = virXMLPropString(cur, "type");
@@ -8715,8 +8730,7 @@ virDomainChrDefNew(void)
  *
  */
 static virDomainChrDefPtr
-virDomainChrDefParseXML(xmlXPathContextPtr ctxt,
-                        xmlNodePtr node,
+virDomainChrDefParseXML(xmlNodePtr node,
                         virSecurityLabelDefPtr* vmSeclabels,
                         int nvmSeclabels,
                         unsigned int flags)
@@ -8765,7 +8779,7 @@ virDomainChrDefParseXML(xmlXPathContextPtr ctxt,
         goto error;
 
     if (virDomainChrSourceDefParseXML(&def->source, node->children, flags, def,
-                                      ctxt, vmSeclabels, nvmSeclabels) < 0)
+                                      vmSeclabels, nvmSeclabels) < 0)
         goto error;
 
     if (def->source.type == VIR_DOMAIN_CHR_TYPE_SPICEVMC) {
@@ -8897,7 +8911,7 @@ virDomainSmartcardDefParseXML(xmlNodePtr node,
 
         cur = node->children;
         if (virDomainChrSourceDefParseXML(&def->data.passthru, cur, flags,
-                                          NULL, NULL, NULL, 0) < 0)
+                                          NULL, NULL, 0) < 0)
             goto error;
 
         if (def->data.passthru.type == VIR_DOMAIN_CHR_TYPE_SPICEVMC) {
@@ -10255,7 +10269,7 @@ virDomainRNGDefParseXML(xmlNodePtr node,
 
         if (virDomainChrSourceDefParseXML(def->source.chardev,
                                           backends[0]->children, flags,
-                                          NULL, ctxt, NULL, 0) < 0)
+                                          NULL, NULL, 0) < 0)
             goto error;
         break;
 
@@ -10909,7 +10923,7 @@ virDomainRedirdevDefParseXML(xmlNodePtr node,
      * source gets parsed in virDomainChrSourceDefParseXML
      * we don't know any of the elements that might remain */
     remaining = virDomainChrSourceDefParseXML(&def->source.chr, cur, flags,
-                                              NULL, NULL, NULL, 0);
+                                              NULL, NULL, 0);
     if (remaining < 0)
         goto error;
 
@@ -11280,8 +11294,7 @@ virDomainDeviceDefParse(const char *xmlStr,
             goto error;
         break;
     case VIR_DOMAIN_DEVICE_CHR:
-        if (!(dev->data.chr = virDomainChrDefParseXML(ctxt,
-                                                      node,
+        if (!(dev->data.chr = virDomainChrDefParseXML(node,
                                                       def->seclabels,
                                                       def->nseclabels,
                                                       flags)))
@@ -14199,8 +14212,7 @@ virDomainDefParseXML(xmlDocPtr xml,
         goto error;
 
     for (i = 0; i < n; i++) {
-        virDomainChrDefPtr chr = virDomainChrDefParseXML(ctxt,
-                                                         nodes[i],
+        virDomainChrDefPtr chr = virDomainChrDefParseXML(nodes[i],
                                                          def->seclabels,
                                                          def->nseclabels,
                                                          flags);
@@ -14226,8 +14238,7 @@ virDomainDefParseXML(xmlDocPtr xml,
         goto error;
 
     for (i = 0; i < n; i++) {
-        virDomainChrDefPtr chr = virDomainChrDefParseXML(ctxt,
-                                                         nodes[i],
+        virDomainChrDefPtr chr = virDomainChrDefParseXML(nodes[i],
                                                          def->seclabels,
                                                          def->nseclabels,
                                                          flags);
@@ -14255,8 +14266,7 @@ virDomainDefParseXML(xmlDocPtr xml,
         goto error;
 
     for (i = 0; i < n; i++) {
-        virDomainChrDefPtr chr = virDomainChrDefParseXML(ctxt,
-                                                         nodes[i],
+        virDomainChrDefPtr chr = virDomainChrDefParseXML(nodes[i],
                                                          def->seclabels,
                                                          def->nseclabels,
                                                          flags);
@@ -14274,8 +14284,7 @@ virDomainDefParseXML(xmlDocPtr xml,
         goto error;
 
     for (i = 0; i < n; i++) {
-        virDomainChrDefPtr chr = virDomainChrDefParseXML(ctxt,
-                                                         nodes[i],
+        virDomainChrDefPtr chr = virDomainChrDefParseXML(nodes[i],
                                                          def->seclabels,
                                                          def->nseclabels,
                                                          flags);
@@ -20593,10 +20602,12 @@ virDomainDefCompatibleDevice(virDomainDefPtr def,
     return 0;
 }
 
-int
-virDomainSaveXML(const char *configDir,
-                 virDomainDefPtr def,
-                 const char *xml)
+static int
+virDomainSaveXMLFull(virFileWriterPtr writer,
+                     const char *configDir,
+                     virDomainDefPtr def,
+                     const char *xml,
+                     bool deferred)
 {
     char uuidstr[VIR_UUID_STRING_BUFLEN];
     char *configFile = NULL;
@@ -20616,15 +20627,23 @@ virDomainSaveXML(const char *configDir,
     }
 
     virUUIDFormat(def->uuid, uuidstr);
-    ret = virXMLSaveFile(configFile,
-                         virXMLPickShellSafeComment(def->name, uuidstr), "edit",
-                         xml);
+    ret = virXMLSaveFileFull(writer, configFile,
+                             virXMLPickShellSafeComment(def->name, uuidstr),
+                             "edit", xml, deferred);
 
  cleanup:
     VIR_FREE(configFile);
     return ret;
 }
 
+int
+virDomainSaveXML(const char *configDir,
+                 virDomainDefPtr def,
+                 const char *xml)
+{
+    return virDomainSaveXMLFull(NULL, configDir, def, xml, false);
+}
+
 int
 virDomainSaveConfig(const char *configDir,
                     virDomainDefPtr def)
@@ -20644,10 +20663,11 @@ virDomainSaveConfig(const char *configDir,
     return ret;
 }
 
-int
-virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
-                    const char *statusDir,
-                    virDomainObjPtr obj)
+static int
+virDomainSaveStatusFull(virDomainXMLOptionPtr xmlopt,
+                        const char *statusDir,
+                        virDomainObjPtr obj,
+                        bool deferred)
 {
     unsigned int flags = (VIR_DOMAIN_DEF_FORMAT_SECURE |
                           VIR_DOMAIN_DEF_FORMAT_STATUS |
@@ -20661,7 +20681,8 @@ virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
     if (!(xml = virDomainObjFormat(xmlopt, obj, flags)))
         goto cleanup;
 
-    if (virDomainSaveXML(statusDir, obj->def, xml))
+    if (virDomainSaveXMLFull(xmlopt->statusWriter, statusDir,
+                             obj->def, xml, deferred))
         goto cleanup;
 
     ret = 0;
@@ -20670,23 +20691,50 @@ virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
     return ret;
 }
 
+/**
+ * virDomainSaveStatus:
+ *
+ * Synchronously write the live status of @obj to @statusDir. Use this
+ * whenever the status on disk must be up to date before the caller
+ * proceeds, e.g. when entering a new job phase.
+ */
+int
+virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
+                    const char *statusDir,
+                    virDomainObjPtr obj)
+{
+    return virDomainSaveStatusFull(xmlopt, statusDir, obj, false);
+}
 
-static virDomainObjPtr
-virDomainObjListLoadConfig(virDomainObjListPtr doms,
-                           virCapsPtr caps,
-                           virDomainXMLOptionPtr xmlopt,
-                           const char *configDir,
-                           const char *autostartDir,
-                           const char *name,
-                           unsigned int expectedVirtTypes,
-                           virDomainLoadConfigNotify notify,
-                           void *opaque)
+/**
+ * virDomainSaveStatusDeferred:
+ *
+ * Like virDomainSaveStatus(), but if @xmlopt has a status writer the
+ * write is only queued, so that bursts of updates of the same domain
+ * coalesce into a single rewrite of its status file.
+ */
+int
+virDomainSaveStatusDeferred(virDomainXMLOptionPtr xmlopt,
+                            const char *statusDir,
+                            virDomainObjPtr obj)
+{
+    return virDomainSaveStatusFull(xmlopt, statusDir, obj, true);
+}
+
+/* Most threads parsing domain XML files at once while loading */
+#define VIR_DOMAIN_OBJ_LIST_LOAD_WORKERS 8
+
+static virDomainDefPtr
+virDomainObjListParseConfig(virCapsPtr caps,
+                            virDomainXMLOptionPtr xmlopt,
+                            const char *configDir,
+                            const char *autostartDir,
+                            const char *name,
+                            unsigned int expectedVirtTypes,
+                            int *autostart)
 {
     char *configFile = NULL, *autostartLink = NULL;
     virDomainDefPtr def = NULL;
-    virDomainObjPtr dom;
-    int autostart;
-    virDomainDefPtr oldDef = NULL;
 
     if ((configFile = virDomainConfigFile(configDir, name)) == NULL)
         goto error;
@@ -20698,21 +20746,12 @@ virDomainObjListLoadConfig(virDomainObjListPtr doms,
     if ((autostartLink = virDomainConfigFile(autostartDir, name)) == NULL)
         goto error;
 
-    if ((autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
+    if ((*autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
         goto error;
 
-    if (!(dom = virDomainObjListAddLocked(doms, def, xmlopt, 0, &oldDef)))
-        goto error;
-
-    dom->autostart = autostart;
-
-    if (notify)
-        (*notify)(dom, oldDef == NULL, opaque);
-
-    virDomainDefFree(oldDef);
     VIR_FREE(configFile);
     VIR_FREE(autostartLink);
-    return dom;
+    return def;
 
  error:
     VIR_FREE(configFile);
@@ -20722,29 +20761,62 @@ virDomainObjListLoadConfig(virDomainObjListPtr doms,
 }
 
 static virDomainObjPtr
-virDomainObjListLoadStatus(virDomainObjListPtr doms,
-                           const char *statusDir,
-                           const char *name,
-                           virCapsPtr caps,
+virDomainObjListLoadConfig(virDomainObjListPtr doms,
                            virDomainXMLOptionPtr xmlopt,
-                           unsigned int expectedVirtTypes,
+                           virDomainDefPtr def,
+                           int autostart,
                            virDomainLoadConfigNotify notify,
                            void *opaque)
+{
+    virDomainObjPtr dom;
+    virDomainDefPtr oldDef = NULL;
+
+    if (!(dom = virDomainObjListAddLocked(doms, def, xmlopt, 0, &oldDef))) {
+        virDomainDefFree(def);
+        return NULL;
+    }
+
+    dom->autostart = autostart;
+
+    if (notify)
+        (*notify)(dom, oldDef == NULL, opaque);
+
+    virDomainDefFree(oldDef);
+    return dom;
+}
+
+static virDomainObjPtr
+virDomainObjListParseStatus(const char *statusDir,
+                            const char *name,
+                            virCapsPtr caps,
+                            virDomainXMLOptionPtr xmlopt,
+                            unsigned int expectedVirtTypes)
 {
     char *statusFile = NULL;
     virDomainObjPtr obj = NULL;
-    char uuidstr[VIR_UUID_STRING_BUFLEN];
 
     if ((statusFile = virDomainConfigFile(statusDir, name)) == NULL)
-        goto error;
+        return NULL;
 
-    if (!(obj = virDomainObjParseFile(statusFile, caps, xmlopt, expectedVirtTypes,
-                                      VIR_DOMAIN_DEF_PARSE_STATUS |
-                                      VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
-                                      VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
-                                      VIR_DOMAIN_DEF_PARSE_CLOCK_ADJUST)))
-        goto error;
+    obj = virDomainObjParseFile(statusFile, caps, xmlopt, expectedVirtTypes,
+                                VIR_DOMAIN_DEF_PARSE_STATUS |
+                                VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
+                                VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
+                                VIR_DOMAIN_DEF_PARSE_CLOCK_ADJUST);
+
+    VIR_FREE(statusFile);
+    return obj;
+}
 
+static virDomainObjPtr
+virDomainObjListLoadStatus(virDomainObjListPtr doms,
+                           virDomainObjPtr obj,
+                           virDomainLoadConfigNotify notify,
+                           void *opaque)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virObjectLock(obj);
     virUUIDFormat(obj->def->uuid, uuidstr);
 
     if (virHashLookup(doms->objs, uuidstr) != NULL) {
@@ -20760,15 +20832,63 @@ virDomainObjListLoadStatus(virDomainObjListPtr doms,
     if (notify)
         (*notify)(obj, 1, opaque);
 
-    VIR_FREE(statusFile);
     return obj;
 
  error:
+    virObjectUnlock(obj);
     virObjectUnref(obj);
-    VIR_FREE(statusFile);
     return NULL;
 }
 
+
+struct virDomainObjListLoadJob {
+    char *name;
+    virDomainDefPtr def;
+    virDomainObjPtr obj;
+    int autostart;
+};
+
+struct virDomainObjListLoadData {
+    const char *configDir;
+    const char *autostartDir;
+    int liveStatus;
+    virCapsPtr caps;
+    virDomainXMLOptionPtr xmlopt;
+    unsigned int expectedVirtTypes;
+    struct virDomainObjListLoadJob *jobs;
+};
+
+static void
+virDomainObjListParseOne(size_t i,
+                         void *opaque)
+{
+    struct virDomainObjListLoadData *data = opaque;
+    struct virDomainObjListLoadJob *job = &data->jobs[i];
+
+    /* NB: ignoring errors, so one malformed config doesn't
+       kill the whole process */
+    VIR_INFO("Loading config file '%s.xml'", job->name);
+    if (data->liveStatus) {
+        job->obj = virDomainObjListParseStatus(data->configDir,
+                                               job->name,
+                                               data->caps,
+                                               data->xmlopt,
+                                               data->expectedVirtTypes);
+        /* Nobody else knows about it yet. It is locked again
+         * by whoever adds it to the list */
+        if (job->obj)
+            virObjectUnlock(job->obj);
+    } else {
+        job->def = virDomainObjListParseConfig(data->caps,
+                                               data->xmlopt,
+                                               data->configDir,
+                                               data->autostartDir,
+                                               job->name,
+                                               data->expectedVirtTypes,
+                                               &job->autostart);
+    }
+}
+
 int
 virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                const char *configDir,
@@ -20780,8 +20900,16 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                virDomainLoadConfigNotify notify,
                                void *opaque)
 {
+    struct virDomainObjListLoadData data = {
+        configDir, autostartDir, liveStatus, caps, xmlopt,
+        expectedVirtTypes, NULL,
+    };
     DIR *dir;
     struct dirent *entry;
+    size_t njobs = 0;
+    size_t nloaded = 0;
+    unsigned long long start = 0, parsed = 0, done = 0;
+    size_t i;
     int ret = -1;
 
     VIR_INFO("Scanning for configs in %s", configDir);
@@ -20795,48 +20923,75 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
         return -1;
     }
 
-    virObjectLock(doms);
+    ignore_value(virTimeMillisNow(&start));
 
     while ((ret = virDirRead(dir, &entry, configDir)) > 0) {
-        virDomainObjPtr dom;
-
         if (entry->d_name[0] == '.')
             continue;
 
         if (!virFileStripSuffix(entry->d_name, ".xml"))
             continue;
 
-        /* NB: ignoring errors, so one malformed config doesn't
-           kill the whole process */
-        VIR_INFO("Loading config file '%s.xml'", entry->d_name);
-        if (liveStatus)
-            dom = virDomainObjListLoadStatus(doms,
-                                             configDir,
-                                             entry->d_name,
-                                             caps,
-                                             xmlopt,
-                                             expectedVirtTypes,
-                                             notify,
-                                             opaque);
-        else
-            dom = virDomainObjListLoadConfig(doms,
-                                             caps,
-                                             xmlopt,
-                                             configDir,
-                                             autostartDir,
-                                             entry->d_name,
-                                             expectedVirtTypes,
-                                             notify,
-                                             opaque);
+        if (VIR_EXPAND_N(data.jobs, njobs, 1) < 0 ||
+            VIR_STRDUP(data.jobs[njobs - 1].name, entry->d_name) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+
+    closedir(dir);
+    if (ret < 0)
+        goto cleanup;
+
+    /* Parsing is what takes time and needs nothing but the file,
+     * the list is only locked to add the results in directory order.
+     * libxml2 sets up its global state on first use, which must not
+     * happen in several workers at once. */
+    xmlInitParser();
+    virThreadPoolRunBatch(njobs, VIR_DOMAIN_OBJ_LIST_LOAD_WORKERS,
+                          virDomainObjListParseOne, &data);
+    ignore_value(virTimeMillisNow(&parsed));
+
+    virObjectLock(doms);
+    for (i = 0; i < njobs; i++) {
+        struct virDomainObjListLoadJob *job = &data.jobs[i];
+        virDomainObjPtr dom;
+
+        if (liveStatus) {
+            if (!job->obj)
+                continue;
+            dom = virDomainObjListLoadStatus(doms, job->obj, notify, opaque);
+            job->obj = NULL;
+        } else {
+            if (!job->def)
+                continue;
+            dom = virDomainObjListLoadConfig(doms, xmlopt, job->def,
+                                             job->autostart, notify, opaque);
+            job->def = NULL;
+        }
+
         if (dom) {
             if (!liveStatus)
                 dom->persistent = 1;
             virObjectUnlock(dom);
+            nloaded++;
         }
     }
-
-    closedir(dir);
     virObjectUnlock(doms);
+    ignore_value(virTimeMillisNow(&done));
+
+    VIR_INFO("Loaded %zu of %zu configs from %s in %llu ms "
+             "(parsing %llu ms, adding %llu ms)",
+             nloaded, njobs, configDir, done - start,
+             parsed - start, done - parsed);
+
+ cleanup:
+    for (i = 0; i < njobs; i++) {
+        VIR_FREE(data.jobs[i].name);
+        virDomainDefFree(data.jobs[i].def);
+        virObjectUnref(data.jobs[i].obj);
+    }
+    VIR_FREE(data.jobs);
     return ret;
 }
 
@@ -50,6 +50,7 @@
 # include "virbitmap.h"
 # include "virstoragefile.h"
 # include "virseclabel.h"
+# include "virfilewriter.h"
 
 /* forward declarations of all device types, required by
  * virDomainDeviceDef
@@ -2308,6 +2309,10 @@ virDomainXMLNamespacePtr
 virDomainXMLOptionGetNamespace(virDomainXMLOptionPtr xmlopt)
     ATTRIBUTE_NONNULL(1);
 
+void virDomainXMLOptionSetStatusWriter(virDomainXMLOptionPtr xmlopt,
+                                       virFileWriterPtr writer)
+    ATTRIBUTE_NONNULL(1);
+
 int
 virDomainDefPostParse(virDomainDefPtr def,
                       virCapsPtr caps,
@@ -2591,7 +2596,6 @@ virDomainDiskRemove(virDomainDefPtr def, size_t i);
 virDomainDiskDefPtr
 virDomainDiskRemoveByName(virDomainDefPtr def, const char *name);
 int virDomainDiskSourceParse(xmlNodePtr node,
-                             xmlXPathContextPtr ctxt,
                              virStorageSourcePtr src);
 
 bool virDomainHasDiskMirror(virDomainObjPtr vm);
@@ -2704,6 +2708,9 @@ int virDomainSaveConfig(const char *configDir,
 int virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
                         const char *statusDir,
                         virDomainObjPtr obj) ATTRIBUTE_RETURN_CHECK;
+int virDomainSaveStatusDeferred(virDomainXMLOptionPtr xmlopt,
+                                const char *statusDir,
+                                virDomainObjPtr obj) ATTRIBUTE_RETURN_CHECK;
 
 typedef void (*virDomainLoadConfigNotify)(virDomainObjPtr dom,
                                           int newDomain,
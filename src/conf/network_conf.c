@@ -148,12 +148,25 @@ virNetworkDHCPHostDefClear(virNetworkDHCPHostDefPtr def)
     VIR_FREE(def->name);
 }
 
+static void
+virNetworkIpDefHostsIndexFree(virNetworkIpDefPtr def)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_NETWORK_DHCP_HOST_KEY_LAST; i++) {
+        virHashFree(def->hostsIndex[i]);
+        def->hostsIndex[i] = NULL;
+    }
+}
+
 static void
 virNetworkIpDefClear(virNetworkIpDefPtr def)
 {
     VIR_FREE(def->family);
     VIR_FREE(def->ranges);
 
+    virNetworkIpDefHostsIndexFree(def);
+
     while (def->nhosts)
         virNetworkDHCPHostDefClear(&def->hosts[--def->nhosts]);
 
@@ -3286,6 +3299,256 @@ virNetworkDefUpdateCheckMultiDHCP(virNetworkDefPtr def,
 }
 
 
+typedef struct _virNetworkDHCPHostIndexEntry virNetworkDHCPHostIndexEntry;
+typedef virNetworkDHCPHostIndexEntry *virNetworkDHCPHostIndexEntryPtr;
+struct _virNetworkDHCPHostIndexEntry {
+    size_t first;               /* index of the first host with the key */
+    size_t count;               /* number of hosts with the key */
+};
+
+/*
+ * Format the key of type @which of @host into @key, which is set to
+ * NULL if @host doesn't have the attribute.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+virNetworkDHCPHostDefKey(virNetworkDHCPHostDefPtr host,
+                         virNetworkDHCPHostKey which,
+                         char **key)
+{
+    virMacAddr addr;
+
+    *key = NULL;
+
+    switch (which) {
+    case VIR_NETWORK_DHCP_HOST_KEY_MAC:
+        if (!host->mac || virMacAddrParse(host->mac, &addr) < 0)
+            return 0;
+        if (VIR_ALLOC_N(*key, VIR_MAC_STRING_BUFLEN) < 0)
+            return -1;
+        virMacAddrFormat(&addr, *key);
+        return 0;
+
+    case VIR_NETWORK_DHCP_HOST_KEY_IP:
+        if (!VIR_SOCKET_ADDR_VALID(&host->ip))
+            return 0;
+        return (*key = virSocketAddrFormat(&host->ip)) ? 0 : -1;
+
+    case VIR_NETWORK_DHCP_HOST_KEY_NAME:
+        return VIR_STRDUP(*key, host->name) < 0 ? -1 : 0;
+
+    case VIR_NETWORK_DHCP_HOST_KEY_LAST:
+        break;
+    }
+
+    return 0;
+}
+
+/* Record the keys of @ipdef->hosts[@idx] in the index, if it's built */
+static int
+virNetworkIpDefHostsIndexAdd(virNetworkIpDefPtr ipdef,
+                             size_t idx)
+{
+    virNetworkDHCPHostIndexEntryPtr entry;
+    char *key = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (!ipdef->hostsIndex[0])
+        return 0;
+
+    for (i = 0; i < VIR_NETWORK_DHCP_HOST_KEY_LAST; i++) {
+        if (virNetworkDHCPHostDefKey(&ipdef->hosts[idx], i, &key) < 0)
+            goto cleanup;
+        if (!key)
+            continue;
+
+        if ((entry = virHashLookup(ipdef->hostsIndex[i], key))) {
+            entry->count++;
+            if (idx < entry->first)
+                entry->first = idx;
+        } else {
+            if (VIR_ALLOC(entry) < 0)
+                goto cleanup;
+            entry->first = idx;
+            entry->count = 1;
+            if (virHashAddEntry(ipdef->hostsIndex[i], key, entry) < 0) {
+                VIR_FREE(entry);
+                goto cleanup;
+            }
+        }
+        VIR_FREE(key);
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(key);
+    return ret;
+}
+
+/* Drop the keys of @ipdef->hosts[@idx] from the index, to be called
+ * before the entry is changed or removed */
+static int
+virNetworkIpDefHostsIndexRemove(virNetworkIpDefPtr ipdef,
+                                size_t idx)
+{
+    virNetworkDHCPHostIndexEntryPtr entry;
+    char *key = NULL;
+    char *other = NULL;
+    size_t i, j;
+    int ret = -1;
+
+    if (!ipdef->hostsIndex[0])
+        return 0;
+
+    for (i = 0; i < VIR_NETWORK_DHCP_HOST_KEY_LAST; i++) {
+        if (virNetworkDHCPHostDefKey(&ipdef->hosts[idx], i, &key) < 0)
+            goto cleanup;
+        if (!key || !(entry = virHashLookup(ipdef->hostsIndex[i], key))) {
+            VIR_FREE(key);
+            continue;
+        }
+
+        if (--entry->count == 0) {
+            if (virHashRemoveEntry(ipdef->hostsIndex[i], key) < 0)
+                goto cleanup;
+        } else if (entry->first == idx) {
+            /* only hosts sharing a key with another one get here */
+            for (j = idx + 1; j < ipdef->nhosts; j++) {
+                if (virNetworkDHCPHostDefKey(&ipdef->hosts[j], i, &other) < 0)
+                    goto cleanup;
+                if (STREQ_NULLABLE(key, other))
+                    break;
+                VIR_FREE(other);
+            }
+            VIR_FREE(other);
+            entry->first = j;
+        }
+        VIR_FREE(key);
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(key);
+    VIR_FREE(other);
+    return ret;
+}
+
+struct virNetworkIpDefHostsIndexShiftData {
+    size_t from;
+    bool insert;
+};
+
+static void
+virNetworkIpDefHostsIndexShiftOne(void *payload,
+                                  const void *name ATTRIBUTE_UNUSED,
+                                  void *opaque)
+{
+    virNetworkDHCPHostIndexEntryPtr entry = payload;
+    struct virNetworkIpDefHostsIndexShiftData *data = opaque;
+
+    if (entry->first < data->from)
+        return;
+
+    if (data->insert)
+        entry->first++;
+    else
+        entry->first--;
+}
+
+/* Account for a host inserted at, or removed from before, @from */
+static void
+virNetworkIpDefHostsIndexShift(virNetworkIpDefPtr ipdef,
+                               size_t from,
+                               bool insert)
+{
+    struct virNetworkIpDefHostsIndexShiftData data = { from, insert };
+    size_t i;
+
+    if (!ipdef->hostsIndex[0])
+        return;
+
+    for (i = 0; i < VIR_NETWORK_DHCP_HOST_KEY_LAST; i++)
+        virHashForEach(ipdef->hostsIndex[i],
+                       virNetworkIpDefHostsIndexShiftOne, &data);
+}
+
+static int
+virNetworkIpDefHostsIndexBuild(virNetworkIpDefPtr ipdef)
+{
+    size_t i;
+
+    if (ipdef->hostsIndex[0])
+        return 0;
+
+    for (i = 0; i < VIR_NETWORK_DHCP_HOST_KEY_LAST; i++) {
+        if (!(ipdef->hostsIndex[i] = virHashCreate(ipdef->nhosts,
+                                                   virHashValueFree)))
+            goto error;
+    }
+
+    for (i = 0; i < ipdef->nhosts; i++) {
+        if (virNetworkIpDefHostsIndexAdd(ipdef, i) < 0)
+            goto error;
+    }
+
+    return 0;
+
+ error:
+    virNetworkIpDefHostsIndexFree(ipdef);
+    return -1;
+}
+
+/*
+ * virNetworkIpDefHostsIndexFind:
+ *
+ * Look up the first entry of @ipdef->hosts with the same MAC, IP and
+ * name as @host, storing its index (or -1) into @bymac, @byip and
+ * @byname respectively. Attributes @host doesn't have are never found.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+virNetworkIpDefHostsIndexFind(virNetworkIpDefPtr ipdef,
+                              virNetworkDHCPHostDefPtr host,
+                              ssize_t *bymac,
+                              ssize_t *byip,
+                              ssize_t *byname)
+{
+    ssize_t *found[VIR_NETWORK_DHCP_HOST_KEY_LAST] = { bymac, byip, byname };
+    virNetworkDHCPHostIndexEntryPtr entry;
+    char *key = NULL;
+    size_t i;
+
+    if (virNetworkIpDefHostsIndexBuild(ipdef) < 0)
+        return -1;
+
+    for (i = 0; i < VIR_NETWORK_DHCP_HOST_KEY_LAST; i++) {
+        *found[i] = -1;
+        if (virNetworkDHCPHostDefKey(host, i, &key) < 0)
+            return -1;
+        if (key && (entry = virHashLookup(ipdef->hostsIndex[i], key)))
+            *found[i] = entry->first;
+        VIR_FREE(key);
+    }
+
+    return 0;
+}
+
+/* all attributes specified in @host must match those of @entry */
+static bool
+virNetworkDHCPHostDefMatchPartial(virNetworkDHCPHostDefPtr host,
+                                  virNetworkDHCPHostDefPtr entry)
+{
+    return (!host->mac || !entry->mac ||
+            !virMacAddrCompare(host->mac, entry->mac)) &&
+        (!host->name || STREQ_NULLABLE(host->name, entry->name)) &&
+        (!VIR_SOCKET_ADDR_VALID(&host->ip) ||
+         virSocketAddrEqual(&host->ip, &entry->ip));
+}
+
+
 static int
 virNetworkDefUpdateIPDHCPHost(virNetworkDefPtr def,
                               unsigned int command,
@@ -3298,6 +3561,7 @@ virNetworkDefUpdateIPDHCPHost(virNetworkDefPtr def,
     int ret = -1;
     virNetworkIpDefPtr ipdef = virNetworkIpDefByIndex(def, parentIndex);
     virNetworkDHCPHostDef host;
+    ssize_t bymac, byip, byname;
     bool partialOkay = (command == VIR_NETWORK_UPDATE_COMMAND_DELETE);
 
     memset(&host, 0, sizeof(host));
@@ -3313,20 +3577,20 @@ virNetworkDefUpdateIPDHCPHost(virNetworkDefPtr def,
                                       &host, partialOkay) < 0)
         goto cleanup;
 
+    if (virNetworkIpDefHostsIndexFind(ipdef, &host, &bymac, &byip, &byname) < 0)
+        goto cleanup;
+
     if (command == VIR_NETWORK_UPDATE_COMMAND_MODIFY) {
 
-        /* search for the entry with this (ip|mac|name),
+        /* search for the first entry with this (ip|mac|name),
          * and update the IP+(mac|name) */
-        for (i = 0; i < ipdef->nhosts; i++) {
-            if ((host.mac && ipdef->hosts[i].mac &&
-                 !virMacAddrCompare(host.mac, ipdef->hosts[i].mac)) ||
-                (VIR_SOCKET_ADDR_VALID(&host.ip) &&
-                 virSocketAddrEqual(&host.ip, &ipdef->hosts[i].ip)) ||
-                (host.name &&
-                 STREQ_NULLABLE(host.name, ipdef->hosts[i].name))) {
-                break;
-            }
-        }
+        i = ipdef->nhosts;
+        if (bymac >= 0)
+            i = bymac;
+        if (byip >= 0 && (size_t)byip < i)
+            i = byip;
+        if (byname >= 0 && (size_t)byname < i)
+            i = byname;
 
         if (i == ipdef->nhosts) {
             char *ip = virSocketAddrFormat(&host.ip);
@@ -3344,9 +3608,13 @@ virNetworkDefUpdateIPDHCPHost(virNetworkDefPtr def,
          * then clear out the extra copy to get rid of the duplicate pointers
          * to its data (mac and name strings).
          */
+        if (virNetworkIpDefHostsIndexRemove(ipdef, i) < 0)
+            virNetworkIpDefHostsIndexFree(ipdef);
         virNetworkDHCPHostDefClear(&ipdef->hosts[i]);
         ipdef->hosts[i] = host;
         memset(&host, 0, sizeof(host));
+        if (virNetworkIpDefHostsIndexAdd(ipdef, i) < 0)
+            virNetworkIpDefHostsIndexFree(ipdef);
 
     } else if ((command == VIR_NETWORK_UPDATE_COMMAND_ADD_FIRST) ||
                (command == VIR_NETWORK_UPDATE_COMMAND_ADD_LAST)) {
@@ -3355,44 +3623,48 @@ virNetworkDefUpdateIPDHCPHost(virNetworkDefPtr def,
             goto cleanup;
 
         /* log error if an entry with same name/address/ip already exists */
-        for (i = 0; i < ipdef->nhosts; i++) {
-            if ((host.mac && ipdef->hosts[i].mac &&
-                 !virMacAddrCompare(host.mac, ipdef->hosts[i].mac)) ||
-                (host.name &&
-                 STREQ_NULLABLE(host.name, ipdef->hosts[i].name)) ||
-                (VIR_SOCKET_ADDR_VALID(&host.ip) &&
-                 virSocketAddrEqual(&host.ip, &ipdef->hosts[i].ip))) {
-                char *ip = virSocketAddrFormat(&host.ip);
+        if (bymac >= 0 || byip >= 0 || byname >= 0) {
+            char *ip = virSocketAddrFormat(&host.ip);
 
-                virReportError(VIR_ERR_OPERATION_INVALID,
-                               _("there is an existing dhcp host entry in "
-                                 "network '%s' that matches "
-                                 "\"<host mac='%s' name='%s' ip='%s'/>\""),
-                               def->name, host.mac ? host.mac : _("unknown"),
-                               host.name, ip ? ip : _("unknown"));
-                VIR_FREE(ip);
-                goto cleanup;
-            }
+            virReportError(VIR_ERR_OPERATION_INVALID,
+                           _("there is an existing dhcp host entry in "
+                             "network '%s' that matches "
+                             "\"<host mac='%s' name='%s' ip='%s'/>\""),
+                           def->name, host.mac ? host.mac : _("unknown"),
+                           host.name, ip ? ip : _("unknown"));
+            VIR_FREE(ip);
+            goto cleanup;
         }
 
         /* add to beginning/end of list */
-        if (VIR_INSERT_ELEMENT(ipdef->hosts,
-                               command == VIR_NETWORK_UPDATE_COMMAND_ADD_FIRST
-                               ? 0 : ipdef->nhosts,
-                               ipdef->nhosts, host) < 0)
-            goto cleanup;
+        if (command == VIR_NETWORK_UPDATE_COMMAND_ADD_FIRST) {
+            if (VIR_INSERT_ELEMENT(ipdef->hosts, 0, ipdef->nhosts, host) < 0)
+                goto cleanup;
+            i = 0;
+            virNetworkIpDefHostsIndexShift(ipdef, 0, true);
+        } else {
+            if (VIR_APPEND_ELEMENT(ipdef->hosts, ipdef->nhosts, host) < 0)
+                goto cleanup;
+            i = ipdef->nhosts - 1;
+        }
+        if (virNetworkIpDefHostsIndexAdd(ipdef, i) < 0)
+            virNetworkIpDefHostsIndexFree(ipdef);
     } else if (command == VIR_NETWORK_UPDATE_COMMAND_DELETE) {
 
-        /* find matching entry - all specified attributes must match */
-        for (i = 0; i < ipdef->nhosts; i++) {
-            if ((!host.mac || !ipdef->hosts[i].mac ||
-                 !virMacAddrCompare(host.mac, ipdef->hosts[i].mac)) &&
-                (!host.name ||
-                 STREQ_NULLABLE(host.name, ipdef->hosts[i].name)) &&
-                (!VIR_SOCKET_ADDR_VALID(&host.ip) ||
-                 virSocketAddrEqual(&host.ip, &ipdef->hosts[i].ip))) {
+        /* find matching entry - all specified attributes must match.
+         * Entries without a MAC match any MAC, but when the IP or name
+         * is given no entry before the first one carrying it can match.
+         */
+        size_t start = 0;
+
+        if (VIR_SOCKET_ADDR_VALID(&host.ip))
+            start = byip >= 0 ? byip : ipdef->nhosts;
+        else if (host.name)
+            start = byname >= 0 ? byname : ipdef->nhosts;
+
+        for (i = start; i < ipdef->nhosts; i++) {
+            if (virNetworkDHCPHostDefMatchPartial(&host, &ipdef->hosts[i]))
                 break;
-            }
         }
         if (i == ipdef->nhosts) {
             virReportError(VIR_ERR_OPERATION_INVALID,
@@ -3402,8 +3674,11 @@ virNetworkDefUpdateIPDHCPHost(virNetworkDefPtr def,
         }
 
         /* remove it */
+        if (virNetworkIpDefHostsIndexRemove(ipdef, i) < 0)
+            virNetworkIpDefHostsIndexFree(ipdef);
         virNetworkDHCPHostDefClear(&ipdef->hosts[i]);
         VIR_DELETE_ELEMENT(ipdef->hosts, i, ipdef->nhosts);
+        virNetworkIpDefHostsIndexShift(ipdef, i + 1, false);
 
     } else {
         virNetworkDefUpdateUnknownCommand(command);
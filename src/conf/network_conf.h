@@ -39,6 +39,7 @@
 # include "virmacaddr.h"
 # include "device_conf.h"
 # include "virbitmap.h"
+# include "virhash.h"
 # include "networkcommon_conf.h"
 
 typedef enum {
@@ -137,6 +138,14 @@ struct _virNetworkDNSDef {
     char **forwarders;
 };
 
+typedef enum {
+    VIR_NETWORK_DHCP_HOST_KEY_MAC,
+    VIR_NETWORK_DHCP_HOST_KEY_IP,
+    VIR_NETWORK_DHCP_HOST_KEY_NAME,
+
+    VIR_NETWORK_DHCP_HOST_KEY_LAST
+} virNetworkDHCPHostKey;
+
 typedef struct _virNetworkIpDef virNetworkIpDef;
 typedef virNetworkIpDef *virNetworkIpDefPtr;
 struct _virNetworkIpDef {
@@ -158,6 +167,10 @@ struct _virNetworkIpDef {
     size_t nhosts;              /* Zero or more dhcp hosts */
     virNetworkDHCPHostDefPtr hosts;
 
+    /* Lookup tables over @hosts keyed by canonical MAC, IP and name,
+     * built on demand and kept up to date by updates afterwards. */
+    virHashTablePtr hostsIndex[VIR_NETWORK_DHCP_HOST_KEY_LAST];
+
     char *tftproot;
     char *bootfile;
     virSocketAddr bootserver;
@@ -78,6 +78,43 @@ struct _virDomainSnapshotObjList {
     virDomainSnapshotObj metaroot; /* Special parent of all root snapshots */
 };
 
+/* Domain definition shared by the snapshots of a store */
+typedef struct _virDomainSnapshotSharedDom virDomainSnapshotSharedDom;
+typedef virDomainSnapshotSharedDom *virDomainSnapshotSharedDomPtr;
+struct _virDomainSnapshotSharedDom {
+    virObject parent;
+
+    virDomainDefPtr def;
+};
+
+static virClassPtr virDomainSnapshotSharedDomClass;
+static void virDomainSnapshotSharedDomDispose(void *obj);
+
+static int virDomainSnapshotOnceInit(void)
+{
+    virDomainSnapshotSharedDomClass =
+        virClassNew(virClassForObject(),
+                    "virDomainSnapshotSharedDom",
+                    sizeof(virDomainSnapshotSharedDom),
+                    virDomainSnapshotSharedDomDispose);
+    if (!virDomainSnapshotSharedDomClass)
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virDomainSnapshot)
+
+
+static void
+virDomainSnapshotSharedDomDispose(void *obj)
+{
+    virDomainSnapshotSharedDomPtr shared = obj;
+
+    virDomainDefFree(shared->def);
+}
+
+
 /* Snapshot Def functions */
 static void
 virDomainSnapshotDiskDefClear(virDomainSnapshotDiskDefPtr disk)
@@ -101,13 +138,15 @@ void virDomainSnapshotDefFree(virDomainSnapshotDefPtr def)
     for (i = 0; i < def->ndisks; i++)
         virDomainSnapshotDiskDefClear(&def->disks[i]);
     VIR_FREE(def->disks);
-    virDomainDefFree(def->dom);
+    if (def->domShared)
+        virObjectUnref(def->domShared);
+    else
+        virDomainDefFree(def->dom);
     VIR_FREE(def);
 }
 
 static int
 virDomainSnapshotDiskDefParseXML(xmlNodePtr node,
-                                 xmlXPathContextPtr ctxt,
                                  virDomainSnapshotDiskDefPtr def)
 {
     int ret = -1;
@@ -155,7 +194,7 @@ virDomainSnapshotDiskDefParseXML(xmlNodePtr node,
         if (!def->src->path &&
             xmlStrEqual(cur->name, BAD_CAST "source")) {
 
-            if (virDomainDiskSourceParse(cur, ctxt, def->src) < 0)
+            if (virDomainDiskSourceParse(cur, def->src) < 0)
                 goto cleanup;
 
         } else if (!def->src->format &&
@@ -203,13 +242,17 @@ virDomainSnapshotDiskDefParseXML(xmlNodePtr node,
 /* flags is bitwise-or of virDomainSnapshotParseFlags.
  * If flags does not include VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE, then
  * caps and expectedVirtTypes are ignored.
+ * If @domdefs is not NULL, <domain ref='N'/> shares the already parsed
+ * @domdefs[N] instead of getting a domain definition of its own.
  */
 static virDomainSnapshotDefPtr
 virDomainSnapshotDefParse(xmlXPathContextPtr ctxt,
                           virCapsPtr caps,
                           virDomainXMLOptionPtr xmlopt,
                           unsigned int expectedVirtTypes,
-                          unsigned int flags)
+                          unsigned int flags,
+                          virDomainSnapshotSharedDomPtr *domdefs,
+                          size_t ndomdefs)
 {
     virDomainSnapshotDefPtr def = NULL;
     virDomainSnapshotDefPtr ret = NULL;
@@ -222,6 +265,7 @@ virDomainSnapshotDefParse(xmlXPathContextPtr ctxt,
     char *tmp;
     char *memorySnapshot = NULL;
     char *memoryFile = NULL;
+    char *ref = NULL;
     bool offline = !!(flags & VIR_DOMAIN_SNAPSHOT_PARSE_OFFLINE);
 
     if (VIR_ALLOC(def) < 0)
@@ -275,7 +319,19 @@ virDomainSnapshotDefParse(xmlXPathContextPtr ctxt,
          * lack domain/@type.  In that case, leave dom NULL, and
          * clients will have to decide between best effort
          * initialization or outright failure.  */
-        if ((tmp = virXPathString("string(./domain/@type)", ctxt))) {
+        if (domdefs &&
+            (ref = virXPathString("string(./domain/@ref)", ctxt))) {
+            unsigned int n;
+
+            if (virStrToLong_ui(ref, NULL, 10, &n) < 0 || n >= ndomdefs) {
+                virReportError(VIR_ERR_XML_ERROR,
+                               _("invalid domain definition reference '%s'"),
+                               ref);
+                goto cleanup;
+            }
+            def->domShared = virObjectRef(domdefs[n]);
+            def->dom = domdefs[n]->def;
+        } else if ((tmp = virXPathString("string(./domain/@type)", ctxt))) {
             xmlNodePtr domainNode = virXPathNode("./domain", ctxt);
 
             VIR_FREE(tmp);
@@ -352,7 +408,7 @@ virDomainSnapshotDefParse(xmlXPathContextPtr ctxt,
             goto cleanup;
         def->ndisks = n;
         for (i = 0; i < def->ndisks; i++) {
-            if (virDomainSnapshotDiskDefParseXML(nodes[i], ctxt,
+            if (virDomainSnapshotDiskDefParseXML(nodes[i],
                                                  &def->disks[i]) < 0)
                 goto cleanup;
         }
@@ -380,6 +436,7 @@ virDomainSnapshotDefParse(xmlXPathContextPtr ctxt,
     VIR_FREE(nodes);
     VIR_FREE(memorySnapshot);
     VIR_FREE(memoryFile);
+    VIR_FREE(ref);
     if (ret == NULL)
         virDomainSnapshotDefFree(def);
 
@@ -410,7 +467,7 @@ virDomainSnapshotDefParseNode(xmlDocPtr xml,
 
     ctxt->node = root;
     def = virDomainSnapshotDefParse(ctxt, caps, xmlopt,
-                                    expectedVirtTypes, flags);
+                                    expectedVirtTypes, flags, NULL, 0);
  cleanup:
     xmlXPathFreeContext(ctxt);
     return def;
@@ -669,66 +726,87 @@ virDomainSnapshotDiskDefFormat(virBufferPtr buf,
     virBufferAddLit(buf, "</disk>\n");
 }
 
-char *virDomainSnapshotDefFormat(const char *domain_uuid,
-                                 virDomainSnapshotDefPtr def,
-                                 unsigned int flags,
-                                 int internal)
+/* Formats @def into @buf. If @domainRef is not negative, the domain
+ * definition is not embedded but referenced by its index in the
+ * <domaindefs> of a snapshot store. */
+static int
+virDomainSnapshotDefFormatInternal(virBufferPtr buf,
+                                   const char *domain_uuid,
+                                   virDomainSnapshotDefPtr def,
+                                   unsigned int flags,
+                                   int internal,
+                                   int domainRef)
 {
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
     size_t i;
 
-    virCheckFlags(VIR_DOMAIN_DEF_FORMAT_SECURE |
-                  VIR_DOMAIN_DEF_FORMAT_UPDATE_CPU, NULL);
-
-    flags |= VIR_DOMAIN_DEF_FORMAT_INACTIVE;
-
-    virBufferAddLit(&buf, "<domainsnapshot>\n");
-    virBufferAdjustIndent(&buf, 2);
-    virBufferEscapeString(&buf, "<name>%s</name>\n", def->name);
+    virBufferAddLit(buf, "<domainsnapshot>\n");
+    virBufferAdjustIndent(buf, 2);
+    virBufferEscapeString(buf, "<name>%s</name>\n", def->name);
     if (def->description)
-        virBufferEscapeString(&buf, "<description>%s</description>\n",
+        virBufferEscapeString(buf, "<description>%s</description>\n",
                               def->description);
-    virBufferAsprintf(&buf, "<state>%s</state>\n",
+    virBufferAsprintf(buf, "<state>%s</state>\n",
                       virDomainSnapshotStateTypeToString(def->state));
     if (def->parent) {
-        virBufferAddLit(&buf, "<parent>\n");
-        virBufferAdjustIndent(&buf, 2);
-        virBufferEscapeString(&buf, "<name>%s</name>\n", def->parent);
-        virBufferAdjustIndent(&buf, -2);
-        virBufferAddLit(&buf, "</parent>\n");
+        virBufferAddLit(buf, "<parent>\n");
+        virBufferAdjustIndent(buf, 2);
+        virBufferEscapeString(buf, "<name>%s</name>\n", def->parent);
+        virBufferAdjustIndent(buf, -2);
+        virBufferAddLit(buf, "</parent>\n");
     }
-    virBufferAsprintf(&buf, "<creationTime>%lld</creationTime>\n",
+    virBufferAsprintf(buf, "<creationTime>%lld</creationTime>\n",
                       def->creationTime);
     if (def->memory) {
-        virBufferAsprintf(&buf, "<memory snapshot='%s'",
+        virBufferAsprintf(buf, "<memory snapshot='%s'",
                           virDomainSnapshotLocationTypeToString(def->memory));
-        virBufferEscapeString(&buf, " file='%s'", def->file);
-        virBufferAddLit(&buf, "/>\n");
+        virBufferEscapeString(buf, " file='%s'", def->file);
+        virBufferAddLit(buf, "/>\n");
     }
     if (def->ndisks) {
-        virBufferAddLit(&buf, "<disks>\n");
-        virBufferAdjustIndent(&buf, 2);
+        virBufferAddLit(buf, "<disks>\n");
+        virBufferAdjustIndent(buf, 2);
         for (i = 0; i < def->ndisks; i++)
-            virDomainSnapshotDiskDefFormat(&buf, &def->disks[i]);
-        virBufferAdjustIndent(&buf, -2);
-        virBufferAddLit(&buf, "</disks>\n");
+            virDomainSnapshotDiskDefFormat(buf, &def->disks[i]);
+        virBufferAdjustIndent(buf, -2);
+        virBufferAddLit(buf, "</disks>\n");
     }
-    if (def->dom) {
-        if (virDomainDefFormatInternal(def->dom, flags, &buf) < 0) {
-            virBufferFreeAndReset(&buf);
-            return NULL;
-        }
+    if (domainRef >= 0) {
+        virBufferAsprintf(buf, "<domain ref='%d'/>\n", domainRef);
+    } else if (def->dom) {
+        if (virDomainDefFormatInternal(def->dom, flags, buf) < 0)
+            return -1;
     } else if (domain_uuid) {
-        virBufferAddLit(&buf, "<domain>\n");
-        virBufferAdjustIndent(&buf, 2);
-        virBufferAsprintf(&buf, "<uuid>%s</uuid>\n", domain_uuid);
-        virBufferAdjustIndent(&buf, -2);
-        virBufferAddLit(&buf, "</domain>\n");
+        virBufferAddLit(buf, "<domain>\n");
+        virBufferAdjustIndent(buf, 2);
+        virBufferAsprintf(buf, "<uuid>%s</uuid>\n", domain_uuid);
+        virBufferAdjustIndent(buf, -2);
+        virBufferAddLit(buf, "</domain>\n");
     }
     if (internal)
-        virBufferAsprintf(&buf, "<active>%d</active>\n", def->current);
-    virBufferAdjustIndent(&buf, -2);
-    virBufferAddLit(&buf, "</domainsnapshot>\n");
+        virBufferAsprintf(buf, "<active>%d</active>\n", def->current);
+    virBufferAdjustIndent(buf, -2);
+    virBufferAddLit(buf, "</domainsnapshot>\n");
+
+    return 0;
+}
+
+char *virDomainSnapshotDefFormat(const char *domain_uuid,
+                                 virDomainSnapshotDefPtr def,
+                                 unsigned int flags,
+                                 int internal)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+    virCheckFlags(VIR_DOMAIN_DEF_FORMAT_SECURE |
+                  VIR_DOMAIN_DEF_FORMAT_UPDATE_CPU, NULL);
+
+    flags |= VIR_DOMAIN_DEF_FORMAT_INACTIVE;
+
+    if (virDomainSnapshotDefFormatInternal(&buf, domain_uuid, def, flags,
+                                           internal, -1) < 0) {
+        virBufferFreeAndReset(&buf);
+        return NULL;
+    }
 
     if (virBufferCheckError(&buf) < 0)
         return NULL;
@@ -736,6 +814,372 @@ char *virDomainSnapshotDefFormat(const char *domain_uuid,
     return virBufferContentAndReset(&buf);
 }
 
+
+static int
+virDomainSnapshotDefNameSorter(const void *a, const void *b)
+{
+    const virDomainSnapshotDefPtr *da = a;
+    const virDomainSnapshotDefPtr *db = b;
+
+    return strcmp((*da)->name, (*db)->name);
+}
+
+
+/**
+ * virDomainSnapshotDefListFormat:
+ * @domain_uuid: UUID of the domain the snapshots belong to
+ * @defs: snapshots to store
+ * @ndefs: number of items in @defs
+ * @flags: bitwise-OR of virDomainDefFormatFlags
+ *
+ * Formats the metadata of all @defs as one snapshot store document.
+ * Snapshots are sorted by name and always include their <active>
+ * state. The domain definitions embedded in the snapshots are stored
+ * once in a <domaindefs> section, snapshots with an identical
+ * definition refer to the same entry.
+ *
+ * Returns the XML document, or NULL on error.
+ */
+char *
+virDomainSnapshotDefListFormat(const char *domain_uuid,
+                               virDomainSnapshotDefPtr *defs,
+                               size_t ndefs,
+                               unsigned int flags)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virBuffer snaps = VIR_BUFFER_INITIALIZER;
+    virDomainSnapshotDefPtr *sorted = NULL;
+    virHashTablePtr domains = NULL;
+    char *domxml = NULL;
+    char *snapxml = NULL;
+    size_t ndomains = 0;
+    char *ret = NULL;
+    size_t i;
+
+    virCheckFlags(VIR_DOMAIN_DEF_FORMAT_SECURE |
+                  VIR_DOMAIN_DEF_FORMAT_UPDATE_CPU, NULL);
+
+    flags |= VIR_DOMAIN_DEF_FORMAT_INACTIVE;
+
+    if (VIR_ALLOC_N(sorted, ndefs) < 0 ||
+        !(domains = virHashCreate(ndefs, NULL)))
+        goto cleanup;
+    memcpy(sorted, defs, sizeof(*defs) * ndefs);
+    qsort(sorted, ndefs, sizeof(*sorted), virDomainSnapshotDefNameSorter);
+
+    virBufferAddLit(&buf, "<snapshots version='1'>\n");
+    virBufferAdjustIndent(&buf, 2);
+    virBufferAdjustIndent(&snaps, 2);
+
+    for (i = 0; i < ndefs; i++) {
+        int ref = -1;
+
+        if (sorted[i]->dom) {
+            virBuffer dom = VIR_BUFFER_INITIALIZER;
+            void *id;
+
+            virBufferAdjustIndent(&dom, 6);
+            if (virDomainDefFormatInternal(sorted[i]->dom, flags, &dom) < 0) {
+                virBufferFreeAndReset(&dom);
+                goto cleanup;
+            }
+            if (virBufferCheckError(&dom) < 0)
+                goto cleanup;
+            domxml = virBufferContentAndReset(&dom);
+
+            if ((id = virHashLookup(domains, domxml))) {
+                ref = (intptr_t) id - 1;
+            } else {
+                ref = ndomains++;
+                if (virHashAddEntry(domains, domxml,
+                                    (void *) (intptr_t) (ref + 1)) < 0)
+                    goto cleanup;
+
+                if (ref == 0) {
+                    virBufferAddLit(&buf, "<domaindefs>\n");
+                    virBufferAdjustIndent(&buf, 2);
+                }
+                virBufferAsprintf(&buf, "<domaindef id='%d'>\n", ref);
+                /* @domxml is indented already */
+                virBufferAdjustIndent(&buf, -4);
+                virBufferAdd(&buf, domxml, -1);
+                virBufferAdjustIndent(&buf, 4);
+                virBufferAddLit(&buf, "</domaindef>\n");
+            }
+            VIR_FREE(domxml);
+        }
+
+        if (virDomainSnapshotDefFormatInternal(&snaps, domain_uuid,
+                                               sorted[i], flags, 1, ref) < 0)
+            goto cleanup;
+    }
+
+    if (ndomains) {
+        virBufferAdjustIndent(&buf, -2);
+        virBufferAddLit(&buf, "</domaindefs>\n");
+    }
+
+    if (virBufferCheckError(&snaps) < 0)
+        goto cleanup;
+    snapxml = virBufferContentAndReset(&snaps);
+    /* @snapxml is indented already */
+    virBufferAdjustIndent(&buf, -2);
+    virBufferAdd(&buf, snapxml, -1);
+    virBufferAddLit(&buf, "</snapshots>\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    ret = virBufferContentAndReset(&buf);
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    virBufferFreeAndReset(&snaps);
+    virHashFree(domains);
+    VIR_FREE(domxml);
+    VIR_FREE(snapxml);
+    VIR_FREE(sorted);
+    return ret;
+}
+
+
+struct _virDomainSnapshotStore {
+    xmlDocPtr xml;
+    xmlNodePtr *snapnodes;
+    size_t nsnapnodes;
+    virDomainSnapshotSharedDomPtr *domdefs;
+    size_t ndomdefs;
+};
+
+
+void
+virDomainSnapshotStoreFree(virDomainSnapshotStorePtr store)
+{
+    size_t i;
+
+    if (!store)
+        return;
+
+    for (i = 0; i < store->ndomdefs; i++)
+        virObjectUnref(store->domdefs[i]);
+    VIR_FREE(store->domdefs);
+    VIR_FREE(store->snapnodes);
+    xmlFreeDoc(store->xml);
+    VIR_FREE(store);
+}
+
+
+/**
+ * virDomainSnapshotStoreParseString:
+ * @xmlStr: snapshot store document
+ * @caps: capabilities
+ * @xmlopt: domain XML parser options
+ * @expectedVirtTypes: bitmask of allowed virtualization types
+ *
+ * Parses a document produced by virDomainSnapshotDefListFormat() along
+ * with the domain definitions shared by its snapshots. The snapshots
+ * themselves are parsed by virDomainSnapshotStoreParseDef().
+ *
+ * Returns the store, or NULL on error.
+ */
+virDomainSnapshotStorePtr
+virDomainSnapshotStoreParseString(const char *xmlStr,
+                                  virCapsPtr caps,
+                                  virDomainXMLOptionPtr xmlopt,
+                                  unsigned int expectedVirtTypes)
+{
+    virDomainSnapshotStorePtr store = NULL;
+    virDomainSnapshotStorePtr ret = NULL;
+    xmlXPathContextPtr ctxt = NULL;
+    xmlNodePtr *domnodes = NULL;
+    int ndomnodes;
+    int nsnapnodes;
+    unsigned int version;
+    int keepBlanksDefault;
+    size_t i;
+
+    if (virDomainSnapshotInitialize() < 0 ||
+        VIR_ALLOC(store) < 0)
+        return NULL;
+
+    keepBlanksDefault = xmlKeepBlanksDefault(0);
+    store->xml = virXMLParseStringCtxt(xmlStr, _("(domain_snapshot_store)"),
+                                       &ctxt);
+    xmlKeepBlanksDefault(keepBlanksDefault);
+    if (!store->xml)
+        goto cleanup;
+
+    if (!xmlStrEqual(ctxt->node->name, BAD_CAST "snapshots")) {
+        virReportError(VIR_ERR_XML_ERROR, "%s", _("snapshots"));
+        goto cleanup;
+    }
+
+    if (virXPathUInt("string(./@version)", ctxt, &version) < 0 ||
+        version != 1) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("unsupported snapshot store version"));
+        goto cleanup;
+    }
+
+    if ((ndomnodes = virXPathNodeSet("./domaindefs/domaindef/domain",
+                                     ctxt, &domnodes)) < 0 ||
+        (nsnapnodes = virXPathNodeSet("./domainsnapshot",
+                                      ctxt, &store->snapnodes)) < 0)
+        goto cleanup;
+    store->nsnapnodes = nsnapnodes;
+
+    if (ndomnodes && VIR_ALLOC_N(store->domdefs, ndomnodes) < 0)
+        goto cleanup;
+
+    /* The domain definitions are listed in order of their id */
+    for (i = 0; i < ndomnodes; i++) {
+        char *id = virXMLPropString(domnodes[i]->parent, "id");
+        unsigned int n;
+
+        if (!id || virStrToLong_ui(id, NULL, 10, &n) < 0 || n != i) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("invalid domain definition id '%s'"),
+                           NULLSTR(id));
+            VIR_FREE(id);
+            goto cleanup;
+        }
+        VIR_FREE(id);
+
+        if (!(store->domdefs[i] =
+              virObjectNew(virDomainSnapshotSharedDomClass)))
+            goto cleanup;
+        store->ndomdefs++;
+
+        if (!(store->domdefs[i]->def =
+              virDomainDefParseNode(store->xml, domnodes[i], caps, xmlopt,
+                                    expectedVirtTypes,
+                                    VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+            goto cleanup;
+    }
+
+    ret = store;
+    store = NULL;
+
+ cleanup:
+    virDomainSnapshotStoreFree(store);
+    VIR_FREE(domnodes);
+    xmlXPathFreeContext(ctxt);
+    return ret;
+}
+
+
+size_t
+virDomainSnapshotStoreGetCount(virDomainSnapshotStorePtr store)
+{
+    return store->nsnapnodes;
+}
+
+
+/**
+ * virDomainSnapshotStoreParseDef:
+ * @store: parsed snapshot store
+ * @idx: index of the snapshot within @store
+ * @caps: capabilities
+ * @xmlopt: domain XML parser options
+ * @expectedVirtTypes: bitmask of allowed virtualization types
+ * @flags: bitwise-OR of virDomainSnapshotParseFlags
+ *
+ * Parses the snapshot number @idx of @store. Snapshots referring to
+ * the same domain definition share a single read-only copy of it,
+ * which stays valid after @store is freed. @store is not modified, so
+ * different snapshots can be parsed in parallel.
+ *
+ * Returns the snapshot definition, or NULL on error.
+ */
+virDomainSnapshotDefPtr
+virDomainSnapshotStoreParseDef(virDomainSnapshotStorePtr store,
+                               size_t idx,
+                               virCapsPtr caps,
+                               virDomainXMLOptionPtr xmlopt,
+                               unsigned int expectedVirtTypes,
+                               unsigned int flags)
+{
+    xmlXPathContextPtr ctxt = NULL;
+    virDomainSnapshotDefPtr def = NULL;
+
+    if (idx >= store->nsnapnodes) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("no snapshot %zu in snapshot store"), idx);
+        return NULL;
+    }
+
+    if (!(ctxt = xmlXPathNewContext(store->xml))) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    ctxt->node = store->snapnodes[idx];
+    def = virDomainSnapshotDefParse(ctxt, caps, xmlopt, expectedVirtTypes,
+                                    flags, store->domdefs, store->ndomdefs);
+    xmlXPathFreeContext(ctxt);
+    return def;
+}
+
+
+/**
+ * virDomainSnapshotDefListParseString:
+ * @xmlStr: snapshot store document
+ * @caps: capabilities
+ * @xmlopt: domain XML parser options
+ * @expectedVirtTypes: bitmask of allowed virtualization types
+ * @flags: bitwise-OR of virDomainSnapshotParseFlags
+ * @defs: filled with the parsed snapshots
+ *
+ * Parses a document produced by virDomainSnapshotDefListFormat().
+ *
+ * Returns the number of snapshots stored in @defs, or -1 on error.
+ */
+int
+virDomainSnapshotDefListParseString(const char *xmlStr,
+                                    virCapsPtr caps,
+                                    virDomainXMLOptionPtr xmlopt,
+                                    unsigned int expectedVirtTypes,
+                                    unsigned int flags,
+                                    virDomainSnapshotDefPtr **defs)
+{
+    virDomainSnapshotStorePtr store;
+    virDomainSnapshotDefPtr *list = NULL;
+    size_t nlist = 0;
+    int ret = -1;
+    size_t i;
+
+    *defs = NULL;
+
+    if (!(store = virDomainSnapshotStoreParseString(xmlStr, caps, xmlopt,
+                                                    expectedVirtTypes)))
+        return -1;
+
+    if (VIR_ALLOC_N(list, store->nsnapnodes) < 0)
+        goto cleanup;
+
+    for (i = 0; i < store->nsnapnodes; i++) {
+        if (!(list[nlist] = virDomainSnapshotStoreParseDef(store, i, caps,
+                                                           xmlopt,
+                                                           expectedVirtTypes,
+                                                           flags)))
+            goto cleanup;
+        nlist++;
+    }
+
+    *defs = list;
+    list = NULL;
+    ret = nlist;
+
+ cleanup:
+    if (list) {
+        for (i = 0; i < nlist; i++)
+            virDomainSnapshotDefFree(list[i]);
+        VIR_FREE(list);
+    }
+    virDomainSnapshotStoreFree(store);
+    return ret;
+}
+
 /* Snapshot Obj functions */
 static virDomainSnapshotObjPtr virDomainSnapshotObjNew(void)
 {
@@ -1270,7 +1714,9 @@ virDomainSnapshotRedefinePrep(virDomainPtr domain,
             } else {
                 /* Transfer the domain def */
                 def->dom = other->def->dom;
+                def->domShared = other->def->domShared;
                 other->def->dom = NULL;
+                other->def->domShared = NULL;
             }
         }
 
@@ -1286,7 +1732,9 @@ virDomainSnapshotRedefinePrep(virDomainPtr domain,
                 /* revert stealing of the snapshot domain definition */
                 if (def->dom && !other->def->dom) {
                     other->def->dom = def->dom;
+                    other->def->domShared = def->domShared;
                     def->dom = NULL;
+                    def->domShared = NULL;
                 }
                 goto cleanup;
             }
@@ -75,6 +75,10 @@ struct _virDomainSnapshotDef {
     virDomainSnapshotDiskDef *disks;
 
     virDomainDefPtr dom;
+    /* If non-NULL, @dom is shared with other snapshots loaded from the
+     * same store and is freed along with the last reference to it, so
+     * it must not be modified */
+    virObjectPtr domShared;
 
     /* Internal use.  */
     bool current; /* At most one snapshot in the list should have this set */
@@ -117,6 +121,32 @@ char *virDomainSnapshotDefFormat(const char *domain_uuid,
                                  virDomainSnapshotDefPtr def,
                                  unsigned int flags,
                                  int internal);
+char *virDomainSnapshotDefListFormat(const char *domain_uuid,
+                                     virDomainSnapshotDefPtr *defs,
+                                     size_t ndefs,
+                                     unsigned int flags);
+typedef struct _virDomainSnapshotStore virDomainSnapshotStore;
+typedef virDomainSnapshotStore *virDomainSnapshotStorePtr;
+virDomainSnapshotStorePtr
+virDomainSnapshotStoreParseString(const char *xmlStr,
+                                  virCapsPtr caps,
+                                  virDomainXMLOptionPtr xmlopt,
+                                  unsigned int expectedVirtTypes);
+size_t virDomainSnapshotStoreGetCount(virDomainSnapshotStorePtr store);
+virDomainSnapshotDefPtr
+virDomainSnapshotStoreParseDef(virDomainSnapshotStorePtr store,
+                               size_t idx,
+                               virCapsPtr caps,
+                               virDomainXMLOptionPtr xmlopt,
+                               unsigned int expectedVirtTypes,
+                               unsigned int flags);
+void virDomainSnapshotStoreFree(virDomainSnapshotStorePtr store);
+int virDomainSnapshotDefListParseString(const char *xmlStr,
+                                        virCapsPtr caps,
+                                        virDomainXMLOptionPtr xmlopt,
+                                        unsigned int expectedVirtTypes,
+                                        unsigned int flags,
+                                        virDomainSnapshotDefPtr **defs);
 int virDomainSnapshotAlignDisks(virDomainSnapshotDefPtr snapshot,
                                 int default_snapshot,
                                 bool require_match);
@@ -10990,6 +10990,47 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  * "block.<num>.physical" - physical size in bytes of the container of the
  *                          backing image as unsigned long long.
  *
+ * VIR_DOMAIN_STATS_AUTOSTART: Return whether the domain is started
+ * automatically. The typed parameter keys are in this format:
+ * "autostart.enabled" - true if the domain is marked for autostart,
+ *                       as boolean.
+ *
+ * VIR_DOMAIN_STATS_MANAGEDSAVE: Return whether the domain has a managed
+ * save image. The typed parameter keys are in this format:
+ * "managedsave.present" - true if a managed save image exists,
+ *                         as boolean.
+ *
+ * VIR_DOMAIN_STATS_MONITOR: Return statistics about the connection the
+ * hypervisor driver uses to control a running domain. The typed parameter
+ * keys are in this format:
+ * "monitor.commands" - number of commands sent to the monitor
+ *                      as unsigned long long.
+ * "monitor.latency.total" - total time spent waiting for replies, in
+ *                           microseconds, as unsigned long long.
+ * "monitor.latency.max" - longest wait for a single reply, in
+ *                         microseconds, as unsigned long long.
+ * "monitor.iothread.name" - name of the I/O thread serving the monitor,
+ *                           as string. This and the following fields are
+ *                           only present if the monitor is not served by
+ *                           the main event loop.
+ * "monitor.iothread.handles" - number of connections served by the I/O
+ *                              thread as unsigned long long.
+ * "monitor.iothread.wakeups" - number of times the I/O thread woke up with
+ *                              work to do as unsigned long long.
+ * "monitor.iothread.dispatches" - number of events handled by the I/O
+ *                                 thread as unsigned long long.
+ * "monitor.iothread.ready.max" - largest number of connections ready at
+ *                                once as unsigned long long.
+ * "monitor.iothread.busy" - total time the I/O thread spent handling
+ *                           events, in microseconds, as unsigned long long.
+ * "monitor.iothread.dispatch.max" - longest time spent handling a single
+ *                                   event, in microseconds, as unsigned
+ *                                   long long.
+ *
+ * Together with VIR_DOMAIN_STATS_STATE these groups provide everything
+ * needed to list domains along with their state in a single call,
+ * instead of querying each domain separately.
+ *
  * Note that entire stats groups or individual stat fields may be missing from
  * the output in case they are not supported by the given hypervisor, are not
  * applicable for the current state of the guest domain, or their retrieval
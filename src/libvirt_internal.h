@@ -118,6 +118,13 @@ enum {
      * Support for server-side event filtering via callback ids in events.
      */
     VIR_DRV_FEATURE_REMOTE_EVENT_CALLBACK = 14,
+
+    /*
+     * Support for stream data packets larger than
+     * VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX. Querying it also tells the
+     * server that the client accepts such packets.
+     */
+    VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_CHUNKS = 15,
 };
 
 
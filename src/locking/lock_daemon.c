@@ -1130,6 +1130,7 @@ int main(int argc, char **argv) {
     bool privileged = false;
     virLockDaemonConfigPtr config = NULL;
     int rv;
+    size_t log_async_size;
 
     struct option opts[] = {
         { "verbose", no_argument, &verbose, 'v'},
@@ -1318,11 +1319,20 @@ int main(int argc, char **argv) {
                 goto cleanup;
             }
 
+            /* Don't fork with the log writer thread running */
+            log_async_size = virLogGetAsync();
+            ignore_value(virLogSetAsync(0));
+
             if ((statuswrite = virLockDaemonForkIntoBackground(argv[0])) < 0) {
                 VIR_ERROR(_("Failed to fork as daemon: %s"),
                           virStrerror(errno, ebuf, sizeof(ebuf)));
                 goto cleanup;
             }
+
+            if (log_async_size && virLogSetAsync(log_async_size) < 0) {
+                VIR_ERROR(_("Can't start asynchronous logging"));
+                goto cleanup;
+            }
         }
 
         /* If we have a pidfile set, claim it now, exiting if already taken */
@@ -24,6 +24,7 @@
 
 #include "rpc/virnetserver.h"
 #include "rpc/virnetserverclient.h"
+#include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
 #include "lock_daemon.h"
@@ -429,3 +430,273 @@ virLockSpaceProtocolDispatchCreateLockSpace(virNetServerPtr server ATTRIBUTE_UNU
     virMutexUnlock(&priv->lock);
     return rv;
 }
+
+
+/*
+ * Split a set of resources into groups sharing the same lockspace,
+ * numbered in order of first appearance. Fills @groups with the
+ * group of each resource and returns the number of groups.
+ */
+static size_t
+virLockDaemonGroupResources(virLockSpaceProtocolResource *resources,
+                            size_t nresources,
+                            size_t *groups)
+{
+    size_t ngroups = 0;
+    size_t i, j;
+
+    for (i = 0; i < nresources; i++) {
+        for (j = 0; j < i; j++) {
+            if (STREQ(resources[i].path, resources[j].path))
+                break;
+        }
+        groups[i] = j < i ? groups[j] : ngroups++;
+    }
+
+    return ngroups;
+}
+
+
+/*
+ * Collect names and lockspace acquire flags of all resources in
+ * group @group. Returns the number of resources collected.
+ */
+static size_t
+virLockDaemonCollectResources(virLockSpaceProtocolResource *resources,
+                              size_t nresources,
+                              size_t *groups,
+                              size_t group,
+                              const char **names,
+                              unsigned int *flags)
+{
+    size_t n = 0;
+    size_t i;
+
+    for (i = 0; i < nresources; i++) {
+        if (groups[i] != group)
+            continue;
+
+        names[n] = resources[i].name;
+        flags[n] = 0;
+        if (resources[i].flags & VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED)
+            flags[n] |= VIR_LOCK_SPACE_ACQUIRE_SHARED;
+        if (resources[i].flags & VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE)
+            flags[n] |= VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE;
+        n++;
+    }
+
+    return n;
+}
+
+
+/*
+ * Look up the lockspace of every group, failing if any of
+ * them does not exist. Returns a newly allocated array.
+ */
+static virLockSpacePtr *
+virLockDaemonFindResourceLockSpaces(virLockSpaceProtocolResource *resources,
+                                    size_t nresources,
+                                    size_t *groups,
+                                    size_t ngroups)
+{
+    virLockSpacePtr *lockspaces;
+    size_t i;
+
+    if (VIR_ALLOC_N(lockspaces, ngroups) < 0)
+        return NULL;
+
+    for (i = 0; i < nresources; i++) {
+        if (lockspaces[groups[i]])
+            continue;
+
+        if (!(lockspaces[groups[i]] =
+              virLockDaemonFindLockSpace(lockDaemon, resources[i].path))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Lockspace for path %s does not exist"),
+                           resources[i].path);
+            VIR_FREE(lockspaces);
+            return NULL;
+        }
+    }
+
+    return lockspaces;
+}
+
+
+static int
+virLockSpaceProtocolDispatchAcquireResources(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                             virNetServerClientPtr client,
+                                             virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                             virNetMessageErrorPtr rerr,
+                                             virLockSpaceProtocolAcquireResourcesArgs *args)
+{
+    int rv = -1;
+    unsigned int flags = args->flags;
+    virLockDaemonClientPtr priv =
+        virNetServerClientGetPrivateData(client);
+    virLockSpaceProtocolResource *resources = args->resources.resources_val;
+    size_t nresources = args->resources.resources_len;
+    virLockSpacePtr *lockspaces = NULL;
+    size_t *groups = NULL;
+    size_t ngroups;
+    const char **names = NULL;
+    unsigned int *resflags = NULL;
+    size_t i;
+
+    virMutexLock(&priv->lock);
+
+    virCheckFlagsGoto(0, cleanup);
+
+    if (priv->restricted) {
+        virReportError(VIR_ERR_OPERATION_DENIED, "%s",
+                       _("lock manager connection has been restricted"));
+        goto cleanup;
+    }
+
+    if (!priv->ownerPid) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("lock owner details have not been registered"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nresources; i++) {
+        if (resources[i].flags &
+            ~(VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED |
+              VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE)) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("unsupported flags (0x%x) for resource %s"),
+                           resources[i].flags, resources[i].name);
+            goto cleanup;
+        }
+    }
+
+    if (VIR_ALLOC_N(groups, nresources) < 0 ||
+        VIR_ALLOC_N(names, nresources) < 0 ||
+        VIR_ALLOC_N(resflags, nresources) < 0)
+        goto cleanup;
+
+    ngroups = virLockDaemonGroupResources(resources, nresources, groups);
+
+    /* Resolve every lockspace before acquiring anything */
+    if (!(lockspaces = virLockDaemonFindResourceLockSpaces(resources,
+                                                           nresources,
+                                                           groups,
+                                                           ngroups)))
+        goto cleanup;
+
+    for (i = 0; i < ngroups; i++) {
+        size_t n = virLockDaemonCollectResources(resources, nresources,
+                                                 groups, i, names, resflags);
+
+        if (virLockSpaceAcquireResources(lockspaces[i], n, names, resflags,
+                                         priv->ownerPid) < 0) {
+            virErrorPtr err = virSaveLastError();
+
+            /* The failed lockspace has already undone its own part,
+             * so give back whatever the earlier ones handed out */
+            while (i-- > 0) {
+                n = virLockDaemonCollectResources(resources, nresources,
+                                                  groups, i, names, resflags);
+                ignore_value(virLockSpaceReleaseResources(lockspaces[i], n,
+                                                          names,
+                                                          priv->ownerPid));
+            }
+            virSetError(err);
+            virFreeError(err);
+            goto cleanup;
+        }
+    }
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virMutexUnlock(&priv->lock);
+    VIR_FREE(lockspaces);
+    VIR_FREE(groups);
+    VIR_FREE(names);
+    VIR_FREE(resflags);
+    return rv;
+}
+
+
+static int
+virLockSpaceProtocolDispatchReleaseResources(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                             virNetServerClientPtr client,
+                                             virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                             virNetMessageErrorPtr rerr,
+                                             virLockSpaceProtocolReleaseResourcesArgs *args)
+{
+    int rv = -1;
+    unsigned int flags = args->flags;
+    virLockDaemonClientPtr priv =
+        virNetServerClientGetPrivateData(client);
+    virLockSpaceProtocolResource *resources = args->resources.resources_val;
+    size_t nresources = args->resources.resources_len;
+    virLockSpacePtr *lockspaces = NULL;
+    size_t *groups = NULL;
+    size_t ngroups;
+    const char **names = NULL;
+    unsigned int *resflags = NULL;
+    size_t i;
+
+    virMutexLock(&priv->lock);
+
+    virCheckFlagsGoto(0, cleanup);
+
+    if (priv->restricted) {
+        virReportError(VIR_ERR_OPERATION_DENIED, "%s",
+                       _("lock manager connection has been restricted"));
+        goto cleanup;
+    }
+
+    if (!priv->ownerPid) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("lock owner details have not been registered"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nresources; i++) {
+        if (resources[i].flags) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("unsupported flags (0x%x) for resource %s"),
+                           resources[i].flags, resources[i].name);
+            goto cleanup;
+        }
+    }
+
+    if (VIR_ALLOC_N(groups, nresources) < 0 ||
+        VIR_ALLOC_N(names, nresources) < 0 ||
+        VIR_ALLOC_N(resflags, nresources) < 0)
+        goto cleanup;
+
+    ngroups = virLockDaemonGroupResources(resources, nresources, groups);
+
+    if (!(lockspaces = virLockDaemonFindResourceLockSpaces(resources,
+                                                           nresources,
+                                                           groups,
+                                                           ngroups)))
+        goto cleanup;
+
+    for (i = 0; i < ngroups; i++) {
+        size_t n = virLockDaemonCollectResources(resources, nresources,
+                                                 groups, i, names, resflags);
+
+        if (virLockSpaceReleaseResources(lockspaces[i], n, names,
+                                         priv->ownerPid) < 0)
+            goto cleanup;
+    }
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virMutexUnlock(&priv->lock);
+    VIR_FREE(lockspaces);
+    VIR_FREE(groups);
+    VIR_FREE(names);
+    VIR_FREE(resflags);
+    return rv;
+}
@@ -33,6 +33,7 @@
 #include "lock_protocol.h"
 #include "configmake.h"
 #include "virstring.h"
+#include "intprops.h"
 
 #define VIR_FROM_THIS VIR_FROM_LOCKING
 
@@ -647,6 +648,182 @@ static int virLockManagerLockDaemonAddResource(virLockManagerPtr lock,
 }
 
 
+/*
+ * Older virtlockd only knows how to handle resources one at a time.
+ * It rejects the set procedures with the RPC layer's "unknown
+ * procedure: N" error; any other failure must be reported as is,
+ * rather than retried resource by resource.
+ */
+static bool
+virLockManagerLockDaemonBatchUnsupported(int procedure)
+{
+    virErrorPtr err = virGetLastError();
+    char procstr[INT_BUFSIZE_BOUND(procedure) + 2];
+    size_t msglen;
+    size_t proclen;
+
+    if (!err || err->code != VIR_ERR_RPC || err->domain != VIR_FROM_RPC ||
+        !err->message)
+        return false;
+
+    /* The message is translated by virtlockd, but always ends
+     * with the procedure number */
+    snprintf(procstr, sizeof(procstr), ": %d", procedure);
+    msglen = strlen(err->message);
+    proclen = strlen(procstr);
+    if (msglen < proclen ||
+        STRNEQ(err->message + msglen - proclen, procstr))
+        return false;
+
+    VIR_DEBUG("virtlockd does not support resource sets: %s",
+              err->message);
+    virResetLastError();
+    return true;
+}
+
+
+static int
+virLockManagerLockDaemonAcquireResources(virLockManagerPtr lock,
+                                         virNetClientPtr client,
+                                         virNetClientProgramPtr program,
+                                         int *counter)
+{
+    virLockManagerLockDaemonPrivatePtr priv = lock->privateData;
+    virLockSpaceProtocolAcquireResourcesArgs args;
+    virLockSpaceProtocolResource *resources = NULL;
+    size_t i;
+    int rv = -1;
+
+    if (VIR_ALLOC_N(resources, priv->nresources) < 0)
+        return -1;
+
+    for (i = 0; i < priv->nresources; i++) {
+        resources[i].path = priv->resources[i].lockspace;
+        resources[i].name = priv->resources[i].name;
+        resources[i].flags = priv->resources[i].flags;
+    }
+
+    memset(&args, 0, sizeof(args));
+    args.resources.resources_len = priv->nresources;
+    args.resources.resources_val = resources;
+
+    /* All the domain's leases in a single round trip, which
+     * virtlockd grants either completely or not at all */
+    if (virNetClientProgramCall(program,
+                                client,
+                                (*counter)++,
+                                VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCES,
+                                0, NULL, NULL, NULL,
+                                (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourcesArgs, (char*)&args,
+                                (xdrproc_t)xdr_void, NULL) == 0) {
+        rv = 0;
+        goto cleanup;
+    }
+
+    if (!virLockManagerLockDaemonBatchUnsupported(
+            VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCES))
+        goto cleanup;
+
+    for (i = 0; i < priv->nresources; i++) {
+        virLockSpaceProtocolAcquireResourceArgs args1;
+
+        memset(&args1, 0, sizeof(args1));
+
+        if (priv->resources[i].lockspace)
+            args1.path = priv->resources[i].lockspace;
+        args1.name = priv->resources[i].name;
+        args1.flags = priv->resources[i].flags;
+
+        if (virNetClientProgramCall(program,
+                                    client,
+                                    (*counter)++,
+                                    VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCE,
+                                    0, NULL, NULL, NULL,
+                                    (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourceArgs, &args1,
+                                    (xdrproc_t)xdr_void, NULL) < 0)
+            goto cleanup;
+    }
+
+    rv = 0;
+
+ cleanup:
+    VIR_FREE(resources);
+    return rv;
+}
+
+
+static int
+virLockManagerLockDaemonReleaseResources(virLockManagerPtr lock,
+                                         virNetClientPtr client,
+                                         virNetClientProgramPtr program,
+                                         int *counter)
+{
+    virLockManagerLockDaemonPrivatePtr priv = lock->privateData;
+    virLockSpaceProtocolReleaseResourcesArgs args;
+    virLockSpaceProtocolResource *resources = NULL;
+    size_t i;
+    int rv = -1;
+
+    if (VIR_ALLOC_N(resources, priv->nresources) < 0)
+        return -1;
+
+    for (i = 0; i < priv->nresources; i++) {
+        resources[i].path = priv->resources[i].lockspace;
+        resources[i].name = priv->resources[i].name;
+        resources[i].flags = 0;
+    }
+
+    memset(&args, 0, sizeof(args));
+    args.resources.resources_len = priv->nresources;
+    args.resources.resources_val = resources;
+
+    if (virNetClientProgramCall(program,
+                                client,
+                                (*counter)++,
+                                VIR_LOCK_SPACE_PROTOCOL_PROC_RELEASE_RESOURCES,
+                                0, NULL, NULL, NULL,
+                                (xdrproc_t)xdr_virLockSpaceProtocolReleaseResourcesArgs, (char*)&args,
+                                (xdrproc_t)xdr_void, NULL) == 0) {
+        rv = 0;
+        goto cleanup;
+    }
+
+    if (!virLockManagerLockDaemonBatchUnsupported(
+            VIR_LOCK_SPACE_PROTOCOL_PROC_RELEASE_RESOURCES))
+        goto cleanup;
+
+    for (i = 0; i < priv->nresources; i++) {
+        virLockSpaceProtocolReleaseResourceArgs args1;
+
+        memset(&args1, 0, sizeof(args1));
+
+        if (priv->resources[i].lockspace)
+            args1.path = priv->resources[i].lockspace;
+        args1.name = priv->resources[i].name;
+        args1.flags = priv->resources[i].flags;
+
+        args1.flags &=
+            ~(VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED |
+              VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE);
+
+        if (virNetClientProgramCall(program,
+                                    client,
+                                    (*counter)++,
+                                    VIR_LOCK_SPACE_PROTOCOL_PROC_RELEASE_RESOURCE,
+                                    0, NULL, NULL, NULL,
+                                    (xdrproc_t)xdr_virLockSpaceProtocolReleaseResourceArgs, &args1,
+                                    (xdrproc_t)xdr_void, NULL) < 0)
+            goto cleanup;
+    }
+
+    rv = 0;
+
+ cleanup:
+    VIR_FREE(resources);
+    return rv;
+}
+
+
 static int virLockManagerLockDaemonAcquire(virLockManagerPtr lock,
                                            const char *state ATTRIBUTE_UNUSED,
                                            unsigned int flags,
@@ -677,28 +854,11 @@ static int virLockManagerLockDaemonAcquire(virLockManagerPtr lock,
         (*fd = virNetClientDupFD(client, false)) < 0)
         goto cleanup;
 
-    if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY)) {
-        size_t i;
-        for (i = 0; i < priv->nresources; i++) {
-            virLockSpaceProtocolAcquireResourceArgs args;
-
-            memset(&args, 0, sizeof(args));
-
-            if (priv->resources[i].lockspace)
-                args.path = priv->resources[i].lockspace;
-            args.name = priv->resources[i].name;
-            args.flags = priv->resources[i].flags;
-
-            if (virNetClientProgramCall(program,
-                                        client,
-                                        counter++,
-                                        VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCE,
-                                        0, NULL, NULL, NULL,
-                                        (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourceArgs, &args,
-                                        (xdrproc_t)xdr_void, NULL) < 0)
-                goto cleanup;
-        }
-    }
+    if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY) &&
+        priv->nresources > 0 &&
+        virLockManagerLockDaemonAcquireResources(lock, client, program,
+                                                 &counter) < 0)
+        goto cleanup;
 
     if ((flags & VIR_LOCK_MANAGER_ACQUIRE_RESTRICT) &&
         virLockManagerLockDaemonConnectionRestrict(lock, client, program, &counter) < 0)
@@ -724,7 +884,6 @@ static int virLockManagerLockDaemonRelease(virLockManagerPtr lock,
     virNetClientProgramPtr program = NULL;
     int counter = 0;
     int rv = -1;
-    size_t i;
     virLockManagerLockDaemonPrivatePtr priv = lock->privateData;
 
     virCheckFlags(0, -1);
@@ -735,29 +894,10 @@ static int virLockManagerLockDaemonRelease(virLockManagerPtr lock,
     if (!(client = virLockManagerLockDaemonConnect(lock, &program, &counter)))
         goto cleanup;
 
-    for (i = 0; i < priv->nresources; i++) {
-        virLockSpaceProtocolReleaseResourceArgs args;
-
-        memset(&args, 0, sizeof(args));
-
-        if (priv->resources[i].lockspace)
-            args.path = priv->resources[i].lockspace;
-        args.name = priv->resources[i].name;
-        args.flags = priv->resources[i].flags;
-
-        args.flags &=
-            ~(VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED |
-              VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE);
-
-        if (virNetClientProgramCall(program,
-                                    client,
-                                    counter++,
-                                    VIR_LOCK_SPACE_PROTOCOL_PROC_RELEASE_RESOURCE,
-                                    0, NULL, NULL, NULL,
-                                    (xdrproc_t)xdr_virLockSpaceProtocolReleaseResourceArgs, &args,
-                                    (xdrproc_t)xdr_void, NULL) < 0)
-            goto cleanup;
-    }
+    if (priv->nresources > 0 &&
+        virLockManagerLockDaemonReleaseResources(lock, client, program,
+                                                 &counter) < 0)
+        goto cleanup;
 
     rv = 0;
 
@@ -1213,11 +1213,20 @@ networkDnsmasqConfContents(virNetworkObjPtr network,
 
     /* Even if there are currently no static hosts, if we're
      * listening for DHCP, we should write a 0-length hosts
-     * file to allow for runtime additions.
+     * file to allow for runtime additions. If dnsmasq can read
+     * them from a directory, hosts added at runtime are picked
+     * up without reloading all of them.
      */
-    if (ipv4def || ipv6def)
-        virBufferAsprintf(&configbuf, "dhcp-hostsfile=%s\n",
-                          dctx->hostsfile->path);
+    dnsmasqSetDhcpHostsdir(dctx,
+                           dnsmasqCapsGet(caps, DNSMASQ_CAPS_DHCP_HOSTSDIR));
+    if (ipv4def || ipv6def) {
+        if (dnsmasqCapsGet(caps, DNSMASQ_CAPS_DHCP_HOSTSDIR))
+            virBufferAsprintf(&configbuf, "dhcp-hostsdir=%s\n",
+                              dctx->hostsfile->dir);
+        else
+            virBufferAsprintf(&configbuf, "dhcp-hostsfile=%s\n",
+                              dctx->hostsfile->path);
+    }
 
     /* Likewise, always create this file and put it on the
      * commandline, to allow for runtime additions.
@@ -1382,20 +1391,24 @@ networkStartDhcpDaemon(virNetworkObjPtr network)
     return ret;
 }
 
-/* networkRefreshDhcpDaemon:
+/* networkRefreshDhcpDaemonInternal:
  *  Update dnsmasq config files, then send a SIGHUP so that it rereads
- *  them.   This only works for the dhcp-hostsfile and the
- *  addn-hosts file.
+ *  them.   This only works for the dhcp-hostsfile (or dhcp-hostsdir)
+ *  and the addn-hosts file. If @dhcpHostsOnly is true, only the dhcp
+ *  hosts are updated, and dnsmasq is only signalled if it can't pick
+ *  up the changes by itself.
  *
  *  Returns 0 on success, -1 on failure.
  */
 static int
-networkRefreshDhcpDaemon(virNetworkObjPtr network)
+networkRefreshDhcpDaemonInternal(virNetworkObjPtr network,
+                                 bool dhcpHostsOnly)
 {
     int ret = -1;
     size_t i;
     virNetworkIpDefPtr ipdef, ipv4def, ipv6def;
     dnsmasqContext *dctx = NULL;
+    bool reload = true;
 
     /* if no IP addresses specified, nothing to do */
     if (!virNetworkDefGetIpByIndex(network->def, AF_UNSPEC, 0))
@@ -1437,18 +1450,33 @@ networkRefreshDhcpDaemon(virNetworkObjPtr network)
     if (ipv6def && (networkBuildDnsmasqDhcpHostsList(dctx, ipv6def) < 0))
         goto cleanup;
 
-    if (networkBuildDnsmasqHostsList(dctx, &network->def->dns) < 0)
-        goto cleanup;
+    if (dhcpHostsOnly) {
+        if ((ret = dnsmasqSaveDhcpHosts(dctx, &reload)) < 0)
+            goto cleanup;
+    } else {
+        if (networkBuildDnsmasqHostsList(dctx, &network->def->dns) < 0)
+            goto cleanup;
 
-    if ((ret = dnsmasqSave(dctx)) < 0)
-        goto cleanup;
+        if ((ret = dnsmasqSave(dctx)) < 0)
+            goto cleanup;
+    }
 
-    ret = kill(network->dnsmasqPid, SIGHUP);
+    if (reload)
+        ret = kill(network->dnsmasqPid, SIGHUP);
+    else
+        VIR_DEBUG("dnsmasq for network %s picks up new hosts by itself",
+                  network->def->bridge);
  cleanup:
     dnsmasqContextFree(dctx);
     return ret;
 }
 
+static int
+networkRefreshDhcpDaemon(virNetworkObjPtr network)
+{
+    return networkRefreshDhcpDaemonInternal(network, false);
+}
+
 /* networkRestartDhcpDaemon:
  *
  * kill and restart dnsmasq, in order to update any config that is on
@@ -3077,6 +3105,24 @@ networkUndefine(virNetworkPtr net)
     return ret;
 }
 
+/* Updating the static hosts adds or removes at most one of them, which
+ * can only enable or disable DHCP for an IPv4 address that has no
+ * ranges and fewer than two hosts.
+ */
+static bool
+networkDHCPHostUpdateAffectsFirewall(virNetworkDefPtr def)
+{
+    size_t i;
+    virNetworkIpDefPtr ipdef;
+
+    for (i = 0; (ipdef = virNetworkDefGetIpByIndex(def, AF_INET, i)); i++) {
+        if (!ipdef->nranges && ipdef->nhosts < 2)
+            return true;
+    }
+
+    return false;
+}
+
 static int
 networkUpdate(virNetworkPtr net,
               unsigned int command,
@@ -3140,11 +3186,16 @@ networkUpdate(virNetworkPtr net,
             network->def->forward.type == VIR_NETWORK_FORWARD_NAT ||
             network->def->forward.type == VIR_NETWORK_FORWARD_ROUTE) {
             switch (section) {
+            case VIR_NETWORK_SECTION_IP_DHCP_HOST:
+                /* a static host only matters to the firewall rules if
+                 * it turns DHCP on or off for an IPv4 address */
+                if (!networkDHCPHostUpdateAffectsFirewall(network->def))
+                    break;
+                /* fallthrough */
             case VIR_NETWORK_SECTION_FORWARD:
             case VIR_NETWORK_SECTION_FORWARD_INTERFACE:
             case VIR_NETWORK_SECTION_IP:
             case VIR_NETWORK_SECTION_IP_DHCP_RANGE:
-            case VIR_NETWORK_SECTION_IP_DHCP_HOST:
                 /* these could affect the firewall rules, so remove the
                  * old rules (and remember to load new ones after the
                  * update).
@@ -3209,9 +3260,10 @@ networkUpdate(virNetworkPtr net,
                 }
             }
 
-            if ((newDhcpActive != oldDhcpActive &&
-                 networkRestartDhcpDaemon(network) < 0) ||
-                networkRefreshDhcpDaemon(network) < 0) {
+            if (newDhcpActive != oldDhcpActive) {
+                if (networkRestartDhcpDaemon(network) < 0)
+                    goto cleanup;
+            } else if (networkRefreshDhcpDaemonInternal(network, true) < 0) {
                 goto cleanup;
             }
 
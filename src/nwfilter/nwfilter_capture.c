@@ -0,0 +1,1414 @@
+/*
+ * nwfilter_capture.c: shared packet capture for DHCP snooping and
+ *                     IP address learning
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Rather than opening a pcap handle and starting a thread for every
+ * interface that is snooped on, a single AF_PACKET socket bound to all
+ * interfaces receives the traffic of interest into a TPACKET_V3 ring
+ * shared with the kernel. A classic BPF program attached to the socket
+ * lets only DHCP, ARP and, while somebody asks for it, the headers of
+ * other IPv4 packets through. One reader thread walks the ring and
+ * hands the packets to the subscribers of the interface they were seen
+ * on. The subscribers' callbacks run on a small fixed set of worker
+ * threads; all callbacks of one interface run on the same worker and
+ * hence never concurrently and in the order the packets arrived.
+ *
+ * The socket and the threads only exist while there are subscribers:
+ * they are set up by the first subscription and the reader tears
+ * everything down once nobody subscribed for a while.
+ */
+
+#include <config.h>
+
+#include "internal.h"
+
+#include "nwfilter_capture.h"
+#define __NWFILTER_CAPTURE_PRIV_H_ALLOW__
+#include "nwfilter_capturepriv.h"
+#include "intprops.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virhash.h"
+#include "virlog.h"
+#include "virobject.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#if defined(__linux__)
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/mman.h>
+# include <sys/socket.h>
+# include <arpa/inet.h>
+# include <net/ethernet.h>
+# include <linux/filter.h>
+# include <linux/if_packet.h>
+#endif
+
+#define VIR_FROM_THIS VIR_FROM_NWFILTER
+
+VIR_LOG_INIT("nwfilter.nwfilter_capture");
+
+#if defined(__linux__) && defined(TPACKET3_HDRLEN)
+
+/* Number of threads running the subscribers' callbacks */
+# define CAPTURE_WORKERS            4
+
+/* The ring: 16 blocks of 256kB, each retired to user space
+ * after 50ms at the latest */
+# define CAPTURE_BLOCK_SIZE         (256 * 1024)
+# define CAPTURE_BLOCK_NR           16
+# define CAPTURE_FRAME_SIZE         2048
+# define CAPTURE_BLOCK_TIMEOUT_MS   50
+
+# define CAPTURE_TICK_MS            1000
+
+/* How long the capture stays up without any subscribers, so that
+ * restarting a guest does not tear it down and set it up again */
+# define CAPTURE_IDLE_TIMEOUT_MS    10000
+
+/* How much of a packet the BPF program lets through */
+# define CAPTURE_SNAPLEN_DHCP       576 /* >= IP/UDP/DHCP headers */
+# define CAPTURE_SNAPLEN_HEADERS    128
+
+# define IFINDEX2STR(VARNAME, ifindex) \
+    char VARNAME[INT_BUFSIZE_BOUND(ifindex)]; \
+    snprintf(VARNAME, sizeof(VARNAME), "%d", ifindex);
+
+typedef struct _virNWFilterCaptureJob virNWFilterCaptureJob;
+typedef virNWFilterCaptureJob *virNWFilterCaptureJobPtr;
+struct _virNWFilterCaptureJob {
+    virNWFilterCaptureSubPtr sub;
+    virNWFilterCaptureJobPtr next;
+    bool tick;
+    bool outgoing;
+    size_t len;
+    unsigned char packet[];
+};
+
+typedef struct _virNWFilterCaptureWorker virNWFilterCaptureWorker;
+typedef virNWFilterCaptureWorker *virNWFilterCaptureWorkerPtr;
+struct _virNWFilterCaptureWorker {
+    virMutex lock;
+    virCond cond;               /* signalled on new jobs */
+    virCond idle;               /* signalled after each callback */
+    virThread thread;
+    bool quit;
+    bool active;                /* running a callback */
+
+    virNWFilterCaptureJobPtr head;
+    virNWFilterCaptureJobPtr tail;
+};
+
+struct _virNWFilterCaptureSub {
+    virObject parent;
+
+    int ifindex;
+    unsigned int protocols;
+    size_t maxQueued;
+    virNWFilterCaptureCallbacks cbs;
+    void *opaque;
+    virNWFilterCaptureWorkerPtr worker;
+
+    /* protected by the capture state lock */
+    virNWFilterCaptureSubPtr next;
+
+    /* protected by the lock of @worker */
+    bool removed;
+    bool busy;
+    bool tickPending;
+    size_t queued;
+    unsigned long long dropped;
+};
+
+struct virNWFilterCaptureState {
+    bool enabled;               /* the capture can be started on demand */
+    bool packetSocket;          /* false if packets are only injected */
+    unsigned int idleTimeout;   /* ms without subscribers before stopping */
+
+    int fd;
+    unsigned char *ring;
+    size_t block;               /* next block to look at */
+    int wakeupFD[2];
+    virThread reader;
+
+    virMutex lock;              /* protects the members below */
+    virCond stopped;            /* signalled when @stopping is cleared */
+    bool running;
+    bool stopping;              /* the reader is tearing down the capture */
+    bool readerExited;          /* ... and has to be joined */
+    bool quit;
+    size_t callers;             /* threads in virNWFilterCaptureUnsubscribe */
+    unsigned long long idleSince;
+
+    virHashTablePtr subs;       /* ifindex -> list of subscriptions */
+    size_t nsubs[3];            /* subscriptions per protocol */
+    size_t nsubscriptions;
+    unsigned int protocols;     /* protocols the BPF program lets through */
+
+    virNWFilterCaptureWorker workers[CAPTURE_WORKERS];
+    size_t nworkers;
+};
+
+static struct virNWFilterCaptureState virNWFilterCaptureState = {
+    .fd = -1,
+    .wakeupFD = { -1, -1 },
+};
+
+static virClassPtr virNWFilterCaptureSubClass;
+static void virNWFilterCaptureSubDispose(void *obj);
+
+static int
+virNWFilterCaptureOnceInit(void)
+{
+    if (!(virNWFilterCaptureSubClass =
+          virClassNew(virClassForObject(),
+                      "virNWFilterCaptureSub",
+                      sizeof(virNWFilterCaptureSub),
+                      virNWFilterCaptureSubDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNWFilterCapture)
+
+
+static void
+virNWFilterCaptureSubDispose(void *obj)
+{
+    virNWFilterCaptureSubPtr sub = obj;
+
+    if (sub->dropped)
+        VIR_DEBUG("Dropped %llu packets on interface %d",
+                  sub->dropped, sub->ifindex);
+
+    if (sub->cbs.release)
+        sub->cbs.release(sub->opaque);
+}
+
+
+/*
+ * Classic BPF program accepting IPv4 DHCP, ARP and any other IPv4
+ * packet. The return values of the last four instructions select
+ * how much of each class is let through, 0 dropping the class.
+ */
+static const struct sock_filter virNWFilterCaptureProgram[] = {
+    /* ethertype */
+    BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ETHERTYPE_ARP, 13, 0),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ETHERTYPE_IP, 0, 14),
+    /* UDP and not a fragment */
+    BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 23),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_UDP, 0, 11),
+    BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 20),
+    BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K, 0x1fff, 9, 0),
+    /* source and destination port both 67 or 68 */
+    BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, 14),
+    BPF_STMT(BPF_LD + BPF_H + BPF_IND, 14),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 67, 1, 0),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 68, 0, 5),
+    BPF_STMT(BPF_LD + BPF_H + BPF_IND, 16),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 67, 1, 0),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 68, 0, 2),
+    BPF_STMT(BPF_RET + BPF_K, 0),   /* DHCP */
+    BPF_STMT(BPF_RET + BPF_K, 0),   /* ARP */
+    BPF_STMT(BPF_RET + BPF_K, 0),   /* other IPv4 */
+    BPF_STMT(BPF_RET + BPF_K, 0),   /* anything else */
+};
+# define CAPTURE_PROGRAM_RET_DHCP   14
+# define CAPTURE_PROGRAM_RET_ARP    15
+# define CAPTURE_PROGRAM_RET_IPV4   16
+
+
+/**
+ * virNWFilterCaptureAttachFilter:
+ * @fd: the socket
+ * @protocols: bitwise-OR of virNWFilterCaptureProto
+ *
+ * Attach the capture's BPF program to @fd, letting only the given
+ * @protocols through.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNWFilterCaptureAttachFilter(int fd,
+                               unsigned int protocols)
+{
+    struct sock_filter insns[ARRAY_CARDINALITY(virNWFilterCaptureProgram)];
+    struct sock_fprog prog = {
+        .len = ARRAY_CARDINALITY(insns),
+        .filter = insns,
+    };
+
+    memcpy(insns, virNWFilterCaptureProgram, sizeof(insns));
+
+    if (protocols & VIR_NWFILTER_CAPTURE_DHCP)
+        insns[CAPTURE_PROGRAM_RET_DHCP].k = CAPTURE_SNAPLEN_DHCP;
+    if (protocols & VIR_NWFILTER_CAPTURE_ARP)
+        insns[CAPTURE_PROGRAM_RET_ARP].k = CAPTURE_SNAPLEN_HEADERS;
+    if (protocols & VIR_NWFILTER_CAPTURE_IPV4) {
+        insns[CAPTURE_PROGRAM_RET_IPV4].k = CAPTURE_SNAPLEN_HEADERS;
+        /* IPv4 headers are wanted for DHCP packets too */
+        if (!(protocols & VIR_NWFILTER_CAPTURE_DHCP))
+            insns[CAPTURE_PROGRAM_RET_DHCP].k = CAPTURE_SNAPLEN_HEADERS;
+    }
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                   &prog, sizeof(prog)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to attach capture filter"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+virNWFilterCaptureSetFilter(unsigned int protocols)
+{
+    if (virNWFilterCaptureState.fd >= 0 &&
+        virNWFilterCaptureAttachFilter(virNWFilterCaptureState.fd,
+                                       protocols) < 0)
+        return -1;
+
+    virNWFilterCaptureState.protocols = protocols;
+    return 0;
+}
+
+
+/* Must be called with the state lock held */
+static void
+virNWFilterCaptureUpdateFilter(void)
+{
+    unsigned int protocols = 0;
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(virNWFilterCaptureState.nsubs); i++) {
+        if (virNWFilterCaptureState.nsubs[i])
+            protocols |= 1 << i;
+    }
+
+    if (protocols == virNWFilterCaptureState.protocols)
+        return;
+
+    VIR_DEBUG("Capturing protocols 0x%x", protocols);
+
+    if (virNWFilterCaptureSetFilter(protocols) < 0) {
+        VIR_WARN("Unable to update capture filter: %s",
+                 virGetLastErrorMessage());
+        virResetLastError();
+    }
+}
+
+
+unsigned int
+virNWFilterCaptureClassify(const unsigned char *packet,
+                           size_t len)
+{
+    const struct ether_header *eth = (const struct ether_header *)packet;
+    const unsigned char *ip = packet + sizeof(*eth);
+    size_t ihl;
+    uint16_t sport;
+    uint16_t dport;
+
+    if (len < sizeof(*eth))
+        return 0;
+
+    switch (ntohs(eth->ether_type)) {
+    case ETHERTYPE_ARP:
+        return VIR_NWFILTER_CAPTURE_ARP;
+    case ETHERTYPE_IP:
+        break;
+    default:
+        return 0;
+    }
+
+    if (len < sizeof(*eth) + 20)
+        return 0;
+
+    ihl = (ip[0] & 0xf) * 4;
+    if (ip[9] != IPPROTO_UDP ||
+        ((ip[6] << 8 | ip[7]) & 0x1fff) != 0 ||
+        len < sizeof(*eth) + ihl + 4)
+        return VIR_NWFILTER_CAPTURE_IPV4;
+
+    sport = ip[ihl] << 8 | ip[ihl + 1];
+    dport = ip[ihl + 2] << 8 | ip[ihl + 3];
+    if ((sport == 67 || sport == 68) && (dport == 67 || dport == 68))
+        return VIR_NWFILTER_CAPTURE_DHCP;
+
+    return VIR_NWFILTER_CAPTURE_IPV4;
+}
+
+
+/* Must be called with the lock of @worker held */
+static void
+virNWFilterCaptureWorkerPush(virNWFilterCaptureWorkerPtr worker,
+                             virNWFilterCaptureJobPtr job)
+{
+    if (worker->tail)
+        worker->tail->next = job;
+    else
+        worker->head = job;
+    worker->tail = job;
+
+    virCondSignal(&worker->cond);
+}
+
+
+static void
+virNWFilterCaptureJobFree(virNWFilterCaptureJobPtr job)
+{
+    virObjectUnref(job->sub);
+    VIR_FREE(job);
+}
+
+
+/* Must be called with the state lock held */
+static void
+virNWFilterCaptureQueuePacket(virNWFilterCaptureSubPtr sub,
+                              const unsigned char *packet,
+                              size_t len,
+                              bool outgoing)
+{
+    virNWFilterCaptureWorkerPtr worker = sub->worker;
+    virNWFilterCaptureJobPtr job = NULL;
+
+    virMutexLock(&worker->lock);
+
+    if (sub->removed)
+        goto cleanup;
+
+    if (sub->queued >= sub->maxQueued) {
+        sub->dropped++;
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_VAR_QUIET(job, unsigned char, len) < 0) {
+        sub->dropped++;
+        goto cleanup;
+    }
+
+    job->sub = virObjectRef(sub);
+    job->outgoing = outgoing;
+    job->len = len;
+    memcpy(job->packet, packet, len);
+
+    sub->queued++;
+    virNWFilterCaptureWorkerPush(worker, job);
+
+ cleanup:
+    virMutexUnlock(&worker->lock);
+}
+
+
+/**
+ * virNWFilterCaptureDeliver:
+ * @ifindex: index of the interface @packet was seen on
+ * @packet: the packet, starting with the Ethernet header
+ * @len: length of @packet
+ * @outgoing: whether the host sent @packet
+ *
+ * Queue @packet for the subscriptions of @ifindex that asked
+ * for its protocol.
+ */
+void
+virNWFilterCaptureDeliver(int ifindex,
+                          const unsigned char *packet,
+                          size_t len,
+                          bool outgoing)
+{
+    virNWFilterCaptureSubPtr sub;
+    unsigned int proto;
+    IFINDEX2STR(ifindex_str, ifindex);
+
+    if (!(proto = virNWFilterCaptureClassify(packet, len)))
+        return;
+
+    virMutexLock(&virNWFilterCaptureState.lock);
+
+    for (sub = virHashLookup(virNWFilterCaptureState.subs, ifindex_str);
+         sub; sub = sub->next) {
+        if (sub->protocols & proto)
+            virNWFilterCaptureQueuePacket(sub, packet, len, outgoing);
+    }
+
+    virMutexUnlock(&virNWFilterCaptureState.lock);
+}
+
+
+static void
+virNWFilterCaptureQueueTick(virNWFilterCaptureSubPtr sub)
+{
+    virNWFilterCaptureWorkerPtr worker = sub->worker;
+    virNWFilterCaptureJobPtr job;
+
+    virMutexLock(&worker->lock);
+
+    if (!sub->removed && !sub->tickPending &&
+        VIR_ALLOC_QUIET(job) == 0) {
+        job->sub = virObjectRef(sub);
+        job->tick = true;
+        sub->tickPending = true;
+        virNWFilterCaptureWorkerPush(worker, job);
+    }
+
+    virMutexUnlock(&worker->lock);
+}
+
+
+static void
+virNWFilterCaptureTickIter(void *payload,
+                           const void *name ATTRIBUTE_UNUSED,
+                           void *data ATTRIBUTE_UNUSED)
+{
+    virNWFilterCaptureSubPtr sub;
+
+    for (sub = payload; sub; sub = sub->next) {
+        if (sub->cbs.tick)
+            virNWFilterCaptureQueueTick(sub);
+    }
+}
+
+
+/* Hand all blocks the kernel has passed to us to the subscribers */
+static void
+virNWFilterCaptureReadRing(void)
+{
+    for (;;) {
+        struct tpacket_block_desc *desc;
+        struct tpacket3_hdr *hdr;
+        uint32_t i;
+
+        desc = (struct tpacket_block_desc *)
+            (virNWFilterCaptureState.ring +
+             virNWFilterCaptureState.block * CAPTURE_BLOCK_SIZE);
+
+        if (!(desc->hdr.bh1.block_status & TP_STATUS_USER))
+            break;
+
+        __sync_synchronize();
+
+        VIR_WARNINGS_NO_CAST_ALIGN
+        hdr = (struct tpacket3_hdr *)
+            ((unsigned char *)desc + desc->hdr.bh1.offset_to_first_pkt);
+        VIR_WARNINGS_RESET
+
+        for (i = 0; i < desc->hdr.bh1.num_pkts; i++) {
+            struct sockaddr_ll *sll;
+
+            VIR_WARNINGS_NO_CAST_ALIGN
+            sll = (struct sockaddr_ll *)
+                ((unsigned char *)hdr +
+                 TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+            VIR_WARNINGS_RESET
+
+            virNWFilterCaptureDeliver(sll->sll_ifindex,
+                                      (unsigned char *)hdr + hdr->tp_mac,
+                                      hdr->tp_snaplen,
+                                      sll->sll_pkttype == PACKET_OUTGOING);
+
+            VIR_WARNINGS_NO_CAST_ALIGN
+            hdr = (struct tpacket3_hdr *)
+                ((unsigned char *)hdr + hdr->tp_next_offset);
+            VIR_WARNINGS_RESET
+        }
+
+        __sync_synchronize();
+        desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+        virNWFilterCaptureState.block =
+            (virNWFilterCaptureState.block + 1) % CAPTURE_BLOCK_NR;
+    }
+}
+
+
+/* Must be called with the state lock held */
+static void
+virNWFilterCaptureWakeup(void)
+{
+    char c = 0;
+
+    if (virNWFilterCaptureState.wakeupFD[1] >= 0 &&
+        write(virNWFilterCaptureState.wakeupFD[1], &c, 1) < 0 &&
+        errno != EAGAIN)
+        VIR_WARN("Unable to wake up the packet capture thread");
+}
+
+
+/*
+ * Decide whether the capture has been without subscribers for long
+ * enough to be stopped. Otherwise lower @deadline to the point in time
+ * at which it would be. Must be called with the state lock held.
+ */
+static bool
+virNWFilterCaptureIdle(unsigned long long now,
+                       unsigned long long *deadline)
+{
+    size_t i;
+
+    if (virNWFilterCaptureState.nsubscriptions ||
+        virNWFilterCaptureState.callers) {
+        virNWFilterCaptureState.idleSince = 0;
+        return false;
+    }
+
+    /* Callbacks still running or queued may need the workers */
+    for (i = 0; i < virNWFilterCaptureState.nworkers; i++) {
+        virNWFilterCaptureWorkerPtr worker =
+            &virNWFilterCaptureState.workers[i];
+        bool busy;
+
+        virMutexLock(&worker->lock);
+        busy = worker->head || worker->active;
+        virMutexUnlock(&worker->lock);
+
+        if (busy)
+            return false;
+    }
+
+    if (!virNWFilterCaptureState.idleSince)
+        virNWFilterCaptureState.idleSince = now;
+
+    if (now - virNWFilterCaptureState.idleSince >=
+        virNWFilterCaptureState.idleTimeout)
+        return true;
+
+    *deadline = MIN(*deadline, virNWFilterCaptureState.idleSince +
+                    virNWFilterCaptureState.idleTimeout);
+    return false;
+}
+
+
+static void virNWFilterCaptureStopWorkers(void);
+static void virNWFilterCaptureClose(void);
+
+static void
+virNWFilterCaptureReader(void *opaque ATTRIBUTE_UNUSED)
+{
+    unsigned long long nextTick = 0;
+
+    for (;;) {
+        struct pollfd fds[] = {
+            { .fd = virNWFilterCaptureState.fd, .events = POLLIN },
+            { .fd = virNWFilterCaptureState.wakeupFD[0], .events = POLLIN },
+        };
+        unsigned long long now;
+        unsigned long long deadline;
+        char buf[64];
+
+        if (virNWFilterCaptureState.ring)
+            virNWFilterCaptureReadRing();
+
+        if (virTimeMillisNow(&now) < 0)
+            now = nextTick;
+
+        virMutexLock(&virNWFilterCaptureState.lock);
+
+        if (virNWFilterCaptureState.quit) {
+            virMutexUnlock(&virNWFilterCaptureState.lock);
+            return;
+        }
+
+        if (now >= nextTick) {
+            virHashForEach(virNWFilterCaptureState.subs,
+                           virNWFilterCaptureTickIter, NULL);
+            nextTick = now + CAPTURE_TICK_MS;
+        }
+
+        deadline = nextTick;
+        if (virNWFilterCaptureIdle(now, &deadline)) {
+            virNWFilterCaptureState.running = false;
+            virNWFilterCaptureState.stopping = true;
+            virMutexUnlock(&virNWFilterCaptureState.lock);
+            break;
+        }
+
+        virMutexUnlock(&virNWFilterCaptureState.lock);
+
+        /* a negative fd is ignored by poll() */
+        if (poll(fds, ARRAY_CARDINALITY(fds), deadline - now) < 0 &&
+            errno != EINTR && errno != EAGAIN) {
+            VIR_WARN("Polling the capture socket failed: %s",
+                     virStrerror(errno, buf, sizeof(buf)));
+            usleep(CAPTURE_TICK_MS * 1000);
+        }
+
+        if (fds[1].revents) {
+            while (read(virNWFilterCaptureState.wakeupFD[0],
+                        buf, sizeof(buf)) > 0)
+                ;
+        }
+    }
+
+    /* Nobody is subscribed and no callback is pending, so nothing
+     * can use the workers anymore */
+    VIR_DEBUG("No subscriptions left, stopping shared packet capture");
+
+    virNWFilterCaptureStopWorkers();
+    virNWFilterCaptureClose();
+
+    virMutexLock(&virNWFilterCaptureState.lock);
+    virNWFilterCaptureState.stopping = false;
+    virNWFilterCaptureState.readerExited = true;
+    virCondBroadcast(&virNWFilterCaptureState.stopped);
+    virMutexUnlock(&virNWFilterCaptureState.lock);
+}
+
+
+static void
+virNWFilterCaptureWorkerRun(void *opaque)
+{
+    virNWFilterCaptureWorkerPtr worker = opaque;
+
+    virMutexLock(&worker->lock);
+
+    while (!worker->quit) {
+        virNWFilterCaptureJobPtr job = worker->head;
+        virNWFilterCaptureSubPtr sub;
+
+        if (!job) {
+            if (virCondWait(&worker->cond, &worker->lock) < 0) {
+                VIR_WARN("Unable to wait on capture worker condition");
+                break;
+            }
+            continue;
+        }
+
+        if (!(worker->head = job->next))
+            worker->tail = NULL;
+
+        sub = job->sub;
+        if (job->tick)
+            sub->tickPending = false;
+        else
+            sub->queued--;
+
+        worker->active = true;
+
+        if (sub->removed) {
+            virMutexUnlock(&worker->lock);
+            virNWFilterCaptureJobFree(job);
+            virMutexLock(&worker->lock);
+            worker->active = false;
+            continue;
+        }
+
+        sub->busy = true;
+        virMutexUnlock(&worker->lock);
+
+        if (job->tick)
+            sub->cbs.tick(sub, sub->opaque);
+        else
+            sub->cbs.packet(sub, job->packet, job->len, job->outgoing,
+                            sub->opaque);
+
+        virMutexLock(&worker->lock);
+        sub->busy = false;
+        virCondBroadcast(&worker->idle);
+
+        /* this may drop the last reference to @sub */
+        virMutexUnlock(&worker->lock);
+        virNWFilterCaptureJobFree(job);
+        virMutexLock(&worker->lock);
+        worker->active = false;
+    }
+
+    virMutexUnlock(&worker->lock);
+}
+
+
+static int
+virNWFilterCaptureOpen(void)
+{
+    struct tpacket_req3 req = {
+        .tp_block_size = CAPTURE_BLOCK_SIZE,
+        .tp_block_nr = CAPTURE_BLOCK_NR,
+        .tp_frame_size = CAPTURE_FRAME_SIZE,
+        .tp_frame_nr = CAPTURE_BLOCK_SIZE / CAPTURE_FRAME_SIZE *
+                       CAPTURE_BLOCK_NR,
+        .tp_retire_blk_tov = CAPTURE_BLOCK_TIMEOUT_MS,
+    };
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(ETH_P_ALL),
+        .sll_ifindex = 0,
+    };
+    int version = TPACKET_V3;
+    void *ring;
+
+    /* Don't receive anything before the filter is in place */
+    if ((virNWFilterCaptureState.fd =
+         socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to open packet socket"));
+        return -1;
+    }
+
+    if (virNWFilterCaptureSetFilter(0) < 0)
+        return -1;
+
+    if (setsockopt(virNWFilterCaptureState.fd, SOL_PACKET, PACKET_VERSION,
+                   &version, sizeof(version)) < 0 ||
+        setsockopt(virNWFilterCaptureState.fd, SOL_PACKET, PACKET_RX_RING,
+                   &req, sizeof(req)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to set up TPACKET_V3 receive ring"));
+        return -1;
+    }
+
+    ring = mmap(NULL, CAPTURE_BLOCK_SIZE * CAPTURE_BLOCK_NR,
+                PROT_READ | PROT_WRITE, MAP_SHARED,
+                virNWFilterCaptureState.fd, 0);
+    if (ring == MAP_FAILED) {
+        virReportSystemError(errno, "%s",
+                             _("unable to map packet receive ring"));
+        return -1;
+    }
+    virNWFilterCaptureState.ring = ring;
+    virNWFilterCaptureState.block = 0;
+
+    if (bind(virNWFilterCaptureState.fd,
+             (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to bind packet socket"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+virNWFilterCaptureClose(void)
+{
+    if (virNWFilterCaptureState.ring) {
+        munmap(virNWFilterCaptureState.ring,
+               CAPTURE_BLOCK_SIZE * CAPTURE_BLOCK_NR);
+        virNWFilterCaptureState.ring = NULL;
+    }
+    VIR_FORCE_CLOSE(virNWFilterCaptureState.fd);
+    VIR_FORCE_CLOSE(virNWFilterCaptureState.wakeupFD[0]);
+    VIR_FORCE_CLOSE(virNWFilterCaptureState.wakeupFD[1]);
+    virNWFilterCaptureState.protocols = 0;
+}
+
+
+static void
+virNWFilterCaptureStopWorkers(void)
+{
+    size_t i;
+
+    for (i = 0; i < virNWFilterCaptureState.nworkers; i++) {
+        virNWFilterCaptureWorkerPtr worker =
+            &virNWFilterCaptureState.workers[i];
+
+        virMutexLock(&worker->lock);
+        worker->quit = true;
+        virCondSignal(&worker->cond);
+        virMutexUnlock(&worker->lock);
+
+        virThreadJoin(&worker->thread);
+
+        while (worker->head) {
+            virNWFilterCaptureJobPtr job = worker->head;
+
+            worker->head = job->next;
+            virNWFilterCaptureJobFree(job);
+        }
+        worker->tail = NULL;
+
+        virCondDestroy(&worker->idle);
+        virCondDestroy(&worker->cond);
+        virMutexDestroy(&worker->lock);
+    }
+
+    virNWFilterCaptureState.nworkers = 0;
+}
+
+
+/*
+ * Open the socket and start the reader and worker threads for the
+ * first subscription. Must be called with the state lock held.
+ */
+static int
+virNWFilterCaptureStart(void)
+{
+    size_t i;
+
+    if (virNWFilterCaptureState.readerExited) {
+        virThreadJoin(&virNWFilterCaptureState.reader);
+        virNWFilterCaptureState.readerExited = false;
+    }
+
+    if (virNWFilterCaptureState.packetSocket &&
+        virNWFilterCaptureOpen() < 0)
+        goto error;
+
+    if (pipe2(virNWFilterCaptureState.wakeupFD, O_CLOEXEC | O_NONBLOCK) < 0) {
+        virReportSystemError(errno, "%s", _("unable to create pipe"));
+        goto error;
+    }
+
+    for (i = 0; i < CAPTURE_WORKERS; i++) {
+        virNWFilterCaptureWorkerPtr worker =
+            &virNWFilterCaptureState.workers[i];
+
+        memset(worker, 0, sizeof(*worker));
+        if (virMutexInit(&worker->lock) < 0) {
+            virReportSystemError(errno, "%s", _("unable to init mutex"));
+            goto error;
+        }
+        if (virCondInit(&worker->cond) < 0) {
+            virReportSystemError(errno, "%s", _("unable to init condition"));
+            virMutexDestroy(&worker->lock);
+            goto error;
+        }
+        if (virCondInit(&worker->idle) < 0) {
+            virReportSystemError(errno, "%s", _("unable to init condition"));
+            virCondDestroy(&worker->cond);
+            virMutexDestroy(&worker->lock);
+            goto error;
+        }
+        if (virThreadCreate(&worker->thread, true,
+                            virNWFilterCaptureWorkerRun, worker) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("unable to create capture worker"));
+            virCondDestroy(&worker->idle);
+            virCondDestroy(&worker->cond);
+            virMutexDestroy(&worker->lock);
+            goto error;
+        }
+        virNWFilterCaptureState.nworkers++;
+    }
+
+    virNWFilterCaptureState.quit = false;
+    virNWFilterCaptureState.idleSince = 0;
+
+    if (virThreadCreate(&virNWFilterCaptureState.reader, true,
+                        virNWFilterCaptureReader, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create capture thread"));
+        goto error;
+    }
+
+    virNWFilterCaptureState.running = true;
+    VIR_DEBUG("Shared packet capture running with %zu workers",
+              virNWFilterCaptureState.nworkers);
+
+    return 0;
+
+ error:
+    virNWFilterCaptureStopWorkers();
+    virNWFilterCaptureClose();
+    return -1;
+}
+
+
+static void
+virNWFilterCaptureSubListFree(void *payload,
+                              const void *name ATTRIBUTE_UNUSED)
+{
+    virNWFilterCaptureSubPtr sub = payload;
+
+    while (sub) {
+        virNWFilterCaptureSubPtr next = sub->next;
+
+        sub->next = NULL;
+        virObjectUnref(sub);
+        sub = next;
+    }
+}
+
+
+/**
+ * virNWFilterCaptureInitInternal:
+ * @packetSocket: whether to capture from a packet socket
+ * @idleTimeout: milliseconds to keep the capture up without subscribers
+ *
+ * Set up the capture state. Without @packetSocket, packets are only
+ * delivered through virNWFilterCaptureDeliver(), which allows testing
+ * without privileges.
+ *
+ * Returns 0 on success, -1 on fatal errors.
+ */
+int
+virNWFilterCaptureInitInternal(bool packetSocket,
+                               unsigned int idleTimeout)
+{
+    if (virNWFilterCaptureState.subs)
+        return 0;
+
+    if (virNWFilterCaptureInitialize() < 0)
+        return -1;
+
+    if (virMutexInit(&virNWFilterCaptureState.lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        return -1;
+    }
+
+    if (virCondInit(&virNWFilterCaptureState.stopped) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init condition"));
+        virMutexDestroy(&virNWFilterCaptureState.lock);
+        return -1;
+    }
+
+    if (!(virNWFilterCaptureState.subs =
+          virHashCreate(0, virNWFilterCaptureSubListFree))) {
+        virCondDestroy(&virNWFilterCaptureState.stopped);
+        virMutexDestroy(&virNWFilterCaptureState.lock);
+        return -1;
+    }
+
+    virNWFilterCaptureState.packetSocket = packetSocket;
+    virNWFilterCaptureState.idleTimeout = idleTimeout;
+
+    /* Only find out whether the socket can be set up; it is opened
+     * for real once somebody subscribes */
+    if (packetSocket) {
+        int rc = virNWFilterCaptureOpen();
+
+        virNWFilterCaptureClose();
+        if (rc < 0) {
+            VIR_WARN("Shared packet capture unavailable, capturing on each "
+                     "interface separately: %s", virGetLastErrorMessage());
+            virResetLastError();
+            return 0;
+        }
+    }
+
+    virNWFilterCaptureState.enabled = true;
+
+    return 0;
+}
+
+
+/**
+ * virNWFilterCaptureInit:
+ *
+ * Find out whether the shared packet capture can be used. Failing to
+ * set it up is not fatal; callers are expected to check
+ * virNWFilterCaptureAvailable() and fall back to capturing on each
+ * interface on their own.
+ *
+ * Returns 0 on success, -1 on fatal errors.
+ */
+int
+virNWFilterCaptureInit(void)
+{
+    return virNWFilterCaptureInitInternal(true, CAPTURE_IDLE_TIMEOUT_MS);
+}
+
+
+void
+virNWFilterCaptureShutdown(void)
+{
+    bool running;
+
+    if (!virNWFilterCaptureState.subs)
+        return;
+
+    virMutexLock(&virNWFilterCaptureState.lock);
+    while (virNWFilterCaptureState.stopping)
+        ignore_value(virCondWait(&virNWFilterCaptureState.stopped,
+                                 &virNWFilterCaptureState.lock));
+    running = virNWFilterCaptureState.running;
+    if (running) {
+        virNWFilterCaptureState.quit = true;
+        virNWFilterCaptureWakeup();
+    }
+    virMutexUnlock(&virNWFilterCaptureState.lock);
+
+    if (running || virNWFilterCaptureState.readerExited)
+        virThreadJoin(&virNWFilterCaptureState.reader);
+
+    virNWFilterCaptureStopWorkers();
+    virNWFilterCaptureClose();
+
+    virHashFree(virNWFilterCaptureState.subs);
+    virNWFilterCaptureState.subs = NULL;
+    memset(virNWFilterCaptureState.nsubs, 0,
+           sizeof(virNWFilterCaptureState.nsubs));
+    virNWFilterCaptureState.nsubscriptions = 0;
+    virNWFilterCaptureState.running = false;
+    virNWFilterCaptureState.readerExited = false;
+    virNWFilterCaptureState.enabled = false;
+    virCondDestroy(&virNWFilterCaptureState.stopped);
+    virMutexDestroy(&virNWFilterCaptureState.lock);
+}
+
+
+bool
+virNWFilterCaptureAvailable(void)
+{
+    return virNWFilterCaptureState.enabled;
+}
+
+
+/**
+ * virNWFilterCaptureIsRunning:
+ *
+ * Returns whether the socket and threads of the capture are set up.
+ */
+bool
+virNWFilterCaptureIsRunning(void)
+{
+    bool ret;
+
+    if (!virNWFilterCaptureState.subs)
+        return false;
+
+    virMutexLock(&virNWFilterCaptureState.lock);
+    ret = virNWFilterCaptureState.running || virNWFilterCaptureState.stopping;
+    virMutexUnlock(&virNWFilterCaptureState.lock);
+
+    return ret;
+}
+
+
+/**
+ * virNWFilterCaptureSubscribe:
+ * @ifindex: index of the interface to capture on
+ * @protocols: bitwise-OR of virNWFilterCaptureProto
+ * @maxQueued: how many packets may be waiting for @cbs->packet
+ *             before further ones are dropped
+ * @cbs: the callbacks
+ * @opaque: data passed to the callbacks
+ *
+ * Start delivering the packets of the given @protocols that are
+ * sent or received on interface @ifindex to @cbs->packet, starting
+ * the capture if this is the first subscription. The callbacks are
+ * invoked from a worker thread, never concurrently for the same
+ * interface.
+ *
+ * Returns the subscription, to be passed to
+ * virNWFilterCaptureUnsubscribe() and released by virObjectUnref(),
+ * or NULL on error.
+ */
+virNWFilterCaptureSubPtr
+virNWFilterCaptureSubscribe(int ifindex,
+                            unsigned int protocols,
+                            size_t maxQueued,
+                            const virNWFilterCaptureCallbacks *cbs,
+                            void *opaque)
+{
+    virNWFilterCaptureSubPtr sub;
+    virNWFilterCaptureSubPtr head;
+    size_t i;
+    IFINDEX2STR(ifindex_str, ifindex);
+
+    if (!virNWFilterCaptureState.enabled) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("shared packet capture is not available"));
+        return NULL;
+    }
+
+    if (!(sub = virObjectNew(virNWFilterCaptureSubClass)))
+        return NULL;
+
+    sub->ifindex = ifindex;
+    sub->protocols = protocols;
+    sub->maxQueued = maxQueued;
+    sub->cbs = *cbs;
+    sub->opaque = opaque;
+
+    virMutexLock(&virNWFilterCaptureState.lock);
+
+    while (virNWFilterCaptureState.stopping)
+        ignore_value(virCondWait(&virNWFilterCaptureState.stopped,
+                                 &virNWFilterCaptureState.lock));
+
+    if (!virNWFilterCaptureState.running &&
+        virNWFilterCaptureStart() < 0)
+        goto error;
+
+    sub->worker = &virNWFilterCaptureState.workers[ifindex %
+                                                   virNWFilterCaptureState.nworkers];
+
+    head = virHashLookup(virNWFilterCaptureState.subs, ifindex_str);
+    if (head) {
+        sub->next = head->next;
+        head->next = sub;
+    } else if (virHashAddEntry(virNWFilterCaptureState.subs,
+                               ifindex_str, sub) < 0) {
+        goto error;
+    }
+
+    /* the list holds one reference, the caller the other */
+    virObjectRef(sub);
+
+    for (i = 0; i < ARRAY_CARDINALITY(virNWFilterCaptureState.nsubs); i++) {
+        if (protocols & (1 << i))
+            virNWFilterCaptureState.nsubs[i]++;
+    }
+    virNWFilterCaptureState.nsubscriptions++;
+    virNWFilterCaptureUpdateFilter();
+
+    virMutexUnlock(&virNWFilterCaptureState.lock);
+
+    VIR_DEBUG("Capturing protocols 0x%x on interface %d",
+              protocols, ifindex);
+
+    return sub;
+
+ error:
+    virMutexUnlock(&virNWFilterCaptureState.lock);
+    /* don't let the caller's opaque be released on error */
+    sub->cbs.release = NULL;
+    virObjectUnref(sub);
+    return NULL;
+}
+
+
+/**
+ * virNWFilterCaptureKick:
+ * @sub: the subscription
+ *
+ * Have the tick callback of @sub invoked as soon as possible. Must
+ * not be called once @sub was unsubscribed.
+ */
+void
+virNWFilterCaptureKick(virNWFilterCaptureSubPtr sub)
+{
+    if (sub->cbs.tick)
+        virNWFilterCaptureQueueTick(sub);
+}
+
+
+/**
+ * virNWFilterCaptureUnsubscribe:
+ * @sub: the subscription
+ * @flags: bitwise-OR of virNWFilterCaptureUnsubscribeFlags
+ *
+ * Stop delivering packets to @sub. Callbacks of @sub will not be
+ * invoked after this returns, with the exception of one that may
+ * be running in a worker thread right now. With
+ * VIR_NWFILTER_CAPTURE_UNSUBSCRIBE_WAIT this waits for such a
+ * callback to finish, unless called from the callback itself; the
+ * caller must not hold any lock that callback might need. Must be
+ * called only once for @sub.
+ *
+ * The reference to @sub held by the caller must still be released.
+ */
+void
+virNWFilterCaptureUnsubscribe(virNWFilterCaptureSubPtr sub,
+                              unsigned int flags)
+{
+    virNWFilterCaptureWorkerPtr worker = sub->worker;
+    virNWFilterCaptureJobPtr *job;
+    virNWFilterCaptureJobPtr stale = NULL;
+    virNWFilterCaptureSubPtr first;
+    virNWFilterCaptureSubPtr head;
+    virNWFilterCaptureSubPtr *prev;
+    bool found = false;
+    size_t i;
+    IFINDEX2STR(ifindex_str, sub->ifindex);
+
+    virCheckFlags(VIR_NWFILTER_CAPTURE_UNSUBSCRIBE_WAIT, );
+
+    virMutexLock(&virNWFilterCaptureState.lock);
+
+    /* keeps the workers from being stopped until we are done */
+    virNWFilterCaptureState.callers++;
+
+    /* Take the jobs still queued for @sub out so that its reference
+     * count reflects the subscriber's references only */
+    virMutexLock(&worker->lock);
+    sub->removed = true;
+    for (job = &worker->head; *job; ) {
+        virNWFilterCaptureJobPtr tmp = *job;
+
+        if (tmp->sub != sub) {
+            worker->tail = tmp;
+            job = &tmp->next;
+            continue;
+        }
+
+        *job = tmp->next;
+        tmp->next = stale;
+        stale = tmp;
+    }
+    if (!worker->head)
+        worker->tail = NULL;
+    sub->queued = 0;
+    sub->tickPending = false;
+    virMutexUnlock(&worker->lock);
+
+    first = head = virHashLookup(virNWFilterCaptureState.subs, ifindex_str);
+    for (prev = &head; *prev; prev = &(*prev)->next) {
+        if (*prev == sub) {
+            *prev = sub->next;
+            sub->next = NULL;
+            found = true;
+            break;
+        }
+    }
+
+    if (found) {
+        /* virHashUpdateEntry() would free the list */
+        if (first == sub) {
+            ignore_value(virHashSteal(virNWFilterCaptureState.subs,
+                                      ifindex_str));
+            if (head &&
+                virHashAddEntry(virNWFilterCaptureState.subs,
+                                ifindex_str, head) < 0) {
+                VIR_WARN("Lost capture subscriptions of interface %d",
+                         sub->ifindex);
+                virResetLastError();
+            }
+        }
+
+        for (i = 0; i < ARRAY_CARDINALITY(virNWFilterCaptureState.nsubs); i++) {
+            if (sub->protocols & (1 << i))
+                virNWFilterCaptureState.nsubs[i]--;
+        }
+        virNWFilterCaptureState.nsubscriptions--;
+        virNWFilterCaptureUpdateFilter();
+    }
+
+    virMutexUnlock(&virNWFilterCaptureState.lock);
+
+    if ((flags & VIR_NWFILTER_CAPTURE_UNSUBSCRIBE_WAIT) &&
+        !virThreadIsSelf(&worker->thread)) {
+        virMutexLock(&worker->lock);
+        while (sub->busy) {
+            if (virCondWait(&worker->idle, &worker->lock) < 0) {
+                VIR_WARN("Unable to wait on capture worker condition");
+                break;
+            }
+        }
+        virMutexUnlock(&worker->lock);
+    }
+
+    while (stale) {
+        virNWFilterCaptureJobPtr next = stale->next;
+
+        virNWFilterCaptureJobFree(stale);
+        stale = next;
+    }
+
+    virMutexLock(&virNWFilterCaptureState.lock);
+    virNWFilterCaptureState.callers--;
+    /* let the reader notice that the capture may be idle now */
+    if (!virNWFilterCaptureState.nsubscriptions &&
+        !virNWFilterCaptureState.callers)
+        virNWFilterCaptureWakeup();
+    virMutexUnlock(&virNWFilterCaptureState.lock);
+
+    /* drop the reference of the list */
+    if (found)
+        virObjectUnref(sub);
+}
+
+#else /* !(__linux__ && TPACKET3_HDRLEN) */
+
+int
+virNWFilterCaptureInit(void)
+{
+    VIR_DEBUG("No shared packet capture support available");
+    return 0;
+}
+
+
+void
+virNWFilterCaptureShutdown(void)
+{
+}
+
+
+bool
+virNWFilterCaptureAvailable(void)
+{
+    return false;
+}
+
+
+int
+virNWFilterCaptureInitInternal(bool packetSocket ATTRIBUTE_UNUSED,
+                               unsigned int idleTimeout ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+
+bool
+virNWFilterCaptureIsRunning(void)
+{
+    return false;
+}
+
+
+int
+virNWFilterCaptureAttachFilter(int fd ATTRIBUTE_UNUSED,
+                               unsigned int protocols ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                   _("shared packet capture is not available"));
+    return -1;
+}
+
+
+unsigned int
+virNWFilterCaptureClassify(const unsigned char *packet ATTRIBUTE_UNUSED,
+                           size_t len ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+
+void
+virNWFilterCaptureDeliver(int ifindex ATTRIBUTE_UNUSED,
+                          const unsigned char *packet ATTRIBUTE_UNUSED,
+                          size_t len ATTRIBUTE_UNUSED,
+                          bool outgoing ATTRIBUTE_UNUSED)
+{
+}
+
+
+virNWFilterCaptureSubPtr
+virNWFilterCaptureSubscribe(int ifindex ATTRIBUTE_UNUSED,
+                            unsigned int protocols ATTRIBUTE_UNUSED,
+                            size_t maxQueued ATTRIBUTE_UNUSED,
+                            const virNWFilterCaptureCallbacks *cbs ATTRIBUTE_UNUSED,
+                            void *opaque ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                   _("shared packet capture is not available"));
+    return NULL;
+}
+
+
+void
+virNWFilterCaptureKick(virNWFilterCaptureSubPtr sub ATTRIBUTE_UNUSED)
+{
+}
+
+
+void
+virNWFilterCaptureUnsubscribe(virNWFilterCaptureSubPtr sub ATTRIBUTE_UNUSED,
+                              unsigned int flags ATTRIBUTE_UNUSED)
+{
+}
+
+#endif /* !(__linux__ && TPACKET3_HDRLEN) */
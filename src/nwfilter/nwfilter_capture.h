@@ -0,0 +1,78 @@
+/*
+ * nwfilter_capture.h: shared packet capture for DHCP snooping and
+ *                     IP address learning
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NWFILTER_CAPTURE_H
+# define __NWFILTER_CAPTURE_H
+
+# include "internal.h"
+
+typedef enum {
+    VIR_NWFILTER_CAPTURE_DHCP = (1 << 0), /* DHCP over IPv4 */
+    VIR_NWFILTER_CAPTURE_ARP  = (1 << 1),
+    VIR_NWFILTER_CAPTURE_IPV4 = (1 << 2), /* headers of other IPv4 traffic */
+} virNWFilterCaptureProto;
+
+typedef enum {
+    /* Wait for a callback of the subscription that is in progress */
+    VIR_NWFILTER_CAPTURE_UNSUBSCRIBE_WAIT = (1 << 0),
+} virNWFilterCaptureUnsubscribeFlags;
+
+typedef struct _virNWFilterCaptureSub virNWFilterCaptureSub;
+typedef virNWFilterCaptureSub *virNWFilterCaptureSubPtr;
+
+/* @outgoing is true for frames the host sent on the interface, i.e.
+ * for frames going to the VM when capturing on its tap device */
+typedef void (*virNWFilterCapturePacketFunc)(virNWFilterCaptureSubPtr sub,
+                                             const unsigned char *packet,
+                                             size_t len,
+                                             bool outgoing,
+                                             void *opaque);
+typedef void (*virNWFilterCaptureTickFunc)(virNWFilterCaptureSubPtr sub,
+                                           void *opaque);
+
+typedef struct _virNWFilterCaptureCallbacks virNWFilterCaptureCallbacks;
+typedef virNWFilterCaptureCallbacks *virNWFilterCaptureCallbacksPtr;
+struct _virNWFilterCaptureCallbacks {
+    virNWFilterCapturePacketFunc packet;
+    virNWFilterCaptureTickFunc tick;    /* optional, about once a second */
+    virFreeCallback release;            /* optional, frees the opaque */
+};
+
+int virNWFilterCaptureInit(void);
+void virNWFilterCaptureShutdown(void);
+bool virNWFilterCaptureAvailable(void);
+
+virNWFilterCaptureSubPtr
+virNWFilterCaptureSubscribe(int ifindex,
+                            unsigned int protocols,
+                            size_t maxQueued,
+                            const virNWFilterCaptureCallbacks *cbs,
+                            void *opaque)
+    ATTRIBUTE_NONNULL(4);
+
+void virNWFilterCaptureKick(virNWFilterCaptureSubPtr sub)
+    ATTRIBUTE_NONNULL(1);
+
+void virNWFilterCaptureUnsubscribe(virNWFilterCaptureSubPtr sub,
+                                   unsigned int flags)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __NWFILTER_CAPTURE_H */
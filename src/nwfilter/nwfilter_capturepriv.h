@@ -0,0 +1,47 @@
+/*
+ * nwfilter_capturepriv.h: internals of the shared packet capture,
+ *                         exposed for the test suite
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NWFILTER_CAPTURE_PRIV_H_ALLOW__
+# error "nwfilter_capturepriv.h may only be included by nwfilter_capture.c or test suites"
+#endif
+
+#ifndef __NWFILTER_CAPTURE_PRIV_H__
+# define __NWFILTER_CAPTURE_PRIV_H__
+
+# include "nwfilter_capture.h"
+
+int virNWFilterCaptureInitInternal(bool packetSocket,
+                                   unsigned int idleTimeout);
+
+bool virNWFilterCaptureIsRunning(void);
+
+int virNWFilterCaptureAttachFilter(int fd,
+                                   unsigned int protocols);
+
+unsigned int virNWFilterCaptureClassify(const unsigned char *packet,
+                                        size_t len);
+
+void virNWFilterCaptureDeliver(int ifindex,
+                               const unsigned char *packet,
+                               size_t len,
+                               bool outgoing);
+
+#endif /* __NWFILTER_CAPTURE_PRIV_H__ */
@@ -61,6 +61,7 @@
 #include "conf/domain_conf.h"
 #include "nwfilter_gentech_driver.h"
 #include "nwfilter_dhcpsnoop.h"
+#include "nwfilter_capture.h"
 #include "nwfilter_ipaddrmap.h"
 #include "virnetdev.h"
 #include "virfile.h"
@@ -266,9 +267,9 @@ struct _virNWFilterSnoopRateLimitConf {
     time_t prev;
     unsigned int pkt_ctr;
     time_t burst;
-    const unsigned int rate;
-    const unsigned int burstRate;
-    const unsigned int burstInterval;
+    unsigned int rate;
+    unsigned int burstRate;
+    unsigned int burstInterval;
 };
 # define SNOOP_POLL_MAX_TIMEOUT_MS  (10 * 1000) /* milliseconds */
 
@@ -1575,6 +1576,241 @@ virNWFilterDHCPSnoopThread(void *req0)
     return;
 }
 
+/*
+ * Snooping through the shared packet capture: rather than a thread
+ * with pcap handles and a worker of its own, a request subscribes to
+ * the DHCP traffic on its interface and decodes the packets in the
+ * capture's callbacks. The subscription ends itself once the request
+ * was cancelled; it holds a reference to the request until then.
+ */
+typedef struct _virNWFilterSnoopCapture virNWFilterSnoopCapture;
+typedef virNWFilterSnoopCapture *virNWFilterSnoopCapturePtr;
+
+struct _virNWFilterSnoopCapture {
+    virNWFilterSnoopReqPtr req;
+    char *threadkey;
+    int ifindex;
+    /* indep. rate limiters for packets from and to the VM */
+    virNWFilterSnoopRateLimitConf rateLimit[2];
+    time_t lastValidated;
+    time_t lastDisplayed;
+};
+
+/*
+ * Check that a packet is a DHCP request of the VM or a reply from a
+ * server, as the filters of the pcap handles do.
+ */
+static bool
+virNWFilterSnoopCaptureMatch(virNWFilterSnoopReqPtr req,
+                             virNWFilterSnoopEthHdrPtr pep,
+                             size_t len, bool fromVM)
+{
+    struct iphdr *pip;
+    struct udphdr *pup;
+
+    if (len <= MIN_VALID_DHCP_PKT_SIZE || len > PCAP_PBUFSIZE ||
+        ntohs(pep->eh_type) != ETHERTYPE_IP)
+        return false;
+
+    /* don't want to hear about another VM's DHCP requests */
+    if (fromVM && virMacAddrCmpRaw(&req->macaddr, pep->eh_src.addr) != 0)
+        return false;
+
+    VIR_WARNINGS_NO_CAST_ALIGN
+    pip = (struct iphdr *) pep->eh_data;
+    VIR_WARNINGS_RESET
+
+    if (len < offsetof(virNWFilterSnoopEthHdr, eh_data) +
+              (pip->ihl << 2) + sizeof(*pup))
+        return false;
+
+    VIR_WARNINGS_NO_CAST_ALIGN
+    pup = (struct udphdr *) ((char *) pip + (pip->ihl << 2));
+    VIR_WARNINGS_RESET
+
+    if (fromVM)
+        return ntohs(pup->source) == 68 && ntohs(pup->dest) == 67;
+    return ntohs(pup->source) == 67 && ntohs(pup->dest) == 68;
+}
+
+/*
+ * Stop snooping because of an error on the interface: drop the
+ * interface association as the snooping thread does when exiting.
+ */
+static void
+virNWFilterSnoopCaptureFail(virNWFilterSnoopCapturePtr cap)
+{
+    virNWFilterSnoopReqPtr req = cap->req;
+
+    /* protect IfNameToKey */
+    virNWFilterSnoopLock();
+
+    /* protect req->ifname & req->threadkey */
+    virNWFilterSnoopReqLock(req);
+
+    if (virNWFilterSnoopIsActive(cap->threadkey)) {
+        virNWFilterSnoopCancel(&req->threadkey);
+
+        ignore_value(virHashRemoveEntry(virNWFilterSnoopState.ifnameToKey,
+                                        req->ifname));
+
+        VIR_FREE(req->ifname);
+    }
+
+    virNWFilterSnoopReqUnlock(req);
+    virNWFilterSnoopUnlock();
+}
+
+static void
+virNWFilterSnoopCapturePacket(virNWFilterCaptureSubPtr sub,
+                              const unsigned char *packet,
+                              size_t len,
+                              bool outgoing,
+                              void *opaque)
+{
+    virNWFilterSnoopCapturePtr cap = opaque;
+    virNWFilterSnoopReqPtr req = cap->req;
+    virNWFilterSnoopEthHdrPtr pep = (virNWFilterSnoopEthHdrPtr) packet;
+    bool fromVM = !outgoing;
+
+    /*
+     * Check whether we were cancelled or whether
+     * a previously decoded packet failed.
+     */
+    if (!virNWFilterSnoopIsActive(cap->threadkey) ||
+        req->jobCompletionStatus != 0) {
+        virNWFilterCaptureUnsubscribe(sub, 0);
+        return;
+    }
+
+    if (!virNWFilterSnoopCaptureMatch(req, pep, len, fromVM))
+        return;
+
+    if (virNWFilterSnoopRateLimit(&cap->rateLimit[fromVM ? 0 : 1]) > 0) {
+        /* rate-limited warnings */
+        if (time(0) - cap->lastDisplayed > 10) {
+            cap->lastDisplayed = time(0);
+            VIR_WARN("Too many DHCP packets on interface '%s'",
+                     req->ifname);
+        }
+        return;
+    }
+
+    if (virNWFilterSnoopDHCPDecode(req, pep, len, fromVM) == -1) {
+        req->jobCompletionStatus = -1;
+
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Instantiation of rules failed on "
+                         "interface '%s'"), req->ifname);
+
+        virNWFilterCaptureUnsubscribe(sub, 0);
+    }
+}
+
+static void
+virNWFilterSnoopCaptureTick(virNWFilterCaptureSubPtr sub,
+                            void *opaque)
+{
+    virNWFilterSnoopCapturePtr cap = opaque;
+    virNWFilterSnoopReqPtr req = cap->req;
+    time_t now = time(0);
+    int tmp = -1;
+
+    virNWFilterSnoopReqLeaseTimerRun(req);
+
+    if (!virNWFilterSnoopIsActive(cap->threadkey) ||
+        req->jobCompletionStatus != 0) {
+        virNWFilterCaptureUnsubscribe(sub, 0);
+        return;
+    }
+
+    /* the shared capture sees no errors on a vanished interface */
+    if (now - cap->lastValidated < SNOOP_POLL_MAX_TIMEOUT_MS / 1000)
+        return;
+    cap->lastValidated = now;
+
+    /* protect req->ifname */
+    virNWFilterSnoopReqLock(req);
+
+    if (req->ifname)
+        tmp = virNetDevValidateConfig(req->ifname, NULL, cap->ifindex);
+
+    virNWFilterSnoopReqUnlock(req);
+
+    if (tmp <= 0) {
+        virResetLastError();
+        virNWFilterSnoopCaptureFail(cap);
+        virNWFilterCaptureUnsubscribe(sub, 0);
+    }
+}
+
+static void
+virNWFilterSnoopCaptureRelease(void *opaque)
+{
+    virNWFilterSnoopCapturePtr cap = opaque;
+
+    virNWFilterSnoopReqPut(cap->req);
+
+    VIR_FREE(cap->threadkey);
+    VIR_FREE(cap);
+
+    virAtomicIntDecAndTest(&virNWFilterSnoopState.nThreads);
+}
+
+/*
+ * Start snooping on the request's interface through the shared capture.
+ * Call this function with the request locked and its threadkey set.
+ * On success the subscription took over the caller's reference to the
+ * request.
+ */
+static int
+virNWFilterSnoopCaptureStart(virNWFilterSnoopReqPtr req)
+{
+    static const virNWFilterCaptureCallbacks callbacks = {
+        .packet = virNWFilterSnoopCapturePacket,
+        .tick = virNWFilterSnoopCaptureTick,
+        .release = virNWFilterSnoopCaptureRelease,
+    };
+    virNWFilterSnoopCapturePtr cap;
+    virNWFilterCaptureSubPtr sub;
+    size_t i;
+
+    if (VIR_ALLOC(cap) < 0)
+        return -1;
+
+    if (VIR_STRDUP(cap->threadkey, req->threadkey) < 0) {
+        VIR_FREE(cap);
+        return -1;
+    }
+
+    cap->req = req;
+    cap->ifindex = req->ifindex;
+    cap->lastValidated = time(0);
+    for (i = 0; i < ARRAY_CARDINALITY(cap->rateLimit); i++) {
+        cap->rateLimit[i].prev = time(0);
+        cap->rateLimit[i].rate = DHCP_PKT_RATE;
+        cap->rateLimit[i].burstRate = DHCP_PKT_BURST;
+        cap->rateLimit[i].burstInterval = DHCP_BURST_INTERVAL_S;
+    }
+
+    virAtomicIntInc(&virNWFilterSnoopState.nThreads);
+
+    if (!(sub = virNWFilterCaptureSubscribe(req->ifindex,
+                                            VIR_NWFILTER_CAPTURE_DHCP,
+                                            MAX_QUEUED_JOBS,
+                                            &callbacks, cap))) {
+        virAtomicIntDecAndTest(&virNWFilterSnoopState.nThreads);
+        VIR_FREE(cap->threadkey);
+        VIR_FREE(cap);
+        return -1;
+    }
+
+    /* the subscription ends itself once the request is cancelled */
+    virObjectUnref(sub);
+
+    return 0;
+}
+
 static void
 virNWFilterSnoopIFKeyFMT(char *ifkey, const unsigned char *vmuuid,
                          const virMacAddr *macaddr)
@@ -1685,6 +1921,34 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
     /* prevent thread from holding req */
     virNWFilterSnoopReqLock(req);
 
+    if (virNWFilterCaptureAvailable()) {
+        req->threadkey = virNWFilterSnoopActivate(req);
+        if (!req->threadkey) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Activation of snoop request failed on "
+                             "interface '%s'"), req->ifname);
+            goto exit_snoopreq_unlock;
+        }
+
+        if (virNWFilterSnoopReqRestore(req) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Restoring of leases failed on "
+                             "interface '%s'"), req->ifname);
+            goto exit_snoop_cancel;
+        }
+
+        if (virNWFilterSnoopCaptureStart(req) < 0)
+            goto exit_snoop_cancel;
+
+        virNWFilterSnoopReqUnlock(req);
+
+        virNWFilterSnoopUnlock();
+
+        /* do not 'put' the req -- the subscription will do this */
+
+        return 0;
+    }
+
     if (virThreadCreate(&thread, false, virNWFilterDHCPSnoopThread,
                         req) != 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -47,6 +47,7 @@
 #include "nwfilter_ipaddrmap.h"
 #include "nwfilter_dhcpsnoop.h"
 #include "nwfilter_learnipaddr.h"
+#include "nwfilter_capture.h"
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
 
@@ -197,8 +198,10 @@ nwfilterStateInitialize(bool privileged,
 
     if (virNWFilterIPAddrMapInit() < 0)
         goto err_free_driverstate;
-    if (virNWFilterLearnInit() < 0)
+    if (virNWFilterCaptureInit() < 0)
         goto err_exit_ipaddrmapshutdown;
+    if (virNWFilterLearnInit() < 0)
+        goto err_exit_captureshutdown;
     if (virNWFilterDHCPSnoopInit() < 0)
         goto err_exit_learnshutdown;
 
@@ -258,6 +261,8 @@ nwfilterStateInitialize(bool privileged,
     virNWFilterDHCPSnoopShutdown();
  err_exit_learnshutdown:
     virNWFilterLearnShutdown();
+ err_exit_captureshutdown:
+    virNWFilterCaptureShutdown();
  err_exit_ipaddrmapshutdown:
     virNWFilterIPAddrMapShutdown();
 
@@ -334,6 +339,7 @@ nwfilterStateCleanup(void)
         virNWFilterConfLayerShutdown();
         virNWFilterDHCPSnoopShutdown();
         virNWFilterLearnShutdown();
+        virNWFilterCaptureShutdown();
         virNWFilterIPAddrMapShutdown();
         virNWFilterTechDriversShutdown();
 
@@ -66,6 +66,9 @@ VIR_LOG_INIT("nwfilter.nwfilter_learnipaddr");
 
 #define PKT_TIMEOUT_MS 500 /* ms */
 
+/* packets waiting to be looked at when using the shared capture */
+#define LEARN_MAX_QUEUED 64
+
 /* structure of an ARP request/reply message */
 struct f_arphdr {
     struct arphdr arphdr;
@@ -241,6 +244,9 @@ virNWFilterRegisterLearnReq(virNWFilterIPAddrLearnReqPtr req)
 }
 
 
+static void learnIPAddressCaptureCancel(virNWFilterIPAddrLearnReqPtr req,
+                                        virNWFilterCaptureSubPtr sub);
+
 #endif
 
 int
@@ -249,6 +255,9 @@ virNWFilterTerminateLearnReq(const char *ifname)
     int rc = -1;
     int ifindex;
     virNWFilterIPAddrLearnReqPtr req;
+#if HAVE_LIBPCAP
+    virNWFilterCaptureSubPtr sub = NULL;
+#endif
 
     /* It's possible that it's already been removed as a result of
      * virNWFilterDeregisterLearnReq during learnIPAddressThread() exit
@@ -271,10 +280,24 @@ virNWFilterTerminateLearnReq(const char *ifname)
     if (req) {
         rc = 0;
         req->terminate = true;
+#if HAVE_LIBPCAP
+        /* A capture callback that is finishing @req already will
+         * notice that it was terminated */
+        if (req->sub && !req->finishing) {
+            req->finishing = true;
+            sub = virObjectRef(req->sub);
+            ignore_value(virHashSteal(pendingLearnReq, ifindex_str));
+        }
+#endif
     }
 
     virMutexUnlock(&pendingLearnReqLock);
 
+#if HAVE_LIBPCAP
+    if (sub)
+        learnIPAddressCaptureCancel(req, sub);
+#endif
+
     return rc;
 }
 
@@ -361,6 +384,214 @@ procDHCPOpts(struct dhcp *dhcp, int dhcp_opts_len,
 }
 
 
+/*
+ * learnIPAddressFromPacket
+ * @req: the learn request
+ * @packet: the packet seen on the interface
+ * @len: the length of @packet
+ * @howDetected: set to the method the address was detected by
+ *
+ * Look for the IP address the VM is using in a packet it sent or that was
+ * sent to it.
+ *
+ * Returns the IPv4 address in network byte order, or 0 if none was found.
+ */
+static uint32_t
+learnIPAddressFromPacket(virNWFilterIPAddrLearnReqPtr req,
+                         const u_char *packet,
+                         unsigned int len,
+                         enum howDetect *howDetected)
+{
+    struct ether_header *ether_hdr;
+    struct ether_vlan_header *vlan_hdr;
+    uint32_t vmaddr = 0, bcastaddr = 0;
+    unsigned int ethHdrSize;
+    int dhcp_opts_len;
+    uint16_t etherType;
+
+    *howDetected = 0;
+
+    if (len < sizeof(struct ether_header))
+        return 0;
+
+    ether_hdr = (struct ether_header*)packet;
+
+    switch (ntohs(ether_hdr->ether_type)) {
+
+    case ETHERTYPE_IP:
+    case ETHERTYPE_ARP:
+        ethHdrSize = sizeof(struct ether_header);
+        etherType = ntohs(ether_hdr->ether_type);
+        break;
+
+    case ETHERTYPE_VLAN:
+        ethHdrSize = sizeof(struct ether_vlan_header);
+        vlan_hdr = (struct ether_vlan_header *)packet;
+        if (len < ethHdrSize ||
+            (ntohs(vlan_hdr->ether_type) != ETHERTYPE_IP &&
+             ntohs(vlan_hdr->ether_type) != ETHERTYPE_ARP))
+            return 0;
+        etherType = ntohs(vlan_hdr->ether_type);
+        break;
+
+    default:
+        return 0;
+    }
+
+    if (virMacAddrCmpRaw(&req->macaddr, ether_hdr->ether_shost) == 0) {
+        /* packets from the VM */
+
+        if (etherType == ETHERTYPE_IP &&
+            (len >= ethHdrSize +
+                    sizeof(struct iphdr))) {
+            VIR_WARNINGS_NO_CAST_ALIGN
+            struct iphdr *iphdr = (struct iphdr*)(packet +
+                                                  ethHdrSize);
+            VIR_WARNINGS_RESET
+            vmaddr = iphdr->saddr;
+            /* skip mcast addresses (224.0.0.0 - 239.255.255.255),
+             * class E (240.0.0.0 - 255.255.255.255, includes eth.
+             * bcast) and zero address in DHCP Requests */
+            if ((ntohl(vmaddr) & 0xe0000000) == 0xe0000000 ||
+                vmaddr == 0)
+                return 0;
+
+            *howDetected = DETECT_STATIC;
+        } else if (etherType == ETHERTYPE_ARP &&
+                   (len >= ethHdrSize +
+                           sizeof(struct f_arphdr))) {
+            VIR_WARNINGS_NO_CAST_ALIGN
+            struct f_arphdr *arphdr = (struct f_arphdr*)(packet +
+                                                 ethHdrSize);
+            VIR_WARNINGS_RESET
+            switch (ntohs(arphdr->arphdr.ar_op)) {
+            case ARPOP_REPLY:
+                vmaddr = arphdr->ar_sip;
+                *howDetected = DETECT_STATIC;
+            break;
+            case ARPOP_REQUEST:
+                vmaddr = arphdr->ar_tip;
+                *howDetected = DETECT_STATIC;
+            break;
+            }
+        }
+    } else if (virMacAddrCmpRaw(&req->macaddr,
+                                ether_hdr->ether_dhost) == 0 ||
+               /* allow Broadcast replies from DHCP server */
+               virMacAddrIsBroadcastRaw(ether_hdr->ether_dhost)) {
+        /* packets to the VM */
+        if (etherType == ETHERTYPE_IP &&
+            (len >= ethHdrSize +
+                    sizeof(struct iphdr))) {
+            VIR_WARNINGS_NO_CAST_ALIGN
+            struct iphdr *iphdr = (struct iphdr*)(packet +
+                                                  ethHdrSize);
+            VIR_WARNINGS_RESET
+            if ((iphdr->protocol == IPPROTO_UDP) &&
+                (len >= ethHdrSize +
+                        iphdr->ihl * 4 +
+                        sizeof(struct udphdr))) {
+                VIR_WARNINGS_NO_CAST_ALIGN
+                struct udphdr *udphdr = (struct udphdr *)
+                                  ((char *)iphdr + iphdr->ihl * 4);
+                VIR_WARNINGS_RESET
+                if (ntohs(udphdr->source) == 67 &&
+                    ntohs(udphdr->dest)   == 68 &&
+                    len >= ethHdrSize +
+                           iphdr->ihl * 4 +
+                           sizeof(struct udphdr) +
+                           sizeof(struct dhcp)) {
+                    struct dhcp *dhcp = (struct dhcp *)
+                                ((char *)udphdr + sizeof(udphdr));
+                    if (dhcp->op == 2 /* BOOTREPLY */ &&
+                        virMacAddrCmpRaw(
+                                &req->macaddr,
+                                &dhcp->chaddr[0]) == 0) {
+                        dhcp_opts_len = len -
+                            (ethHdrSize + iphdr->ihl * 4 +
+                             sizeof(struct udphdr) +
+                             sizeof(struct dhcp));
+                        procDHCPOpts(dhcp, dhcp_opts_len,
+                                     &vmaddr,
+                                     &bcastaddr,
+                                     howDetected);
+                    }
+                }
+            }
+        }
+    }
+
+    if (vmaddr && (req->howDetect & *howDetected) == 0) {
+        vmaddr = 0;
+        *howDetected = 0;
+    }
+
+    return vmaddr;
+}
+
+
+static int
+learnIPAddressApplyRules(virNWFilterIPAddrLearnReqPtr req)
+{
+    switch (req->howDetect) {
+    case DETECT_DHCP:
+        return req->techdriver->applyDHCPOnlyRules(req->ifname,
+                                                   &req->macaddr,
+                                                   NULL, false);
+    default:
+        return req->techdriver->applyBasicRules(req->ifname,
+                                                &req->macaddr);
+    }
+}
+
+
+/*
+ * Instantiate the filter with the learned address or, if learning
+ * failed as given by req->status, block the interface. Blocking
+ * requires the interface lock to be held.
+ */
+static void
+learnIPAddressDone(virNWFilterIPAddrLearnReqPtr req,
+                   uint32_t vmaddr,
+                   bool showError)
+{
+    if (req->status == 0) {
+        int ret;
+        virSocketAddr sa;
+        sa.len = sizeof(sa.data.inet4);
+        sa.data.inet4.sin_family = AF_INET;
+        sa.data.inet4.sin_addr.s_addr = vmaddr;
+        char *inetaddr;
+
+        if ((inetaddr = virSocketAddrFormat(&sa)) != NULL) {
+            if (virNWFilterIPAddrMapAddIPAddr(req->ifname, inetaddr) < 0) {
+                VIR_ERROR(_("Failed to add IP address %s to IP address "
+                          "cache for interface %s"), inetaddr, req->ifname);
+            }
+
+            ret = virNWFilterInstantiateFilterLate(req->driver,
+                                                   NULL,
+                                                   req->ifname,
+                                                   req->ifindex,
+                                                   req->linkdev,
+                                                   &req->macaddr,
+                                                   req->filtername,
+                                                   req->filterparams);
+            VIR_DEBUG("Result from applying firewall rules on "
+                      "%s with IP addr %s : %d\n", req->ifname, inetaddr, ret);
+        }
+    } else {
+        if (showError)
+            virReportSystemError(req->status,
+                                 _("encountered an error on interface %s "
+                                   "index %d"),
+                                 req->ifname, req->ifindex);
+
+        req->techdriver->applyDropAllRules(req->ifname);
+    }
+}
+
+
 /**
  * learnIPAddressThread
  * arg: pointer to virNWFilterIPAddrLearnReq structure
@@ -382,21 +613,15 @@ learnIPAddressThread(void *arg)
     struct bpf_program fp;
     struct pcap_pkthdr header;
     const u_char *packet;
-    struct ether_header *ether_hdr;
-    struct ether_vlan_header *vlan_hdr;
     virNWFilterIPAddrLearnReqPtr req = arg;
-    uint32_t vmaddr = 0, bcastaddr = 0;
-    unsigned int ethHdrSize;
+    uint32_t vmaddr = 0;
     char *listen_if = (strlen(req->linkdev) != 0) ? req->linkdev
                                                   : req->ifname;
-    int dhcp_opts_len;
     char macaddr[VIR_MAC_STRING_BUFLEN];
     virBuffer buf = VIR_BUFFER_INITIALIZER;
     char *filter = NULL;
-    uint16_t etherType;
     bool showError = true;
     enum howDetect howDetected = 0;
-    virNWFilterTechDriverPtr techdriver = req->techdriver;
 
     if (virNWFilterLockIface(req->ifname) < 0)
        goto err_no_lock;
@@ -420,22 +645,16 @@ learnIPAddressThread(void *arg)
 
     virMacAddrFormat(&req->macaddr, macaddr);
 
+    if (learnIPAddressApplyRules(req) < 0) {
+        req->status = EINVAL;
+        goto done;
+    }
+
     switch (req->howDetect) {
     case DETECT_DHCP:
-        if (techdriver->applyDHCPOnlyRules(req->ifname,
-                                           &req->macaddr,
-                                           NULL, false) < 0) {
-            req->status = EINVAL;
-            goto done;
-        }
         virBufferAddLit(&buf, "src port 67 and dst port 68");
         break;
     default:
-        if (techdriver->applyBasicRules(req->ifname,
-                                        &req->macaddr) < 0) {
-            req->status = EINVAL;
-            goto done;
-        }
         virBufferAsprintf(&buf, "ether host %s or ether dst ff:ff:ff:ff:ff:ff",
                           macaddr);
     }
@@ -483,118 +702,8 @@ learnIPAddressThread(void *arg)
             continue;
         }
 
-        if (header.len >= sizeof(struct ether_header)) {
-            ether_hdr = (struct ether_header*)packet;
-
-            switch (ntohs(ether_hdr->ether_type)) {
-
-            case ETHERTYPE_IP:
-                ethHdrSize = sizeof(struct ether_header);
-                etherType = ntohs(ether_hdr->ether_type);
-                break;
-
-            case ETHERTYPE_VLAN:
-                ethHdrSize = sizeof(struct ether_vlan_header);
-                vlan_hdr = (struct ether_vlan_header *)packet;
-                if (ntohs(vlan_hdr->ether_type) != ETHERTYPE_IP ||
-                    header.len < ethHdrSize)
-                    continue;
-                etherType = ntohs(vlan_hdr->ether_type);
-                break;
-
-            default:
-                continue;
-            }
-
-            if (virMacAddrCmpRaw(&req->macaddr, ether_hdr->ether_shost) == 0) {
-                /* packets from the VM */
-
-                if (etherType == ETHERTYPE_IP &&
-                    (header.len >= ethHdrSize +
-                                   sizeof(struct iphdr))) {
-                    VIR_WARNINGS_NO_CAST_ALIGN
-                    struct iphdr *iphdr = (struct iphdr*)(packet +
-                                                          ethHdrSize);
-                    VIR_WARNINGS_RESET
-                    vmaddr = iphdr->saddr;
-                    /* skip mcast addresses (224.0.0.0 - 239.255.255.255),
-                     * class E (240.0.0.0 - 255.255.255.255, includes eth.
-                     * bcast) and zero address in DHCP Requests */
-                    if ((ntohl(vmaddr) & 0xe0000000) == 0xe0000000 ||
-                        vmaddr == 0) {
-                        vmaddr = 0;
-                        continue;
-                    }
-
-                    howDetected = DETECT_STATIC;
-                } else if (etherType == ETHERTYPE_ARP &&
-                           (header.len >= ethHdrSize +
-                                          sizeof(struct f_arphdr))) {
-                    VIR_WARNINGS_NO_CAST_ALIGN
-                    struct f_arphdr *arphdr = (struct f_arphdr*)(packet +
-                                                         ethHdrSize);
-                    VIR_WARNINGS_RESET
-                    switch (ntohs(arphdr->arphdr.ar_op)) {
-                    case ARPOP_REPLY:
-                        vmaddr = arphdr->ar_sip;
-                        howDetected = DETECT_STATIC;
-                    break;
-                    case ARPOP_REQUEST:
-                        vmaddr = arphdr->ar_tip;
-                        howDetected = DETECT_STATIC;
-                    break;
-                    }
-                }
-            } else if (virMacAddrCmpRaw(&req->macaddr,
-                                        ether_hdr->ether_dhost) == 0 ||
-                       /* allow Broadcast replies from DHCP server */
-                       virMacAddrIsBroadcastRaw(ether_hdr->ether_dhost)) {
-                /* packets to the VM */
-                if (etherType == ETHERTYPE_IP &&
-                    (header.len >= ethHdrSize +
-                                   sizeof(struct iphdr))) {
-                    VIR_WARNINGS_NO_CAST_ALIGN
-                    struct iphdr *iphdr = (struct iphdr*)(packet +
-                                                          ethHdrSize);
-                    VIR_WARNINGS_RESET
-                    if ((iphdr->protocol == IPPROTO_UDP) &&
-                        (header.len >= ethHdrSize +
-                                       iphdr->ihl * 4 +
-                                       sizeof(struct udphdr))) {
-                        VIR_WARNINGS_NO_CAST_ALIGN
-                        struct udphdr *udphdr = (struct udphdr *)
-                                          ((char *)iphdr + iphdr->ihl * 4);
-                        VIR_WARNINGS_RESET
-                        if (ntohs(udphdr->source) == 67 &&
-                            ntohs(udphdr->dest)   == 68 &&
-                            header.len >= ethHdrSize +
-                                          iphdr->ihl * 4 +
-                                          sizeof(struct udphdr) +
-                                          sizeof(struct dhcp)) {
-                            struct dhcp *dhcp = (struct dhcp *)
-                                        ((char *)udphdr + sizeof(udphdr));
-                            if (dhcp->op == 2 /* BOOTREPLY */ &&
-                                virMacAddrCmpRaw(
-                                        &req->macaddr,
-                                        &dhcp->chaddr[0]) == 0) {
-                                dhcp_opts_len = header.len -
-                                    (ethHdrSize + iphdr->ihl * 4 +
-                                     sizeof(struct udphdr) +
-                                     sizeof(struct dhcp));
-                                procDHCPOpts(dhcp, dhcp_opts_len,
-                                             &vmaddr,
-                                             &bcastaddr,
-                                             &howDetected);
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        if (vmaddr && (req->howDetect & howDetected) == 0) {
-            vmaddr = 0;
-            howDetected = 0;
-        }
+        vmaddr = learnIPAddressFromPacket(req, packet, header.len,
+                                          &howDetected);
     } /* while */
 
  done:
@@ -603,40 +712,7 @@ learnIPAddressThread(void *arg)
     if (handle)
         pcap_close(handle);
 
-    if (req->status == 0) {
-        int ret;
-        virSocketAddr sa;
-        sa.len = sizeof(sa.data.inet4);
-        sa.data.inet4.sin_family = AF_INET;
-        sa.data.inet4.sin_addr.s_addr = vmaddr;
-        char *inetaddr;
-
-        if ((inetaddr = virSocketAddrFormat(&sa)) != NULL) {
-            if (virNWFilterIPAddrMapAddIPAddr(req->ifname, inetaddr) < 0) {
-                VIR_ERROR(_("Failed to add IP address %s to IP address "
-                          "cache for interface %s"), inetaddr, req->ifname);
-            }
-
-            ret = virNWFilterInstantiateFilterLate(req->driver,
-                                                   NULL,
-                                                   req->ifname,
-                                                   req->ifindex,
-                                                   req->linkdev,
-                                                   &req->macaddr,
-                                                   req->filtername,
-                                                   req->filterparams);
-            VIR_DEBUG("Result from applying firewall rules on "
-                      "%s with IP addr %s : %d\n", req->ifname, inetaddr, ret);
-        }
-    } else {
-        if (showError)
-            virReportSystemError(req->status,
-                                 _("encountered an error on interface %s "
-                                   "index %d"),
-                                 req->ifname, req->ifindex);
-
-        techdriver->applyDropAllRules(req->ifname);
-    }
+    learnIPAddressDone(req, vmaddr, showError);
 
     memset(&req->thread, 0x0, sizeof(req->thread));
 
@@ -653,6 +729,219 @@ learnIPAddressThread(void *arg)
 }
 
 
+/*
+ * Finish learning through the shared packet capture with the given
+ * @status and address unless somebody else already does so. Called
+ * from the capture callbacks, i.e. in a capture worker.
+ */
+static void
+learnIPAddressCaptureFinish(virNWFilterIPAddrLearnReqPtr req,
+                            virNWFilterCaptureSubPtr sub,
+                            int status,
+                            uint32_t vmaddr,
+                            bool showError)
+{
+    bool terminated;
+    IFINDEX2STR(ifindex_str, req->ifindex);
+
+    virMutexLock(&pendingLearnReqLock);
+
+    if (req->finishing) {
+        virMutexUnlock(&pendingLearnReqLock);
+        return;
+    }
+    req->finishing = true;
+
+    virMutexUnlock(&pendingLearnReqLock);
+
+    /* @req lives on with the subscription until this callback is done */
+    virNWFilterCaptureUnsubscribe(sub, 0);
+
+    req->status = status;
+
+    /* Instantiating the filter takes the filter update lock and then
+     * the interface lock, so it must be called without the latter */
+    if (status == 0) {
+        learnIPAddressDone(req, vmaddr, showError);
+    } else if (virNWFilterLockIface(req->ifname) == 0) {
+        learnIPAddressDone(req, vmaddr, showError);
+        virNWFilterUnlockIface(req->ifname);
+    }
+
+    /* The request stays registered up to here so that an attempt to
+     * terminate it meanwhile is recorded */
+    virMutexLock(&pendingLearnReqLock);
+    ignore_value(virHashSteal(pendingLearnReq, ifindex_str));
+    terminated = req->terminate;
+    virMutexUnlock(&pendingLearnReqLock);
+
+    /* The interface's rules were torn down while the filter was
+     * being instantiated; don't leave the new ones behind */
+    if (status == 0 && terminated &&
+        virNWFilterLockIface(req->ifname) == 0) {
+        req->techdriver->allTeardown(req->ifname);
+        virNWFilterIPAddrMapDelIPAddr(req->ifname, NULL);
+        virNWFilterUnlockIface(req->ifname);
+    }
+
+    VIR_DEBUG("Learning terminated for interface %s\n", req->ifname);
+}
+
+
+static void
+learnIPAddressCapturePacket(virNWFilterCaptureSubPtr sub,
+                            const unsigned char *packet,
+                            size_t len,
+                            bool outgoing ATTRIBUTE_UNUSED,
+                            void *opaque)
+{
+    virNWFilterIPAddrLearnReqPtr req = opaque;
+    enum howDetect howDetected;
+    uint32_t vmaddr;
+
+    if ((vmaddr = learnIPAddressFromPacket(req, packet, len, &howDetected)))
+        learnIPAddressCaptureFinish(req, sub, 0, vmaddr, true);
+}
+
+
+static void
+learnIPAddressCaptureTick(virNWFilterCaptureSubPtr sub,
+                          void *opaque)
+{
+    virNWFilterIPAddrLearnReqPtr req = opaque;
+
+    if (threadsTerminate || req->terminate) {
+        learnIPAddressCaptureFinish(req, sub, ECANCELED, 0, false);
+        return;
+    }
+
+    /* check whether VM's dev is still there */
+    if (virNetDevValidateConfig(req->ifname, NULL, req->ifindex) <= 0) {
+        virResetLastError();
+        learnIPAddressCaptureFinish(req, sub, ENODEV, 0, false);
+    }
+}
+
+
+static void
+learnIPAddressCaptureRelease(void *opaque)
+{
+    virNWFilterIPAddrLearnReqPtr req = opaque;
+
+    req->sub = NULL;
+    virNWFilterIPAddrLearnReqFree(req);
+}
+
+
+/*
+ * Unlike the learning thread that holds the interface lock until it is
+ * done, learning through the shared capture happens in callbacks that
+ * lock the interface only when needed. Stop it right away so that the
+ * caller can tear down the interface's rules. The caller took over
+ * finishing @req and holds a reference to @sub.
+ *
+ * This does not wait for a callback of @sub that may be running: it
+ * could be instantiating the filter and hence need the filter update
+ * lock our caller may hold. Such a callback finds @req finishing and
+ * leaves it alone; the subscription keeps @req around until it returns.
+ */
+static void
+learnIPAddressCaptureCancel(virNWFilterIPAddrLearnReqPtr req,
+                            virNWFilterCaptureSubPtr sub)
+{
+    virNWFilterCaptureUnsubscribe(sub, 0);
+
+    req->status = ECANCELED;
+
+    if (virNWFilterLockIface(req->ifname) == 0) {
+        learnIPAddressDone(req, 0, false);
+        virNWFilterUnlockIface(req->ifname);
+    }
+
+    VIR_DEBUG("Learning terminated for interface %s\n", req->ifname);
+
+    /* may release @req */
+    virObjectUnref(sub);
+}
+
+
+/*
+ * Start learning the IP address through the shared packet capture
+ * rather than with a thread of its own. Takes over @req, also on
+ * failure; once subscribed, it is freed along with the subscription.
+ */
+static int
+learnIPAddressCaptureStart(virNWFilterIPAddrLearnReqPtr req)
+{
+    static const virNWFilterCaptureCallbacks callbacks = {
+        .packet = learnIPAddressCapturePacket,
+        .tick = learnIPAddressCaptureTick,
+        .release = learnIPAddressCaptureRelease,
+    };
+    virNWFilterCaptureSubPtr sub;
+    char ifname[IF_NAMESIZE];
+    unsigned int protocols = VIR_NWFILTER_CAPTURE_DHCP;
+    int listenIndex = req->ifindex;
+    int ret = -1;
+    IFINDEX2STR(ifindex_str, req->ifindex);
+
+    if (req->howDetect & DETECT_STATIC)
+        protocols |= VIR_NWFILTER_CAPTURE_ARP | VIR_NWFILTER_CAPTURE_IPV4;
+
+    if (strlen(req->linkdev) != 0 &&
+        virNetDevGetIndex(req->linkdev, &listenIndex) < 0)
+        goto cleanup;
+
+    /* once registered, @req may be gone as soon as we let go of
+     * the interface */
+    memcpy(ifname, req->ifname, sizeof(ifname));
+
+    if (virNWFilterLockIface(ifname) < 0)
+        goto cleanup;
+
+    /* anything change to the VM's interface -- check at least once */
+    if (virNetDevValidateConfig(req->ifname, NULL, req->ifindex) <= 0) {
+        virResetLastError();
+        req->status = ENODEV;
+    } else if (learnIPAddressApplyRules(req) < 0) {
+        req->status = EINVAL;
+    }
+
+    if (req->status != 0) {
+        learnIPAddressDone(req, 0, true);
+        virNWFilterUnlockIface(ifname);
+        ret = 0;
+        goto cleanup;
+    }
+
+    virMutexLock(&pendingLearnReqLock);
+
+    if (!virHashLookup(pendingLearnReq, ifindex_str) &&
+        virHashAddEntry(pendingLearnReq, ifindex_str, req) == 0) {
+        if ((sub = virNWFilterCaptureSubscribe(listenIndex, protocols,
+                                               LEARN_MAX_QUEUED,
+                                               &callbacks, req))) {
+            /* from now on @req belongs to the subscription, which
+             * stays around as long as it is listed by the capture */
+            req->sub = sub;
+            virObjectUnref(sub);
+            req = NULL;
+            ret = 0;
+        } else {
+            ignore_value(virHashSteal(pendingLearnReq, ifindex_str));
+        }
+    }
+
+    virMutexUnlock(&pendingLearnReqLock);
+
+    virNWFilterUnlockIface(ifname);
+
+ cleanup:
+    virNWFilterIPAddrLearnReqFree(req);
+    return ret;
+}
+
+
 /**
  * virNWFilterLearnIPAddress
  * @techdriver : driver to build firewalls
@@ -672,7 +961,9 @@ learnIPAddressThread(void *arg)
  * being used on the interface, a thread is started that will listen on
  * the traffic being sent on the interface (or link device) with the
  * MAC address that is provided. Will then launch the application of the
- * firewall rules on the interface.
+ * firewall rules on the interface. If the shared packet capture is
+ * available, the traffic is looked at through it instead of by a thread
+ * of its own.
  */
 int
 virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
@@ -737,6 +1028,9 @@ virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
     req->howDetect = howDetect;
     req->techdriver = techdriver;
 
+    if (virNWFilterCaptureAvailable())
+        return learnIPAddressCaptureStart(req);
+
     rc = virNWFilterRegisterLearnReq(req);
 
     if (rc < 0)
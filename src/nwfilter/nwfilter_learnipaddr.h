@@ -28,6 +28,7 @@
 
 # include "conf/nwfilter_params.h"
 # include "nwfilter_tech_driver.h"
+# include "nwfilter_capture.h"
 # include <net/if.h>
 
 enum howDetect {
@@ -51,6 +52,11 @@ struct _virNWFilterIPAddrLearnReq {
     int status;
     pthread_t thread;
     volatile bool terminate;
+
+    /* set when learning through the shared packet capture; the
+     * subscription owns the request rather than the other way round */
+    virNWFilterCaptureSubPtr sub;
+    bool finishing;
 };
 
 int virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
@@ -91,6 +91,9 @@ struct _qemuAgent {
     int fd;
     int watch;
 
+    /* Event loop serving @fd, NULL for the default one */
+    virEventThreadPtr iothread;
+
     bool connectPending;
 
     virDomainObjPtr vm;
@@ -164,6 +167,7 @@ static void qemuAgentDispose(void *obj)
     virCondDestroy(&mon->notify);
     VIR_FREE(mon->buffer);
     virResetError(&mon->lastError);
+    virObjectUnref(mon->iothread);
 }
 
 static int
@@ -172,8 +176,8 @@ qemuAgentOpenUnix(const char *monitor, pid_t cpid, bool *inProgress)
     struct sockaddr_un addr;
     int monfd;
     int timeout = 3; /* In seconds */
-    int ret;
-    size_t i = 0;
+    int ret = -1;
+    virTimeBackOffVar timebackoff;
 
     *inProgress = false;
 
@@ -205,7 +209,9 @@ qemuAgentOpenUnix(const char *monitor, pid_t cpid, bool *inProgress)
         goto error;
     }
 
-    do {
+    if (virTimeBackOffStart(&timebackoff, 1, timeout * 1000) < 0)
+        goto error;
+    while (virTimeBackOffWait(&timebackoff)) {
         ret = connect(monfd, (struct sockaddr *) &addr, sizeof(addr));
 
         if (ret == 0)
@@ -229,8 +235,7 @@ qemuAgentOpenUnix(const char *monitor, pid_t cpid, bool *inProgress)
         virReportSystemError(errno, "%s",
                              _("failed to connect to monitor socket"));
         goto error;
-
-    } while ((++i <= timeout*5) && (usleep(.2 * 1000000) <= 0));
+    }
 
     if (ret != 0) {
         virReportSystemError(errno, "%s",
@@ -568,7 +573,10 @@ static void qemuAgentUpdateWatch(qemuAgentPtr mon)
             events |= VIR_EVENT_HANDLE_WRITABLE;
     }
 
-    virEventUpdateHandle(mon->watch, events);
+    if (mon->iothread)
+        virEventThreadUpdateHandle(mon->iothread, mon->watch, events);
+    else
+        virEventUpdateHandle(mon->watch, events);
 }
 
 
@@ -709,9 +717,11 @@ qemuAgentIO(int watch, int fd, int events, void *opaque)
 qemuAgentPtr
 qemuAgentOpen(virDomainObjPtr vm,
               virDomainChrSourceDefPtr config,
+              virEventThreadPtr iothread,
               qemuAgentCallbacksPtr cb)
 {
     qemuAgentPtr mon;
+    int events;
 
     if (!cb || !cb->eofNotify) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -755,17 +765,24 @@ qemuAgentOpen(virDomainObjPtr vm,
     if (mon->fd == -1)
         goto cleanup;
 
+    events = VIR_EVENT_HANDLE_HANGUP |
+             VIR_EVENT_HANDLE_ERROR |
+             VIR_EVENT_HANDLE_READABLE |
+             (mon->connectPending ? VIR_EVENT_HANDLE_WRITABLE : 0);
+
     virObjectRef(mon);
-    if ((mon->watch = virEventAddHandle(mon->fd,
-                                        VIR_EVENT_HANDLE_HANGUP |
-                                        VIR_EVENT_HANDLE_ERROR |
-                                        VIR_EVENT_HANDLE_READABLE |
-                                        (mon->connectPending ?
-                                         VIR_EVENT_HANDLE_WRITABLE :
-                                         0),
-                                        qemuAgentIO,
-                                        mon,
-                                        virObjectFreeCallback)) < 0) {
+    if (iothread) {
+        mon->iothread = virObjectRef(iothread);
+        mon->watch = virEventThreadAddHandle(iothread, mon->fd, events,
+                                             qemuAgentIO, mon,
+                                             virObjectFreeCallback);
+    } else {
+        mon->watch = virEventAddHandle(mon->fd, events,
+                                       qemuAgentIO, mon,
+                                       virObjectFreeCallback);
+    }
+    if (mon->watch < 0) {
+        mon->watch = 0;
         virObjectUnref(mon);
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("unable to register monitor events"));
@@ -798,8 +815,12 @@ void qemuAgentClose(qemuAgentPtr mon)
     virObjectLock(mon);
 
     if (mon->fd >= 0) {
-        if (mon->watch)
-            virEventRemoveHandle(mon->watch);
+        if (mon->watch) {
+            if (mon->iothread)
+                virEventThreadRemoveHandle(mon->iothread, mon->watch);
+            else
+                virEventRemoveHandle(mon->watch);
+        }
         VIR_FORCE_CLOSE(mon->fd);
     }
 
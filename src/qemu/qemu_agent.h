@@ -27,6 +27,7 @@
 
 # include "internal.h"
 # include "domain_conf.h"
+# include "vireventthread.h"
 
 typedef struct _qemuAgent qemuAgent;
 typedef qemuAgent *qemuAgentPtr;
@@ -45,6 +46,7 @@ struct _qemuAgentCallbacks {
 
 qemuAgentPtr qemuAgentOpen(virDomainObjPtr vm,
                            virDomainChrSourceDefPtr config,
+                           virEventThreadPtr iothread,
                            qemuAgentCallbacksPtr cb);
 
 void qemuAgentClose(qemuAgentPtr mon);
@@ -277,6 +277,7 @@ VIR_ENUM_IMPL(virQEMUCaps, QEMU_CAPS_LAST,
               "vmware-svga.vgamem_mb",
               "qxl.vgamem_mb",
               "qxl-vga.vgamem_mb",
+              "chardev-fd-pass",
     );
 
 
@@ -3254,6 +3255,11 @@ virQEMUCapsInitQMPMonitor(virQEMUCapsPtr qemuCaps,
     if (qemuCaps->version >= 1006000)
         virQEMUCapsSet(qemuCaps, QEMU_CAPS_DEVICE_VIDEO_PRIMARY);
 
+    /* A listening UNIX socket can be handed over with -chardev
+     * socket,fd= since 2.12.0; there's no way to query for it */
+    if (qemuCaps->version >= 2012000)
+        virQEMUCapsSet(qemuCaps, QEMU_CAPS_CHARDEV_FD_PASS);
+
     if (virQEMUCapsProbeQMPCommands(qemuCaps, mon) < 0)
         goto cleanup;
     if (virQEMUCapsProbeQMPEvents(qemuCaps, mon) < 0)
@@ -3370,7 +3376,7 @@ virQEMUCapsInitQMP(virQEMUCapsPtr qemuCaps,
 
     vm->pid = pid;
 
-    if (!(mon = qemuMonitorOpen(vm, &config, true, &callbacks, NULL))) {
+    if (!(mon = qemuMonitorOpen(vm, &config, true, NULL, &callbacks, NULL))) {
         ret = 0;
         goto cleanup;
     }
@@ -61,6 +61,8 @@
 #endif
 
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
@@ -5963,6 +5965,101 @@ qemuBuildChrChardevStr(virDomainChrSourceDefPtr dev, const char *alias,
 }
 
 
+/* Create and bind the listening socket of a UNIX chardev ourselves, so
+ * that it can be connected to as soon as QEMU is started, rather than
+ * whenever QEMU gets round to creating it */
+static int
+qemuOpenChrChardevUNIXSocket(virDomainChrSourceDefPtr dev)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create UNIX socket"));
+        goto error;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (virStrcpyStatic(addr.sun_path, dev->data.nix.path) == NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("UNIX socket path '%s' too long"),
+                       dev->data.nix.path);
+        goto error;
+    }
+
+    if (unlink(dev->data.nix.path) < 0 && errno != ENOENT) {
+        virReportSystemError(errno,
+                             _("Unable to unlink %s"),
+                             dev->data.nix.path);
+        goto error;
+    }
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to bind to UNIX socket path '%s'"),
+                             dev->data.nix.path);
+        goto error;
+    }
+
+    if (listen(fd, 1) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to listen to UNIX socket path '%s'"),
+                             dev->data.nix.path);
+        unlink(dev->data.nix.path);
+        goto error;
+    }
+
+    return fd;
+
+ error:
+    VIR_FORCE_CLOSE(fd);
+    return -1;
+}
+
+/* Like qemuBuildChrChardevStr, but if QEMU supports it, the socket of a
+ * listening UNIX chardev is created here and passed to QEMU in @cmd */
+static char *
+qemuBuildChrChardevStrPassFD(virCommandPtr cmd,
+                             virQEMUDriverPtr driver,
+                             virDomainDefPtr def,
+                             virDomainChrSourceDefPtr dev,
+                             const char *alias,
+                             virQEMUCapsPtr qemuCaps,
+                             bool standalone)
+{
+    char *ret = NULL;
+    int fd;
+
+    if (standalone ||
+        dev->type != VIR_DOMAIN_CHR_TYPE_UNIX ||
+        !dev->data.nix.listen ||
+        !virQEMUCapsGet(qemuCaps, QEMU_CAPS_CHARDEV_FD_PASS))
+        return qemuBuildChrChardevStr(dev, alias, qemuCaps);
+
+    if (virSecurityManagerSetSocketLabel(driver->securityManager, def) < 0)
+        return NULL;
+    fd = qemuOpenChrChardevUNIXSocket(dev);
+    if (virSecurityManagerClearSocketLabel(driver->securityManager, def) < 0) {
+        VIR_FORCE_CLOSE(fd);
+        return NULL;
+    }
+    if (fd < 0)
+        return NULL;
+
+    if (virAsprintf(&ret, "socket,id=char%s,fd=%d,server,nowait",
+                    alias, fd) < 0) {
+        VIR_FORCE_CLOSE(fd);
+        unlink(dev->data.nix.path);
+        return NULL;
+    }
+
+    virCommandPassFD(cmd, fd, VIR_COMMAND_PASS_FD_CLOSE_PARENT);
+    return ret;
+}
+
+
 static char *
 qemuBuildChrArgStr(virDomainChrSourceDefPtr dev, const char *prefix)
 {
@@ -8520,8 +8617,9 @@ qemuBuildCommandLine(virConnectPtr conn,
         if (virQEMUCapsGet(qemuCaps, QEMU_CAPS_CHARDEV)) {
 
             virCommandAddArg(cmd, "-chardev");
-            if (!(chrdev = qemuBuildChrChardevStr(monitor_chr, "monitor",
-                                                  qemuCaps)))
+            if (!(chrdev = qemuBuildChrChardevStrPassFD(cmd, driver, def,
+                                                        monitor_chr, "monitor",
+                                                        qemuCaps, standalone)))
                 goto error;
             virCommandAddArg(cmd, chrdev);
             VIR_FREE(chrdev);
@@ -9497,6 +9595,18 @@ qemuBuildCommandLine(virConnectPtr conn,
                  * with a backend internal to qemu; although we prefer
                  * the newer -chardev interface.  */
                 ;
+            } else if (STREQ_NULLABLE(channel->target.name,
+                                      "org.qemu.guest_agent.0")) {
+                /* we connect to the agent right after startup */
+                virCommandAddArg(cmd, "-chardev");
+                if (!(devstr = qemuBuildChrChardevStrPassFD(cmd, driver, def,
+                                                            &channel->source,
+                                                            channel->info.alias,
+                                                            qemuCaps,
+                                                            standalone)))
+                    goto error;
+                virCommandAddArg(cmd, devstr);
+                VIR_FREE(devstr);
             } else {
                 virCommandAddArg(cmd, "-chardev");
                 if (!(devstr = qemuBuildChrChardevStr(&channel->source,
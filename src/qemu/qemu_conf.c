@@ -33,6 +33,7 @@
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <arpa/inet.h>
+#include <dirent.h>
 
 #include "virerror.h"
 #include "qemu_conf.h"
@@ -53,6 +54,7 @@
 #include "viratomic.h"
 #include "storage_conf.h"
 #include "configmake.h"
+#include "c-ctype.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
@@ -706,6 +708,7 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     GET_VALUE_STR("auto_dump_path", cfg->autoDumpPath);
     GET_VALUE_BOOL("auto_dump_bypass_cache", cfg->autoDumpBypassCache);
     GET_VALUE_BOOL("auto_start_bypass_cache", cfg->autoStartBypassCache);
+    GET_VALUE_BOOL("snapshot_store", cfg->snapshotStore);
 
     /* Some crazy backcompat. Back in the old days, this was just a pure
      * string. We must continue supporting it. These days however, this may be
@@ -778,6 +781,15 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     GET_VALUE_LONG("keepalive_interval", cfg->keepAliveInterval);
     GET_VALUE_ULONG("keepalive_count", cfg->keepAliveCount);
 
+    GET_VALUE_ULONG("status_save_delay", cfg->statusSaveDelay);
+    GET_VALUE_ULONG("monitor_io_threads", cfg->monitorIOThreads);
+    if (cfg->monitorIOThreads > QEMU_MONITOR_IO_THREADS_MAX) {
+        virReportError(VIR_ERR_CONF_SYNTAX,
+                       _("%s: monitor_io_threads: must not be greater than %d"),
+                       filename, QEMU_MONITOR_IO_THREADS_MAX);
+        goto cleanup;
+    }
+
     GET_VALUE_LONG("seccomp_sandbox", cfg->seccompSandbox);
 
     GET_VALUE_STR("migration_host", cfg->migrateHost);
@@ -938,13 +950,217 @@ virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver)
 }
 
 
+/* Appends the contents of the sysfs attribute @dir/@name */
+static void
+virQEMUDriverCapsFingerprintFile(virBufferPtr buf,
+                                 const char *dir,
+                                 const char *name)
+{
+    char *path = NULL;
+    char *content = NULL;
+
+    if (virAsprintf(&path, "%s/%s", dir, name) < 0)
+        return;
+
+    if (virFileReadAllQuiet(path, 1024, &content) >= 0)
+        virBufferAsprintf(buf, "%s=%s\n", path, content);
+
+    VIR_FREE(content);
+    VIR_FREE(path);
+}
+
+
+/* Appends what a stat() of @path says about its identity and age */
+static void
+virQEMUDriverCapsFingerprintStat(virBufferPtr buf,
+                                 const char *path)
+{
+    struct stat sb;
+
+    if (!path)
+        return;
+
+    if (stat(path, &sb) < 0) {
+        virBufferAsprintf(buf, "%s=-\n", path);
+        return;
+    }
+
+    virBufferAsprintf(buf, "%s=%llu:%llu:%o:%lld:%lld\n", path,
+                      (unsigned long long) sb.st_dev,
+                      (unsigned long long) sb.st_ino,
+                      (unsigned int) sb.st_mode,
+                      (long long) sb.st_mtime,
+                      (long long) sb.st_ctime);
+}
+
+
+/* Appends the size of each huge page pool found under @dir */
+static void
+virQEMUDriverCapsFingerprintPages(virBufferPtr buf,
+                                  const char *dir)
+{
+    DIR *dh;
+    struct dirent *de;
+    char *path = NULL;
+
+    if (!(dh = opendir(dir)))
+        return;
+
+    while (virDirRead(dh, &de, NULL) > 0) {
+        if (!STRPREFIX(de->d_name, "hugepages-"))
+            continue;
+        if (virAsprintf(&path, "%s/%s", dir, de->d_name) < 0)
+            break;
+        virQEMUDriverCapsFingerprintFile(buf, path, "nr_hugepages");
+        VIR_FREE(path);
+    }
+
+    closedir(dh);
+}
+
+
+/*
+ * Summarizes the host state the capabilities are built from: online
+ * CPUs, huge page pools, accelerator and VFIO devices, the emulator
+ * binaries and the directories they are looked up in, and firmware
+ * images. Computing it costs a handful of stat() calls and small sysfs
+ * reads, far less than probing NUMA topology and formatting the
+ * result, so the capabilities only need to be rebuilt once it changes.
+ */
+static char *
+virQEMUDriverCapsFingerprint(virQEMUDriverPtr driver,
+                             virCapsPtr caps)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    const char *devs[] = { "/dev/kvm", "/dev/kqemu", "/dev/vfio/vfio" };
+    const char *envpath = virGetEnvBlockSUID("PATH");
+    char **dirs = NULL;
+    DIR *dh;
+    struct dirent *de;
+    char *path = NULL;
+    size_t i, j;
+
+    virQEMUDriverCapsFingerprintFile(&buf, "/sys/devices/system/cpu", "online");
+
+    virQEMUDriverCapsFingerprintPages(&buf, "/sys/kernel/mm/hugepages");
+    if ((dh = opendir("/sys/devices/system/node"))) {
+        while (virDirRead(dh, &de, NULL) > 0) {
+            if (!STRPREFIX(de->d_name, "node") ||
+                !c_isdigit(de->d_name[4]))
+                continue;
+            if (virAsprintf(&path, "/sys/devices/system/node/%s/hugepages",
+                            de->d_name) < 0)
+                break;
+            virQEMUDriverCapsFingerprintPages(&buf, path);
+            VIR_FREE(path);
+        }
+        closedir(dh);
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(devs); i++)
+        virQEMUDriverCapsFingerprintStat(&buf, devs[i]);
+
+    /* New emulators appear by being installed in one of these */
+    if ((dirs = virStringSplit(envpath ? envpath : "/bin:/usr/bin", ":", 0))) {
+        for (i = 0; dirs[i]; i++)
+            virQEMUDriverCapsFingerprintStat(&buf, dirs[i]);
+    }
+    virStringFreeList(dirs);
+    virQEMUDriverCapsFingerprintStat(&buf, "/usr/libexec");
+
+    for (i = 0; caps && i < caps->nguests; i++) {
+        virCapsGuestArchptr arch = &caps->guests[i]->arch;
+
+        virQEMUDriverCapsFingerprintStat(&buf, arch->defaultInfo.emulator);
+        for (j = 0; j < arch->ndomains; j++)
+            virQEMUDriverCapsFingerprintStat(&buf,
+                                             arch->domains[j]->info.emulator);
+    }
+
+    for (i = 0; i < cfg->nloader; i++)
+        virQEMUDriverCapsFingerprintStat(&buf, cfg->loader[i]);
+
+    virObjectUnref(cfg);
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/**
+ * virQEMUDriverRefreshCapabilities:
+ *
+ * Makes sure driver->caps reflects the current host state, building
+ * a new snapshot only if the host fingerprint changed since the last
+ * one was taken. The first call, made at startup, always builds the
+ * capabilities along with their fingerprint.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+virQEMUDriverRefreshCapabilities(virQEMUDriverPtr driver)
+{
+    virCapsPtr caps = NULL;
+    char *fingerprint = NULL;
+    bool current;
+    int ret = -1;
+
+    qemuDriverLock(driver);
+    caps = virObjectRef(driver->caps);
+    qemuDriverUnlock(driver);
+
+    if (!(fingerprint = virQEMUDriverCapsFingerprint(driver, caps)))
+        goto cleanup;
+
+    qemuDriverLock(driver);
+    current = caps && STREQ_NULLABLE(driver->capsFingerprint, fingerprint);
+    qemuDriverUnlock(driver);
+
+    if (current) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    virObjectUnref(caps);
+    VIR_FREE(fingerprint);
+
+    if (!(caps = virQEMUDriverCreateCapabilities(driver)) ||
+        !(fingerprint = virQEMUDriverCapsFingerprint(driver, caps)))
+        goto cleanup;
+
+    qemuDriverLock(driver);
+    virObjectUnref(driver->caps);
+    driver->caps = caps;
+    caps = NULL;
+    VIR_FREE(driver->capsFingerprint);
+    driver->capsFingerprint = fingerprint;
+    fingerprint = NULL;
+    VIR_FREE(driver->capsXML);
+    driver->capsGeneration++;
+    VIR_DEBUG("Host state changed, capabilities now at generation %u",
+              driver->capsGeneration);
+    qemuDriverUnlock(driver);
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(caps);
+    VIR_FREE(fingerprint);
+    return ret;
+}
+
+
 /**
  * virQEMUDriverGetCapabilities:
  *
  * Get a reference to the virCapsPtr instance for the
  * driver. If @refresh is true, the capabilities will be
- * rebuilt first
+ * rebuilt first if the host changed since they were built
  *
+ * The returned object is shared and must not be modified.
  * The caller must release the reference with virObjetUnref
  *
  * Returns: a reference to a virCapsPtr instance or NULL
@@ -953,23 +1169,153 @@ virCapsPtr virQEMUDriverGetCapabilities(virQEMUDriverPtr driver,
                                         bool refresh)
 {
     virCapsPtr ret = NULL;
-    if (refresh) {
-        virCapsPtr caps = NULL;
-        if ((caps = virQEMUDriverCreateCapabilities(driver)) == NULL)
-            return NULL;
-
-        qemuDriverLock(driver);
-        virObjectUnref(driver->caps);
-        driver->caps = caps;
-    } else {
-        qemuDriverLock(driver);
-    }
 
+    if (refresh && virQEMUDriverRefreshCapabilities(driver) < 0)
+        return NULL;
+
+    qemuDriverLock(driver);
     ret = virObjectRef(driver->caps);
     qemuDriverUnlock(driver);
     return ret;
 }
 
+
+/**
+ * virQEMUDriverGetCapabilitiesXML:
+ *
+ * Formats the current capabilities of the driver, refreshing
+ * them first if the host changed. The XML is formatted once
+ * per capabilities snapshot and handed out from a cache
+ * thereafter.
+ *
+ * Returns: the XML document, to be freed by the caller, or NULL
+ */
+char *virQEMUDriverGetCapabilitiesXML(virQEMUDriverPtr driver)
+{
+    virCapsPtr caps;
+    char *xml = NULL;
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, true)))
+        return NULL;
+
+    qemuDriverLock(driver);
+    if (caps == driver->caps && driver->capsXML) {
+        ignore_value(VIR_STRDUP(xml, driver->capsXML));
+        qemuDriverUnlock(driver);
+        goto cleanup;
+    }
+    qemuDriverUnlock(driver);
+
+    if (!(xml = virCapabilitiesFormatXML(caps)))
+        goto cleanup;
+
+    qemuDriverLock(driver);
+    if (caps == driver->caps && !driver->capsXML)
+        ignore_value(VIR_STRDUP_QUIET(driver->capsXML, xml));
+    qemuDriverUnlock(driver);
+
+ cleanup:
+    virObjectUnref(caps);
+    return xml;
+}
+
+
+struct _virQEMUDriverDomCapsEntry {
+    virQEMUCapsPtr qemuCaps;
+    unsigned int generation;
+    char *xml;
+};
+
+
+void
+virQEMUDriverDomCapsEntryFree(void *payload,
+                              const void *name ATTRIBUTE_UNUSED)
+{
+    virQEMUDriverDomCapsEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    virObjectUnref(entry->qemuCaps);
+    VIR_FREE(entry->xml);
+    VIR_FREE(entry);
+}
+
+
+/**
+ * virQEMUDriverGetDomainCapsXML:
+ * @driver: the QEMU driver
+ * @qemuCaps: the capabilities of the emulator the XML describes
+ * @key: identifies the emulator, arch, machine and virt type
+ * @xml: filled with a copy of the cached XML on a hit
+ * @generation: filled with the capabilities generation to pass
+ *              to virQEMUDriverCacheDomainCapsXML on a miss
+ *
+ * Looks up domain capabilities XML formatted earlier. An entry is
+ * only valid as long as neither the emulator (which gets a new
+ * @qemuCaps when it changes) nor the host changed since.
+ *
+ * Returns: 1 on a hit, 0 on a miss, -1 on error
+ */
+int
+virQEMUDriverGetDomainCapsXML(virQEMUDriverPtr driver,
+                              virQEMUCapsPtr qemuCaps,
+                              const char *key,
+                              char **xml,
+                              unsigned int *generation)
+{
+    virQEMUDriverDomCapsEntryPtr entry;
+    int ret = 0;
+
+    if (virQEMUDriverRefreshCapabilities(driver) < 0)
+        return -1;
+
+    qemuDriverLock(driver);
+    *generation = driver->capsGeneration;
+    if ((entry = virHashLookup(driver->domCapsCache, key)) &&
+        entry->qemuCaps == qemuCaps &&
+        entry->generation == driver->capsGeneration) {
+        ret = VIR_STRDUP(*xml, entry->xml) < 0 ? -1 : 1;
+    }
+    qemuDriverUnlock(driver);
+
+    return ret;
+}
+
+
+/**
+ * virQEMUDriverCacheDomainCapsXML:
+ *
+ * Remembers @xml as the domain capabilities for @key, as formatted
+ * from @qemuCaps at capabilities @generation. Failing to do so is
+ * not an error, the XML just has to be formatted again next time.
+ */
+void
+virQEMUDriverCacheDomainCapsXML(virQEMUDriverPtr driver,
+                                virQEMUCapsPtr qemuCaps,
+                                const char *key,
+                                const char *xml,
+                                unsigned int generation)
+{
+    virQEMUDriverDomCapsEntryPtr entry;
+
+    if (VIR_ALLOC_QUIET(entry) < 0)
+        return;
+
+    entry->qemuCaps = virObjectRef(qemuCaps);
+    entry->generation = generation;
+    if (VIR_STRDUP_QUIET(entry->xml, xml) < 0) {
+        virQEMUDriverDomCapsEntryFree(entry, NULL);
+        return;
+    }
+
+    qemuDriverLock(driver);
+    if (generation != driver->capsGeneration ||
+        virHashUpdateEntry(driver->domCapsCache, key, entry) < 0)
+        virQEMUDriverDomCapsEntryFree(entry, NULL);
+    qemuDriverUnlock(driver);
+}
+
 struct _qemuSharedDeviceEntry {
     size_t ref;
     char **domains; /* array of domain names */
@@ -46,6 +46,8 @@
 # include "virclosecallbacks.h"
 # include "virhostdev.h"
 # include "virfile.h"
+# include "virfilewriter.h"
+# include "vireventthread.h"
 
 # ifdef CPU_SETSIZE /* Linux */
 #  define QEMUD_CPUMASK_LEN CPU_SETSIZE
@@ -57,6 +59,9 @@
 
 # define QEMU_DRIVER_NAME "QEMU"
 
+/* Upper limit for the monitor_io_threads setting */
+# define QEMU_MONITOR_IO_THREADS_MAX 256
+
 typedef struct _virQEMUDriver virQEMUDriver;
 typedef virQEMUDriver *virQEMUDriverPtr;
 
@@ -157,12 +162,16 @@ struct _virQEMUDriverConfig {
     char *autoDumpPath;
     bool autoDumpBypassCache;
     bool autoStartBypassCache;
+    bool snapshotStore;
 
     char *lockManagerName;
 
     int keepAliveInterval;
     unsigned int keepAliveCount;
 
+    unsigned int statusSaveDelay;
+    unsigned int monitorIOThreads;
+
     int seccompSandbox;
 
     char *migrateHost;
@@ -214,6 +223,15 @@ struct _virQEMUDriver {
      */
     virCapsPtr caps;
 
+    /* Require lock while reading or updating. Describe the host
+     * state @caps was built from and cache its XML */
+    char *capsFingerprint;
+    char *capsXML;
+    unsigned int capsGeneration;
+
+    /* Immutable pointer. Require lock while using the table */
+    virHashTablePtr domCapsCache;
+
     /* Immutable pointer, Immutable object */
     virDomainXMLOptionPtr xmlopt;
 
@@ -248,6 +266,15 @@ struct _virQEMUDriver {
 
     /* Immutable pointer, self-clocking APIs */
     virCloseCallbacksPtr closeCallbacks;
+
+    /* Immutable pointer, self-locking APIs. NULL if status
+     * updates are not being coalesced */
+    virFileWriterPtr statusWriter;
+
+    /* Immutable array, self-locking APIs. Empty if monitors are
+     * served by the default event loop */
+    virEventThreadPtr *monitorIOThreads;
+    size_t nmonitorIOThreads;
 };
 
 typedef struct _qemuDomainCmdlineDef qemuDomainCmdlineDef;
@@ -273,8 +300,25 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
 virQEMUDriverConfigPtr virQEMUDriverGetConfig(virQEMUDriverPtr driver);
 
 virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver);
+int virQEMUDriverRefreshCapabilities(virQEMUDriverPtr driver);
 virCapsPtr virQEMUDriverGetCapabilities(virQEMUDriverPtr driver,
                                         bool refresh);
+char *virQEMUDriverGetCapabilitiesXML(virQEMUDriverPtr driver);
+
+typedef struct _virQEMUDriverDomCapsEntry virQEMUDriverDomCapsEntry;
+typedef virQEMUDriverDomCapsEntry *virQEMUDriverDomCapsEntryPtr;
+
+void virQEMUDriverDomCapsEntryFree(void *payload, const void *name);
+int virQEMUDriverGetDomainCapsXML(virQEMUDriverPtr driver,
+                                  virQEMUCapsPtr qemuCaps,
+                                  const char *key,
+                                  char **xml,
+                                  unsigned int *generation);
+void virQEMUDriverCacheDomainCapsXML(virQEMUDriverPtr driver,
+                                     virQEMUCapsPtr qemuCaps,
+                                     const char *key,
+                                     const char *xml,
+                                     unsigned int generation);
 
 struct qemuDomainDiskInfo {
     bool removable;
@@ -437,6 +437,7 @@ qemuDomainObjPrivateFree(void *data)
     VIR_FREE(priv->iothreadpids);
     VIR_FREE(priv->lockState);
     VIR_FREE(priv->origname);
+    virObjectUnref(priv->tunnelMerge);
 
     virCondDestroy(&priv->unplugFinished);
     virChrdevFree(priv->devs);
@@ -2161,10 +2162,183 @@ qemuFindQemuImgBinary(virQEMUDriverPtr driver)
     return driver->qemuImgBinary;
 }
 
+char *
+qemuDomainSnapshotStorePath(virDomainObjPtr vm,
+                            const char *snapshotDir)
+{
+    char *ret;
+
+    ignore_value(virAsprintf(&ret, "%s/%s/.snapshots.xml",
+                             snapshotDir, vm->def->name));
+    return ret;
+}
+
+
+struct qemuDomainSnapshotStoreData {
+    virDomainSnapshotDefPtr *defs;
+    size_t ndefs;
+};
+
+static void
+qemuDomainSnapshotStoreCollect(void *payload,
+                               const void *name ATTRIBUTE_UNUSED,
+                               void *opaque)
+{
+    virDomainSnapshotObjPtr snap = payload;
+    struct qemuDomainSnapshotStoreData *data = opaque;
+
+    /* Snapshots that are still being created are not linked into
+     * the hierarchy yet and get stored once they are complete */
+    if (snap->parent)
+        data->defs[data->ndefs++] = snap->def;
+}
+
+
+/* Rewrites the snapshot store of @vm in one go. @snapshot, if given,
+ * is included even if it isn't linked into the hierarchy yet.  */
+static int
+qemuDomainSnapshotStoreWrite(virDomainObjPtr vm,
+                             virDomainSnapshotObjPtr snapshot,
+                             const char *snapshotDir)
+{
+    struct qemuDomainSnapshotStoreData data = { NULL, 0 };
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    char *snapDir = NULL;
+    char *storeFile = NULL;
+    char *newxml = NULL;
+    int nsnapshots = virDomainSnapshotObjListNum(vm->snapshots, NULL, 0);
+    int ret = -1;
+
+    if (nsnapshots < 0 ||
+        VIR_ALLOC_N(data.defs, nsnapshots + 1) < 0)
+        goto cleanup;
+
+    virDomainSnapshotForEach(vm->snapshots, qemuDomainSnapshotStoreCollect,
+                             &data);
+    if (snapshot && !snapshot->parent)
+        data.defs[data.ndefs++] = snapshot->def;
+
+    if (!(storeFile = qemuDomainSnapshotStorePath(vm, snapshotDir)))
+        goto cleanup;
+
+    if (data.ndefs == 0) {
+        if (unlink(storeFile) < 0 && errno != ENOENT) {
+            virReportSystemError(errno,
+                                 _("cannot remove snapshot store '%s'"),
+                                 storeFile);
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    virUUIDFormat(vm->def->uuid, uuidstr);
+    newxml = virDomainSnapshotDefListFormat(
+        uuidstr, data.defs, data.ndefs,
+        virDomainDefFormatConvertXMLFlags(QEMU_DOMAIN_FORMAT_LIVE_FLAGS));
+    if (newxml == NULL)
+        goto cleanup;
+
+    if (virAsprintf(&snapDir, "%s/%s", snapshotDir, vm->def->name) < 0)
+        goto cleanup;
+    if (virFileMakePath(snapDir) < 0) {
+        virReportSystemError(errno, _("cannot create snapshot directory '%s'"),
+                             snapDir);
+        goto cleanup;
+    }
+
+    ret = virXMLSaveFile(storeFile, NULL, "snapshot-edit", newxml);
+
+ cleanup:
+    VIR_FREE(newxml);
+    VIR_FREE(storeFile);
+    VIR_FREE(snapDir);
+    VIR_FREE(data.defs);
+    return ret;
+}
+
+
+/**
+ * qemuDomainSnapshotSaveStore:
+ * @vm: domain object
+ * @snapshotDir: snapshot metadata directory
+ *
+ * Writes the metadata of all snapshots of @vm to its snapshot store,
+ * or removes the store if @vm has no snapshots.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainSnapshotSaveStore(virDomainObjPtr vm,
+                            const char *snapshotDir)
+{
+    return qemuDomainSnapshotStoreWrite(vm, NULL, snapshotDir);
+}
+
+
+/**
+ * qemuDomainSnapshotBeginUpdate:
+ * @vm: domain object
+ *
+ * Starts a batch of snapshot metadata updates. With the snapshot
+ * store enabled, the store is not rewritten for every modified
+ * snapshot, but once by the matching qemuDomainSnapshotEndUpdate().
+ * Batches may nest.
+ */
+void
+qemuDomainSnapshotBeginUpdate(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    priv->snapshotUpdates++;
+}
+
+
+/**
+ * qemuDomainSnapshotEndUpdate:
+ * @vm: domain object
+ * @cfg: driver config
+ *
+ * Ends a batch of updates started by qemuDomainSnapshotBeginUpdate()
+ * and, once the outermost batch ends, writes out the snapshot store
+ * if any snapshot was changed within the batch.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainSnapshotEndUpdate(virDomainObjPtr vm,
+                            virQEMUDriverConfigPtr cfg)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (--priv->snapshotUpdates > 0 || !priv->snapshotDirty)
+        return 0;
+
+    priv->snapshotDirty = false;
+    return qemuDomainSnapshotStoreWrite(vm, NULL, cfg->snapshotDir);
+}
+
+
+static int
+qemuDomainSnapshotStoreUpdate(virDomainObjPtr vm,
+                              virDomainSnapshotObjPtr snapshot,
+                              virQEMUDriverConfigPtr cfg)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (priv->snapshotUpdates > 0) {
+        priv->snapshotDirty = true;
+        return 0;
+    }
+
+    return qemuDomainSnapshotStoreWrite(vm, snapshot, cfg->snapshotDir);
+}
+
+
 int
 qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
                                 virDomainSnapshotObjPtr snapshot,
-                                char *snapshotDir)
+                                virQEMUDriverConfigPtr cfg)
 {
     char *newxml = NULL;
     int ret = -1;
@@ -2172,6 +2346,9 @@ qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
     char *snapFile = NULL;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
 
+    if (cfg->snapshotStore)
+        return qemuDomainSnapshotStoreUpdate(vm, snapshot, cfg);
+
     virUUIDFormat(vm->def->uuid, uuidstr);
     newxml = virDomainSnapshotDefFormat(
         uuidstr, snapshot->def,
@@ -2180,7 +2357,7 @@ qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
     if (newxml == NULL)
         return -1;
 
-    if (virAsprintf(&snapDir, "%s/%s", snapshotDir, vm->def->name) < 0)
+    if (virAsprintf(&snapDir, "%s/%s", cfg->snapshotDir, vm->def->name) < 0)
         goto cleanup;
     if (virFileMakePath(snapDir) < 0) {
         virReportSystemError(errno, _("cannot create snapshot directory '%s'"),
@@ -2302,10 +2479,12 @@ qemuDomainSnapshotDiscard(virQEMUDriverPtr driver,
 {
     char *snapFile = NULL;
     int ret = -1;
-    qemuDomainObjPrivatePtr priv;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     virDomainSnapshotObjPtr parentsnap = NULL;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
+    qemuDomainSnapshotBeginUpdate(vm);
+
     if (!metadata_only) {
         if (!virDomainObjIsActive(vm)) {
             /* Ignore any skipped disks */
@@ -2313,7 +2492,6 @@ qemuDomainSnapshotDiscard(virQEMUDriverPtr driver,
                                                true) < 0)
                 goto cleanup;
         } else {
-            priv = vm->privateData;
             qemuDomainObjEnterMonitor(driver, vm);
             /* we continue on even in the face of error */
             qemuMonitorDeleteSnapshot(priv->mon, snap->def->name);
@@ -2335,7 +2513,7 @@ qemuDomainSnapshotDiscard(virQEMUDriverPtr driver,
             } else {
                 parentsnap->def->current = true;
                 if (qemuDomainSnapshotWriteMetadata(vm, parentsnap,
-                                                    cfg->snapshotDir) < 0) {
+                                                    cfg) < 0) {
                     VIR_WARN("failed to set parent snapshot '%s' as current",
                              snap->def->parent);
                     parentsnap->def->current = false;
@@ -2346,13 +2524,20 @@ qemuDomainSnapshotDiscard(virQEMUDriverPtr driver,
         vm->current_snapshot = parentsnap;
     }
 
-    if (unlink(snapFile) < 0)
+    if (unlink(snapFile) < 0 &&
+        (!cfg->snapshotStore || errno != ENOENT))
         VIR_WARN("Failed to unlink %s", snapFile);
     virDomainSnapshotObjListRemove(vm->snapshots, snap);
 
+    if (cfg->snapshotStore)
+        priv->snapshotDirty = true;
+
     ret = 0;
 
  cleanup:
+    if (qemuDomainSnapshotEndUpdate(vm, cfg) < 0)
+        VIR_WARN("Failed to update snapshot store of domain %s",
+                 vm->def->name);
     VIR_FREE(snapFile);
     virObjectUnref(cfg);
     return ret;
@@ -2379,14 +2564,20 @@ int
 qemuDomainSnapshotDiscardAllMetadata(virQEMUDriverPtr driver,
                                      virDomainObjPtr vm)
 {
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     virQEMUSnapRemove rem;
 
     rem.driver = driver;
     rem.vm = vm;
     rem.metadata_only = true;
     rem.err = 0;
+
+    qemuDomainSnapshotBeginUpdate(vm);
     virDomainSnapshotForEach(vm->snapshots, qemuDomainSnapshotDiscardAll,
                              &rem);
+    if (qemuDomainSnapshotEndUpdate(vm, cfg) < 0 && !rem.err)
+        rem.err = -1;
+    virObjectUnref(cfg);
 
     return rem.err;
 }
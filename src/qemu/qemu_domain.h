@@ -132,6 +132,9 @@ struct qemuDomainJobObj {
 typedef void (*qemuDomainCleanupCallback)(virQEMUDriverPtr driver,
                                           virDomainObjPtr vm);
 
+typedef struct _qemuMigrationTunnelMerge qemuMigrationTunnelMerge;
+typedef qemuMigrationTunnelMerge *qemuMigrationTunnelMergePtr;
+
 typedef struct _qemuDomainObjPrivate qemuDomainObjPrivate;
 typedef qemuDomainObjPrivate *qemuDomainObjPrivatePtr;
 struct _qemuDomainObjPrivate {
@@ -173,6 +176,8 @@ struct _qemuDomainObjPrivate {
     int nbdPort; /* Port used for migration with NBD */
     unsigned short migrationPort;
     int preMigrationState;
+    /* Reassembles incoming migration striped over several tunnels */
+    qemuMigrationTunnelMergePtr tunnelMerge;
 
     virChrdevsPtr devs;
 
@@ -188,6 +193,10 @@ struct _qemuDomainObjPrivate {
 
     bool hookRun;  /* true if there was a hook run over this domain */
     virBitmapPtr autoNodeset;
+
+    /* Batched updates of the snapshot store */
+    int snapshotUpdates;
+    bool snapshotDirty;
 };
 
 typedef enum {
@@ -319,9 +328,17 @@ int qemuDomainAppendLog(virQEMUDriverPtr driver,
 
 const char *qemuFindQemuImgBinary(virQEMUDriverPtr driver);
 
+char *qemuDomainSnapshotStorePath(virDomainObjPtr vm,
+                                  const char *snapshotDir);
+int qemuDomainSnapshotSaveStore(virDomainObjPtr vm,
+                                const char *snapshotDir);
+void qemuDomainSnapshotBeginUpdate(virDomainObjPtr vm);
+int qemuDomainSnapshotEndUpdate(virDomainObjPtr vm,
+                                virQEMUDriverConfigPtr cfg);
+
 int qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
                                     virDomainSnapshotObjPtr snapshot,
-                                    char *snapshotDir);
+                                    virQEMUDriverConfigPtr cfg);
 
 int qemuDomainSnapshotForEachQcow2(virQEMUDriverPtr driver,
                                    virDomainObjPtr vm,
@@ -451,37 +451,81 @@ qemuSecurityInit(virQEMUDriverPtr driver)
 }
 
 
+/* Most threads parsing snapshot XML files at once */
+#define QEMU_SNAPSHOT_LOAD_WORKERS 8
+
+/* Largest snapshot store we're willing to read */
+#define QEMU_SNAPSHOT_STORE_MAX_SIZE (256 * 1024 * 1024)
+
+struct qemuDomainSnapshotLoadJob {
+    virDomainObjPtr vm;
+    char *path;
+    bool store; /* @path is a snapshot store rather than a single snapshot */
+    virDomainSnapshotStorePtr contents; /* of the store, until parsed */
+    virDomainSnapshotDefPtr *defs;
+    size_t ndefs;
+    bool assigned; /* the domain knows the snapshots of this job */
+};
+
+/* Parses the snapshot @idx of the store of job @job */
+struct qemuDomainSnapshotLoadTask {
+    size_t job;
+    size_t idx;
+};
+
+struct qemuDomainSnapshotExportData {
+    virQEMUDriverConfigPtr cfg;
+    virDomainObjPtr vm;
+    int err;
+};
+
+struct qemuDomainSnapshotLoadData {
+    virQEMUDriverConfigPtr cfg;
+    virCapsPtr caps;
+    virDomainObjPtr *vms;
+    size_t nvms;
+    struct qemuDomainSnapshotLoadJob *jobs;
+    size_t njobs;
+    struct qemuDomainSnapshotLoadTask *tasks;
+    size_t ntasks;
+};
+
+
 static int
-qemuDomainSnapshotLoad(virDomainObjPtr vm,
-                       void *data)
+qemuDomainSnapshotCollect(virDomainObjPtr vm,
+                          void *opaque)
+{
+    struct qemuDomainSnapshotLoadData *data = opaque;
+
+    if (VIR_APPEND_ELEMENT_COPY(data->vms, data->nvms, vm) < 0)
+        return -1;
+    virObjectRef(vm);
+    return 0;
+}
+
+
+/* Queues a parse job for the snapshot store and every file in the
+ * snapshot directory of @vm */
+static void
+qemuDomainSnapshotScan(struct qemuDomainSnapshotLoadData *data,
+                       virDomainObjPtr vm)
 {
-    char *baseDir = (char *)data;
     char *snapDir = NULL;
     DIR *dir = NULL;
     struct dirent *entry;
-    char *xmlStr;
-    char *fullpath;
-    virDomainSnapshotDefPtr def = NULL;
-    virDomainSnapshotObjPtr snap = NULL;
-    virDomainSnapshotObjPtr current = NULL;
     char ebuf[1024];
-    unsigned int flags = (VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE |
-                          VIR_DOMAIN_SNAPSHOT_PARSE_DISKS |
-                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL);
-    int ret = -1;
-    virCapsPtr caps = NULL;
     int direrr;
+    struct qemuDomainSnapshotLoadJob store = { vm, NULL, true, NULL,
+                                               NULL, 0, false };
 
     virObjectLock(vm);
-    if (virAsprintf(&snapDir, "%s/%s", baseDir, vm->def->name) < 0) {
+    if (virAsprintf(&snapDir, "%s/%s", data->cfg->snapshotDir,
+                    vm->def->name) < 0) {
         VIR_ERROR(_("Failed to allocate memory for snapshot directory for domain %s"),
                    vm->def->name);
         goto cleanup;
     }
 
-    if (!(caps = virQEMUDriverGetCapabilities(qemu_driver, false)))
-        goto cleanup;
-
     VIR_INFO("Scanning for snapshots for domain %s in %s", vm->def->name,
              snapDir);
 
@@ -493,54 +537,319 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
         goto cleanup;
     }
 
+    /* The store goes first so that its snapshots take precedence */
+    if (!(store.path = qemuDomainSnapshotStorePath(vm,
+                                                   data->cfg->snapshotDir))) {
+        VIR_ERROR(_("Failed to allocate memory for path"));
+    } else if (!virFileExists(store.path)) {
+        VIR_FREE(store.path);
+    } else if (VIR_APPEND_ELEMENT(data->jobs, data->njobs, store) < 0) {
+        VIR_FREE(store.path);
+        goto cleanup;
+    }
+
+    /* The store is a hidden file, so it's skipped here */
     while ((direrr = virDirRead(dir, &entry, NULL)) > 0) {
+        struct qemuDomainSnapshotLoadJob job = { vm, NULL, false, NULL,
+                                                 NULL, 0, false };
+
         if (entry->d_name[0] == '.')
             continue;
 
-        /* NB: ignoring errors, so one malformed config doesn't
-           kill the whole process */
-        VIR_INFO("Loading snapshot file '%s'", entry->d_name);
-
-        if (virAsprintf(&fullpath, "%s/%s", snapDir, entry->d_name) < 0) {
+        if (virAsprintf(&job.path, "%s/%s", snapDir, entry->d_name) < 0) {
             VIR_ERROR(_("Failed to allocate memory for path"));
             continue;
         }
 
-        if (virFileReadAll(fullpath, 1024*1024*1, &xmlStr) < 0) {
-            /* Nothing we can do here, skip this one */
-            VIR_ERROR(_("Failed to read snapshot file %s: %s"), fullpath,
-                      virStrerror(errno, ebuf, sizeof(ebuf)));
-            VIR_FREE(fullpath);
-            continue;
+        if (VIR_APPEND_ELEMENT(data->jobs, data->njobs, job) < 0) {
+            VIR_FREE(job.path);
+            break;
         }
+    }
+    if (direrr < 0)
+        VIR_ERROR(_("Failed to fully read directory %s"), snapDir);
+
+ cleanup:
+    if (dir)
+        closedir(dir);
+    VIR_FREE(snapDir);
+    virObjectUnlock(vm);
+}
+
+
+/* Moves a snapshot store that can't be loaded out of the way, so that
+ * it is not overwritten and can be recovered manually */
+static void
+qemuDomainSnapshotStoreSetAside(const char *path)
+{
+    char ebuf[1024];
+    char *bad = NULL;
+
+    if (virAsprintf(&bad, "%s.bad", path) < 0)
+        return;
+
+    if (rename(path, bad) < 0)
+        VIR_ERROR(_("Failed to rename snapshot store %s to %s: %s"),
+                  path, bad, virStrerror(errno, ebuf, sizeof(ebuf)));
+    else
+        VIR_WARN("Moved unusable snapshot store %s to %s", path, bad);
+    VIR_FREE(bad);
+}
+
+
+static void
+qemuDomainSnapshotParseOne(size_t i,
+                           void *opaque)
+{
+    struct qemuDomainSnapshotLoadData *data = opaque;
+    struct qemuDomainSnapshotLoadJob *job = &data->jobs[i];
+    unsigned int flags = (VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_DISKS |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL);
+    char ebuf[1024];
+    char *xmlStr;
+
+    /* NB: ignoring errors, so one malformed config doesn't
+       kill the whole process */
+    VIR_INFO("Loading snapshot file '%s'", job->path);
+
+    if (virFileReadAll(job->path,
+                       job->store ? QEMU_SNAPSHOT_STORE_MAX_SIZE : 1024*1024*1,
+                       &xmlStr) < 0) {
+        /* Nothing we can do here, skip this one */
+        VIR_ERROR(_("Failed to read snapshot file %s: %s"), job->path,
+                  virStrerror(errno, ebuf, sizeof(ebuf)));
+        return;
+    }
 
-        def = virDomainSnapshotDefParseString(xmlStr, caps,
-                                              qemu_driver->xmlopt,
-                                              QEMU_EXPECTED_VIRT_TYPES,
-                                              flags);
-        if (def == NULL) {
+    /* The snapshots of the store are parsed by separate tasks */
+    if (job->store) {
+        job->contents = virDomainSnapshotStoreParseString(xmlStr, data->caps,
+                                                          qemu_driver->xmlopt,
+                                                          QEMU_EXPECTED_VIRT_TYPES);
+        if (!job->contents) {
+            VIR_ERROR(_("Failed to parse snapshot store '%s': %s"),
+                      job->path, virGetLastErrorMessage());
+            qemuDomainSnapshotStoreSetAside(job->path);
+        } else {
+            size_t n = virDomainSnapshotStoreGetCount(job->contents);
+
+            if (VIR_ALLOC_N(job->defs, n) == 0)
+                job->ndefs = n;
+        }
+    } else if (VIR_ALLOC_N(job->defs, 1) == 0) {
+        job->defs[0] = virDomainSnapshotDefParseString(xmlStr, data->caps,
+                                                       qemu_driver->xmlopt,
+                                                       QEMU_EXPECTED_VIRT_TYPES,
+                                                       flags);
+        if (job->defs[0] == NULL) {
             /* Nothing we can do here, skip this one */
             VIR_ERROR(_("Failed to parse snapshot XML from file '%s'"),
-                      fullpath);
-            VIR_FREE(fullpath);
-            VIR_FREE(xmlStr);
-            continue;
+                      job->path);
+        } else {
+            job->ndefs = 1;
         }
+    }
 
-        snap = virDomainSnapshotAssignDef(vm->snapshots, def);
-        if (snap == NULL) {
-            virDomainSnapshotDefFree(def);
-        } else if (snap->def->current) {
-            current = snap;
-            if (!vm->current_snapshot)
-                vm->current_snapshot = snap;
+    VIR_FREE(xmlStr);
+    virResetLastError();
+}
+
+
+static void
+qemuDomainSnapshotParseStoreDef(size_t i,
+                                void *opaque)
+{
+    struct qemuDomainSnapshotLoadData *data = opaque;
+    struct qemuDomainSnapshotLoadTask *task = &data->tasks[i];
+    struct qemuDomainSnapshotLoadJob *job = &data->jobs[task->job];
+    unsigned int flags = (VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_DISKS |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL);
+
+    job->defs[task->idx] = virDomainSnapshotStoreParseDef(job->contents,
+                                                          task->idx,
+                                                          data->caps,
+                                                          qemu_driver->xmlopt,
+                                                          QEMU_EXPECTED_VIRT_TYPES,
+                                                          flags);
+    if (!job->defs[task->idx])
+        VIR_ERROR(_("Failed to parse snapshot %zu of snapshot store '%s': %s"),
+                  task->idx, job->path, virGetLastErrorMessage());
+    virResetLastError();
+}
+
+
+/* Splits the snapshots of all stores into parse tasks, so that large
+ * stores don't keep a single worker busy */
+static void
+qemuDomainSnapshotParseStores(struct qemuDomainSnapshotLoadData *data)
+{
+    struct qemuDomainSnapshotLoadTask task;
+    bool parsed = false;
+    size_t i, j;
+
+    for (i = 0; i < data->njobs; i++) {
+        task.job = i;
+        for (j = 0; j < data->jobs[i].ndefs && data->jobs[i].contents; j++) {
+            task.idx = j;
+            if (VIR_APPEND_ELEMENT(data->tasks, data->ntasks, task) < 0)
+                goto cleanup;
+        }
+    }
+
+    virThreadPoolRunBatch(data->ntasks, QEMU_SNAPSHOT_LOAD_WORKERS,
+                          qemuDomainSnapshotParseStoreDef, data);
+    parsed = true;
+
+ cleanup:
+    /* A store is loaded in full or not at all */
+    for (i = 0; i < data->njobs; i++) {
+        struct qemuDomainSnapshotLoadJob *job = &data->jobs[i];
+        bool failed = false;
+
+        if (!job->contents)
+            continue;
+
+        for (j = 0; j < job->ndefs; j++) {
+            if (!job->defs[j])
+                failed = true;
+        }
+        if (failed) {
+            for (j = 0; j < job->ndefs; j++)
+                virDomainSnapshotDefFree(job->defs[j]);
+            VIR_FREE(job->defs);
+            job->ndefs = 0;
+            if (parsed)
+                qemuDomainSnapshotStoreSetAside(job->path);
         }
 
-        VIR_FREE(fullpath);
-        VIR_FREE(xmlStr);
+        virDomainSnapshotStoreFree(job->contents);
+        job->contents = NULL;
+    }
+    VIR_FREE(data->tasks);
+    data->ntasks = 0;
+}
+
+
+static void
+qemuDomainSnapshotExport(void *payload,
+                         const void *name ATTRIBUTE_UNUSED,
+                         void *data)
+{
+    virDomainSnapshotObjPtr snap = payload;
+    struct qemuDomainSnapshotExportData *exp = data;
+
+    if (exp->err < 0)
+        return;
+
+    exp->err = qemuDomainSnapshotWriteMetadata(exp->vm, snap, exp->cfg);
+}
+
+
+/* Brings the on-disk format of the snapshots of @vm, jobs @first up
+ * to @last, in line with the snapshot_store setting: snapshot files
+ * are imported into the store, or the store is exported to snapshot
+ * files. The old copies are removed only once the new ones are
+ * written successfully. */
+static void
+qemuDomainSnapshotConvert(struct qemuDomainSnapshotLoadData *data,
+                          virDomainObjPtr vm,
+                          size_t first,
+                          size_t last)
+{
+    virQEMUDriverConfigPtr cfg = data->cfg;
+    bool convert = false;
+    size_t i;
+
+    for (i = first; i < last; i++) {
+        if (data->jobs[i].assigned && data->jobs[i].store != cfg->snapshotStore)
+            convert = true;
+    }
+
+    if (!convert)
+        return;
+
+    if (cfg->snapshotStore) {
+        VIR_INFO("Importing snapshot files of domain %s into its store",
+                 vm->def->name);
+        if (qemuDomainSnapshotSaveStore(vm, cfg->snapshotDir) < 0)
+            goto error;
+    } else {
+        struct qemuDomainSnapshotExportData exp = { cfg, vm, 0 };
+
+        VIR_INFO("Exporting snapshot store of domain %s to snapshot files",
+                 vm->def->name);
+        virDomainSnapshotForEach(vm->snapshots, qemuDomainSnapshotExport,
+                                 &exp);
+        if (exp.err < 0)
+            goto error;
+    }
+
+    for (i = first; i < last; i++) {
+        if (!data->jobs[i].assigned ||
+            data->jobs[i].store == cfg->snapshotStore)
+            continue;
+        if (unlink(data->jobs[i].path) < 0)
+            VIR_WARN("Failed to unlink %s", data->jobs[i].path);
+    }
+    return;
+
+ error:
+    VIR_ERROR(_("Failed to convert snapshot metadata of domain %s: %s"),
+              vm->def->name, virGetLastErrorMessage());
+}
+
+
+/* Hands the parsed snapshots of @vm, jobs @first up to @last, over to it */
+static size_t
+qemuDomainSnapshotAssign(struct qemuDomainSnapshotLoadData *data,
+                         virDomainObjPtr vm,
+                         size_t first,
+                         size_t last)
+{
+    virDomainSnapshotObjPtr snap;
+    virDomainSnapshotObjPtr current = NULL;
+    size_t nloaded = 0;
+    size_t i, j;
+
+    virObjectLock(vm);
+
+    for (i = first; i < last; i++) {
+        struct qemuDomainSnapshotLoadJob *job = &data->jobs[i];
+
+        for (j = 0; j < job->ndefs; j++) {
+            virDomainSnapshotDefPtr def = job->defs[j];
+
+            job->defs[j] = NULL;
+
+            /* The store comes first, so this is a snapshot file left
+             * behind by a conversion that was interrupted. It is
+             * dropped along with the other converted files. */
+            if (!job->store &&
+                virDomainSnapshotFindByName(vm->snapshots, def->name)) {
+                VIR_DEBUG("Snapshot %s of domain %s is already loaded "
+                          "from its store, skipping %s",
+                          def->name, vm->def->name, job->path);
+                virDomainSnapshotDefFree(def);
+                job->assigned = true;
+                continue;
+            }
+
+            if (!(snap = virDomainSnapshotAssignDef(vm->snapshots, def))) {
+                virDomainSnapshotDefFree(def);
+                continue;
+            }
+
+            if (snap->def->current) {
+                current = snap;
+                if (!vm->current_snapshot)
+                    vm->current_snapshot = snap;
+            }
+            job->assigned = true;
+            nloaded++;
+        }
     }
-    if (direrr < 0)
-        VIR_ERROR(_("Failed to fully read directory %s"), snapDir);
 
     if (vm->current_snapshot != current) {
         VIR_ERROR(_("Too many snapshots claiming to be current for domain %s"),
@@ -561,16 +870,75 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
      * pretty important in our metadata.
      */
 
+    qemuDomainSnapshotConvert(data, vm, first, last);
+
     virResetLastError();
+    virObjectUnlock(vm);
+    return nloaded;
+}
+
+
+/*
+ * Loads the snapshot metadata of all domains. Snapshot stores and
+ * files are parsed in parallel, followed by the snapshots of the
+ * stores, then assigned to their domain one domain at a time.
+ */
+static void
+qemuDomainSnapshotLoadAll(virQEMUDriverPtr driver,
+                          virQEMUDriverConfigPtr cfg)
+{
+    struct qemuDomainSnapshotLoadData data = { cfg, NULL, NULL, 0, NULL, 0,
+                                               NULL, 0 };
+    unsigned long long start = 0, parsed = 0, done = 0;
+    size_t nloaded = 0;
+    size_t first = 0;
+    size_t i, j;
+
+    ignore_value(virTimeMillisNow(&start));
+
+    if (!(data.caps = virQEMUDriverGetCapabilities(driver, false)))
+        return;
+
+    if (virDomainObjListForEach(driver->domains,
+                                qemuDomainSnapshotCollect, &data) < 0)
+        goto cleanup;
+
+    for (i = 0; i < data.nvms; i++)
+        qemuDomainSnapshotScan(&data, data.vms[i]);
+
+    /* Not to be initialized by several workers at once */
+    xmlInitParser();
+    virThreadPoolRunBatch(data.njobs, QEMU_SNAPSHOT_LOAD_WORKERS,
+                          qemuDomainSnapshotParseOne, &data);
+    qemuDomainSnapshotParseStores(&data);
+    ignore_value(virTimeMillisNow(&parsed));
+
+    /* Jobs were queued domain by domain */
+    for (i = 0; i < data.nvms; i++) {
+        for (j = first; j < data.njobs && data.jobs[j].vm == data.vms[i]; j++)
+            ;
+        nloaded += qemuDomainSnapshotAssign(&data, data.vms[i], first, j);
+        first = j;
+    }
+    ignore_value(virTimeMillisNow(&done));
+
+    VIR_INFO("Loaded %zu snapshots from %zu files of %zu domains in %llu ms "
+             "(parsing %llu ms, assigning %llu ms)",
+             nloaded, data.njobs, data.nvms, done - start,
+             parsed - start, done - parsed);
 
-    ret = 0;
  cleanup:
-    if (dir)
-        closedir(dir);
-    VIR_FREE(snapDir);
-    virObjectUnref(caps);
-    virObjectUnlock(vm);
-    return ret;
+    for (i = 0; i < data.njobs; i++) {
+        VIR_FREE(data.jobs[i].path);
+        for (j = 0; j < data.jobs[i].ndefs; j++)
+            virDomainSnapshotDefFree(data.jobs[i].defs[j]);
+        VIR_FREE(data.jobs[i].defs);
+    }
+    VIR_FREE(data.jobs);
+    for (i = 0; i < data.nvms; i++)
+        virObjectUnref(data.vms[i]);
+    VIR_FREE(data.vms);
+    virObjectUnref(data.caps);
 }
 
 
@@ -760,6 +1128,9 @@ qemuStateInitialize(bool privileged,
     if (!(qemu_driver->sharedDevices = virHashCreate(30, qemuSharedDeviceEntryFree)))
         goto error;
 
+    if (!(qemu_driver->domCapsCache = virHashCreate(10, virQEMUDriverDomCapsEntryFree)))
+        goto error;
+
     if (privileged) {
         if (chown(cfg->libDir, cfg->user, cfg->group) < 0) {
             virReportSystemError(errno,
@@ -800,12 +1171,37 @@ qemuStateInitialize(bool privileged,
     if (!qemu_driver->qemuCapsCache)
         goto error;
 
-    if ((qemu_driver->caps = virQEMUDriverCreateCapabilities(qemu_driver)) == NULL)
+    /* Fingerprints the host along with building the capabilities, so
+     * that changes made before the first query are noticed */
+    if (virQEMUDriverRefreshCapabilities(qemu_driver) < 0)
         goto error;
 
     if (!(qemu_driver->xmlopt = virQEMUDriverCreateXMLConf(qemu_driver)))
         goto error;
 
+    if (cfg->statusSaveDelay) {
+        qemu_driver->statusWriter = virFileWriterNew(cfg->statusSaveDelay);
+        if (!qemu_driver->statusWriter)
+            goto error;
+        virDomainXMLOptionSetStatusWriter(qemu_driver->xmlopt,
+                                          qemu_driver->statusWriter);
+    }
+
+    if (cfg->monitorIOThreads &&
+        VIR_ALLOC_N(qemu_driver->monitorIOThreads, cfg->monitorIOThreads) < 0)
+        goto error;
+    for (i = 0; i < cfg->monitorIOThreads; i++) {
+        char *name;
+
+        if (virAsprintf(&name, "qemu-monitor-%zu", i) < 0)
+            goto error;
+        qemu_driver->monitorIOThreads[i] = virEventThreadNew(name);
+        VIR_FREE(name);
+        if (!qemu_driver->monitorIOThreads[i])
+            goto error;
+        qemu_driver->nmonitorIOThreads++;
+    }
+
     /* If hugetlbfs is present, then we need to create a sub-directory within
      * it, since we can't assume the root mount point has permissions that
      * will let our spawned QEMU instances use it. */
@@ -873,9 +1269,7 @@ qemuStateInitialize(bool privileged,
                                        NULL, NULL) < 0)
         goto error;
 
-    virDomainObjListForEach(qemu_driver->domains,
-                            qemuDomainSnapshotLoad,
-                            cfg->snapshotDir);
+    qemuDomainSnapshotLoadAll(qemu_driver, cfg);
 
     virDomainObjListForEach(qemu_driver->domains,
                             qemuDomainManagedSaveLoad,
@@ -1028,17 +1422,34 @@ qemuStateStop(void)
 static int
 qemuStateCleanup(void)
 {
+    size_t i;
+
     if (!qemu_driver)
         return -1;
 
     virNWFilterUnRegisterCallbackDriver(&qemuCallbackDriver);
+    if (qemu_driver->statusWriter &&
+        virFileWriterFlush(qemu_driver->statusWriter) < 0)
+        VIR_WARN("Unable to write out queued status files");
+    virObjectUnref(qemu_driver->statusWriter);
     virObjectUnref(qemu_driver->config);
     virObjectUnref(qemu_driver->hostdevMgr);
     virHashFree(qemu_driver->sharedDevices);
+    virHashFree(qemu_driver->domCapsCache);
     virObjectUnref(qemu_driver->caps);
+    VIR_FREE(qemu_driver->capsFingerprint);
+    VIR_FREE(qemu_driver->capsXML);
     virQEMUCapsCacheFree(qemu_driver->qemuCapsCache);
 
     virObjectUnref(qemu_driver->domains);
+
+    /* Monitors still open hold their own references */
+    for (i = 0; i < qemu_driver->nmonitorIOThreads; i++) {
+        virEventThreadStop(qemu_driver->monitorIOThreads[i]);
+        virObjectUnref(qemu_driver->monitorIOThreads[i]);
+    }
+    VIR_FREE(qemu_driver->monitorIOThreads);
+
     virObjectUnref(qemu_driver->remotePorts);
     virObjectUnref(qemu_driver->webSocketPorts);
     virObjectUnref(qemu_driver->migrationPorts);
@@ -1286,21 +1697,11 @@ qemuConnectGetMaxVcpus(virConnectPtr conn ATTRIBUTE_UNUSED, const char *type)
 
 static char *qemuConnectGetCapabilities(virConnectPtr conn) {
     virQEMUDriverPtr driver = conn->privateData;
-    virCapsPtr caps = NULL;
-    char *xml = NULL;
 
     if (virConnectGetCapabilitiesEnsureACL(conn) < 0)
         return NULL;
 
-    if (!(caps = virQEMUDriverGetCapabilities(driver, true)))
-        goto cleanup;
-
-    xml = virCapabilitiesFormatXML(caps);
-    virObjectUnref(caps);
-
- cleanup:
-
-    return xml;
+    return virQEMUDriverGetCapabilitiesXML(driver);
 }
 
 
@@ -11500,7 +11901,7 @@ qemuDomainMigratePrepareTunnel(virConnectPtr dconn,
 
     ret = qemuMigrationPrepareTunnel(driver, dconn,
                                      NULL, 0, NULL, NULL, /* No cookies in v2 */
-                                     st, &def, origname, flags);
+                                     st, &def, origname, 1, flags);
 
  cleanup:
     VIR_FREE(origname);
@@ -11613,7 +12014,7 @@ qemuDomainMigratePerform(virDomainPtr dom,
      * Consume any cookie we were able to decode though
      */
     ret = qemuMigrationPerform(driver, dom->conn, vm,
-                               NULL, dconnuri, uri, NULL, NULL,
+                               NULL, dconnuri, uri, NULL, NULL, 1,
                                cookie, cookielen,
                                NULL, NULL, /* No output cookies in v2 */
                                flags, dname, resource, false);
@@ -11882,7 +12283,7 @@ qemuDomainMigratePrepareTunnel3(virConnectPtr dconn,
     ret = qemuMigrationPrepareTunnel(driver, dconn,
                                      cookiein, cookieinlen,
                                      cookieout, cookieoutlen,
-                                     st, &def, origname, flags);
+                                     st, &def, origname, 1, flags);
 
  cleanup:
     VIR_FREE(origname);
@@ -11890,6 +12291,44 @@ qemuDomainMigratePrepareTunnel3(virConnectPtr dconn,
     return ret;
 }
 
+static int
+qemuDomainMigratePrepareTunnelStream(virConnectPtr dconn,
+                                     virQEMUDriverPtr driver,
+                                     const char *dname,
+                                     const char *cookiein,
+                                     int cookieinlen,
+                                     virStreamPtr st,
+                                     int index)
+{
+    virDomainObjPtr vm;
+    int ret = -1;
+
+    if (!dname) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("migration tunnel stream requires domain name"));
+        return -1;
+    }
+
+    if (!(vm = virDomainObjListFindByName(driver->domains, dname))) {
+        virReportError(VIR_ERR_NO_DOMAIN,
+                       _("no domain with matching name '%s'"), dname);
+        return -1;
+    }
+
+    /* The incoming domain is already defined, check against it instead
+     * of parsing the domain XML for every stream */
+    if (virDomainMigratePrepareTunnel3ParamsEnsureACL(dconn, vm->def) < 0)
+        goto cleanup;
+
+    ret = qemuMigrationPrepareTunnelStream(driver, vm, cookiein, cookieinlen,
+                                           st, index);
+
+ cleanup:
+    virObjectUnlock(vm);
+    return ret;
+}
+
+
 static int
 qemuDomainMigratePrepareTunnel3Params(virConnectPtr dconn,
                                       virStreamPtr st,
@@ -11906,10 +12345,15 @@ qemuDomainMigratePrepareTunnel3Params(virConnectPtr dconn,
     const char *dom_xml = NULL;
     const char *dname = NULL;
     char *origname = NULL;
+    int tunnelStreams = 1;
+    int tunnelIndex = 0;
     int ret = -1;
 
     virCheckFlags(QEMU_MIGRATION_FLAGS, -1);
-    if (virTypedParamsValidate(params, nparams, QEMU_MIGRATION_PARAMETERS) < 0)
+    if (virTypedParamsValidate(params, nparams,
+                               QEMU_MIGRATION_PARAM_TUNNEL_INDEX,
+                               VIR_TYPED_PARAM_INT,
+                               QEMU_MIGRATION_PARAMETERS) < 0)
         return -1;
 
     if (virTypedParamsGetString(params, nparams,
@@ -11917,7 +12361,13 @@ qemuDomainMigratePrepareTunnel3Params(virConnectPtr dconn,
                                 &dom_xml) < 0 ||
         virTypedParamsGetString(params, nparams,
                                 VIR_MIGRATE_PARAM_DEST_NAME,
-                                &dname) < 0)
+                                &dname) < 0 ||
+        virTypedParamsGetInt(params, nparams,
+                             VIR_MIGRATE_PARAM_TUNNEL_STREAMS,
+                             &tunnelStreams) < 0 ||
+        virTypedParamsGetInt(params, nparams,
+                             QEMU_MIGRATION_PARAM_TUNNEL_INDEX,
+                             &tunnelIndex) < 0)
         return -1;
 
     if (!(flags & VIR_MIGRATE_TUNNELLED)) {
@@ -11926,6 +12376,23 @@ qemuDomainMigratePrepareTunnel3Params(virConnectPtr dconn,
         goto cleanup;
     }
 
+    if (tunnelStreams < 1 ||
+        tunnelStreams > QEMU_MIGRATION_TUNNEL_STREAMS_MAX) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("number of tunnel streams must be between 1 and %d"),
+                       QEMU_MIGRATION_TUNNEL_STREAMS_MAX);
+        goto cleanup;
+    }
+
+    /* Additional streams of a striped migration join the domain
+     * prepared by the first one */
+    if (tunnelIndex > 0) {
+        ret = qemuDomainMigratePrepareTunnelStream(dconn, driver, dname,
+                                                   cookiein, cookieinlen,
+                                                   st, tunnelIndex);
+        goto cleanup;
+    }
+
     if (!(def = qemuMigrationPrepareDef(driver, dom_xml, dname, &origname)))
         goto cleanup;
 
@@ -11935,7 +12402,8 @@ qemuDomainMigratePrepareTunnel3Params(virConnectPtr dconn,
     ret = qemuMigrationPrepareTunnel(driver, dconn,
                                      cookiein, cookieinlen,
                                      cookieout, cookieoutlen,
-                                     st, &def, origname, flags);
+                                     st, &def, origname, tunnelStreams,
+                                     flags);
 
  cleanup:
     VIR_FREE(origname);
@@ -11971,7 +12439,7 @@ qemuDomainMigratePerform3(virDomainPtr dom,
     }
 
     return qemuMigrationPerform(driver, dom->conn, vm, xmlin,
-                                dconnuri, uri, NULL, NULL,
+                                dconnuri, uri, NULL, NULL, 1,
                                 cookiein, cookieinlen,
                                 cookieout, cookieoutlen,
                                 flags, dname, resource, true);
@@ -11996,6 +12464,7 @@ qemuDomainMigratePerform3Params(virDomainPtr dom,
     const char *graphicsuri = NULL;
     const char *listenAddress = NULL;
     unsigned long long bandwidth = 0;
+    int tunnelStreams = 1;
 
     virCheckFlags(QEMU_MIGRATION_FLAGS, -1);
     if (virTypedParamsValidate(params, nparams, QEMU_MIGRATION_PARAMETERS) < 0)
@@ -12018,9 +12487,27 @@ qemuDomainMigratePerform3Params(virDomainPtr dom,
                                 &graphicsuri) < 0 ||
         virTypedParamsGetString(params, nparams,
                                 VIR_MIGRATE_PARAM_LISTEN_ADDRESS,
-                                &listenAddress) < 0)
+                                &listenAddress) < 0 ||
+        virTypedParamsGetInt(params, nparams,
+                             VIR_MIGRATE_PARAM_TUNNEL_STREAMS,
+                             &tunnelStreams) < 0)
         return -1;
 
+    if (tunnelStreams < 1 ||
+        tunnelStreams > QEMU_MIGRATION_TUNNEL_STREAMS_MAX) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("number of tunnel streams must be between 1 and %d"),
+                       QEMU_MIGRATION_TUNNEL_STREAMS_MAX);
+        return -1;
+    }
+
+    if (tunnelStreams > 1 && !(flags & VIR_MIGRATE_TUNNELLED)) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
+                       _("multiple streams are only supported with "
+                         "tunnelled migration"));
+        return -1;
+    }
+
     if (!(vm = qemuDomObjFromDomain(dom)))
         return -1;
 
@@ -12031,7 +12518,8 @@ qemuDomainMigratePerform3Params(virDomainPtr dom,
 
     return qemuMigrationPerform(driver, dom->conn, vm, dom_xml,
                                 dconnuri, uri, graphicsuri, listenAddress,
-                                cookiein, cookieinlen, cookieout, cookieoutlen,
+                                tunnelStreams, cookiein, cookieinlen,
+                                cookieout, cookieoutlen,
                                 flags, dname, bandwidth, true);
 }
 
@@ -14208,7 +14696,7 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
         if (update_current) {
             vm->current_snapshot->def->current = false;
             if (qemuDomainSnapshotWriteMetadata(vm, vm->current_snapshot,
-                                                cfg->snapshotDir) < 0)
+                                                cfg) < 0)
                 goto endjob;
             vm->current_snapshot = NULL;
         }
@@ -14256,8 +14744,7 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
 
  endjob:
     if (snapshot && !(flags & VIR_DOMAIN_SNAPSHOT_CREATE_NO_METADATA)) {
-        if (qemuDomainSnapshotWriteMetadata(vm, snap,
-                                            cfg->snapshotDir) < 0) {
+        if (qemuDomainSnapshotWriteMetadata(vm, snap, cfg) < 0) {
             /* if writing of metadata fails, error out rather than trying
              * to silently carry on without completing the snapshot */
             virObjectUnref(snapshot);
@@ -14773,8 +15260,7 @@ qemuDomainRevertToSnapshot(virDomainSnapshotPtr snapshot,
 
     if (vm->current_snapshot) {
         vm->current_snapshot->def->current = false;
-        if (qemuDomainSnapshotWriteMetadata(vm, vm->current_snapshot,
-                                            cfg->snapshotDir) < 0)
+        if (qemuDomainSnapshotWriteMetadata(vm, vm->current_snapshot, cfg) < 0)
             goto endjob;
         vm->current_snapshot = NULL;
         /* XXX Should we restore vm->current_snapshot after this point
@@ -15014,8 +15500,7 @@ qemuDomainRevertToSnapshot(virDomainSnapshotPtr snapshot,
 
  cleanup:
     if (ret == 0) {
-        if (qemuDomainSnapshotWriteMetadata(vm, snap,
-                                            cfg->snapshotDir) < 0)
+        if (qemuDomainSnapshotWriteMetadata(vm, snap, cfg) < 0)
             ret = -1;
         else
             vm->current_snapshot = snap;
@@ -15070,8 +15555,7 @@ qemuDomainSnapshotReparentChildren(void *payload,
     if (!snap->sibling)
         rep->last = snap;
 
-    rep->err = qemuDomainSnapshotWriteMetadata(rep->vm, snap,
-                                               rep->cfg->snapshotDir);
+    rep->err = qemuDomainSnapshotWriteMetadata(rep->vm, snap, rep->cfg);
 }
 
 
@@ -15104,6 +15588,10 @@ qemuDomainSnapshotDelete(virDomainSnapshotPtr snapshot,
     if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
         goto cleanup;
 
+    /* Write the snapshot store only once for all the snapshots being
+     * reparented or deleted */
+    qemuDomainSnapshotBeginUpdate(vm);
+
     if (!(snap = qemuSnapObjFromSnapshot(vm, snapshot)))
         goto endjob;
 
@@ -15139,8 +15627,7 @@ qemuDomainSnapshotDelete(virDomainSnapshotPtr snapshot,
         if (rem.current) {
             if (flags & VIR_DOMAIN_SNAPSHOT_DELETE_CHILDREN_ONLY) {
                 snap->def->current = true;
-                if (qemuDomainSnapshotWriteMetadata(vm, snap,
-                                                    cfg->snapshotDir) < 0) {
+                if (qemuDomainSnapshotWriteMetadata(vm, snap, cfg) < 0) {
                     virReportError(VIR_ERR_INTERNAL_ERROR,
                                    _("failed to set snapshot '%s' as current"),
                                    snap->def->name);
@@ -15177,6 +15664,8 @@ qemuDomainSnapshotDelete(virDomainSnapshotPtr snapshot,
     }
 
  endjob:
+    if (qemuDomainSnapshotEndUpdate(vm, cfg) < 0)
+        ret = -1;
     qemuDomainObjEndJob(driver, vm);
 
  cleanup:
@@ -18239,6 +18728,8 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
     virDomainCapsPtr domCaps = NULL;
     int arch = virArchFromHost(); /* virArch */
     virQEMUDriverConfigPtr cfg = NULL;
+    char *key = NULL;
+    unsigned int generation;
 
     virCheckFlags(0, ret);
 
@@ -18311,6 +18802,15 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
         machine = virQEMUCapsGetDefaultMachine(qemuCaps);
     }
 
+    if (virAsprintf(&key, "%s:%s:%s:%s", emulatorbin, virArchToString(arch),
+                    NULLSTR(machine), virDomainVirtTypeToString(virttype)) < 0)
+        goto cleanup;
+
+    /* Served from the cache unless this is the first time round */
+    if (virQEMUDriverGetDomainCapsXML(driver, qemuCaps, key,
+                                      &ret, &generation) != 0)
+        goto cleanup;
+
     if (!(domCaps = virDomainCapsNew(emulatorbin, machine, arch, virttype)))
         goto cleanup;
 
@@ -18318,8 +18818,10 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
                                   cfg->loader, cfg->nloader) < 0)
         goto cleanup;
 
-    ret = virDomainCapsFormat(domCaps);
+    if ((ret = virDomainCapsFormat(domCaps)))
+        virQEMUDriverCacheDomainCapsXML(driver, qemuCaps, key, ret, generation);
  cleanup:
+    VIR_FREE(key);
     virObjectUnref(cfg);
     virObjectUnref(domCaps);
     virObjectUnref(qemuCaps);
@@ -18330,28 +18832,98 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
 static int
 qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                         virDomainObjPtr dom,
-                        virDomainStatsRecordPtr record,
-                        int *maxparams,
+                        virTypedParamListPtr params,
                         unsigned int privflags ATTRIBUTE_UNUSED)
 {
-    if (virTypedParamsAddInt(&record->params,
-                             &record->nparams,
-                             maxparams,
-                             "state.state",
-                             dom->state.state) < 0)
+    if (virTypedParamListAddInt(params, "state.state", dom->state.state) < 0)
         return -1;
 
-    if (virTypedParamsAddInt(&record->params,
-                             &record->nparams,
-                             maxparams,
-                             "state.reason",
-                             dom->state.reason) < 0)
+    if (virTypedParamListAddInt(params, "state.reason", dom->state.reason) < 0)
         return -1;
 
     return 0;
 }
 
 
+static int
+qemuDomainGetStatsAutostart(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                            virDomainObjPtr dom,
+                            virTypedParamListPtr params,
+                            unsigned int privflags ATTRIBUTE_UNUSED)
+{
+    if (virTypedParamListAddBoolean(params, "autostart.enabled",
+                                    dom->autostart) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+qemuDomainGetStatsManagedSave(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                              virDomainObjPtr dom,
+                              virTypedParamListPtr params,
+                              unsigned int privflags ATTRIBUTE_UNUSED)
+{
+    if (virTypedParamListAddBoolean(params, "managedsave.present",
+                                    dom->hasManagedSave) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+qemuDomainGetStatsMonitor(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                          virDomainObjPtr dom,
+                          virTypedParamListPtr params,
+                          unsigned int privflags ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    qemuMonitorStats stats;
+    virEventThreadPtr iothread;
+    virEventThreadStats thrstats;
+
+    /* The monitor is only cleared with the domain object locked,
+     * which it is for the duration of this call. */
+    if (!priv->mon)
+        return 0;
+
+    qemuMonitorGetStats(priv->mon, &stats);
+
+#define QEMU_ADD_MONITOR_PARAM(name, value)                                 \
+    do {                                                                    \
+        if (virTypedParamListAddULLong(params, name, value) < 0)            \
+            return -1;                                                      \
+    } while (0)
+
+    QEMU_ADD_MONITOR_PARAM("monitor.commands", stats.commands);
+    QEMU_ADD_MONITOR_PARAM("monitor.latency.total", stats.latencyTotal);
+    QEMU_ADD_MONITOR_PARAM("monitor.latency.max", stats.latencyMax);
+
+    if (!(iothread = qemuMonitorGetIOThread(priv->mon)))
+        return 0;
+
+    virEventThreadGetStats(iothread, &thrstats);
+
+    if (virTypedParamListAddString(params, "monitor.iothread.name",
+                                   virEventThreadGetName(iothread)) < 0)
+        return -1;
+
+    QEMU_ADD_MONITOR_PARAM("monitor.iothread.handles", thrstats.handles);
+    QEMU_ADD_MONITOR_PARAM("monitor.iothread.wakeups", thrstats.wakeups);
+    QEMU_ADD_MONITOR_PARAM("monitor.iothread.dispatches", thrstats.dispatches);
+    QEMU_ADD_MONITOR_PARAM("monitor.iothread.ready.max", thrstats.readyMax);
+    QEMU_ADD_MONITOR_PARAM("monitor.iothread.busy", thrstats.busyTime);
+    QEMU_ADD_MONITOR_PARAM("monitor.iothread.dispatch.max",
+                           thrstats.dispatchMax);
+
+#undef QEMU_ADD_MONITOR_PARAM
+
+    return 0;
+}
+
+
 typedef enum {
     QEMU_DOMAIN_STATS_HAVE_JOB = 1 << 0, /* job is entered, monitor can be
                                             accessed */
@@ -18366,8 +18938,7 @@ typedef enum {
 static int
 qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                       virDomainObjPtr dom,
-                      virDomainStatsRecordPtr record,
-                      int *maxparams,
+                      virTypedParamListPtr params,
                       unsigned int privflags ATTRIBUTE_UNUSED)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
@@ -18380,25 +18951,13 @@ qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
         return 0;
 
     err = virCgroupGetCpuacctUsage(priv->cgroup, &cpu_time);
-    if (!err && virTypedParamsAddULLong(&record->params,
-                                        &record->nparams,
-                                        maxparams,
-                                        "cpu.time",
-                                        cpu_time) < 0)
+    if (!err && virTypedParamListAddULLong(params, "cpu.time", cpu_time) < 0)
         return -1;
 
     err = virCgroupGetCpuacctStat(priv->cgroup, &user_time, &sys_time);
-    if (!err && virTypedParamsAddULLong(&record->params,
-                                        &record->nparams,
-                                        maxparams,
-                                        "cpu.user",
-                                        user_time) < 0)
+    if (!err && virTypedParamListAddULLong(params, "cpu.user", user_time) < 0)
         return -1;
-    if (!err && virTypedParamsAddULLong(&record->params,
-                                        &record->nparams,
-                                        maxparams,
-                                        "cpu.system",
-                                        sys_time) < 0)
+    if (!err && virTypedParamListAddULLong(params, "cpu.system", sys_time) < 0)
         return -1;
 
     return 0;
@@ -18407,8 +18966,7 @@ qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
 static int
 qemuDomainGetStatsBalloon(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                           virDomainObjPtr dom,
-                          virDomainStatsRecordPtr record,
-                          int *maxparams,
+                          virTypedParamListPtr params,
                           unsigned int privflags ATTRIBUTE_UNUSED)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
@@ -18424,18 +18982,12 @@ qemuDomainGetStatsBalloon(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
         err = -1;
     }
 
-    if (!err && virTypedParamsAddULLong(&record->params,
-                                        &record->nparams,
-                                        maxparams,
-                                        "balloon.current",
-                                        cur_balloon) < 0)
+    if (!err && virTypedParamListAddULLong(params, "balloon.current",
+                                           cur_balloon) < 0)
         return -1;
 
-    if (virTypedParamsAddULLong(&record->params,
-                                &record->nparams,
-                                maxparams,
-                                "balloon.maximum",
-                                dom->def->mem.max_balloon) < 0)
+    if (virTypedParamListAddULLong(params, "balloon.maximum",
+                                   dom->def->mem.max_balloon) < 0)
         return -1;
 
     return 0;
@@ -18445,8 +18997,7 @@ qemuDomainGetStatsBalloon(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
 static int
 qemuDomainGetStatsVcpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                        virDomainObjPtr dom,
-                       virDomainStatsRecordPtr record,
-                       int *maxparams,
+                       virTypedParamListPtr params,
                        unsigned int privflags ATTRIBUTE_UNUSED)
 {
     size_t i;
@@ -18454,18 +19005,12 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
     char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
     virVcpuInfoPtr cpuinfo = NULL;
 
-    if (virTypedParamsAddUInt(&record->params,
-                              &record->nparams,
-                              maxparams,
-                              "vcpu.current",
-                              (unsigned) dom->def->vcpus) < 0)
+    if (virTypedParamListAddUInt(params, "vcpu.current",
+                                 (unsigned) dom->def->vcpus) < 0)
         return -1;
 
-    if (virTypedParamsAddUInt(&record->params,
-                              &record->nparams,
-                              maxparams,
-                              "vcpu.maximum",
-                              (unsigned) dom->def->maxvcpus) < 0)
+    if (virTypedParamListAddUInt(params, "vcpu.maximum",
+                                 (unsigned) dom->def->maxvcpus) < 0)
         return -1;
 
     if (VIR_ALLOC_N(cpuinfo, dom->def->vcpus) < 0)
@@ -18481,11 +19026,7 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
     for (i = 0; i < dom->def->vcpus; i++) {
         snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
                  "vcpu.%zu.state", i);
-        if (virTypedParamsAddInt(&record->params,
-                                 &record->nparams,
-                                 maxparams,
-                                 param_name,
-                                 cpuinfo[i].state) < 0)
+        if (virTypedParamListAddInt(params, param_name, cpuinfo[i].state) < 0)
             goto cleanup;
 
         /* stats below are available only if the VM is alive */
@@ -18494,11 +19035,8 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
 
         snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
                  "vcpu.%zu.time", i);
-        if (virTypedParamsAddULLong(&record->params,
-                                    &record->nparams,
-                                    maxparams,
-                                    param_name,
-                                    cpuinfo[i].cpuTime) < 0)
+        if (virTypedParamListAddULLong(params, param_name,
+                                       cpuinfo[i].cpuTime) < 0)
             goto cleanup;
     }
 
@@ -18509,49 +19047,37 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
     return ret;
 }
 
-#define QEMU_ADD_COUNT_PARAM(record, maxparams, type, count) \
+#define QEMU_ADD_COUNT_PARAM(params, type, count) \
 do { \
     char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
     snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "%s.count", type); \
-    if (virTypedParamsAddUInt(&(record)->params, \
-                              &(record)->nparams, \
-                              maxparams, \
-                              param_name, \
-                              count) < 0) \
+    if (virTypedParamListAddUInt(params, param_name, count) < 0) \
         goto cleanup; \
 } while (0)
 
-#define QEMU_ADD_NAME_PARAM(record, maxparams, type, subtype, num, name) \
+#define QEMU_ADD_NAME_PARAM(params, type, subtype, num, name) \
 do { \
     char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
     snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
              "%s.%zu.%s", type, num, subtype); \
-    if (virTypedParamsAddString(&(record)->params, \
-                                &(record)->nparams, \
-                                maxparams, \
-                                param_name, \
-                                name) < 0) \
+    if (virTypedParamListAddString(params, param_name, name) < 0) \
         goto cleanup; \
 } while (0)
 
-#define QEMU_ADD_NET_PARAM(record, maxparams, num, name, value) \
+#define QEMU_ADD_NET_PARAM(params, num, name, value) \
 do { \
     char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
     snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
              "net.%zu.%s", num, name); \
-    if (value >= 0 && virTypedParamsAddULLong(&(record)->params, \
-                                              &(record)->nparams, \
-                                              maxparams, \
-                                              param_name, \
-                                              value) < 0) \
+    if (value >= 0 && virTypedParamListAddULLong(params, param_name, \
+                                                 value) < 0) \
         return -1; \
 } while (0)
 
 static int
 qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                             virDomainObjPtr dom,
-                            virDomainStatsRecordPtr record,
-                            int *maxparams,
+                            virTypedParamListPtr params,
                             unsigned int privflags ATTRIBUTE_UNUSED)
 {
     size_t i;
@@ -18561,7 +19087,7 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
     if (!virDomainObjIsActive(dom))
         return 0;
 
-    QEMU_ADD_COUNT_PARAM(record, maxparams, "net", dom->def->nnets);
+    QEMU_ADD_COUNT_PARAM(params, "net", dom->def->nnets);
 
     /* Check the path is one of the domain's network interfaces. */
     for (i = 0; i < dom->def->nnets; i++) {
@@ -18570,29 +19096,29 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
 
         memset(&tmp, 0, sizeof(tmp));
 
-        QEMU_ADD_NAME_PARAM(record, maxparams,
-                            "net", "name", i, dom->def->nets[i]->ifname);
+        QEMU_ADD_NAME_PARAM(params, "net", "name", i,
+                            dom->def->nets[i]->ifname);
 
         if (virNetInterfaceStats(dom->def->nets[i]->ifname, &tmp) < 0) {
             virResetLastError();
             continue;
         }
 
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "rx.bytes", tmp.rx_bytes);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "rx.pkts", tmp.rx_packets);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "rx.errs", tmp.rx_errs);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "rx.drop", tmp.rx_drop);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "tx.bytes", tmp.tx_bytes);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "tx.pkts", tmp.tx_packets);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "tx.errs", tmp.tx_errs);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "tx.drop", tmp.tx_drop);
     }
 
@@ -18603,43 +19129,32 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
 
 #undef QEMU_ADD_NET_PARAM
 
-#define QEMU_ADD_BLOCK_PARAM_UI(record, maxparams, num, name, value) \
+#define QEMU_ADD_BLOCK_PARAM_UI(params, num, name, value)            \
     do {                                                             \
         char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];               \
         snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,           \
                  "block.%zu.%s", num, name);                         \
-        if (virTypedParamsAddUInt(&(record)->params,                 \
-                                  &(record)->nparams,                \
-                                  maxparams,                         \
-                                  param_name,                        \
-                                  value) < 0)                        \
+        if (virTypedParamListAddUInt(params, param_name, value) < 0) \
             goto cleanup;                                            \
     } while (0)
 
 /* expects a LL, but typed parameter must be ULL */
-#define QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, num, name, value) \
+#define QEMU_ADD_BLOCK_PARAM_LL(params, num, name, value) \
 do { \
     char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
     snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
              "block.%zu.%s", num, name); \
-    if (value >= 0 && virTypedParamsAddULLong(&(record)->params, \
-                                              &(record)->nparams, \
-                                              maxparams, \
-                                              param_name, \
-                                              value) < 0) \
+    if (value >= 0 && virTypedParamListAddULLong(params, param_name, \
+                                                 value) < 0) \
         goto cleanup; \
 } while (0)
 
-#define QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, num, name, value) \
+#define QEMU_ADD_BLOCK_PARAM_ULL(params, num, name, value) \
 do { \
     char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
     snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
              "block.%zu.%s", num, name); \
-    if (virTypedParamsAddULLong(&(record)->params, \
-                                &(record)->nparams, \
-                                maxparams, \
-                                param_name, \
-                                value) < 0) \
+    if (virTypedParamListAddULLong(params, param_name, value) < 0) \
         goto cleanup; \
 } while (0)
 
@@ -18648,8 +19163,7 @@ static int
 qemuDomainGetStatsOneBlock(virQEMUDriverPtr driver,
                            virQEMUDriverConfigPtr cfg,
                            virDomainObjPtr dom,
-                           virDomainStatsRecordPtr record,
-                           int *maxparams,
+                           virTypedParamListPtr params,
                            virDomainDiskDefPtr disk,
                            virStorageSourcePtr src,
                            size_t block_idx,
@@ -18664,13 +19178,13 @@ qemuDomainGetStatsOneBlock(virQEMUDriverPtr driver,
     if (disk->info.alias)
         alias = qemuDomainStorageAlias(disk->info.alias, backing_idx);
 
-    QEMU_ADD_NAME_PARAM(record, maxparams, "block", "name", block_idx,
+    QEMU_ADD_NAME_PARAM(params, "block", "name", block_idx,
                         disk->dst);
     if (virStorageSourceIsLocalStorage(src) && src->path)
-        QEMU_ADD_NAME_PARAM(record, maxparams, "block", "path",
+        QEMU_ADD_NAME_PARAM(params, "block", "path",
                             block_idx, src->path);
     if (backing_idx)
-        QEMU_ADD_BLOCK_PARAM_UI(record, maxparams, block_idx, "backingIndex",
+        QEMU_ADD_BLOCK_PARAM_UI(params, block_idx, "backingIndex",
                                 backing_idx);
 
     if (abbreviated || !alias || !(entry = virHashLookup(stats, alias))) {
@@ -18681,43 +19195,43 @@ qemuDomainGetStatsOneBlock(virQEMUDriverPtr driver,
         if (qemuStorageLimitsRefresh(driver, cfg, dom, src) < 0)
             goto cleanup;
         if (src->allocation)
-            QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+            QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                                      "allocation", src->allocation);
         if (src->capacity)
-            QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+            QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                                      "capacity", src->capacity);
         if (src->physical)
-            QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+            QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                                      "physical", src->physical);
         ret = 0;
         goto cleanup;
     }
 
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "rd.reqs", entry->rd_req);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "rd.bytes", entry->rd_bytes);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "rd.times", entry->rd_total_times);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "wr.reqs", entry->wr_req);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "wr.bytes", entry->wr_bytes);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "wr.times", entry->wr_total_times);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "fl.reqs", entry->flush_req);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "fl.times", entry->flush_total_times);
 
-    QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                              "allocation", entry->wr_highest_offset);
 
     if (entry->capacity)
-        QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+        QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                                  "capacity", entry->capacity);
     if (entry->physical)
-        QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+        QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                                  "physical", entry->physical);
 
     ret = 0;
@@ -18730,8 +19244,7 @@ qemuDomainGetStatsOneBlock(virQEMUDriverPtr driver,
 static int
 qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
                         virDomainObjPtr dom,
-                        virDomainStatsRecordPtr record,
-                        int *maxparams,
+                        virTypedParamListPtr params,
                         unsigned int privflags)
 {
     size_t i;
@@ -18741,7 +19254,7 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
     qemuDomainObjPrivatePtr priv = dom->privateData;
     bool abbreviated = false;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
-    int count_index = -1;
+    size_t count_index;
     size_t visited = 0;
     bool visitBacking = !!(privflags & QEMU_DOMAIN_STATS_BACKING);
 
@@ -18765,8 +19278,8 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
     /* When listing backing chains, it's easier to fix up the count
      * after the iteration than it is to iterate twice; but we still
      * want count listed first.  */
-    count_index = record->nparams;
-    QEMU_ADD_COUNT_PARAM(record, maxparams, "block", 0);
+    count_index = params->npar;
+    QEMU_ADD_COUNT_PARAM(params, "block", 0);
 
     for (i = 0; i < dom->def->ndisks; i++) {
         virDomainDiskDefPtr disk = dom->def->disks[i];
@@ -18774,7 +19287,7 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
         unsigned int backing_idx = 0;
 
         while (src && (backing_idx == 0 || visitBacking)) {
-            if (qemuDomainGetStatsOneBlock(driver, cfg, dom, record, maxparams,
+            if (qemuDomainGetStatsOneBlock(driver, cfg, dom, params,
                                            disk, src, visited, backing_idx,
                                            abbreviated, stats) < 0)
                 goto cleanup;
@@ -18784,7 +19297,7 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
         }
     }
 
-    record->params[count_index].value.ui = visited;
+    params->par[count_index].value.ui = visited;
     ret = 0;
 
  cleanup:
@@ -18804,8 +19317,7 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
 typedef int
 (*qemuDomainGetStatsFunc)(virQEMUDriverPtr driver,
                           virDomainObjPtr dom,
-                          virDomainStatsRecordPtr record,
-                          int *maxparams,
+                          virTypedParamListPtr params,
                           unsigned int flags);
 
 struct qemuDomainGetStatsWorker {
@@ -18821,6 +19333,9 @@ static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
     { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU, false },
     { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE, false },
     { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK, true },
+    { qemuDomainGetStatsAutostart, VIR_DOMAIN_STATS_AUTOSTART, false },
+    { qemuDomainGetStatsManagedSave, VIR_DOMAIN_STATS_MANAGEDSAVE, false },
+    { qemuDomainGetStatsMonitor, VIR_DOMAIN_STATS_MONITOR, false },
     { NULL, 0, false }
 };
 
@@ -18874,34 +19389,41 @@ qemuDomainGetStats(virConnectPtr conn,
                    virDomainStatsRecordPtr *record,
                    unsigned int flags)
 {
-    int maxparams = 0;
-    virDomainStatsRecordPtr tmp;
+    virTypedParamListPtr params = NULL;
+    virDomainStatsRecordPtr tmp = NULL;
     size_t i;
     int ret = -1;
 
-    if (VIR_ALLOC(tmp) < 0)
+    if (!(params = virTypedParamListNew()))
         goto cleanup;
 
     for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
         if (stats & qemuDomainGetStatsWorkers[i].stats) {
-            if (qemuDomainGetStatsWorkers[i].func(conn->privateData, dom, tmp,
-                                                  &maxparams, flags) < 0)
+            if (qemuDomainGetStatsWorkers[i].func(conn->privateData, dom,
+                                                  params, flags) < 0)
                 goto cleanup;
         }
     }
 
+    if (VIR_ALLOC(tmp) < 0)
+        goto cleanup;
+
     if (!(tmp->dom = virGetDomain(conn, dom->def->name, dom->def->uuid)))
         goto cleanup;
 
+    if ((tmp->nparams = virTypedParamListSteal(params, &tmp->params)) < 0)
+        goto cleanup;
+
     *record = tmp;
     tmp = NULL;
     ret = 0;
 
  cleanup:
     if (tmp) {
-        virTypedParamsFree(tmp->params, tmp->nparams);
+        virObjectUnref(tmp->dom);
         VIR_FREE(tmp);
     }
+    virTypedParamListFree(params);
 
     return ret;
 }
@@ -2977,6 +2977,13 @@ qemuDomainRemoveChrDevice(virQEMUDriverPtr driver,
     if (rc < 0)
         goto cleanup;
 
+    /* QEMU doesn't know the path of a socket it got passed as a file
+     * descriptor, and it won't be cleaned up on shutdown either once
+     * the device is gone from the definition */
+    if (chr->source.type == VIR_DOMAIN_CHR_TYPE_UNIX &&
+        chr->source.data.nix.listen)
+        unlink(chr->source.data.nix.path);
+
     event = virDomainEventDeviceRemovedNewFromObj(vm, chr->info.alias);
     if (event)
         qemuDomainEventQueue(driver, event);
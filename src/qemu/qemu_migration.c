@@ -32,6 +32,7 @@
 #include <poll.h>
 
 #include "qemu_migration.h"
+#include "qemu_migrationpriv.h"
 #include "qemu_monitor.h"
 #include "qemu_domain.h"
 #include "qemu_process.h"
@@ -84,6 +85,7 @@ enum qemuMigrationCookieFlags {
     QEMU_MIGRATION_COOKIE_FLAG_NETWORK,
     QEMU_MIGRATION_COOKIE_FLAG_NBD,
     QEMU_MIGRATION_COOKIE_FLAG_STATS,
+    QEMU_MIGRATION_COOKIE_FLAG_TUNNEL,
 
     QEMU_MIGRATION_COOKIE_FLAG_LAST
 };
@@ -96,7 +98,8 @@ VIR_ENUM_IMPL(qemuMigrationCookieFlag,
               "persistent",
               "network",
               "nbd",
-              "statistics");
+              "statistics",
+              "tunnel");
 
 enum qemuMigrationCookieFeatures {
     QEMU_MIGRATION_COOKIE_GRAPHICS  = (1 << QEMU_MIGRATION_COOKIE_FLAG_GRAPHICS),
@@ -105,6 +108,7 @@ enum qemuMigrationCookieFeatures {
     QEMU_MIGRATION_COOKIE_NETWORK = (1 << QEMU_MIGRATION_COOKIE_FLAG_NETWORK),
     QEMU_MIGRATION_COOKIE_NBD = (1 << QEMU_MIGRATION_COOKIE_FLAG_NBD),
     QEMU_MIGRATION_COOKIE_STATS = (1 << QEMU_MIGRATION_COOKIE_FLAG_STATS),
+    QEMU_MIGRATION_COOKIE_TUNNEL = (1 << QEMU_MIGRATION_COOKIE_FLAG_TUNNEL),
 };
 
 typedef struct _qemuMigrationCookieGraphics qemuMigrationCookieGraphics;
@@ -184,6 +188,9 @@ struct _qemuMigrationCookie {
 
     /* If (flags & QEMU_MIGRATION_COOKIE_STATS) */
     qemuDomainJobInfoPtr jobInfo;
+
+    /* If (flags & QEMU_MIGRATION_COOKIE_TUNNEL) */
+    char *tunnelToken;
 };
 
 static void qemuMigrationCookieGraphicsFree(qemuMigrationCookieGraphicsPtr grap)
@@ -240,6 +247,7 @@ static void qemuMigrationCookieFree(qemuMigrationCookiePtr mig)
     VIR_FREE(mig->lockState);
     VIR_FREE(mig->lockDriver);
     VIR_FREE(mig->jobInfo);
+    VIR_FREE(mig->tunnelToken);
     VIR_FREE(mig);
 }
 
@@ -618,6 +626,29 @@ qemuMigrationCookieAddStatistics(qemuMigrationCookiePtr mig,
 }
 
 
+static int
+qemuMigrationCookieAddTunnel(qemuMigrationCookiePtr mig,
+                             virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    /* The destination hands out the token of its stream merge, the
+     * source passes back the one it got from Prepare. */
+    if (priv->tunnelMerge) {
+        VIR_FREE(mig->tunnelToken);
+        if (VIR_STRDUP(mig->tunnelToken,
+                       qemuMigrationTunnelMergeGetToken(priv->tunnelMerge)) < 0)
+            return -1;
+    }
+
+    if (!mig->tunnelToken)
+        return 0;
+
+    mig->flags |= QEMU_MIGRATION_COOKIE_TUNNEL;
+    return 0;
+}
+
+
 static void qemuMigrationCookieGraphicsXMLFormat(virBufferPtr buf,
                                                  qemuMigrationCookieGraphicsPtr grap)
 {
@@ -839,6 +870,9 @@ qemuMigrationCookieXMLFormat(virQEMUDriverPtr driver,
     if (mig->flags & QEMU_MIGRATION_COOKIE_STATS && mig->jobInfo)
         qemuMigrationCookieStatisticsXMLFormat(buf, mig->jobInfo);
 
+    if (mig->flags & QEMU_MIGRATION_COOKIE_TUNNEL && mig->tunnelToken)
+        virBufferEscapeString(buf, "<tunnel token='%s'/>\n", mig->tunnelToken);
+
     virBufferAdjustIndent(buf, -2);
     virBufferAddLit(buf, "</qemu-migration>\n");
     return 0;
@@ -1267,6 +1301,14 @@ qemuMigrationCookieXMLParse(qemuMigrationCookiePtr mig,
         (!(mig->jobInfo = qemuMigrationCookieStatisticsXMLParse(ctxt))))
         goto error;
 
+    if (flags & QEMU_MIGRATION_COOKIE_TUNNEL &&
+        virXPathBoolean("boolean(./tunnel)", ctxt) &&
+        !(mig->tunnelToken = virXPathString("string(./tunnel/@token)", ctxt))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("missing tunnel token in migration data"));
+        goto error;
+    }
+
     virObjectUnref(caps);
     return 0;
 
@@ -1341,6 +1383,10 @@ qemuMigrationBakeCookie(qemuMigrationCookiePtr mig,
         qemuMigrationCookieAddStatistics(mig, dom) < 0)
         return -1;
 
+    if (flags & QEMU_MIGRATION_COOKIE_TUNNEL &&
+        qemuMigrationCookieAddTunnel(mig, dom) < 0)
+        return -1;
+
     if (!(*cookieout = qemuMigrationCookieXMLFormatStr(driver, mig)))
         return -1;
 
@@ -2761,6 +2807,400 @@ qemuMigrationBegin(virConnectPtr conn,
 }
 
 
+#define TUNNEL_SEND_BUF_SIZE (1024 * 1024)
+
+/* When a tunnelled migration is striped across several streams, each
+ * chunk read from QEMU is prefixed with its sequence number (8 bytes) and
+ * length (4 bytes), both big endian, so that the destination can put the
+ * chunks back in order. */
+#define TUNNEL_CHUNK_HEADER_SIZE 12
+#define TUNNEL_CHUNK_DATA_MAX (TUNNEL_SEND_BUF_SIZE - TUNNEL_CHUNK_HEADER_SIZE)
+
+static void
+qemuMigrationTunnelChunkEncode(unsigned char *header,
+                               unsigned long long seq,
+                               size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < 8; i++)
+        header[i] = (seq >> (8 * (7 - i))) & 0xff;
+    for (i = 0; i < 4; i++)
+        header[8 + i] = (len >> (8 * (3 - i))) & 0xff;
+}
+
+static void
+qemuMigrationTunnelChunkDecode(const unsigned char *header,
+                               unsigned long long *seq,
+                               size_t *len)
+{
+    size_t i;
+
+    *seq = 0;
+    *len = 0;
+    for (i = 0; i < 8; i++)
+        *seq = (*seq << 8) | header[i];
+    for (i = 0; i < 4; i++)
+        *len = (*len << 8) | header[8 + i];
+}
+
+
+/* On the destination of a striped tunnelled migration, each stream
+ * writes into its own pipe and a dedicated thread merges the chunks
+ * read from those pipes back into QEMU's incoming migration pipe. The
+ * first stream is attached by the Prepare step itself, the others are
+ * attached once the source opened them. */
+struct _qemuMigrationTunnelMerge {
+    virObjectLockable parent;
+
+    virThread thread;
+    size_t ninputs;
+    int *inputs;        /* read ends of per-stream pipes, owned by thread */
+    int *pending;       /* write ends not handed to a stream yet */
+    int output;         /* QEMU's incoming migration pipe */
+
+    /* handed to the source in the Prepare cookie, which has to present
+     * it again to attach the other streams */
+    char token[VIR_UUID_STRING_BUFLEN];
+};
+
+typedef struct _qemuMigrationTunnelInput qemuMigrationTunnelInput;
+typedef qemuMigrationTunnelInput *qemuMigrationTunnelInputPtr;
+struct _qemuMigrationTunnelInput {
+    char *buf;
+    size_t len;
+    unsigned long long seq;
+    bool ready;         /* a complete chunk is waiting in @buf */
+    bool eof;
+    unsigned long long bytes;
+};
+
+static virClassPtr qemuMigrationTunnelMergeClass;
+static void qemuMigrationTunnelMergeDispose(void *obj);
+
+static int
+qemuMigrationTunnelMergeOnceInit(void)
+{
+    if (!(qemuMigrationTunnelMergeClass =
+          virClassNew(virClassForObjectLockable(),
+                      "qemuMigrationTunnelMerge",
+                      sizeof(qemuMigrationTunnelMerge),
+                      qemuMigrationTunnelMergeDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(qemuMigrationTunnelMerge)
+
+
+static void
+qemuMigrationTunnelMergeDispose(void *obj)
+{
+    qemuMigrationTunnelMergePtr merge = obj;
+    size_t i;
+
+    for (i = 0; i < merge->ninputs; i++) {
+        VIR_FORCE_CLOSE(merge->inputs[i]);
+        VIR_FORCE_CLOSE(merge->pending[i]);
+    }
+    VIR_FREE(merge->inputs);
+    VIR_FREE(merge->pending);
+    VIR_FORCE_CLOSE(merge->output);
+}
+
+
+qemuMigrationTunnelMergePtr
+qemuMigrationTunnelMergeNew(size_t ninputs)
+{
+    qemuMigrationTunnelMergePtr merge;
+    unsigned char token[VIR_UUID_BUFLEN];
+    size_t i;
+
+    if (qemuMigrationTunnelMergeInitialize() < 0)
+        return NULL;
+
+    if (!(merge = virObjectLockableNew(qemuMigrationTunnelMergeClass)))
+        return NULL;
+
+    merge->output = -1;
+    if (VIR_ALLOC_N(merge->inputs, ninputs) < 0 ||
+        VIR_ALLOC_N(merge->pending, ninputs) < 0)
+        goto error;
+    merge->ninputs = ninputs;
+
+    for (i = 0; i < ninputs; i++)
+        merge->inputs[i] = merge->pending[i] = -1;
+
+    if (virUUIDGenerate(token) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot generate migration tunnel token"));
+        goto error;
+    }
+    virUUIDFormat(token, merge->token);
+
+    for (i = 0; i < ninputs; i++) {
+        int fds[2];
+
+        if (pipe2(fds, O_CLOEXEC) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("cannot create pipe for tunnelled migration"));
+            goto error;
+        }
+        merge->inputs[i] = fds[0];
+        merge->pending[i] = fds[1];
+    }
+
+    return merge;
+
+ error:
+    virObjectUnref(merge);
+    return NULL;
+}
+
+
+const char *
+qemuMigrationTunnelMergeGetToken(qemuMigrationTunnelMergePtr merge)
+{
+    return merge->token;
+}
+
+
+static int
+qemuMigrationTunnelMergeReadChunk(int fd,
+                                  qemuMigrationTunnelInputPtr input)
+{
+    unsigned char header[TUNNEL_CHUNK_HEADER_SIZE];
+    ssize_t got;
+
+    if ((got = saferead(fd, header, sizeof(header))) == 0) {
+        input->eof = true;
+        return 0;
+    }
+
+    if (got != sizeof(header)) {
+        if (got < 0)
+            virReportSystemError(errno, "%s",
+                                 _("failed to read from migration tunnel"));
+        else
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("truncated chunk header in migration tunnel"));
+        return -1;
+    }
+
+    qemuMigrationTunnelChunkDecode(header, &input->seq, &input->len);
+    if (input->len == 0 || input->len > TUNNEL_CHUNK_DATA_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("invalid chunk length %zu in migration tunnel"),
+                       input->len);
+        return -1;
+    }
+
+    got = saferead(fd, input->buf, input->len);
+    if (got != (ssize_t) input->len) {
+        if (got < 0)
+            virReportSystemError(errno, "%s",
+                                 _("failed to read from migration tunnel"));
+        else
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("truncated chunk in migration tunnel"));
+        return -1;
+    }
+
+    input->ready = true;
+    input->bytes += input->len;
+    return 0;
+}
+
+
+static void
+qemuMigrationTunnelMergeFunc(void *opaque)
+{
+    qemuMigrationTunnelMergePtr merge = opaque;
+    qemuMigrationTunnelInputPtr inputs = NULL;
+    struct pollfd *fds = NULL;
+    size_t *map = NULL;
+    unsigned long long next = 0;
+    unsigned long long start = 0;
+    unsigned long long now = 0;
+    size_t i;
+
+    VIR_DEBUG("Merging %zu migration tunnels into fd %d",
+              merge->ninputs, merge->output);
+
+    if (VIR_ALLOC_N(inputs, merge->ninputs) < 0 ||
+        VIR_ALLOC_N(fds, merge->ninputs) < 0 ||
+        VIR_ALLOC_N(map, merge->ninputs) < 0)
+        goto cleanup;
+
+    for (i = 0; i < merge->ninputs; i++) {
+        if (VIR_ALLOC_N(inputs[i].buf, TUNNEL_CHUNK_DATA_MAX) < 0)
+            goto cleanup;
+    }
+
+    ignore_value(virTimeMillisNow(&start));
+
+    for (;;) {
+        size_t nfds = 0;
+        bool progress;
+        int rc;
+
+        /* Pass on every chunk that is next in sequence */
+        do {
+            progress = false;
+            for (i = 0; i < merge->ninputs; i++) {
+                if (!inputs[i].ready || inputs[i].seq != next)
+                    continue;
+
+                if (safewrite(merge->output, inputs[i].buf,
+                              inputs[i].len) < 0) {
+                    virReportSystemError(errno, "%s",
+                                         _("failed to write to qemu"));
+                    goto cleanup;
+                }
+                inputs[i].ready = false;
+                next++;
+                progress = true;
+            }
+        } while (progress);
+
+        /* Only read from streams whose last chunk has been passed on;
+         * the chunk we are waiting for is at the head of one of them */
+        for (i = 0; i < merge->ninputs; i++) {
+            if (inputs[i].eof || inputs[i].ready)
+                continue;
+            fds[nfds].fd = merge->inputs[i];
+            fds[nfds].events = POLLIN;
+            fds[nfds].revents = 0;
+            map[nfds++] = i;
+        }
+
+        if (nfds == 0) {
+            for (i = 0; i < merge->ninputs; i++) {
+                if (inputs[i].ready) {
+                    virReportError(VIR_ERR_INTERNAL_ERROR,
+                                   _("migration tunnel chunk %llu is missing"),
+                                   next);
+                    goto cleanup;
+                }
+            }
+            break;
+        }
+
+        if ((rc = poll(fds, nfds, -1)) < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            virReportSystemError(errno, "%s",
+                                 _("poll failed in migration tunnel"));
+            goto cleanup;
+        }
+
+        for (i = 0; i < nfds; i++) {
+            if (!(fds[i].revents & (POLLIN | POLLERR | POLLHUP)))
+                continue;
+            if (qemuMigrationTunnelMergeReadChunk(fds[i].fd,
+                                                  &inputs[map[i]]) < 0)
+                goto cleanup;
+        }
+    }
+
+    ignore_value(virTimeMillisNow(&now));
+    for (i = 0; i < merge->ninputs; i++) {
+        unsigned long long elapsed = now > start ? now - start : 1;
+
+        VIR_INFO("Migration tunnel stream %zu received %llu bytes "
+                 "in %llu ms (%llu KiB/s)",
+                 i, inputs[i].bytes, elapsed,
+                 inputs[i].bytes * 1000 / 1024 / elapsed);
+    }
+
+ cleanup:
+    /* Closing the pipes lets QEMU see the end of the migration
+     * stream and makes any stream still writing to us fail */
+    for (i = 0; i < merge->ninputs; i++) {
+        VIR_FORCE_CLOSE(merge->inputs[i]);
+        if (inputs)
+            VIR_FREE(inputs[i].buf);
+    }
+    VIR_FORCE_CLOSE(merge->output);
+    VIR_FREE(inputs);
+    VIR_FREE(fds);
+    VIR_FREE(map);
+    virObjectUnref(merge);
+}
+
+
+/* Starts merging chunks into @output, which is consumed on success */
+int
+qemuMigrationTunnelMergeStart(qemuMigrationTunnelMergePtr merge,
+                              int output)
+{
+    merge->output = output;
+    virObjectRef(merge);
+
+    if (virThreadCreate(&merge->thread, false,
+                        qemuMigrationTunnelMergeFunc, merge) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create migration thread"));
+        merge->output = -1;
+        virObjectUnref(merge);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int
+qemuMigrationTunnelMergeAttach(qemuMigrationTunnelMergePtr merge,
+                               virStreamPtr st,
+                               int index)
+{
+    int ret = -1;
+
+    virObjectLock(merge);
+
+    if (index < 0 || (size_t) index >= merge->ninputs ||
+        merge->pending[index] < 0) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("unexpected migration tunnel stream %d"), index);
+        goto cleanup;
+    }
+
+    if (virFDStreamOpen(st, merge->pending[index]) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot pass pipe for tunnelled migration"));
+        goto cleanup;
+    }
+    merge->pending[index] = -1; /* 'st' owns the FD now & will close it */
+
+    ret = 0;
+ cleanup:
+    virObjectUnlock(merge);
+    return ret;
+}
+
+
+/* Drops streams which were never attached, so that the merging thread
+ * sees their end, and releases the caller's reference. */
+void
+qemuMigrationTunnelMergeRelease(qemuMigrationTunnelMergePtr *merge)
+{
+    size_t i;
+
+    if (!*merge)
+        return;
+
+    virObjectLock(*merge);
+    for (i = 0; i < (*merge)->ninputs; i++)
+        VIR_FORCE_CLOSE((*merge)->pending[i]);
+    virObjectUnlock(*merge);
+
+    virObjectUnref(*merge);
+    *merge = NULL;
+}
+
+
 /* Prepare is the first step, and it runs on the destination host.
  */
 
@@ -2778,6 +3218,7 @@ qemuMigrationPrepareCleanup(virQEMUDriverPtr driver,
 
     virPortAllocatorRelease(driver->migrationPorts, priv->migrationPort);
     priv->migrationPort = 0;
+    qemuMigrationTunnelMergeRelease(&priv->tunnelMerge);
 
     if (!qemuMigrationJobIsActive(vm, QEMU_ASYNC_JOB_MIGRATION_IN))
         return;
@@ -2798,12 +3239,14 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
                         unsigned short port,
                         bool autoPort,
                         const char *listenAddress,
+                        int tunnelStreams,
                         unsigned long flags)
 {
     virDomainObjPtr vm = NULL;
     virObjectEventPtr event = NULL;
     int ret = -1;
     int dataFD[2] = { -1, -1 };
+    qemuMigrationTunnelMergePtr merge = NULL;
     qemuDomainObjPrivatePtr priv = NULL;
     unsigned long long now;
     qemuMigrationCookiePtr mig = NULL;
@@ -3012,6 +3455,10 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
         goto endjob;
     }
 
+    if (tunnel && tunnelStreams > 1 &&
+        !(merge = qemuMigrationTunnelMergeNew(tunnelStreams)))
+        goto endjob;
+
     /* Start the QEMU daemon, with the same command-line arguments plus
      * -incoming $migrateFrom
      */
@@ -3024,7 +3471,16 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
         goto endjob;
     }
 
-    if (tunnel) {
+    if (merge) {
+        if (qemuMigrationTunnelMergeStart(merge, dataFD[1]) < 0)
+            goto stop;
+        dataFD[1] = -1; /* the merging thread owns the FD now */
+        priv->tunnelMerge = merge;
+        merge = NULL;
+
+        if (qemuMigrationTunnelMergeAttach(priv->tunnelMerge, st, 0) < 0)
+            goto stop;
+    } else if (tunnel) {
         if (virFDStreamOpen(st, dataFD[1]) < 0) {
             virReportSystemError(errno, "%s",
                                  _("cannot pass pipe for tunnelled migration"));
@@ -3073,6 +3529,9 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
         cookieFlags |= QEMU_MIGRATION_COOKIE_NBD;
     }
 
+    if (priv->tunnelMerge)
+        cookieFlags |= QEMU_MIGRATION_COOKIE_TUNNEL;
+
     if (qemuMigrationBakeCookie(mig, driver, vm, cookieout,
                                 cookieoutlen, cookieFlags) < 0) {
         /* We could tear down the whole guest here, but
@@ -3107,10 +3566,12 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
     VIR_FREE(xmlout);
     VIR_FORCE_CLOSE(dataFD[0]);
     VIR_FORCE_CLOSE(dataFD[1]);
+    virObjectUnref(merge);
     if (ret < 0 && priv) {
         /* priv is set right after vm is added to the list of domains
          * and there is no 'goto cleanup;' in the middle of those */
         VIR_FREE(priv->origname);
+        qemuMigrationTunnelMergeRelease(&priv->tunnelMerge);
         virPortAllocatorRelease(driver->migrationPorts, priv->nbdPort);
         priv->nbdPort = 0;
         qemuDomainRemoveInactive(driver, vm);
@@ -3147,15 +3608,17 @@ qemuMigrationPrepareTunnel(virQEMUDriverPtr driver,
                            virStreamPtr st,
                            virDomainDefPtr *def,
                            const char *origname,
+                           int tunnelStreams,
                            unsigned long flags)
 {
     int ret;
 
     VIR_DEBUG("driver=%p, dconn=%p, cookiein=%s, cookieinlen=%d, "
               "cookieout=%p, cookieoutlen=%p, st=%p, def=%p, "
-              "origname=%s, flags=%lx",
+              "origname=%s, tunnelStreams=%d, flags=%lx",
               driver, dconn, NULLSTR(cookiein), cookieinlen,
-              cookieout, cookieoutlen, st, *def, origname, flags);
+              cookieout, cookieoutlen, st, *def, origname,
+              tunnelStreams, flags);
 
     if (st == NULL) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -3165,7 +3628,60 @@ qemuMigrationPrepareTunnel(virQEMUDriverPtr driver,
 
     ret = qemuMigrationPrepareAny(driver, dconn, cookiein, cookieinlen,
                                   cookieout, cookieoutlen, def, origname,
-                                  st, NULL, 0, false, NULL, flags);
+                                  st, NULL, 0, false, NULL, tunnelStreams,
+                                  flags);
+    return ret;
+}
+
+
+/*
+ * Attaches an additional stream of a striped tunnelled migration to the
+ * incoming domain prepared by an earlier qemuMigrationPrepareTunnel call.
+ * The source proves it owns that migration by passing back the token it
+ * got in the cookie from Prepare.
+ */
+int
+qemuMigrationPrepareTunnelStream(virQEMUDriverPtr driver,
+                                 virDomainObjPtr vm,
+                                 const char *cookiein,
+                                 int cookieinlen,
+                                 virStreamPtr st,
+                                 int index)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuMigrationCookiePtr mig = NULL;
+    int ret = -1;
+
+    VIR_DEBUG("driver=%p, vm=%s, cookiein=%s, cookieinlen=%d, st=%p, "
+              "index=%d", driver, vm->def->name, NULLSTR(cookiein),
+              cookieinlen, st, index);
+
+    if (!qemuMigrationJobIsActive(vm, QEMU_ASYNC_JOB_MIGRATION_IN))
+        goto cleanup;
+
+    if (!priv->tunnelMerge) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("incoming migration is not striped across "
+                         "several tunnels"));
+        goto cleanup;
+    }
+
+    if (!(mig = qemuMigrationEatCookie(driver, vm, cookiein, cookieinlen,
+                                       QEMU_MIGRATION_COOKIE_TUNNEL)))
+        goto cleanup;
+
+    if (STRNEQ_NULLABLE(mig->tunnelToken,
+                        qemuMigrationTunnelMergeGetToken(priv->tunnelMerge))) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("migration tunnel stream does not belong to "
+                         "the incoming migration"));
+        goto cleanup;
+    }
+
+    ret = qemuMigrationTunnelMergeAttach(priv->tunnelMerge, st, index);
+
+ cleanup:
+    qemuMigrationCookieFree(mig);
     return ret;
 }
 
@@ -3324,7 +3840,7 @@ qemuMigrationPrepareDirect(virQEMUDriverPtr driver,
     ret = qemuMigrationPrepareAny(driver, dconn, cookiein, cookieinlen,
                                   cookieout, cookieoutlen, def, origname,
                                   NULL, uri ? uri->scheme : "tcp",
-                                  port, autoPort, listenAddress, flags);
+                                  port, autoPort, listenAddress, 1, flags);
  cleanup:
     virURIFree(uri);
     VIR_FREE(hostname);
@@ -3555,54 +4071,81 @@ struct _qemuMigrationSpec {
 
     enum qemuMigrationForwardType fwdType;
     union {
-        virStreamPtr stream;
+        struct {
+            virStreamPtr *streams;
+            size_t nstreams;
+        } stream;
     } fwd;
 };
 
-#define TUNNEL_SEND_BUF_SIZE 65536
-
-typedef struct _qemuMigrationIOThread qemuMigrationIOThread;
-typedef qemuMigrationIOThread *qemuMigrationIOThreadPtr;
-struct _qemuMigrationIOThread {
+typedef struct _qemuMigrationIOWorker qemuMigrationIOWorker;
+typedef qemuMigrationIOWorker *qemuMigrationIOWorkerPtr;
+struct _qemuMigrationIOWorker {
+    qemuMigrationIOThreadPtr io;
+    size_t index;
     virThread thread;
     virStreamPtr st;
-    int sock;
     virError err;
+    unsigned long long bytes;
+    unsigned long long chunks;
+};
+
+/* Each stream is served by its own worker. Workers take turns at
+ * reading from QEMU so that chunks are numbered in the order QEMU
+ * produced them, but send them in parallel. */
+struct _qemuMigrationIOThread {
+    virMutex lock;          /* serializes reading from QEMU */
+    int sock;
     int wakeupRecvFD;
     int wakeupSendFD;
+    bool striped;
+    bool draining;          /* asked to finish, read until it would block */
+    bool eof;
+    bool failed;            /* aborted or one of the workers failed */
+    unsigned long long seq;
+    size_t nworkers;
+    qemuMigrationIOWorkerPtr workers;
 };
 
-static void qemuMigrationIOFunc(void *arg)
+/*
+ * Reads next chunk of migration data from QEMU. Must be called with
+ * io->lock held.
+ *
+ * Returns number of bytes read, 0 at the end of migration data, -1 on
+ * error, or -2 if the tunnel was aborted.
+ */
+static ssize_t
+qemuMigrationIORead(qemuMigrationIOThreadPtr io,
+                    char *buf,
+                    size_t len,
+                    unsigned long long *seq)
 {
-    qemuMigrationIOThreadPtr data = arg;
-    char *buffer = NULL;
     struct pollfd fds[2];
-    int timeout = -1;
-    virErrorPtr err = NULL;
-
-    VIR_DEBUG("Running migration tunnel; stream=%p, sock=%d",
-              data->st, data->sock);
-
-    if (VIR_ALLOC_N(buffer, TUNNEL_SEND_BUF_SIZE) < 0)
-        goto abrt;
 
-    fds[0].fd = data->sock;
-    fds[1].fd = data->wakeupRecvFD;
+    fds[0].fd = io->sock;
+    fds[1].fd = io->wakeupRecvFD;
 
     for (;;) {
+        int nfds = io->draining ? 1 : 2;
         int ret;
 
+        if (io->failed)
+            return -2;
+        if (io->eof)
+            return 0;
+
         fds[0].events = fds[1].events = POLLIN;
         fds[0].revents = fds[1].revents = 0;
 
-        ret = poll(fds, ARRAY_CARDINALITY(fds), timeout);
+        ret = poll(fds, nfds, io->draining ? 0 : -1);
 
         if (ret < 0) {
             if (errno == EAGAIN || errno == EINTR)
                 continue;
             virReportSystemError(errno, "%s",
                                  _("poll failed in migration tunnel"));
-            goto abrt;
+            io->failed = true;
+            return -1;
         }
 
         if (ret == 0) {
@@ -3611,48 +4154,117 @@ static void qemuMigrationIOFunc(void *arg)
              * close the migration fd. We handle this in the same way as EOF.
              */
             VIR_DEBUG("QEMU forgot to close migration fd");
-            break;
+            io->eof = true;
+            return 0;
         }
 
-        if (fds[1].revents & (POLLIN | POLLERR | POLLHUP)) {
+        if (nfds > 1 && fds[1].revents & (POLLIN | POLLERR | POLLHUP)) {
             char stop = 0;
 
-            if (saferead(data->wakeupRecvFD, &stop, 1) != 1) {
+            if (saferead(io->wakeupRecvFD, &stop, 1) != 1) {
                 virReportSystemError(errno, "%s",
                                      _("failed to read from wakeup fd"));
-                goto abrt;
+                io->failed = true;
+                return -1;
             }
 
             VIR_DEBUG("Migration tunnel was asked to %s",
                       stop ? "abort" : "finish");
             if (stop) {
-                goto abrt;
+                io->failed = true;
+                return -2;
             } else {
-                timeout = 0;
+                io->draining = true;
             }
         }
 
         if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
-            int nbytes;
+            ssize_t nbytes;
 
-            nbytes = saferead(data->sock, buffer, TUNNEL_SEND_BUF_SIZE);
+            nbytes = saferead(io->sock, buf, len);
             if (nbytes > 0) {
-                if (virStreamSend(data->st, buffer, nbytes) < 0)
-                    goto error;
+                *seq = io->seq++;
             } else if (nbytes < 0) {
                 virReportSystemError(errno, "%s",
                         _("tunnelled migration failed to read from qemu"));
-                goto abrt;
+                io->failed = true;
+                return -1;
             } else {
                 /* EOF; get out of here */
-                break;
+                io->eof = true;
             }
+            return nbytes;
+        }
+    }
+}
+
+static void qemuMigrationIOFunc(void *arg)
+{
+    qemuMigrationIOWorkerPtr worker = arg;
+    qemuMigrationIOThreadPtr io = worker->io;
+    size_t offset = io->striped ? TUNNEL_CHUNK_HEADER_SIZE : 0;
+    char *buffer = NULL;
+    virErrorPtr err = NULL;
+    unsigned long long start = 0;
+    unsigned long long now = 0;
+
+    VIR_DEBUG("Running migration tunnel; stream=%p, sock=%d, index=%zu",
+              worker->st, io->sock, worker->index);
+
+    if (VIR_ALLOC_N(buffer, TUNNEL_SEND_BUF_SIZE) < 0)
+        goto abrt;
+
+    ignore_value(virTimeMillisNow(&start));
+
+    for (;;) {
+        unsigned long long seq = 0;
+        ssize_t nbytes;
+        size_t len;
+        size_t done = 0;
+
+        virMutexLock(&io->lock);
+        nbytes = qemuMigrationIORead(io, buffer + offset,
+                                     TUNNEL_SEND_BUF_SIZE - offset, &seq);
+        virMutexUnlock(&io->lock);
+
+        if (nbytes == 0)
+            break;
+        if (nbytes < 0)
+            goto abrt;
+
+        len = nbytes;
+        if (io->striped) {
+            qemuMigrationTunnelChunkEncode((unsigned char *) buffer,
+                                           seq, nbytes);
+            len += TUNNEL_CHUNK_HEADER_SIZE;
         }
+
+        /* Peers without large stream packet support
+         * take the buffer in several pieces */
+        while (done < len) {
+            int rc = virStreamSend(worker->st, buffer + done, len - done);
+            if (rc < 0)
+                goto error;
+            done += rc;
+        }
+
+        worker->bytes += nbytes;
+        worker->chunks++;
     }
 
-    if (virStreamFinish(data->st) < 0)
+    if (virStreamFinish(worker->st) < 0)
         goto error;
 
+    ignore_value(virTimeMillisNow(&now));
+    if (io->striped) {
+        unsigned long long elapsed = now > start ? now - start : 1;
+
+        VIR_INFO("Migration tunnel stream %zu sent %llu bytes in %llu chunks "
+                 "in %llu ms (%llu KiB/s)",
+                 worker->index, worker->bytes, worker->chunks, elapsed,
+                 worker->bytes * 1000 / 1024 / elapsed);
+    }
+
     VIR_FREE(buffer);
 
     return;
@@ -3663,25 +4275,32 @@ static void qemuMigrationIOFunc(void *arg)
         virFreeError(err);
         err = NULL;
     }
-    virStreamAbort(data->st);
+    virStreamAbort(worker->st);
     if (err) {
         virSetError(err);
         virFreeError(err);
     }
 
  error:
-    virCopyLastError(&data->err);
+    /* Make the other workers give up as well */
+    virMutexLock(&io->lock);
+    io->failed = true;
+    virMutexUnlock(&io->lock);
+
+    virCopyLastError(&worker->err);
     virResetLastError();
     VIR_FREE(buffer);
 }
 
 
-static qemuMigrationIOThreadPtr
-qemuMigrationStartTunnel(virStreamPtr st,
+qemuMigrationIOThreadPtr
+qemuMigrationStartTunnel(virStreamPtr *streams,
+                         size_t nstreams,
                          int sock)
 {
     qemuMigrationIOThreadPtr io = NULL;
     int wakeupFD[2] = { -1, -1 };
+    size_t i;
 
     if (pipe2(wakeupFD, O_CLOEXEC) < 0) {
         virReportSystemError(errno, "%s",
@@ -3692,17 +4311,33 @@ qemuMigrationStartTunnel(virStreamPtr st,
     if (VIR_ALLOC(io) < 0)
         goto error;
 
-    io->st = st;
+    if (VIR_ALLOC_N(io->workers, nstreams) < 0 ||
+        virMutexInit(&io->lock) < 0) {
+        VIR_FREE(io->workers);
+        goto error;
+    }
+
     io->sock = sock;
     io->wakeupRecvFD = wakeupFD[0];
     io->wakeupSendFD = wakeupFD[1];
+    io->striped = nstreams > 1;
 
-    if (virThreadCreate(&io->thread, true,
-                        qemuMigrationIOFunc,
-                        io) < 0) {
-        virReportSystemError(errno, "%s",
-                             _("Unable to create migration thread"));
-        goto error;
+    for (i = 0; i < nstreams; i++) {
+        qemuMigrationIOWorkerPtr worker = &io->workers[i];
+
+        worker->io = io;
+        worker->index = i;
+        worker->st = streams[i];
+
+        if (virThreadCreate(&worker->thread, true,
+                            qemuMigrationIOFunc,
+                            worker) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create migration thread"));
+            ignore_value(qemuMigrationStopTunnel(io, true));
+            return NULL;
+        }
+        io->nworkers++;
     }
 
     return io;
@@ -3714,36 +4349,43 @@ qemuMigrationStartTunnel(virStreamPtr st,
     return NULL;
 }
 
-static int
+int
 qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
 {
     int rv = -1;
     char stop = error ? 1 : 0;
+    size_t i;
 
-    /* make sure the thread finishes its job and is joinable */
+    /* make sure the workers finish their job and are joinable */
     if (safewrite(io->wakeupSendFD, &stop, 1) != 1) {
         virReportSystemError(errno, "%s",
                              _("failed to wakeup migration tunnel"));
         goto cleanup;
     }
 
-    virThreadJoin(&io->thread);
-
-    /* Forward error from the IO thread, to this thread */
-    if (io->err.code != VIR_ERR_OK) {
-        if (error)
-            rv = 0;
-        else
-            virSetError(&io->err);
-        virResetError(&io->err);
-        goto cleanup;
-    }
+    for (i = 0; i < io->nworkers; i++)
+        virThreadJoin(&io->workers[i].thread);
 
     rv = 0;
 
+    /* Forward the first error from the IO threads, to this thread */
+    for (i = 0; i < io->nworkers; i++) {
+        virErrorPtr err = &io->workers[i].err;
+
+        if (err->code != VIR_ERR_OK) {
+            if (!error && rv == 0) {
+                virSetError(err);
+                rv = -1;
+            }
+            virResetError(err);
+        }
+    }
+
  cleanup:
+    virMutexDestroy(&io->lock);
     VIR_FORCE_CLOSE(io->wakeupSendFD);
     VIR_FORCE_CLOSE(io->wakeupRecvFD);
+    VIR_FREE(io->workers);
     VIR_FREE(io);
     return rv;
 }
@@ -3971,7 +4613,9 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     }
 
     if (spec->fwdType != MIGRATION_FWD_DIRECT &&
-        !(iothread = qemuMigrationStartTunnel(spec->fwd.stream, fd)))
+        !(iothread = qemuMigrationStartTunnel(spec->fwd.stream.streams,
+                                              spec->fwd.stream.nstreams,
+                                              fd)))
         goto cancel;
 
     rc = qemuMigrationWaitForCompletion(driver, vm,
@@ -4135,7 +4779,8 @@ static int doNativeMigrate(virQEMUDriverPtr driver,
 
 static int doTunnelMigrate(virQEMUDriverPtr driver,
                            virDomainObjPtr vm,
-                           virStreamPtr st,
+                           virStreamPtr *streams,
+                           size_t nstreams,
                            const char *cookiein,
                            int cookieinlen,
                            char **cookieout,
@@ -4151,10 +4796,10 @@ static int doTunnelMigrate(virQEMUDriverPtr driver,
     qemuMigrationSpec spec;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
-    VIR_DEBUG("driver=%p, vm=%p, st=%p, cookiein=%s, cookieinlen=%d, "
-              "cookieout=%p, cookieoutlen=%p, flags=%lx, resource=%lu, "
-              "graphicsuri=%s",
-              driver, vm, st, NULLSTR(cookiein), cookieinlen,
+    VIR_DEBUG("driver=%p, vm=%p, streams=%p, nstreams=%zu, cookiein=%s, "
+              "cookieinlen=%d, cookieout=%p, cookieoutlen=%p, flags=%lx, "
+              "resource=%lu, graphicsuri=%s",
+              driver, vm, streams, nstreams, NULLSTR(cookiein), cookieinlen,
               cookieout, cookieoutlen, flags, resource,
               NULLSTR(graphicsuri));
 
@@ -4168,7 +4813,8 @@ static int doTunnelMigrate(virQEMUDriverPtr driver,
     }
 
     spec.fwdType = MIGRATION_FWD_STREAM;
-    spec.fwd.stream = st;
+    spec.fwd.stream.streams = streams;
+    spec.fwd.stream.nstreams = nstreams;
 
     if (virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_MIGRATE_QEMU_FD)) {
         int fds[2];
@@ -4317,7 +4963,7 @@ static int doPeer2PeerMigrate2(virQEMUDriverPtr driver,
     VIR_DEBUG("Perform %p", sconn);
     qemuMigrationJobSetPhase(driver, vm, QEMU_MIGRATION_PHASE_PERFORM2);
     if (flags & VIR_MIGRATE_TUNNELLED)
-        ret = doTunnelMigrate(driver, vm, st,
+        ret = doTunnelMigrate(driver, vm, &st, 1,
                               NULL, 0, NULL, NULL,
                               flags, resource, dconn, NULL);
     else
@@ -4371,6 +5017,133 @@ static int doPeer2PeerMigrate2(virQEMUDriverPtr driver,
 }
 
 
+static int virConnectCredType[] = {
+    VIR_CRED_AUTHNAME,
+    VIR_CRED_PASSPHRASE,
+};
+
+
+static virConnectAuth virConnectAuthConfig = {
+    .credtype = virConnectCredType,
+    .ncredtype = ARRAY_CARDINALITY(virConnectCredType),
+};
+
+
+/* Opens the additional streams of a striped tunnelled migration, each
+ * over its own connection to the destination, once the first stream was
+ * set up by PrepareTunnel3. The destination only accepts them along with
+ * the token from the cookie its Prepare step returned in @cookiein. */
+static int
+qemuMigrationOpenTunnelStreams(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm,
+                               const char *dconnuri,
+                               const char *dname,
+                               const char *cookiein,
+                               int cookieinlen,
+                               unsigned long destflags,
+                               virConnectPtr *conns,
+                               virStreamPtr *streams,
+                               size_t nstreams)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuMigrationCookiePtr mig = NULL;
+    virTypedParameterPtr sparams = NULL;
+    int nsparams = 0;
+    int maxsparams = 0;
+    char *cookie = NULL;
+    int cookielen = 0;
+    char *cookieout = NULL;
+    int cookieoutlen = 0;
+    size_t i;
+    int ret = -1;
+
+    if (!(mig = qemuMigrationEatCookie(driver, vm, cookiein, cookieinlen,
+                                       QEMU_MIGRATION_COOKIE_TUNNEL)))
+        goto cleanup;
+
+    if (!mig->tunnelToken) {
+        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                       _("destination did not accept striped tunnelled "
+                         "migration"));
+        goto cleanup;
+    }
+
+    if (qemuMigrationBakeCookie(mig, driver, vm, &cookie, &cookielen,
+                                QEMU_MIGRATION_COOKIE_TUNNEL) < 0)
+        goto cleanup;
+
+    /* The other streams join the domain prepared by the first one, they
+     * don't need its definition again */
+    if (virTypedParamsAddString(&sparams, &nsparams, &maxsparams,
+                                VIR_MIGRATE_PARAM_DEST_NAME,
+                                dname ? dname : vm->def->name) < 0 ||
+        virTypedParamsAddInt(&sparams, &nsparams, &maxsparams,
+                             QEMU_MIGRATION_PARAM_TUNNEL_INDEX, 0) < 0)
+        goto cleanup;
+
+    for (i = 1; i < nstreams; i++) {
+        int rc;
+
+        qemuDomainObjEnterRemote(vm);
+        conns[i] = virConnectOpenAuth(dconnuri, &virConnectAuthConfig, 0);
+        qemuDomainObjExitRemote(vm);
+        if (!conns[i]) {
+            virReportError(VIR_ERR_OPERATION_FAILED,
+                           _("Failed to connect to remote libvirt URI %s: %s"),
+                           dconnuri, virGetLastErrorMessage());
+            goto cleanup;
+        }
+
+        if (virConnectSetKeepAlive(conns[i], cfg->keepAliveInterval,
+                                   cfg->keepAliveCount) < 0 ||
+            !(streams[i] = virStreamNew(conns[i], 0)))
+            goto cleanup;
+
+        /* QEMU_MIGRATION_PARAM_TUNNEL_INDEX was added last */
+        sparams[nsparams - 1].value.i = i;
+
+        VIR_DEBUG("PrepareTunnel3 stream %zu %p", i, conns[i]);
+        qemuDomainObjEnterRemote(vm);
+        rc = conns[i]->driver->domainMigratePrepareTunnel3Params
+            (conns[i], streams[i], sparams, nsparams, cookie, cookielen,
+             &cookieout, &cookieoutlen, destflags);
+        qemuDomainObjExitRemote(vm);
+        VIR_FREE(cookieout);
+        if (rc < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(sparams, nsparams);
+    VIR_FREE(cookie);
+    qemuMigrationCookieFree(mig);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+static void
+qemuMigrationCloseTunnelStreams(virDomainObjPtr vm,
+                                virConnectPtr *conns,
+                                virStreamPtr *streams,
+                                size_t nstreams)
+{
+    size_t i;
+
+    /* The first stream and connection belong to the caller */
+    for (i = 1; i < nstreams; i++) {
+        virObjectUnref(streams[i]);
+        if (conns[i]) {
+            qemuDomainObjEnterRemote(vm);
+            virObjectUnref(conns[i]);
+            qemuDomainObjExitRemote(vm);
+        }
+    }
+}
+
+
 /* This is essentially a re-impl of virDomainMigrateVersion3
  * from libvirt.c, but running in source libvirtd context,
  * instead of client app context & also adding in tunnel
@@ -4386,6 +5159,7 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
                     const char *uri,
                     const char *graphicsuri,
                     const char *listenAddress,
+                    int tunnelStreams,
                     unsigned long long bandwidth,
                     bool useParams,
                     unsigned long flags)
@@ -4401,6 +5175,9 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
     virErrorPtr orig_err = NULL;
     bool cancelled = true;
     virStreamPtr st = NULL;
+    virStreamPtr *streams = NULL;
+    virConnectPtr *tconns = NULL;
+    size_t nstreams = 1;
     unsigned long destflags;
     virTypedParameterPtr params = NULL;
     int nparams = 0;
@@ -4408,10 +5185,14 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
 
     VIR_DEBUG("driver=%p, sconn=%p, dconn=%p, dconnuri=%s, vm=%p, xmlin=%s, "
               "dname=%s, uri=%s, graphicsuri=%s, listenAddress=%s, "
-              "bandwidth=%llu, useParams=%d, flags=%lx",
+              "tunnelStreams=%d, bandwidth=%llu, useParams=%d, flags=%lx",
               driver, sconn, dconn, NULLSTR(dconnuri), vm, NULLSTR(xmlin),
               NULLSTR(dname), NULLSTR(uri), NULLSTR(graphicsuri),
-              NULLSTR(listenAddress), bandwidth, useParams, flags);
+              NULLSTR(listenAddress), tunnelStreams, bandwidth, useParams,
+              flags);
+
+    if ((flags & VIR_MIGRATE_TUNNELLED) && tunnelStreams > 1)
+        nstreams = tunnelStreams;
 
     /* Unlike the virDomainMigrateVersion3 counterpart, we don't need
      * to worry about auto-setting the VIR_MIGRATE_CHANGE_PROTECTION
@@ -4454,6 +5235,11 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
                                     VIR_MIGRATE_PARAM_LISTEN_ADDRESS,
                                     listenAddress) < 0)
             goto cleanup;
+        if (nstreams > 1 &&
+            virTypedParamsAddInt(&params, &nparams, &maxparams,
+                                 VIR_MIGRATE_PARAM_TUNNEL_STREAMS,
+                                 nstreams) < 0)
+            goto cleanup;
     }
 
     if (virDomainObjGetState(vm, NULL) == VIR_DOMAIN_PAUSED)
@@ -4468,8 +5254,12 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
     cookieout = NULL;
     cookieoutlen = 0;
     if (flags & VIR_MIGRATE_TUNNELLED) {
-        if (!(st = virStreamNew(dconn, 0)))
+        if (VIR_ALLOC_N(streams, nstreams) < 0 ||
+            VIR_ALLOC_N(tconns, nstreams) < 0 ||
+            !(st = virStreamNew(dconn, 0)))
             goto cleanup;
+        streams[0] = st;
+        tconns[0] = dconn;
 
         qemuDomainObjEnterRemote(vm);
         if (useParams) {
@@ -4522,6 +5312,14 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
         goto finish;
     }
 
+    if (nstreams > 1 &&
+        qemuMigrationOpenTunnelStreams(driver, vm, dconnuri, dname,
+                                       cookieout, cookieoutlen, destflags,
+                                       tconns, streams, nstreams) < 0) {
+        orig_err = virSaveLastError();
+        goto finish;
+    }
+
     /* Perform the migration.  The driver isn't supposed to return
      * until the migration is complete. The src VM should remain
      * running, but in paused state until the destination can
@@ -4535,7 +5333,7 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
     cookieout = NULL;
     cookieoutlen = 0;
     if (flags & VIR_MIGRATE_TUNNELLED) {
-        ret = doTunnelMigrate(driver, vm, st,
+        ret = doTunnelMigrate(driver, vm, streams, nstreams,
                               cookiein, cookieinlen,
                               &cookieout, &cookieoutlen,
                               flags, bandwidth, dconn, graphicsuri);
@@ -4643,6 +5441,10 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
         ret = -1;
     }
 
+    if (streams && tconns)
+        qemuMigrationCloseTunnelStreams(vm, tconns, streams, nstreams);
+    VIR_FREE(streams);
+    VIR_FREE(tconns);
     virObjectUnref(st);
 
     if (orig_err) {
@@ -4657,18 +5459,6 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
 }
 
 
-static int virConnectCredType[] = {
-    VIR_CRED_AUTHNAME,
-    VIR_CRED_PASSPHRASE,
-};
-
-
-static virConnectAuth virConnectAuthConfig = {
-    .credtype = virConnectCredType,
-    .ncredtype = ARRAY_CARDINALITY(virConnectCredType),
-};
-
-
 static int doPeer2PeerMigrate(virQEMUDriverPtr driver,
                               virConnectPtr sconn,
                               virDomainObjPtr vm,
@@ -4677,6 +5467,7 @@ static int doPeer2PeerMigrate(virQEMUDriverPtr driver,
                               const char *uri,
                               const char *graphicsuri,
                               const char *listenAddress,
+                              int tunnelStreams,
                               unsigned long flags,
                               const char *dname,
                               unsigned long resource,
@@ -4740,7 +5531,7 @@ static int doPeer2PeerMigrate(virQEMUDriverPtr driver,
 
     /* Only xmlin, dname, uri, and bandwidth parameters can be used with
      * old-style APIs. */
-    if (!useParams && graphicsuri) {
+    if (!useParams && (graphicsuri || tunnelStreams > 1)) {
         virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
                        _("Migration APIs with extensible parameters are not "
                          "supported but extended parameters were passed"));
@@ -4771,7 +5562,7 @@ static int doPeer2PeerMigrate(virQEMUDriverPtr driver,
     if (*v3proto) {
         ret = doPeer2PeerMigrate3(driver, sconn, dconn, dconnuri, vm, xmlin,
                                   dname, uri, graphicsuri, listenAddress,
-                                  resource, useParams, flags);
+                                  tunnelStreams, resource, useParams, flags);
     } else {
         ret = doPeer2PeerMigrate2(driver, sconn, dconn, vm,
                                   dconnuri, flags, dname, resource);
@@ -4805,6 +5596,7 @@ qemuMigrationPerformJob(virQEMUDriverPtr driver,
                         const char *uri,
                         const char *graphicsuri,
                         const char *listenAddress,
+                        int tunnelStreams,
                         const char *cookiein,
                         int cookieinlen,
                         char **cookieout,
@@ -4840,7 +5632,8 @@ qemuMigrationPerformJob(virQEMUDriverPtr driver,
     if ((flags & (VIR_MIGRATE_TUNNELLED | VIR_MIGRATE_PEER2PEER))) {
         ret = doPeer2PeerMigrate(driver, conn, vm, xmlin,
                                  dconnuri, uri, graphicsuri, listenAddress,
-                                 flags, dname, resource, &v3proto);
+                                 tunnelStreams, flags, dname, resource,
+                                 &v3proto);
     } else {
         qemuMigrationJobSetPhase(driver, vm, QEMU_MIGRATION_PHASE_PERFORM2);
         ret = doNativeMigrate(driver, vm, uri, cookiein, cookieinlen,
@@ -4969,6 +5762,7 @@ qemuMigrationPerform(virQEMUDriverPtr driver,
                      const char *uri,
                      const char *graphicsuri,
                      const char *listenAddress,
+                     int tunnelStreams,
                      const char *cookiein,
                      int cookieinlen,
                      char **cookieout,
@@ -4979,11 +5773,12 @@ qemuMigrationPerform(virQEMUDriverPtr driver,
                      bool v3proto)
 {
     VIR_DEBUG("driver=%p, conn=%p, vm=%p, xmlin=%s, dconnuri=%s, "
-              "uri=%s, graphicsuri=%s, listenAddress=%s"
+              "uri=%s, graphicsuri=%s, listenAddress=%s, tunnelStreams=%d, "
               "cookiein=%s, cookieinlen=%d, cookieout=%p, cookieoutlen=%p, "
               "flags=%lx, dname=%s, resource=%lu, v3proto=%d",
               driver, conn, vm, NULLSTR(xmlin), NULLSTR(dconnuri),
               NULLSTR(uri), NULLSTR(graphicsuri), NULLSTR(listenAddress),
+              tunnelStreams,
               NULLSTR(cookiein), cookieinlen, cookieout, cookieoutlen,
               flags, NULLSTR(dname), resource, v3proto);
 
@@ -4996,7 +5791,7 @@ qemuMigrationPerform(virQEMUDriverPtr driver,
 
         return qemuMigrationPerformJob(driver, conn, vm, xmlin, dconnuri, uri,
                                        graphicsuri, listenAddress,
-                                       cookiein, cookieinlen,
+                                       tunnelStreams, cookiein, cookieinlen,
                                        cookieout, cookieoutlen,
                                        flags, dname, resource, v3proto);
     } else {
@@ -5015,7 +5810,7 @@ qemuMigrationPerform(virQEMUDriverPtr driver,
         } else {
             return qemuMigrationPerformJob(driver, conn, vm, xmlin, dconnuri,
                                            uri, graphicsuri, listenAddress,
-                                           cookiein, cookieinlen,
+                                           tunnelStreams, cookiein, cookieinlen,
                                            cookieout, cookieoutlen, flags,
                                            dname, resource, v3proto);
         }
@@ -5116,6 +5911,7 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
                                        : QEMU_MIGRATION_PHASE_FINISH2);
 
     qemuDomainCleanupRemove(vm, qemuMigrationPrepareCleanup);
+    qemuMigrationTunnelMergeRelease(&priv->tunnelMerge);
     VIR_FREE(priv->job.completed);
 
     cookie_flags = QEMU_MIGRATION_COOKIE_NETWORK |
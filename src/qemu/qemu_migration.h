@@ -43,6 +43,14 @@
      VIR_MIGRATE_AUTO_CONVERGE |                \
      VIR_MIGRATE_RDMA_PIN_ALL)
 
+/* Private parameter the source daemon uses to hand the destination the
+ * additional streams of a striped tunnelled migration. It is not part of
+ * QEMU_MIGRATION_PARAMETERS, only PrepareTunnel3 accepts it and only
+ * along with the token from the migration cookie. */
+# define QEMU_MIGRATION_PARAM_TUNNEL_INDEX "tunnel_stream_index"
+
+# define QEMU_MIGRATION_TUNNEL_STREAMS_MAX 16
+
 /* All supported migration parameters and their types. */
 # define QEMU_MIGRATION_PARAMETERS                              \
     VIR_MIGRATE_PARAM_URI,              VIR_TYPED_PARAM_STRING, \
@@ -51,6 +59,7 @@
     VIR_MIGRATE_PARAM_BANDWIDTH,        VIR_TYPED_PARAM_ULLONG, \
     VIR_MIGRATE_PARAM_GRAPHICS_URI,     VIR_TYPED_PARAM_STRING, \
     VIR_MIGRATE_PARAM_LISTEN_ADDRESS,   VIR_TYPED_PARAM_STRING, \
+    VIR_MIGRATE_PARAM_TUNNEL_STREAMS,   VIR_TYPED_PARAM_INT,    \
     NULL
 
 
@@ -115,8 +124,16 @@ int qemuMigrationPrepareTunnel(virQEMUDriverPtr driver,
                                virStreamPtr st,
                                virDomainDefPtr *def,
                                const char *origname,
+                               int tunnelStreams,
                                unsigned long flags);
 
+int qemuMigrationPrepareTunnelStream(virQEMUDriverPtr driver,
+                                     virDomainObjPtr vm,
+                                     const char *cookiein,
+                                     int cookieinlen,
+                                     virStreamPtr st,
+                                     int index);
+
 int qemuMigrationPrepareDirect(virQEMUDriverPtr driver,
                                virConnectPtr dconn,
                                const char *cookiein,
@@ -138,6 +155,7 @@ int qemuMigrationPerform(virQEMUDriverPtr driver,
                          const char *uri,
                          const char *graphicsuri,
                          const char *listenAddress,
+                         int tunnelStreams,
                          const char *cookiein,
                          int cookieinlen,
                          char **cookieout,
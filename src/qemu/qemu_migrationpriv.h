@@ -0,0 +1,52 @@
+/*
+ * qemu_migrationpriv.h: private declarations for QEMU migration handling
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __QEMU_MIGRATIONPRIV_H__
+# define __QEMU_MIGRATIONPRIV_H__
+
+# include "qemu_domain.h"
+
+/*
+ * This header file should never be used outside unit tests.
+ */
+
+qemuMigrationTunnelMergePtr qemuMigrationTunnelMergeNew(size_t ninputs);
+
+const char *
+qemuMigrationTunnelMergeGetToken(qemuMigrationTunnelMergePtr merge);
+
+int qemuMigrationTunnelMergeStart(qemuMigrationTunnelMergePtr merge,
+                                  int output);
+
+int qemuMigrationTunnelMergeAttach(qemuMigrationTunnelMergePtr merge,
+                                   virStreamPtr st,
+                                   int index);
+
+void qemuMigrationTunnelMergeRelease(qemuMigrationTunnelMergePtr *merge);
+
+typedef struct _qemuMigrationIOThread qemuMigrationIOThread;
+typedef qemuMigrationIOThread *qemuMigrationIOThreadPtr;
+
+qemuMigrationIOThreadPtr qemuMigrationStartTunnel(virStreamPtr *streams,
+                                                  size_t nstreams,
+                                                  int sock);
+
+int qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error);
+
+#endif /* __QEMU_MIGRATIONPRIV_H__ */
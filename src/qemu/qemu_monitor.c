@@ -28,6 +28,7 @@
 #include <sys/un.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include "qemu_monitor.h"
 #include "qemu_monitor_text.h"
@@ -42,6 +43,8 @@
 #include "virobject.h"
 #include "virprobe.h"
 #include "virstring.h"
+#include "virtime.h"
+#include "vireventthread.h"
 
 #ifdef WITH_DTRACE_PROBES
 # include "libvirt_qemu_probes.h"
@@ -63,6 +66,9 @@ struct _qemuMonitor {
     int watch;
     int hasSendFD;
 
+    /* Event loop serving @fd, NULL for the default one */
+    virEventThreadPtr iothread;
+
     virDomainObjPtr vm;
 
     qemuMonitorCallbacksPtr cb;
@@ -96,6 +102,8 @@ struct _qemuMonitor {
 
     /* Log file fd of the qemu process to dig for usable info */
     int logfd;
+
+    qemuMonitorStats stats;
 };
 
 static virClassPtr qemuMonitorClass;
@@ -266,6 +274,7 @@ static void qemuMonitorDispose(void *obj)
     virJSONValueFree(mon->options);
     VIR_FREE(mon->balloonpath);
     VIR_FORCE_CLOSE(mon->logfd);
+    virObjectUnref(mon->iothread);
 }
 
 
@@ -275,8 +284,8 @@ qemuMonitorOpenUnix(const char *monitor, pid_t cpid)
     struct sockaddr_un addr;
     int monfd;
     int timeout = 30; /* In seconds */
-    int ret;
-    size_t i = 0;
+    int ret = -1;
+    virTimeBackOffVar timebackoff;
 
     if ((monfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
         virReportSystemError(errno,
@@ -292,7 +301,12 @@ qemuMonitorOpenUnix(const char *monitor, pid_t cpid)
         goto error;
     }
 
-    do {
+    /* If we created the listening socket ourselves, this succeeds
+     * right away. Otherwise, QEMU creates it shortly after startup,
+     * so retry often at first and back off later. */
+    if (virTimeBackOffStart(&timebackoff, 1, timeout * 1000) < 0)
+        goto error;
+    while (virTimeBackOffWait(&timebackoff)) {
         ret = connect(monfd, (struct sockaddr *) &addr, sizeof(addr));
 
         if (ret == 0)
@@ -308,8 +322,7 @@ qemuMonitorOpenUnix(const char *monitor, pid_t cpid)
         virReportSystemError(errno, "%s",
                              _("failed to connect to monitor socket"));
         goto error;
-
-    } while ((++i <= timeout*5) && (usleep(.2 * 1000000) <= 0));
+    }
 
     if (ret != 0) {
         virReportSystemError(errno, "%s",
@@ -589,7 +602,10 @@ static void qemuMonitorUpdateWatch(qemuMonitorPtr mon)
             events |= VIR_EVENT_HANDLE_WRITABLE;
     }
 
-    virEventUpdateHandle(mon->watch, events);
+    if (mon->iothread)
+        virEventThreadUpdateHandle(mon->iothread, mon->watch, events);
+    else
+        virEventUpdateHandle(mon->watch, events);
 }
 
 
@@ -760,10 +776,14 @@ qemuMonitorOpenInternal(virDomainObjPtr vm,
                         int fd,
                         bool hasSendFD,
                         bool json,
+                        virEventThreadPtr iothread,
                         qemuMonitorCallbacksPtr cb,
                         void *opaque)
 {
     qemuMonitorPtr mon;
+    int events = VIR_EVENT_HANDLE_HANGUP |
+                 VIR_EVENT_HANDLE_ERROR |
+                 VIR_EVENT_HANDLE_READABLE;
 
     if (!cb->eofNotify) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -812,13 +832,18 @@ qemuMonitorOpenInternal(virDomainObjPtr vm,
 
     virObjectLock(mon);
     virObjectRef(mon);
-    if ((mon->watch = virEventAddHandle(mon->fd,
-                                        VIR_EVENT_HANDLE_HANGUP |
-                                        VIR_EVENT_HANDLE_ERROR |
-                                        VIR_EVENT_HANDLE_READABLE,
-                                        qemuMonitorIO,
-                                        mon,
-                                        virObjectFreeCallback)) < 0) {
+    if (iothread) {
+        mon->iothread = virObjectRef(iothread);
+        mon->watch = virEventThreadAddHandle(iothread, mon->fd, events,
+                                             qemuMonitorIO, mon,
+                                             virObjectFreeCallback);
+    } else {
+        mon->watch = virEventAddHandle(mon->fd, events,
+                                       qemuMonitorIO, mon,
+                                       virObjectFreeCallback);
+    }
+    if (mon->watch < 0) {
+        mon->watch = 0;
         virObjectUnref(mon);
         virObjectUnlock(mon);
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -850,6 +875,7 @@ qemuMonitorPtr
 qemuMonitorOpen(virDomainObjPtr vm,
                 virDomainChrSourceDefPtr config,
                 bool json,
+                virEventThreadPtr iothread,
                 qemuMonitorCallbacksPtr cb,
                 void *opaque)
 {
@@ -876,7 +902,8 @@ qemuMonitorOpen(virDomainObjPtr vm,
         return NULL;
     }
 
-    ret = qemuMonitorOpenInternal(vm, fd, hasSendFD, json, cb, opaque);
+    ret = qemuMonitorOpenInternal(vm, fd, hasSendFD, json, iothread,
+                                  cb, opaque);
     if (!ret)
         VIR_FORCE_CLOSE(fd);
     return ret;
@@ -886,10 +913,12 @@ qemuMonitorOpen(virDomainObjPtr vm,
 qemuMonitorPtr qemuMonitorOpenFD(virDomainObjPtr vm,
                                  int sockfd,
                                  bool json,
+                                 virEventThreadPtr iothread,
                                  qemuMonitorCallbacksPtr cb,
                                  void *opaque)
 {
-    return qemuMonitorOpenInternal(vm, sockfd, true, json, cb, opaque);
+    return qemuMonitorOpenInternal(vm, sockfd, true, json, iothread,
+                                   cb, opaque);
 }
 
 
@@ -904,7 +933,10 @@ void qemuMonitorClose(qemuMonitorPtr mon)
 
     if (mon->fd >= 0) {
         if (mon->watch) {
-            virEventRemoveHandle(mon->watch);
+            if (mon->iothread)
+                virEventThreadRemoveHandle(mon->iothread, mon->watch);
+            else
+                virEventRemoveHandle(mon->watch);
             mon->watch = 0;
         }
         VIR_FORCE_CLOSE(mon->fd);
@@ -951,10 +983,24 @@ char *qemuMonitorNextCommandID(qemuMonitorPtr mon)
 }
 
 
+static unsigned long long
+qemuMonitorNowUS(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+
 int qemuMonitorSend(qemuMonitorPtr mon,
                     qemuMonitorMessagePtr msg)
 {
     int ret = -1;
+    unsigned long long start;
+    unsigned long long took;
 
     /* Check whether qemu quit unexpectedly */
     if (mon->lastError.code != VIR_ERR_OK) {
@@ -964,6 +1010,7 @@ int qemuMonitorSend(qemuMonitorPtr mon,
         return -1;
     }
 
+    start = qemuMonitorNowUS();
     mon->msg = msg;
     qemuMonitorUpdateWatch(mon);
 
@@ -992,10 +1039,41 @@ int qemuMonitorSend(qemuMonitorPtr mon,
     mon->msg = NULL;
     qemuMonitorUpdateWatch(mon);
 
+    took = qemuMonitorNowUS() - start;
+    mon->stats.commands++;
+    mon->stats.latencyTotal += took;
+    if (took > mon->stats.latencyMax)
+        mon->stats.latencyMax = took;
+
     return ret;
 }
 
 
+/**
+ * qemuMonitorGetStats:
+ * @mon: the monitor
+ * @stats: filled with the counters of @mon
+ *
+ * Fetches the command counters of @mon. Unlike most monitor APIs this
+ * doesn't talk to QEMU and doesn't need a job.
+ */
+void
+qemuMonitorGetStats(qemuMonitorPtr mon,
+                    qemuMonitorStatsPtr stats)
+{
+    virObjectLock(mon);
+    *stats = mon->stats;
+    virObjectUnlock(mon);
+}
+
+
+virEventThreadPtr
+qemuMonitorGetIOThread(qemuMonitorPtr mon)
+{
+    return mon->iothread;
+}
+
+
 virJSONValuePtr
 qemuMonitorGetOptions(qemuMonitorPtr mon)
 {
@@ -34,6 +34,7 @@
 # include "virnetdev.h"
 # include "device_conf.h"
 # include "cpu/cpu.h"
+# include "vireventthread.h"
 
 typedef struct _qemuMonitor qemuMonitor;
 typedef qemuMonitor *qemuMonitorPtr;
@@ -217,18 +218,35 @@ char *qemuMonitorUnescapeArg(const char *in);
 qemuMonitorPtr qemuMonitorOpen(virDomainObjPtr vm,
                                virDomainChrSourceDefPtr config,
                                bool json,
+                               virEventThreadPtr iothread,
                                qemuMonitorCallbacksPtr cb,
                                void *opaque)
-    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4);
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(5);
 qemuMonitorPtr qemuMonitorOpenFD(virDomainObjPtr vm,
                                  int sockfd,
                                  bool json,
+                                 virEventThreadPtr iothread,
                                  qemuMonitorCallbacksPtr cb,
                                  void *opaque)
-    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(4);
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(5);
 
 void qemuMonitorClose(qemuMonitorPtr mon);
 
+typedef struct _qemuMonitorStats qemuMonitorStats;
+typedef qemuMonitorStats *qemuMonitorStatsPtr;
+struct _qemuMonitorStats {
+    unsigned long long commands;      /* commands completed */
+    unsigned long long latencyTotal;  /* time from sending a command to
+                                         its reply, summed up, in us */
+    unsigned long long latencyMax;    /* slowest command, in us */
+};
+
+void qemuMonitorGetStats(qemuMonitorPtr mon,
+                         qemuMonitorStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+virEventThreadPtr qemuMonitorGetIOThread(qemuMonitorPtr mon)
+    ATTRIBUTE_NONNULL(1);
+
 int qemuMonitorSetCapabilities(qemuMonitorPtr mon);
 
 int qemuMonitorSetLink(qemuMonitorPtr mon,
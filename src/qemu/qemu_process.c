@@ -24,7 +24,11 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
+#include <poll.h>
 #include <sys/stat.h>
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
 #if defined(__linux__)
 # include <linux/capability.h>
 #elif defined(__FreeBSD__)
@@ -99,6 +103,10 @@ qemuProcessRemoveDomainStatus(virQEMUDriverPtr driver,
     if (virAsprintf(&file, "%s/%s.xml", cfg->stateDir, vm->def->name) < 0)
         goto cleanup;
 
+    /* Make sure no deferred status update resurrects the file */
+    if (driver->statusWriter)
+        virFileWriterCancel(driver->statusWriter, file);
+
     if (unlink(file) < 0 && errno != ENOENT && errno != ENOTDIR)
         VIR_WARN("Failed to remove domain XML for %s: %s",
                  vm->def->name, virStrerror(errno, ebuf, sizeof(ebuf)));
@@ -199,6 +207,24 @@ static qemuAgentCallbacks agentCallbacks = {
     .errorNotify = qemuProcessHandleAgentError,
 };
 
+/*
+ * Pick the event loop serving the monitor and guest agent of @vm.
+ * Domains are spread over the dedicated I/O threads by their UUID,
+ * if there are any, otherwise NULL selects the default event loop.
+ */
+static virEventThreadPtr
+qemuProcessGetIOThread(virQEMUDriverPtr driver,
+                       virDomainObjPtr vm)
+{
+    unsigned int hash;
+
+    if (!driver->nmonitorIOThreads)
+        return NULL;
+
+    memcpy(&hash, vm->def->uuid, sizeof(hash));
+    return driver->monitorIOThreads[hash % driver->nmonitorIOThreads];
+}
+
 static virDomainChrSourceDefPtr
 qemuFindAgentConfig(virDomainDefPtr def)
 {
@@ -247,6 +273,7 @@ qemuConnectAgent(virQEMUDriverPtr driver, virDomainObjPtr vm)
 
     agent = qemuAgentOpen(vm,
                           config,
+                          qemuProcessGetIOThread(driver, vm),
                           &agentCallbacks);
 
     virObjectLock(vm);
@@ -540,7 +567,7 @@ qemuProcessHandleReset(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     if (priv->agent)
         qemuAgentNotifyEvent(priv->agent, QEMU_AGENT_EVENT_RESET);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0)
+    if (virDomainSaveStatusDeferred(driver->xmlopt, cfg->stateDir, vm) < 0)
         VIR_WARN("Failed to save status on vm %s", vm->def->name);
 
     virObjectUnlock(vm);
@@ -714,7 +741,7 @@ qemuProcessHandleShutdown(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                      VIR_DOMAIN_EVENT_SHUTDOWN,
                                      VIR_DOMAIN_EVENT_SHUTDOWN_FINISHED);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+    if (virDomainSaveStatusDeferred(driver->xmlopt, cfg->stateDir, vm) < 0) {
         VIR_WARN("Unable to save status on vm %s after state change",
                  vm->def->name);
     }
@@ -867,7 +894,7 @@ qemuProcessHandleRTCChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         offset += vm->def->clock.data.variable.adjustment0;
         vm->def->clock.data.variable.adjustment = offset;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0)
+        if (virDomainSaveStatusDeferred(driver->xmlopt, cfg->stateDir, vm) < 0)
            VIR_WARN("unable to save domain status with RTC change");
     }
 
@@ -1115,7 +1142,16 @@ qemuProcessHandleBlockJob(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     }
 
     if (save) {
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0)
+        int rc;
+
+        /* A completed job may have changed the disk source, which
+         * must not get lost if we crash before writing it out */
+        if (status == VIR_DOMAIN_BLOCK_JOB_COMPLETED)
+            rc = virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm);
+        else
+            rc = virDomainSaveStatusDeferred(driver->xmlopt,
+                                             cfg->stateDir, vm);
+        if (rc < 0)
             VIR_WARN("Unable to save status on vm %s after block job",
                      vm->def->name);
         if (persistDisk && virDomainSaveConfig(cfg->configDir,
@@ -1246,7 +1282,8 @@ qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         else if (reason == VIR_DOMAIN_EVENT_TRAY_CHANGE_CLOSE)
             disk->tray_status = VIR_DOMAIN_DISK_TRAY_CLOSED;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+        if (virDomainSaveStatusDeferred(driver->xmlopt,
+                                        cfg->stateDir, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after tray moved event",
                      vm->def->name);
         }
@@ -1285,7 +1322,8 @@ qemuProcessHandlePMWakeup(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                                   VIR_DOMAIN_EVENT_STARTED,
                                                   VIR_DOMAIN_EVENT_STARTED_WAKEUP);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+        if (virDomainSaveStatusDeferred(driver->xmlopt,
+                                        cfg->stateDir, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after wakeup event",
                      vm->def->name);
         }
@@ -1325,7 +1363,8 @@ qemuProcessHandlePMSuspend(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED_MEMORY);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+        if (virDomainSaveStatusDeferred(driver->xmlopt,
+                                        cfg->stateDir, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after suspend event",
                      vm->def->name);
         }
@@ -1361,7 +1400,7 @@ qemuProcessHandleBalloonChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
               vm->def->mem.cur_balloon, actual);
     vm->def->mem.cur_balloon = actual;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0)
+    if (virDomainSaveStatusDeferred(driver->xmlopt, cfg->stateDir, vm) < 0)
         VIR_WARN("unable to save domain status with balloon change");
 
     virObjectUnlock(vm);
@@ -1397,7 +1436,8 @@ qemuProcessHandlePMSuspendDisk(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED_DISK);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+        if (virDomainSaveStatusDeferred(driver->xmlopt,
+                                        cfg->stateDir, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after suspend event",
                      vm->def->name);
         }
@@ -1629,6 +1669,7 @@ qemuConnectMonitor(virQEMUDriverPtr driver, virDomainObjPtr vm, int asyncJob,
     mon = qemuMonitorOpen(vm,
                           priv->monConfig,
                           priv->monJSON,
+                          qemuProcessGetIOThread(driver, vm),
                           &monitorCallbacks,
                           driver);
 
@@ -1723,6 +1764,54 @@ typedef int qemuProcessLogHandleOutput(virDomainObjPtr vm,
                                        const char *output,
                                        int fd);
 
+/*
+ * Returns an FD that becomes readable whenever the log file open as
+ * @fd is written to, or -1 if that can't be watched.
+ */
+static int
+qemuProcessLogWatchOpen(int fd)
+{
+#if HAVE_SYS_INOTIFY_H
+    char path[64];
+    int watchfd;
+
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+    if ((watchfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+        return -1;
+
+    if (inotify_add_watch(watchfd, path, IN_MODIFY) < 0) {
+        VIR_FORCE_CLOSE(watchfd);
+        return -1;
+    }
+
+    return watchfd;
+#else
+    return -1;
+#endif
+}
+
+/*
+ * Wait up to @ms milliseconds for something to be written to the log
+ */
+static void
+qemuProcessLogWatchWait(int watchfd, int ms)
+{
+    struct pollfd pfd = { .fd = watchfd, .events = POLLIN };
+    char buf[4096];
+
+    if (watchfd < 0) {
+        usleep(ms * 1000);
+        return;
+    }
+
+    if (poll(&pfd, 1, ms) > 0) {
+        /* drain the notifications, we only care that there were some */
+        while (read(watchfd, buf, sizeof(buf)) > 0)
+            ;
+    }
+}
+
 /*
  * Returns -1 for error, 0 on success
  */
@@ -1735,13 +1824,23 @@ qemuProcessReadLogOutput(virDomainObjPtr vm,
                          const char *what,
                          int timeout)
 {
-    int retries = (timeout*10);
+    unsigned long long now, deadline;
+    int watchfd;
     int got = 0;
     int ret = -1;
 
     buf[0] = '\0';
 
-    while (retries) {
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+    deadline = now + timeout * 1000ull;
+
+    /* Rather than polling at a fixed interval, wake up as soon as QEMU
+     * writes to the log. The process is still checked for every 100ms
+     * in case it died silently. */
+    watchfd = qemuProcessLogWatchOpen(fd);
+
+    while (now < deadline) {
         ssize_t func_ret;
         bool isdead;
 
@@ -1776,8 +1875,9 @@ qemuProcessReadLogOutput(virDomainObjPtr vm,
             goto cleanup;
         }
 
-        usleep(100*1000);
-        retries--;
+        qemuProcessLogWatchWait(watchfd, MIN(100, deadline - now));
+        if (virTimeMillisNow(&now) < 0)
+            goto cleanup;
     }
 
     virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -1785,6 +1885,7 @@ qemuProcessReadLogOutput(virDomainObjPtr vm,
                    what, buf);
 
  cleanup:
+    VIR_FORCE_CLOSE(watchfd);
     return ret;
 }
 
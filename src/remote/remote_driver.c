@@ -99,6 +99,7 @@ struct private_data {
     char *hostname;             /* Original hostname */
     bool serverKeepAlive;       /* Does server support keepalive protocol? */
     bool serverEventFilter;     /* Does server support modern event filtering */
+    size_t streamChunkMax;      /* Largest stream packet the server accepts */
 
     virObjectEventStatePtr eventState;
 };
@@ -1071,6 +1072,25 @@ doRemoteOpen(virConnectPtr conn,
         }
     }
 
+    /* Negotiate stream packet size */
+    priv->streamChunkMax = VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX;
+    {
+        remote_connect_supports_feature_args args =
+            { VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_CHUNKS };
+        remote_connect_supports_feature_ret ret = { 0 };
+        int rc;
+
+        rc = call(conn, priv, 0, REMOTE_PROC_CONNECT_SUPPORTS_FEATURE,
+                  (xdrproc_t)xdr_remote_connect_supports_feature_args, (char *) &args,
+                  (xdrproc_t)xdr_remote_connect_supports_feature_ret, (char *) &ret);
+
+        if (rc != -1 && ret.supported)
+            priv->streamChunkMax = VIR_NET_MESSAGE_STREAM_CHUNK_MAX;
+        else
+            VIR_INFO("Using legacy stream packet size since larger "
+                     "packets are not supported by the server");
+    }
+
     /* Successful. */
     retcode = VIR_DRV_OPEN_SUCCESS;
 
@@ -5505,6 +5525,10 @@ remoteStreamSend(virStreamPtr st,
     if (virNetClientStreamRaiseError(privst))
         return -1;
 
+    /* Like write(2), sending less than asked for is fine */
+    if (nbytes > priv->streamChunkMax)
+        nbytes = priv->streamChunkMax;
+
     remoteDriverLock(priv);
     priv->localUses++;
     remoteDriverUnlock(priv);
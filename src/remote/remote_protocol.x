@@ -3176,13 +3176,15 @@ enum remote_procedure {
      *   <paramnumber> specifies at which offset the stream parameter is inserted
      *   in the function parameter list.
      *
-     * - @priority: low|high
+     * - @priority: low|high|long
      *
      *   Each API that might eventually access hypervisor's monitor (and thus
      *   block) MUST fall into low priority. However, there are some exceptions
      *   to this rule, e.g. domainDestroy. Other APIs MAY be marked as high
      *   priority. If in doubt, it's safe to choose low. Low is taken as default,
-     *   and thus can be left out.
+     *   and thus can be left out. APIs which usually run for a long time, such
+     *   as migration or saving a domain, are marked long, so that the daemon
+     *   can limit how many workers they may occupy at once.
      *
      * - @acl: <object>:<permission>
      * - @acl: <object>:<permission>:<flagname>
@@ -3570,6 +3572,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @acl: domain:core_dump
+     * @priority: long
      */
     REMOTE_PROC_DOMAIN_CORE_DUMP = 53,
 
@@ -3577,12 +3580,14 @@ enum remote_procedure {
      * @generate: both
      * @acl: domain:start
      * @acl: domain:write
+     * @priority: long
      */
     REMOTE_PROC_DOMAIN_RESTORE = 54,
 
     /**
      * @generate: both
      * @acl: domain:hibernate
+     * @priority: long
      */
     REMOTE_PROC_DOMAIN_SAVE = 55,
 
@@ -3629,6 +3634,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @acl: domain:migrate
+     * @priority: long
      */
     REMOTE_PROC_DOMAIN_MIGRATE_PERFORM = 62,
 
@@ -4063,6 +4069,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @acl: storage_vol:create
+     * @priority: long
      */
     REMOTE_PROC_STORAGE_VOL_CREATE_XML_FROM = 125,
 
@@ -4346,6 +4353,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @acl: storage_vol:format
+     * @priority: long
      */
     REMOTE_PROC_STORAGE_VOL_WIPE = 165,
 
@@ -4463,6 +4471,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @acl: domain:hibernate
+     * @priority: long
      */
     REMOTE_PROC_DOMAIN_MANAGED_SAVE = 182,
 
@@ -4482,6 +4491,7 @@ enum remote_procedure {
      * @generate: both
      * @acl: domain:snapshot
      * @acl: domain:fs_freeze:VIR_DOMAIN_SNAPSHOT_CREATE_QUIESCE
+     * @priority: long
      */
     REMOTE_PROC_DOMAIN_SNAPSHOT_CREATE_XML = 185,
 
@@ -4695,6 +4705,7 @@ enum remote_procedure {
     /**
      * @generate: none
      * @acl: domain:migrate
+     * @priority: long
      */
     REMOTE_PROC_DOMAIN_MIGRATE_PERFORM3 = 216,
 
@@ -4799,6 +4810,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @acl: domain:hibernate
+     * @priority: long
      */
     REMOTE_PROC_DOMAIN_SAVE_FLAGS = 232,
 
@@ -4806,6 +4818,7 @@ enum remote_procedure {
      * @generate: both
      * @acl: domain:start
      * @acl: domain:write
+     * @priority: long
      */
     REMOTE_PROC_DOMAIN_RESTORE_FLAGS = 233,
 
@@ -4977,6 +4990,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @acl: storage_vol:format
+     * @priority: long
      */
     REMOTE_PROC_STORAGE_VOL_WIPE_PATTERN = 259,
 
@@ -5285,6 +5299,7 @@ enum remote_procedure {
     /**
      * @generate: none
      * @acl: domain:migrate
+     * @priority: long
      */
     REMOTE_PROC_DOMAIN_MIGRATE_PERFORM3_PARAMS = 305,
 
@@ -5468,6 +5483,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @acl: domain:core_dump
+     * @priority: long
      */
     REMOTE_PROC_DOMAIN_CORE_DUMP_WITH_FORMAT = 334,
 
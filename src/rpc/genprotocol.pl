@@ -47,9 +47,15 @@ my $fixup = $^O eq "linux" || $^O eq "cygwin" || $^O eq "gnukfreebsd" || $^O eq
 
 if ($mode eq "-c") {
     print TARGET "#include <config.h>\n";
+    print TARGET "#include \"rpc/virnetxdr.h\"\n";
 }
 
 while (<RPCGEN>) {
+    # Route the allocating primitives through our wrappers so
+    # that the server can decode call arguments into an arena.
+    # This is needed regardless of the rpcgen flavour in use.
+    s/\bxdr_(string|bytes|array|pointer)(\s*\()/"virNetXDR" . ucfirst($1) . $2/ge;
+
     # We only want to fixup the GLibc rpcgen output
     # So just print data unchanged, if non-Linux
     unless ($fixup) {
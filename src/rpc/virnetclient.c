@@ -26,6 +26,7 @@
 #include <poll.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <sys/socket.h>
 
 #include "virnetclient.h"
 #include "virnetsocket.h"
@@ -975,13 +976,8 @@ virNetClientCallDispatchReply(virNetClientPtr client)
         return -1;
     }
 
-    if (VIR_REALLOC_N(thecall->msg->buffer, client->msg.bufferLength) < 0)
-        return -1;
-
-    memcpy(thecall->msg->buffer, client->msg.buffer, client->msg.bufferLength);
+    virNetMessageStealBuffer(thecall->msg, &client->msg);
     memcpy(&thecall->msg->header, &client->msg.header, sizeof(client->msg.header));
-    thecall->msg->bufferLength = client->msg.bufferLength;
-    thecall->msg->bufferOffset = client->msg.bufferOffset;
 
     thecall->msg->nfds = client->msg.nfds;
     thecall->msg->fds = client->msg.fds;
@@ -1151,32 +1147,58 @@ static ssize_t
 virNetClientIOWriteMessage(virNetClientPtr client,
                            virNetClientCallPtr thecall)
 {
+    virNetMessagePtr msg = thecall->msg;
     ssize_t ret = 0;
 
-    if (thecall->msg->bufferOffset < thecall->msg->bufferLength) {
+    if (msg->payload &&
+        msg->payloadOffset < msg->payloadLength) {
+        struct iovec iov[2];
+
+        /* Header and stream data go out together, straight
+         * from where the caller keeps the data */
+        iov[0].iov_base = msg->buffer + msg->bufferOffset;
+        iov[0].iov_len = msg->bufferLength - msg->bufferOffset;
+        iov[1].iov_base = (char *)msg->payload + msg->payloadOffset;
+        iov[1].iov_len = msg->payloadLength - msg->payloadOffset;
+
+        ret = virNetSocketWritev(client->sock, iov, 2);
+        if (ret <= 0)
+            return ret;
+
+        if (ret <= iov[0].iov_len) {
+            msg->bufferOffset += ret;
+        } else {
+            msg->payloadOffset += ret - iov[0].iov_len;
+            msg->bufferOffset = msg->bufferLength;
+        }
+
+        if (msg->payloadOffset < msg->payloadLength)
+            return ret;
+    } else if (msg->bufferOffset < msg->bufferLength) {
         ret = virNetSocketWrite(client->sock,
-                                thecall->msg->buffer + thecall->msg->bufferOffset,
-                                thecall->msg->bufferLength - thecall->msg->bufferOffset);
+                                msg->buffer + msg->bufferOffset,
+                                msg->bufferLength - msg->bufferOffset);
         if (ret <= 0)
             return ret;
 
-        thecall->msg->bufferOffset += ret;
+        msg->bufferOffset += ret;
     }
 
-    if (thecall->msg->bufferOffset == thecall->msg->bufferLength) {
+    if (msg->bufferOffset == msg->bufferLength) {
         size_t i;
-        for (i = thecall->msg->donefds; i < thecall->msg->nfds; i++) {
+        for (i = msg->donefds; i < msg->nfds; i++) {
             int rv;
-            if ((rv = virNetSocketSendFD(client->sock, thecall->msg->fds[i])) < 0)
+            if ((rv = virNetSocketSendFD(client->sock, msg->fds[i])) < 0)
                 return -1;
             if (rv == 0) /* Blocking */
                 return 0;
-            thecall->msg->donefds++;
+            msg->donefds++;
         }
-        thecall->msg->donefds = 0;
-        thecall->msg->bufferOffset = thecall->msg->bufferLength = 0;
-        VIR_FREE(thecall->msg->fds);
-        VIR_FREE(thecall->msg->buffer);
+        msg->donefds = 0;
+        msg->payload = NULL;
+        msg->payloadOffset = msg->payloadLength = 0;
+        VIR_FREE(msg->fds);
+        virNetMessageReleaseBuffer(msg);
         if (thecall->expectReply)
             thecall->mode = VIR_NET_CLIENT_MODE_WAIT_RX;
         else
@@ -1224,8 +1246,7 @@ virNetClientIOReadMessage(virNetClientPtr client)
 
     /* Start by reading length word */
     if (client->msg.bufferLength == 0) {
-        client->msg.bufferLength = 4;
-        if (VIR_ALLOC_N(client->msg.buffer, client->msg.bufferLength) < 0)
+        if (virNetMessageSetBufferLength(&client->msg, 4) < 0)
             return -ENOMEM;
     }
 
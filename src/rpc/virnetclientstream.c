@@ -48,9 +48,11 @@ struct _virNetClientStream {
      * recv them. Figure out how to address this some
      * time by stopping consuming any incoming data
      * off the socket....
+     *
+     * Packets are queued as they were read, with bufferOffset
+     * pointing at the first byte not yet handed to the app.
      */
-    char *incoming;
-    size_t incomingOffset;
+    virNetMessagePtr rx;
     size_t incomingLength;
     bool incomingEOF;
 
@@ -86,9 +88,9 @@ virNetClientStreamEventTimerUpdate(virNetClientStreamPtr st)
     if (!st->cb)
         return;
 
-    VIR_DEBUG("Check timer offset=%zu %d", st->incomingOffset, st->cbEvents);
+    VIR_DEBUG("Check timer length=%zu %d", st->incomingLength, st->cbEvents);
 
-    if (((st->incomingOffset || st->incomingEOF) &&
+    if (((st->incomingLength || st->incomingEOF) &&
          (st->cbEvents & VIR_STREAM_EVENT_READABLE)) ||
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE)) {
         VIR_DEBUG("Enabling event timer");
@@ -110,13 +112,13 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_READABLE) &&
-        (st->incomingOffset || st->incomingEOF))
+        (st->incomingLength || st->incomingEOF))
         events |= VIR_STREAM_EVENT_READABLE;
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE))
         events |= VIR_STREAM_EVENT_WRITABLE;
 
-    VIR_DEBUG("Got Timer dispatch %d %d offset=%zu", events, st->cbEvents, st->incomingOffset);
+    VIR_DEBUG("Got Timer dispatch %d %d length=%zu", events, st->cbEvents, st->incomingLength);
     if (events) {
         virNetClientStreamEventCallback cb = st->cb;
         void *cbOpaque = st->cbOpaque;
@@ -161,7 +163,10 @@ void virNetClientStreamDispose(void *obj)
     virNetClientStreamPtr st = obj;
 
     virResetError(&st->err);
-    VIR_FREE(st->incoming);
+    while (st->rx) {
+        virNetMessagePtr msg = virNetMessageQueueServe(&st->rx);
+        virNetMessageFree(msg);
+    }
     virObjectUnref(st->prog);
 }
 
@@ -261,6 +266,11 @@ int virNetClientStreamSetError(virNetClientStreamPtr st,
 }
 
 
+/*
+ * Takes over the payload of @msg, which the caller is about to
+ * clear, rather than copying it: stream packets can be several
+ * megabytes large.
+ */
 int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
                                   virNetMessagePtr msg)
 {
@@ -270,28 +280,24 @@ int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
     virObjectLock(st);
     need = msg->bufferLength - msg->bufferOffset;
     if (need) {
-        size_t avail = st->incomingLength - st->incomingOffset;
-        if (need > avail) {
-            size_t extra = need - avail;
-            if (VIR_REALLOC_N(st->incoming,
-                              st->incomingLength + extra) < 0) {
-                VIR_DEBUG("Out of memory handling stream data");
-                goto cleanup;
-            }
-            st->incomingLength += extra;
+        virNetMessagePtr tmp_msg;
+
+        if (!(tmp_msg = virNetMessageNew(false))) {
+            VIR_DEBUG("Out of memory handling stream data");
+            goto cleanup;
         }
 
-        memcpy(st->incoming + st->incomingOffset,
-               msg->buffer + msg->bufferOffset,
-               msg->bufferLength - msg->bufferOffset);
-        st->incomingOffset += (msg->bufferLength - msg->bufferOffset);
+        tmp_msg->header = msg->header;
+        virNetMessageStealBuffer(tmp_msg, msg);
+
+        virNetMessageQueuePush(&st->rx, tmp_msg);
+        st->incomingLength += need;
     } else {
         st->incomingEOF = true;
     }
 
-    VIR_DEBUG("Stream incoming data offset %zu length %zu EOF %d",
-              st->incomingOffset, st->incomingLength,
-              st->incomingEOF);
+    VIR_DEBUG("Stream incoming data length %zu EOF %d",
+              st->incomingLength, st->incomingEOF);
     virNetClientStreamEventTimerUpdate(st);
 
     ret = 0;
@@ -332,7 +338,9 @@ int virNetClientStreamSendPacket(virNetClientStreamPtr st,
      * need a synchronous confirmation
      */
     if (status == VIR_NET_CONTINUE) {
-        if (virNetMessageEncodePayloadRaw(msg, data, nbytes) < 0)
+        /* Sending blocks until the packet is on the wire, so it
+         * can be written straight from the caller's buffer */
+        if (virNetMessageEncodePayloadRef(msg, data, nbytes) < 0)
             goto error;
 
         if (virNetClientSendNoReply(client, msg) < 0)
@@ -362,10 +370,11 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
                                  bool nonblock)
 {
     int rv = -1;
+    size_t got = 0;
     VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d",
               st, client, data, nbytes, nonblock);
     virObjectLock(st);
-    if (!st->incomingOffset && !st->incomingEOF) {
+    if (!st->incomingLength && !st->incomingEOF) {
         virNetMessagePtr msg;
         int ret;
 
@@ -395,23 +404,24 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
             goto cleanup;
     }
 
-    VIR_DEBUG("After IO %zu", st->incomingOffset);
-    if (st->incomingOffset) {
-        int want = st->incomingOffset;
-        if (want > nbytes)
-            want = nbytes;
-        memcpy(data, st->incoming, want);
-        if (want < st->incomingOffset) {
-            memmove(st->incoming, st->incoming + want, st->incomingOffset - want);
-            st->incomingOffset -= want;
-        } else {
-            VIR_FREE(st->incoming);
-            st->incomingOffset = st->incomingLength = 0;
+    VIR_DEBUG("After IO %zu", st->incomingLength);
+    while (st->rx && got < nbytes) {
+        virNetMessagePtr msg = st->rx;
+        size_t want = msg->bufferLength - msg->bufferOffset;
+
+        if (want > nbytes - got)
+            want = nbytes - got;
+        memcpy(data + got, msg->buffer + msg->bufferOffset, want);
+        msg->bufferOffset += want;
+        st->incomingLength -= want;
+        got += want;
+
+        if (msg->bufferOffset == msg->bufferLength) {
+            virNetMessageQueueServe(&st->rx);
+            virNetMessageFree(msg);
         }
-        rv = want;
-    } else {
-        rv = 0;
     }
+    rv = got;
 
     virNetClientStreamEventTimerUpdate(st);
 
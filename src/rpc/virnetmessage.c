@@ -30,11 +30,242 @@
 #include "virfile.h"
 #include "virutil.h"
 #include "virstring.h"
+#include "virthread.h"
+#include "virprobe.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
 VIR_LOG_INIT("rpc.netmessage");
 
+/*
+ * Message buffers are recycled through a process wide cache split
+ * into size classes, each four times the previous one, starting at
+ * VIR_NET_MESSAGE_INITIAL and ending at VIR_NET_MESSAGE_MAX (plus
+ * the length word). Most messages thus neither allocate nor zero a
+ * fresh buffer, and a message that outgrows its buffer jumps
+ * straight to the next class. Cached buffers are chained through
+ * their first bytes, so the cache needs no memory of its own.
+ */
+#define VIR_NET_MESSAGE_BUFFER_CLASSES 5
+#define VIR_NET_MESSAGE_BUFFER_CLASS_SIZE(cls)                 \
+    (((size_t) VIR_NET_MESSAGE_INITIAL << (2 * (cls))) +       \
+     VIR_NET_MESSAGE_LEN_MAX)
+
+/* How many free buffers of each class to keep around */
+static const size_t
+virNetMessageBufferCacheMax[VIR_NET_MESSAGE_BUFFER_CLASSES] = {
+    32, 8, 2, 1, 0,
+};
+
+static virMutex virNetMessageBufferLock;
+static char *virNetMessageBufferCache[VIR_NET_MESSAGE_BUFFER_CLASSES];
+static size_t virNetMessageBufferCached[VIR_NET_MESSAGE_BUFFER_CLASSES];
+static virNetMessageBufferStats virNetMessageBufferCounters;
+
+static int
+virNetMessageBufferOnceInit(void)
+{
+    if (virMutexInit(&virNetMessageBufferLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize message buffer lock"));
+        return -1;
+    }
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetMessageBuffer)
+
+
+static int
+virNetMessageBufferClass(size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_NET_MESSAGE_BUFFER_CLASSES; i++) {
+        if (len <= VIR_NET_MESSAGE_BUFFER_CLASS_SIZE(i))
+            return i;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Hands out a buffer of at least @len bytes, storing its real
+ * size in @size. The contents of the buffer are undefined.
+ */
+static char *
+virNetMessageBufferGet(size_t len,
+                       size_t *size)
+{
+    int cls = virNetMessageBufferClass(len);
+    char *buf = NULL;
+
+    if (virNetMessageBufferInitialize() < 0)
+        return NULL;
+
+    if (cls >= 0)
+        len = VIR_NET_MESSAGE_BUFFER_CLASS_SIZE(cls);
+
+    virMutexLock(&virNetMessageBufferLock);
+    if (cls >= 0 && (buf = virNetMessageBufferCache[cls])) {
+        memcpy(&virNetMessageBufferCache[cls], buf, sizeof(buf));
+        virNetMessageBufferCached[cls]--;
+        virNetMessageBufferCounters.cached--;
+        virNetMessageBufferCounters.cachedBytes -= len;
+        virNetMessageBufferCounters.reuses++;
+    } else {
+        virNetMessageBufferCounters.allocs++;
+    }
+    virMutexUnlock(&virNetMessageBufferLock);
+
+    if (!buf) {
+        if (VIR_ALLOC_N(buf, len) < 0)
+            return NULL;
+        PROBE(RPC_MESSAGE_BUFFER_ALLOC,
+              "buf=%p size=%zu", buf, len);
+    }
+
+    *size = len;
+    return buf;
+}
+
+
+/*
+ * Gives @buf back to the cache, or to the heap if it is full or
+ * @size does not match a class (e.g. a buffer not obtained from
+ * virNetMessageBufferGet, whose size is recorded as 0).
+ */
+static void
+virNetMessageBufferPut(char *buf,
+                       size_t size)
+{
+    int cls;
+
+    if (!buf)
+        return;
+
+    cls = virNetMessageBufferClass(size);
+    if (cls >= 0 && size == VIR_NET_MESSAGE_BUFFER_CLASS_SIZE(cls)) {
+        virMutexLock(&virNetMessageBufferLock);
+        if (virNetMessageBufferCached[cls] < virNetMessageBufferCacheMax[cls]) {
+            memcpy(buf, &virNetMessageBufferCache[cls], sizeof(buf));
+            virNetMessageBufferCache[cls] = buf;
+            virNetMessageBufferCached[cls]++;
+            virNetMessageBufferCounters.cached++;
+            virNetMessageBufferCounters.cachedBytes += size;
+            buf = NULL;
+        }
+        virMutexUnlock(&virNetMessageBufferLock);
+    }
+
+    if (buf) {
+        PROBE(RPC_MESSAGE_BUFFER_FREE,
+              "buf=%p size=%zu", buf, size);
+        VIR_FREE(buf);
+    }
+}
+
+
+/*
+ * @msg: the message whose buffer to size
+ * @len: the number of bytes the buffer has to hold
+ *
+ * Makes sure @msg has a buffer of at least @len bytes and sets
+ * bufferLength to @len. Data already in the buffer, up to the
+ * smaller of the old bufferLength and @len, is preserved.
+ *
+ * returns 0 on success, -1 on OOM
+ */
+int virNetMessageSetBufferLength(virNetMessagePtr msg,
+                                 size_t len)
+{
+    char *buf;
+    size_t size;
+
+    if (msg->buffer && msg->bufferSize >= len) {
+        msg->bufferLength = len;
+        return 0;
+    }
+
+    if (!(buf = virNetMessageBufferGet(len, &size)))
+        return -1;
+
+    if (msg->buffer) {
+        memcpy(buf, msg->buffer, MIN(msg->bufferLength, len));
+        virNetMessageBufferPut(msg->buffer, msg->bufferSize);
+
+        virMutexLock(&virNetMessageBufferLock);
+        virNetMessageBufferCounters.grows++;
+        virMutexUnlock(&virNetMessageBufferLock);
+    }
+
+    msg->buffer = buf;
+    msg->bufferSize = size;
+    msg->bufferLength = len;
+    return 0;
+}
+
+
+/*
+ * @msg: the message whose buffer to drop
+ *
+ * Returns the buffer of @msg to the cache and resets the
+ * buffer length and offset.
+ */
+void virNetMessageReleaseBuffer(virNetMessagePtr msg)
+{
+    virNetMessageBufferPut(msg->buffer, msg->bufferSize);
+    msg->buffer = NULL;
+    msg->bufferSize = 0;
+    msg->bufferLength = 0;
+    msg->bufferOffset = 0;
+}
+
+
+/*
+ * @dst: the message to receive the buffer
+ * @src: the message to take the buffer from
+ *
+ * Moves the buffer of @src, along with its length and offset,
+ * over to @dst, releasing the one @dst had. @src is left without
+ * a buffer.
+ */
+void virNetMessageStealBuffer(virNetMessagePtr dst,
+                              virNetMessagePtr src)
+{
+    virNetMessageReleaseBuffer(dst);
+
+    dst->buffer = src->buffer;
+    dst->bufferSize = src->bufferSize;
+    dst->bufferLength = src->bufferLength;
+    dst->bufferOffset = src->bufferOffset;
+
+    src->buffer = NULL;
+    src->bufferSize = 0;
+    src->bufferLength = 0;
+    src->bufferOffset = 0;
+}
+
+
+/*
+ * @stats: filled with the current buffer counters
+ *
+ * Reports how well the message buffer cache is doing.
+ */
+void virNetMessageGetBufferStats(virNetMessageBufferStatsPtr stats)
+{
+    if (virNetMessageBufferInitialize() < 0) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+
+    virMutexLock(&virNetMessageBufferLock);
+    *stats = virNetMessageBufferCounters;
+    virMutexUnlock(&virNetMessageBufferLock);
+}
+
+
 virNetMessagePtr virNetMessageNew(bool tracked)
 {
     virNetMessagePtr msg;
@@ -59,7 +290,7 @@ void virNetMessageClear(virNetMessagePtr msg)
     for (i = 0; i < msg->nfds; i++)
         VIR_FORCE_CLOSE(msg->fds[i]);
     VIR_FREE(msg->fds);
-    VIR_FREE(msg->buffer);
+    virNetMessageReleaseBuffer(msg);
     memset(msg, 0, sizeof(*msg));
     msg->tracked = tracked;
 }
@@ -78,7 +309,7 @@ void virNetMessageFree(virNetMessagePtr msg)
 
     for (i = 0; i < msg->nfds; i++)
         VIR_FORCE_CLOSE(msg->fds[i]);
-    VIR_FREE(msg->buffer);
+    virNetMessageReleaseBuffer(msg);
     VIR_FREE(msg->fds);
     VIR_FREE(msg);
 }
@@ -143,8 +374,7 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
 
     /* Extend our declared buffer length and carry
        on reading the header + payload */
-    msg->bufferLength += len;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageSetBufferLength(msg, msg->bufferLength + len) < 0)
         goto cleanup;
 
     VIR_DEBUG("Got length, now need %zu total (%u more)",
@@ -220,9 +450,11 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
     int ret = -1;
     unsigned int len = 0;
 
-    msg->bufferLength = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageSetBufferLength(msg, VIR_NET_MESSAGE_INITIAL +
+                                     VIR_NET_MESSAGE_LEN_MAX) < 0)
         return ret;
+    /* A recycled buffer may well be larger, let the payload use it */
+    msg->bufferLength = msg->bufferSize;
     msg->bufferOffset = 0;
 
     /* Format the header. */
@@ -339,6 +571,9 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
 {
     XDR xdr;
     unsigned int msglen;
+#ifdef HAVE_XDR_SIZEOF
+    bool sized = false;
+#endif
 
     /* Serialise payload of the message. This assumes that
      * virNetMessageEncodeHeader has already been run, so
@@ -348,7 +583,20 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
 
     /* Try to encode the payload. If the buffer is too small increase it. */
     while (!(*filter)(&xdr, data, 0)) {
-        unsigned int newlen = (msg->bufferLength - VIR_NET_MESSAGE_LEN_MAX) * 4;
+        size_t newlen = (msg->bufferLength - VIR_NET_MESSAGE_LEN_MAX) * 4;
+
+#ifdef HAVE_XDR_SIZEOF
+        /* Rather than growing the buffer step by step and encoding
+         * the whole payload over again each time, measure it once */
+        if (!sized) {
+            size_t want = msg->bufferOffset - VIR_NET_MESSAGE_LEN_MAX +
+                xdr_sizeof(filter, data);
+
+            if (want > msg->bufferLength - VIR_NET_MESSAGE_LEN_MAX)
+                newlen = want;
+            sized = true;
+        }
+#endif
 
         if (newlen > VIR_NET_MESSAGE_MAX) {
             virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message payload"));
@@ -357,14 +605,18 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
 
         xdr_destroy(&xdr);
 
-        msg->bufferLength = newlen + VIR_NET_MESSAGE_LEN_MAX;
-
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageSetBufferLength(msg, newlen +
+                                         VIR_NET_MESSAGE_LEN_MAX) < 0)
             goto error;
+        msg->bufferLength = msg->bufferSize;
 
         xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
                       msg->bufferLength - msg->bufferOffset, XDR_ENCODE);
 
+        virMutexLock(&virNetMessageBufferLock);
+        virNetMessageBufferCounters.encodeRetries++;
+        virMutexUnlock(&virNetMessageBufferLock);
+
         VIR_DEBUG("Increased message buffer length = %zu", msg->bufferLength);
     }
 
@@ -420,13 +672,22 @@ int virNetMessageDecodePayload(virNetMessagePtr msg,
 }
 
 
-int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
-                                  const char *data,
-                                  size_t len)
+/*
+ * @msg: the outgoing message, whose header is already encoded
+ * @len: number of raw payload bytes to make room for
+ * @data: filled with where the payload bytes are to be placed
+ *
+ * Grows the message buffer so that @len bytes of raw payload fit
+ * after the header, letting the caller read stream data straight
+ * into the message instead of through a bounce buffer. The payload
+ * must be finalized with virNetMessageCommitPayloadRaw().
+ *
+ * returns 0 on success, -1 upon fatal error
+ */
+int virNetMessageReservePayloadRaw(virNetMessagePtr msg,
+                                   size_t len,
+                                   char **data)
 {
-    XDR xdr;
-    unsigned int msglen;
-
     /* If the message buffer is too small for the payload increase it accordingly. */
     if ((msg->bufferLength - msg->bufferOffset) < len) {
         if ((msg->bufferOffset + len) >
@@ -441,15 +702,38 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
             return -1;
         }
 
-        msg->bufferLength = msg->bufferOffset + len;
-
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageSetBufferLength(msg, msg->bufferOffset + len) < 0)
             return -1;
 
         VIR_DEBUG("Increased message buffer length = %zu", msg->bufferLength);
     }
 
-    memcpy(msg->buffer + msg->bufferOffset, data, len);
+    *data = msg->buffer + msg->bufferOffset;
+    return 0;
+}
+
+
+/*
+ * @msg: the outgoing message
+ * @len: number of raw payload bytes placed in the reserved space
+ *
+ * Completes a payload set up by virNetMessageReservePayloadRaw(),
+ * @len may be less than what was reserved.
+ *
+ * returns 0 on success, -1 upon fatal error
+ */
+int virNetMessageCommitPayloadRaw(virNetMessagePtr msg,
+                                  size_t len)
+{
+    XDR xdr;
+    unsigned int msglen;
+
+    if (len > msg->bufferLength - msg->bufferOffset) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Payload of %zu bytes exceeds reserved space"), len);
+        return -1;
+    }
+
     msg->bufferOffset += len;
 
     /* Re-encode the length word. */
@@ -472,6 +756,76 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
 }
 
 
+int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
+                                  const char *data,
+                                  size_t len)
+{
+    char *payload;
+
+    if (virNetMessageReservePayloadRaw(msg, len, &payload) < 0)
+        return -1;
+
+    if (len)
+        memcpy(payload, data, len);
+
+    return virNetMessageCommitPayloadRaw(msg, len);
+}
+
+
+/*
+ * @msg: the outgoing message, whose header is already encoded
+ * @data: raw payload, owned by the caller
+ * @len: number of bytes in @data
+ *
+ * Like virNetMessageEncodePayloadRaw(), but leaves the payload in
+ * the caller's buffer rather than copying it into the message, so
+ * that it can be written out along with the header in a single
+ * vectored write. @data must stay valid until the message was
+ * transmitted, so this is only suitable for callers that block
+ * until then.
+ *
+ * returns 0 on success, -1 upon fatal error
+ */
+int virNetMessageEncodePayloadRef(virNetMessagePtr msg,
+                                  const char *data,
+                                  size_t len)
+{
+    XDR xdr;
+    unsigned int msglen;
+
+    if (len > VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX -
+        msg->bufferOffset) {
+        virReportError(VIR_ERR_RPC,
+                       _("Stream data too long to send "
+                         "(%zu bytes needed, %zu bytes available)"),
+                       len,
+                       VIR_NET_MESSAGE_MAX +
+                       VIR_NET_MESSAGE_LEN_MAX -
+                       msg->bufferOffset);
+        return -1;
+    }
+
+    /* Re-encode the length word to cover the external payload too. */
+    xdrmem_create(&xdr, msg->buffer, VIR_NET_MESSAGE_HEADER_XDR_LEN, XDR_ENCODE);
+    msglen = msg->bufferOffset + len;
+    VIR_DEBUG("Encode length as %u", msglen);
+    if (!xdr_u_int(&xdr, &msglen)) {
+        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message length"));
+        xdr_destroy(&xdr);
+        return -1;
+    }
+    xdr_destroy(&xdr);
+
+    msg->payload = data;
+    msg->payloadLength = len;
+    msg->payloadOffset = 0;
+
+    msg->bufferLength = msg->bufferOffset;
+    msg->bufferOffset = 0;
+    return 0;
+}
+
+
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
 {
     XDR xdr;
@@ -23,6 +23,14 @@
 
 # include "virnetprotocol.h"
 
+/* Largest stream data chunk exchanged with peers that advertise
+ * VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_CHUNKS; everyone else is sent
+ * at most VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX bytes per packet. A full
+ * packet, header and length word included, fits a 1 MiB message
+ * buffer. */
+# define VIR_NET_MESSAGE_STREAM_CHUNK_MAX                       \
+    (1024 * 1024 - VIR_NET_MESSAGE_HEADER_MAX - VIR_NET_MESSAGE_LEN_MAX)
+
 typedef struct virNetMessageHeader *virNetMessageHeaderPtr;
 typedef struct virNetMessageError *virNetMessageErrorPtr;
 
@@ -31,6 +39,17 @@ typedef virNetMessage *virNetMessagePtr;
 
 typedef void (*virNetMessageFreeCallback)(virNetMessagePtr msg, void *opaque);
 
+typedef struct _virNetMessageBufferStats virNetMessageBufferStats;
+typedef virNetMessageBufferStats *virNetMessageBufferStatsPtr;
+struct _virNetMessageBufferStats {
+    unsigned long long allocs;        /* buffers allocated from the heap */
+    unsigned long long reuses;        /* buffers taken from the cache */
+    unsigned long long grows;         /* buffers swapped for a larger one */
+    unsigned long long encodeRetries; /* payloads that had to be re-encoded */
+    size_t cached;                    /* buffers sitting in the cache */
+    size_t cachedBytes;               /* memory held by those buffers */
+};
+
 struct _virNetMessage {
     bool tracked;
 
@@ -38,6 +57,13 @@ struct _virNetMessage {
                   /* Maximum   VIR_NET_MESSAGE_MAX     + VIR_NET_MESSAGE_LEN_MAX */
     size_t bufferLength;
     size_t bufferOffset;
+    size_t bufferSize; /* Allocated size of @buffer, 0 if not known */
+
+    /* Raw payload following @buffer on the wire, not owned by
+     * the message. See virNetMessageEncodePayloadRef. */
+    const char *payload;
+    size_t payloadLength;
+    size_t payloadOffset;
 
     virNetMessageHeader header;
 
@@ -58,6 +84,18 @@ void virNetMessageClear(virNetMessagePtr);
 
 void virNetMessageFree(virNetMessagePtr msg);
 
+int virNetMessageSetBufferLength(virNetMessagePtr msg,
+                                 size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+void virNetMessageReleaseBuffer(virNetMessagePtr msg)
+    ATTRIBUTE_NONNULL(1);
+void virNetMessageStealBuffer(virNetMessagePtr dst,
+                              virNetMessagePtr src)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+void virNetMessageGetBufferStats(virNetMessageBufferStatsPtr stats)
+    ATTRIBUTE_NONNULL(1);
+
 virNetMessagePtr virNetMessageQueueServe(virNetMessagePtr *queue)
     ATTRIBUTE_NONNULL(1);
 void virNetMessageQueuePush(virNetMessagePtr *queue,
@@ -89,6 +127,17 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageReservePayloadRaw(virNetMessagePtr msg,
+                                   size_t len,
+                                   char **data)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageCommitPayloadRaw(virNetMessagePtr msg,
+                                  size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageEncodePayloadRef(virNetMessagePtr msg,
+                                  const char *data,
+                                  size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
 void virNetMessageSaveError(virNetMessageErrorPtr rerr)
     ATTRIBUTE_NONNULL(1);
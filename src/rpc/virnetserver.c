@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include "virnetserver.h"
 #include "virlog.h"
@@ -65,6 +66,7 @@ struct _virNetServerJob {
     virNetServerClientPtr client;
     virNetMessagePtr msg;
     virNetServerProgramPtr prog;
+    unsigned long long queued;          /* when the job was queued, in us */
 };
 
 struct _virNetServer {
@@ -182,15 +184,43 @@ static int virNetServerProcessMsg(virNetServerPtr srv,
     return ret;
 }
 
+static unsigned long long
+virNetServerNowUS(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
 static void virNetServerHandleJob(void *jobOpaque, void *opaque)
 {
     virNetServerPtr srv = opaque;
     virNetServerJobPtr job = jobOpaque;
+    unsigned long long start = virNetServerNowUS();
+    int procedure = -1;
+    int rc;
 
     VIR_DEBUG("server=%p client=%p message=%p prog=%p",
               srv, job->client, job->msg, job->prog);
 
-    if (virNetServerProcessMsg(srv, job->client, job->prog, job->msg) < 0)
+    /* The message is gone once processed */
+    if (job->prog &&
+        (job->msg->header.type == VIR_NET_CALL ||
+         job->msg->header.type == VIR_NET_CALL_WITH_FDS))
+        procedure = job->msg->header.proc;
+
+    rc = virNetServerProcessMsg(srv, job->client, job->prog, job->msg);
+
+    /* Failed calls took their time too */
+    if (procedure >= 0)
+        virNetServerProgramRecordCall(job->prog, procedure,
+                                      start - job->queued,
+                                      virNetServerNowUS() - start);
+
+    if (rc < 0)
         goto error;
 
     virObjectUnref(job->prog);
@@ -235,6 +265,7 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
 
         job->client = client;
         job->msg = msg;
+        job->queued = virNetServerNowUS();
 
         if (prog) {
             virObjectRef(prog);
@@ -242,7 +273,8 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
             priority = virNetServerProgramGetPriority(prog, msg->header.proc);
         }
 
-        ret = virThreadPoolSendJob(srv->workers, priority, job);
+        /* Calls of each client take turns with those of others */
+        ret = virThreadPoolSendJobFull(srv->workers, priority, client, job);
 
         if (ret < 0) {
             VIR_FREE(job);
@@ -1174,6 +1206,36 @@ void virNetServerRun(virNetServerPtr srv)
 }
 
 
+/*
+ * @maxLong: most long running calls to process at once, 0 for no limit
+ *
+ * Keeps calls of procedures marked as long, like migration, from
+ * occupying all the workers.
+ */
+void virNetServerSetLongJobLimit(virNetServerPtr srv,
+                                 size_t maxLong)
+{
+    virObjectLock(srv);
+    if (srv->workers)
+        virThreadPoolSetLongJobLimit(srv->workers, maxLong);
+    virObjectUnlock(srv);
+}
+
+
+/*
+ * Logs the call counts and time histograms of all procedures.
+ */
+void virNetServerLogStats(virNetServerPtr srv)
+{
+    size_t i;
+
+    virObjectLock(srv);
+    for (i = 0; i < srv->nprograms; i++)
+        virNetServerProgramLogStats(srv->programs[i]);
+    virObjectUnlock(srv);
+}
+
+
 void virNetServerQuit(virNetServerPtr srv)
 {
     virObjectLock(srv);
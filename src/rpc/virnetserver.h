@@ -94,6 +94,11 @@ void virNetServerRun(virNetServerPtr srv);
 
 void virNetServerQuit(virNetServerPtr srv);
 
+void virNetServerSetLongJobLimit(virNetServerPtr srv,
+                                 size_t maxLong);
+
+void virNetServerLogStats(virNetServerPtr srv);
+
 void virNetServerClose(virNetServerPtr srv);
 
 bool virNetServerKeepAliveRequired(virNetServerPtr srv);
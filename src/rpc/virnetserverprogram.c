@@ -25,38 +25,74 @@
 
 #include "virnetserverprogram.h"
 #include "virnetserverclient.h"
+#include "virnetxdr.h"
 
 #include "viralloc.h"
 #include "virerror.h"
 #include "virlog.h"
 #include "virfile.h"
 #include "virthread.h"
+#include "virbuffer.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
 VIR_LOG_INIT("rpc.netserverprogram");
 
+/* Call statistics of one thread. Only that thread records calls in
+ * them, so the lock is contended only while the statistics are read */
+typedef struct _virNetServerProgramThreadStats virNetServerProgramThreadStats;
+typedef virNetServerProgramThreadStats *virNetServerProgramThreadStatsPtr;
+
+struct _virNetServerProgramThreadStats {
+    virNetServerProgramThreadStatsPtr next;
+    virMutex lock;
+    virNetServerProgramProcStatsPtr procs;
+};
+
 struct _virNetServerProgram {
-    virObject object;
+    virObjectLockable parent;
 
     unsigned program;
     unsigned version;
     virNetServerProgramProcPtr procs;
     size_t nprocs;
+
+    /* The statistics of the calling thread, owned by the list below */
+    virThreadLocal threadStats;
+    virNetServerProgramThreadStatsPtr stats;
 };
 
 
+/* Block size of the per-thread arena call arguments are decoded
+ * into; enough to hold the arguments of nearly every call */
+#define VIR_NET_SERVER_PROGRAM_ARENA_BLOCK (16 * 1024)
+
 static virClassPtr virNetServerProgramClass;
 static void virNetServerProgramDispose(void *obj);
 
+/* Each worker thread keeps its arena across calls */
+static virThreadLocal virNetServerProgramArena;
+
+static void virNetServerProgramArenaFree(void *opaque)
+{
+    virNetXDRArenaFree(opaque);
+}
+
 static int virNetServerProgramOnceInit(void)
 {
-    if (!(virNetServerProgramClass = virClassNew(virClassForObject(),
+    if (!(virNetServerProgramClass = virClassNew(virClassForObjectLockable(),
                                                  "virNetServerProgram",
                                                  sizeof(virNetServerProgram),
                                                  virNetServerProgramDispose)))
         return -1;
 
+    if (virThreadLocalInit(&virNetServerProgramArena,
+                           virNetServerProgramArenaFree) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize thread local variable"));
+        return -1;
+    }
+
     return 0;
 }
 
@@ -73,7 +109,7 @@ virNetServerProgramPtr virNetServerProgramNew(unsigned program,
     if (virNetServerProgramInitialize() < 0)
         return NULL;
 
-    if (!(prog = virObjectNew(virNetServerProgramClass)))
+    if (!(prog = virObjectLockableNew(virNetServerProgramClass)))
         return NULL;
 
     prog->program = program;
@@ -81,6 +117,13 @@ virNetServerProgramPtr virNetServerProgramNew(unsigned program,
     prog->procs = procs;
     prog->nprocs = nprocs;
 
+    if (virThreadLocalInit(&prog->threadStats, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize thread local variable"));
+        virObjectUnref(prog);
+        return NULL;
+    }
+
     VIR_DEBUG("prog=%p", prog);
 
     return prog;
@@ -139,6 +182,184 @@ virNetServerProgramGetPriority(virNetServerProgramPtr prog,
     return proc->priority;
 }
 
+
+static size_t
+virNetServerProgramStatsBucket(unsigned long long us)
+{
+    size_t i = 0;
+
+    while (i < VIR_NET_SERVER_PROGRAM_STATS_BUCKETS - 1 && us >= (1ULL << i))
+        i++;
+
+    return i;
+}
+
+
+static void
+virNetServerProgramThreadStatsFree(virNetServerProgramThreadStatsPtr ts)
+{
+    if (!ts)
+        return;
+
+    virMutexDestroy(&ts->lock);
+    VIR_FREE(ts->procs);
+    VIR_FREE(ts);
+}
+
+
+/* Returns the statistics of the calling thread, allocated on its
+ * first call */
+static virNetServerProgramThreadStatsPtr
+virNetServerProgramGetThreadStats(virNetServerProgramPtr prog)
+{
+    virNetServerProgramThreadStatsPtr ts;
+
+    if ((ts = virThreadLocalGet(&prog->threadStats)))
+        return ts;
+
+    if (VIR_ALLOC_QUIET(ts) < 0)
+        return NULL;
+    if (virMutexInit(&ts->lock) < 0) {
+        VIR_FREE(ts);
+        return NULL;
+    }
+    if (VIR_ALLOC_N_QUIET(ts->procs, prog->nprocs) < 0 ||
+        virThreadLocalSet(&prog->threadStats, ts) < 0) {
+        virNetServerProgramThreadStatsFree(ts);
+        return NULL;
+    }
+
+    virObjectLock(prog);
+    ts->next = prog->stats;
+    prog->stats = ts;
+    virObjectUnlock(prog);
+
+    return ts;
+}
+
+
+/*
+ * @waitUS: how long the call was queued for a worker
+ * @serviceUS: how long it took to process the call
+ *
+ * Accounts for a call of @procedure in the histograms reported by
+ * virNetServerProgramGetProcStats.
+ */
+void
+virNetServerProgramRecordCall(virNetServerProgramPtr prog,
+                              int procedure,
+                              unsigned long long waitUS,
+                              unsigned long long serviceUS)
+{
+    virNetServerProgramThreadStatsPtr ts;
+    virNetServerProgramProcStatsPtr stats;
+
+    if (procedure < 0 || procedure >= prog->nprocs)
+        return;
+
+    if (!(ts = virNetServerProgramGetThreadStats(prog)))
+        return;
+
+    virMutexLock(&ts->lock);
+    stats = &ts->procs[procedure];
+    stats->calls++;
+    stats->waitTotal += waitUS;
+    stats->serviceTotal += serviceUS;
+    stats->wait[virNetServerProgramStatsBucket(waitUS)]++;
+    stats->service[virNetServerProgramStatsBucket(serviceUS)]++;
+    virMutexUnlock(&ts->lock);
+}
+
+
+/* Sums up the statistics of @procedure over all threads */
+int
+virNetServerProgramGetProcStats(virNetServerProgramPtr prog,
+                                int procedure,
+                                virNetServerProgramProcStatsPtr stats)
+{
+    virNetServerProgramThreadStatsPtr ts;
+    virNetServerProgramProcStatsPtr cur;
+    size_t i;
+
+    if (procedure < 0 || procedure >= prog->nprocs)
+        return -1;
+
+    memset(stats, 0, sizeof(*stats));
+
+    virObjectLock(prog);
+    for (ts = prog->stats; ts; ts = ts->next) {
+        virMutexLock(&ts->lock);
+        cur = &ts->procs[procedure];
+        stats->calls += cur->calls;
+        stats->waitTotal += cur->waitTotal;
+        stats->serviceTotal += cur->serviceTotal;
+        for (i = 0; i < VIR_NET_SERVER_PROGRAM_STATS_BUCKETS; i++) {
+            stats->wait[i] += cur->wait[i];
+            stats->service[i] += cur->service[i];
+        }
+        virMutexUnlock(&ts->lock);
+    }
+    virObjectUnlock(prog);
+    return 0;
+}
+
+
+static void
+virNetServerProgramFormatHistogram(virBufferPtr buf,
+                                   const char *name,
+                                   unsigned long long total,
+                                   unsigned long long calls,
+                                   const unsigned long long *buckets)
+{
+    size_t i;
+
+    virBufferAsprintf(buf, " %s avg=%lluus", name, total / calls);
+    for (i = 0; i < VIR_NET_SERVER_PROGRAM_STATS_BUCKETS; i++) {
+        if (!buckets[i])
+            continue;
+        if (i == VIR_NET_SERVER_PROGRAM_STATS_BUCKETS - 1)
+            virBufferAsprintf(buf, " >=%lluus:%llu", 1ULL << (i - 1), buckets[i]);
+        else
+            virBufferAsprintf(buf, " <%lluus:%llu", 1ULL << i, buckets[i]);
+    }
+}
+
+
+/*
+ * Logs the number of calls of each procedure so far, with the
+ * histograms of their queueing and processing time.
+ */
+void
+virNetServerProgramLogStats(virNetServerProgramPtr prog)
+{
+    virNetServerProgramProcStats stats;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *str;
+    size_t i;
+
+    for (i = 0; i < prog->nprocs; i++) {
+        if (virNetServerProgramGetProcStats(prog, i, &stats) < 0 ||
+            stats.calls == 0)
+            continue;
+
+        virBufferAsprintf(&buf, "program=%u version=%u procedure=%zu",
+                          prog->program, prog->version, i);
+        if (prog->procs[i].name)
+            virBufferAsprintf(&buf, " (%s)", prog->procs[i].name);
+        virBufferAsprintf(&buf, " calls=%llu", stats.calls);
+        virNetServerProgramFormatHistogram(&buf, "wait", stats.waitTotal,
+                                           stats.calls, stats.wait);
+        virNetServerProgramFormatHistogram(&buf, "service", stats.serviceTotal,
+                                           stats.calls, stats.service);
+
+        if (!(str = virBufferContentAndReset(&buf)))
+            continue;
+        VIR_INFO("%s", str);
+        VIR_FREE(str);
+    }
+}
+
+
 static int
 virNetServerProgramSendError(unsigned program,
                              unsigned version,
@@ -353,6 +574,28 @@ int virNetServerProgramDispatch(virNetServerProgramPtr prog,
 }
 
 
+static virNetXDRArenaPtr
+virNetServerProgramGetArena(void)
+{
+    virNetXDRArenaPtr arena;
+
+    if ((arena = virThreadLocalGet(&virNetServerProgramArena)))
+        return arena;
+
+    if (!(arena = virNetXDRArenaNew(VIR_NET_SERVER_PROGRAM_ARENA_BLOCK)))
+        return NULL;
+
+    if (virThreadLocalSet(&virNetServerProgramArena, arena) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to set thread local variable"));
+        virNetXDRArenaFree(arena);
+        return NULL;
+    }
+
+    return arena;
+}
+
+
 /*
  * @server: the unlocked server object
  * @client: the unlocked client object
@@ -378,6 +621,8 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     virNetMessageError rerr;
     size_t i;
     virIdentityPtr identity = NULL;
+    virNetXDRArenaPtr arena = NULL;
+    int rc;
 
     memset(&rerr, 0, sizeof(rerr));
 
@@ -410,12 +655,25 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
         goto error;
     }
 
-    if (VIR_ALLOC_N(arg, dispatcher->arg_len) < 0)
+    /*
+     * The arguments are decoded into this thread's arena, so
+     * however deeply nested they are, they are released in one
+     * step once the call completes, instead of by xdr_free.
+     * Nothing the dispatcher hands back may point into them.
+     */
+    if (!(arena = virNetServerProgramGetArena()))
+        goto error;
+
+    if (!(arg = virNetXDRArenaAlloc(arena, dispatcher->arg_len)))
         goto error;
     if (VIR_ALLOC_N(ret, dispatcher->ret_len) < 0)
         goto error;
 
-    if (virNetMessageDecodePayload(msg, dispatcher->arg_filter, arg) < 0)
+    if (virNetXDRArenaSetCurrent(arena) < 0)
+        goto error;
+    rc = virNetMessageDecodePayload(msg, dispatcher->arg_filter, arg);
+    ignore_value(virNetXDRArenaSetCurrent(NULL));
+    if (rc < 0)
         goto error;
 
     if (!(identity = virNetServerClientGetIdentity(client)))
@@ -455,7 +713,8 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
         msg->nfds = 0;
     }
 
-    xdr_free(dispatcher->arg_filter, arg);
+    virNetXDRArenaReset(arena);
+    arg = NULL;
 
     if (rv < 0)
         goto error;
@@ -486,7 +745,6 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     }
 
     xdr_free(dispatcher->ret_filter, ret);
-    VIR_FREE(arg);
     VIR_FREE(ret);
 
     virObjectUnref(identity);
@@ -498,7 +756,8 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
      * RPC error message we can send back to the client */
     rv = virNetServerProgramSendReplyError(prog, client, msg, &rerr, &msg->header);
 
-    VIR_FREE(arg);
+    if (arena)
+        virNetXDRArenaReset(arena);
     VIR_FREE(ret);
     virObjectUnref(identity);
 
@@ -548,6 +807,61 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
 }
 
 
-void virNetServerProgramDispose(void *obj ATTRIBUTE_UNUSED)
+/*
+ * Sets up @msg as a stream data packet with room for @len bytes of
+ * payload, stored in @data, so that the data can be read straight
+ * into the message. Send it with virNetServerProgramSendReservedStreamData
+ */
+int virNetServerProgramReserveStreamData(virNetServerProgramPtr prog,
+                                         virNetMessagePtr msg,
+                                         int procedure,
+                                         int serial,
+                                         size_t len,
+                                         char **data)
+{
+    VIR_DEBUG("msg=%p len=%zu", msg, len);
+
+    msg->header.prog = prog->program;
+    msg->header.vers = prog->version;
+    msg->header.proc = procedure;
+    msg->header.type = VIR_NET_STREAM;
+    msg->header.serial = serial;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        return -1;
+
+    return virNetMessageReservePayloadRaw(msg, len, data);
+}
+
+
+/*
+ * Sends a packet set up by virNetServerProgramReserveStreamData
+ * with the first @len bytes of the reserved space filled in. A
+ * @len of zero signals read EOF, as with SendStreamData.
+ */
+int virNetServerProgramSendReservedStreamData(virNetServerProgramPtr prog ATTRIBUTE_UNUSED,
+                                              virNetServerClientPtr client,
+                                              virNetMessagePtr msg,
+                                              size_t len)
+{
+    VIR_DEBUG("client=%p msg=%p len=%zu", client, msg, len);
+
+    if (virNetMessageCommitPayloadRaw(msg, len) < 0)
+        return -1;
+    VIR_DEBUG("Total %zu", msg->bufferLength);
+
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
+void virNetServerProgramDispose(void *obj)
 {
+    virNetServerProgramPtr prog = obj;
+    virNetServerProgramThreadStatsPtr ts;
+
+    while ((ts = prog->stats)) {
+        prog->stats = ts->next;
+        virNetServerProgramThreadStatsFree(ts);
+    }
 }
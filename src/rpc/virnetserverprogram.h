@@ -55,6 +55,22 @@ struct _virNetServerProgramProc {
     xdrproc_t ret_filter;
     bool needAuth;
     unsigned int priority;
+    const char *name;
+};
+
+/* Bucket i counts calls that took less than 2^i microseconds, the
+ * last one everything longer */
+# define VIR_NET_SERVER_PROGRAM_STATS_BUCKETS 24
+
+typedef struct _virNetServerProgramProcStats virNetServerProgramProcStats;
+typedef virNetServerProgramProcStats *virNetServerProgramProcStatsPtr;
+
+struct _virNetServerProgramProcStats {
+    unsigned long long calls;
+    unsigned long long waitTotal;       /* time queued for a worker, in us */
+    unsigned long long serviceTotal;    /* time being processed, in us */
+    unsigned long long wait[VIR_NET_SERVER_PROGRAM_STATS_BUCKETS];
+    unsigned long long service[VIR_NET_SERVER_PROGRAM_STATS_BUCKETS];
 };
 
 virNetServerProgramPtr virNetServerProgramNew(unsigned program,
@@ -68,6 +84,17 @@ int virNetServerProgramGetVersion(virNetServerProgramPtr prog);
 unsigned int virNetServerProgramGetPriority(virNetServerProgramPtr prog,
                                             int procedure);
 
+void virNetServerProgramRecordCall(virNetServerProgramPtr prog,
+                                   int procedure,
+                                   unsigned long long waitUS,
+                                   unsigned long long serviceUS);
+
+int virNetServerProgramGetProcStats(virNetServerProgramPtr prog,
+                                    int procedure,
+                                    virNetServerProgramProcStatsPtr stats);
+
+void virNetServerProgramLogStats(virNetServerProgramPtr prog);
+
 int virNetServerProgramMatches(virNetServerProgramPtr prog,
                                virNetMessagePtr msg);
 
@@ -101,4 +128,16 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
                                       const char *data,
                                       size_t len);
 
+int virNetServerProgramReserveStreamData(virNetServerProgramPtr prog,
+                                         virNetMessagePtr msg,
+                                         int procedure,
+                                         int serial,
+                                         size_t len,
+                                         char **data);
+
+int virNetServerProgramSendReservedStreamData(virNetServerProgramPtr prog,
+                                              virNetServerClientPtr client,
+                                              virNetMessagePtr msg,
+                                              size_t len);
+
 #endif /* __VIR_NET_SERVER_PROGRAM_H__ */
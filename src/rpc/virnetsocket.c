@@ -39,6 +39,10 @@
 # include <sys/ucred.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+# include <sys/uio.h>
+#endif
+
 #include "c-ctype.h"
 #ifdef WITH_SELINUX
 # include <selinux/selinux.h>
@@ -1749,6 +1753,98 @@ ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len)
 }
 
 
+#ifdef HAVE_SYS_UIO_H
+/* Whether data is written to the file descriptor as is, rather than
+ * being encoded by a TLS, SASL or SSH session first */
+static bool virNetSocketIsPlain(virNetSocketPtr sock)
+{
+# if WITH_SSH2
+    if (sock->sshSession)
+        return false;
+# endif
+# if WITH_SASL
+    if (sock->saslSession)
+        return false;
+# endif
+# if WITH_GNUTLS
+    if (sock->tlsSession &&
+        virNetTLSSessionGetHandshakeStatus(sock->tlsSession) ==
+        VIR_NET_TLS_HANDSHAKE_COMPLETE)
+        return false;
+# endif
+    return true;
+}
+
+
+static ssize_t virNetSocketWritevWire(virNetSocketPtr sock,
+                                      const struct iovec *iov,
+                                      int iovcnt)
+{
+    ssize_t ret;
+
+ rewrite:
+    ret = writev(sock->fd, iov, iovcnt);
+
+    if (ret < 0) {
+        if (errno == EINTR)
+            goto rewrite;
+        if (errno == EAGAIN)
+            return 0;
+
+        virReportSystemError(errno, "%s",
+                             _("Cannot write data"));
+        return -1;
+    }
+    if (ret == 0) {
+        virReportSystemError(EIO, "%s",
+                             _("End of file while writing data"));
+        return -1;
+    }
+
+    return ret;
+}
+#endif
+
+
+/*
+ * Writes as much as possible of the @iovcnt buffers in @iov with a
+ * single system call, so that a message header and a separately
+ * held payload need not be copied together first. Sockets with an
+ * encoding session get the first non-empty buffer only, they have
+ * to copy the data anyway.
+ *
+ * Returns the number of bytes written, 0 if it would block, or
+ * -1 on error
+ */
+ssize_t virNetSocketWritev(virNetSocketPtr sock,
+                           const struct iovec *iov,
+                           int iovcnt)
+{
+    ssize_t ret;
+    int i;
+
+    for (i = 0; i < iovcnt && iov[i].iov_len == 0; i++)
+        ;
+    if (i == iovcnt)
+        return 0;
+
+    virObjectLock(sock);
+#ifdef HAVE_SYS_UIO_H
+    if (virNetSocketIsPlain(sock))
+        ret = virNetSocketWritevWire(sock, iov + i, iovcnt - i);
+    else
+#endif
+#if WITH_SASL
+    if (sock->saslSession)
+        ret = virNetSocketWriteSASL(sock, iov[i].iov_base, iov[i].iov_len);
+    else
+#endif
+        ret = virNetSocketWriteWire(sock, iov[i].iov_base, iov[i].iov_len);
+    virObjectUnlock(sock);
+    return ret;
+}
+
+
 /*
  * Returns 1 if an FD was sent, 0 if it would block, -1 on error
  */
@@ -0,0 +1,375 @@
+/*
+ * virnetxdr.c: arena backed XDR decoding
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdint.h>
+
+#include "virnetxdr.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+/* Alignment of every chunk handed out, large enough for any
+ * type found in the generated protocol structs */
+#define VIR_NET_XDR_ARENA_ALIGN 16
+
+/* Requests larger than a quarter of the block size get a block
+ * of their own, which is given back to the heap on reset */
+#define VIR_NET_XDR_ARENA_LARGE(arena, size) ((size) > (arena)->blockSize / 4)
+
+typedef struct _virNetXDRArenaBlock virNetXDRArenaBlock;
+typedef virNetXDRArenaBlock *virNetXDRArenaBlockPtr;
+struct _virNetXDRArenaBlock {
+    virNetXDRArenaBlockPtr next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct _virNetXDRArena {
+    size_t blockSize;
+    /* The block small requests are carved from comes first */
+    virNetXDRArenaBlockPtr blocks;
+    virNetXDRArenaStats stats;
+};
+
+static virThreadLocal virNetXDRArenaCurrent;
+
+static int virNetXDROnceInit(void)
+{
+    if (virThreadLocalInit(&virNetXDRArenaCurrent, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize XDR arena"));
+        return -1;
+    }
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetXDR)
+
+
+/**
+ * virNetXDRArenaNew:
+ * @blockSize: size of the blocks small allocations are carved from
+ *
+ * Create an arena for decoding XDR data. Nothing is allocated from
+ * the heap until the first allocation is made.
+ *
+ * Returns the new arena, or NULL on error
+ */
+virNetXDRArenaPtr
+virNetXDRArenaNew(size_t blockSize)
+{
+    virNetXDRArenaPtr arena;
+
+    if (virNetXDRInitialize() < 0)
+        return NULL;
+
+    if (VIR_ALLOC(arena) < 0)
+        return NULL;
+
+    arena->blockSize = blockSize < 1024 ? 1024 : blockSize;
+    return arena;
+}
+
+
+static void
+virNetXDRArenaFreeBlocks(virNetXDRArenaBlockPtr block)
+{
+    while (block) {
+        virNetXDRArenaBlockPtr next = block->next;
+        VIR_FREE(block);
+        block = next;
+    }
+}
+
+
+void
+virNetXDRArenaFree(virNetXDRArenaPtr arena)
+{
+    if (!arena)
+        return;
+
+    virNetXDRArenaFreeBlocks(arena->blocks);
+    VIR_FREE(arena);
+}
+
+
+static void *
+virNetXDRArenaBlockCarve(virNetXDRArenaBlockPtr block,
+                         size_t size)
+{
+    uintptr_t start = (uintptr_t) (block->data + block->used);
+    size_t pad = (VIR_NET_XDR_ARENA_ALIGN -
+                  start % VIR_NET_XDR_ARENA_ALIGN) % VIR_NET_XDR_ARENA_ALIGN;
+    char *ptr;
+
+    if (block->size - block->used < pad ||
+        block->size - block->used - pad < size)
+        return NULL;
+
+    ptr = block->data + block->used + pad;
+    block->used += pad + size;
+    return ptr;
+}
+
+
+/**
+ * virNetXDRArenaAlloc:
+ * @arena: the arena
+ * @size: number of bytes wanted
+ *
+ * Hand out @size bytes of zeroed memory which stays valid until
+ * the next virNetXDRArenaReset or virNetXDRArenaFree call.
+ *
+ * Returns a pointer to the memory, or NULL on OOM
+ */
+void *
+virNetXDRArenaAlloc(virNetXDRArenaPtr arena,
+                    size_t size)
+{
+    virNetXDRArenaBlockPtr block;
+    size_t blockSize = arena->blockSize;
+    void *ptr = NULL;
+
+    if (size == 0)
+        size = 1;
+
+    if (arena->blocks &&
+        !VIR_NET_XDR_ARENA_LARGE(arena, size) &&
+        (ptr = virNetXDRArenaBlockCarve(arena->blocks, size)))
+        goto done;
+
+    if (VIR_NET_XDR_ARENA_LARGE(arena, size)) {
+        if (size > SIZE_MAX - VIR_NET_XDR_ARENA_ALIGN) {
+            virReportOOMError();
+            return NULL;
+        }
+        blockSize = size + VIR_NET_XDR_ARENA_ALIGN;
+    }
+
+    if (VIR_ALLOC_VAR(block, char, blockSize) < 0)
+        return NULL;
+    block->size = blockSize;
+    arena->stats.blocks++;
+
+    /* Dedicated blocks go behind the current one so that small
+     * requests keep filling up the partially used block */
+    if (VIR_NET_XDR_ARENA_LARGE(arena, size) && arena->blocks) {
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+    } else {
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    ptr = virNetXDRArenaBlockCarve(block, size);
+
+ done:
+    memset(ptr, 0, size);
+    arena->stats.allocs++;
+    arena->stats.bytes += size;
+    return ptr;
+}
+
+
+/**
+ * virNetXDRArenaReset:
+ * @arena: the arena
+ *
+ * Release everything allocated from @arena in one go. A single
+ * regular block is kept around for reuse by the next call.
+ */
+void
+virNetXDRArenaReset(virNetXDRArenaPtr arena)
+{
+    virNetXDRArenaBlockPtr keep = NULL;
+    virNetXDRArenaBlockPtr block = arena->blocks;
+
+    while (block) {
+        virNetXDRArenaBlockPtr next = block->next;
+
+        if (!keep && block->size == arena->blockSize) {
+            keep = block;
+            keep->next = NULL;
+            keep->used = 0;
+        } else {
+            VIR_FREE(block);
+        }
+        block = next;
+    }
+
+    arena->blocks = keep;
+    arena->stats.bytes = 0;
+    arena->stats.resets++;
+}
+
+
+void
+virNetXDRArenaGetStats(virNetXDRArenaPtr arena,
+                       virNetXDRArenaStatsPtr stats)
+{
+    *stats = arena->stats;
+}
+
+
+/**
+ * virNetXDRArenaSetCurrent:
+ * @arena: the arena, or NULL
+ *
+ * Make the XDR filters running in the calling thread decode into
+ * @arena, or back into individually heap allocated memory when
+ * @arena is NULL.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virNetXDRArenaSetCurrent(virNetXDRArenaPtr arena)
+{
+    if (virNetXDRInitialize() < 0)
+        return -1;
+
+    if (virThreadLocalSet(&virNetXDRArenaCurrent, arena) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to set current XDR arena"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static virNetXDRArenaPtr
+virNetXDRArenaForDecode(XDR *xdrs)
+{
+    if (xdrs->x_op != XDR_DECODE ||
+        virNetXDRInitialize() < 0)
+        return NULL;
+
+    return virThreadLocalGet(&virNetXDRArenaCurrent);
+}
+
+
+bool_t
+virNetXDRString(XDR *xdrs, char **cpp, u_int maxsize)
+{
+    virNetXDRArenaPtr arena;
+    u_int size;
+
+    if (!(arena = virNetXDRArenaForDecode(xdrs)))
+        return xdr_string(xdrs, cpp, maxsize);
+
+    if (!xdr_u_int(xdrs, &size))
+        return FALSE;
+    if (size > maxsize || size == (u_int) -1)
+        return FALSE;
+
+    if (!*cpp &&
+        !(*cpp = virNetXDRArenaAlloc(arena, (size_t) size + 1)))
+        return FALSE;
+    (*cpp)[size] = '\0';
+
+    return xdr_opaque(xdrs, *cpp, size);
+}
+
+
+bool_t
+virNetXDRBytes(XDR *xdrs, char **cpp, u_int *sizep, u_int maxsize)
+{
+    virNetXDRArenaPtr arena;
+
+    if (!(arena = virNetXDRArenaForDecode(xdrs)))
+        return xdr_bytes(xdrs, cpp, sizep, maxsize);
+
+    if (!xdr_u_int(xdrs, sizep))
+        return FALSE;
+    if (*sizep > maxsize)
+        return FALSE;
+    if (*sizep == 0)
+        return TRUE;
+
+    if (!*cpp &&
+        !(*cpp = virNetXDRArenaAlloc(arena, *sizep)))
+        return FALSE;
+
+    return xdr_opaque(xdrs, *cpp, *sizep);
+}
+
+
+bool_t
+virNetXDRArray(XDR *xdrs, char **addrp, u_int *sizep,
+               u_int maxsize, u_int elsize, xdrproc_t elproc)
+{
+    virNetXDRArenaPtr arena;
+    u_int i;
+
+    if (!(arena = virNetXDRArenaForDecode(xdrs)))
+        return xdr_array(xdrs, addrp, sizep, maxsize, elsize, elproc);
+
+    if (!xdr_u_int(xdrs, sizep))
+        return FALSE;
+    if (*sizep > maxsize ||
+        (elsize && *sizep > (u_int) -1 / elsize))
+        return FALSE;
+
+    if (!*addrp) {
+        if (*sizep == 0)
+            return TRUE;
+        if (!(*addrp = virNetXDRArenaAlloc(arena,
+                                           (size_t) *sizep * elsize)))
+            return FALSE;
+    }
+
+    for (i = 0; i < *sizep; i++) {
+        if (!(*elproc)(xdrs, *addrp + (size_t) i * elsize))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+bool_t
+virNetXDRPointer(XDR *xdrs, char **objpp, u_int obj_size,
+                 xdrproc_t xdr_obj)
+{
+    virNetXDRArenaPtr arena;
+    bool_t more;
+
+    if (!(arena = virNetXDRArenaForDecode(xdrs)))
+        return xdr_pointer(xdrs, objpp, obj_size, xdr_obj);
+
+    if (!xdr_bool(xdrs, &more))
+        return FALSE;
+    if (!more) {
+        *objpp = NULL;
+        return TRUE;
+    }
+
+    if (!*objpp &&
+        !(*objpp = virNetXDRArenaAlloc(arena, obj_size)))
+        return FALSE;
+
+    return (*xdr_obj)(xdrs, *objpp);
+}
@@ -0,0 +1,67 @@
+/*
+ * virnetxdr.h: arena backed XDR decoding
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIR_NET_XDR_H__
+# define __VIR_NET_XDR_H__
+
+# include <rpc/rpc.h>
+
+# include "internal.h"
+
+typedef struct _virNetXDRArena virNetXDRArena;
+typedef virNetXDRArena *virNetXDRArenaPtr;
+
+typedef struct _virNetXDRArenaStats virNetXDRArenaStats;
+typedef virNetXDRArenaStats *virNetXDRArenaStatsPtr;
+struct _virNetXDRArenaStats {
+    unsigned long long allocs;    /* allocations served by the arena */
+    unsigned long long blocks;    /* heap allocations made for them */
+    unsigned long long resets;
+    size_t bytes;                 /* bytes handed out since the last reset */
+};
+
+virNetXDRArenaPtr virNetXDRArenaNew(size_t blockSize);
+void virNetXDRArenaFree(virNetXDRArenaPtr arena);
+
+void *virNetXDRArenaAlloc(virNetXDRArenaPtr arena, size_t size)
+    ATTRIBUTE_NONNULL(1);
+void virNetXDRArenaReset(virNetXDRArenaPtr arena)
+    ATTRIBUTE_NONNULL(1);
+void virNetXDRArenaGetStats(virNetXDRArenaPtr arena,
+                            virNetXDRArenaStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+int virNetXDRArenaSetCurrent(virNetXDRArenaPtr arena);
+
+/*
+ * Drop-in replacements for the allocating XDR primitives, substituted
+ * into the generated protocol code by genprotocol.pl. While the calling
+ * thread has a current arena, decoding allocates from it and the
+ * result must be released with virNetXDRArenaReset rather than
+ * xdr_free. Otherwise they behave exactly like the library versions.
+ */
+bool_t virNetXDRString(XDR *xdrs, char **cpp, u_int maxsize);
+bool_t virNetXDRBytes(XDR *xdrs, char **cpp, u_int *sizep, u_int maxsize);
+bool_t virNetXDRArray(XDR *xdrs, char **addrp, u_int *sizep,
+                      u_int maxsize, u_int elsize, xdrproc_t elproc);
+bool_t virNetXDRPointer(XDR *xdrs, char **objpp, u_int obj_size,
+                        xdrproc_t xdr_obj);
+
+#endif /* __VIR_NET_XDR_H__ */
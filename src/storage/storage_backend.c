@@ -60,6 +60,7 @@
 #include "storage_backend.h"
 #include "virlog.h"
 #include "virfile.h"
+#include "virfilewipe.h"
 #include "stat-time.h"
 #include "virstring.h"
 #include "virxml.h"
@@ -1834,63 +1835,15 @@ virStorageBackendVolZeroSparseFileLocal(virStorageVolDefPtr vol,
 }
 
 
-static int
-virStorageBackendWipeExtentLocal(virStorageVolDefPtr vol,
-                                 int fd,
-                                 off_t extent_start,
-                                 off_t extent_length,
-                                 char *writebuf,
-                                 size_t writebuf_length,
-                                 size_t *bytes_wiped)
+static void
+virStorageBackendVolWipeProgress(unsigned long long done,
+                                 unsigned long long total,
+                                 void *opaque)
 {
-    int ret = -1, written = 0;
-    off_t remaining = 0;
-    size_t write_size = 0;
-
-    VIR_DEBUG("extent logical start: %ju len: %ju",
-              (uintmax_t)extent_start, (uintmax_t)extent_length);
-
-    if ((ret = lseek(fd, extent_start, SEEK_SET)) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to seek to position %ju in volume "
-                               "with path '%s'"),
-                             (uintmax_t)extent_start, vol->target.path);
-        goto cleanup;
-    }
+    virStorageVolDefPtr vol = opaque;
 
-    remaining = extent_length;
-    while (remaining > 0) {
-
-        write_size = (writebuf_length < remaining) ? writebuf_length : remaining;
-        written = safewrite(fd, writebuf, write_size);
-        if (written < 0) {
-            virReportSystemError(errno,
-                                 _("Failed to write %zu bytes to "
-                                   "storage volume with path '%s'"),
-                                 write_size, vol->target.path);
-
-            goto cleanup;
-        }
-
-        *bytes_wiped += written;
-        remaining -= written;
-    }
-
-    if (fdatasync(fd) < 0) {
-        ret = -errno;
-        virReportSystemError(errno,
-                             _("cannot sync data to volume with path '%s'"),
-                             vol->target.path);
-        goto cleanup;
-    }
-
-    VIR_DEBUG("Wrote %zu bytes to volume with path '%s'",
-              *bytes_wiped, vol->target.path);
-
-    ret = 0;
-
- cleanup:
-    return ret;
+    VIR_DEBUG("Wiped %llu of %llu bytes of volume with path '%s'",
+              done, total, vol->target.path);
 }
 
 
@@ -1903,8 +1856,6 @@ virStorageBackendVolWipeLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
 {
     int ret = -1, fd = -1;
     struct stat st;
-    char *writebuf = NULL;
-    size_t bytes_wiped = 0;
     virCommandPtr cmd = NULL;
 
     virCheckFlags(0, -1);
@@ -1972,23 +1923,26 @@ virStorageBackendVolWipeLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
         if (S_ISREG(st.st_mode) && st.st_blocks < (st.st_size / DEV_BSIZE)) {
             ret = virStorageBackendVolZeroSparseFileLocal(vol, st.st_size, fd);
         } else {
-
-            if (VIR_ALLOC_N(writebuf, st.st_blksize) < 0)
-                goto cleanup;
-
-            ret = virStorageBackendWipeExtentLocal(vol,
-                                                   fd,
-                                                   0,
-                                                   vol->target.allocation,
-                                                   writebuf,
-                                                   st.st_blksize,
-                                                   &bytes_wiped);
+            virFileWipeParams params = {
+                .progress = virStorageBackendVolWipeProgress,
+                .opaque = vol,
+            };
+            unsigned int wipeflags = 0;
+
+            /* Wiping must not change the allocation of a fully
+             * allocated file, block devices however are best
+             * discarded if that is guaranteed to zero them */
+            if (S_ISREG(st.st_mode))
+                wipeflags |= VIR_FILE_WIPE_KEEP_ALLOCATION;
+
+            ret = virFileWipeZero(fd, vol->target.path,
+                                  0, vol->target.allocation,
+                                  &params, NULL, wipeflags);
         }
     }
 
  cleanup:
     virCommandFree(cmd);
-    VIR_FREE(writebuf);
     VIR_FORCE_CLOSE(fd);
     return ret;
 }
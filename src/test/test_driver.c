@@ -112,6 +112,9 @@ struct _testConn {
     size_t numAuths;
     testAuthPtr auths;
 
+    /* Simulated hypervisor round trip of stats queries, in microseconds */
+    unsigned int statsLatency;
+
     virObjectEventStatePtr eventState;
 };
 typedef struct _testConn testConn;
@@ -496,6 +499,15 @@ testDomObjFromDomain(virDomainPtr domain)
     return vm;
 }
 
+/* Stands in for the monitor round trip a real driver makes to
+ * collect statistics, see the scale element of the node XML */
+static void
+testDomainStatsDelay(testConnPtr privconn)
+{
+    if (privconn->statsLatency)
+        usleep(privconn->statsLatency);
+}
+
 static char *
 testDomainGenerateIfname(virDomainDefPtr domdef)
 {
@@ -1390,6 +1402,130 @@ testParseAuthUsers(testConnPtr privconn,
     return ret;
 }
 
+static int
+testParseScaleAttr(xmlXPathContextPtr ctxt,
+                   const char *attr,
+                   unsigned int *value)
+{
+    char *xpath = NULL;
+    int rc;
+
+    if (virAsprintf(&xpath, "string(/node/scale/@%s)", attr) < 0)
+        return -1;
+
+    rc = virXPathUInt(xpath, ctxt, value);
+    VIR_FREE(xpath);
+
+    if (rc == -2) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("invalid value for /node/scale/@%s"), attr);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * <scale domains='1000' disks='4' interfaces='2' latency='500'/>
+ * populates the connection with that many running domains named
+ * scale-0, scale-1, ... carrying the given number of disks and
+ * interfaces each, and makes every stats query sleep for @latency
+ * microseconds per domain as if it had to talk to a monitor.
+ */
+static int
+testParseScale(testConnPtr privconn,
+               xmlXPathContextPtr ctxt)
+{
+    unsigned int ndomains = 0;
+    unsigned int ndisks = 1;
+    unsigned int nifaces = 1;
+    char *prefix = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virDomainDefPtr def = NULL;
+    virDomainObjPtr obj;
+    char *xml = NULL;
+    size_t i, j;
+    int ret = -1;
+
+    if (testParseScaleAttr(ctxt, "domains", &ndomains) < 0 ||
+        testParseScaleAttr(ctxt, "disks", &ndisks) < 0 ||
+        testParseScaleAttr(ctxt, "interfaces", &nifaces) < 0 ||
+        testParseScaleAttr(ctxt, "latency", &privconn->statsLatency) < 0)
+        goto cleanup;
+
+    if (ndisks > 26 || nifaces > 256) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("at most 26 disks and 256 interfaces "
+                         "per scaled domain are supported"));
+        goto cleanup;
+    }
+
+    if (!(prefix = virXPathString("string(/node/scale/@prefix)", ctxt)) &&
+        VIR_STRDUP(prefix, "scale") < 0)
+        goto cleanup;
+
+    for (i = 0; i < ndomains; i++) {
+        virBufferAddLit(&buf, "<domain type='test'>\n");
+        virBufferAsprintf(&buf, "  <name>%s-%zu</name>\n", prefix, i);
+        virBufferAsprintf(&buf, "  <uuid>%08zx-5ca1-4000-8000-000000000000</uuid>\n",
+                          i);
+        virBufferAddLit(&buf, "  <memory>1048576</memory>\n");
+        virBufferAddLit(&buf, "  <vcpu>2</vcpu>\n");
+        virBufferAddLit(&buf, "  <os><type>hvm</type></os>\n");
+        virBufferAddLit(&buf, "  <devices>\n");
+        for (j = 0; j < ndisks; j++) {
+            virBufferAddLit(&buf, "    <disk type='file' device='disk'>\n");
+            virBufferAsprintf(&buf, "      <source file='/var/lib/libvirt/images/%s-%zu-%zu.img'/>\n",
+                              prefix, i, j);
+            virBufferAsprintf(&buf, "      <target dev='vd%c' bus='virtio'/>\n",
+                              (char) ('a' + j));
+            virBufferAddLit(&buf, "    </disk>\n");
+        }
+        for (j = 0; j < nifaces; j++) {
+            virBufferAddLit(&buf, "    <interface type='network'>\n");
+            virBufferAsprintf(&buf, "      <mac address='52:54:%02zx:%02zx:%02zx:%02zx'/>\n",
+                              (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff, j);
+            virBufferAddLit(&buf, "      <source network='default'/>\n");
+            virBufferAddLit(&buf, "    </interface>\n");
+        }
+        virBufferAddLit(&buf, "  </devices>\n");
+        virBufferAddLit(&buf, "</domain>\n");
+
+        if (virBufferCheckError(&buf) < 0)
+            goto cleanup;
+        xml = virBufferContentAndReset(&buf);
+
+        if (!(def = virDomainDefParseString(xml, privconn->caps,
+                                            privconn->xmlopt,
+                                            1 << VIR_DOMAIN_VIRT_TEST,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+            goto cleanup;
+        VIR_FREE(xml);
+
+        if (testDomainGenerateIfnames(def) < 0 ||
+            !(obj = virDomainObjListAdd(privconn->domains, def,
+                                        privconn->xmlopt, 0, NULL)))
+            goto cleanup;
+        def = NULL;
+
+        obj->persistent = 1;
+        if (testDomainStartState(privconn, obj,
+                                 VIR_DOMAIN_RUNNING_BOOTED) < 0) {
+            virObjectUnlock(obj);
+            goto cleanup;
+        }
+        virObjectUnlock(obj);
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    virDomainDefFree(def);
+    VIR_FREE(xml);
+    VIR_FREE(prefix);
+    return ret;
+}
+
 /* No shared state between simultaneous test connections initialized
  * from a file.  */
 static int
@@ -1452,6 +1588,8 @@ testOpenFromFile(virConnectPtr conn, const char *file)
         goto error;
     if (testParseAuthUsers(privconn, ctxt) < 0)
         goto error;
+    if (testParseScale(privconn, ctxt) < 0)
+        goto error;
 
     xmlXPathFreeContext(ctxt);
     xmlFreeDoc(doc);
@@ -3405,6 +3543,8 @@ static int testDomainBlockStats(virDomainPtr domain,
         goto error;
     }
 
+    testDomainStatsDelay(privconn);
+
     if (gettimeofday(&tv, NULL) < 0) {
         virReportSystemError(errno,
                              "%s", _("getting time of day"));
@@ -3461,6 +3601,8 @@ static int testDomainInterfaceStats(virDomainPtr domain,
         goto error;
     }
 
+    testDomainStatsDelay(privconn);
+
     if (gettimeofday(&tv, NULL) < 0) {
         virReportSystemError(errno,
                              "%s", _("getting time of day"));
@@ -3486,6 +3628,279 @@ static int testDomainInterfaceStats(virDomainPtr domain,
 }
 
 
+#define TEST_DOMAIN_STATS_SUPPORTED \
+    (VIR_DOMAIN_STATS_STATE | \
+     VIR_DOMAIN_STATS_CPU_TOTAL | \
+     VIR_DOMAIN_STATS_BALLOON | \
+     VIR_DOMAIN_STATS_VCPU | \
+     VIR_DOMAIN_STATS_INTERFACE | \
+     VIR_DOMAIN_STATS_BLOCK)
+
+static int
+testDomainStatsAddULLong(virTypedParamListPtr params,
+                         const char *type,
+                         size_t num,
+                         const char *field,
+                         unsigned long long value)
+{
+    char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+
+    snprintf(name, sizeof(name), "%s.%zu.%s", type, num, field);
+    return virTypedParamListAddULLong(params, name, value);
+}
+
+static int
+testDomainStatsAddString(virTypedParamListPtr params,
+                         const char *type,
+                         size_t num,
+                         const char *field,
+                         const char *value)
+{
+    char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+
+    snprintf(name, sizeof(name), "%s.%zu.%s", type, num, field);
+    return virTypedParamListAddString(params, name, value);
+}
+
+static int
+testDomainGetStats(virConnectPtr conn,
+                   virDomainObjPtr dom,
+                   unsigned int stats,
+                   virDomainStatsRecordPtr *record)
+{
+    testConnPtr privconn = conn->privateData;
+    virDomainStatsRecordPtr tmp = NULL;
+    virDomainDefPtr def = dom->def;
+    virTypedParamListPtr params = NULL;
+    struct timeval tv;
+    unsigned long long statbase;
+    int state, reason;
+    size_t i;
+    int ret = -1;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        virReportSystemError(errno,
+                             "%s", _("getting time of day"));
+        goto cleanup;
+    }
+
+    /* No significance to these numbers, just enough to mix it up */
+    statbase = (tv.tv_sec * 1000UL * 1000UL) + tv.tv_usec;
+
+    if (!(params = virTypedParamListNew()))
+        goto cleanup;
+
+    if (stats & VIR_DOMAIN_STATS_STATE) {
+        state = virDomainObjGetState(dom, &reason);
+        if (virTypedParamListAddInt(params, "state.state", state) < 0 ||
+            virTypedParamListAddInt(params, "state.reason", reason) < 0)
+            goto cleanup;
+    }
+
+    if (!virDomainObjIsActive(dom) ||
+        !(stats & ~VIR_DOMAIN_STATS_STATE))
+        goto done;
+
+    testDomainStatsDelay(privconn);
+
+    if (stats & VIR_DOMAIN_STATS_CPU_TOTAL) {
+        if (virTypedParamListAddULLong(params,
+                                       "cpu.time", statbase * 1000) < 0 ||
+            virTypedParamListAddULLong(params,
+                                       "cpu.user", statbase * 600) < 0 ||
+            virTypedParamListAddULLong(params,
+                                       "cpu.system", statbase * 300) < 0)
+            goto cleanup;
+    }
+
+    if (stats & VIR_DOMAIN_STATS_BALLOON) {
+        if (virTypedParamListAddULLong(params, "balloon.current",
+                                       def->mem.cur_balloon) < 0 ||
+            virTypedParamListAddULLong(params, "balloon.maximum",
+                                       def->mem.max_balloon) < 0)
+            goto cleanup;
+    }
+
+    if (stats & VIR_DOMAIN_STATS_VCPU) {
+        if (virTypedParamListAddUInt(params, "vcpu.current", def->vcpus) < 0 ||
+            virTypedParamListAddUInt(params, "vcpu.maximum", def->maxvcpus) < 0)
+            goto cleanup;
+
+        for (i = 0; i < def->vcpus; i++) {
+            char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+
+            snprintf(name, sizeof(name), "vcpu.%zu.state", i);
+            if (virTypedParamListAddInt(params, name, VIR_VCPU_RUNNING) < 0 ||
+                testDomainStatsAddULLong(params, "vcpu", i, "time",
+                                         statbase * 1000 / (i + 1)) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (stats & VIR_DOMAIN_STATS_INTERFACE) {
+        if (virTypedParamListAddUInt(params, "net.count", def->nnets) < 0)
+            goto cleanup;
+
+        for (i = 0; i < def->nnets; i++) {
+            const char *ifname = def->nets[i]->ifname;
+
+            if ((ifname &&
+                 testDomainStatsAddString(params, "net", i,
+                                          "name", ifname) < 0) ||
+                testDomainStatsAddULLong(params, "net", i,
+                                         "rx.bytes", statbase / 10) < 0 ||
+                testDomainStatsAddULLong(params, "net", i,
+                                         "rx.pkts", statbase / 100) < 0 ||
+                testDomainStatsAddULLong(params, "net", i,
+                                         "rx.errs", tv.tv_sec / 1) < 0 ||
+                testDomainStatsAddULLong(params, "net", i,
+                                         "rx.drop", tv.tv_sec / 2) < 0 ||
+                testDomainStatsAddULLong(params, "net", i,
+                                         "tx.bytes", statbase / 20) < 0 ||
+                testDomainStatsAddULLong(params, "net", i,
+                                         "tx.pkts", statbase / 110) < 0 ||
+                testDomainStatsAddULLong(params, "net", i,
+                                         "tx.errs", tv.tv_sec / 3) < 0 ||
+                testDomainStatsAddULLong(params, "net", i,
+                                         "tx.drop", tv.tv_sec / 4) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (stats & VIR_DOMAIN_STATS_BLOCK) {
+        if (virTypedParamListAddUInt(params, "block.count", def->ndisks) < 0)
+            goto cleanup;
+
+        for (i = 0; i < def->ndisks; i++) {
+            virDomainDiskDefPtr disk = def->disks[i];
+            const char *path = virDomainDiskGetSource(disk);
+
+            if (testDomainStatsAddString(params, "block", i,
+                                         "name", disk->dst) < 0 ||
+                (path &&
+                 testDomainStatsAddString(params, "block", i,
+                                          "path", path) < 0) ||
+                testDomainStatsAddULLong(params, "block", i,
+                                         "rd.reqs", statbase / 10) < 0 ||
+                testDomainStatsAddULLong(params, "block", i,
+                                         "rd.bytes", statbase / 20) < 0 ||
+                testDomainStatsAddULLong(params, "block", i,
+                                         "wr.reqs", statbase / 30) < 0 ||
+                testDomainStatsAddULLong(params, "block", i,
+                                         "wr.bytes", statbase / 40) < 0)
+                goto cleanup;
+        }
+    }
+
+ done:
+    if (VIR_ALLOC(tmp) < 0)
+        goto cleanup;
+
+    if (!(tmp->dom = virGetDomain(conn, def->name, def->uuid)))
+        goto cleanup;
+
+    if ((tmp->nparams = virTypedParamListSteal(params, &tmp->params)) < 0)
+        goto cleanup;
+
+    *record = tmp;
+    tmp = NULL;
+    ret = 0;
+
+ cleanup:
+    if (tmp) {
+        virObjectUnref(tmp->dom);
+        VIR_FREE(tmp);
+    }
+    virTypedParamListFree(params);
+    return ret;
+}
+
+static int
+testConnectGetAllDomainStats(virConnectPtr conn,
+                             virDomainPtr *doms,
+                             unsigned int ndoms,
+                             unsigned int stats,
+                             virDomainStatsRecordPtr **retStats,
+                             unsigned int flags)
+{
+    testConnPtr privconn = conn->privateData;
+    virDomainPtr *domlist = NULL;
+    virDomainObjPtr dom = NULL;
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    int nstats = 0;
+    size_t i;
+    int ret = -1;
+
+    if (ndoms)
+        virCheckFlags(VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+    else
+        virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                      VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                      VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
+                      VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+
+    if (!stats) {
+        stats = TEST_DOMAIN_STATS_SUPPORTED;
+    } else if (stats & ~TEST_DOMAIN_STATS_SUPPORTED) {
+        if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS) {
+            virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                           _("Stats types bits 0x%x are not supported by this daemon"),
+                           stats & ~TEST_DOMAIN_STATS_SUPPORTED);
+            return -1;
+        }
+        stats &= TEST_DOMAIN_STATS_SUPPORTED;
+    }
+
+    if (!ndoms) {
+        unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                                       VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                                       VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
+        int ntempdoms;
+
+        testDriverLock(privconn);
+        ntempdoms = virDomainObjListExport(privconn->domains, conn,
+                                           &domlist, NULL, lflags);
+        testDriverUnlock(privconn);
+        if (ntempdoms < 0)
+            goto cleanup;
+
+        ndoms = ntempdoms;
+        doms = domlist;
+    }
+
+    if (VIR_ALLOC_N(tmpstats, ndoms + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ndoms; i++) {
+        virDomainStatsRecordPtr tmp = NULL;
+
+        if (!(dom = testDomObjFromDomain(doms[i])))
+            continue;
+
+        if (testDomainGetStats(conn, dom, stats, &tmp) < 0)
+            goto cleanup;
+
+        if (tmp)
+            tmpstats[nstats++] = tmp;
+
+        virObjectUnlock(dom);
+        dom = NULL;
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+
+    ret = nstats;
+
+ cleanup:
+    if (dom)
+        virObjectUnlock(dom);
+    virDomainStatsRecordListFree(tmpstats);
+    virDomainListFree(domlist);
+    return ret;
+}
+
+
 static virNetworkPtr testNetworkLookupByUUID(virConnectPtr conn,
                                              const unsigned char *uuid)
 {
@@ -7338,6 +7753,7 @@ static virHypervisorDriver testHypervisorDriver = {
     .domainSnapshotDelete = testDomainSnapshotDelete, /* 1.1.4 */
 
     .connectBaselineCPU = testConnectBaselineCPU, /* 1.2.0 */
+    .connectGetAllDomainStats = testConnectGetAllDomainStats, /* 1.2.13 */
 };
 
 static virNetworkDriver testNetworkDriver = {
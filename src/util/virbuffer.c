@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include "c-ctype.h"
 
 #define __VIR_BUFFER_C__
@@ -127,6 +128,11 @@ virBufferGrow(virBufferPtr buf, unsigned int len)
 
     size = buf->use + len + 1000;
 
+    /* Grow geometrically, so that building a large document out of
+     * many small pieces does not keep reallocating and copying it */
+    if (buf->size <= INT_MAX / 2 && size < (int) buf->size * 2)
+        size = buf->size * 2;
+
     if (VIR_REALLOC_N_QUIET(buf->content, size) < 0) {
         virBufferSetError(buf, errno);
         return -1;
@@ -381,6 +387,122 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
     buf->use += count;
 }
 
+/* Helpers for looking at eight bytes of a string at once. Each of
+ * them is non-zero iff any byte of @v is zero, equal to @c, or less
+ * than @n (which must not exceed 128) respectively. */
+#define VIR_BUFFER_ONES 0x0101010101010101ULL
+#define VIR_BUFFER_HIGHS 0x8080808080808080ULL
+#define VIR_BUFFER_HAS_ZERO(v) \
+    (((v) - VIR_BUFFER_ONES) & ~(v) & VIR_BUFFER_HIGHS)
+#define VIR_BUFFER_HAS_BYTE(v, c) \
+    VIR_BUFFER_HAS_ZERO((v) ^ (VIR_BUFFER_ONES * (unsigned char) (c)))
+#define VIR_BUFFER_HAS_LESS(v, n) \
+    (((v) - VIR_BUFFER_ONES * (n)) & ~(v) & VIR_BUFFER_HIGHS)
+
+#define VIR_BUFFER_HAS_XML_SPECIAL(v) \
+    (VIR_BUFFER_HAS_BYTE(v, '<') | VIR_BUFFER_HAS_BYTE(v, '>') | \
+     VIR_BUFFER_HAS_BYTE(v, '&') | VIR_BUFFER_HAS_BYTE(v, '"') | \
+     VIR_BUFFER_HAS_BYTE(v, '\''))
+
+typedef struct {
+    const char *str;
+    size_t len;
+} virBufferXMLEntity;
+
+static const virBufferXMLEntity virBufferXMLEntities[256] = {
+    ['<'] = { "&lt;", 4 },
+    ['>'] = { "&gt;", 4 },
+    ['&'] = { "&amp;", 5 },
+    ['"'] = { "&quot;", 6 },
+    ['\''] = { "&apos;", 6 },
+};
+
+static uint64_t
+virBufferLoadWord(const char *str)
+{
+    uint64_t v;
+
+    memcpy(&v, str, sizeof(v));
+    return v;
+}
+
+/* Return whether @str contains any character that has an XML entity */
+static bool
+virBufferHasXMLSpecial(const char *str, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        if (VIR_BUFFER_HAS_XML_SPECIAL(virBufferLoadWord(str + i)))
+            return true;
+    }
+
+    for (; i < len; i++) {
+        if (virBufferXMLEntities[(unsigned char) str[i]].str)
+            return true;
+    }
+
+    return false;
+}
+
+/* Control characters other than whitespace are dropped */
+static bool
+virBufferIsXMLChar(unsigned char c)
+{
+    return c >= 0x20 || c == '\n' || c == '\t' || c == '\r';
+}
+
+static char *
+virBufferXMLEscapeChar(char *out, unsigned char c)
+{
+    if (virBufferXMLEntities[c].str) {
+        memcpy(out, virBufferXMLEntities[c].str, virBufferXMLEntities[c].len);
+        out += virBufferXMLEntities[c].len;
+    } else if (virBufferIsXMLChar(c)) {
+        /*
+         * default case, just copy !
+         * Note that character over 0x80 are likely to give problem
+         * with UTF-8 XML, but since our string don't have an encoding
+         * it's hard to handle properly we have to assume it's UTF-8 too
+         */
+        *out++ = c;
+    }
+
+    return out;
+}
+
+/* Escape @str for XML into @out, which must have room for six times
+ * @len bytes. Words without anything to escape are copied as a whole,
+ * so that long plain runs cost next to nothing. Returns the number of
+ * bytes written. */
+static size_t
+virBufferXMLEscape(char *out, const char *str, size_t len)
+{
+    char *start = out;
+    size_t i = 0;
+
+    while (i + sizeof(uint64_t) <= len) {
+        uint64_t v = virBufferLoadWord(str + i);
+        size_t end = i + sizeof(v);
+
+        if (!VIR_BUFFER_HAS_XML_SPECIAL(v) &&
+            !VIR_BUFFER_HAS_LESS(v, 0x20)) {
+            memcpy(out, str + i, sizeof(v));
+            out += sizeof(v);
+            i = end;
+            continue;
+        }
+
+        for (; i < end; i++)
+            out = virBufferXMLEscapeChar(out, str[i]);
+    }
+
+    for (; i < len; i++)
+        out = virBufferXMLEscapeChar(out, str[i]);
+
+    return out - start;
+}
+
 /**
  * virBufferEscapeString:
  * @buf: the buffer to append to
@@ -395,9 +517,16 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
 void
 virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
 {
-    int len;
-    char *escaped, *out;
-    const char *cur;
+    size_t len;
+    size_t outlen;
+    size_t prefixlen;
+    size_t suffixlen;
+    size_t total;
+    bool escape;
+    const char *spec;
+    char *escaped;
+    char *out;
+    int indent;
 
     if ((format == NULL) || (buf == NULL) || (str == NULL))
         return;
@@ -406,66 +535,65 @@ virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
         return;
 
     len = strlen(str);
-    if (strcspn(str, "<>&'\"") == len) {
-        virBufferAsprintf(buf, format, str);
+    escape = virBufferHasXMLSpecial(str, len);
+
+    /* Anything but a lone %s in @format goes through printf */
+    if (!(spec = strchr(format, '%')) || spec[1] != 's' ||
+        strchr(spec + 2, '%')) {
+        if (!escape) {
+            virBufferAsprintf(buf, format, str);
+            return;
+        }
+
+        if (xalloc_oversized(6, len) ||
+            VIR_ALLOC_N_QUIET(escaped, 6 * len + 1) < 0) {
+            virBufferSetError(buf, errno);
+            return;
+        }
+        escaped[virBufferXMLEscape(escaped, str, len)] = '\0';
+
+        virBufferAsprintf(buf, format, escaped);
+        VIR_FREE(escaped);
         return;
     }
 
-    if (xalloc_oversized(6, len) ||
-        VIR_ALLOC_N_QUIET(escaped, 6 * len + 1) < 0) {
-        virBufferSetError(buf, errno);
+    if ((indent = virBufferGetIndent(buf, true)) < 0)
+        return;
+
+    /* Reserve room for the worst case, and write straight into the
+     * buffer the same way virBufferAsprintf would, that is indenting
+     * only once at the start */
+    if (escape && xalloc_oversized(6, len)) {
+        virBufferSetError(buf, ENOMEM);
         return;
     }
+    outlen = escape ? 6 * len : len;
+    prefixlen = spec - format;
+    suffixlen = strlen(spec + 2);
+    total = indent + prefixlen + outlen + suffixlen;
 
-    cur = str;
-    out = escaped;
-    while (*cur != 0) {
-        if (*cur == '<') {
-            *out++ = '&';
-            *out++ = 'l';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '>') {
-            *out++ = '&';
-            *out++ = 'g';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '&') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'm';
-            *out++ = 'p';
-            *out++ = ';';
-        } else if (*cur == '"') {
-            *out++ = '&';
-            *out++ = 'q';
-            *out++ = 'u';
-            *out++ = 'o';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '\'') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'p';
-            *out++ = 'o';
-            *out++ = 's';
-            *out++ = ';';
-        } else if (((unsigned char)*cur >= 0x20) || (*cur == '\n') || (*cur == '\t') ||
-                   (*cur == '\r')) {
-            /*
-             * default case, just copy !
-             * Note that character over 0x80 are likely to give problem
-             * with UTF-8 XML, but since our string don't have an encoding
-             * it's hard to handle properly we have to assume it's UTF-8 too
-             */
-            *out++ = *cur;
-        }
-        cur++;
+    if (total < outlen || total >= INT_MAX - 1000 - buf->use) {
+        virBufferSetError(buf, ENOMEM);
+        return;
     }
-    *out = 0;
 
-    virBufferAsprintf(buf, format, escaped);
-    VIR_FREE(escaped);
+    if (virBufferGrow(buf, total + 1) < 0)
+        return;
+
+    out = buf->content + buf->use;
+    memset(out, ' ', indent);
+    out += indent;
+    memcpy(out, format, prefixlen);
+    out += prefixlen;
+    if (escape) {
+        out += virBufferXMLEscape(out, str, len);
+    } else {
+        memcpy(out, str, len);
+        out += len;
+    }
+    memcpy(out, spec + 2, suffixlen + 1);
+
+    buf->use = out + suffixlen - buf->content;
 }
 
 /**
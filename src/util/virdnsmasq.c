@@ -28,6 +28,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <dirent.h>
 #include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -42,6 +43,7 @@
 #include "internal.h"
 #include "datatypes.h"
 #include "virbitmap.h"
+#include "vircrypto.h"
 #include "virdnsmasq.h"
 #include "virutil.h"
 #include "vircommand.h"
@@ -49,6 +51,7 @@
 #include "virerror.h"
 #include "virlog.h"
 #include "virfile.h"
+#include "virhash.h"
 #include "virstring.h"
 
 #define VIR_FROM_THIS VIR_FROM_NETWORK
@@ -56,6 +59,7 @@
 VIR_LOG_INIT("util.dnsmasq");
 
 #define DNSMASQ_HOSTSFILE_SUFFIX "hostsfile"
+#define DNSMASQ_HOSTSDIR_SUFFIX "hostsdir"
 #define DNSMASQ_ADDNHOSTSFILE_SUFFIX "addnhosts"
 
 static void
@@ -291,6 +295,7 @@ hostsfileFree(dnsmasqHostsfile *hostsfile)
     }
 
     VIR_FREE(hostsfile->path);
+    VIR_FREE(hostsfile->dir);
 
     VIR_FREE(hostsfile);
 }
@@ -307,7 +312,8 @@ hostsfileAdd(dnsmasqHostsfile *hostsfile,
              bool ipv6)
 {
     char *ipstr = NULL;
-    if (VIR_REALLOC_N(hostsfile->hosts, hostsfile->nhosts + 1) < 0)
+    if (VIR_RESIZE_N(hostsfile->hosts, hostsfile->nhosts_max,
+                     hostsfile->nhosts, 1) < 0)
         goto error;
 
     if (!(ipstr = virSocketAddrFormat(ip)))
@@ -367,6 +373,13 @@ hostsfileNew(const char *name,
     if (virAsprintf(&hostsfile->path, "%s/%s.%s", config_dir, name,
                     DNSMASQ_HOSTSFILE_SUFFIX) < 0)
         goto error;
+    if (virAsprintf(&hostsfile->dir, "%s/%s.%s", config_dir, name,
+                    DNSMASQ_HOSTSDIR_SUFFIX) < 0)
+        goto error;
+
+    /* Keep using the directory if a running dnsmasq has been told to
+     * read it; the caller decides when generating a new config. */
+    hostsfile->useDir = virFileIsDir(hostsfile->dir);
 
     return hostsfile;
 
@@ -378,7 +391,7 @@ hostsfileNew(const char *name,
 static int
 hostsfileWrite(const char *path,
                dnsmasqDhcpHost *hosts,
-               unsigned int nhosts)
+               size_t nhosts)
 {
     char *tmp;
     FILE *f;
@@ -430,11 +443,141 @@ hostsfileWrite(const char *path,
     return rc;
 }
 
+/*
+ * hostsdirSave:
+ *
+ * Bring the dhcp-hostsdir in line with @hostsfile. Each entry lives in
+ * a file named after the SHA-256 of its contents, so entries already
+ * present are left alone and only new ones are written. dnsmasq picks
+ * up new files by itself, but only forgets removed ones on SIGHUP, so
+ * @removed is set to true if any file was deleted.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+hostsdirSave(dnsmasqHostsfile *hostsfile,
+             bool *removed)
+{
+    virHashTablePtr pending = NULL;
+    char **names = NULL;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    char *path = NULL;
+    char *tmp = NULL;
+    char *content = NULL;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    *removed = false;
+
+    if (virFileMakePath(hostsfile->dir) < 0) {
+        virReportSystemError(errno, _("cannot create config directory '%s'"),
+                             hostsfile->dir);
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(names, hostsfile->nhosts) < 0 ||
+        !(pending = virHashCreate(hostsfile->nhosts, NULL)))
+        goto cleanup;
+
+    for (i = 0; i < hostsfile->nhosts; i++) {
+        if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256,
+                                hostsfile->hosts[i].host, &names[i]) < 0)
+            goto cleanup;
+        if (!virHashLookup(pending, names[i]) &&
+            virHashAddEntry(pending, names[i], &hostsfile->hosts[i]) < 0)
+            goto cleanup;
+    }
+
+    if (!(dir = opendir(hostsfile->dir))) {
+        virReportSystemError(errno, _("cannot open directory '%s'"),
+                             hostsfile->dir);
+        goto cleanup;
+    }
+
+    while ((rc = virDirRead(dir, &ent, hostsfile->dir)) > 0) {
+        /* dnsmasq ignores dot files, which we use for writing */
+        if (ent->d_name[0] == '.')
+            continue;
+
+        if (virHashLookup(pending, ent->d_name)) {
+            ignore_value(virHashRemoveEntry(pending, ent->d_name));
+            continue;
+        }
+
+        if (virAsprintf(&path, "%s/%s", hostsfile->dir, ent->d_name) < 0)
+            goto cleanup;
+        if (unlink(path) < 0 && errno != ENOENT) {
+            virReportSystemError(errno, _("cannot remove config file '%s'"),
+                                 path);
+            goto cleanup;
+        }
+        VIR_FREE(path);
+        *removed = true;
+    }
+    if (rc < 0)
+        goto cleanup;
+
+    for (i = 0; i < hostsfile->nhosts; i++) {
+        dnsmasqDhcpHost *host = virHashLookup(pending, names[i]);
+
+        if (!host)
+            continue;
+
+        /* write under a hidden name and rename it into place, so that
+         * dnsmasq never sees a partial entry */
+        if (virAsprintf(&path, "%s/%s", hostsfile->dir, names[i]) < 0 ||
+            virAsprintf(&tmp, "%s/.%s.new", hostsfile->dir, names[i]) < 0 ||
+            virAsprintf(&content, "%s\n", host->host) < 0)
+            goto cleanup;
+
+        if (virFileWriteStr(tmp, content, 0644) < 0 ||
+            rename(tmp, path) < 0) {
+            virReportSystemError(errno, _("cannot write config file '%s'"),
+                                 path);
+            unlink(tmp);
+            goto cleanup;
+        }
+
+        ignore_value(virHashRemoveEntry(pending, names[i]));
+        VIR_FREE(path);
+        VIR_FREE(tmp);
+        VIR_FREE(content);
+    }
+
+    ret = 0;
+ cleanup:
+    if (dir)
+        closedir(dir);
+    virHashFree(pending);
+    if (names) {
+        for (i = 0; i < hostsfile->nhosts; i++)
+            VIR_FREE(names[i]);
+        VIR_FREE(names);
+    }
+    VIR_FREE(path);
+    VIR_FREE(tmp);
+    VIR_FREE(content);
+    return ret;
+}
+
 static int
-hostsfileSave(dnsmasqHostsfile *hostsfile)
+hostsfileSave(dnsmasqHostsfile *hostsfile,
+              bool *reload)
 {
-    int err = hostsfileWrite(hostsfile->path, hostsfile->hosts,
-                             hostsfile->nhosts);
+    int err;
+
+    if (hostsfile->useDir) {
+        if (hostsdirSave(hostsfile, reload) < 0)
+            return -1;
+        if (unlink(hostsfile->path) < 0 && errno != ENOENT)
+            VIR_WARN("cannot remove stale file '%s'", hostsfile->path);
+        return 0;
+    }
+
+    err = hostsfileWrite(hostsfile->path, hostsfile->hosts,
+                         hostsfile->nhosts);
 
     if (err < 0) {
         virReportSystemError(-err, _("cannot write config file '%s'"),
@@ -442,6 +585,11 @@ hostsfileSave(dnsmasqHostsfile *hostsfile)
         return -1;
     }
 
+    if (virFileIsDir(hostsfile->dir) &&
+        virFileDeleteTree(hostsfile->dir) < 0)
+        return -1;
+
+    *reload = true;
     return 0;
 }
 
@@ -535,6 +683,46 @@ dnsmasqAddHost(dnsmasqContext *ctx,
     return addnhostsAdd(ctx->addnhostsfile, ip, name);
 }
 
+/**
+ * dnsmasqSetDhcpHostsdir:
+ * @ctx: pointer to the dnsmasq context for each network
+ * @enable: whether dnsmasq reads dhcp-host entries from a directory
+ *
+ * Select whether dhcp-host entries are saved into the dhcp-hostsdir,
+ * one file per entry, or into the dhcp-hostsfile. By default a context
+ * uses the directory if it already exists.
+ */
+void
+dnsmasqSetDhcpHostsdir(dnsmasqContext *ctx,
+                       bool enable)
+{
+    ctx->hostsfile->useDir = enable;
+}
+
+/**
+ * dnsmasqSaveDhcpHosts:
+ * @ctx: pointer to the dnsmasq context for each network
+ * @reload: set to true if dnsmasq needs a SIGHUP to see the changes
+ *
+ * Saves only the dhcp-host entries of a context to disk. When they go
+ * to a dhcp-hostsdir only new and removed entries touch the disk, and
+ * dnsmasq only needs to be told about removed ones.
+ */
+int
+dnsmasqSaveDhcpHosts(const dnsmasqContext *ctx,
+                     bool *reload)
+{
+    *reload = false;
+
+    if (virFileMakePath(ctx->config_dir) < 0) {
+        virReportSystemError(errno, _("cannot create config directory '%s'"),
+                             ctx->config_dir);
+        return -1;
+    }
+
+    return hostsfileSave(ctx->hostsfile, reload);
+}
+
 /**
  * dnsmasqSave:
  * @ctx: pointer to the dnsmasq context for each network
@@ -545,6 +733,7 @@ int
 dnsmasqSave(const dnsmasqContext *ctx)
 {
     int ret = 0;
+    bool reload;
 
     if (virFileMakePath(ctx->config_dir) < 0) {
         virReportSystemError(errno, _("cannot create config directory '%s'"),
@@ -553,7 +742,7 @@ dnsmasqSave(const dnsmasqContext *ctx)
     }
 
     if (ctx->hostsfile)
-        ret = hostsfileSave(ctx->hostsfile);
+        ret = hostsfileSave(ctx->hostsfile, &reload);
     if (ret == 0) {
         if (ctx->addnhostsfile)
             ret = addnhostsSave(ctx->addnhostsfile);
@@ -574,10 +763,16 @@ dnsmasqDelete(const dnsmasqContext *ctx)
 {
     int ret = 0;
 
-    if (ctx->hostsfile)
-        ret = genericFileDelete(ctx->hostsfile->path);
-    if (ctx->addnhostsfile)
-        ret = genericFileDelete(ctx->addnhostsfile->path);
+    if (ctx->hostsfile) {
+        if (genericFileDelete(ctx->hostsfile->path) < 0)
+            ret = -1;
+        if (virFileIsDir(ctx->hostsfile->dir) &&
+            virFileDeleteTree(ctx->hostsfile->dir) < 0)
+            ret = -1;
+    }
+    if (ctx->addnhostsfile &&
+        genericFileDelete(ctx->addnhostsfile->path) < 0)
+        ret = -1;
 
     return ret;
 }
@@ -677,6 +872,9 @@ dnsmasqCapsSetFromBuffer(dnsmasqCapsPtr caps, const char *buf)
     if (strstr(buf, "--bind-interfaces with SO_BINDTODEVICE"))
         dnsmasqCapsSet(caps, DNSMASQ_CAPS_BINDTODEVICE);
 
+    if (strstr(buf, "--dhcp-hostsdir"))
+        dnsmasqCapsSet(caps, DNSMASQ_CAPS_DHCP_HOSTSDIR);
+
     VIR_INFO("dnsmasq version is %d.%d, --bind-dynamic is %spresent, "
              "SO_BINDTODEVICE is %sin use",
              (int)caps->version / 1000000,
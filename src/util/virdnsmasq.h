@@ -39,10 +39,14 @@ typedef struct
 
 typedef struct
 {
-    unsigned int     nhosts;
+    size_t           nhosts;
+    size_t           nhosts_max;
     dnsmasqDhcpHost *hosts;
 
     char            *path;  /* Absolute path of dnsmasq's hostsfile. */
+    char            *dir;   /* Absolute path of dnsmasq's dhcp-hostsdir. */
+    bool             useDir; /* Save one file per host into @dir instead
+                              * of writing @path. */
 } dnsmasqHostsfile;
 
 typedef struct
@@ -71,6 +75,7 @@ typedef struct
 typedef enum {
    DNSMASQ_CAPS_BIND_DYNAMIC = 0, /* support for --bind-dynamic */
    DNSMASQ_CAPS_BINDTODEVICE = 1, /* uses SO_BINDTODEVICE for --bind-interfaces */
+   DNSMASQ_CAPS_DHCP_HOSTSDIR = 2, /* support for --dhcp-hostsdir */
 
    DNSMASQ_CAPS_LAST,             /* this must always be the last item */
 } dnsmasqCapsFlags;
@@ -91,7 +96,11 @@ int              dnsmasqAddDhcpHost(dnsmasqContext *ctx,
 int              dnsmasqAddHost(dnsmasqContext *ctx,
                                 virSocketAddr *ip,
                                 const char *name);
+void             dnsmasqSetDhcpHostsdir(dnsmasqContext *ctx,
+                                        bool enable);
 int              dnsmasqSave(const dnsmasqContext *ctx);
+int              dnsmasqSaveDhcpHosts(const dnsmasqContext *ctx,
+                                      bool *reload);
 int              dnsmasqDelete(const dnsmasqContext *ctx);
 int              dnsmasqReload(pid_t pid);
 
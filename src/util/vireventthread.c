@@ -0,0 +1,481 @@
+/*
+ * vireventthread.c: file handle event loop running in its own thread
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vireventthread.h"
+#include "vireventpoll.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virobject.h"
+#include "virstring.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_EVENT
+
+VIR_LOG_INIT("util.eventthread");
+
+typedef struct _virEventThreadHandle virEventThreadHandle;
+typedef virEventThreadHandle *virEventThreadHandlePtr;
+struct _virEventThreadHandle {
+    int watch;
+    int fd;
+    int events;     /* native poll() events */
+    virEventHandleCallback cb;
+    virFreeCallback ff;
+    void *opaque;
+    bool deleted;
+};
+
+/*
+ * A minimal event loop serving only file handles, for subsystems
+ * which want to keep their I/O off the main event loop. Unlike the
+ * main loop the handles live in the object, so any number of these
+ * loops can run side by side.
+ *
+ * The loop thread holds a reference on the object until it was told
+ * to stop by virEventThreadStop(), so that callbacks dropping the
+ * last reference of whatever they serve can never dispose of the
+ * loop underneath itself. Whatever is still registered when the
+ * thread exits is released right away: the objects served commonly
+ * hold a reference on the loop themselves, so waiting for the last
+ * reference to go away would keep both of them alive forever.
+ */
+struct _virEventThread {
+    virObjectLockable parent;
+
+    char *name;
+    int wakeupfd[2];
+    bool quit;
+
+    virEventThreadHandlePtr handles;
+    size_t nhandles;
+    int nextWatch;
+
+    virEventThreadStats stats;
+};
+
+static virClassPtr virEventThreadClass;
+static void virEventThreadDispose(void *obj);
+
+static int virEventThreadOnceInit(void)
+{
+    if (!(virEventThreadClass = virClassNew(virClassForObjectLockable(),
+                                            "virEventThread",
+                                            sizeof(virEventThread),
+                                            virEventThreadDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virEventThread)
+
+
+static unsigned long long
+virEventThreadNowUS(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+
+/* Called with @thr locked */
+static void
+virEventThreadInterruptLocked(virEventThreadPtr thr)
+{
+    char c = '\0';
+
+    if (safewrite(thr->wakeupfd[1], &c, sizeof(c)) != sizeof(c) &&
+        errno != EAGAIN)
+        VIR_WARN("Unable to wake up event thread %s", thr->name);
+}
+
+
+/* Called with @thr locked, returns with @thr unlocked. Frees handles
+ * marked for deletion, running their free callbacks without holding
+ * the lock as those may well call back into us. */
+static void
+virEventThreadCleanupUnlock(virEventThreadPtr thr)
+{
+    virEventThreadHandlePtr gone = NULL;
+    size_t ngone = 0;
+    size_t i = 0;
+
+    while (i < thr->nhandles) {
+        virEventThreadHandle handle = thr->handles[i];
+
+        if (!handle.deleted) {
+            i++;
+            continue;
+        }
+
+        VIR_DELETE_ELEMENT_INPLACE(thr->handles, i, thr->nhandles);
+        if (handle.ff &&
+            VIR_APPEND_ELEMENT_QUIET(gone, ngone, handle) < 0) {
+            /* Better to call it with the lock held than to leak it */
+            handle.ff(handle.opaque);
+        }
+    }
+    thr->stats.handles = thr->nhandles;
+
+    virObjectUnlock(thr);
+
+    for (i = 0; i < ngone; i++)
+        gone[i].ff(gone[i].opaque);
+    VIR_FREE(gone);
+}
+
+
+static void
+virEventThreadRun(void *opaque)
+{
+    virEventThreadPtr thr = opaque;
+    struct pollfd *fds = NULL;
+    int *watches = NULL;
+    size_t nfds = 0;
+    size_t i, n;
+
+    virObjectLock(thr);
+
+    while (!thr->quit) {
+        size_t ready = 0;
+        char buf[64];
+        int rc;
+
+        if (VIR_RESIZE_N(fds, nfds, 0, thr->nhandles + 1) < 0 ||
+            VIR_REALLOC_N(watches, nfds) < 0) {
+            virObjectUnlock(thr);
+            usleep(100 * 1000);
+            virObjectLock(thr);
+            continue;
+        }
+
+        fds[0].fd = thr->wakeupfd[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        for (i = 0, n = 1; i < thr->nhandles; i++) {
+            if (!thr->handles[i].events || thr->handles[i].deleted)
+                continue;
+            fds[n].fd = thr->handles[i].fd;
+            fds[n].events = thr->handles[i].events;
+            fds[n].revents = 0;
+            watches[n] = thr->handles[i].watch;
+            n++;
+        }
+
+        virObjectUnlock(thr);
+        rc = poll(fds, n, -1);
+        virObjectLock(thr);
+
+        if (rc < 0) {
+            if (errno != EINTR && errno != EAGAIN) {
+                VIR_WARN("poll() failed in event thread %s: %s",
+                         thr->name, strerror(errno));
+            }
+            continue;
+        }
+
+        /* Anything left over just wakes us up once more */
+        if (fds[0].revents)
+            ignore_value(read(thr->wakeupfd[0], buf, sizeof(buf)));
+
+        for (i = 1; i < n; i++) {
+            virEventThreadHandlePtr handle = NULL;
+            virEventHandleCallback cb;
+            void *cbopaque;
+            unsigned long long start, took;
+            size_t j;
+
+            if (!fds[i].revents || thr->quit)
+                continue;
+
+            /* The array may have changed while the lock was dropped */
+            for (j = 0; j < thr->nhandles; j++) {
+                if (thr->handles[j].watch == watches[i]) {
+                    handle = &thr->handles[j];
+                    break;
+                }
+            }
+            if (!handle || handle->deleted)
+                continue;
+
+            cb = handle->cb;
+            cbopaque = handle->opaque;
+            ready++;
+
+            virObjectUnlock(thr);
+            start = virEventThreadNowUS();
+            cb(watches[i], fds[i].fd,
+               virEventPollFromNativeEvents(fds[i].revents), cbopaque);
+            took = virEventThreadNowUS() - start;
+            virObjectLock(thr);
+
+            thr->stats.dispatches++;
+            thr->stats.busyTime += took;
+            if (took > thr->stats.dispatchMax)
+                thr->stats.dispatchMax = took;
+        }
+
+        if (ready) {
+            thr->stats.wakeups++;
+            if (ready > thr->stats.readyMax)
+                thr->stats.readyMax = ready;
+        }
+
+        virEventThreadCleanupUnlock(thr);
+        virObjectLock(thr);
+    }
+
+    VIR_DEBUG("Event thread %s exiting", thr->name);
+    for (i = 0; i < thr->nhandles; i++)
+        thr->handles[i].deleted = true;
+    virEventThreadCleanupUnlock(thr);
+
+    VIR_FREE(fds);
+    VIR_FREE(watches);
+    virObjectUnref(thr);
+}
+
+
+/**
+ * virEventThreadNew:
+ * @name: name of the loop, used for logging only
+ *
+ * Creates a new event loop for file handles and starts a thread
+ * running it. The loop keeps running until virEventThreadStop() is
+ * called.
+ *
+ * Returns the new loop, or NULL on error.
+ */
+virEventThreadPtr
+virEventThreadNew(const char *name)
+{
+    virEventThreadPtr thr;
+    virThread thread;
+
+    if (virEventThreadInitialize() < 0)
+        return NULL;
+
+    if (!(thr = virObjectLockableNew(virEventThreadClass)))
+        return NULL;
+
+    thr->wakeupfd[0] = thr->wakeupfd[1] = -1;
+    thr->quit = true;
+
+    if (VIR_STRDUP(thr->name, name) < 0)
+        goto error;
+
+    if (pipe2(thr->wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to setup wakeup pipe"));
+        goto error;
+    }
+
+    thr->quit = false;
+    virObjectRef(thr);
+    if (virThreadCreate(&thread, false, virEventThreadRun, thr) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to create event thread %s"), name);
+        thr->quit = true;
+        virObjectUnref(thr);
+        goto error;
+    }
+
+    return thr;
+
+ error:
+    virObjectUnref(thr);
+    return NULL;
+}
+
+
+/**
+ * virEventThreadStop:
+ * @thr: the event loop
+ *
+ * Tells the loop thread to finish. Handles still registered are no
+ * longer served and are released by the loop thread on its way out,
+ * asynchronously to this call.
+ */
+void
+virEventThreadStop(virEventThreadPtr thr)
+{
+    virObjectLock(thr);
+    if (!thr->quit) {
+        thr->quit = true;
+        virEventThreadInterruptLocked(thr);
+    }
+    virObjectUnlock(thr);
+}
+
+
+static void
+virEventThreadDispose(void *obj)
+{
+    virEventThreadPtr thr = obj;
+    size_t i;
+
+    for (i = 0; i < thr->nhandles; i++) {
+        if (thr->handles[i].ff)
+            thr->handles[i].ff(thr->handles[i].opaque);
+    }
+    VIR_FREE(thr->handles);
+
+    VIR_FORCE_CLOSE(thr->wakeupfd[0]);
+    VIR_FORCE_CLOSE(thr->wakeupfd[1]);
+    VIR_FREE(thr->name);
+}
+
+
+/**
+ * virEventThreadAddHandle:
+ * @thr: the event loop
+ * @fd: file descriptor to watch
+ * @events: bitset of VIR_EVENT_HANDLE_* to watch for
+ * @cb: callback to invoke from the loop thread when @fd is ready
+ * @opaque: data for @cb
+ * @ff: callback to free @opaque once the handle was removed, or NULL
+ *
+ * Works just like virEventAddHandle(), except that @cb runs in the
+ * thread of @thr. The watch returned is only meaningful for @thr.
+ *
+ * Returns the watch number, or -1 on error.
+ */
+int
+virEventThreadAddHandle(virEventThreadPtr thr,
+                        int fd,
+                        int events,
+                        virEventHandleCallback cb,
+                        void *opaque,
+                        virFreeCallback ff)
+{
+    virEventThreadHandle handle = {
+        .fd = fd,
+        .events = virEventPollToNativeEvents(events),
+        .cb = cb,
+        .ff = ff,
+        .opaque = opaque,
+    };
+    int ret = -1;
+
+    virObjectLock(thr);
+
+    if (thr->quit) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("event thread %s is not running"), thr->name);
+        goto cleanup;
+    }
+
+    handle.watch = ++thr->nextWatch;
+    if (VIR_APPEND_ELEMENT(thr->handles, thr->nhandles, handle) < 0)
+        goto cleanup;
+    thr->stats.handles = thr->nhandles;
+
+    ret = thr->nextWatch;
+    virEventThreadInterruptLocked(thr);
+
+ cleanup:
+    virObjectUnlock(thr);
+    return ret;
+}
+
+
+void
+virEventThreadUpdateHandle(virEventThreadPtr thr,
+                           int watch,
+                           int events)
+{
+    bool found = false;
+    size_t i;
+
+    virObjectLock(thr);
+    for (i = 0; i < thr->nhandles; i++) {
+        if (thr->handles[i].watch == watch && !thr->handles[i].deleted) {
+            int native = virEventPollToNativeEvents(events);
+
+            if (thr->handles[i].events != native) {
+                thr->handles[i].events = native;
+                virEventThreadInterruptLocked(thr);
+            }
+            found = true;
+            break;
+        }
+    }
+    virObjectUnlock(thr);
+
+    if (!found)
+        VIR_WARN("Got update for non-existent handle watch %d", watch);
+}
+
+
+/*
+ * Like virEventRemoveHandle() this is safe to call from within a
+ * callback: the handle is only flagged here and freed by the loop.
+ */
+int
+virEventThreadRemoveHandle(virEventThreadPtr thr,
+                           int watch)
+{
+    size_t i;
+    int ret = -1;
+
+    virObjectLock(thr);
+    for (i = 0; i < thr->nhandles; i++) {
+        if (thr->handles[i].watch == watch && !thr->handles[i].deleted) {
+            thr->handles[i].deleted = true;
+            virEventThreadInterruptLocked(thr);
+            ret = 0;
+            break;
+        }
+    }
+    virObjectUnlock(thr);
+
+    return ret;
+}
+
+
+const char *
+virEventThreadGetName(virEventThreadPtr thr)
+{
+    return thr->name;
+}
+
+
+void
+virEventThreadGetStats(virEventThreadPtr thr,
+                       virEventThreadStatsPtr stats)
+{
+    virObjectLock(thr);
+    *stats = thr->stats;
+    virObjectUnlock(thr);
+}
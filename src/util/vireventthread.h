@@ -0,0 +1,71 @@
+/*
+ * vireventthread.h: file handle event loop running in its own thread
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_EVENT_THREAD_H__
+# define __VIR_EVENT_THREAD_H__
+
+# include "internal.h"
+
+typedef struct _virEventThread virEventThread;
+typedef virEventThread *virEventThreadPtr;
+
+typedef struct _virEventThreadStats virEventThreadStats;
+typedef virEventThreadStats *virEventThreadStatsPtr;
+struct _virEventThreadStats {
+    size_t handles;                  /* file handles being watched */
+    unsigned long long wakeups;      /* poll() returns with work to do */
+    unsigned long long dispatches;   /* handle callbacks invoked */
+    size_t readyMax;                 /* most handles ready at once */
+    unsigned long long busyTime;     /* time spent in callbacks, in us */
+    unsigned long long dispatchMax;  /* longest callback, in us */
+};
+
+virEventThreadPtr virEventThreadNew(const char *name)
+    ATTRIBUTE_NONNULL(1);
+
+void virEventThreadStop(virEventThreadPtr thr)
+    ATTRIBUTE_NONNULL(1);
+
+int virEventThreadAddHandle(virEventThreadPtr thr,
+                            int fd,
+                            int events,
+                            virEventHandleCallback cb,
+                            void *opaque,
+                            virFreeCallback ff)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(4);
+
+void virEventThreadUpdateHandle(virEventThreadPtr thr,
+                                int watch,
+                                int events)
+    ATTRIBUTE_NONNULL(1);
+
+int virEventThreadRemoveHandle(virEventThreadPtr thr,
+                               int watch)
+    ATTRIBUTE_NONNULL(1);
+
+const char *virEventThreadGetName(virEventThreadPtr thr)
+    ATTRIBUTE_NONNULL(1);
+
+void virEventThreadGetStats(virEventThreadPtr thr,
+                            virEventThreadStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+#endif /* __VIR_EVENT_THREAD_H__ */
@@ -0,0 +1,660 @@
+/*
+ * virfilewipe.c: extent aware zeroing of files and block devices
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+#endif
+
+#include "virfilewipe.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virlog.h"
+#include "virthread.h"
+#include "virtime.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("util.filewipe");
+
+/* Unit of work handed to a worker thread. Large enough for the
+ * kernel to do useful work per ioctl, small enough to balance
+ * the load and to report progress at a sensible granularity */
+#define VIR_FILE_WIPE_CHUNK (64ULL * 1024 * 1024)
+
+#define VIR_FILE_WIPE_WORKERS_DEFAULT 4
+#define VIR_FILE_WIPE_WORKERS_MAX 32
+#define VIR_FILE_WIPE_BUFSIZE_DEFAULT (1024 * 1024)
+
+/* How often in milliseconds the progress callback is invoked */
+#define VIR_FILE_WIPE_PROGRESS_INTERVAL 1000
+
+/* Ordered from fastest to slowest; whenever a primitive turns
+ * out to be unsupported the job moves on to the next one that
+ * gives the same guarantees, eventually ending up writing */
+typedef enum {
+    VIR_FILE_WIPE_METHOD_DISCARD,
+    VIR_FILE_WIPE_METHOD_ZEROOUT,
+    VIR_FILE_WIPE_METHOD_PUNCH,
+    VIR_FILE_WIPE_METHOD_ZERO_RANGE,
+    VIR_FILE_WIPE_METHOD_WRITE,
+
+    VIR_FILE_WIPE_METHOD_LAST
+} virFileWipeMethod;
+
+VIR_ENUM_DECL(virFileWipeMethod)
+VIR_ENUM_IMPL(virFileWipeMethod, VIR_FILE_WIPE_METHOD_LAST,
+              "discard", "zeroout", "punch", "zero-range", "write")
+
+typedef struct _virFileWipeChunk virFileWipeChunk;
+typedef virFileWipeChunk *virFileWipeChunkPtr;
+struct _virFileWipeChunk {
+    off_t offset;
+    off_t length;
+};
+
+typedef struct _virFileWipeJob virFileWipeJob;
+typedef virFileWipeJob *virFileWipeJobPtr;
+struct _virFileWipeJob {
+    int fd;
+    const char *path;
+    off_t align;                /* granularity of the offloaded ops */
+
+    char *buf;                  /* zeroes, shared by all workers */
+    size_t bufsize;
+
+    unsigned long long bandwidth;
+    unsigned long long start;   /* in milliseconds */
+
+    /* Everything below is protected by @lock */
+    virMutex lock;
+    virCond cond;
+
+    virFileWipeMethod method;
+    virFileWipeChunkPtr chunks;
+    size_t nchunks;
+    size_t next;
+    size_t nrunning;
+
+    unsigned long long throttled;
+    unsigned long long done;
+    virFileWipeStats stats;
+
+    int err;
+    off_t erroffset;
+    virFileWipeMethod errmethod;
+};
+
+
+static bool
+virFileWipeIsUnsupported(int err)
+{
+    return err == EOPNOTSUPP || err == ENOTSUP || err == ENOTTY ||
+        err == ENOSYS || err == EINVAL;
+}
+
+
+static int
+virFileWipeOffload(int fd,
+                   virFileWipeMethod method,
+                   off_t offset,
+                   off_t length)
+{
+#if defined(BLKDISCARD) || defined(BLKZEROOUT)
+    uint64_t range[2] = { offset, length };
+#endif
+
+    switch (method) {
+    case VIR_FILE_WIPE_METHOD_DISCARD:
+#ifdef BLKDISCARD
+        return ioctl(fd, BLKDISCARD, range);
+#else
+        break;
+#endif
+
+    case VIR_FILE_WIPE_METHOD_ZEROOUT:
+#ifdef BLKZEROOUT
+        return ioctl(fd, BLKZEROOUT, range);
+#else
+        break;
+#endif
+
+    case VIR_FILE_WIPE_METHOD_PUNCH:
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+        return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                         offset, length);
+#else
+        break;
+#endif
+
+    case VIR_FILE_WIPE_METHOD_ZERO_RANGE:
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_ZERO_RANGE)
+        return fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+                         offset, length);
+#else
+        break;
+#endif
+
+    case VIR_FILE_WIPE_METHOD_WRITE:
+    case VIR_FILE_WIPE_METHOD_LAST:
+        break;
+    }
+
+    errno = ENOSYS;
+    return -1;
+}
+
+
+static void
+virFileWipeAccount(virFileWipeJobPtr job,
+                   virFileWipeMethod method,
+                   unsigned long long bytes)
+{
+    virMutexLock(&job->lock);
+    switch (method) {
+    case VIR_FILE_WIPE_METHOD_DISCARD:
+    case VIR_FILE_WIPE_METHOD_PUNCH:
+        job->stats.discarded += bytes;
+        break;
+    case VIR_FILE_WIPE_METHOD_ZEROOUT:
+    case VIR_FILE_WIPE_METHOD_ZERO_RANGE:
+        job->stats.zeroed += bytes;
+        break;
+    case VIR_FILE_WIPE_METHOD_WRITE:
+    case VIR_FILE_WIPE_METHOD_LAST:
+        job->stats.written += bytes;
+        break;
+    }
+    job->done += bytes;
+    virMutexUnlock(&job->lock);
+}
+
+
+/* Keep the aggregate rate of all workers below the configured
+ * bandwidth by delaying each request until the point in time at
+ * which it would have been issued at exactly that rate */
+static void
+virFileWipeThrottle(virFileWipeJobPtr job,
+                    unsigned long long bytes)
+{
+    unsigned long long due;
+    unsigned long long now;
+
+    if (!job->bandwidth)
+        return;
+
+    virMutexLock(&job->lock);
+    due = job->start + job->throttled * 1000 / job->bandwidth;
+    job->throttled += bytes;
+    virMutexUnlock(&job->lock);
+
+    if (virTimeMillisNow(&now) < 0)
+        return;
+
+    if (due > now)
+        usleep((due - now) * 1000);
+}
+
+
+static int
+virFileWipeWrite(virFileWipeJobPtr job,
+                 off_t offset,
+                 off_t length)
+{
+    while (length > 0) {
+        size_t len = MIN(job->bufsize, length);
+        ssize_t written;
+
+        virFileWipeThrottle(job, len);
+
+        if ((written = pwrite(job->fd, job->buf, len, offset)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (written == 0) {
+            errno = ENOSPC;
+            return -1;
+        }
+
+        virFileWipeAccount(job, VIR_FILE_WIPE_METHOD_WRITE, written);
+        offset += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+
+static int
+virFileWipeRunChunk(virFileWipeJobPtr job,
+                    virFileWipeChunkPtr chunk,
+                    virFileWipeMethod *method)
+{
+    off_t end = chunk->offset + chunk->length;
+    off_t head;
+    off_t tail;
+
+ retry:
+    virMutexLock(&job->lock);
+    *method = job->method;
+    virMutexUnlock(&job->lock);
+
+    if (*method == VIR_FILE_WIPE_METHOD_WRITE)
+        return virFileWipeWrite(job, chunk->offset, chunk->length);
+
+    /* The block layer insists on sector aligned requests, the
+     * unaligned head and tail are simply overwritten */
+    head = VIR_ROUND_UP(chunk->offset, job->align);
+    tail = end - end % job->align;
+
+    if (head >= tail)
+        return virFileWipeWrite(job, chunk->offset, chunk->length);
+
+    /* BLKDISCARD and hole punching do not cause any writes */
+    if (*method == VIR_FILE_WIPE_METHOD_ZEROOUT)
+        virFileWipeThrottle(job, tail - head);
+
+    if (virFileWipeOffload(job->fd, *method, head, tail - head) < 0) {
+        int err = errno;
+
+        if (!virFileWipeIsUnsupported(err))
+            return -1;
+
+        virMutexLock(&job->lock);
+        if (job->method == *method) {
+            VIR_DEBUG("Cannot wipe '%s' using %s (errno=%d), falling back",
+                      job->path, virFileWipeMethodTypeToString(*method), err);
+            switch (job->method) {
+            case VIR_FILE_WIPE_METHOD_DISCARD:
+                job->method = VIR_FILE_WIPE_METHOD_ZEROOUT;
+                break;
+            case VIR_FILE_WIPE_METHOD_PUNCH:
+                job->method = VIR_FILE_WIPE_METHOD_ZERO_RANGE;
+                break;
+            case VIR_FILE_WIPE_METHOD_ZEROOUT:
+            case VIR_FILE_WIPE_METHOD_ZERO_RANGE:
+            case VIR_FILE_WIPE_METHOD_WRITE:
+            case VIR_FILE_WIPE_METHOD_LAST:
+                job->method = VIR_FILE_WIPE_METHOD_WRITE;
+                break;
+            }
+        }
+        virMutexUnlock(&job->lock);
+        goto retry;
+    }
+    virFileWipeAccount(job, *method, tail - head);
+
+    *method = VIR_FILE_WIPE_METHOD_WRITE;
+    if (virFileWipeWrite(job, chunk->offset, head - chunk->offset) < 0 ||
+        virFileWipeWrite(job, tail, end - tail) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static void
+virFileWipeWorker(void *opaque)
+{
+    virFileWipeJobPtr job = opaque;
+
+    virMutexLock(&job->lock);
+    while (!job->err && job->next < job->nchunks) {
+        virFileWipeChunkPtr chunk = &job->chunks[job->next++];
+        virFileWipeMethod method;
+        int err = 0;
+
+        virMutexUnlock(&job->lock);
+        if (virFileWipeRunChunk(job, chunk, &method) < 0)
+            err = errno;
+        virMutexLock(&job->lock);
+
+        if (err && !job->err) {
+            job->err = err;
+            job->erroffset = chunk->offset;
+            job->errmethod = method;
+        }
+        virCondSignal(&job->cond);
+    }
+    job->nrunning--;
+    virCondSignal(&job->cond);
+    virMutexUnlock(&job->lock);
+}
+
+
+static int
+virFileWipeAddExtent(virFileWipeJobPtr job,
+                     off_t offset,
+                     off_t length)
+{
+    while (length > 0) {
+        virFileWipeChunk chunk;
+
+        chunk.offset = offset;
+        chunk.length = MIN(length, VIR_FILE_WIPE_CHUNK);
+
+        if (VIR_APPEND_ELEMENT_COPY(job->chunks, job->nchunks, chunk) < 0)
+            return -1;
+
+        offset += chunk.length;
+        length -= chunk.length;
+    }
+
+    return 0;
+}
+
+
+/* Split the range into chunks, leaving out whatever the allocation
+ * map of a sparse file reports as holes since those read back as
+ * zeroes already */
+static int
+virFileWipeMapExtents(virFileWipeJobPtr job,
+                      off_t offset,
+                      off_t length,
+                      bool sparse)
+{
+    off_t end = offset + length;
+    off_t pos = offset;
+
+    while (pos < end) {
+        off_t data = pos;
+        off_t hole = end;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        if (sparse) {
+            if ((data = lseek(job->fd, pos, SEEK_DATA)) < 0) {
+                if (errno == ENXIO) {
+                    data = end;
+                } else if (virFileWipeIsUnsupported(errno)) {
+                    data = pos;
+                    sparse = false;
+                } else {
+                    virReportSystemError(errno,
+                                         _("unable to find data at offset "
+                                           "%llu in '%s'"),
+                                         (unsigned long long) pos,
+                                         job->path);
+                    return -1;
+                }
+            }
+
+            if (data > end)
+                data = end;
+
+            if (sparse && data < end) {
+                if ((hole = lseek(job->fd, data, SEEK_HOLE)) < 0) {
+                    virReportSystemError(errno,
+                                         _("unable to find hole at offset "
+                                           "%llu in '%s'"),
+                                         (unsigned long long) data,
+                                         job->path);
+                    return -1;
+                }
+                if (hole > end)
+                    hole = end;
+            }
+        }
+#else
+        (void) sparse;
+#endif
+
+        job->stats.skipped += data - pos;
+        job->done += data - pos;
+
+        if (data < hole &&
+            virFileWipeAddExtent(job, data, hole - data) < 0)
+            return -1;
+
+        pos = hole;
+    }
+
+    return 0;
+}
+
+
+static virFileWipeMethod
+virFileWipeInitMethod(virFileWipeJobPtr job,
+                      struct stat *sb,
+                      unsigned int flags)
+{
+    if (flags & VIR_FILE_WIPE_NO_OFFLOAD)
+        return VIR_FILE_WIPE_METHOD_WRITE;
+
+    if (S_ISBLK(sb->st_mode)) {
+#ifdef BLKSSZGET
+        int sectorsize = 0;
+
+        if (ioctl(job->fd, BLKSSZGET, &sectorsize) == 0 && sectorsize > 0)
+            job->align = sectorsize;
+        else
+            job->align = 512;
+#else
+        job->align = 512;
+#endif
+
+        /* Discarded sectors are only guaranteed to read back as
+         * zeroes if the device says so */
+#ifdef BLKDISCARDZEROES
+        if (!(flags & VIR_FILE_WIPE_KEEP_ALLOCATION)) {
+            unsigned int zeroes = 0;
+
+            if (ioctl(job->fd, BLKDISCARDZEROES, &zeroes) == 0 && zeroes)
+                return VIR_FILE_WIPE_METHOD_DISCARD;
+        }
+#endif
+        return VIR_FILE_WIPE_METHOD_ZEROOUT;
+    }
+
+    if (S_ISREG(sb->st_mode)) {
+        job->align = sb->st_blksize > 0 ? sb->st_blksize : 512;
+
+        if (flags & VIR_FILE_WIPE_KEEP_ALLOCATION)
+            return VIR_FILE_WIPE_METHOD_ZERO_RANGE;
+        return VIR_FILE_WIPE_METHOD_PUNCH;
+    }
+
+    return VIR_FILE_WIPE_METHOD_WRITE;
+}
+
+
+/**
+ * virFileWipeZero:
+ * @fd: file descriptor open for writing
+ * @path: name of the file, for error reporting
+ * @offset: where to start wiping
+ * @length: number of bytes to wipe
+ * @params: tunables, or NULL for the defaults
+ * @stats: filled in with what was done, or NULL
+ * @flags: bitwise-OR of virFileWipeFlags
+ *
+ * Make the given range of @fd read back as zeroes, using the
+ * cheapest primitive the kernel offers for it: BLKDISCARD on
+ * devices that guarantee zeroed discards, BLKZEROOUT, hole
+ * punching or zero ranges on files, and plain writes of zeroed
+ * buffers as the last resort. Holes in sparse files are skipped
+ * entirely. The work is spread across @params->workers threads
+ * and throttled to @params->bandwidth bytes per second; while it
+ * is running @params->progress is called about once a second.
+ * The data is synced to disk before returning.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virFileWipeZero(int fd,
+                const char *path,
+                off_t offset,
+                off_t length,
+                virFileWipeParamsPtr params,
+                virFileWipeStatsPtr stats,
+                unsigned int flags)
+{
+    virFileWipeJob job;
+    virFileWipeParams defparams;
+    virThreadPtr threads = NULL;
+    size_t nthreads = 0;
+    size_t nworkers;
+    struct stat sb;
+    size_t i;
+    int ret = -1;
+
+    virCheckFlags(VIR_FILE_WIPE_KEEP_ALLOCATION |
+                  VIR_FILE_WIPE_NO_OFFLOAD, -1);
+
+    if (!params) {
+        memset(&defparams, 0, sizeof(defparams));
+        params = &defparams;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.fd = fd;
+    job.path = path;
+    job.align = 1;
+    job.bandwidth = params->bandwidth;
+    job.bufsize = params->bufsize ? params->bufsize :
+        VIR_FILE_WIPE_BUFSIZE_DEFAULT;
+
+    if (virMutexInit(&job.lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        return -1;
+    }
+    if (virCondInit(&job.cond) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init condition"));
+        virMutexDestroy(&job.lock);
+        return -1;
+    }
+
+    if (fstat(fd, &sb) < 0) {
+        virReportSystemError(errno, _("unable to stat '%s'"), path);
+        goto cleanup;
+    }
+
+    job.method = virFileWipeInitMethod(&job, &sb, flags);
+
+    if (virFileWipeMapExtents(&job, offset, length, S_ISREG(sb.st_mode)) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Wiping %llu bytes of '%s' in %zu chunks using %s, "
+              "%llu bytes in holes",
+              (unsigned long long) length, path, job.nchunks,
+              virFileWipeMethodTypeToString(job.method),
+              job.stats.skipped);
+
+    if (job.nchunks == 0)
+        goto done;
+
+    if (VIR_ALLOC_N(job.buf, job.bufsize) < 0)
+        goto cleanup;
+
+    nworkers = params->workers ? params->workers :
+        VIR_FILE_WIPE_WORKERS_DEFAULT;
+    nworkers = MIN(nworkers, VIR_FILE_WIPE_WORKERS_MAX);
+    nworkers = MIN(nworkers, job.nchunks);
+
+    if (VIR_ALLOC_N(threads, nworkers) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&job.start) < 0)
+        goto cleanup;
+
+    virMutexLock(&job.lock);
+    for (i = 0; i < nworkers; i++) {
+        if (virThreadCreate(&threads[nthreads], true,
+                            virFileWipeWorker, &job) < 0) {
+            /* The workers that did start will get through all
+             * the chunks, just more slowly */
+            if (nthreads)
+                break;
+            virMutexUnlock(&job.lock);
+            virReportSystemError(errno, "%s",
+                                 _("unable to create wipe thread"));
+            goto cleanup;
+        }
+        nthreads++;
+        job.nrunning++;
+    }
+
+    while (job.nrunning) {
+        unsigned long long now;
+        unsigned long long done;
+
+        if (virTimeMillisNow(&now) < 0 ||
+            (virCondWaitUntil(&job.cond, &job.lock,
+                              now + VIR_FILE_WIPE_PROGRESS_INTERVAL) < 0 &&
+             errno != ETIMEDOUT)) {
+            VIR_WARN("Unable to wait for wipe of '%s' to make progress",
+                     path);
+            break;
+        }
+
+        if (!params->progress || !job.nrunning)
+            continue;
+
+        done = job.done;
+        virMutexUnlock(&job.lock);
+        params->progress(done, length, params->opaque);
+        virMutexLock(&job.lock);
+    }
+    virMutexUnlock(&job.lock);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    if (job.err) {
+        virReportSystemError(job.err,
+                             _("failed to wipe '%s' at offset %llu using %s"),
+                             path, (unsigned long long) job.erroffset,
+                             virFileWipeMethodTypeToString(job.errmethod));
+        goto cleanup;
+    }
+
+    if (fdatasync(fd) < 0) {
+        virReportSystemError(errno, _("cannot sync data to '%s'"), path);
+        goto cleanup;
+    }
+
+ done:
+    VIR_DEBUG("Wiped '%s': skipped=%llu discarded=%llu zeroed=%llu "
+              "written=%llu",
+              path, job.stats.skipped, job.stats.discarded,
+              job.stats.zeroed, job.stats.written);
+
+    if (params->progress)
+        params->progress(length, length, params->opaque);
+    if (stats)
+        *stats = job.stats;
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(threads);
+    VIR_FREE(job.chunks);
+    VIR_FREE(job.buf);
+    virCondDestroy(&job.cond);
+    virMutexDestroy(&job.lock);
+    return ret;
+}
@@ -0,0 +1,72 @@
+/*
+ * virfilewipe.h: extent aware zeroing of files and block devices
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_FILE_WIPE_H__
+# define __VIR_FILE_WIPE_H__
+
+# include <sys/types.h>
+
+# include "internal.h"
+
+typedef enum {
+    /* Never release blocks: use BLKZEROOUT / FALLOC_FL_ZERO_RANGE
+     * instead of BLKDISCARD / FALLOC_FL_PUNCH_HOLE */
+    VIR_FILE_WIPE_KEEP_ALLOCATION = (1 << 0),
+    /* Always overwrite with zero buffers, as older releases did */
+    VIR_FILE_WIPE_NO_OFFLOAD      = (1 << 1),
+} virFileWipeFlags;
+
+typedef void (*virFileWipeProgressFunc)(unsigned long long done,
+                                        unsigned long long total,
+                                        void *opaque);
+
+typedef struct _virFileWipeParams virFileWipeParams;
+typedef virFileWipeParams *virFileWipeParamsPtr;
+struct _virFileWipeParams {
+    unsigned int workers;          /* parallel I/O threads, 0 for default */
+    unsigned long long bandwidth;  /* bytes per second, 0 for unlimited */
+    size_t bufsize;                /* write buffer size, 0 for default */
+
+    virFileWipeProgressFunc progress;
+    void *opaque;
+};
+
+typedef struct _virFileWipeStats virFileWipeStats;
+typedef virFileWipeStats *virFileWipeStatsPtr;
+struct _virFileWipeStats {
+    unsigned long long skipped;    /* bytes in holes, already zero */
+    unsigned long long discarded;  /* bytes released by BLKDISCARD or
+                                      FALLOC_FL_PUNCH_HOLE */
+    unsigned long long zeroed;     /* bytes cleared by BLKZEROOUT or
+                                      FALLOC_FL_ZERO_RANGE */
+    unsigned long long written;    /* bytes overwritten with zeroes */
+};
+
+int virFileWipeZero(int fd,
+                    const char *path,
+                    off_t offset,
+                    off_t length,
+                    virFileWipeParamsPtr params,
+                    virFileWipeStatsPtr stats,
+                    unsigned int flags)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+
+#endif /* __VIR_FILE_WIPE_H__ */
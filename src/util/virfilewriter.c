@@ -0,0 +1,583 @@
+/*
+ * virfilewriter.c: coalescing writer for small state files
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "virfilewriter.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virhash.h"
+#include "virlog.h"
+#include "virobject.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("util.filewriter");
+
+/* Upper bound on the number of files kept open while committing
+ * one batch, so that a burst of updates cannot exhaust our FDs */
+#define VIR_FILE_WRITER_BATCH_MAX 64
+
+typedef struct _virFileWriterEntry virFileWriterEntry;
+typedef virFileWriterEntry *virFileWriterEntryPtr;
+struct _virFileWriterEntry {
+    char *path;
+    mode_t mode;
+    virFileRewriteFunc rewrite;
+    void *opaque;
+    virFreeCallback freeOpaque;
+
+    /* Used during commit only */
+    char *newfile;
+    int fd;
+};
+
+struct _virFileWriter {
+    virObjectLockable parent;
+
+    /* Held while files are being rewritten, so that a synchronous
+     * rewrite or cancellation of a path never races with a batch
+     * that is in flight. Lock ordering is writer -> commitLock. */
+    virMutex commitLock;
+
+    virCond cond;
+    virThread thread;
+    bool quit;
+
+    unsigned int delay;         /* in milliseconds */
+    unsigned long long deadline;
+
+    /* path -> virFileWriterEntryPtr */
+    virHashTablePtr pending;
+
+    virFileWriterStats stats;
+};
+
+static virClassPtr virFileWriterClass;
+static void virFileWriterDispose(void *obj);
+
+static int virFileWriterOnceInit(void)
+{
+    if (!(virFileWriterClass = virClassNew(virClassForObjectLockable(),
+                                           "virFileWriter",
+                                           sizeof(virFileWriter),
+                                           virFileWriterDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virFileWriter)
+
+
+static void
+virFileWriterEntryFree(void *payload,
+                       const void *name ATTRIBUTE_UNUSED)
+{
+    virFileWriterEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    if (entry->freeOpaque)
+        entry->freeOpaque(entry->opaque);
+    VIR_FORCE_CLOSE(entry->fd);
+    if (entry->newfile) {
+        unlink(entry->newfile);
+        VIR_FREE(entry->newfile);
+    }
+    VIR_FREE(entry->path);
+    VIR_FREE(entry);
+}
+
+
+/* First half of virFileRewrite: write the new contents next
+ * to the target file, but neither sync nor rename it yet. */
+static int
+virFileWriterEntryPrepare(virFileWriterEntryPtr entry)
+{
+    if (virAsprintf(&entry->newfile, "%s.new", entry->path) < 0)
+        return -1;
+
+    if ((entry->fd = open(entry->newfile,
+                          O_WRONLY | O_CREAT | O_TRUNC, entry->mode)) < 0) {
+        virReportSystemError(errno, _("cannot create file '%s'"),
+                             entry->newfile);
+        return -1;
+    }
+
+    if (entry->rewrite(entry->fd, entry->opaque) < 0) {
+        virReportSystemError(errno, _("cannot write data to file '%s'"),
+                             entry->newfile);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Second half of virFileRewrite: make the new contents durable
+ * and atomically replace the target file with them. */
+static int
+virFileWriterEntryFinish(virFileWriterEntryPtr entry)
+{
+    if (fsync(entry->fd) < 0) {
+        virReportSystemError(errno, _("cannot sync file '%s'"),
+                             entry->newfile);
+        return -1;
+    }
+
+    if (VIR_CLOSE(entry->fd) < 0) {
+        virReportSystemError(errno, _("cannot save file '%s'"),
+                             entry->newfile);
+        return -1;
+    }
+
+    if (rename(entry->newfile, entry->path) < 0) {
+        virReportSystemError(errno, _("cannot rename file '%s' as '%s'"),
+                             entry->newfile, entry->path);
+        return -1;
+    }
+
+    VIR_FREE(entry->newfile);
+    return 0;
+}
+
+
+static void
+virFileWriterEntryFailed(virFileWriterEntryPtr entry)
+{
+    virErrorPtr err = virGetLastError();
+
+    VIR_WARN("Failed to write '%s': %s",
+             entry->path, err ? err->message : _("unknown error"));
+    virResetLastError();
+}
+
+
+/*
+ * Write out all files in @entries. The contents of a chunk of
+ * files are written first and only then all of them are synced
+ * and renamed, so that the filesystem can fold the flushes of one
+ * chunk into as few journal commits as possible.
+ *
+ * Returns the number of files that could not be written.
+ */
+static size_t
+virFileWriterCommitBatch(virFileWriterEntryPtr *entries,
+                         size_t nentries)
+{
+    size_t failed = 0;
+    size_t start;
+    size_t i;
+
+    for (start = 0; start < nentries; start += VIR_FILE_WRITER_BATCH_MAX) {
+        size_t end = MIN(nentries, start + VIR_FILE_WRITER_BATCH_MAX);
+        bool ok[VIR_FILE_WRITER_BATCH_MAX];
+
+        for (i = start; i < end; i++) {
+            if (!(ok[i - start] = virFileWriterEntryPrepare(entries[i]) == 0))
+                virFileWriterEntryFailed(entries[i]);
+        }
+
+        for (i = start; i < end; i++) {
+            if (!ok[i - start]) {
+                failed++;
+                continue;
+            }
+            if (virFileWriterEntryFinish(entries[i]) < 0) {
+                virFileWriterEntryFailed(entries[i]);
+                failed++;
+            }
+        }
+    }
+
+    return failed;
+}
+
+
+/*
+ * Take all pending updates and write them to disk in one batch.
+ * Must be called with @writer locked; returns with it unlocked.
+ *
+ * Returns 0 on success, -1 if the batch could not be set up, in which
+ * case the updates stay queued.
+ */
+static int
+virFileWriterCommit(virFileWriterPtr writer)
+{
+    virHashTablePtr batch = writer->pending;
+    virHashKeyValuePairPtr items = NULL;
+    virFileWriterEntryPtr *entries = NULL;
+    size_t nentries = virHashSize(batch);
+    size_t failed = 0;
+    size_t i;
+
+    if (nentries == 0) {
+        virObjectUnlock(writer);
+        return 0;
+    }
+
+    if (!(writer->pending = virHashCreate(nentries, virFileWriterEntryFree))) {
+        writer->pending = batch;
+        virObjectUnlock(writer);
+        return -1;
+    }
+
+    virMutexLock(&writer->commitLock);
+    virObjectUnlock(writer);
+
+    VIR_DEBUG("Committing %zu files", nentries);
+
+    if (!(items = virHashGetItems(batch, NULL)) ||
+        VIR_ALLOC_N(entries, nentries) < 0) {
+        VIR_WARN("Failed to commit %zu files", nentries);
+        virResetLastError();
+        failed = nentries;
+        goto cleanup;
+    }
+
+    for (i = 0; i < nentries; i++)
+        entries[i] = (virFileWriterEntryPtr) items[i].value;
+
+    failed = virFileWriterCommitBatch(entries, nentries);
+
+ cleanup:
+    virMutexUnlock(&writer->commitLock);
+
+    virObjectLock(writer);
+    writer->stats.batches++;
+    writer->stats.written += nentries - failed;
+    writer->stats.failed += failed;
+    virObjectUnlock(writer);
+
+    VIR_FREE(entries);
+    VIR_FREE(items);
+    virHashFree(batch);
+    return 0;
+}
+
+
+static void
+virFileWriterWorker(void *opaque)
+{
+    virFileWriterPtr writer = opaque;
+
+    virObjectLock(writer);
+    while (!writer->quit) {
+        unsigned long long now;
+
+        if (virHashSize(writer->pending) == 0) {
+            if (virCondWait(&writer->cond, &writer->parent.lock) < 0) {
+                VIR_WARN("Unable to wait on file writer condition");
+                break;
+            }
+            continue;
+        }
+
+        if (virTimeMillisNow(&now) < 0)
+            now = writer->deadline;
+
+        if (now < writer->deadline) {
+            if (virCondWaitUntil(&writer->cond, &writer->parent.lock,
+                                 writer->deadline) < 0 &&
+                errno != ETIMEDOUT) {
+                VIR_WARN("Unable to wait on file writer condition");
+                break;
+            }
+            continue;
+        }
+
+        if (virFileWriterCommit(writer) < 0) {
+            VIR_WARN("Unable to commit queued files: %s",
+                     virGetLastErrorMessage());
+            virResetLastError();
+
+            /* Try again once another delay has passed */
+            virObjectLock(writer);
+            writer->deadline = now + writer->delay;
+            continue;
+        }
+        virObjectLock(writer);
+    }
+    virObjectUnlock(writer);
+}
+
+
+/**
+ * virFileWriterNew:
+ * @delay: how long in milliseconds a queued update may be held back
+ *
+ * Creates a writer that collects updates of files queued via
+ * virFileWriterQueue() and writes them out from a background thread
+ * at most @delay milliseconds after the first of them was queued.
+ * Repeated updates of the same file within that window are coalesced
+ * into a single rewrite and all files of one window are committed
+ * together.
+ *
+ * Returns the new writer, or NULL on error.
+ */
+virFileWriterPtr
+virFileWriterNew(unsigned int delay)
+{
+    virFileWriterPtr writer;
+
+    if (virFileWriterInitialize() < 0)
+        return NULL;
+
+    if (!(writer = virObjectLockableNew(virFileWriterClass)))
+        return NULL;
+
+    writer->delay = delay;
+    /* No thread yet, so make dispose skip joining it */
+    writer->quit = true;
+
+    if (virMutexInit(&writer->commitLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        goto error;
+    }
+
+    if (virCondInit(&writer->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize condition variable"));
+        goto error;
+    }
+
+    if (!(writer->pending = virHashCreate(32, virFileWriterEntryFree)))
+        goto error;
+
+    writer->quit = false;
+    if (virThreadCreate(&writer->thread, true,
+                        virFileWriterWorker, writer) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create file writer thread"));
+        writer->quit = true;
+        goto error;
+    }
+
+    return writer;
+
+ error:
+    virObjectUnref(writer);
+    return NULL;
+}
+
+
+static void
+virFileWriterDispose(void *obj)
+{
+    virFileWriterPtr writer = obj;
+
+    if (!writer->quit) {
+        virObjectLock(writer);
+        writer->quit = true;
+        virCondSignal(&writer->cond);
+        virObjectUnlock(writer);
+
+        virThreadJoin(&writer->thread);
+    }
+
+    if (writer->pending) {
+        virObjectLock(writer);
+        if (virFileWriterCommit(writer) < 0)
+            VIR_WARN("Unable to commit queued files: %s",
+                     virGetLastErrorMessage());
+    }
+
+    virHashFree(writer->pending);
+    virCondDestroy(&writer->cond);
+    virMutexDestroy(&writer->commitLock);
+}
+
+
+/**
+ * virFileWriterQueue:
+ * @writer: the writer
+ * @path: file to rewrite
+ * @mode: mode to create the file with
+ * @rewrite: callback producing the new contents
+ * @opaque: data for @rewrite, owned by the writer from now on
+ * @freeOpaque: callback to free @opaque, or NULL
+ *
+ * Schedules @path to be rewritten by @rewrite, superseding any update
+ * of @path still pending. The file is replaced exactly as
+ * virFileRewrite() would do it, just later. Since @rewrite runs from
+ * the writer thread, @opaque must be a self-contained copy of the
+ * data to write.
+ *
+ * On error, @opaque is freed and -1 returned.
+ */
+int
+virFileWriterQueue(virFileWriterPtr writer,
+                   const char *path,
+                   mode_t mode,
+                   virFileRewriteFunc rewrite,
+                   void *opaque,
+                   virFreeCallback freeOpaque)
+{
+    virFileWriterEntryPtr entry = NULL;
+    bool superseded;
+    int ret = -1;
+
+    if (VIR_ALLOC(entry) < 0 ||
+        VIR_STRDUP(entry->path, path) < 0) {
+        VIR_FREE(entry);
+        if (freeOpaque)
+            freeOpaque(opaque);
+        return -1;
+    }
+
+    entry->mode = mode;
+    entry->rewrite = rewrite;
+    entry->opaque = opaque;
+    entry->freeOpaque = freeOpaque;
+    entry->fd = -1;
+
+    virObjectLock(writer);
+
+    if (virHashSize(writer->pending) == 0) {
+        if (virTimeMillisNow(&writer->deadline) < 0)
+            goto cleanup;
+        writer->deadline += writer->delay;
+    }
+
+    superseded = !!virHashLookup(writer->pending, path);
+
+    if (virHashUpdateEntry(writer->pending, path, entry) < 0)
+        goto cleanup;
+    entry = NULL;
+
+    writer->stats.queued++;
+    if (superseded)
+        writer->stats.coalesced++;
+    else
+        virCondSignal(&writer->cond);
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(writer);
+    virFileWriterEntryFree(entry, NULL);
+    return ret;
+}
+
+
+/**
+ * virFileWriterRewrite:
+ * @writer: the writer
+ * @path: file to rewrite
+ * @mode: mode to create the file with
+ * @rewrite: callback producing the new contents
+ * @opaque: data for @rewrite
+ *
+ * Rewrites @path synchronously via virFileRewrite(), dropping any
+ * update of @path still queued on @writer. This is meant for updates
+ * which must be on disk before the caller proceeds.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virFileWriterRewrite(virFileWriterPtr writer,
+                     const char *path,
+                     mode_t mode,
+                     virFileRewriteFunc rewrite,
+                     void *opaque)
+{
+    int ret;
+
+    virObjectLock(writer);
+    if (virHashRemoveEntry(writer->pending, path) == 0)
+        writer->stats.coalesced++;
+    virObjectUnlock(writer);
+
+    virMutexLock(&writer->commitLock);
+    ret = virFileRewrite(path, mode, rewrite, opaque);
+    virMutexUnlock(&writer->commitLock);
+
+    if (ret == 0) {
+        virObjectLock(writer);
+        writer->stats.written++;
+        virObjectUnlock(writer);
+    }
+
+    return ret;
+}
+
+
+/**
+ * virFileWriterCancel:
+ * @writer: the writer
+ * @path: file to forget about
+ *
+ * Drops any update of @path queued on @writer and waits for a commit
+ * that may be writing it right now, so that the caller may safely
+ * remove @path once this returns.
+ */
+void
+virFileWriterCancel(virFileWriterPtr writer,
+                    const char *path)
+{
+    virObjectLock(writer);
+    ignore_value(virHashRemoveEntry(writer->pending, path));
+    virObjectUnlock(writer);
+
+    virMutexLock(&writer->commitLock);
+    virMutexUnlock(&writer->commitLock);
+}
+
+
+/**
+ * virFileWriterFlush:
+ * @writer: the writer
+ *
+ * Writes out all queued updates right away.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virFileWriterFlush(virFileWriterPtr writer)
+{
+    virObjectLock(writer);
+    if (virFileWriterCommit(writer) < 0)
+        return -1;
+
+    /* Also wait for a batch the worker thread might be committing */
+    virMutexLock(&writer->commitLock);
+    virMutexUnlock(&writer->commitLock);
+    return 0;
+}
+
+
+void
+virFileWriterGetStats(virFileWriterPtr writer,
+                      virFileWriterStatsPtr stats)
+{
+    virObjectLock(writer);
+    *stats = writer->stats;
+    virObjectUnlock(writer);
+}
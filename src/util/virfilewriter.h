@@ -0,0 +1,72 @@
+/*
+ * virfilewriter.h: coalescing writer for small state files
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_FILE_WRITER_H__
+# define __VIR_FILE_WRITER_H__
+
+# include <sys/types.h>
+
+# include "internal.h"
+# include "virfile.h"
+
+typedef struct _virFileWriter virFileWriter;
+typedef virFileWriter *virFileWriterPtr;
+
+typedef struct _virFileWriterStats virFileWriterStats;
+typedef virFileWriterStats *virFileWriterStatsPtr;
+struct _virFileWriterStats {
+    unsigned long long queued;     /* deferred writes requested */
+    unsigned long long coalesced;  /* deferred writes superseded before
+                                      hitting the disk */
+    unsigned long long written;    /* files actually rewritten */
+    unsigned long long batches;    /* group commits performed */
+    unsigned long long failed;     /* failed background rewrites */
+};
+
+virFileWriterPtr virFileWriterNew(unsigned int delay);
+
+int virFileWriterQueue(virFileWriterPtr writer,
+                       const char *path,
+                       mode_t mode,
+                       virFileRewriteFunc rewrite,
+                       void *opaque,
+                       virFreeCallback freeOpaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4);
+
+int virFileWriterRewrite(virFileWriterPtr writer,
+                         const char *path,
+                         mode_t mode,
+                         virFileRewriteFunc rewrite,
+                         void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4);
+
+void virFileWriterCancel(virFileWriterPtr writer,
+                         const char *path)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+int virFileWriterFlush(virFileWriterPtr writer)
+    ATTRIBUTE_NONNULL(1);
+
+void virFileWriterGetStats(virFileWriterPtr writer,
+                           virFileWriterStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+#endif /* __VIR_FILE_WRITER_H__ */
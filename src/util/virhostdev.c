@@ -40,6 +40,8 @@
 #include "virlog.h"
 #include "virutil.h"
 #include "virnetdev.h"
+#include "virthread.h"
+#include "virtime.h"
 #include "configmake.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -516,6 +518,241 @@ virHostdevNetConfigRestore(virDomainHostdevDefPtr hostdev,
     return ret;
 }
 
+/* Wait until KVM has released the device's memory regions, so that
+ * it can be unbound from pci-stub */
+static void
+virHostdevWaitForPCICleanup(virPCIDevicePtr dev)
+{
+    virTimeBackOffVar timebackoff;
+
+    if (!virPCIDeviceGetManaged(dev) ||
+        STRNEQ(virPCIDeviceGetStubDriver(dev), "pci-stub"))
+        return;
+
+    if (virTimeBackOffStart(&timebackoff, 10, 10 * 1000) < 0) {
+        virResetLastError();
+        return;
+    }
+    while (virTimeBackOffWait(&timebackoff)) {
+        if (!virPCIDeviceWaitForCleanup(dev, "kvm_assigned_device"))
+            break;
+    }
+}
+
+
+/* Log how long a phase of PCI device (re)attachment took */
+static void
+virHostdevPhaseDone(const char *dom_name,
+                    const char *phase,
+                    unsigned long long *start)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNowRaw(&now) < 0)
+        return;
+
+    VIR_DEBUG("PCI %s phase for domain %s took %llums",
+              phase, dom_name, now - *start);
+    *start = now;
+}
+
+
+typedef struct _virHostdevPCIResetJob virHostdevPCIResetJob;
+typedef virHostdevPCIResetJob *virHostdevPCIResetJobPtr;
+struct _virHostdevPCIResetJob {
+    virHostdevManagerPtr mgr;
+    virPCIDevicePtr *devs;  /* not owned */
+    size_t ndevs;
+    size_t label;
+    bool reattach;
+    virThread thread;
+    bool threaded;
+    int ret;
+    virErrorPtr err;
+};
+
+static void
+virHostdevResetPCIDeviceGroup(void *opaque)
+{
+    virHostdevPCIResetJobPtr job = opaque;
+    size_t i;
+
+    job->ret = 0;
+    for (i = 0; i < job->ndevs; i++) {
+        virPCIDevicePtr dev = job->devs[i];
+
+        if (virPCIDeviceReset(dev, job->mgr->activePCIHostdevs,
+                              job->mgr->inactivePCIHostdevs) < 0) {
+            virErrorPtr err;
+
+            if (!job->reattach) {
+                job->ret = -1;
+                job->err = virSaveLastError();
+                return;
+            }
+            err = virGetLastError();
+            VIR_ERROR(_("Failed to reset PCI device: %s"),
+                      err ? err->message : _("unknown error"));
+            virResetError(err);
+        }
+
+        if (job->reattach)
+            virHostdevWaitForPCICleanup(dev);
+    }
+}
+
+/* Can resetting @a affect @b, or vice versa? */
+static bool
+virHostdevPCIDevicesDependent(virPCIDevicePtr a, int groupA,
+                              virPCIDevicePtr b, int groupB)
+{
+    virPCIDeviceAddressPtr addrA, addrB;
+    bool ret;
+
+    if (groupA >= 0 && groupA == groupB)
+        return true;
+
+    if (!(addrA = virPCIDeviceGetAddress(a)) ||
+        !(addrB = virPCIDeviceGetAddress(b))) {
+        virResetLastError();
+        VIR_FREE(addrA);
+        return true;
+    }
+
+    /* A secondary bus reset hits the whole bus. There is no
+     * such thing for the root bus. */
+    ret = addrA->domain == addrB->domain &&
+          addrA->bus == addrB->bus &&
+          addrA->bus != 0;
+
+    VIR_FREE(addrA);
+    VIR_FREE(addrB);
+    return ret;
+}
+
+/*
+ * Reset all devices in @pcidevs. Devices which share an IOMMU group
+ * or a (non-root) bus are reset one after another, independent sets
+ * of devices are handled in parallel. With @reattach, failures are
+ * only logged and we also wait for KVM to release each device.
+ *
+ * Pre-condition: inactivePCIHostdevs & activePCIHostdevs
+ * are locked
+ */
+static int
+virHostdevResetPCIDevices(virHostdevManagerPtr mgr,
+                          virPCIDeviceListPtr pcidevs,
+                          bool reattach)
+{
+    size_t n = virPCIDeviceListCount(pcidevs);
+    virHostdevPCIResetJobPtr jobs = NULL;
+    size_t njobs = 0;
+    size_t *label = NULL;
+    int *group = NULL;
+    size_t i, j, k;
+    int ret = -1;
+
+    if (n == 0)
+        return 0;
+
+    if (VIR_ALLOC_N(label, n) < 0 ||
+        VIR_ALLOC_N(group, n) < 0 ||
+        VIR_ALLOC_N(jobs, n) < 0)
+        goto cleanup;
+
+    for (i = 0; i < n; i++) {
+        virPCIDevicePtr dev = virPCIDeviceListGet(pcidevs, i);
+        virPCIDeviceAddressPtr addr;
+
+        group[i] = -1;
+        if ((addr = virPCIDeviceGetAddress(dev)))
+            group[i] = virPCIDeviceAddressGetIOMMUGroupNum(addr);
+        if (group[i] < 0) {
+            /* No IOMMU, or the group is unknown */
+            virResetLastError();
+            group[i] = -1;
+        }
+        VIR_FREE(addr);
+    }
+
+    /* Split the devices into sets which can be reset independently */
+    for (i = 0; i < n; i++) {
+        virPCIDevicePtr dev = virPCIDeviceListGet(pcidevs, i);
+
+        label[i] = i;
+        for (j = 0; j < i; j++) {
+            size_t old = label[j];
+
+            if (old == label[i] ||
+                !virHostdevPCIDevicesDependent(dev, group[i],
+                                               virPCIDeviceListGet(pcidevs, j),
+                                               group[j]))
+                continue;
+
+            for (k = 0; k <= i; k++) {
+                if (label[k] == old)
+                    label[k] = label[i];
+            }
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        virPCIDevicePtr dev = virPCIDeviceListGet(pcidevs, i);
+        virHostdevPCIResetJobPtr job = NULL;
+
+        for (j = 0; j < njobs; j++) {
+            if (jobs[j].label == label[i]) {
+                job = &jobs[j];
+                break;
+            }
+        }
+        if (!job) {
+            job = &jobs[njobs++];
+            job->mgr = mgr;
+            job->label = label[i];
+            job->reattach = reattach;
+        }
+        if (VIR_APPEND_ELEMENT(job->devs, job->ndevs, dev) < 0)
+            goto cleanup;
+    }
+
+    VIR_DEBUG("Resetting %zu PCI devices in %zu independent sets", n, njobs);
+
+    /* Keep the first set for this thread, so that the common case
+     * of a single set doesn't need any extra thread at all */
+    for (i = 1; i < njobs; i++) {
+        if (virThreadCreate(&jobs[i].thread, true,
+                            virHostdevResetPCIDeviceGroup, &jobs[i]) < 0) {
+            VIR_WARN("Unable to create PCI reset thread, "
+                     "resetting devices sequentially");
+            virHostdevResetPCIDeviceGroup(&jobs[i]);
+        } else {
+            jobs[i].threaded = true;
+        }
+    }
+    virHostdevResetPCIDeviceGroup(&jobs[0]);
+
+    ret = 0;
+    for (i = 0; i < njobs; i++) {
+        if (jobs[i].threaded)
+            virThreadJoin(&jobs[i].thread);
+        if (jobs[i].ret < 0 && ret == 0) {
+            ret = -1;
+            virSetError(jobs[i].err);
+        }
+    }
+
+ cleanup:
+    for (i = 0; jobs && i < njobs; i++) {
+        virFreeError(jobs[i].err);
+        VIR_FREE(jobs[i].devs);
+    }
+    VIR_FREE(jobs);
+    VIR_FREE(label);
+    VIR_FREE(group);
+    return ret;
+}
+
 int
 virHostdevPreparePCIDevices(virHostdevManagerPtr hostdev_mgr,
                             const char *drv_name,
@@ -530,10 +767,13 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr hostdev_mgr,
     size_t i;
     int ret = -1;
     virPCIDeviceAddressPtr devAddr = NULL;
+    unsigned long long phase = 0;
 
     if (!nhostdevs)
         return 0;
 
+    ignore_value(virTimeMillisNowRaw(&phase));
+
     virObjectLock(hostdev_mgr->activePCIHostdevs);
     virObjectLock(hostdev_mgr->inactivePCIHostdevs);
 
@@ -582,6 +822,8 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr hostdev_mgr,
         }
     }
 
+    virHostdevPhaseDone(dom_name, "validate", &phase);
+
     /* Loop 2: detach managed devices (i.e. bind to appropriate stub driver) */
     for (i = 0; i < virPCIDeviceListCount(pcidevs); i++) {
         virPCIDevicePtr dev = virPCIDeviceListGet(pcidevs, i);
@@ -590,15 +832,14 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr hostdev_mgr,
             goto reattachdevs;
     }
 
+    virHostdevPhaseDone(dom_name, "detach", &phase);
+
     /* Loop 3: Now that all the PCI hostdevs have been detached, we
      * can safely reset them */
-    for (i = 0; i < virPCIDeviceListCount(pcidevs); i++) {
-        virPCIDevicePtr dev = virPCIDeviceListGet(pcidevs, i);
+    if (virHostdevResetPCIDevices(hostdev_mgr, pcidevs, false) < 0)
+        goto reattachdevs;
 
-        if (virPCIDeviceReset(dev, hostdev_mgr->activePCIHostdevs,
-                              hostdev_mgr->inactivePCIHostdevs) < 0)
-            goto reattachdevs;
-    }
+    virHostdevPhaseDone(dom_name, "reset", &phase);
 
     /* Loop 4: For SRIOV network devices, Now that we have detached the
      * the network device, set the netdev config */
@@ -679,6 +920,8 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr hostdev_mgr,
     while (virPCIDeviceListCount(pcidevs) > 0)
         virPCIDeviceListStealIndex(pcidevs, 0);
 
+    virHostdevPhaseDone(dom_name, "activate", &phase);
+
     ret = 0;
     goto cleanup;
 
@@ -717,7 +960,8 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr hostdev_mgr,
 
 /*
  * Pre-condition: inactivePCIHostdevs & activePCIHostdevs
- * are locked
+ * are locked, and KVM has released @dev, see
+ * virHostdevWaitForPCICleanup
  */
 static void
 virHostdevReattachPCIDevice(virPCIDevicePtr dev, virHostdevManagerPtr mgr)
@@ -731,16 +975,6 @@ virHostdevReattachPCIDevice(virPCIDevicePtr dev, virHostdevManagerPtr mgr)
         return;
     }
 
-    /* Wait for device cleanup if it is qemu/kvm */
-    if (STREQ(virPCIDeviceGetStubDriver(dev), "pci-stub")) {
-        int retries = 100;
-        while (virPCIDeviceWaitForCleanup(dev, "kvm_assigned_device")
-               && retries) {
-            usleep(100*1000);
-            retries--;
-        }
-    }
-
     if (virPCIDeviceReattach(dev, mgr->activePCIHostdevs,
                              mgr->inactivePCIHostdevs) < 0) {
         virErrorPtr err = virGetLastError();
@@ -764,10 +998,13 @@ virHostdevReAttachPCIDevices(virHostdevManagerPtr hostdev_mgr,
 {
     virPCIDeviceListPtr pcidevs;
     size_t i;
+    unsigned long long phase = 0;
 
     if (!nhostdevs)
         return;
 
+    ignore_value(virTimeMillisNowRaw(&phase));
+
     virObjectLock(hostdev_mgr->activePCIHostdevs);
     virObjectLock(hostdev_mgr->inactivePCIHostdevs);
 
@@ -820,23 +1057,19 @@ virHostdevReAttachPCIDevices(virHostdevManagerPtr hostdev_mgr,
         virHostdevNetConfigRestore(hostdevs[i], hostdev_mgr->stateDir,
                                    oldStateDir);
 
-    for (i = 0; i < virPCIDeviceListCount(pcidevs); i++) {
-        virPCIDevicePtr dev = virPCIDeviceListGet(pcidevs, i);
+    /* Reset the devices and wait for KVM to let go of them. Failures
+     * are only logged. */
+    ignore_value(virHostdevResetPCIDevices(hostdev_mgr, pcidevs, true));
 
-        if (virPCIDeviceReset(dev, hostdev_mgr->activePCIHostdevs,
-                              hostdev_mgr->inactivePCIHostdevs) < 0) {
-            virErrorPtr err = virGetLastError();
-            VIR_ERROR(_("Failed to reset PCI device: %s"),
-                      err ? err->message : _("unknown error"));
-            virResetError(err);
-        }
-    }
+    virHostdevPhaseDone(dom_name, "reset", &phase);
 
     while (virPCIDeviceListCount(pcidevs) > 0) {
         virPCIDevicePtr dev = virPCIDeviceListStealIndex(pcidevs, 0);
         virHostdevReattachPCIDevice(dev, hostdev_mgr);
     }
 
+    virHostdevPhaseDone(dom_name, "reattach", &phase);
+
     virObjectUnref(pcidevs);
  cleanup:
     virObjectUnlock(hostdev_mgr->activePCIHostdevs);
@@ -136,20 +136,14 @@ virLockSpaceResourceNew(virLockSpacePtr lockspace,
     if (flags & VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE) {
         while (1) {
             struct stat a, b;
-            if ((res->fd = open(res->path, O_RDWR|O_CREAT, 0600)) < 0) {
+            if ((res->fd = open(res->path,
+                                O_RDWR|O_CREAT|O_CLOEXEC, 0600)) < 0) {
                 virReportSystemError(errno,
                                      _("Unable to open/create resource %s"),
                                      res->path);
                 goto error;
             }
 
-            if (virSetCloseExec(res->fd) < 0) {
-                virReportSystemError(errno,
-                                     _("Failed to set close-on-exec flag '%s'"),
-                                     res->path);
-                goto error;
-            }
-
             if (fstat(res->fd, &b) < 0) {
                 virReportSystemError(errno,
                                      _("Unable to check status of pid file '%s'"),
@@ -190,20 +184,13 @@ virLockSpaceResourceNew(virLockSpacePtr lockspace,
             /* Someone else must be racing with us, so try again */
         }
     } else {
-        if ((res->fd = open(res->path, O_RDWR)) < 0) {
+        if ((res->fd = open(res->path, O_RDWR|O_CLOEXEC)) < 0) {
             virReportSystemError(errno,
                                  _("Unable to open resource %s"),
                                  res->path);
             goto error;
         }
 
-        if (virSetCloseExec(res->fd) < 0) {
-            virReportSystemError(errno,
-                                 _("Failed to set close-on-exec flag '%s'"),
-                                 res->path);
-            goto error;
-        }
-
         if (virFileLock(res->fd, shared, 0, 1, false) < 0) {
             if (errno == EACCES || errno == EAGAIN) {
                 virReportError(VIR_ERR_RESOURCE_BUSY,
@@ -609,73 +596,56 @@ int virLockSpaceDeleteResource(virLockSpacePtr lockspace,
 }
 
 
-int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
-                                const char *resname,
-                                pid_t owner,
-                                unsigned int flags)
+static int
+virLockSpaceAcquireResourceLocked(virLockSpacePtr lockspace,
+                                  const char *resname,
+                                  pid_t owner,
+                                  unsigned int flags)
 {
-    int ret = -1;
     virLockSpaceResourcePtr res;
 
-    VIR_DEBUG("lockspace=%p resname=%s flags=%x owner=%lld",
-              lockspace, resname, flags, (unsigned long long)owner);
-
-    virCheckFlags(VIR_LOCK_SPACE_ACQUIRE_SHARED |
-                  VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE, -1);
-
-    virMutexLock(&lockspace->lock);
-
     if ((res = virHashLookup(lockspace->resources, resname))) {
         if ((res->flags & VIR_LOCK_SPACE_ACQUIRE_SHARED) &&
             (flags & VIR_LOCK_SPACE_ACQUIRE_SHARED)) {
 
             if (VIR_EXPAND_N(res->owners, res->nOwners, 1) < 0)
-                goto cleanup;
+                return -1;
             res->owners[res->nOwners-1] = owner;
 
-            goto done;
+            return 0;
         }
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is locked"),
                        resname);
-        goto cleanup;
+        return -1;
     }
 
     if (!(res = virLockSpaceResourceNew(lockspace, resname, flags, owner)))
-        goto cleanup;
+        return -1;
 
     if (virHashAddEntry(lockspace->resources, resname, res) < 0) {
         virLockSpaceResourceFree(res);
-        goto cleanup;
+        return -1;
     }
 
- done:
-    ret = 0;
-
- cleanup:
-    virMutexUnlock(&lockspace->lock);
-    return ret;
+    return 0;
 }
 
 
-int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
-                                const char *resname,
-                                pid_t owner)
+static virLockSpaceResourcePtr
+virLockSpaceFindOwnedResource(virLockSpacePtr lockspace,
+                              const char *resname,
+                              pid_t owner,
+                              size_t *idx)
 {
-    int ret = -1;
     virLockSpaceResourcePtr res;
     size_t i;
 
-    VIR_DEBUG("lockspace=%p resname=%s owner=%lld",
-              lockspace, resname, (unsigned long long)owner);
-
-    virMutexLock(&lockspace->lock);
-
     if (!(res = virHashLookup(lockspace->resources, resname))) {
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is not locked"),
                        resname);
-        goto cleanup;
+        return NULL;
     }
 
     for (i = 0; i < res->nOwners; i++) {
@@ -687,14 +657,200 @@ int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("owner %lld does not hold the resource lock"),
                        (unsigned long long)owner);
-        goto cleanup;
+        return NULL;
     }
 
+    *idx = i;
+    return res;
+}
+
+
+static int
+virLockSpaceReleaseResourceLocked(virLockSpacePtr lockspace,
+                                  const char *resname,
+                                  pid_t owner)
+{
+    virLockSpaceResourcePtr res;
+    size_t i;
+
+    if (!(res = virLockSpaceFindOwnedResource(lockspace, resname, owner, &i)))
+        return -1;
+
     VIR_DELETE_ELEMENT(res->owners, i, res->nOwners);
 
     if ((res->nOwners == 0) &&
         virHashRemoveEntry(lockspace->resources, resname) < 0)
-        goto cleanup;
+        return -1;
+
+    return 0;
+}
+
+
+int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
+                                const char *resname,
+                                pid_t owner,
+                                unsigned int flags)
+{
+    int ret;
+
+    VIR_DEBUG("lockspace=%p resname=%s flags=%x owner=%lld",
+              lockspace, resname, flags, (unsigned long long)owner);
+
+    virCheckFlags(VIR_LOCK_SPACE_ACQUIRE_SHARED |
+                  VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE, -1);
+
+    virMutexLock(&lockspace->lock);
+    ret = virLockSpaceAcquireResourceLocked(lockspace, resname, owner, flags);
+    virMutexUnlock(&lockspace->lock);
+
+    return ret;
+}
+
+
+/**
+ * virLockSpaceAcquireResources:
+ * @lockspace: the lockspace
+ * @nresources: number of entries in @resnames and @flags
+ * @resnames: names of the resources to acquire
+ * @flags: virLockSpaceAcquireFlags for each resource
+ * @owner: the process acquiring the resources
+ *
+ * Acquire a set of resources in one go. Either all of them are
+ * acquired, or, if any one of them cannot be, none of them are.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virLockSpaceAcquireResources(virLockSpacePtr lockspace,
+                                 size_t nresources,
+                                 const char **resnames,
+                                 const unsigned int *flags,
+                                 pid_t owner)
+{
+    int ret = -1;
+    size_t i;
+
+    VIR_DEBUG("lockspace=%p nresources=%zu owner=%lld",
+              lockspace, nresources, (unsigned long long)owner);
+
+    for (i = 0; i < nresources; i++) {
+        if (flags[i] & ~(VIR_LOCK_SPACE_ACQUIRE_SHARED |
+                         VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE)) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("unsupported flags (0x%x) for resource '%s'"),
+                           flags[i], resnames[i]);
+            return -1;
+        }
+    }
+
+    virMutexLock(&lockspace->lock);
+
+    for (i = 0; i < nresources; i++) {
+        VIR_DEBUG("resname=%s flags=%x", resnames[i], flags[i]);
+        if (virLockSpaceAcquireResourceLocked(lockspace, resnames[i],
+                                              owner, flags[i]) < 0) {
+            virErrorPtr err = virSaveLastError();
+
+            /* Undo what we got so far, in reverse order */
+            while (i-- > 0)
+                ignore_value(virLockSpaceReleaseResourceLocked(lockspace,
+                                                               resnames[i],
+                                                               owner));
+            virSetError(err);
+            virFreeError(err);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&lockspace->lock);
+    return ret;
+}
+
+
+int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
+                                const char *resname,
+                                pid_t owner)
+{
+    int ret;
+
+    VIR_DEBUG("lockspace=%p resname=%s owner=%lld",
+              lockspace, resname, (unsigned long long)owner);
+
+    virMutexLock(&lockspace->lock);
+    ret = virLockSpaceReleaseResourceLocked(lockspace, resname, owner);
+    virMutexUnlock(&lockspace->lock);
+
+    return ret;
+}
+
+
+/**
+ * virLockSpaceReleaseResources:
+ * @lockspace: the lockspace
+ * @nresources: number of entries in @resnames
+ * @resnames: names of the resources to release
+ * @owner: the process releasing the resources
+ *
+ * Release a set of resources in one go. Ownership of all of them
+ * is verified first, so that nothing is released if @owner does
+ * not hold any one of them, or lists one more often than it holds
+ * it.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virLockSpaceReleaseResources(virLockSpacePtr lockspace,
+                                 size_t nresources,
+                                 const char **resnames,
+                                 pid_t owner)
+{
+    int ret = -1;
+    size_t i;
+    size_t idx;
+
+    VIR_DEBUG("lockspace=%p nresources=%zu owner=%lld",
+              lockspace, nresources, (unsigned long long)owner);
+
+    virMutexLock(&lockspace->lock);
+
+    for (i = 0; i < nresources; i++) {
+        virLockSpaceResourcePtr res;
+        size_t wanted = 0;
+        size_t held = 0;
+        size_t j;
+
+        if (!(res = virLockSpaceFindOwnedResource(lockspace, resnames[i],
+                                                  owner, &idx)))
+            goto cleanup;
+
+        /* A name listed more than once must be held (shared) as many
+         * times, or the set would only be released in part */
+        for (j = 0; j < nresources; j++) {
+            if (STREQ(resnames[j], resnames[i]))
+                wanted++;
+        }
+        for (j = 0; j < res->nOwners; j++) {
+            if (res->owners[j] == owner)
+                held++;
+        }
+
+        if (held < wanted) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("owner %lld holds the resource lock '%s' "
+                             "%zu times, but %zu releases were requested"),
+                           (unsigned long long)owner, resnames[i],
+                           held, wanted);
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < nresources; i++) {
+        VIR_DEBUG("resname=%s", resnames[i]);
+        if (virLockSpaceReleaseResourceLocked(lockspace, resnames[i],
+                                              owner) < 0)
+            goto cleanup;
+    }
 
     ret = 0;
 
@@ -52,10 +52,21 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
                                 pid_t owner,
                                 unsigned int flags);
 
+int virLockSpaceAcquireResources(virLockSpacePtr lockspace,
+                                 size_t nresources,
+                                 const char **resnames,
+                                 const unsigned int *flags,
+                                 pid_t owner);
+
 int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
                                 const char *resname,
                                 pid_t owner);
 
+int virLockSpaceReleaseResources(virLockSpacePtr lockspace,
+                                 size_t nresources,
+                                 const char **resnames,
+                                 pid_t owner);
+
 int virLockSpaceReleaseResourcesForOwner(virLockSpacePtr lockspace,
                                          pid_t owner);
 
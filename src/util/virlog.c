@@ -31,6 +31,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <execinfo.h>
+#include <sched.h>
 #include <regex.h>
 #if HAVE_SYSLOG_H
 # include <syslog.h>
@@ -45,6 +46,7 @@
 #include "viralloc.h"
 #include "virutil.h"
 #include "virbuffer.h"
+#include "viratomic.h"
 #include "virthread.h"
 #include "virfile.h"
 #include "virtime.h"
@@ -113,8 +115,71 @@ static int virLogNbOutputs;
  */
 static virLogPriority virLogDefaultPriority = VIR_LOG_DEFAULT;
 
+/*
+ * Asynchronous logging: messages are queued on a bounded ring and
+ * written out by a dedicated thread, so that threads emitting log
+ * messages never block on the outputs or on virLogLock.
+ */
+struct _virLogRecord {
+    virLogSourcePtr source;
+    virLogPriority priority;
+    const char *filename;
+    int linenr;
+    const char *funcname;
+    unsigned long long thread;
+    unsigned long long when;
+    virLogMetadataPtr metadata;
+    unsigned int flags;
+    char *str;
+};
+typedef struct _virLogRecord virLogRecord;
+typedef virLogRecord *virLogRecordPtr;
+
+struct _virLogSlot {
+    int seq;
+    virLogRecordPtr rec;
+};
+typedef struct _virLogSlot virLogSlot;
+typedef virLogSlot *virLogSlotPtr;
+
+/* Number of messages the ring can hold, must be a power of two */
+#define VIR_LOG_ASYNC_SLOTS 4096
+
+/* How long virLogFlush waits for the writer thread, in ms */
+#define VIR_LOG_ASYNC_FLUSH_TIMEOUT (5 * 1000)
+
+static struct {
+    int enabled;                /* producers may queue messages */
+    size_t requested;           /* buffer size asked for */
+    bool forked;                /* this is a child process after fork() */
+    int users;                  /* producers currently queueing */
+    int maxBytes;               /* limit on the size of queued messages */
+    int queuedBytes;
+    int dropped;                /* messages lost due to a full queue */
+
+    /* Multi-producer, single-consumer ring. A producer claims slot
+     * tail % VIR_LOG_ASYNC_SLOTS by advancing tail, and publishes its
+     * record by setting the sequence number of the slot to tail + 1.
+     * The writer thread consumes slots in order from head. */
+    virLogSlotPtr slots;
+    int tail;
+    int head;
+
+    virMutex lock;
+    virCond cond;               /* wakes up the writer thread */
+    virCond flushed;            /* signalled as the writer catches up */
+    int sleeping;               /* the writer waits on cond */
+    size_t flushWaiters;
+    bool quit;
+    bool running;
+    unsigned long long writerID;
+    virThread writer;
+} virLogAsync;
+
 static int virLogResetFilters(void);
 static int virLogResetOutputs(void);
+static void virLogAsyncStop(void);
+static void virLogAsyncAtForkChild(void);
 static void virLogOutputToFd(virLogSourcePtr src,
                              virLogPriority priority,
                              const char *filename,
@@ -187,6 +252,14 @@ virLogOnceInit(void)
     if (virMutexInit(&virLogMutex) < 0)
         return -1;
 
+    if (virMutexInit(&virLogAsync.lock) < 0 ||
+        virCondInit(&virLogAsync.cond) < 0 ||
+        virCondInit(&virLogAsync.flushed) < 0)
+        return -1;
+
+    if (pthread_atfork(NULL, NULL, virLogAsyncAtForkChild) != 0)
+        return -1;
+
     virLogLock();
     virLogDefaultPriority = VIR_LOG_DEFAULT;
 
@@ -215,6 +288,9 @@ virLogReset(void)
     if (virLogInitialize() < 0)
         return -1;
 
+    virLogAsyncStop();
+    virLogAsync.requested = 0;
+
     virLogLock();
     virLogResetFilters();
     virLogResetOutputs();
@@ -417,6 +493,7 @@ virLogDefineOutput(virLogOutputFunc f,
 
 static int
 virLogFormatString(char **msg,
+                   unsigned long long thread,
                    int linenr,
                    const char *funcname,
                    virLogPriority priority,
@@ -433,11 +510,11 @@ virLogFormatString(char **msg,
      */
     if ((funcname != NULL)) {
         ret = virAsprintfQuiet(msg, "%llu: %s : %s:%d : %s\n",
-                               virThreadSelfID(), virLogPriorityString(priority),
+                               thread, virLogPriorityString(priority),
                                funcname, linenr, str);
     } else {
         ret = virAsprintfQuiet(msg, "%llu: %s : %s\n",
-                               virThreadSelfID(), virLogPriorityString(priority),
+                               thread, virLogPriorityString(priority),
                                str);
     }
     return ret;
@@ -449,7 +526,8 @@ virLogVersionString(const char **rawmsg,
                     char **msg)
 {
     *rawmsg = VIR_LOG_VERSION_STRING;
-    return virLogFormatString(msg, 0, NULL, VIR_LOG_INFO, VIR_LOG_VERSION_STRING);
+    return virLogFormatString(msg, virThreadSelfID(), 0, NULL, VIR_LOG_INFO,
+                              VIR_LOG_VERSION_STRING);
 }
 
 
@@ -509,6 +587,504 @@ virLogMessage(virLogSourcePtr source,
 }
 
 
+/*
+ * Pushes a message to the outputs defined, if none exist then
+ * use stderr. Must be called with virLogLock held.
+ */
+static void
+virLogDispatch(virLogSourcePtr source,
+               virLogPriority priority,
+               const char *filename,
+               int linenr,
+               const char *funcname,
+               const char *timestamp,
+               virLogMetadataPtr metadata,
+               unsigned int filterflags,
+               const char *str,
+               const char *msg)
+{
+    static bool logVersionStderr = true;
+    size_t i;
+
+    for (i = 0; i < virLogNbOutputs; i++) {
+        if (priority >= virLogOutputs[i].priority) {
+            if (virLogOutputs[i].logVersion) {
+                const char *rawver;
+                char *ver = NULL;
+                if (virLogVersionString(&rawver, &ver) >= 0)
+                    virLogOutputs[i].f(&virLogSelf, VIR_LOG_INFO,
+                                       __FILE__, __LINE__, __func__,
+                                       timestamp, NULL, 0, rawver, ver,
+                                       virLogOutputs[i].data);
+                VIR_FREE(ver);
+                virLogOutputs[i].logVersion = false;
+            }
+            virLogOutputs[i].f(source, priority,
+                               filename, linenr, funcname,
+                               timestamp, metadata, filterflags,
+                               str, msg, virLogOutputs[i].data);
+        }
+    }
+    if (virLogNbOutputs == 0) {
+        if (logVersionStderr) {
+            const char *rawver;
+            char *ver = NULL;
+            if (virLogVersionString(&rawver, &ver) >= 0)
+                virLogOutputToFd(&virLogSelf, VIR_LOG_INFO,
+                                 __FILE__, __LINE__, __func__,
+                                 timestamp, NULL, 0, rawver, ver,
+                                 (void *) STDERR_FILENO);
+            VIR_FREE(ver);
+            logVersionStderr = false;
+        }
+        virLogOutputToFd(source, priority,
+                         filename, linenr, funcname,
+                         timestamp, metadata, filterflags,
+                         str, msg, (void *) STDERR_FILENO);
+    }
+}
+
+
+static void
+virLogRecordFree(virLogRecordPtr rec)
+{
+    size_t i;
+
+    if (!rec)
+        return;
+
+    for (i = 0; rec->metadata && rec->metadata[i].key; i++) {
+        char *str = (char *) rec->metadata[i].s;
+        VIR_FREE(str);
+    }
+    VIR_FREE(rec->metadata);
+    VIR_FREE(rec->str);
+    VIR_FREE(rec);
+}
+
+
+/* Formats the timestamp and prefix of a queued message and hands it
+ * to the outputs. Must be called with virLogLock held. */
+static void
+virLogRecordDispatch(virLogRecordPtr rec)
+{
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    char *msg = NULL;
+
+    if (virLogFormatString(&msg, rec->thread, rec->linenr, rec->funcname,
+                           rec->priority, rec->str) < 0)
+        return;
+
+    if (virTimeStringThenRaw(rec->when, timestamp) < 0)
+        timestamp[0] = '\0';
+
+    virLogDispatch(rec->source, rec->priority,
+                   rec->filename, rec->linenr, rec->funcname,
+                   timestamp, rec->metadata, rec->flags,
+                   rec->str, msg);
+    VIR_FREE(msg);
+}
+
+
+/* Takes the next published record off the ring, if any. Only
+ * ever called by the writer thread. */
+static virLogRecordPtr
+virLogAsyncDequeue(void)
+{
+    int pos = virLogAsync.head;
+    virLogSlotPtr slot = &virLogAsync.slots[pos & (VIR_LOG_ASYNC_SLOTS - 1)];
+    virLogRecordPtr rec;
+
+    if (virAtomicIntGet(&slot->seq) != (int) ((unsigned int) pos + 1))
+        return NULL;
+
+    rec = slot->rec;
+    slot->rec = NULL;
+    virAtomicIntSet(&slot->seq, (int) ((unsigned int) pos +
+                                       VIR_LOG_ASYNC_SLOTS));
+    virAtomicIntSet(&virLogAsync.head, (int) ((unsigned int) pos + 1));
+    return rec;
+}
+
+
+static bool
+virLogAsyncIsEmpty(void)
+{
+    int pos = virAtomicIntGet(&virLogAsync.head);
+    virLogSlotPtr slot = &virLogAsync.slots[pos & (VIR_LOG_ASYNC_SLOTS - 1)];
+
+    return virAtomicIntGet(&slot->seq) != (int) ((unsigned int) pos + 1);
+}
+
+
+/* Queues @rec, returns -1 if the ring is full */
+static int
+virLogAsyncEnqueue(virLogRecordPtr rec)
+{
+    virLogSlotPtr slot;
+    int pos;
+    int diff;
+
+    for (;;) {
+        pos = virAtomicIntGet(&virLogAsync.tail);
+        slot = &virLogAsync.slots[pos & (VIR_LOG_ASYNC_SLOTS - 1)];
+        diff = (int) ((unsigned int) virAtomicIntGet(&slot->seq) -
+                      (unsigned int) pos);
+
+        if (diff < 0)
+            return -1;
+
+        /* Otherwise another producer claimed the slot first */
+        if (diff == 0 &&
+            virAtomicIntCompareExchange(&virLogAsync.tail, pos,
+                                        (int) ((unsigned int) pos + 1)))
+            break;
+    }
+
+    slot->rec = rec;
+    virAtomicIntSet(&slot->seq, (int) ((unsigned int) pos + 1));
+    return 0;
+}
+
+
+static void
+virLogAsyncReportDropped(int dropped)
+{
+    virLogRecord rec = {
+        .source = &virLogSelf,
+        .priority = VIR_LOG_WARN,
+        .filename = __FILE__,
+        .linenr = __LINE__,
+        .funcname = __func__,
+        .thread = virLogAsync.writerID,
+    };
+
+    if (virTimeMillisNowRaw(&rec.when) < 0)
+        rec.when = 0;
+    if (virAsprintfQuiet(&rec.str, "%d log messages were dropped", dropped) < 0)
+        return;
+
+    virLogLock();
+    virLogRecordDispatch(&rec);
+    virLogUnlock();
+    VIR_FREE(rec.str);
+}
+
+
+static void
+virLogAsyncWriter(void *opaque ATTRIBUTE_UNUSED)
+{
+    virLogRecordPtr rec;
+    unsigned long long now;
+    size_t n;
+    int dropped;
+
+    virLogAsync.writerID = virThreadSelfID();
+
+    for (;;) {
+        /* Dispatch in batches so that configuration changes, which
+         * need virLogLock too, don't wait for the whole queue */
+        n = 0;
+        while (n < 64 && (rec = virLogAsyncDequeue())) {
+            if (n++ == 0)
+                virLogLock();
+            virLogRecordDispatch(rec);
+            virAtomicIntAdd(&virLogAsync.queuedBytes, -(int) strlen(rec->str));
+            virLogRecordFree(rec);
+        }
+        if (n)
+            virLogUnlock();
+
+        if ((dropped = virAtomicIntGet(&virLogAsync.dropped)) > 0) {
+            virAtomicIntAdd(&virLogAsync.dropped, -dropped);
+            virLogAsyncReportDropped(dropped);
+        }
+
+        virMutexLock(&virLogAsync.lock);
+        if (virLogAsync.flushWaiters)
+            virCondBroadcast(&virLogAsync.flushed);
+
+        virAtomicIntSet(&virLogAsync.sleeping, 1);
+        if (virLogAsyncIsEmpty()) {
+            if (virLogAsync.quit) {
+                virAtomicIntSet(&virLogAsync.sleeping, 0);
+                virMutexUnlock(&virLogAsync.lock);
+                break;
+            }
+            /* Producers only signal us when they see us sleeping,
+             * the timeout covers for any wakeup missed anyway */
+            if (virTimeMillisNowRaw(&now) == 0)
+                ignore_value(virCondWaitUntil(&virLogAsync.cond,
+                                              &virLogAsync.lock,
+                                              now + 1000));
+        }
+        virAtomicIntSet(&virLogAsync.sleeping, 0);
+        virMutexUnlock(&virLogAsync.lock);
+    }
+}
+
+
+/**
+ * virLogFlush:
+ *
+ * Waits until all messages queued so far by asynchronous logging
+ * were handed to the outputs. Does nothing if logging is
+ * synchronous.
+ */
+void
+virLogFlush(void)
+{
+    unsigned long long deadline;
+    int target;
+
+    if (!virAtomicIntGet(&virLogAsync.enabled) ||
+        virLogAsync.writerID == virThreadSelfID())
+        return;
+
+    if (virTimeMillisNowRaw(&deadline) < 0)
+        return;
+    deadline += VIR_LOG_ASYNC_FLUSH_TIMEOUT;
+
+    target = virAtomicIntGet(&virLogAsync.tail);
+
+    virMutexLock(&virLogAsync.lock);
+    virLogAsync.flushWaiters++;
+    virCondSignal(&virLogAsync.cond);
+    while (virLogAsync.running &&
+           (int) ((unsigned int) virAtomicIntGet(&virLogAsync.head) -
+                  (unsigned int) target) < 0) {
+        if (virCondWaitUntil(&virLogAsync.flushed, &virLogAsync.lock,
+                             deadline) < 0)
+            break;
+    }
+    virLogAsync.flushWaiters--;
+    virMutexUnlock(&virLogAsync.lock);
+}
+
+
+/* The writer thread does not survive fork(), so the child process
+ * abandons whatever was queued and logs synchronously unless it calls
+ * virLogSetAsync() again. The locks might have been held by the
+ * parent's threads. */
+static void
+virLogAsyncAtForkChild(void)
+{
+    size_t i;
+
+    virLogAsync.forked = true;
+    virLogAsync.requested = 0;
+    virLogAsync.enabled = 0;
+    virLogAsync.users = 0;
+    virLogAsync.sleeping = 0;
+    virLogAsync.flushWaiters = 0;
+    virLogAsync.quit = false;
+    virLogAsync.running = false;
+    virLogAsync.writerID = 0;
+
+    for (i = 0; virLogAsync.slots && i < VIR_LOG_ASYNC_SLOTS; i++)
+        virLogAsync.slots[i].rec = NULL;
+
+    ignore_value(virMutexInit(&virLogAsync.lock));
+    ignore_value(virCondInit(&virLogAsync.cond));
+    ignore_value(virCondInit(&virLogAsync.flushed));
+}
+
+
+/* Stops queueing messages and waits for the writer thread to write
+ * out what was queued already */
+static void
+virLogAsyncStop(void)
+{
+    if (!virLogAsync.running)
+        return;
+
+    virAtomicIntSet(&virLogAsync.enabled, 0);
+
+    while (virAtomicIntGet(&virLogAsync.users) > 0)
+        sched_yield();
+
+    virMutexLock(&virLogAsync.lock);
+    virLogAsync.quit = true;
+    virCondSignal(&virLogAsync.cond);
+    virMutexUnlock(&virLogAsync.lock);
+
+    virThreadJoin(&virLogAsync.writer);
+
+    virMutexLock(&virLogAsync.lock);
+    virLogAsync.running = false;
+    virLogAsync.quit = false;
+    virLogAsync.writerID = 0;
+    virCondBroadcast(&virLogAsync.flushed);
+    virMutexUnlock(&virLogAsync.lock);
+}
+
+
+/**
+ * virLogSetAsync:
+ * @maxBytes: limit on the size of messages waiting to be written
+ *
+ * Turns on asynchronous logging if @maxBytes is not 0. Messages are
+ * then formatted only partially and queued, and a separate thread
+ * hands them to the outputs. Once @maxBytes worth of messages, or
+ * VIR_LOG_ASYNC_SLOTS messages, are waiting, further messages are
+ * dropped and the number of dropped messages is logged later on.
+ * Errors, and messages filtered with the stack trace flag, are
+ * still written synchronously, after any queued messages.
+ *
+ * Passing 0 writes out all queued messages and makes logging
+ * synchronous again.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLogSetAsync(size_t maxBytes)
+{
+    size_t i;
+
+    if (virLogInitialize() < 0)
+        return -1;
+
+    virLogAsyncStop();
+
+    virLogAsync.requested = maxBytes;
+    if (maxBytes == 0)
+        return 0;
+
+    if (!virLogAsync.slots &&
+        VIR_ALLOC_N_QUIET(virLogAsync.slots, VIR_LOG_ASYNC_SLOTS) < 0)
+        return -1;
+
+    for (i = 0; i < VIR_LOG_ASYNC_SLOTS; i++) {
+        virLogAsync.slots[i].seq = i;
+        virLogAsync.slots[i].rec = NULL;
+    }
+    virLogAsync.head = 0;
+    virLogAsync.tail = 0;
+    virLogAsync.queuedBytes = 0;
+    virLogAsync.dropped = 0;
+    virLogAsync.maxBytes = MIN(maxBytes, INT_MAX / 2);
+
+    if (virThreadCreate(&virLogAsync.writer, true,
+                        virLogAsyncWriter, NULL) < 0)
+        return -1;
+
+    virLogAsync.running = true;
+    virAtomicIntSet(&virLogAsync.enabled, 1);
+    return 0;
+}
+
+
+/**
+ * virLogGetAsync:
+ *
+ * Returns the buffer size asynchronous logging is turned on with, or
+ * 0 if logging is synchronous. A daemon can use it to turn the writer
+ * thread off before forking into the background and on again after.
+ */
+size_t
+virLogGetAsync(void)
+{
+    if (virLogInitialize() < 0)
+        return 0;
+
+    return virLogAsync.requested;
+}
+
+
+/* Queues a message for the writer thread. Returns 0 if the message
+ * was queued or dropped, -1 if it must be written synchronously. */
+static int
+virLogAsyncQueue(virLogSourcePtr source,
+                 virLogPriority priority,
+                 const char *filename,
+                 int linenr,
+                 const char *funcname,
+                 virLogMetadataPtr metadata,
+                 unsigned int filterflags,
+                 char **str)
+{
+    virLogRecordPtr rec = NULL;
+    int len = strlen(*str);
+    size_t nmeta = 0;
+    size_t i;
+    int ret = -1;
+
+    virAtomicIntInc(&virLogAsync.users);
+    if (!virAtomicIntGet(&virLogAsync.enabled))
+        goto cleanup;
+
+    if (virAtomicIntAdd(&virLogAsync.queuedBytes, len) + len >
+        virLogAsync.maxBytes) {
+        virAtomicIntAdd(&virLogAsync.queuedBytes, -len);
+        goto drop;
+    }
+
+    if (VIR_ALLOC_QUIET(rec) < 0)
+        goto unqueue;
+
+    /* File and function names are string constants and don't need
+     * a copy, unlike the metadata */
+    rec->source = source;
+    rec->priority = priority;
+    rec->filename = filename;
+    rec->linenr = linenr;
+    rec->funcname = funcname;
+    rec->thread = virThreadSelfID();
+    rec->flags = filterflags;
+
+    if (metadata) {
+        while (metadata[nmeta].key)
+            nmeta++;
+        if (VIR_ALLOC_N_QUIET(rec->metadata, nmeta + 1) < 0)
+            goto unqueue;
+        for (i = 0; i < nmeta; i++) {
+            char *copy;
+            if (VIR_STRDUP_QUIET(copy, metadata[i].s) < 0)
+                goto unqueue;
+            rec->metadata[i].key = metadata[i].key;
+            rec->metadata[i].s = copy;
+            rec->metadata[i].iv = metadata[i].iv;
+        }
+    }
+
+    if (virTimeMillisNowRaw(&rec->when) < 0)
+        goto unqueue;
+
+    rec->str = *str;
+    *str = NULL;
+
+    if (virLogAsyncEnqueue(rec) < 0) {
+        *str = rec->str;
+        rec->str = NULL;
+        virLogRecordFree(rec);
+        virAtomicIntAdd(&virLogAsync.queuedBytes, -len);
+        goto drop;
+    }
+
+    if (virAtomicIntGet(&virLogAsync.sleeping)) {
+        virMutexLock(&virLogAsync.lock);
+        virCondSignal(&virLogAsync.cond);
+        virMutexUnlock(&virLogAsync.lock);
+    }
+
+    ret = 0;
+    goto cleanup;
+
+ drop:
+    virAtomicIntInc(&virLogAsync.dropped);
+    ret = 0;
+    goto cleanup;
+
+ unqueue:
+    virAtomicIntAdd(&virLogAsync.queuedBytes, -len);
+    virLogRecordFree(rec);
+
+ cleanup:
+    virAtomicIntAdd(&virLogAsync.users, -1);
+    return ret;
+}
+
+
 /**
  * virLogVMessage:
  * @source: where is that message coming from
@@ -533,12 +1109,10 @@ virLogVMessage(virLogSourcePtr source,
                const char *fmt,
                va_list vargs)
 {
-    static bool logVersionStderr = true;
     char *str = NULL;
     char *msg = NULL;
     char timestamp[VIR_TIME_STRING_BUFLEN];
     int ret;
-    size_t i;
     int saved_errno = errno;
     unsigned int filterflags = 0;
 
@@ -568,7 +1142,19 @@ virLogVMessage(virLogSourcePtr source,
     if (virVasprintfQuiet(&str, fmt, vargs) < 0)
         goto cleanup;
 
-    ret = virLogFormatString(&msg, linenr, funcname, priority, str);
+    /* Errors, and stack traces which have to be taken in this
+     * thread, are not queued but written out right away */
+    if (virAtomicIntGet(&virLogAsync.enabled)) {
+        if (priority < VIR_LOG_ERROR &&
+            !(filterflags & VIR_LOG_STACK_TRACE) &&
+            virLogAsyncQueue(source, priority, filename, linenr, funcname,
+                             metadata, filterflags, &str) == 0)
+            goto cleanup;
+        virLogFlush();
+    }
+
+    ret = virLogFormatString(&msg, virThreadSelfID(), linenr, funcname,
+                             priority, str);
     if (ret < 0)
         goto cleanup;
 
@@ -576,47 +1162,8 @@ virLogVMessage(virLogSourcePtr source,
         timestamp[0] = '\0';
 
     virLogLock();
-
-    /*
-     * Push the message to the outputs defined, if none exist then
-     * use stderr.
-     */
-    for (i = 0; i < virLogNbOutputs; i++) {
-        if (priority >= virLogOutputs[i].priority) {
-            if (virLogOutputs[i].logVersion) {
-                const char *rawver;
-                char *ver = NULL;
-                if (virLogVersionString(&rawver, &ver) >= 0)
-                    virLogOutputs[i].f(&virLogSelf, VIR_LOG_INFO,
-                                       __FILE__, __LINE__, __func__,
-                                       timestamp, NULL, 0, rawver, ver,
-                                       virLogOutputs[i].data);
-                VIR_FREE(ver);
-                virLogOutputs[i].logVersion = false;
-            }
-            virLogOutputs[i].f(source, priority,
-                               filename, linenr, funcname,
-                               timestamp, metadata, filterflags,
-                               str, msg, virLogOutputs[i].data);
-        }
-    }
-    if (virLogNbOutputs == 0) {
-        if (logVersionStderr) {
-            const char *rawver;
-            char *ver = NULL;
-            if (virLogVersionString(&rawver, &ver) >= 0)
-                virLogOutputToFd(&virLogSelf, VIR_LOG_INFO,
-                                 __FILE__, __LINE__, __func__,
-                                 timestamp, NULL, 0, rawver, ver,
-                                 (void *) STDERR_FILENO);
-            VIR_FREE(ver);
-            logVersionStderr = false;
-        }
-        virLogOutputToFd(source, priority,
-                         filename, linenr, funcname,
-                         timestamp, metadata, filterflags,
-                         str, msg, (void *) STDERR_FILENO);
-    }
+    virLogDispatch(source, priority, filename, linenr, funcname,
+                   timestamp, metadata, filterflags, str, msg);
     virLogUnlock();
 
  cleanup:
@@ -1377,7 +1924,10 @@ virLogParseDefaultPriority(const char *priority)
  * virLogSetFromEnv:
  *
  * Sets virLogDefaultPriority, virLogFilters and virLogOutputs based on
- * environment variables.
+ * environment variables, and turns on asynchronous logging if
+ * LIBVIRT_LOG_ASYNC gives a buffer size in KiB. The latter is ignored
+ * in a child process after fork(), which is about to exec() and must
+ * not start threads.
  */
 void
 virLogSetFromEnv(void)
@@ -1396,6 +1946,13 @@ virLogSetFromEnv(void)
     debugEnv = virGetEnvAllowSUID("LIBVIRT_LOG_OUTPUTS");
     if (debugEnv && *debugEnv)
         virLogParseOutputs(debugEnv);
+    debugEnv = virGetEnvAllowSUID("LIBVIRT_LOG_ASYNC");
+    if (debugEnv && *debugEnv) {
+        unsigned int kib;
+        if (!virLogAsync.forked &&
+            virStrToLong_ui(debugEnv, NULL, 10, &kib) == 0)
+            ignore_value(virLogSetAsync((size_t) kib * 1024));
+    }
 }
 
 
@@ -194,6 +194,9 @@ extern int virLogDefineOutput(virLogOutputFunc f,
 extern void virLogLock(void);
 extern void virLogUnlock(void);
 extern int virLogReset(void);
+extern int virLogSetAsync(size_t maxBytes);
+extern size_t virLogGetAsync(void);
+extern void virLogFlush(void);
 extern int virLogParseDefaultPriority(const char *priority);
 extern int virLogParseFilters(const char *filters);
 extern int virLogParseOutputs(const char *output);
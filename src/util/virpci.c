@@ -45,6 +45,7 @@
 #include "virkmod.h"
 #include "virstring.h"
 #include "virutil.h"
+#include "virthread.h"
 
 VIR_LOG_INIT("util.pci");
 
@@ -188,10 +189,21 @@ struct _virPCIDeviceList {
 
 static virClassPtr virPCIDeviceListClass;
 
+/* Devices may be reset from several threads at once. A secondary
+ * bus reset hits every device behind the bridge though, so it must
+ * not overlap with any other reset. */
+static virRWLock virPCIResetLock;
+
 static void virPCIDeviceListDispose(void *obj);
 
 static int virPCIOnceInit(void)
 {
+    if (virRWLockInit(&virPCIResetLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize PCI reset lock"));
+        return -1;
+    }
+
     if (!(virPCIDeviceListClass = virClassNew(virClassForObjectLockable(),
                                               "virPCIDeviceList",
                                               sizeof(virPCIDeviceList),
@@ -929,6 +941,9 @@ virPCIDeviceReset(virPCIDevicePtr dev,
     int ret = -1;
     int fd = -1;
 
+    if (virPCIInitialize() < 0)
+        return -1;
+
     if (activeDevs && virPCIDeviceListFind(activeDevs, dev)) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Not resetting active device %s"), dev->name);
@@ -969,12 +984,18 @@ virPCIDeviceReset(virPCIDevicePtr dev,
      * that's the next best thing because it only resets
      * the function, not the whole device.
      */
-    if (dev->has_pm_reset)
+    if (dev->has_pm_reset) {
+        virRWLockRead(&virPCIResetLock);
         ret = virPCIDeviceTryPowerManagementReset(dev, fd);
+        virRWLockUnlock(&virPCIResetLock);
+    }
 
     /* Bus reset is not an option with the root bus */
-    if (ret < 0 && dev->bus != 0)
+    if (ret < 0 && dev->bus != 0) {
+        virRWLockWrite(&virPCIResetLock);
         ret = virPCIDeviceTrySecondaryBusReset(dev, fd, inactiveDevs);
+        virRWLockUnlock(&virPCIResetLock);
+    }
 
     if (ret < 0) {
         virErrorPtr err = virGetLastError();
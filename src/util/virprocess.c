@@ -49,8 +49,16 @@
 # include <sys/cpuset.h>
 #endif
 
+#ifdef __linux__
+# include <poll.h>
+# if HAVE_SYS_SYSCALL_H
+#  include <sys/syscall.h>
+# endif
+#endif
+
 #include "viratomic.h"
-#include "virprocess.h"
+#define __VIR_PROCESS_PRIV_H_ALLOW__
+#include "virprocesspriv.h"
 #include "virerror.h"
 #include "viralloc.h"
 #include "virfile.h"
@@ -58,11 +66,17 @@
 #include "virutil.h"
 #include "virstring.h"
 #include "vircommand.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
 VIR_LOG_INIT("util.process");
 
+/* How long in milliseconds virProcessKillPainfully waits for a process
+ * to exit after SIGTERM and after SIGKILL, see virProcessSetKillTimeouts */
+static unsigned long long virProcessKillTermTimeout = 10000;
+static unsigned long long virProcessKillKillTimeout = 5000;
+
 #ifdef __linux__
 /*
  * Workaround older glibc. While kernel may support the setns
@@ -106,6 +120,14 @@ static inline int setns(int fd ATTRIBUTE_UNUSED, int nstype ATTRIBUTE_UNUSED)
 }
 #endif
 
+/* Without the syscall number in the headers, wait for processes to
+ * exit by polling them rather than guessing it */
+#if defined(__linux__) && defined(SYS_pidfd_open)
+# define VIR_PROCESS_PIDFD_OPEN SYS_pidfd_open
+#elif defined(__linux__) && defined(__NR_pidfd_open)
+# define VIR_PROCESS_PIDFD_OPEN __NR_pidfd_open
+#endif
+
 VIR_ENUM_IMPL(virProcessSchedPolicy, VIR_PROC_POLICY_LAST,
               "none",
               "batch",
@@ -335,6 +357,101 @@ int virProcessKill(pid_t pid, int sig)
 }
 
 
+/*
+ * Get a file descriptor referring to the process @pid that becomes
+ * readable once it exits, or -1 if the kernel does not support it.
+ */
+static int
+virProcessPidFDOpen(pid_t pid)
+{
+#ifdef VIR_PROCESS_PIDFD_OPEN
+    int fd;
+
+    if ((fd = syscall(VIR_PROCESS_PIDFD_OPEN, pid, 0)) < 0) {
+        VIR_DEBUG("pidfd_open failed for %lld: %d",
+                  (long long)pid, errno);
+        return -1;
+    }
+
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+
+/*
+ * Check whether @pid is gone. Our own children linger as zombies
+ * until they are reaped, which kill(pid, 0) can't tell apart from
+ * running processes, so ask waitid() first without reaping them.
+ */
+static bool
+virProcessIsGone(pid_t pid)
+{
+#if !defined(WIN32) && defined(WNOWAIT)
+    siginfo_t info;
+
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+        info.si_pid == pid)
+        return true;
+#endif
+
+    return virProcessKill(pid, 0) < 0 && errno == ESRCH;
+}
+
+
+/*
+ * Wait up to @timeout milliseconds for @pid to exit. If @pidfd is
+ * valid, sleep on it so that we wake up the moment the process
+ * exits, otherwise poll with backoff.
+ *
+ * Returns 1 if the process exited, 0 if it is still running,
+ * -1 on error.
+ */
+static int
+virProcessWaitExit(pid_t pid, int pidfd, unsigned long long timeout)
+{
+    virTimeBackOffVar timebackoff;
+
+    if (virProcessIsGone(pid))
+        return 1;
+
+#ifdef __linux__
+    if (pidfd >= 0) {
+        unsigned long long now, limit;
+
+        if (virTimeMillisNowRaw(&now) < 0)
+            return -1;
+        limit = now + timeout;
+
+        while (now < limit) {
+            struct pollfd pfd = { .fd = pidfd, .events = POLLIN };
+            int rc = poll(&pfd, 1, limit - now);
+
+            if (rc < 0 && errno != EINTR)
+                return -1;
+            if (rc > 0)
+                return 1;
+            if (virTimeMillisNowRaw(&now) < 0)
+                return -1;
+        }
+
+        return virProcessIsGone(pid) ? 1 : 0;
+    }
+#endif
+
+    if (virTimeBackOffStart(&timebackoff, 10, timeout) < 0)
+        return -1;
+    while (virTimeBackOffWait(&timebackoff)) {
+        if (virProcessIsGone(pid))
+            return 1;
+    }
+
+    return virProcessIsGone(pid) ? 1 : 0;
+}
+
+
 /*
  * Try to kill the process and verify it has exited
  *
@@ -345,63 +462,102 @@ int virProcessKill(pid_t pid, int sig)
 int
 virProcessKillPainfully(pid_t pid, bool force)
 {
-    size_t i;
     int ret = -1;
+    int pidfd;
+    int rc;
     const char *signame = "TERM";
 
     VIR_DEBUG("vpid=%lld force=%d", (long long)pid, force);
 
-    /* This loop sends SIGTERM, then waits a few iterations (10 seconds)
-     * to see if it dies. If the process still hasn't exited, and
-     * @force is requested, a SIGKILL will be sent, and this will
-     * wait upto 5 seconds more for the process to exit before
-     * returning.
+    /* Send SIGTERM, then wait up to 10 seconds to see if it dies.
+     * If the process still hasn't exited, and @force is requested,
+     * a SIGKILL will be sent, and this will wait upto 5 seconds
+     * more for the process to exit before returning. Without @force
+     * we just keep waiting for the whole 15 seconds.
+     *
+     * Where the kernel supports pidfd_open we sleep on the pidfd and
+     * return as soon as the process is gone.
      *
      * Note that setting @force could result in dataloss for the process.
      */
-    for (i = 0; i < 75; i++) {
-        int signum;
-        if (i == 0) {
-            signum = SIGTERM; /* kindly suggest it should exit */
-        } else if (i == 50 && force) {
-            VIR_DEBUG("Timed out waiting after SIGTERM to process %lld, "
-                      "sending SIGKILL", (long long)pid);
-            /* No SIGKILL kill on Win32 ! Use SIGABRT instead which our
-             * virProcessKill proc will handle more or less like SIGKILL */
+    pidfd = virProcessPidFDOpen(pid);
+
+    if (virProcessKill(pid, SIGTERM) < 0) {
+        if (errno != ESRCH)
+            goto error;
+        ret = 0; /* process is dead */
+        goto cleanup;
+    }
+
+    if ((rc = virProcessWaitExit(pid, pidfd,
+                                 force ? virProcessKillTermTimeout :
+                                 virProcessKillTermTimeout +
+                                 virProcessKillKillTimeout)) < 0)
+        goto error;
+    if (rc > 0) {
+        ret = 1;
+        goto cleanup;
+    }
+
+    if (!force) {
+        errno = EBUSY;
+        goto error;
+    }
+
+    VIR_DEBUG("Timed out waiting after SIGTERM to process %lld, "
+              "sending SIGKILL", (long long)pid);
+    /* No SIGKILL kill on Win32 ! Use SIGABRT instead which our
+     * virProcessKill proc will handle more or less like SIGKILL */
 #ifdef WIN32
-            signum = SIGABRT; /* kill it after a grace period */
-            signame = "ABRT";
+    signame = "ABRT";
+    rc = virProcessKill(pid, SIGABRT); /* kill it after a grace period */
 #else
-            signum = SIGKILL; /* kill it after a grace period */
-            signame = "KILL";
+    signame = "KILL";
+    rc = virProcessKill(pid, SIGKILL); /* kill it after a grace period */
 #endif
-        } else {
-            signum = 0; /* Just check for existence */
-        }
-
-        if (virProcessKill(pid, signum) < 0) {
-            if (errno != ESRCH) {
-                virReportSystemError(errno,
-                                     _("Failed to terminate process %lld with SIG%s"),
-                                     (long long)pid, signame);
-                goto cleanup;
-            }
-            ret = signum == SIGTERM ? 0 : 1;
-            goto cleanup; /* process is dead */
-        }
+    if (rc < 0) {
+        if (errno != ESRCH)
+            goto error;
+        ret = 1;
+        goto cleanup;
+    }
 
-        usleep(200 * 1000);
+    if ((rc = virProcessWaitExit(pid, pidfd, virProcessKillKillTimeout)) < 0)
+        goto error;
+    if (rc > 0) {
+        ret = 1;
+        goto cleanup;
     }
 
-    virReportSystemError(EBUSY,
+    errno = EBUSY;
+ error:
+    virReportSystemError(errno,
                          _("Failed to terminate process %lld with SIG%s"),
                          (long long)pid, signame);
 
  cleanup:
+    VIR_FORCE_CLOSE(pidfd);
     return ret;
 }
 
 
+/**
+ * virProcessSetKillTimeouts:
+ * @term: milliseconds to wait after SIGTERM
+ * @kill: milliseconds to wait after SIGKILL
+ *
+ * Changes the timeouts used by virProcessKillPainfully, so that
+ * tests don't have to wait for the whole grace period.
+ */
+void
+virProcessSetKillTimeouts(unsigned long long term,
+                          unsigned long long kill)
+{
+    virProcessKillTermTimeout = term;
+    virProcessKillKillTimeout = kill;
+}
+
+
 #if HAVE_SCHED_GETAFFINITY
 
 int virProcessSetAffinity(pid_t pid, virBitmapPtr map)
@@ -26,49 +26,90 @@
 
 #include <config.h>
 
+#include <unistd.h>
+
 #include "virthreadpool.h"
 #include "viralloc.h"
 #include "virthread.h"
 #include "virerror.h"
+#include "viratomic.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
+/* Most job queues a pool is split into */
+#define VIR_THREAD_POOL_MAX_QUEUES 16
+
 typedef struct _virThreadPoolJob virThreadPoolJob;
 typedef virThreadPoolJob *virThreadPoolJobPtr;
 
 struct _virThreadPoolJob {
-    virThreadPoolJobPtr prev;
     virThreadPoolJobPtr next;
     unsigned int priority;
 
     void *data;
 };
 
-typedef struct _virThreadPoolJobList virThreadPoolJobList;
-typedef virThreadPoolJobList *virThreadPoolJobListPtr;
+/* Jobs sent with the same key, in the order they were sent */
+typedef struct _virThreadPoolKey virThreadPoolKey;
+typedef virThreadPoolKey *virThreadPoolKeyPtr;
+
+struct _virThreadPoolKey {
+    virThreadPoolKeyPtr next;
+    const void *key;
 
-struct _virThreadPoolJobList {
     virThreadPoolJobPtr head;
     virThreadPoolJobPtr tail;
-    virThreadPoolJobPtr firstPrio;
+};
+
+/*
+ * Jobs are spread over several queues by their key, each with its
+ * own lock, so that submitters and workers rarely contend. Every
+ * worker has a home queue it sleeps on, but takes jobs from the
+ * other queues too once its own is empty. Within a queue, the keys
+ * with pending jobs are served round robin, so a submitter sending
+ * many jobs can't hold back another one.
+ */
+typedef struct _virThreadPoolQueue virThreadPoolQueue;
+typedef virThreadPoolQueue *virThreadPoolQueuePtr;
+
+struct _virThreadPoolQueue {
+    virMutex lock;
+    virCond cond;
+
+    virThreadPoolKeyPtr head;
+    virThreadPoolKeyPtr tail;
+
+    int idle;                   /* workers waiting on cond, not signalled */
+    int wakeups;                /* workers signalled, but not awake yet */
 };
 
 
 struct _virThreadPool {
-    bool quit;
+    int quit;
 
     virThreadPoolJobFunc jobFunc;
     void *jobOpaque;
-    virThreadPoolJobList jobList;
-    size_t jobQueueDepth;
 
+    size_t nqueues;
+    virThreadPoolQueuePtr queues;
+
+    /* Updated atomically, for a lock free view of the whole pool */
+    int pending;                /* jobs queued */
+    int pendingPrio;            /* ... of which high priority */
+    int pendingLong;            /* ... of which long */
+    int keys;                   /* keys with jobs queued */
+    int heldKeys;               /* ... of which the next job is long */
+    int runningLong;            /* long jobs being run */
+    int maxLong;                /* most long jobs to run at once */
+    int freeWorkers;
+    int freePrioWorkers;
+
+    /* Protects the list of workers */
     virMutex mutex;
-    virCond cond;
     virCond quit_cond;
 
     size_t maxWorkers;
     size_t minWorkers;
-    size_t freeWorkers;
     size_t nWorkers;
     virThreadPtr workers;
 
@@ -79,74 +120,215 @@ struct _virThreadPool {
 
 struct virThreadPoolWorkerData {
     virThreadPoolPtr pool;
-    virCondPtr cond;
+    size_t queue;
     bool priority;
 };
 
+
+/* Whether there's a job some worker may take right now */
+static bool
+virThreadPoolHasRunnable(virThreadPoolPtr pool,
+                         bool priority)
+{
+    int pending;
+    int maxLong;
+
+    if (priority)
+        return virAtomicIntGet(&pool->pendingPrio) > 0;
+
+    /* Once no more long jobs may run, keys with a long job up next
+     * wait for it, including the jobs queued after it */
+    maxLong = virAtomicIntGet(&pool->maxLong);
+    if (maxLong && virAtomicIntGet(&pool->runningLong) >= maxLong)
+        return virAtomicIntGet(&pool->keys) -
+            virAtomicIntGet(&pool->heldKeys) > 0;
+
+    pending = virAtomicIntGet(&pool->pending);
+    return pending > 0;
+}
+
+
+/* Accounts for a long job about to be run, unless the limit on
+ * long jobs is reached already */
+static bool
+virThreadPoolClaimLong(virThreadPoolPtr pool)
+{
+    int running;
+    int maxLong;
+
+    do {
+        running = virAtomicIntGet(&pool->runningLong);
+        maxLong = virAtomicIntGet(&pool->maxLong);
+        if (maxLong && running >= maxLong)
+            return false;
+    } while (!virAtomicIntCompareExchange(&pool->runningLong,
+                                          running, running + 1));
+
+    return true;
+}
+
+
+/*
+ * Takes the next job off @queue. Priority workers only take high
+ * priority jobs, wherever they are queued. Others take the first
+ * job of the next key, passing over keys whose first job is a long
+ * one that has to wait.
+ */
+static virThreadPoolJobPtr
+virThreadPoolQueueTake(virThreadPoolPtr pool,
+                       virThreadPoolQueuePtr queue,
+                       bool priority)
+{
+    virThreadPoolKeyPtr key;
+    virThreadPoolKeyPtr prevKey = NULL;
+    virThreadPoolJobPtr job = NULL;
+    virThreadPoolJobPtr prevJob = NULL;
+    bool canRunLong = true;
+
+    virMutexLock(&queue->lock);
+
+    for (key = queue->head; key; prevKey = key, key = key->next) {
+        prevJob = NULL;
+        if (priority) {
+            for (job = key->head; job; prevJob = job, job = job->next) {
+                if (job->priority == VIR_THREAD_POOL_PRIORITY_HIGH)
+                    break;
+            }
+        } else {
+            /* Jobs of a key start in order, so those behind a long
+             * job wait along with it */
+            job = key->head;
+            if (job->priority == VIR_THREAD_POOL_PRIORITY_LONG) {
+                if (canRunLong)
+                    canRunLong = virThreadPoolClaimLong(pool);
+                if (!canRunLong)
+                    job = NULL;
+            }
+        }
+        if (job)
+            break;
+    }
+
+    if (!job)
+        goto cleanup;
+
+    if (key->head == job &&
+        job->priority == VIR_THREAD_POOL_PRIORITY_LONG)
+        virAtomicIntAdd(&pool->heldKeys, -1);
+
+    if (prevJob)
+        prevJob->next = job->next;
+    else
+        key->head = job->next;
+    if (key->tail == job)
+        key->tail = prevJob;
+    job->next = NULL;
+
+    /* Move the key to the back of the queue, or drop it if it has
+     * no jobs left */
+    if (prevKey)
+        prevKey->next = key->next;
+    else
+        queue->head = key->next;
+    if (queue->tail == key)
+        queue->tail = prevKey;
+    key->next = NULL;
+
+    if (key->head) {
+        if (queue->tail)
+            queue->tail->next = key;
+        else
+            queue->head = key;
+        queue->tail = key;
+        if (!prevJob &&
+            key->head->priority == VIR_THREAD_POOL_PRIORITY_LONG)
+            virAtomicIntInc(&pool->heldKeys);
+    } else {
+        VIR_FREE(key);
+        virAtomicIntAdd(&pool->keys, -1);
+    }
+
+    virAtomicIntAdd(&pool->pending, -1);
+    if (job->priority == VIR_THREAD_POOL_PRIORITY_HIGH)
+        virAtomicIntAdd(&pool->pendingPrio, -1);
+    else if (job->priority == VIR_THREAD_POOL_PRIORITY_LONG)
+        virAtomicIntAdd(&pool->pendingLong, -1);
+
+ cleanup:
+    virMutexUnlock(&queue->lock);
+    return job;
+}
+
+
 static void virThreadPoolWorker(void *opaque)
 {
     struct virThreadPoolWorkerData *data = opaque;
     virThreadPoolPtr pool = data->pool;
-    virCondPtr cond = data->cond;
+    virThreadPoolQueuePtr home = &pool->queues[data->queue];
+    size_t first = data->queue;
     bool priority = data->priority;
     virThreadPoolJobPtr job = NULL;
+    size_t i;
+    int rc;
 
     VIR_FREE(data);
 
-    virMutexLock(&pool->mutex);
-
-    while (1) {
-        while (!pool->quit &&
-               ((!priority && !pool->jobList.head) ||
-                (priority && !pool->jobList.firstPrio))) {
-            if (!priority)
-                pool->freeWorkers++;
-            if (virCondWait(cond, &pool->mutex) < 0) {
-                if (!priority)
-                    pool->freeWorkers--;
-                goto out;
-            }
-            if (!priority)
-                pool->freeWorkers--;
+    while (!virAtomicIntGet(&pool->quit)) {
+        /* Start with our own queue, then steal from the others */
+        job = NULL;
+        for (i = 0; i < pool->nqueues && !job; i++)
+            job = virThreadPoolQueueTake(pool,
+                                         &pool->queues[(first + i) %
+                                                       pool->nqueues],
+                                         priority);
+
+        if (job) {
+            (pool->jobFunc)(job->data, pool->jobOpaque);
+            if (job->priority == VIR_THREAD_POOL_PRIORITY_LONG)
+                virAtomicIntAdd(&pool->runningLong, -1);
+            VIR_FREE(job);
+            continue;
         }
 
-        if (pool->quit)
-            break;
-
+        /* Submitters bump the pending counters before they look for
+         * sleeping workers, and we announce ourselves before we check
+         * the counters, so no wakeup can be lost in between */
         if (priority) {
-            job = pool->jobList.firstPrio;
+            virMutexLock(&pool->mutex);
+            virAtomicIntInc(&pool->freePrioWorkers);
+            if (virAtomicIntGet(&pool->quit) ||
+                virThreadPoolHasRunnable(pool, true))
+                rc = 0;
+            else
+                rc = virCondWait(&pool->prioCond, &pool->mutex);
+            virAtomicIntAdd(&pool->freePrioWorkers, -1);
+            virMutexUnlock(&pool->mutex);
         } else {
-            job = pool->jobList.head;
-        }
-
-        if (job == pool->jobList.firstPrio) {
-            virThreadPoolJobPtr tmp = job->next;
-            while (tmp) {
-                if (tmp->priority)
-                    break;
-                tmp = tmp->next;
+            virMutexLock(&home->lock);
+            virAtomicIntInc(&home->idle);
+            virAtomicIntInc(&pool->freeWorkers);
+            rc = 0;
+            if (!virAtomicIntGet(&pool->quit) &&
+                !virThreadPoolHasRunnable(pool, false)) {
+                while (rc == 0 && home->wakeups == 0 &&
+                       !virAtomicIntGet(&pool->quit))
+                    rc = virCondWait(&home->cond, &home->lock);
+            }
+            /* A pending wakeup counted one of us off already */
+            if (home->wakeups > 0) {
+                home->wakeups--;
+            } else {
+                virAtomicIntAdd(&pool->freeWorkers, -1);
+                virAtomicIntAdd(&home->idle, -1);
             }
-            pool->jobList.firstPrio = tmp;
+            virMutexUnlock(&home->lock);
         }
 
-        if (job->prev)
-            job->prev->next = job->next;
-        else
-            pool->jobList.head = job->next;
-        if (job->next)
-            job->next->prev = job->prev;
-        else
-            pool->jobList.tail = job->prev;
-
-        pool->jobQueueDepth--;
-
-        virMutexUnlock(&pool->mutex);
-        (pool->jobFunc)(job->data, pool->jobOpaque);
-        VIR_FREE(job);
-        virMutexLock(&pool->mutex);
+        if (rc < 0)
+            break;
     }
 
- out:
+    virMutexLock(&pool->mutex);
     if (priority)
         pool->nPrioWorkers--;
     else
@@ -156,6 +338,41 @@ static void virThreadPoolWorker(void *opaque)
     virMutexUnlock(&pool->mutex);
 }
 
+
+/* Must be called with pool->mutex held */
+static int
+virThreadPoolSpawnWorkerLocked(virThreadPoolPtr pool,
+                               bool priority)
+{
+    struct virThreadPoolWorkerData *data = NULL;
+    virThreadPtr thread;
+
+    if (VIR_ALLOC(data) < 0)
+        return -1;
+
+    data->pool = pool;
+    data->priority = priority;
+
+    if (priority) {
+        thread = &pool->prioWorkers[pool->nPrioWorkers];
+    } else {
+        thread = &pool->workers[pool->nWorkers];
+        data->queue = pool->nWorkers % pool->nqueues;
+    }
+
+    if (virThreadCreate(thread, true, virThreadPoolWorker, data) < 0) {
+        VIR_FREE(data);
+        return -1;
+    }
+
+    if (priority)
+        pool->nPrioWorkers++;
+    else
+        pool->nWorkers++;
+    return 0;
+}
+
+
 virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
                                   size_t maxWorkers,
                                   size_t prioWorkers,
@@ -164,7 +381,6 @@ virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
 {
     virThreadPoolPtr pool;
     size_t i;
-    struct virThreadPoolWorkerData *data = NULL;
 
     if (minWorkers > maxWorkers)
         minWorkers = maxWorkers;
@@ -172,66 +388,60 @@ virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
     if (VIR_ALLOC(pool) < 0)
         return NULL;
 
-    pool->jobList.tail = pool->jobList.head = NULL;
-
     pool->jobFunc = func;
     pool->jobOpaque = opaque;
 
     if (virMutexInit(&pool->mutex) < 0)
         goto error;
-    if (virCondInit(&pool->cond) < 0)
-        goto error;
     if (virCondInit(&pool->quit_cond) < 0)
         goto error;
+    if (virCondInit(&pool->prioCond) < 0)
+        goto error;
+
+    /* One queue per initial worker, so that they rarely meet */
+    pool->nqueues = minWorkers;
+    if (pool->nqueues > VIR_THREAD_POOL_MAX_QUEUES)
+        pool->nqueues = VIR_THREAD_POOL_MAX_QUEUES;
+    if (pool->nqueues == 0)
+        pool->nqueues = 1;
+    if (VIR_ALLOC_N(pool->queues, pool->nqueues) < 0)
+        goto error;
+    for (i = 0; i < pool->nqueues; i++) {
+        if (virMutexInit(&pool->queues[i].lock) < 0 ||
+            virCondInit(&pool->queues[i].cond) < 0) {
+            pool->nqueues = i;
+            goto error;
+        }
+    }
 
-    if (VIR_ALLOC_N(pool->workers, minWorkers) < 0)
+    if (VIR_ALLOC_N(pool->workers, maxWorkers) < 0)
+        goto error;
+    if (prioWorkers &&
+        VIR_ALLOC_N(pool->prioWorkers, prioWorkers) < 0)
         goto error;
 
     pool->minWorkers = minWorkers;
     pool->maxWorkers = maxWorkers;
 
+    virMutexLock(&pool->mutex);
     for (i = 0; i < minWorkers; i++) {
-        if (VIR_ALLOC(data) < 0)
-            goto error;
-        data->pool = pool;
-        data->cond = &pool->cond;
-
-        if (virThreadCreate(&pool->workers[i],
-                            true,
-                            virThreadPoolWorker,
-                            data) < 0) {
+        if (virThreadPoolSpawnWorkerLocked(pool, false) < 0) {
+            virMutexUnlock(&pool->mutex);
             goto error;
         }
-        pool->nWorkers++;
     }
 
-    if (prioWorkers) {
-        if (virCondInit(&pool->prioCond) < 0)
-            goto error;
-        if (VIR_ALLOC_N(pool->prioWorkers, prioWorkers) < 0)
+    for (i = 0; i < prioWorkers; i++) {
+        if (virThreadPoolSpawnWorkerLocked(pool, true) < 0) {
+            virMutexUnlock(&pool->mutex);
             goto error;
-
-        for (i = 0; i < prioWorkers; i++) {
-            if (VIR_ALLOC(data) < 0)
-                goto error;
-            data->pool = pool;
-            data->cond = &pool->prioCond;
-            data->priority = true;
-
-            if (virThreadCreate(&pool->prioWorkers[i],
-                                true,
-                                virThreadPoolWorker,
-                                data) < 0) {
-                goto error;
-            }
-            pool->nPrioWorkers++;
         }
     }
+    virMutexUnlock(&pool->mutex);
 
     return pool;
 
  error:
-    VIR_FREE(data);
     virThreadPoolFree(pool);
     return NULL;
 
@@ -239,8 +449,8 @@ virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
 
 void virThreadPoolFree(virThreadPoolPtr pool)
 {
+    virThreadPoolKeyPtr key;
     virThreadPoolJobPtr job;
-    bool priority = false;
     size_t i;
     size_t nWorkers;
     size_t nPrioWorkers;
@@ -251,37 +461,45 @@ void virThreadPoolFree(virThreadPoolPtr pool)
     virMutexLock(&pool->mutex);
     nWorkers = pool->nWorkers;
     nPrioWorkers = pool->nPrioWorkers;
-    pool->quit = true;
-    if (pool->nWorkers > 0)
-        virCondBroadcast(&pool->cond);
-    if (pool->nPrioWorkers > 0) {
-        priority = true;
-        virCondBroadcast(&pool->prioCond);
+    virAtomicIntSet(&pool->quit, 1);
+
+    for (i = 0; i < pool->nqueues; i++) {
+        virMutexLock(&pool->queues[i].lock);
+        virCondBroadcast(&pool->queues[i].cond);
+        virMutexUnlock(&pool->queues[i].lock);
     }
+    virCondBroadcast(&pool->prioCond);
 
     while (pool->nWorkers > 0 || pool->nPrioWorkers > 0)
         ignore_value(virCondWait(&pool->quit_cond, &pool->mutex));
 
-    while ((job = pool->jobList.head)) {
-        pool->jobList.head = pool->jobList.head->next;
-        VIR_FREE(job);
-    }
-
     for (i = 0; i < nWorkers; i++)
         virThreadJoin(&pool->workers[i]);
 
     for (i = 0; i < nPrioWorkers; i++)
         virThreadJoin(&pool->prioWorkers[i]);
 
-    VIR_FREE(pool->workers);
     virMutexUnlock(&pool->mutex);
+
+    for (i = 0; i < pool->nqueues; i++) {
+        while ((key = pool->queues[i].head)) {
+            pool->queues[i].head = key->next;
+            while ((job = key->head)) {
+                key->head = job->next;
+                VIR_FREE(job);
+            }
+            VIR_FREE(key);
+        }
+        virMutexDestroy(&pool->queues[i].lock);
+        virCondDestroy(&pool->queues[i].cond);
+    }
+    VIR_FREE(pool->queues);
+
+    VIR_FREE(pool->workers);
+    VIR_FREE(pool->prioWorkers);
     virMutexDestroy(&pool->mutex);
     virCondDestroy(&pool->quit_cond);
-    virCondDestroy(&pool->cond);
-    if (priority) {
-        VIR_FREE(pool->prioWorkers);
-        virCondDestroy(&pool->prioCond);
-    }
+    virCondDestroy(&pool->prioCond);
     VIR_FREE(pool);
 }
 
@@ -301,6 +519,75 @@ size_t virThreadPoolGetPriorityWorkers(virThreadPoolPtr pool)
     return pool->nPrioWorkers;
 }
 
+/* Wakes up an idle worker, preferably one sleeping on queue @first.
+ * The worker is counted off as it is signalled, so that the next
+ * job wakes up another one. */
+static void
+virThreadPoolWakeup(virThreadPoolPtr pool,
+                    size_t first)
+{
+    virThreadPoolQueuePtr queue;
+    size_t i;
+
+    for (i = 0; i < pool->nqueues; i++) {
+        queue = &pool->queues[(first + i) % pool->nqueues];
+        if (virAtomicIntGet(&queue->idle) <= 0)
+            continue;
+
+        virMutexLock(&queue->lock);
+        if (virAtomicIntGet(&queue->idle) > 0) {
+            virAtomicIntAdd(&queue->idle, -1);
+            virAtomicIntAdd(&pool->freeWorkers, -1);
+            queue->wakeups++;
+            virCondSignal(&queue->cond);
+            virMutexUnlock(&queue->lock);
+            return;
+        }
+        virMutexUnlock(&queue->lock);
+    }
+}
+
+
+/*
+ * @maxLong: most long jobs to run at once, 0 for no limit
+ *
+ * Keeps long jobs from occupying all the workers. Once @maxLong of
+ * them are running, further long jobs wait while workers go on with
+ * other jobs.
+ */
+void virThreadPoolSetLongJobLimit(virThreadPoolPtr pool,
+                                  size_t maxLong)
+{
+    virAtomicIntSet(&pool->maxLong, maxLong > INT_MAX ? INT_MAX : maxLong);
+
+    /* Long jobs held back so far may be runnable now */
+    if (virAtomicIntGet(&pool->pendingLong) > 0)
+        virThreadPoolWakeup(pool, 0);
+}
+
+size_t virThreadPoolGetLongJobLimit(virThreadPoolPtr pool)
+{
+    return virAtomicIntGet(&pool->maxLong);
+}
+
+
+/* Picks the queue for jobs sent with @key */
+static size_t
+virThreadPoolQueueForKey(virThreadPoolPtr pool,
+                         const void *key)
+{
+    unsigned long long hash = (uintptr_t) key;
+
+    if (pool->nqueues == 1)
+        return 0;
+
+    /* Allocations are aligned, mix in the higher bits */
+    hash ^= hash >> 4;
+    hash *= 0x9E3779B97F4A7C15ULL;
+    return (hash >> 32) % pool->nqueues;
+}
+
+
 /*
  * @priority - job priority
  * Return: 0 on success, -1 otherwise
@@ -309,63 +596,164 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
                          unsigned int priority,
                          void *jobData)
 {
-    virThreadPoolJobPtr job;
-    struct virThreadPoolWorkerData *data = NULL;
+    return virThreadPoolSendJobFull(pool, priority, NULL, jobData);
+}
 
-    virMutexLock(&pool->mutex);
-    if (pool->quit)
-        goto error;
 
-    if (pool->freeWorkers - pool->jobQueueDepth <= 0 &&
-        pool->nWorkers < pool->maxWorkers) {
-        if (VIR_EXPAND_N(pool->workers, pool->nWorkers, 1) < 0)
-            goto error;
+/*
+ * @priority: job priority
+ * @key: identifies the submitter, or NULL
+ * @jobData: passed to the job function
+ *
+ * Jobs sent with the same @key are started in the order they were
+ * sent, and take turns with jobs sent with other keys. Only high
+ * priority jobs may be started early, by the priority workers.
+ *
+ * Return: 0 on success, -1 otherwise
+ */
+int virThreadPoolSendJobFull(virThreadPoolPtr pool,
+                             unsigned int priority,
+                             const void *key,
+                             void *jobData)
+{
+    virThreadPoolJobPtr job = NULL;
+    virThreadPoolKeyPtr k;
+    virThreadPoolQueuePtr queue;
+    size_t idx;
 
-        if (VIR_ALLOC(data) < 0) {
-            pool->nWorkers--;
-            goto error;
-        }
+    if (virAtomicIntGet(&pool->quit))
+        return -1;
 
-        data->pool = pool;
-        data->cond = &pool->cond;
+    /* Start another worker if all of them are busy */
+    if (virAtomicIntGet(&pool->freeWorkers) <= virAtomicIntGet(&pool->pending)) {
+        int rc = 0;
 
-        if (virThreadCreate(&pool->workers[pool->nWorkers - 1],
-                            true,
-                            virThreadPoolWorker,
-                            data) < 0) {
-            VIR_FREE(data);
-            pool->nWorkers--;
-            goto error;
-        }
+        virMutexLock(&pool->mutex);
+        if (pool->nWorkers < pool->maxWorkers)
+            rc = virThreadPoolSpawnWorkerLocked(pool, false);
+        virMutexUnlock(&pool->mutex);
+        if (rc < 0)
+            return -1;
     }
 
     if (VIR_ALLOC(job) < 0)
-        goto error;
+        return -1;
 
     job->data = jobData;
     job->priority = priority;
 
-    job->prev = pool->jobList.tail;
-    if (pool->jobList.tail)
-        pool->jobList.tail->next = job;
-    pool->jobList.tail = job;
+    idx = virThreadPoolQueueForKey(pool, key);
+    queue = &pool->queues[idx];
 
-    if (!pool->jobList.head)
-        pool->jobList.head = job;
+    virMutexLock(&queue->lock);
+    for (k = queue->head; k; k = k->next) {
+        if (k->key == key)
+            break;
+    }
+    if (!k) {
+        if (VIR_ALLOC(k) < 0) {
+            virMutexUnlock(&queue->lock);
+            VIR_FREE(job);
+            return -1;
+        }
+        k->key = key;
+        if (queue->tail)
+            queue->tail->next = k;
+        else
+            queue->head = k;
+        queue->tail = k;
+        virAtomicIntInc(&pool->keys);
+        if (priority == VIR_THREAD_POOL_PRIORITY_LONG)
+            virAtomicIntInc(&pool->heldKeys);
+    }
+    if (k->tail)
+        k->tail->next = job;
+    else
+        k->head = job;
+    k->tail = job;
 
-    if (priority && !pool->jobList.firstPrio)
-        pool->jobList.firstPrio = job;
+    if (priority == VIR_THREAD_POOL_PRIORITY_HIGH)
+        virAtomicIntInc(&pool->pendingPrio);
+    else if (priority == VIR_THREAD_POOL_PRIORITY_LONG)
+        virAtomicIntInc(&pool->pendingLong);
+    virAtomicIntInc(&pool->pending);
+    virMutexUnlock(&queue->lock);
 
-    pool->jobQueueDepth++;
+    virThreadPoolWakeup(pool, idx);
 
-    virCondSignal(&pool->cond);
-    if (priority)
+    if (priority == VIR_THREAD_POOL_PRIORITY_HIGH &&
+        virAtomicIntGet(&pool->freePrioWorkers) > 0) {
+        virMutexLock(&pool->mutex);
         virCondSignal(&pool->prioCond);
+        virMutexUnlock(&pool->mutex);
+    }
 
-    virMutexUnlock(&pool->mutex);
     return 0;
+}
 
- error:
-    virMutexUnlock(&pool->mutex);
-    return -1;
+
+struct virThreadPoolBatch {
+    virThreadPoolBatchFunc func;
+    void *opaque;
+    size_t njobs;
+    int next;
+};
+
+static void virThreadPoolBatchWorker(void *opaque)
+{
+    struct virThreadPoolBatch *batch = opaque;
+    int job;
+
+    while ((size_t) (job = virAtomicIntInc(&batch->next) - 1) < batch->njobs)
+        batch->func(job, batch->opaque);
+}
+
+
+/*
+ * @njobs: number of jobs to run
+ * @maxWorkers: most threads to run them in, 0 for one per online CPU
+ * @func: called once for every job number from 0 to @njobs - 1
+ * @opaque: passed to @func
+ *
+ * Runs a fixed batch of independent jobs in parallel and waits for
+ * all of them to complete. The calling thread works on the batch
+ * too, so should no extra thread be available the jobs simply run
+ * one after another.
+ */
+void virThreadPoolRunBatch(size_t njobs,
+                           size_t maxWorkers,
+                           virThreadPoolBatchFunc func,
+                           void *opaque)
+{
+    struct virThreadPoolBatch batch = { func, opaque, njobs, 0 };
+    virThreadPtr threads = NULL;
+    size_t nthreads = maxWorkers;
+    size_t created = 0;
+    size_t i;
+
+    if (nthreads == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpus > 0 ? ncpus : 1;
+#else
+        nthreads = 1;
+#endif
+    }
+    if (nthreads > njobs)
+        nthreads = njobs;
+
+    if (nthreads > 1 && VIR_ALLOC_N_QUIET(threads, nthreads - 1) == 0) {
+        for (i = 0; i < nthreads - 1; i++) {
+            if (virThreadCreate(&threads[i], true,
+                                virThreadPoolBatchWorker, &batch) < 0)
+                break;
+            created++;
+        }
+    }
+
+    virThreadPoolBatchWorker(&batch);
+
+    for (i = 0; i < created; i++)
+        virThreadJoin(&threads[i]);
+    VIR_FREE(threads);
 }
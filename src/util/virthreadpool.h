@@ -33,6 +33,13 @@ typedef virThreadPool *virThreadPoolPtr;
 
 typedef void (*virThreadPoolJobFunc)(void *jobdata, void *opaque);
 
+/* Job priorities */
+enum {
+    VIR_THREAD_POOL_PRIORITY_NORMAL = 0,
+    VIR_THREAD_POOL_PRIORITY_HIGH = 1,  /* may run on priority workers too */
+    VIR_THREAD_POOL_PRIORITY_LONG = 2,  /* subject to the long job limit */
+};
+
 virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
                                   size_t maxWorkers,
                                   size_t prioWorkers,
@@ -43,6 +50,10 @@ size_t virThreadPoolGetMinWorkers(virThreadPoolPtr pool);
 size_t virThreadPoolGetMaxWorkers(virThreadPoolPtr pool);
 size_t virThreadPoolGetPriorityWorkers(virThreadPoolPtr pool);
 
+void virThreadPoolSetLongJobLimit(virThreadPoolPtr pool,
+                                  size_t maxLong);
+size_t virThreadPoolGetLongJobLimit(virThreadPoolPtr pool);
+
 void virThreadPoolFree(virThreadPoolPtr pool);
 
 int virThreadPoolSendJob(virThreadPoolPtr pool,
@@ -50,4 +61,17 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
                          void *jobdata) ATTRIBUTE_NONNULL(1)
                                         ATTRIBUTE_RETURN_CHECK;
 
+int virThreadPoolSendJobFull(virThreadPoolPtr pool,
+                             unsigned int priority,
+                             const void *key,
+                             void *jobdata) ATTRIBUTE_NONNULL(1)
+                                            ATTRIBUTE_RETURN_CHECK;
+
+typedef void (*virThreadPoolBatchFunc)(size_t job, void *opaque);
+
+void virThreadPoolRunBatch(size_t njobs,
+                           size_t maxWorkers,
+                           virThreadPoolBatchFunc func,
+                           void *opaque) ATTRIBUTE_NONNULL(3);
+
 #endif
@@ -34,6 +34,7 @@
 #include <config.h>
 
 #include <stdio.h>
+#include <unistd.h>
 #include <sys/time.h>
 
 #include "virtime.h"
@@ -363,3 +364,108 @@ virTimeLocalOffsetFromUTC(long *offset)
     *offset = current - utc;
     return 0;
 }
+
+/* Longest single sleep of virTimeBackOffWait */
+#define VIR_TIME_BACKOFF_CAP 200
+
+/**
+ * virTimeBackOffStart:
+ * @var: the backoff state to initialize
+ * @first: the first wait, in milliseconds
+ * @timeout: the total time to keep trying for, in milliseconds
+ *
+ * Prepare a retry loop that waits exponentially longer between
+ * attempts, starting at @first and capped at 200ms, for a total of
+ * @timeout milliseconds:
+ *
+ *   virTimeBackOffVar timebackoff;
+ *
+ *   if (virTimeBackOffStart(&timebackoff, 1, 30 * 1000) < 0)
+ *       goto error;
+ *   while (virTimeBackOffWait(&timebackoff)) {
+ *       if (attempt() == 0)
+ *           break;
+ *   }
+ *
+ * This reacts to a resource showing up almost at once, without
+ * spinning while it takes a long time.
+ *
+ * Returns 0 on success, -1 on error with a libvirt error reported.
+ */
+int
+virTimeBackOffStart(virTimeBackOffVar *var,
+                    unsigned long long first,
+                    unsigned long long timeout)
+{
+    if (virTimeMillisNow(&var->limit_t) < 0)
+        return -1;
+
+    var->limit_t += timeout;
+    var->next = first ? first : 1;
+    var->started = false;
+    return 0;
+}
+
+/**
+ * virTimeBackOffNext:
+ * @var: the backoff state
+ * @now: the current time, in milliseconds
+ * @delay: filled with the time to wait before the next attempt
+ *
+ * Compute how long to wait at @now before the next attempt of the
+ * retry loop described by @var, which is zero for the first attempt.
+ *
+ * Returns true if there is a next attempt, false once the timeout
+ * has expired.
+ */
+bool
+virTimeBackOffNext(virTimeBackOffVar *var,
+                   unsigned long long now,
+                   unsigned long long *delay)
+{
+    *delay = 0;
+
+    if (!var->started) {
+        var->started = true;
+        return true;
+    }
+
+    if (now >= var->limit_t)
+        return false;
+
+    *delay = var->next;
+    if (*delay > var->limit_t - now)
+        *delay = var->limit_t - now;
+    if (var->next < VIR_TIME_BACKOFF_CAP) {
+        var->next *= 2;
+        if (var->next > VIR_TIME_BACKOFF_CAP)
+            var->next = VIR_TIME_BACKOFF_CAP;
+    }
+
+    return true;
+}
+
+/**
+ * virTimeBackOffWait:
+ * @var: the backoff state
+ *
+ * Returns true straight away the first time it is called, and after
+ * sleeping for the next backoff period every other time, or false once
+ * the timeout has expired.
+ */
+bool
+virTimeBackOffWait(virTimeBackOffVar *var)
+{
+    unsigned long long now = 0;
+    unsigned long long delay;
+
+    if (var->started && virTimeMillisNowRaw(&now) < 0)
+        return false;
+
+    if (!virTimeBackOffNext(var, now, &delay))
+        return false;
+
+    if (delay)
+        usleep(delay * 1000);
+    return true;
+}
@@ -64,4 +64,21 @@ char *virTimeStringThen(unsigned long long when);
 int virTimeLocalOffsetFromUTC(long *offset)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
+typedef struct {
+    unsigned long long limit_t;
+    unsigned long long next;
+    bool started;
+} virTimeBackOffVar;
+
+int virTimeBackOffStart(virTimeBackOffVar *var,
+                        unsigned long long first,
+                        unsigned long long timeout)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+bool virTimeBackOffNext(virTimeBackOffVar *var,
+                        unsigned long long now,
+                        unsigned long long *delay)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3);
+bool virTimeBackOffWait(virTimeBackOffVar *var)
+    ATTRIBUTE_NONNULL(1);
+
 #endif
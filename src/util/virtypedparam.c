@@ -28,6 +28,8 @@
 #include "virutil.h"
 #include "virerror.h"
 #include "virstring.h"
+#include "virhashcode.h"
+#include "virrandom.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -47,6 +49,53 @@ VIR_ENUM_IMPL(virTypedParameter, VIR_TYPED_PARAM_LAST,
  * internal utility functions (those in libvirt_private.syms) may
  * report errors that the caller will dispatch.  */
 
+typedef struct _virTypedParamsValidateName virTypedParamsValidateName;
+typedef virTypedParamsValidateName *virTypedParamsValidateNamePtr;
+struct _virTypedParamsValidateName {
+    const char *name;
+    int type;
+    size_t pos;
+    bool seen;
+};
+
+static int
+virTypedParamsValidateNameCompare(const void *a,
+                                  const void *b)
+{
+    const virTypedParamsValidateName *na = a;
+    const virTypedParamsValidateName *nb = b;
+    int ret = strcmp(na->name, nb->name);
+
+    /* Keep the order in which the names were passed in among equal
+     * ones, so that the first one wins like it always did */
+    if (ret == 0)
+        ret = na->pos < nb->pos ? -1 : na->pos > nb->pos;
+    return ret;
+}
+
+/* Find the first entry called @name in the sorted @names array */
+static virTypedParamsValidateNamePtr
+virTypedParamsValidateNameFind(virTypedParamsValidateNamePtr names,
+                               size_t nnames,
+                               const char *name)
+{
+    size_t lo = 0;
+    size_t hi = nnames;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (strcmp(names[mid].name, name) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < nnames && STREQ(names[lo].name, name))
+        return names + lo;
+    return NULL;
+}
+
 /* Validate that PARAMS contains only recognized parameter names with
  * correct types, and with no duplicates.  Pass in as many name/type
  * pairs as appropriate, and pass NULL to end the list of accepted
@@ -57,59 +106,70 @@ virTypedParamsValidate(virTypedParameterPtr params, int nparams, ...)
 {
     va_list ap;
     int ret = -1;
-    size_t i, j;
+    size_t i;
+    size_t nnames = 0;
+    virTypedParamsValidateNamePtr names = NULL;
+    virTypedParamsValidateNamePtr entry;
     const char *name;
-    int type;
+
+    /* The accepted names are sorted once, which keeps this cheap even
+     * for large parameter arrays; duplicates are found by marking the
+     * name each parameter matched rather than by comparing every pair
+     * of parameters.  */
+    va_start(ap, nparams);
+    while ((name = va_arg(ap, const char *))) {
+        ignore_value(va_arg(ap, int));
+        nnames++;
+    }
+    va_end(ap);
+
+    if (nnames && VIR_ALLOC_N(names, nnames) < 0)
+        return -1;
 
     va_start(ap, nparams);
+    for (i = 0; i < nnames; i++) {
+        names[i].name = va_arg(ap, const char *);
+        names[i].type = va_arg(ap, int);
+        names[i].pos = i;
+    }
+    va_end(ap);
+
+    if (nnames)
+        qsort(names, nnames, sizeof(*names),
+              virTypedParamsValidateNameCompare);
 
-    /* Yes, this is quadratic, but since we reject duplicates and
-     * unknowns, it is constrained by the number of var-args passed
-     * in, which is expected to be small enough to not be
-     * noticeable.  */
     for (i = 0; i < nparams; i++) {
-        va_end(ap);
-        va_start(ap, nparams);
-
-        name = va_arg(ap, const char *);
-        while (name) {
-            type = va_arg(ap, int);
-            if (STREQ(params[i].field, name)) {
-                if (params[i].type != type) {
-                    const char *badtype;
-
-                    badtype = virTypedParameterTypeToString(params[i].type);
-                    if (!badtype)
-                        badtype = virTypedParameterTypeToString(0);
-                    virReportError(VIR_ERR_INVALID_ARG,
-                                   _("invalid type '%s' for parameter '%s', "
-                                     "expected '%s'"),
-                                   badtype, params[i].field,
-                                   virTypedParameterTypeToString(type));
-                }
-                break;
-            }
-            name = va_arg(ap, const char *);
-        }
-        if (!name) {
+        if (!(entry = virTypedParamsValidateNameFind(names, nnames,
+                                                     params[i].field))) {
             virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
                            _("parameter '%s' not supported"),
                            params[i].field);
             goto cleanup;
         }
-        for (j = 0; j < i; j++) {
-            if (STREQ(params[i].field, params[j].field)) {
-                virReportError(VIR_ERR_INVALID_ARG,
-                               _("parameter '%s' occurs multiple times"),
-                               params[i].field);
-                goto cleanup;
-            }
+        if (params[i].type != entry->type) {
+            const char *badtype;
+
+            badtype = virTypedParameterTypeToString(params[i].type);
+            if (!badtype)
+                badtype = virTypedParameterTypeToString(0);
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("invalid type '%s' for parameter '%s', "
+                             "expected '%s'"),
+                           badtype, params[i].field,
+                           virTypedParameterTypeToString(entry->type));
+        }
+        if (entry->seen) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("parameter '%s' occurs multiple times"),
+                           params[i].field);
+            goto cleanup;
         }
+        entry->seen = true;
     }
 
     ret = 0;
  cleanup:
-    va_end(ap);
+    VIR_FREE(names);
     return ret;
 
 }
@@ -417,6 +477,350 @@ virTypedParamsCopy(virTypedParameterPtr *dst,
 }
 
 
+/* Lists shorter than this are searched linearly, which is cheaper than
+ * hashing for the handful of parameters most APIs deal with */
+#define VIR_TYPED_PARAM_LIST_INDEX_MIN 16
+
+virTypedParamListPtr
+virTypedParamListNew(void)
+{
+    virTypedParamListPtr list;
+
+    ignore_value(VIR_ALLOC(list));
+    return list;
+}
+
+
+void
+virTypedParamListFree(virTypedParamListPtr list)
+{
+    if (!list)
+        return;
+
+    virTypedParamsFree(list->par, list->npar);
+    VIR_FREE(list->index);
+    VIR_FREE(list);
+}
+
+
+/* Return the index slot holding @name, or the empty one it belongs in */
+static size_t
+virTypedParamListIndexSlot(virTypedParamListPtr list,
+                           const char *name)
+{
+    size_t mask = list->nindex - 1;
+    size_t slot = virHashCodeGen(name, strlen(name), list->seed) & mask;
+
+    while (list->index[slot] &&
+           STRNEQ(list->par[list->index[slot] - 1].field, name))
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+
+static void
+virTypedParamListIndexInsert(virTypedParamListPtr list,
+                             size_t pos)
+{
+    size_t slot = virTypedParamListIndexSlot(list, list->par[pos].field);
+
+    list->index[slot] = pos + 1;
+}
+
+
+/* Make sure the index has room for one more entry, keeping it at most
+ * half full. Nothing is indexed until the list grows long enough.  */
+static int
+virTypedParamListIndexReserve(virTypedParamListPtr list)
+{
+    size_t *old = list->index;
+    size_t nindex = list->nindex;
+    size_t i;
+
+    if (list->npar + 1 < VIR_TYPED_PARAM_LIST_INDEX_MIN ||
+        (list->index && (list->npar + 1) * 2 <= list->nindex))
+        return 0;
+
+    if (!nindex)
+        nindex = 4 * VIR_TYPED_PARAM_LIST_INDEX_MIN;
+    while ((list->npar + 1) * 2 > nindex)
+        nindex *= 2;
+
+    if (VIR_ALLOC_N(list->index, nindex) < 0) {
+        list->index = old;
+        return -1;
+    }
+    VIR_FREE(old);
+
+    if (!list->nindex)
+        list->seed = virRandomBits(32);
+    list->nindex = nindex;
+
+    for (i = 0; i < list->npar; i++)
+        virTypedParamListIndexInsert(list, i);
+
+    return 0;
+}
+
+
+/**
+ * virTypedParamListGet:
+ * @list: the list
+ * @name: name of the parameter to find
+ *
+ * Returns the parameter called @name, or NULL if there is none. No
+ * error is reported in the latter case.
+ */
+virTypedParameterPtr
+virTypedParamListGet(virTypedParamListPtr list,
+                     const char *name)
+{
+    size_t slot;
+
+    if (!list->index)
+        return virTypedParamsGet(list->par, list->npar, name);
+
+    slot = virTypedParamListIndexSlot(list, name);
+    if (!list->index[slot])
+        return NULL;
+    return list->par + list->index[slot] - 1;
+}
+
+
+/* Reserve space for a new parameter called @name, rejecting duplicates.
+ * The parameter becomes part of the list by virTypedParamListAddCommit
+ * once the caller has filled it in.  */
+static virTypedParameterPtr
+virTypedParamListAddPrepare(virTypedParamListPtr list,
+                            const char *name)
+{
+    if (virTypedParamListGet(list, name)) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("Parameter '%s' is already set"), name);
+        return NULL;
+    }
+
+    if (VIR_RESIZE_N(list->par, list->par_alloc, list->npar, 1) < 0 ||
+        virTypedParamListIndexReserve(list) < 0)
+        return NULL;
+
+    return list->par + list->npar;
+}
+
+
+static void
+virTypedParamListAddCommit(virTypedParamListPtr list)
+{
+    if (list->index)
+        virTypedParamListIndexInsert(list, list->npar);
+    list->npar++;
+}
+
+
+int
+virTypedParamListAddInt(virTypedParamListPtr list,
+                        const char *name,
+                        int value)
+{
+    virTypedParameterPtr param;
+
+    if (!(param = virTypedParamListAddPrepare(list, name)) ||
+        virTypedParameterAssign(param, name, VIR_TYPED_PARAM_INT, value) < 0)
+        return -1;
+
+    virTypedParamListAddCommit(list);
+    return 0;
+}
+
+
+int
+virTypedParamListAddUInt(virTypedParamListPtr list,
+                         const char *name,
+                         unsigned int value)
+{
+    virTypedParameterPtr param;
+
+    if (!(param = virTypedParamListAddPrepare(list, name)) ||
+        virTypedParameterAssign(param, name, VIR_TYPED_PARAM_UINT, value) < 0)
+        return -1;
+
+    virTypedParamListAddCommit(list);
+    return 0;
+}
+
+
+int
+virTypedParamListAddLLong(virTypedParamListPtr list,
+                          const char *name,
+                          long long value)
+{
+    virTypedParameterPtr param;
+
+    if (!(param = virTypedParamListAddPrepare(list, name)) ||
+        virTypedParameterAssign(param, name, VIR_TYPED_PARAM_LLONG, value) < 0)
+        return -1;
+
+    virTypedParamListAddCommit(list);
+    return 0;
+}
+
+
+int
+virTypedParamListAddULLong(virTypedParamListPtr list,
+                           const char *name,
+                           unsigned long long value)
+{
+    virTypedParameterPtr param;
+
+    if (!(param = virTypedParamListAddPrepare(list, name)) ||
+        virTypedParameterAssign(param, name, VIR_TYPED_PARAM_ULLONG, value) < 0)
+        return -1;
+
+    virTypedParamListAddCommit(list);
+    return 0;
+}
+
+
+int
+virTypedParamListAddDouble(virTypedParamListPtr list,
+                           const char *name,
+                           double value)
+{
+    virTypedParameterPtr param;
+
+    if (!(param = virTypedParamListAddPrepare(list, name)) ||
+        virTypedParameterAssign(param, name, VIR_TYPED_PARAM_DOUBLE, value) < 0)
+        return -1;
+
+    virTypedParamListAddCommit(list);
+    return 0;
+}
+
+
+int
+virTypedParamListAddBoolean(virTypedParamListPtr list,
+                            const char *name,
+                            bool value)
+{
+    virTypedParameterPtr param;
+
+    if (!(param = virTypedParamListAddPrepare(list, name)) ||
+        virTypedParameterAssign(param, name,
+                                VIR_TYPED_PARAM_BOOLEAN, value) < 0)
+        return -1;
+
+    virTypedParamListAddCommit(list);
+    return 0;
+}
+
+
+int
+virTypedParamListAddString(virTypedParamListPtr list,
+                           const char *name,
+                           const char *value)
+{
+    virTypedParameterPtr param;
+    char *str = NULL;
+
+    if (!(param = virTypedParamListAddPrepare(list, name)) ||
+        VIR_STRDUP(str, value) < 0)
+        return -1;
+
+    if (virTypedParameterAssign(param, name, VIR_TYPED_PARAM_STRING, str) < 0) {
+        VIR_FREE(str);
+        return -1;
+    }
+
+    virTypedParamListAddCommit(list);
+    return 0;
+}
+
+
+/**
+ * virTypedParamListSteal:
+ * @list: the list
+ * @params: where to store the array of parameters
+ *
+ * Hand the parameters collected in @list over to the caller in the form
+ * used by public APIs, leaving @list empty.
+ *
+ * Returns the number of parameters stored in @params, or -1 on error.
+ */
+int
+virTypedParamListSteal(virTypedParamListPtr list,
+                       virTypedParameterPtr *params)
+{
+    int ret;
+
+    if (list->npar > INT_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("too many typed parameters: %zu"), list->npar);
+        return -1;
+    }
+
+    ret = list->npar;
+    *params = list->par;
+    list->par = NULL;
+    list->npar = 0;
+    list->par_alloc = 0;
+    VIR_FREE(list->index);
+    list->nindex = 0;
+
+    return ret;
+}
+
+
+/**
+ * virTypedParamListNewFromParams:
+ * @params: pointer to the array of typed parameters
+ * @nparams: number of parameters in the @params array
+ *
+ * Build a list around an existing array of parameters, for example one
+ * received through a public API, to get indexed lookups into it. On
+ * success the list takes over the array and *@params is set to NULL.
+ *
+ * Returns the list, or NULL on error, which includes @params having
+ * more than one parameter with the same name.
+ */
+virTypedParamListPtr
+virTypedParamListNewFromParams(virTypedParameterPtr *params,
+                               int nparams)
+{
+    virTypedParamListPtr list;
+    size_t n = nparams > 0 ? nparams : 0;
+
+    if (!(list = virTypedParamListNew()))
+        return NULL;
+
+    list->par = *params;
+    list->par_alloc = n;
+
+    /* Index the entries one by one so that duplicates are caught */
+    while (list->npar < n) {
+        const char *name = list->par[list->npar].field;
+
+        if (virTypedParamListGet(list, name)) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("Parameter '%s' is already set"), name);
+            goto error;
+        }
+        if (virTypedParamListIndexReserve(list) < 0)
+            goto error;
+        virTypedParamListAddCommit(list);
+    }
+
+    *params = NULL;
+    return list;
+
+ error:
+    list->par = NULL;
+    list->npar = 0;
+    virTypedParamListFree(list);
+    return NULL;
+}
+
+
 /* The following APIs are public and their signature may never change. */
 
 /**
@@ -56,6 +56,69 @@ int virTypedParamsCopy(virTypedParameterPtr *dst,
 
 char *virTypedParameterToString(virTypedParameterPtr param);
 
+/*
+ * A growable list of typed parameters for building large records, such
+ * as bulk domain stats. Lookups and the duplicate check done by each
+ * addition go through a hash index of positions into @par once the list
+ * grows past a handful of entries, so field names are only ever stored
+ * once, in the array itself. The array is the public virTypedParameter
+ * form and can be handed out with virTypedParamListSteal.
+ */
+typedef struct _virTypedParamList virTypedParamList;
+typedef virTypedParamList *virTypedParamListPtr;
+struct _virTypedParamList {
+    virTypedParameterPtr par;
+    size_t npar;
+    size_t par_alloc;
+
+    size_t *index;      /* position + 1 of each entry, 0 for empty slots */
+    size_t nindex;      /* always a power of two */
+    uint32_t seed;
+};
+
+virTypedParamListPtr virTypedParamListNew(void);
+virTypedParamListPtr
+virTypedParamListNewFromParams(virTypedParameterPtr *params,
+                               int nparams)
+    ATTRIBUTE_NONNULL(1);
+void virTypedParamListFree(virTypedParamListPtr list);
+
+virTypedParameterPtr virTypedParamListGet(virTypedParamListPtr list,
+                                          const char *name)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int virTypedParamListSteal(virTypedParamListPtr list,
+                           virTypedParameterPtr *params)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+int virTypedParamListAddInt(virTypedParamListPtr list,
+                            const char *name,
+                            int value)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+int virTypedParamListAddUInt(virTypedParamListPtr list,
+                             const char *name,
+                             unsigned int value)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+int virTypedParamListAddLLong(virTypedParamListPtr list,
+                              const char *name,
+                              long long value)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+int virTypedParamListAddULLong(virTypedParamListPtr list,
+                               const char *name,
+                               unsigned long long value)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+int virTypedParamListAddDouble(virTypedParamListPtr list,
+                               const char *name,
+                               double value)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+int virTypedParamListAddBoolean(virTypedParamListPtr list,
+                                const char *name,
+                                bool value)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+int virTypedParamListAddString(virTypedParamListPtr list,
+                               const char *name,
+                               const char *value)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+
 VIR_ENUM_DECL(virTypedParameter)
 
 # define VIR_TYPED_PARAMS_DEBUG(params, nparams)                            \
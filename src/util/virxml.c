@@ -37,6 +37,8 @@
 #include "viralloc.h"
 #include "virfile.h"
 #include "virstring.h"
+#include "virhash.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_XML
 
@@ -56,6 +58,93 @@ struct virParserData {
  *									*
  ************************************************************************/
 
+/* Domain parsing evaluates the same few hundred literal expressions
+ * over and over, so each thread keeps them compiled, keyed on the
+ * expression string.  The expressions are compiled without a context,
+ * so namespace prefixes are still resolved by each evaluation. */
+#define VIR_XPATH_CACHE_MAX 1024
+
+static virThreadLocal virXPathCache;
+
+static void
+virXPathCacheDataFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    xmlXPathFreeCompExpr(payload);
+}
+
+static void
+virXPathCacheFree(void *data)
+{
+    virHashFree(data);
+}
+
+static int
+virXPathCacheOnceInit(void)
+{
+    return virThreadLocalInit(&virXPathCache, virXPathCacheFree);
+}
+
+VIR_ONCE_GLOBAL_INIT(virXPathCache)
+
+static xmlXPathCompExprPtr
+virXPathCacheLookup(const char *xpath)
+{
+    virHashTablePtr cache;
+    xmlXPathCompExprPtr comp;
+
+    if (virXPathCacheInitialize() < 0)
+        return NULL;
+
+    if (!(cache = virThreadLocalGet(&virXPathCache))) {
+        if (!(cache = virHashCreate(256, virXPathCacheDataFree)))
+            return NULL;
+        if (virThreadLocalSet(&virXPathCache, cache) < 0) {
+            virHashFree(cache);
+            return NULL;
+        }
+    }
+
+    if ((comp = virHashLookup(cache, xpath)))
+        return comp;
+
+    /* Invalid expressions are left to xmlXPathEval to complain about */
+    if (!(comp = xmlXPathCompile(BAD_CAST xpath)))
+        return NULL;
+
+    /* Expressions built at runtime must not grow the cache forever */
+    if (virHashSize(cache) >= VIR_XPATH_CACHE_MAX)
+        virHashRemoveAll(cache);
+
+    if (virHashAddEntry(cache, xpath, comp) < 0) {
+        xmlXPathFreeCompExpr(comp);
+        return NULL;
+    }
+
+    return comp;
+}
+
+/*
+ * virXPathEval:
+ * @xpath: the XPath string to evaluate
+ * @ctxt: an XPath context
+ *
+ * Evaluate @xpath in @ctxt, using the per-thread compiled copy of the
+ * expression when there is one.
+ *
+ * Returns the resulting object, or NULL on failure.
+ */
+static xmlXPathObjectPtr
+virXPathEval(const char *xpath,
+             xmlXPathContextPtr ctxt)
+{
+    xmlXPathCompExprPtr comp = virXPathCacheLookup(xpath);
+
+    if (!comp)
+        return xmlXPathEval(BAD_CAST xpath, ctxt);
+
+    return xmlXPathCompiledEval(comp, ctxt);
+}
+
 /**
  * virXPathString:
  * @xpath: the XPath string to evaluate
@@ -80,7 +169,7 @@ virXPathString(const char *xpath,
         return NULL;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_STRING) ||
         (obj->stringval == NULL) || (obj->stringval[0] == 0)) {
@@ -147,7 +236,7 @@ virXPathNumber(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_NUMBER) ||
         (isnan(obj->floatval))) {
@@ -176,7 +265,7 @@ virXPathLongBase(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -281,7 +370,7 @@ virXPathULongBase(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -397,7 +486,7 @@ virXPathULongLong(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -443,7 +532,7 @@ virXPathLongLong(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -502,7 +591,7 @@ virXPathBoolean(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_BOOLEAN) ||
         (obj->boolval < 0) || (obj->boolval > 1)) {
@@ -539,7 +628,7 @@ virXPathNode(const char *xpath,
         return NULL;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_NODESET) ||
         (obj->nodesetval == NULL) || (obj->nodesetval->nodeNr <= 0) ||
@@ -583,7 +672,7 @@ virXPathNodeSet(const char *xpath,
         *list = NULL;
 
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if (obj == NULL)
         return 0;
@@ -843,6 +932,28 @@ struct virXMLRewriteFileData {
     const char *xml;
 };
 
+/* Self-contained copy of virXMLRewriteFileData for deferred writes */
+struct virXMLRewriteFileCopy {
+    struct virXMLRewriteFileData data; /* must stay first */
+    char *warnName;
+    char *warnCommand;
+    char *xml;
+};
+
+static void
+virXMLRewriteFileCopyFree(void *opaque)
+{
+    struct virXMLRewriteFileCopy *copy = opaque;
+
+    if (!copy)
+        return;
+
+    VIR_FREE(copy->warnName);
+    VIR_FREE(copy->warnCommand);
+    VIR_FREE(copy->xml);
+    VIR_FREE(copy);
+}
+
 static int
 virXMLRewriteFile(int fd, void *opaque)
 {
@@ -870,6 +981,58 @@ virXMLSaveFile(const char *path,
     return virFileRewrite(path, S_IRUSR | S_IWUSR, virXMLRewriteFile, &data);
 }
 
+
+/**
+ * virXMLSaveFileFull:
+ * @writer: writer coordinating rewrites of @path, or NULL
+ * @path: file to write
+ * @warnName: name for the warning comment, or NULL
+ * @warnCommand: virsh command for the warning comment, or NULL
+ * @xml: the XML document to store
+ * @deferred: whether the write may be held back and coalesced
+ *
+ * Like virXMLSaveFile(), but when @writer is given the file is
+ * rewritten in coordination with other updates queued on @writer. If
+ * @deferred is true, the write is merely queued on @writer and any
+ * error writing the file later is only logged.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virXMLSaveFileFull(virFileWriterPtr writer,
+                   const char *path,
+                   const char *warnName,
+                   const char *warnCommand,
+                   const char *xml,
+                   bool deferred)
+{
+    struct virXMLRewriteFileData data = { warnName, warnCommand, xml };
+    struct virXMLRewriteFileCopy *copy = NULL;
+
+    if (!writer)
+        return virXMLSaveFile(path, warnName, warnCommand, xml);
+
+    if (!deferred)
+        return virFileWriterRewrite(writer, path, S_IRUSR | S_IWUSR,
+                                    virXMLRewriteFile, &data);
+
+    if (VIR_ALLOC(copy) < 0 ||
+        VIR_STRDUP(copy->warnName, warnName) < 0 ||
+        VIR_STRDUP(copy->warnCommand, warnCommand) < 0 ||
+        VIR_STRDUP(copy->xml, xml) < 0) {
+        virXMLRewriteFileCopyFree(copy);
+        return -1;
+    }
+
+    copy->data.warnName = copy->warnName;
+    copy->data.warnCommand = copy->warnCommand;
+    copy->data.xml = copy->xml;
+
+    return virFileWriterQueue(writer, path, S_IRUSR | S_IWUSR,
+                              virXMLRewriteFile, copy,
+                              virXMLRewriteFileCopyFree);
+}
+
 /* Returns the number of children of node, or -1 on error.  */
 long
 virXMLChildElementCount(xmlNodePtr node)
@@ -891,6 +1054,178 @@ virXMLChildElementCount(xmlNodePtr node)
 }
 
 
+/*
+ * The helpers below read the same data as the virXPath* functions do
+ * for the simple relative expressions noted with each of them, but by
+ * walking the children of @node directly. Parsers of elements which
+ * occur many times in a document use them to avoid compiling and
+ * evaluating an XPath expression for every single field.
+ */
+
+/**
+ * virXMLChildElement:
+ * @node: parent node, may be NULL
+ * @name: name of the wanted element
+ *
+ * Same as virXPathNode("./NAME") with @node as the context node,
+ * where NAME is @name.
+ *
+ * Returns the first child element of @node called @name, or NULL
+ */
+xmlNodePtr
+virXMLChildElement(xmlNodePtr node,
+                   const char *name)
+{
+    xmlNodePtr cur;
+
+    if (!node)
+        return NULL;
+
+    for (cur = node->children; cur; cur = cur->next) {
+        if (cur->type == XML_ELEMENT_NODE &&
+            xmlStrEqual(cur->name, BAD_CAST name))
+            return cur;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * virXMLChildContent:
+ * @node: parent node, may be NULL
+ * @name: name of the child element
+ *
+ * Same as virXPathString("string(./NAME)") with @node as the
+ * context node, where NAME is @name.
+ *
+ * Returns the text content of the first child element of @node
+ * called @name, or NULL if there is none or it is empty. The caller
+ * must free the result.
+ */
+char *
+virXMLChildContent(xmlNodePtr node,
+                   const char *name)
+{
+    xmlNodePtr child;
+    char *ret;
+
+    if (!(child = virXMLChildElement(node, name)))
+        return NULL;
+
+    ret = (char *) xmlNodeGetContent(child);
+    if (ret && !*ret)
+        VIR_FREE(ret);
+    return ret;
+}
+
+
+/**
+ * virXMLChildPropString:
+ * @node: parent node, may be NULL
+ * @name: name of the child element
+ * @prop: name of the attribute
+ *
+ * Same as virXPathString("string(./NAME/@PROP)") with @node as
+ * the context node, where NAME is @name and PROP is @prop.
+ *
+ * Returns the value of @prop on the first child element of @node
+ * called @name which has it, or NULL if there is none or the value
+ * is empty. The caller must free the result.
+ */
+char *
+virXMLChildPropString(xmlNodePtr node,
+                      const char *name,
+                      const char *prop)
+{
+    xmlNodePtr cur;
+    char *ret;
+
+    if (!node)
+        return NULL;
+
+    for (cur = node->children; cur; cur = cur->next) {
+        if (cur->type != XML_ELEMENT_NODE ||
+            !xmlStrEqual(cur->name, BAD_CAST name) ||
+            !xmlHasProp(cur, BAD_CAST prop))
+            continue;
+
+        ret = virXMLPropString(cur, prop);
+        if (ret && !*ret)
+            VIR_FREE(ret);
+        return ret;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * virXMLChildULongLong:
+ * @node: parent node, may be NULL
+ * @name: name of the child element
+ * @value: the returned value
+ *
+ * Same as virXPathULongLong("string(./NAME)") with @node as the
+ * context node, where NAME is @name.
+ *
+ * Returns 0 in case of success in which case @value is set,
+ *         or -1 if the element is missing or empty,
+ *         or -2 if its content does not parse as an unsigned number
+ */
+int
+virXMLChildULongLong(xmlNodePtr node,
+                     const char *name,
+                     unsigned long long *value)
+{
+    char *str;
+    int ret = 0;
+
+    if (!(str = virXMLChildContent(node, name)))
+        return -1;
+
+    if (virStrToLong_ull(str, NULL, 10, value) < 0)
+        ret = -2;
+
+    VIR_FREE(str);
+    return ret;
+}
+
+
+/**
+ * virXMLPropUInt:
+ * @node: element node
+ * @name: name of the attribute
+ * @value: the returned value
+ *
+ * Same as virXPathUInt("string(./@NAME)") with @node as the context
+ * node, where NAME is @name.
+ *
+ * Returns 0 in case of success in which case @value is set,
+ *         or -1 if the attribute is missing or empty,
+ *         or -2 if its value does not parse as an unsigned number
+ */
+int
+virXMLPropUInt(xmlNodePtr node,
+               const char *name,
+               unsigned int *value)
+{
+    char *str;
+    int ret = 0;
+
+    if (!(str = virXMLPropString(node, name)))
+        return -1;
+
+    if (!*str)
+        ret = -1;
+    else if (virStrToLong_ui(str, NULL, 10, value) < 0)
+        ret = -2;
+
+    VIR_FREE(str);
+    return ret;
+}
+
+
 /**
  * virXMLNodeToString: convert an XML node ptr to an XML string
  *
@@ -24,6 +24,7 @@
 # define __VIR_XML_H__
 
 # include "internal.h"
+# include "virfilewriter.h"
 
 # include <libxml/parser.h>
 # include <libxml/tree.h>
@@ -72,6 +73,19 @@ int              virXPathNodeSet(const char *xpath,
 char *          virXMLPropString(xmlNodePtr node,
                                  const char *name);
 long     virXMLChildElementCount(xmlNodePtr node);
+xmlNodePtr    virXMLChildElement(xmlNodePtr node,
+                                 const char *name);
+char *        virXMLChildContent(xmlNodePtr node,
+                                 const char *name);
+char *     virXMLChildPropString(xmlNodePtr node,
+                                 const char *name,
+                                 const char *prop);
+int         virXMLChildULongLong(xmlNodePtr node,
+                                 const char *name,
+                                 unsigned long long *value);
+int               virXMLPropUInt(xmlNodePtr node,
+                                 const char *name,
+                                 unsigned int *value);
 
 /* Internal function; prefer the macros below.  */
 xmlDocPtr      virXMLParseHelper(int domcode,
@@ -163,6 +177,12 @@ int virXMLSaveFile(const char *path,
                    const char *warnName,
                    const char *warnCommand,
                    const char *xml);
+int virXMLSaveFileFull(virFileWriterPtr writer,
+                       const char *path,
+                       const char *warnName,
+                       const char *warnCommand,
+                       const char *xml,
+                       bool deferred);
 
 char *virXMLNodeToString(xmlDocPtr doc, xmlNodePtr node);
 
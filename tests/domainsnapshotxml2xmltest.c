@@ -148,6 +148,61 @@ testCompareXMLToXMLHelper(const void *data)
 }
 
 
+static int
+testCompareStoreFile(const void *data)
+{
+    const char *xml = data;
+    char *xmlData = NULL;
+    char *actual = NULL;
+    virDomainSnapshotDefPtr *defs = NULL;
+    size_t ndefs = 0;
+    int ret = -1;
+    int n;
+    size_t i;
+    unsigned int flags = (VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_DISKS |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL);
+
+    if (virtTestLoadFile(xml, &xmlData) < 0)
+        goto cleanup;
+
+    if ((n = virDomainSnapshotDefListParseString(xmlData, driver.caps,
+                                                 driver.xmlopt,
+                                                 QEMU_EXPECTED_VIRT_TYPES,
+                                                 flags, &defs)) < 0)
+        goto cleanup;
+    ndefs = n;
+
+    /* The first two snapshots refer to the same domain definition,
+     * the third one to a different definition */
+    if (ndefs != 3 ||
+        !defs[0]->dom || defs[0]->dom != defs[1]->dom ||
+        !defs[2]->dom || defs[2]->dom == defs[0]->dom) {
+        fprintf(stderr, "domain definitions are not shared as expected\n");
+        goto cleanup;
+    }
+
+    if (!(actual = virDomainSnapshotDefListFormat(NULL, defs, ndefs,
+                                                  VIR_DOMAIN_DEF_FORMAT_SECURE)))
+        goto cleanup;
+
+    if (STRNEQ(xmlData, actual)) {
+        virtTestDifference(stderr, xmlData, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < ndefs; i++)
+        virDomainSnapshotDefFree(defs[i]);
+    VIR_FREE(defs);
+    VIR_FREE(xmlData);
+    VIR_FREE(actual);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -224,6 +279,11 @@ mymain(void)
     DO_TEST_IN("description_only", NULL);
     DO_TEST_IN("name_only", NULL);
 
+    if (virtTestRun("SNAPSHOT STORE out->out store",
+                    testCompareStoreFile,
+                    abs_srcdir "/domainsnapshotxml2xmlout/store.xml") < 0)
+        ret = -1;
+
  cleanup:
     if (testSnapshotXMLVariableLineRegex)
         regfree(testSnapshotXMLVariableLineRegex);
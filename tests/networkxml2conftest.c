@@ -110,6 +110,9 @@ mymain(void)
         = dnsmasqCapsNewFromBuffer("Dnsmasq version 2.63\n--bind-dynamic", DNSMASQ);
     dnsmasqCapsPtr dhcpv6
         = dnsmasqCapsNewFromBuffer("Dnsmasq version 2.64\n--bind-dynamic", DNSMASQ);
+    dnsmasqCapsPtr hostsdir
+        = dnsmasqCapsNewFromBuffer("Dnsmasq version 2.73\n--bind-dynamic\n"
+                                   "--dhcp-hostsdir", DNSMASQ);
 
 #define DO_TEST(xname, xcaps)                                        \
     do {                                                             \
@@ -138,6 +141,7 @@ mymain(void)
     DO_TEST("dhcp6-network", dhcpv6);
     DO_TEST("dhcp6-nat-network", dhcpv6);
     DO_TEST("dhcp6host-routed-network", dhcpv6);
+    DO_TEST("nat-network-dhcp-hostsdir", hostsdir);
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
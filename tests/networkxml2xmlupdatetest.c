@@ -117,6 +117,105 @@ testCompareXMLToXMLHelper(const void *data)
     return result;
 }
 
+struct testSequenceStep {
+    unsigned int command;
+    const char *xml;
+    bool expectFailure;
+};
+
+/*
+ * Apply several updates of DHCP hosts to the same definition in turn,
+ * so that later ones look up hosts in an index earlier ones changed.
+ */
+static int
+testUpdateSequence(const void *data ATTRIBUTE_UNUSED)
+{
+    static const struct testSequenceStep steps[] = {
+        /* all existing hosts move down by one */
+        { VIR_NETWORK_UPDATE_COMMAND_ADD_FIRST,
+          "<host mac='00:16:3e:77:f0:0d' name='m.example.com' "
+          "ip='192.168.122.12'/>", false },
+        { VIR_NETWORK_UPDATE_COMMAND_MODIFY,
+          "<host mac='00:16:3e:3e:a9:1a' name='b.example.com' "
+          "ip='192.168.122.47'/>", false },
+        /* the old IP of the modified host is gone */
+        { VIR_NETWORK_UPDATE_COMMAND_DELETE,
+          "<host ip='192.168.122.11'/>", true },
+        { VIR_NETWORK_UPDATE_COMMAND_DELETE,
+          "<host name='a.example.com'/>", false },
+        /* as is everything about the deleted one */
+        { VIR_NETWORK_UPDATE_COMMAND_MODIFY,
+          "<host mac='00:16:3e:77:e2:ed' name='a.example.com' "
+          "ip='192.168.122.10'/>", true },
+        { VIR_NETWORK_UPDATE_COMMAND_ADD_LAST,
+          "<host mac='00:16:3e:77:e2:ed' name='a.example.com' "
+          "ip='192.168.122.10'/>", false },
+        { VIR_NETWORK_UPDATE_COMMAND_ADD_LAST,
+          "<host mac='00:16:3E:3E:A9:1A' name='c.example.com' "
+          "ip='192.168.122.13'/>", true },
+        { VIR_NETWORK_UPDATE_COMMAND_ADD_FIRST,
+          "<host mac='00:16:3e:12:34:56' name='c.example.com' "
+          "ip='192.168.122.47'/>", true },
+        { VIR_NETWORK_UPDATE_COMMAND_MODIFY,
+          "<host mac='00:16:3e:77:f0:0d' name='m.example.com' "
+          "ip='192.168.122.13'/>", false },
+    };
+    char *netxml = NULL;
+    char *outxml = NULL;
+    char *netXmlData = NULL;
+    char *outXmlData = NULL;
+    char *actual = NULL;
+    virNetworkDefPtr def = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (virAsprintf(&netxml, "%s/networkxml2xmlin/nat-network.xml",
+                    abs_srcdir) < 0 ||
+        virAsprintf(&outxml,
+                    "%s/networkxml2xmlupdateout/nat-network-hosts-sequence.xml",
+                    abs_srcdir) < 0)
+        goto cleanup;
+
+    if (virtTestLoadFile(netxml, &netXmlData) < 0 ||
+        virtTestLoadFile(outxml, &outXmlData) < 0)
+        goto cleanup;
+
+    if (!(def = virNetworkDefParseString(netXmlData)))
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(steps); i++) {
+        int rc = virNetworkDefUpdateSection(def, steps[i].command,
+                                            VIR_NETWORK_SECTION_IP_DHCP_HOST,
+                                            0, steps[i].xml, 0);
+
+        if ((rc < 0) != steps[i].expectFailure) {
+            fprintf(stderr, "Step %zu: expected %s, got %s\n", i,
+                    steps[i].expectFailure ? "failure" : "success",
+                    rc < 0 ? "failure" : "success");
+            goto cleanup;
+        }
+        virResetLastError();
+    }
+
+    if (!(actual = virNetworkDefFormat(def, 0)))
+        goto cleanup;
+
+    if (STRNEQ(outXmlData, actual)) {
+        virtTestDifference(stderr, outXmlData, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(netxml);
+    VIR_FREE(outxml);
+    VIR_FREE(netXmlData);
+    VIR_FREE(outXmlData);
+    VIR_FREE(actual);
+    virNetworkDefFree(def);
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -204,6 +303,9 @@ mymain(void)
                        "nat-network",
                        VIR_NETWORK_UPDATE_COMMAND_DELETE,
                        0);
+    if (virtTestRun("Network XML-2-XML update host sequence",
+                    testUpdateSequence, NULL) < 0)
+        ret = -1;
 
 
     section = VIR_NETWORK_SECTION_IP_DHCP_RANGE;
@@ -0,0 +1,868 @@
+/*
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "testutils.h"
+
+#if defined(__linux__)
+
+# include <sched.h>
+# include <sys/socket.h>
+# include <arpa/inet.h>
+# include <net/ethernet.h>
+# include <linux/if_packet.h>
+
+# include "nwfilter/nwfilter_capture.h"
+# define __NWFILTER_CAPTURE_PRIV_H_ALLOW__
+# include "nwfilter/nwfilter_capturepriv.h"
+# include "viralloc.h"
+# include "virfile.h"
+# include "virnetdev.h"
+# include "virnetdevveth.h"
+# include "virstring.h"
+# include "virthread.h"
+# include "virtime.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Interface index packets are injected on when not capturing for real */
+# define TEST_IFINDEX 4242
+
+/* The end of the veth pair captured on, standing in for the tap
+ * device of a VM, and the end the VM's frames are sent from */
+static char *hostdev;
+static char *guestdev;
+static int hostIndex;
+static int guestIndex;
+
+static const unsigned char guestMAC[ETH_ALEN] = {
+    0x52, 0x54, 0x00, 0x12, 0x34, 0x56
+};
+static const unsigned char hostMAC[ETH_ALEN] = {
+    0x52, 0x54, 0x00, 0xab, 0xcd, 0xef
+};
+
+typedef struct _testCaptureData testCaptureData;
+struct _testCaptureData {
+    virMutex lock;
+    virCond cond;
+
+    size_t packets[3];          /* per virNWFilterCaptureProto bit */
+    size_t outgoing;
+    size_t ticks;
+    bool released;
+
+    /* makes the packet callback wait for @proceed */
+    bool block;
+    bool blocked;
+    bool proceed;
+};
+
+enum {
+    TEST_FRAME_DHCP_REQUEST,
+    TEST_FRAME_DHCP_REPLY,
+    TEST_FRAME_ARP,
+    TEST_FRAME_UDP,
+    TEST_FRAME_IPV6,
+
+    TEST_FRAME_LAST
+};
+
+
+static size_t
+testBuildFrame(unsigned char *buf,
+               int type)
+{
+    struct ether_header *eth = (struct ether_header *)buf;
+    unsigned char *ip = buf + sizeof(*eth);
+    unsigned char *udp = ip + 20;
+    uint16_t sport = 1234;
+    uint16_t dport = 4321;
+    size_t len = sizeof(*eth) + 20 + 8 + 240;
+
+    memset(buf, 0, len);
+    memset(eth->ether_dhost, 0xff, ETH_ALEN);
+    memcpy(eth->ether_shost,
+           type == TEST_FRAME_DHCP_REPLY ? hostMAC : guestMAC, ETH_ALEN);
+
+    switch (type) {
+    case TEST_FRAME_ARP:
+        eth->ether_type = htons(ETHERTYPE_ARP);
+        return sizeof(*eth) + 28;
+    case TEST_FRAME_IPV6:
+        eth->ether_type = htons(ETHERTYPE_IPV6);
+        return sizeof(*eth) + 40;
+    case TEST_FRAME_DHCP_REQUEST:
+        sport = 68;
+        dport = 67;
+        break;
+    case TEST_FRAME_DHCP_REPLY:
+        sport = 67;
+        dport = 68;
+        break;
+    }
+
+    eth->ether_type = htons(ETHERTYPE_IP);
+    ip[0] = 0x45;
+    ip[2] = (len - sizeof(*eth)) >> 8;
+    ip[3] = (len - sizeof(*eth)) & 0xff;
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+    memset(ip + 16, 0xff, 4);
+    udp[0] = sport >> 8;
+    udp[1] = sport & 0xff;
+    udp[2] = dport >> 8;
+    udp[3] = dport & 0xff;
+    udp[4] = (len - sizeof(*eth) - 20) >> 8;
+    udp[5] = (len - sizeof(*eth) - 20) & 0xff;
+
+    return len;
+}
+
+
+static int
+testSendFrame(int ifindex,
+              int type)
+{
+    unsigned char buf[ETH_FRAME_LEN];
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_ifindex = ifindex,
+        .sll_halen = ETH_ALEN,
+    };
+    size_t len = testBuildFrame(buf, type);
+    int fd;
+    int ret = -1;
+
+    if ((fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+        fprintf(stderr, "Cannot open packet socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(sll.sll_addr, 0xff, ETH_ALEN);
+    if (sendto(fd, buf, len, 0,
+               (struct sockaddr *)&sll, sizeof(sll)) != len) {
+        fprintf(stderr, "Cannot send frame: %s\n", strerror(errno));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+
+static void
+testPacket(virNWFilterCaptureSubPtr sub ATTRIBUTE_UNUSED,
+           const unsigned char *packet,
+           size_t len,
+           bool outgoing,
+           void *opaque)
+{
+    testCaptureData *data = opaque;
+    const struct ether_header *eth = (const struct ether_header *)packet;
+    size_t idx = 2;
+
+    if (len < sizeof(*eth))
+        return;
+
+    if (ntohs(eth->ether_type) == ETHERTYPE_ARP)
+        idx = 1;
+    else if (len >= sizeof(*eth) + 24 &&
+             packet[sizeof(*eth) + 9] == IPPROTO_UDP &&
+             packet[sizeof(*eth) + 22] == 0 &&
+             (packet[sizeof(*eth) + 23] == 67 ||
+              packet[sizeof(*eth) + 23] == 68))
+        idx = 0;
+
+    virMutexLock(&data->lock);
+    data->packets[idx]++;
+    if (outgoing)
+        data->outgoing++;
+    virCondBroadcast(&data->cond);
+    if (data->block) {
+        data->blocked = true;
+        while (!data->proceed)
+            ignore_value(virCondWait(&data->cond, &data->lock));
+    }
+    virMutexUnlock(&data->lock);
+}
+
+
+static void
+testTick(virNWFilterCaptureSubPtr sub ATTRIBUTE_UNUSED,
+         void *opaque)
+{
+    testCaptureData *data = opaque;
+
+    virMutexLock(&data->lock);
+    data->ticks++;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+static void
+testRelease(void *opaque)
+{
+    testCaptureData *data = opaque;
+
+    virMutexLock(&data->lock);
+    data->released = true;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+static const virNWFilterCaptureCallbacks testCallbacks = {
+    .packet = testPacket,
+    .tick = testTick,
+    .release = testRelease,
+};
+
+
+static int
+testDataInit(testCaptureData *data)
+{
+    memset(data, 0, sizeof(*data));
+    if (virMutexInit(&data->lock) < 0 ||
+        virCondInit(&data->cond) < 0)
+        return -1;
+    return 0;
+}
+
+
+static void
+testDataClear(testCaptureData *data)
+{
+    virCondDestroy(&data->cond);
+    virMutexDestroy(&data->lock);
+}
+
+
+/* Wait until @total packets arrived, then a little longer to
+ * catch those that should not have */
+static size_t
+testWaitPackets(testCaptureData *data,
+                size_t total,
+                unsigned long long timeout)
+{
+    unsigned long long until;
+    size_t got = 0;
+    bool waited = false;
+
+    if (virTimeMillisNow(&until) < 0)
+        return 0;
+    until += timeout;
+
+    virMutexLock(&data->lock);
+    for (;;) {
+        got = data->packets[0] + data->packets[1] + data->packets[2];
+        if (got >= total) {
+            if (waited)
+                break;
+            if (virTimeMillisNow(&until) < 0)
+                break;
+            until += 300;
+            waited = true;
+        }
+        if (virCondWaitUntil(&data->cond, &data->lock, until) < 0) {
+            got = data->packets[0] + data->packets[1] + data->packets[2];
+            break;
+        }
+    }
+    virMutexUnlock(&data->lock);
+
+    return got;
+}
+
+
+static bool
+testWaitFor(testCaptureData *data,
+            bool *cond,
+            unsigned long long timeout)
+{
+    unsigned long long until;
+    bool ret;
+
+    if (virTimeMillisNow(&until) < 0)
+        return false;
+    until += timeout;
+
+    virMutexLock(&data->lock);
+    while (!*cond) {
+        if (virCondWaitUntil(&data->cond, &data->lock, until) < 0)
+            break;
+    }
+    ret = *cond;
+    virMutexUnlock(&data->lock);
+
+    return ret;
+}
+
+
+/* The subscription is released once the worker let go of its last job */
+static int
+testUnsubscribe(virNWFilterCaptureSubPtr sub,
+                testCaptureData *data)
+{
+    virNWFilterCaptureUnsubscribe(sub, VIR_NWFILTER_CAPTURE_UNSUBSCRIBE_WAIT);
+    virObjectUnref(sub);
+
+    if (!testWaitFor(data, &data->released, 5000)) {
+        fprintf(stderr, "Subscription was not released\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+testDeliverFrame(int ifindex,
+                 int type,
+                 bool outgoing)
+{
+    unsigned char buf[ETH_FRAME_LEN];
+    size_t len = testBuildFrame(buf, type);
+
+    virNWFilterCaptureDeliver(ifindex, buf, len, outgoing);
+}
+
+
+struct testFilterInfo {
+    unsigned int protocols;
+    size_t expect[TEST_FRAME_LAST];     /* bytes let through */
+};
+
+
+/* The BPF program works the same on any socket, hence check what it
+ * lets through a datagram socket pair rather than a packet socket */
+static int
+testCaptureFilter(const void *opaque)
+{
+    const struct testFilterInfo *info = opaque;
+    unsigned char buf[ETH_FRAME_LEN];
+    int fds[2] = { -1, -1 };
+    size_t i;
+    int ret = -1;
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0) {
+        fprintf(stderr, "Cannot create socket pair: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (virNWFilterCaptureAttachFilter(fds[1], info->protocols) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_FRAME_LAST; i++) {
+        size_t len = testBuildFrame(buf, i);
+        ssize_t got;
+
+        if (send(fds[0], buf, len, 0) != len) {
+            fprintf(stderr, "Cannot send frame: %s\n", strerror(errno));
+            goto cleanup;
+        }
+
+        if ((got = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT)) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fprintf(stderr, "Cannot receive frame: %s\n",
+                        strerror(errno));
+                goto cleanup;
+            }
+            got = 0;
+        }
+
+        if (got != info->expect[i]) {
+            fprintf(stderr, "Frame %zu: expected %zu bytes, got %zd\n",
+                    i, info->expect[i], got);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_CLOSE(fds[0]);
+    VIR_FORCE_CLOSE(fds[1]);
+    return ret;
+}
+
+
+static int
+testCaptureClassify(const void *opaque ATTRIBUTE_UNUSED)
+{
+    static const unsigned int expect[TEST_FRAME_LAST] = {
+        [TEST_FRAME_DHCP_REQUEST] = VIR_NWFILTER_CAPTURE_DHCP,
+        [TEST_FRAME_DHCP_REPLY] = VIR_NWFILTER_CAPTURE_DHCP,
+        [TEST_FRAME_ARP] = VIR_NWFILTER_CAPTURE_ARP,
+        [TEST_FRAME_UDP] = VIR_NWFILTER_CAPTURE_IPV4,
+        [TEST_FRAME_IPV6] = 0,
+    };
+    unsigned char buf[ETH_FRAME_LEN];
+    size_t i;
+
+    for (i = 0; i < TEST_FRAME_LAST; i++) {
+        size_t len = testBuildFrame(buf, i);
+        unsigned int proto = virNWFilterCaptureClassify(buf, len);
+
+        if (proto != expect[i]) {
+            fprintf(stderr, "Frame %zu: expected class 0x%x, got 0x%x\n",
+                    i, expect[i], proto);
+            return -1;
+        }
+    }
+
+    /* truncated frames must not be looked into */
+    if (virNWFilterCaptureClassify(buf, sizeof(struct ether_header) - 1)) {
+        fprintf(stderr, "Truncated frame was classified\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testCaptureDeliver(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNWFilterCaptureSubPtr sub = NULL;
+    testCaptureData data;
+    int ret = -1;
+
+    if (testDataInit(&data) < 0)
+        return -1;
+
+    if (!(sub = virNWFilterCaptureSubscribe(TEST_IFINDEX,
+                                            VIR_NWFILTER_CAPTURE_DHCP |
+                                            VIR_NWFILTER_CAPTURE_ARP, 16,
+                                            &testCallbacks, &data)))
+        goto cleanup;
+
+    if (!virNWFilterCaptureIsRunning()) {
+        fprintf(stderr, "Capture was not started by subscribing\n");
+        goto cleanup;
+    }
+
+    testDeliverFrame(TEST_IFINDEX, TEST_FRAME_DHCP_REQUEST, false);
+    testDeliverFrame(TEST_IFINDEX, TEST_FRAME_ARP, false);
+    testDeliverFrame(TEST_IFINDEX, TEST_FRAME_UDP, false);
+    testDeliverFrame(TEST_IFINDEX, TEST_FRAME_IPV6, false);
+    testDeliverFrame(TEST_IFINDEX, TEST_FRAME_DHCP_REPLY, true);
+    testDeliverFrame(TEST_IFINDEX + 1, TEST_FRAME_ARP, false);
+
+    testWaitPackets(&data, 3, 5000);
+
+    if (data.packets[0] != 2 || data.packets[1] != 1 ||
+        data.packets[2] != 0 || data.outgoing != 1) {
+        fprintf(stderr, "Got %zu DHCP, %zu ARP, %zu IPv4 and %zu "
+                "outgoing packets\n", data.packets[0], data.packets[1],
+                data.packets[2], data.outgoing);
+        goto cleanup;
+    }
+
+    ret = testUnsubscribe(sub, &data);
+    sub = NULL;
+
+ cleanup:
+    if (sub)
+        ignore_value(testUnsubscribe(sub, &data));
+    testDataClear(&data);
+    return ret;
+}
+
+
+static int
+testCaptureTick(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNWFilterCaptureSubPtr sub = NULL;
+    testCaptureData data;
+    unsigned long long until;
+    int ret = -1;
+
+    if (testDataInit(&data) < 0)
+        return -1;
+
+    if (!(sub = virNWFilterCaptureSubscribe(TEST_IFINDEX,
+                                            VIR_NWFILTER_CAPTURE_DHCP, 16,
+                                            &testCallbacks, &data)))
+        goto cleanup;
+
+    virNWFilterCaptureKick(sub);
+    if (virTimeMillisNow(&until) < 0)
+        goto cleanup;
+    until += 5000;
+
+    virMutexLock(&data.lock);
+    while (!data.ticks) {
+        if (virCondWaitUntil(&data.cond, &data.lock, until) < 0)
+            break;
+    }
+    virMutexUnlock(&data.lock);
+
+    if (!data.ticks) {
+        fprintf(stderr, "Tick callback was not invoked\n");
+        goto cleanup;
+    }
+
+    virNWFilterCaptureUnsubscribe(sub, VIR_NWFILTER_CAPTURE_UNSUBSCRIBE_WAIT);
+
+    testDeliverFrame(TEST_IFINDEX, TEST_FRAME_DHCP_REQUEST, false);
+
+    if (testWaitPackets(&data, 1, 500) != 0) {
+        fprintf(stderr, "Got packets after unsubscribing\n");
+        goto cleanup;
+    }
+
+    if (data.released) {
+        fprintf(stderr, "Subscription released while still referenced\n");
+        goto cleanup;
+    }
+
+    virObjectUnref(sub);
+    sub = NULL;
+
+    if (!testWaitFor(&data, &data.released, 5000)) {
+        fprintf(stderr, "Subscription was not released\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    if (sub)
+        ignore_value(testUnsubscribe(sub, &data));
+    testDataClear(&data);
+    return ret;
+}
+
+
+/*
+ * Unsubscribing without waiting must not block on a callback that is
+ * running, which in turn must keep the subscription's data alive
+ * until it returns.
+ */
+static int
+testCaptureUnsubscribeBusy(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNWFilterCaptureSubPtr sub = NULL;
+    testCaptureData data;
+    int ret = -1;
+
+    if (testDataInit(&data) < 0)
+        return -1;
+    data.block = true;
+
+    if (!(sub = virNWFilterCaptureSubscribe(TEST_IFINDEX,
+                                            VIR_NWFILTER_CAPTURE_DHCP, 16,
+                                            &testCallbacks, &data)))
+        goto cleanup;
+
+    testDeliverFrame(TEST_IFINDEX, TEST_FRAME_DHCP_REQUEST, false);
+
+    if (!testWaitFor(&data, &data.blocked, 5000)) {
+        fprintf(stderr, "Packet callback was not invoked\n");
+        goto cleanup;
+    }
+
+    virNWFilterCaptureUnsubscribe(sub, 0);
+    virObjectUnref(sub);
+    sub = NULL;
+
+    virMutexLock(&data.lock);
+    if (data.released) {
+        fprintf(stderr, "Subscription released during its callback\n");
+        data.proceed = true;
+        virCondBroadcast(&data.cond);
+        virMutexUnlock(&data.lock);
+        goto cleanup;
+    }
+    data.proceed = true;
+    virCondBroadcast(&data.cond);
+    virMutexUnlock(&data.lock);
+
+    if (!testWaitFor(&data, &data.released, 5000)) {
+        fprintf(stderr, "Subscription was not released\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    if (sub) {
+        virMutexLock(&data.lock);
+        data.proceed = true;
+        virCondBroadcast(&data.cond);
+        virMutexUnlock(&data.lock);
+        ignore_value(testUnsubscribe(sub, &data));
+    }
+    testDataClear(&data);
+    return ret;
+}
+
+
+static bool
+testWaitStopped(void)
+{
+    size_t i;
+
+    for (i = 0; i < 500; i++) {
+        if (!virNWFilterCaptureIsRunning())
+            return true;
+        usleep(10 * 1000);
+    }
+
+    return false;
+}
+
+
+/* With the idle timeout set to zero the capture stops as soon as the
+ * last subscription is gone, and the next one starts it again */
+static int
+testCaptureIdle(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNWFilterCaptureSubPtr sub = NULL;
+    testCaptureData data;
+    int ret = -1;
+
+    if (testDataInit(&data) < 0)
+        return -1;
+
+    if (!testWaitStopped()) {
+        fprintf(stderr, "Capture kept running without subscriptions\n");
+        goto cleanup;
+    }
+
+    if (!(sub = virNWFilterCaptureSubscribe(TEST_IFINDEX,
+                                            VIR_NWFILTER_CAPTURE_ARP, 16,
+                                            &testCallbacks, &data)))
+        goto cleanup;
+
+    if (!virNWFilterCaptureIsRunning()) {
+        fprintf(stderr, "Capture was not restarted\n");
+        goto cleanup;
+    }
+
+    testDeliverFrame(TEST_IFINDEX, TEST_FRAME_ARP, false);
+    if (testWaitPackets(&data, 1, 5000) != 1) {
+        fprintf(stderr, "Restarted capture did not deliver packets\n");
+        goto cleanup;
+    }
+
+    ret = testUnsubscribe(sub, &data);
+    sub = NULL;
+
+    if (ret == 0 && !testWaitStopped()) {
+        fprintf(stderr, "Capture kept running without subscriptions\n");
+        ret = -1;
+    }
+
+ cleanup:
+    if (sub)
+        ignore_value(testUnsubscribe(sub, &data));
+    testDataClear(&data);
+    return ret;
+}
+
+
+struct testInfo {
+    const char *name;
+    unsigned int protocols;
+    bool fromHost;
+    size_t expect[3];
+};
+
+
+static int
+testCapture(const void *opaque)
+{
+    const struct testInfo *info = opaque;
+    virNWFilterCaptureSubPtr sub = NULL;
+    testCaptureData data;
+    size_t total = info->expect[0] + info->expect[1] + info->expect[2];
+    size_t i;
+    int ret = -1;
+
+    if (testDataInit(&data) < 0)
+        return -1;
+
+    if (!(sub = virNWFilterCaptureSubscribe(hostIndex, info->protocols, 16,
+                                            &testCallbacks, &data)))
+        goto cleanup;
+
+    if (info->fromHost) {
+        if (testSendFrame(hostIndex, TEST_FRAME_DHCP_REPLY) < 0)
+            goto cleanup;
+    } else {
+        if (testSendFrame(guestIndex, TEST_FRAME_DHCP_REQUEST) < 0 ||
+            testSendFrame(guestIndex, TEST_FRAME_ARP) < 0 ||
+            testSendFrame(guestIndex, TEST_FRAME_UDP) < 0 ||
+            testSendFrame(guestIndex, TEST_FRAME_IPV6) < 0)
+            goto cleanup;
+    }
+
+    testWaitPackets(&data, total, 5000);
+
+    for (i = 0; i < ARRAY_CARDINALITY(data.packets); i++) {
+        if (data.packets[i] != info->expect[i]) {
+            fprintf(stderr, "Expected %zu packets of class %zu, got %zu\n",
+                    info->expect[i], i, data.packets[i]);
+            goto cleanup;
+        }
+    }
+
+    if (data.outgoing != (info->fromHost ? total : 0)) {
+        fprintf(stderr, "Got %zu outgoing packets out of %zu\n",
+                data.outgoing, total);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    if (sub && testUnsubscribe(sub, &data) < 0)
+        ret = -1;
+    testDataClear(&data);
+    return ret;
+}
+
+
+static int
+testCaptureVeth(void)
+{
+    int ret = 0;
+
+    if (virNWFilterCaptureInit() < 0)
+        return -1;
+
+    if (!virNWFilterCaptureAvailable() ||
+        VIR_STRDUP(hostdev, "vnettest0") < 0 ||
+        VIR_STRDUP(guestdev, "vnettest1") < 0 ||
+        virNetDevVethCreate(&hostdev, &guestdev) < 0) {
+        if (virTestGetDebug())
+            fprintf(stderr, "Skipping capture on veth devices: %s\n",
+                    virGetLastErrorMessage());
+        virResetLastError();
+        goto cleanup;
+    }
+
+    if (virNetDevSetOnline(hostdev, true) < 0 ||
+        virNetDevSetOnline(guestdev, true) < 0 ||
+        virNetDevGetIndex(hostdev, &hostIndex) < 0 ||
+        virNetDevGetIndex(guestdev, &guestIndex) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+# define DO_TEST(name, protocols, fromHost, dhcp, arp, ipv4)             \
+    do {                                                                \
+        struct testInfo info = {                                        \
+            name, protocols, fromHost, { dhcp, arp, ipv4 },             \
+        };                                                              \
+        if (virtTestRun("Capture veth " name, testCapture, &info) < 0)  \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("dhcp", VIR_NWFILTER_CAPTURE_DHCP, false, 1, 0, 0);
+    DO_TEST("dhcp-reply", VIR_NWFILTER_CAPTURE_DHCP, true, 1, 0, 0);
+    DO_TEST("arp", VIR_NWFILTER_CAPTURE_ARP, false, 0, 1, 0);
+    DO_TEST("ipv4", VIR_NWFILTER_CAPTURE_IPV4, false, 0, 0, 1);
+    DO_TEST("all",
+            VIR_NWFILTER_CAPTURE_DHCP | VIR_NWFILTER_CAPTURE_ARP |
+            VIR_NWFILTER_CAPTURE_IPV4, false, 1, 1, 1);
+
+# undef DO_TEST
+
+ cleanup:
+    virNWFilterCaptureShutdown();
+    if (hostdev)
+        ignore_value(virNetDevVethDelete(hostdev));
+    VIR_FREE(hostdev);
+    VIR_FREE(guestdev);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+# define DO_TEST_FILTER(name, protocols, dhcpreq, dhcprep, arp, udp, ipv6) \
+    do {                                                                \
+        struct testFilterInfo info = {                                  \
+            protocols, { dhcpreq, dhcprep, arp, udp, ipv6 },            \
+        };                                                              \
+        if (virtTestRun("Capture filter " name,                         \
+                        testCaptureFilter, &info) < 0)                  \
+            ret = -1;                                                   \
+    } while (0)
+
+    /* Frames are 282 (DHCP, UDP), 42 (ARP) and 54 (IPv6) bytes long */
+    DO_TEST_FILTER("none", 0, 0, 0, 0, 0, 0);
+    DO_TEST_FILTER("dhcp", VIR_NWFILTER_CAPTURE_DHCP, 282, 282, 0, 0, 0);
+    DO_TEST_FILTER("arp", VIR_NWFILTER_CAPTURE_ARP, 0, 0, 42, 0, 0);
+    DO_TEST_FILTER("ipv4", VIR_NWFILTER_CAPTURE_IPV4, 128, 128, 0, 128, 0);
+    DO_TEST_FILTER("dhcp-ipv4",
+                   VIR_NWFILTER_CAPTURE_DHCP | VIR_NWFILTER_CAPTURE_IPV4,
+                   282, 282, 0, 128, 0);
+    DO_TEST_FILTER("all",
+                   VIR_NWFILTER_CAPTURE_DHCP | VIR_NWFILTER_CAPTURE_ARP |
+                   VIR_NWFILTER_CAPTURE_IPV4, 282, 282, 42, 128, 0);
+
+    if (virtTestRun("Capture classify", testCaptureClassify, NULL) < 0)
+        ret = -1;
+
+    /* Packets are injected rather than captured from a socket, and
+     * the capture stops as soon as nobody subscribed */
+    if (virNWFilterCaptureInitInternal(false, 0) < 0)
+        return EXIT_FAILURE;
+
+    if (virtTestRun("Capture deliver", testCaptureDeliver, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Capture tick", testCaptureTick, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Capture unsubscribe busy",
+                    testCaptureUnsubscribeBusy, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Capture idle", testCaptureIdle, NULL) < 0)
+        ret = -1;
+
+    virNWFilterCaptureShutdown();
+
+    /* Capturing from real interfaces needs a network namespace of
+     * our own to create them in */
+    if (geteuid() == 0 && unshare(CLONE_NEWNET) == 0 &&
+        testCaptureVeth() < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* __linux__ */
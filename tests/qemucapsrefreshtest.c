@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "testutils.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virhash.h"
+#include "virstring.h"
+#include "qemu/qemu_conf.h"
+#include "qemu/qemu_capabilities.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define SCRATCHDIRTEMPLATE abs_builddir "/qemucapsrefreshdata-XXXXXX"
+
+static virQEMUDriver driver;
+static char *loader;
+
+
+/* Makes the firmware image appear or disappear, which is a change of
+ * the host the capabilities have to follow */
+static int
+testChangeHost(void)
+{
+    int fd;
+
+    if (virFileExists(loader))
+        return unlink(loader);
+
+    if ((fd = open(loader, O_WRONLY | O_CREAT, 0600)) < 0)
+        return -1;
+    return VIR_CLOSE(fd);
+}
+
+
+static bool
+testFingerprintHasLoader(bool present)
+{
+    char *line = NULL;
+    bool ret;
+
+    if (virAsprintf(&line, "%s=-\n", loader) < 0)
+        return false;
+
+    ret = strstr(driver.capsFingerprint, loader) &&
+        (strstr(driver.capsFingerprint, line) == NULL) == present;
+
+    VIR_FREE(line);
+    return ret;
+}
+
+
+/* The fingerprint has to describe the host the capabilities were built
+ * from at startup already, not the one seen at the first query */
+static int
+testStartup(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virCapsPtr caps = NULL;
+    int ret = -1;
+
+    if (virQEMUDriverRefreshCapabilities(&driver) < 0)
+        goto cleanup;
+
+    if (!driver.caps || !driver.capsFingerprint ||
+        !testFingerprintHasLoader(false)) {
+        virFilePrintf(stderr, "startup did not fingerprint the host\n");
+        goto cleanup;
+    }
+
+    if (testChangeHost() < 0)
+        goto cleanup;
+
+    if (!(caps = virQEMUDriverGetCapabilities(&driver, true)))
+        goto cleanup;
+
+    if (driver.capsGeneration != 2 || !testFingerprintHasLoader(true)) {
+        virFilePrintf(stderr, "change before first query was missed, "
+                      "generation %u\n", driver.capsGeneration);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(caps);
+    return ret;
+}
+
+
+static int
+testUnchanged(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virCapsPtr caps1 = NULL;
+    virCapsPtr caps2 = NULL;
+    unsigned int generation = driver.capsGeneration;
+    int ret = -1;
+
+    if (!(caps1 = virQEMUDriverGetCapabilities(&driver, true)) ||
+        !(caps2 = virQEMUDriverGetCapabilities(&driver, true)))
+        goto cleanup;
+
+    if (caps1 != caps2 || driver.capsGeneration != generation) {
+        virFilePrintf(stderr, "capabilities rebuilt for unchanged host\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(caps1);
+    virObjectUnref(caps2);
+    return ret;
+}
+
+
+static int
+testCapsXML(const void *opaque ATTRIBUTE_UNUSED)
+{
+    char *xml = NULL;
+    int ret = -1;
+
+    if (!(xml = virQEMUDriverGetCapabilitiesXML(&driver)))
+        goto cleanup;
+
+    if (STRNEQ_NULLABLE(driver.capsXML, xml)) {
+        virFilePrintf(stderr, "capabilities XML was not cached\n");
+        goto cleanup;
+    }
+    VIR_FREE(xml);
+
+    /* Mark the cached copy so that we can tell where the XML comes from */
+    VIR_FREE(driver.capsXML);
+    if (VIR_STRDUP(driver.capsXML, "<cached/>") < 0)
+        goto cleanup;
+
+    if (!(xml = virQEMUDriverGetCapabilitiesXML(&driver)))
+        goto cleanup;
+    if (STRNEQ(xml, "<cached/>")) {
+        virFilePrintf(stderr, "capabilities XML was formatted again\n");
+        goto cleanup;
+    }
+    VIR_FREE(xml);
+
+    if (testChangeHost() < 0)
+        goto cleanup;
+
+    if (!(xml = virQEMUDriverGetCapabilitiesXML(&driver)))
+        goto cleanup;
+    if (!strstr(xml, "<capabilities>") ||
+        STRNEQ_NULLABLE(driver.capsXML, xml)) {
+        virFilePrintf(stderr, "stale capabilities XML after host change\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static int
+testDomainCapsXML(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virQEMUCapsPtr qemuCaps = NULL;
+    virQEMUCapsPtr newCaps = NULL;
+    const char *key = "/usr/bin/qemu-kvm:x86_64:pc:kvm";
+    char *xml = NULL;
+    unsigned int generation;
+    int ret = -1;
+
+    if (!(qemuCaps = virQEMUCapsNew()) ||
+        !(newCaps = virQEMUCapsNew()))
+        goto cleanup;
+
+    if (virQEMUDriverGetDomainCapsXML(&driver, qemuCaps, key,
+                                      &xml, &generation) != 0) {
+        virFilePrintf(stderr, "unexpected hit in empty cache\n");
+        goto cleanup;
+    }
+    virQEMUDriverCacheDomainCapsXML(&driver, qemuCaps, key,
+                                    "<domainCapabilities/>", generation);
+
+    if (virQEMUDriverGetDomainCapsXML(&driver, qemuCaps, key,
+                                      &xml, &generation) != 1 ||
+        STRNEQ(xml, "<domainCapabilities/>")) {
+        virFilePrintf(stderr, "domain capabilities XML was not cached\n");
+        goto cleanup;
+    }
+    VIR_FREE(xml);
+
+    /* The emulator changed, so it got probed again */
+    if (virQEMUDriverGetDomainCapsXML(&driver, newCaps, key,
+                                      &xml, &generation) != 0) {
+        virFilePrintf(stderr, "cache hit for a different emulator\n");
+        goto cleanup;
+    }
+
+    /* XML formatted from capabilities replaced meanwhile is dropped */
+    virQEMUDriverCacheDomainCapsXML(&driver, newCaps, key,
+                                    "<stale/>", generation - 1);
+    if (virQEMUDriverGetDomainCapsXML(&driver, newCaps, key,
+                                      &xml, &generation) != 0) {
+        virFilePrintf(stderr, "stale domain capabilities XML was cached\n");
+        goto cleanup;
+    }
+
+    if (testChangeHost() < 0)
+        goto cleanup;
+
+    if (virQEMUDriverGetDomainCapsXML(&driver, qemuCaps, key,
+                                      &xml, &generation) != 0) {
+        virFilePrintf(stderr, "domain capabilities XML kept after "
+                      "host change\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(xml);
+    virObjectUnref(qemuCaps);
+    virObjectUnref(newCaps);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    char dir[] = SCRATCHDIRTEMPLATE;
+    virQEMUDriverConfigPtr cfg;
+    int ret = 0;
+
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "Cannot create scratch directory");
+        return EXIT_FAILURE;
+    }
+
+    /* No emulators to probe, and the directory is part of the
+     * fingerprint */
+    if (setenv("PATH", dir, 1) < 0 ||
+        virAsprintf(&loader, "%s/OVMF.fd", dir) < 0)
+        return EXIT_FAILURE;
+
+    if (virMutexInit(&driver.lock) < 0 ||
+        !(driver.config = cfg = virQEMUDriverConfigNew(false)))
+        return EXIT_FAILURE;
+
+    virStringFreeListCount(cfg->loader, cfg->nloader);
+    virStringFreeListCount(cfg->nvram, cfg->nloader);
+    if (VIR_ALLOC_N(cfg->loader, 1) < 0 ||
+        VIR_ALLOC_N(cfg->nvram, 1) < 0 ||
+        VIR_STRDUP(cfg->loader[0], loader) < 0 ||
+        VIR_STRDUP(cfg->nvram[0], loader) < 0)
+        return EXIT_FAILURE;
+    cfg->nloader = 1;
+
+    if (!(driver.qemuCapsCache = virQEMUCapsCacheNew(dir, dir, -1, -1)) ||
+        !(driver.securityManager = virSecurityManagerNew("none", "qemu",
+                                                         false, false,
+                                                         false)) ||
+        !(driver.domCapsCache =
+          virHashCreate(10, virQEMUDriverDomCapsEntryFree)))
+        return EXIT_FAILURE;
+
+    if (virtTestRun("Startup", testStartup, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Unchanged host", testUnchanged, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Capabilities XML", testCapsXML, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Domain capabilities XML", testDomainCapsXML, NULL) < 0)
+        ret = -1;
+
+    virHashFree(driver.domCapsCache);
+    virObjectUnref(driver.securityManager);
+    virQEMUCapsCacheFree(driver.qemuCapsCache);
+    virObjectUnref(driver.caps);
+    VIR_FREE(driver.capsFingerprint);
+    VIR_FREE(driver.capsXML);
+    virObjectUnref(driver.config);
+    virMutexDestroy(&driver.lock);
+    VIR_FREE(loader);
+
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(dir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
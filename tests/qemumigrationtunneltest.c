@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <signal.h>
+#include <unistd.h>
+
+#include "testutils.h"
+#include "datatypes.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virthread.h"
+#include "qemu/qemu_migrationpriv.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Large enough for every stream to carry several chunks */
+#define TEST_DATA_SIZE (8 * 1024 * 1024)
+
+struct testPipeData {
+    int fd;
+    char *buf;
+    size_t len;
+    bool overflow;
+};
+
+
+static char *
+testTunnelPattern(void)
+{
+    char *data;
+    size_t i;
+
+    if (VIR_ALLOC_N(data, TEST_DATA_SIZE) < 0)
+        return NULL;
+
+    /* Not periodic in the chunk size, so misordered chunks show up */
+    for (i = 0; i < TEST_DATA_SIZE; i++)
+        data[i] = (i * 7 + i / 251) & 0xff;
+
+    return data;
+}
+
+
+/* Plays QEMU on the source, feeding the migration data to the tunnel */
+static void
+testTunnelWriter(void *opaque)
+{
+    struct testPipeData *data = opaque;
+
+    ignore_value(safewrite(data->fd, data->buf, data->len));
+    VIR_FORCE_CLOSE(data->fd);
+}
+
+
+/* Plays QEMU on the destination, collecting what the merge passes on */
+static void
+testTunnelReader(void *opaque)
+{
+    struct testPipeData *data = opaque;
+    char buf[4096];
+    ssize_t got;
+
+    while ((got = saferead(data->fd, buf, sizeof(buf))) > 0) {
+        if (data->len + got > TEST_DATA_SIZE) {
+            data->overflow = true;
+            continue;
+        }
+        memcpy(data->buf + data->len, buf, got);
+        data->len += got;
+    }
+}
+
+
+/* Nothing is attached to a merge which is released, e.g. because
+ * Prepare failed after starting it, so the merge has to end on its
+ * own and let QEMU see the end of the migration stream. */
+static int
+testTunnelMergeRelease(const void *opaque ATTRIBUTE_UNUSED)
+{
+    qemuMigrationTunnelMergePtr merge = NULL;
+    struct testPipeData out = { -1, NULL, 0, false };
+    int outFD[2] = { -1, -1 };
+    virThread reader;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(out.buf, TEST_DATA_SIZE) < 0 ||
+        pipe(outFD) < 0 ||
+        !(merge = qemuMigrationTunnelMergeNew(3)))
+        goto cleanup;
+
+    if (qemuMigrationTunnelMergeStart(merge, outFD[1]) < 0)
+        goto cleanup;
+    outFD[1] = -1;
+
+    out.fd = outFD[0];
+    if (virThreadCreate(&reader, true, testTunnelReader, &out) < 0)
+        goto cleanup;
+
+    qemuMigrationTunnelMergeRelease(&merge);
+    virThreadJoin(&reader);
+
+    if (out.len != 0) {
+        virFilePrintf(stderr, "unexpected %zu bytes of data\n", out.len);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    qemuMigrationTunnelMergeRelease(&merge);
+    VIR_FORCE_CLOSE(outFD[0]);
+    VIR_FORCE_CLOSE(outFD[1]);
+    VIR_FREE(out.buf);
+    return ret;
+}
+
+
+static int
+testTunnelMergeAttach(const void *opaque ATTRIBUTE_UNUSED)
+{
+    qemuMigrationTunnelMergePtr merge = NULL;
+    qemuMigrationTunnelMergePtr other = NULL;
+    virConnectPtr conn = NULL;
+    virStreamPtr st[3] = { NULL, NULL, NULL };
+    size_t i;
+    int ret = -1;
+
+    if (!(conn = virGetConnect()) ||
+        !(merge = qemuMigrationTunnelMergeNew(2)) ||
+        !(other = qemuMigrationTunnelMergeNew(2)))
+        goto cleanup;
+
+    if (STREQ(qemuMigrationTunnelMergeGetToken(merge),
+              qemuMigrationTunnelMergeGetToken(other))) {
+        virFilePrintf(stderr, "merges share token %s\n",
+                      qemuMigrationTunnelMergeGetToken(merge));
+        goto cleanup;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(st); i++) {
+        if (!(st[i] = virStreamNew(conn, 0)))
+            goto cleanup;
+    }
+
+    if (qemuMigrationTunnelMergeAttach(merge, st[0], 1) < 0)
+        goto cleanup;
+
+    /* Each index can be claimed only once and only within range */
+    if (qemuMigrationTunnelMergeAttach(merge, st[1], 1) == 0 ||
+        qemuMigrationTunnelMergeAttach(merge, st[1], 2) == 0 ||
+        qemuMigrationTunnelMergeAttach(merge, st[1], -1) == 0) {
+        virFilePrintf(stderr, "stream attached twice or out of range\n");
+        goto cleanup;
+    }
+    virResetLastError();
+
+    if (qemuMigrationTunnelMergeAttach(merge, st[2], 0) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    for (i = 0; i < ARRAY_CARDINALITY(st); i++)
+        virObjectUnref(st[i]);
+    qemuMigrationTunnelMergeRelease(&merge);
+    qemuMigrationTunnelMergeRelease(&other);
+    virObjectUnref(conn);
+    return ret;
+}
+
+
+struct testTunnelData {
+    size_t nstreams;
+    bool fail;      /* last stream has no driver, so sending fails */
+};
+
+/* Runs the source side tunnel straight into the destination merge */
+static int
+testTunnelStriped(const void *opaque)
+{
+    const struct testTunnelData *data = opaque;
+    qemuMigrationTunnelMergePtr merge = NULL;
+    qemuMigrationIOThreadPtr io = NULL;
+    virConnectPtr conn = NULL;
+    virStreamPtr *streams = NULL;
+    struct testPipeData in = { -1, NULL, TEST_DATA_SIZE, false };
+    struct testPipeData out = { -1, NULL, 0, false };
+    int qemuFD[2] = { -1, -1 };
+    int outFD[2] = { -1, -1 };
+    virThread writer;
+    virThread reader;
+    bool writing = false;
+    bool reading = false;
+    int rc;
+    size_t i;
+    int ret = -1;
+
+    if (!(in.buf = testTunnelPattern()) ||
+        VIR_ALLOC_N(out.buf, TEST_DATA_SIZE) < 0 ||
+        VIR_ALLOC_N(streams, data->nstreams) < 0 ||
+        pipe(qemuFD) < 0 || pipe(outFD) < 0)
+        goto cleanup;
+
+    if (!(conn = virGetConnect()) ||
+        !(merge = qemuMigrationTunnelMergeNew(data->nstreams)))
+        goto cleanup;
+
+    if (qemuMigrationTunnelMergeStart(merge, outFD[1]) < 0)
+        goto cleanup;
+    outFD[1] = -1;
+
+    for (i = 0; i < data->nstreams; i++) {
+        if (!(streams[i] = virStreamNew(conn, 0)))
+            goto cleanup;
+        if (data->fail && i == data->nstreams - 1)
+            break;
+        if (qemuMigrationTunnelMergeAttach(merge, streams[i], i) < 0)
+            goto cleanup;
+    }
+    qemuMigrationTunnelMergeRelease(&merge);
+
+    out.fd = outFD[0];
+    if (virThreadCreate(&reader, true, testTunnelReader, &out) < 0)
+        goto cleanup;
+    reading = true;
+
+    in.fd = qemuFD[1];
+    qemuFD[1] = -1;
+    if (virThreadCreate(&writer, true, testTunnelWriter, &in) < 0) {
+        VIR_FORCE_CLOSE(in.fd);
+        goto cleanup;
+    }
+    writing = true;
+
+    if (!(io = qemuMigrationStartTunnel(streams, data->nstreams, qemuFD[0])))
+        goto cleanup;
+
+    /* Once the streams gave up, nobody reads the rest of the data */
+    if (!data->fail) {
+        virThreadJoin(&writer);
+        writing = false;
+    }
+
+    rc = qemuMigrationStopTunnel(io, false);
+    io = NULL;
+
+    if (data->fail) {
+        if (rc == 0) {
+            virFilePrintf(stderr, "failing stream was not reported\n");
+            goto cleanup;
+        }
+        virResetLastError();
+    } else if (rc < 0) {
+        goto cleanup;
+    }
+
+    /* Let the writer see the end of the pipe */
+    VIR_FORCE_CLOSE(qemuFD[0]);
+    if (writing) {
+        virThreadJoin(&writer);
+        writing = false;
+    }
+
+    /* The merge ends once all streams are finished or aborted */
+    for (i = 0; i < data->nstreams; i++) {
+        virObjectUnref(streams[i]);
+        streams[i] = NULL;
+    }
+    virThreadJoin(&reader);
+    reading = false;
+
+    if (out.overflow) {
+        virFilePrintf(stderr, "merge passed on more data than was sent\n");
+        goto cleanup;
+    }
+
+    if (!data->fail && out.len != TEST_DATA_SIZE) {
+        virFilePrintf(stderr, "expected %d bytes, got %zu\n",
+                      TEST_DATA_SIZE, out.len);
+        goto cleanup;
+    }
+
+    /* Whatever was passed on has to be in order, even if incomplete */
+    for (i = 0; i < out.len; i++) {
+        if (out.buf[i] != in.buf[i]) {
+            virFilePrintf(stderr, "data differ at offset %zu\n", i);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    if (io)
+        ignore_value(qemuMigrationStopTunnel(io, true));
+    VIR_FORCE_CLOSE(qemuFD[0]);
+    VIR_FORCE_CLOSE(qemuFD[1]);
+    if (writing)
+        virThreadJoin(&writer);
+    qemuMigrationTunnelMergeRelease(&merge);
+    if (streams) {
+        for (i = 0; i < data->nstreams; i++)
+            virObjectUnref(streams[i]);
+    }
+    if (reading)
+        virThreadJoin(&reader);
+    VIR_FORCE_CLOSE(outFD[0]);
+    VIR_FORCE_CLOSE(outFD[1]);
+    VIR_FREE(streams);
+    VIR_FREE(in.buf);
+    VIR_FREE(out.buf);
+    virObjectUnref(conn);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    signal(SIGPIPE, SIG_IGN);
+    virtTestQuiesceLibvirtErrors(false);
+
+    if (virtTestRun("Release unused merge", testTunnelMergeRelease, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Attach streams", testTunnelMergeAttach, NULL) < 0)
+        ret = -1;
+
+#define DO_TEST(nstreams, fail)                                         \
+    do {                                                                \
+        struct testTunnelData data = { nstreams, fail };                \
+        if (virtTestRun("Striped over " #nstreams " streams"            \
+                        " fail=" #fail, testTunnelStriped, &data) < 0)  \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST(2, false);
+    DO_TEST(4, false);
+    DO_TEST(16, false);
+    DO_TEST(2, true);
+    DO_TEST(4, true);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
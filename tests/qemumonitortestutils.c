@@ -900,6 +900,7 @@ qemuMonitorTestNew(bool json,
     if (!(test->mon = qemuMonitorOpen(test->vm,
                                       &src,
                                       json,
+                                      NULL,
                                       &qemuMonitorTestCallbacks,
                                       driver)))
         goto error;
@@ -938,6 +939,7 @@ qemuMonitorTestNewAgent(virDomainXMLOptionPtr xmlopt)
 
     if (!(test->agent = qemuAgentOpen(test->vm,
                                       &src,
+                                      NULL,
                                       &qemuMonitorTestAgentCallbacks)))
         goto error;
 
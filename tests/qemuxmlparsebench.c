@@ -0,0 +1,439 @@
+/*
+ * qemuxmlparsebench.c: domain XML parsing benchmarks
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * The corpus is every document in tests/qemuxml2argvdata which the
+ * QEMU driver accepts, or the files given with --file. Like
+ * virapibench, every workload prints one JSON object on a line of
+ * its own.
+ */
+
+#include <config.h>
+
+#include <dirent.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "internal.h"
+#include "qemu/qemu_conf.h"
+#include "qemu/qemu_domain.h"
+#include "testutilsqemu.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define BENCH_MAX_XML (10 * 1024 * 1024)
+
+typedef struct _benchDoc benchDoc;
+typedef benchDoc *benchDocPtr;
+struct _benchDoc {
+    char *name;
+    char *xml;
+    virDomainDefPtr def;
+    unsigned long long elapsed;   /* in the current workload */
+};
+
+typedef struct _benchState benchState;
+typedef benchState *benchStatePtr;
+struct _benchState {
+    virQEMUDriver driver;
+    benchDocPtr docs;
+    size_t ndocs;
+    size_t skipped;
+};
+
+typedef int (*benchFunc)(benchStatePtr state,
+                         benchDocPtr doc);
+
+typedef struct _benchWorkload benchWorkload;
+struct _benchWorkload {
+    const char *name;
+    benchFunc func;
+    size_t iterations;      /* passes over the corpus */
+};
+
+
+static unsigned long long
+benchNowUS(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+
+static void
+benchQuietError(void *opaque ATTRIBUTE_UNUSED,
+                virErrorPtr err ATTRIBUTE_UNUSED)
+{
+}
+
+
+static virDomainDefPtr
+benchParse(benchStatePtr state,
+           const char *xml)
+{
+    return virDomainDefParseString(xml, state->driver.caps,
+                                   state->driver.xmlopt,
+                                   QEMU_EXPECTED_VIRT_TYPES,
+                                   VIR_DOMAIN_DEF_PARSE_INACTIVE);
+}
+
+
+static int
+benchWorkloadParse(benchStatePtr state,
+                   benchDocPtr doc)
+{
+    virDomainDefPtr def;
+
+    if (!(def = benchParse(state, doc->xml)))
+        return -1;
+
+    virDomainDefFree(def);
+    return 0;
+}
+
+
+static int
+benchWorkloadFormat(benchStatePtr state ATTRIBUTE_UNUSED,
+                    benchDocPtr doc)
+{
+    char *xml;
+
+    if (!(xml = virDomainDefFormat(doc->def,
+                                   VIR_DOMAIN_DEF_FORMAT_SECURE |
+                                   VIR_DOMAIN_DEF_FORMAT_INACTIVE)))
+        return -1;
+
+    VIR_FREE(xml);
+    return 0;
+}
+
+
+static int
+benchWorkloadCopy(benchStatePtr state,
+                  benchDocPtr doc)
+{
+    virDomainDefPtr def;
+
+    if (!(def = virDomainDefCopy(doc->def, state->driver.caps,
+                                 state->driver.xmlopt, false)))
+        return -1;
+
+    virDomainDefFree(def);
+    return 0;
+}
+
+
+static const benchWorkload workloads[] = {
+    { "parse", benchWorkloadParse, 20 },
+    { "format", benchWorkloadFormat, 20 },
+    { "copy", benchWorkloadCopy, 10 },
+};
+
+
+static int
+benchRunWorkload(benchStatePtr state,
+                 const benchWorkload *workload,
+                 size_t iterations)
+{
+    benchDocPtr slowest = NULL;
+    unsigned long long start;
+    unsigned long long elapsed;
+    size_t errors = 0;
+    size_t i, j;
+
+    if (!iterations)
+        iterations = workload->iterations;
+
+    for (i = 0; i < state->ndocs; i++)
+        state->docs[i].elapsed = 0;
+
+    start = benchNowUS();
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < state->ndocs; j++) {
+            benchDocPtr doc = state->docs + j;
+            unsigned long long docStart = benchNowUS();
+
+            if (workload->func(state, doc) < 0)
+                errors++;
+            doc->elapsed += benchNowUS() - docStart;
+        }
+    }
+    elapsed = benchNowUS() - start;
+
+    for (i = 0; i < state->ndocs; i++) {
+        if (!slowest || state->docs[i].elapsed > slowest->elapsed)
+            slowest = state->docs + i;
+    }
+
+    printf("{\"workload\": \"%s\", \"version\": %d, \"documents\": %zu, "
+           "\"skipped\": %zu, \"iterations\": %zu, \"errors\": %zu, "
+           "\"seconds\": %.3f, \"docs_per_sec\": %.1f, \"mean_us\": %.1f, "
+           "\"slowest\": \"%s\", \"slowest_us\": %.1f}\n",
+           workload->name, LIBVIR_VERSION_NUMBER, state->ndocs,
+           state->skipped, iterations, errors,
+           elapsed / 1e6,
+           elapsed ? state->ndocs * iterations * 1e6 / elapsed : 0.0,
+           (double) elapsed / (state->ndocs * iterations),
+           slowest->name,
+           (double) slowest->elapsed / iterations);
+    fflush(stdout);
+
+    return errors ? -1 : 0;
+}
+
+
+/* Documents the driver rejects are meant to test error reporting
+ * and are left out of the corpus */
+static int
+benchAddDoc(benchStatePtr state,
+            const char *path,
+            const char *name,
+            bool required)
+{
+    benchDoc doc;
+
+    memset(&doc, 0, sizeof(doc));
+
+    if (virFileReadAll(path, BENCH_MAX_XML, &doc.xml) < 0)
+        goto error;
+
+    if (!(doc.def = benchParse(state, doc.xml))) {
+        if (required) {
+            fprintf(stderr, "unable to parse '%s': %s\n",
+                    path, virGetLastErrorMessage());
+            goto error;
+        }
+        virResetLastError();
+        state->skipped++;
+        VIR_FREE(doc.xml);
+        return 0;
+    }
+
+    if (VIR_STRDUP(doc.name, name) < 0 ||
+        VIR_APPEND_ELEMENT(state->docs, state->ndocs, doc) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    VIR_FREE(doc.name);
+    VIR_FREE(doc.xml);
+    virDomainDefFree(doc.def);
+    return -1;
+}
+
+
+static int
+benchCompareNames(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+static int
+benchLoadCorpus(benchStatePtr state,
+                const char *dirname)
+{
+    DIR *dir;
+    struct dirent *ent;
+    char **names = NULL;
+    size_t nnames = 0;
+    char *path = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (!(dir = opendir(dirname))) {
+        virReportSystemError(errno, _("cannot open directory '%s'"), dirname);
+        return -1;
+    }
+
+    while ((ent = readdir(dir))) {
+        char *name;
+
+        if (!STRPREFIX(ent->d_name, "qemuxml2argv-") ||
+            !virFileHasSuffix(ent->d_name, ".xml"))
+            continue;
+
+        if (VIR_STRDUP(name, ent->d_name) < 0 ||
+            VIR_APPEND_ELEMENT(names, nnames, name) < 0) {
+            VIR_FREE(name);
+            goto cleanup;
+        }
+    }
+
+    /* Keep the order independent of the file system */
+    qsort(names, nnames, sizeof(*names), benchCompareNames);
+
+    for (i = 0; i < nnames; i++) {
+        if (virAsprintf(&path, "%s/%s", dirname, names[i]) < 0 ||
+            benchAddDoc(state, path, names[i], false) < 0)
+            goto cleanup;
+        VIR_FREE(path);
+    }
+
+    ret = 0;
+ cleanup:
+    for (i = 0; i < nnames; i++)
+        VIR_FREE(names[i]);
+    VIR_FREE(names);
+    VIR_FREE(path);
+    closedir(dir);
+    return ret;
+}
+
+
+static void
+benchUsage(const char *argv0)
+{
+    size_t i;
+
+    fprintf(stderr,
+            "Usage: %s [OPTIONS] [WORKLOAD...]\n\n"
+            "  -f, --file FILE        benchmark FILE instead of the corpus\n"
+            "  -n, --iterations N     passes over the documents\n"
+            "  -h, --help             show this message\n\n"
+            "Workloads:\n", argv0);
+    for (i = 0; i < ARRAY_CARDINALITY(workloads); i++)
+        fprintf(stderr, "  %-18s %zu iterations by default\n",
+                workloads[i].name, workloads[i].iterations);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    struct option opts[] = {
+        { "file", required_argument, NULL, 'f' },
+        { "iterations", required_argument, NULL, 'n' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    benchState state;
+    char **files = NULL;
+    size_t nfiles = 0;
+    char *corpus = NULL;
+    unsigned int iterations = 0;
+    size_t i;
+    int c, j;
+    int ret = EXIT_FAILURE;
+
+    memset(&state, 0, sizeof(state));
+
+    if (virInitialize() < 0) {
+        fprintf(stderr, "unable to initialize libvirt\n");
+        return EXIT_FAILURE;
+    }
+
+    while ((c = getopt_long(argc, argv, "f:n:h", opts, NULL)) != -1) {
+        switch (c) {
+        case 'f':
+            if (VIR_APPEND_ELEMENT_COPY(files, nfiles, optarg) < 0)
+                goto cleanup;
+            break;
+        case 'n':
+            if (virStrToLong_ui(optarg, NULL, 10, &iterations) < 0 ||
+                iterations == 0) {
+                fprintf(stderr, "invalid iteration count '%s'\n", optarg);
+                goto cleanup;
+            }
+            break;
+        case 'h':
+            benchUsage(argv[0]);
+            ret = EXIT_SUCCESS;
+            goto cleanup;
+        default:
+            benchUsage(argv[0]);
+            goto cleanup;
+        }
+    }
+
+    for (j = optind; j < argc; j++) {
+        for (i = 0; i < ARRAY_CARDINALITY(workloads); i++) {
+            if (STREQ(argv[j], workloads[i].name))
+                break;
+        }
+        if (i == ARRAY_CARDINALITY(workloads)) {
+            fprintf(stderr, "unknown workload '%s'\n", argv[j]);
+            benchUsage(argv[0]);
+            goto cleanup;
+        }
+    }
+
+    if (!(state.driver.caps = testQemuCapsInit()) ||
+        !(state.driver.xmlopt = virQEMUDriverCreateXMLConf(&state.driver))) {
+        fprintf(stderr, "unable to set up QEMU capabilities\n");
+        goto cleanup;
+    }
+
+    /* Rejected documents in the corpus are expected */
+    virSetErrorFunc(NULL, benchQuietError);
+
+    if (nfiles) {
+        for (i = 0; i < nfiles; i++) {
+            if (benchAddDoc(&state, files[i], files[i], true) < 0)
+                goto cleanup;
+        }
+    } else {
+        if (virAsprintf(&corpus, "%s/qemuxml2argvdata", abs_srcdir) < 0 ||
+            benchLoadCorpus(&state, corpus) < 0) {
+            fprintf(stderr, "unable to load '%s': %s\n",
+                    NULLSTR(corpus), virGetLastErrorMessage());
+            goto cleanup;
+        }
+    }
+
+    if (state.ndocs == 0) {
+        fprintf(stderr, "no documents to benchmark\n");
+        goto cleanup;
+    }
+
+    ret = EXIT_SUCCESS;
+    for (i = 0; i < ARRAY_CARDINALITY(workloads); i++) {
+        bool selected = optind == argc;
+
+        for (j = optind; j < argc && !selected; j++)
+            selected = STREQ(argv[j], workloads[i].name);
+
+        if (selected &&
+            benchRunWorkload(&state, workloads + i, iterations) < 0)
+            ret = EXIT_FAILURE;
+    }
+
+ cleanup:
+    for (i = 0; i < state.ndocs; i++) {
+        VIR_FREE(state.docs[i].name);
+        VIR_FREE(state.docs[i].xml);
+        virDomainDefFree(state.docs[i].def);
+    }
+    VIR_FREE(state.docs);
+    VIR_FREE(files);
+    VIR_FREE(corpus);
+    virObjectUnref(state.driver.caps);
+    virObjectUnref(state.driver.xmlopt);
+    return ret;
+}
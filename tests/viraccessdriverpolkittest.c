@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#if defined(WITH_DBUS) && defined(__linux__)
+
+# include <stdlib.h>
+# include <dbus/dbus.h>
+
+# include "access/viraccessmanager.h"
+# include "viralloc.h"
+# include "virdbus.h"
+# include "viridentity.h"
+# include "virlog.h"
+# include "virmock.h"
+# include "virstring.h"
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.accessdriverpolkittest");
+
+/* Some interesting numbers */
+# define THE_PID 1458
+# define THE_TIME 11011000001
+# define THE_UID 1729
+
+/* Number of CheckAuthorization calls that reached polkitd */
+static size_t polkitCalls;
+
+VIR_MOCK_WRAP_RET_ARGS(dbus_connection_send_with_reply_and_block,
+                       DBusMessage *,
+                       DBusConnection *, connection,
+                       DBusMessage *, message,
+                       int, timeout_milliseconds,
+                       DBusError *, error)
+{
+    DBusMessage *reply = NULL;
+    const char *service = dbus_message_get_destination(message);
+    const char *member = dbus_message_get_member(message);
+
+    VIR_MOCK_REAL_INIT(dbus_connection_send_with_reply_and_block);
+
+    if (STREQ(service, "org.freedesktop.PolicyKit1") &&
+        STREQ(member, "CheckAuthorization")) {
+        char *type;
+        char *pidkey;
+        unsigned int pidval;
+        char *timekey;
+        unsigned long long timeval;
+        char *uidkey;
+        int uidval;
+        char *actionid;
+        char **details;
+        size_t detailslen;
+        int allowInteraction;
+        char *cancellationId;
+        int is_authorized;
+
+        if (virDBusMessageRead(message,
+                               "(sa{sv})sa&{ss}us",
+                               &type,
+                               3,
+                               &pidkey, "u", &pidval,
+                               &timekey, "t", &timeval,
+                               &uidkey, "i", &uidval,
+                               &actionid,
+                               &detailslen,
+                               &details,
+                               &allowInteraction,
+                               &cancellationId) < 0)
+            goto error;
+
+        polkitCalls++;
+        is_authorized = STREQ(actionid, "org.libvirt.api.domain.getattr");
+
+        VIR_FREE(type);
+        VIR_FREE(pidkey);
+        VIR_FREE(timekey);
+        VIR_FREE(uidkey);
+        VIR_FREE(actionid);
+        VIR_FREE(cancellationId);
+        virStringFreeListCount(details, detailslen);
+
+        if (virDBusCreateReply(&reply,
+                               "(bba&{ss})",
+                               is_authorized,
+                               0,
+                               0) < 0)
+            goto error;
+    } else {
+        reply = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_RETURN);
+    }
+
+    return reply;
+
+ error:
+    dbus_message_unref(reply);
+    return NULL;
+}
+
+
+static virAccessManagerPtr manager;
+static virDomainDefPtr domain;
+
+
+static int
+testSetIdentity(unsigned long long startTime)
+{
+    virIdentityPtr ident;
+    int ret = -1;
+
+    if (!(ident = virIdentityNew()))
+        return -1;
+
+    if (virIdentitySetUNIXProcessID(ident, THE_PID) < 0 ||
+        virIdentitySetUNIXProcessTime(ident, startTime) < 0 ||
+        virIdentitySetUNIXUserID(ident, THE_UID) < 0 ||
+        virIdentitySetCurrent(ident) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(ident);
+    return ret;
+}
+
+
+static int
+testCheck(virAccessPermDomain perm,
+          int expectResult,
+          size_t expectCalls,
+          unsigned long long expectHits,
+          unsigned long long expectMisses)
+{
+    unsigned long long hits;
+    unsigned long long misses;
+    int rv;
+
+    rv = virAccessManagerCheckDomain(manager, "QEMU", domain, perm);
+    virResetLastError();
+
+    virAccessManagerGetCacheStats(manager, &hits, &misses);
+
+    if (rv != expectResult ||
+        polkitCalls != expectCalls ||
+        hits != expectHits ||
+        misses != expectMisses) {
+        fprintf(stderr,
+                "Expected result=%d calls=%zu hits=%llu misses=%llu, "
+                "got result=%d calls=%zu hits=%llu misses=%llu\n",
+                expectResult, expectCalls, expectHits, expectMisses,
+                rv, polkitCalls, hits, misses);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testPolkitCacheReuse(const void *opaque ATTRIBUTE_UNUSED)
+{
+    if (testSetIdentity(THE_TIME) < 0)
+        return -1;
+
+    /* First checks go to polkitd, repeated ones are answered locally,
+     * both for allowed and for denied actions */
+    if (testCheck(VIR_ACCESS_PERM_DOMAIN_GETATTR, 1, 1, 0, 1) < 0 ||
+        testCheck(VIR_ACCESS_PERM_DOMAIN_GETATTR, 1, 1, 1, 1) < 0 ||
+        testCheck(VIR_ACCESS_PERM_DOMAIN_WRITE, 0, 2, 1, 2) < 0 ||
+        testCheck(VIR_ACCESS_PERM_DOMAIN_WRITE, 0, 2, 2, 2) < 0 ||
+        testCheck(VIR_ACCESS_PERM_DOMAIN_GETATTR, 1, 2, 3, 2) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+testPolkitCacheProcess(const void *opaque ATTRIBUTE_UNUSED)
+{
+    /* A different process reusing the same PID must not
+     * inherit the decision made for its predecessor */
+    if (testSetIdentity(THE_TIME + 1) < 0)
+        return -1;
+
+    if (testCheck(VIR_ACCESS_PERM_DOMAIN_GETATTR, 1, 3, 3, 3) < 0)
+        return -1;
+
+    /* Without a start time decisions are never cached */
+    if (testSetIdentity(0) < 0)
+        return -1;
+
+    if (testCheck(VIR_ACCESS_PERM_DOMAIN_GETATTR, 1, 4, 3, 3) < 0 ||
+        testCheck(VIR_ACCESS_PERM_DOMAIN_GETATTR, 1, 5, 3, 3) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+testPolkitCacheFlush(const void *opaque ATTRIBUTE_UNUSED)
+{
+    if (testSetIdentity(THE_TIME) < 0)
+        return -1;
+
+    virAccessManagerFlushCache(manager);
+
+    if (testCheck(VIR_ACCESS_PERM_DOMAIN_GETATTR, 1, 6, 3, 4) < 0 ||
+        testCheck(VIR_ACCESS_PERM_DOMAIN_GETATTR, 1, 6, 4, 4) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    const char *drivers[] = { "polkit", NULL };
+    int ret = 0;
+
+    if (!(manager = virAccessManagerNewStack(drivers)))
+        return EXIT_FAILURE;
+
+    if (VIR_ALLOC(domain) < 0 ||
+        VIR_STRDUP(domain->name, "test") < 0)
+        return EXIT_FAILURE;
+
+    if (virtTestRun("Polkit cache reuse ", testPolkitCacheReuse, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Polkit cache process ", testPolkitCacheProcess, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Polkit cache flush ", testPolkitCacheFlush, NULL) < 0)
+        ret = -1;
+
+    virDomainDefFree(domain);
+    virObjectUnref(manager);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN_PRELOAD(mymain, abs_builddir "/.libs/virmockdbus.so")
+
+#else /* ! (WITH_DBUS && __linux__) */
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+#endif /* ! WITH_DBUS */
@@ -0,0 +1,627 @@
+/*
+ * virapibench.c: API level benchmarks against a scaled test driver
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Without --uri the benchmarks run against the in-process test driver
+ * loaded with examples/xml/test/testnodescale.xml. To include the
+ * daemon and the RPC layer in the measurement, start libvirtd and use
+ * a URI like test+unix:///abs/path/to/testnodescale.xml instead.
+ *
+ * Every workload prints one JSON object on a line of its own, so runs
+ * of different releases can be compared by a script.
+ */
+
+#include <config.h>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "internal.h"
+#include "viralloc.h"
+#include "virbuffer.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+typedef struct _benchState benchState;
+typedef benchState *benchStatePtr;
+
+typedef int (*benchFunc)(benchStatePtr state,
+                         size_t thread,
+                         size_t iteration);
+
+typedef struct _benchWorkload benchWorkload;
+struct _benchWorkload {
+    const char *name;
+    benchFunc func;
+    size_t iterations;      /* per thread, unless overridden */
+    bool serial;            /* always run on a single thread */
+};
+
+typedef struct _benchThread benchThread;
+typedef benchThread *benchThreadPtr;
+struct _benchThread {
+    benchStatePtr state;
+    const benchWorkload *workload;
+    size_t id;
+    size_t iterations;
+    unsigned long long *latencies;
+    size_t nlatencies;
+    size_t errors;
+};
+
+struct _benchState {
+    virConnectPtr conn;
+    char **names;
+    size_t nnames;
+
+    size_t callbacks;
+    int *callbackIDs;
+    virMutex lock;
+    virCond cond;
+    size_t delivered;
+    bool quit;
+};
+
+
+static unsigned long long
+benchNowUS(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+
+static int
+benchListAll(benchStatePtr state,
+             size_t thread ATTRIBUTE_UNUSED,
+             size_t iteration ATTRIBUTE_UNUSED)
+{
+    virDomainPtr *doms = NULL;
+    int ndoms;
+    size_t i;
+
+    if ((ndoms = virConnectListAllDomains(state->conn, &doms, 0)) < 0)
+        return -1;
+
+    for (i = 0; i < ndoms; i++)
+        virDomainFree(doms[i]);
+    VIR_FREE(doms);
+    return 0;
+}
+
+
+static int
+benchLookup(benchStatePtr state,
+            size_t thread,
+            size_t iteration)
+{
+    virDomainPtr dom;
+
+    /* Spread the threads over the name space */
+    if (!(dom = virDomainLookupByName(state->conn,
+                                      state->names[(iteration * 7919 + thread) %
+                                                   state->nnames])))
+        return -1;
+
+    virDomainFree(dom);
+    return 0;
+}
+
+
+static int
+benchStats(benchStatePtr state,
+           size_t thread ATTRIBUTE_UNUSED,
+           size_t iteration ATTRIBUTE_UNUSED)
+{
+    virDomainStatsRecordPtr *records = NULL;
+
+    if (virConnectGetAllDomainStats(state->conn, 0, &records, 0) < 0)
+        return -1;
+
+    virDomainStatsRecordListFree(records);
+    return 0;
+}
+
+
+static int
+benchLifecycleEvent(virConnectPtr conn ATTRIBUTE_UNUSED,
+                    virDomainPtr dom ATTRIBUTE_UNUSED,
+                    int event ATTRIBUTE_UNUSED,
+                    int detail ATTRIBUTE_UNUSED,
+                    void *opaque)
+{
+    benchStatePtr state = opaque;
+
+    virMutexLock(&state->lock);
+    state->delivered++;
+    virCondSignal(&state->cond);
+    virMutexUnlock(&state->lock);
+    return 0;
+}
+
+
+/* Times one state change until every registered callback saw it */
+static int
+benchEvents(benchStatePtr state,
+            size_t thread ATTRIBUTE_UNUSED,
+            size_t iteration)
+{
+    virDomainPtr dom;
+    unsigned long long deadline;
+    int ret = -1;
+
+    if (!(dom = virDomainLookupByName(state->conn, state->names[0])))
+        return -1;
+
+    virMutexLock(&state->lock);
+    state->delivered = 0;
+    virMutexUnlock(&state->lock);
+
+    if ((iteration % 2 ? virDomainResume(dom) : virDomainSuspend(dom)) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&deadline) < 0)
+        goto cleanup;
+    deadline += 10 * 1000;
+
+    virMutexLock(&state->lock);
+    while (state->delivered < state->callbacks) {
+        if (virCondWaitUntil(&state->cond, &state->lock, deadline) < 0) {
+            virMutexUnlock(&state->lock);
+            goto cleanup;
+        }
+    }
+    virMutexUnlock(&state->lock);
+
+    ret = 0;
+ cleanup:
+    virDomainFree(dom);
+    return ret;
+}
+
+
+static int
+benchChurn(benchStatePtr state,
+           size_t thread,
+           size_t iteration)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virDomainPtr dom = NULL;
+    char *xml = NULL;
+    size_t i;
+    int ret = -1;
+
+    virBufferAddLit(&buf, "<domain type='test'>\n");
+    virBufferAsprintf(&buf, "  <name>bench-%zu-%zu</name>\n",
+                      thread, iteration);
+    virBufferAddLit(&buf, "  <memory>1048576</memory>\n");
+    virBufferAddLit(&buf, "  <vcpu>2</vcpu>\n");
+    virBufferAddLit(&buf, "  <os><type>hvm</type></os>\n");
+    virBufferAddLit(&buf, "  <devices>\n");
+    for (i = 0; i < 4; i++) {
+        virBufferAddLit(&buf, "    <disk type='file' device='disk'>\n");
+        virBufferAsprintf(&buf, "      <source file='/var/lib/libvirt/images/bench-%zu-%zu-%zu.img'/>\n",
+                          thread, iteration, i);
+        virBufferAsprintf(&buf, "      <target dev='vd%c' bus='virtio'/>\n",
+                          (char) ('a' + i));
+        virBufferAddLit(&buf, "    </disk>\n");
+    }
+    for (i = 0; i < 2; i++) {
+        virBufferAddLit(&buf, "    <interface type='network'>\n");
+        virBufferAddLit(&buf, "      <source network='default'/>\n");
+        virBufferAddLit(&buf, "    </interface>\n");
+    }
+    virBufferAddLit(&buf, "  </devices>\n");
+    virBufferAddLit(&buf, "</domain>\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+    xml = virBufferContentAndReset(&buf);
+
+    if (!(dom = virDomainDefineXML(state->conn, xml)) ||
+        virDomainUndefine(dom) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    if (dom)
+        virDomainFree(dom);
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static const benchWorkload workloads[] = {
+    { "list-all", benchListAll, 200, false },
+    { "lookup-by-name", benchLookup, 5000, false },
+    { "bulk-stats", benchStats, 5, false },
+    { "event-fanout", benchEvents, 200, true },
+    { "define-undefine", benchChurn, 200, false },
+};
+
+
+static void
+benchThreadRun(void *opaque)
+{
+    benchThreadPtr thr = opaque;
+    unsigned long long start;
+    size_t i;
+
+    for (i = 0; i < thr->iterations; i++) {
+        start = benchNowUS();
+        if (thr->workload->func(thr->state, thr->id, i) < 0) {
+            if (thr->errors++ == 0)
+                fprintf(stderr, "%s: %s\n", thr->workload->name,
+                        virGetLastErrorMessage());
+            continue;
+        }
+        thr->latencies[thr->nlatencies++] = benchNowUS() - start;
+    }
+}
+
+
+static int
+benchCompareULL(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+static unsigned long long
+benchPercentile(unsigned long long *sorted,
+                size_t n,
+                unsigned int pct)
+{
+    if (!n)
+        return 0;
+    return sorted[((n - 1) * pct) / 100];
+}
+
+
+static int
+benchRun(benchStatePtr state,
+         const benchWorkload *workload,
+         size_t nthreads,
+         size_t iterations,
+         unsigned long libVersion)
+{
+    benchThreadPtr threads = NULL;
+    virThread *ids = NULL;
+    unsigned long long *all = NULL;
+    unsigned long long start, elapsed, sum = 0;
+    size_t nall = 0, errors = 0;
+    size_t i, j;
+    int ret = -1;
+
+    if (workload->serial)
+        nthreads = 1;
+    if (!iterations)
+        iterations = workload->iterations;
+
+    if (VIR_ALLOC_N(threads, nthreads) < 0 ||
+        VIR_ALLOC_N(ids, nthreads) < 0 ||
+        VIR_ALLOC_N(all, nthreads * iterations) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nthreads; i++) {
+        threads[i].state = state;
+        threads[i].workload = workload;
+        threads[i].id = i;
+        threads[i].iterations = iterations;
+        if (VIR_ALLOC_N(threads[i].latencies, iterations) < 0)
+            goto cleanup;
+    }
+
+    start = benchNowUS();
+    for (i = 0; i < nthreads; i++) {
+        if (virThreadCreate(&ids[i], true, benchThreadRun, &threads[i]) < 0) {
+            fprintf(stderr, "%s: unable to create thread\n", workload->name);
+            while (i--)
+                virThreadJoin(&ids[i]);
+            goto cleanup;
+        }
+    }
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&ids[i]);
+    elapsed = benchNowUS() - start;
+
+    for (i = 0; i < nthreads; i++) {
+        for (j = 0; j < threads[i].nlatencies; j++) {
+            sum += threads[i].latencies[j];
+            all[nall++] = threads[i].latencies[j];
+        }
+        errors += threads[i].errors;
+    }
+    qsort(all, nall, sizeof(*all), benchCompareULL);
+
+    printf("{\"workload\": \"%s\", \"version\": %lu, \"domains\": %zu, "
+           "\"threads\": %zu, \"ops\": %zu, \"errors\": %zu, "
+           "\"seconds\": %.3f, \"ops_per_sec\": %.1f, "
+           "\"mean_us\": %llu, \"p50_us\": %llu, \"p90_us\": %llu, "
+           "\"p99_us\": %llu, \"max_us\": %llu}\n",
+           workload->name, libVersion, state->nnames,
+           nthreads, nall, errors,
+           elapsed / 1e6, elapsed ? nall * 1e6 / elapsed : 0.0,
+           nall ? sum / nall : 0,
+           benchPercentile(all, nall, 50),
+           benchPercentile(all, nall, 90),
+           benchPercentile(all, nall, 99),
+           nall ? all[nall - 1] : 0);
+    fflush(stdout);
+
+    ret = errors ? -1 : 0;
+ cleanup:
+    if (threads) {
+        for (i = 0; i < nthreads; i++)
+            VIR_FREE(threads[i].latencies);
+    }
+    VIR_FREE(threads);
+    VIR_FREE(ids);
+    VIR_FREE(all);
+    return ret;
+}
+
+
+static void
+benchEventLoop(void *opaque)
+{
+    benchStatePtr state = opaque;
+    bool quit = false;
+
+    while (!quit) {
+        if (virEventRunDefaultImpl() < 0)
+            break;
+        virMutexLock(&state->lock);
+        quit = state->quit;
+        virMutexUnlock(&state->lock);
+    }
+}
+
+
+/* Keeps the event loop turning over so it notices state->quit */
+static void
+benchEventTick(int timer ATTRIBUTE_UNUSED,
+               void *opaque ATTRIBUTE_UNUSED)
+{
+}
+
+
+static int
+benchLoadNames(benchStatePtr state)
+{
+    virDomainPtr *doms = NULL;
+    int ndoms;
+    size_t i;
+    int ret = -1;
+
+    if ((ndoms = virConnectListAllDomains(state->conn, &doms,
+                                          VIR_CONNECT_LIST_DOMAINS_ACTIVE)) < 0)
+        return -1;
+
+    if (ndoms == 0) {
+        fprintf(stderr, "no running domains to benchmark against\n");
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(state->names, ndoms) < 0)
+        goto cleanup;
+    state->nnames = ndoms;
+
+    for (i = 0; i < ndoms; i++) {
+        if (VIR_STRDUP(state->names[i], virDomainGetName(doms[i])) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    for (i = 0; i < ndoms; i++)
+        virDomainFree(doms[i]);
+    VIR_FREE(doms);
+    return ret;
+}
+
+
+static void
+benchUsage(const char *argv0)
+{
+    size_t i;
+
+    fprintf(stderr,
+            "Usage: %s [OPTIONS] [WORKLOAD...]\n\n"
+            "  -c, --uri URI          connect to URI\n"
+            "  -t, --threads N        client threads per workload (4)\n"
+            "  -n, --iterations N     operations per thread\n"
+            "  -e, --callbacks N      event callbacks to fan out to (8)\n"
+            "  -h, --help             show this message\n\n"
+            "Workloads:\n", argv0);
+    for (i = 0; i < ARRAY_CARDINALITY(workloads); i++)
+        fprintf(stderr, "  %-18s %zu iterations by default\n",
+                workloads[i].name, workloads[i].iterations);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    struct option opts[] = {
+        { "uri", required_argument, NULL, 'c' },
+        { "threads", required_argument, NULL, 't' },
+        { "iterations", required_argument, NULL, 'n' },
+        { "callbacks", required_argument, NULL, 'e' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    benchState state;
+    virThread loop;
+    bool haveLoop = false;
+    char *uri = NULL;
+    unsigned int nthreads = 4;
+    unsigned int iterations = 0;
+    unsigned int callbacks = 8;
+    unsigned long libVersion = 0;
+    int timer = -1;
+    size_t i;
+    int c, j;
+    int ret = EXIT_FAILURE;
+
+    memset(&state, 0, sizeof(state));
+
+    while ((c = getopt_long(argc, argv, "c:t:n:e:h", opts, NULL)) != -1) {
+        switch (c) {
+        case 'c':
+            VIR_FREE(uri);
+            if (VIR_STRDUP(uri, optarg) < 0)
+                goto cleanup;
+            break;
+        case 't':
+            if (virStrToLong_ui(optarg, NULL, 10, &nthreads) < 0 ||
+                nthreads == 0) {
+                fprintf(stderr, "invalid thread count '%s'\n", optarg);
+                goto cleanup;
+            }
+            break;
+        case 'n':
+            if (virStrToLong_ui(optarg, NULL, 10, &iterations) < 0 ||
+                iterations == 0) {
+                fprintf(stderr, "invalid iteration count '%s'\n", optarg);
+                goto cleanup;
+            }
+            break;
+        case 'e':
+            if (virStrToLong_ui(optarg, NULL, 10, &callbacks) < 0 ||
+                callbacks == 0) {
+                fprintf(stderr, "invalid callback count '%s'\n", optarg);
+                goto cleanup;
+            }
+            break;
+        case 'h':
+            benchUsage(argv[0]);
+            ret = EXIT_SUCCESS;
+            goto cleanup;
+        default:
+            benchUsage(argv[0]);
+            goto cleanup;
+        }
+    }
+
+    for (j = optind; j < argc; j++) {
+        for (i = 0; i < ARRAY_CARDINALITY(workloads); i++) {
+            if (STREQ(argv[j], workloads[i].name))
+                break;
+        }
+        if (i == ARRAY_CARDINALITY(workloads)) {
+            fprintf(stderr, "unknown workload '%s'\n", argv[j]);
+            benchUsage(argv[0]);
+            goto cleanup;
+        }
+    }
+
+    if (!uri &&
+        virAsprintf(&uri, "test://%s/../examples/xml/test/testnodescale.xml",
+                    abs_srcdir) < 0)
+        goto cleanup;
+
+    if (virMutexInit(&state.lock) < 0 ||
+        virCondInit(&state.cond) < 0) {
+        fprintf(stderr, "unable to initialize locks\n");
+        goto cleanup;
+    }
+
+    if (virEventRegisterDefaultImpl() < 0 ||
+        (timer = virEventAddTimeout(100, benchEventTick, NULL, NULL)) < 0 ||
+        virThreadCreate(&loop, true, benchEventLoop, &state) < 0) {
+        fprintf(stderr, "unable to start event loop\n");
+        goto cleanup;
+    }
+    haveLoop = true;
+
+    if (!(state.conn = virConnectOpen(uri)) ||
+        virConnectGetLibVersion(state.conn, &libVersion) < 0 ||
+        benchLoadNames(&state) < 0) {
+        fprintf(stderr, "unable to set up '%s': %s\n",
+                uri, virGetLastErrorMessage());
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(state.callbackIDs, callbacks) < 0)
+        goto cleanup;
+    for (i = 0; i < callbacks; i++) {
+        state.callbackIDs[i] =
+            virConnectDomainEventRegisterAny(state.conn, NULL,
+                                             VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                             VIR_DOMAIN_EVENT_CALLBACK(benchLifecycleEvent),
+                                             &state, NULL);
+        if (state.callbackIDs[i] < 0) {
+            fprintf(stderr, "unable to register event callback: %s\n",
+                    virGetLastErrorMessage());
+            goto cleanup;
+        }
+        state.callbacks++;
+    }
+
+    ret = EXIT_SUCCESS;
+    for (i = 0; i < ARRAY_CARDINALITY(workloads); i++) {
+        if (optind < argc) {
+            for (j = optind; j < argc; j++) {
+                if (STREQ(argv[j], workloads[i].name))
+                    break;
+            }
+            if (j == argc)
+                continue;
+        }
+
+        if (benchRun(&state, &workloads[i], nthreads,
+                     iterations, libVersion) < 0)
+            ret = EXIT_FAILURE;
+    }
+
+ cleanup:
+    if (state.conn) {
+        for (i = 0; i < state.callbacks; i++)
+            virConnectDomainEventDeregisterAny(state.conn,
+                                               state.callbackIDs[i]);
+        virConnectClose(state.conn);
+    }
+    if (haveLoop) {
+        virMutexLock(&state.lock);
+        state.quit = true;
+        virMutexUnlock(&state.lock);
+        virThreadJoin(&loop);
+    }
+    if (timer >= 0)
+        virEventRemoveTimeout(timer);
+    for (i = 0; i < state.nnames; i++)
+        VIR_FREE(state.names[i]);
+    VIR_FREE(state.names);
+    VIR_FREE(state.callbackIDs);
+    VIR_FREE(uri);
+    return ret;
+}
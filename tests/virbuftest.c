@@ -9,6 +9,7 @@
 #include "virbuffer.h"
 #include "viralloc.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -199,6 +200,194 @@ static int testBufTrim(const void *data ATTRIBUTE_UNUSED)
     return ret;
 }
 
+struct testEscapeStringData {
+    const char *format;
+    const char *str;
+    const char *expected;
+};
+
+static int testBufEscapeString(const void *data ATTRIBUTE_UNUSED)
+{
+    static const struct testEscapeStringData tests[] = {
+        { "%s", "", "" },
+        { "<a>%s</a>\n", "plain text that spans words",
+          "<a>plain text that spans words</a>\n" },
+        { "<a>%s</a>\n", "<&>'\"", "<a>&lt;&amp;&gt;&apos;&quot;</a>\n" },
+        { "%s", "tail&", "tail&amp;" },
+        { "%s", "a long string with one <char> near the end",
+          "a long string with one &lt;char&gt; near the end" },
+        /* Control characters only go when something else is escaped */
+        { "%s", "bell\x07", "bell\x07" },
+        { "%s", "bell\x07&\ttab\r\n", "bell&amp;\ttab\r\n" },
+        { "%s", "\x01\x02\x03\x04\x05\x06\x07\x08\x0b\x0c\x0e&", "&amp;" },
+        { "\xc3\xa9%s", "\xc3\xa9 & \xe2\x82\xac",
+          "\xc3\xa9\xc3\xa9 &amp; \xe2\x82\xac" },
+        /* Formats that need printf */
+        { "100%% %s\n", "<sure>", "100% &lt;sure&gt;\n" },
+        { "%5s|", "&", "&amp;|" },
+        { "%-6s|", "ab", "ab    |" },
+    };
+    virBuffer bufinit = VIR_BUFFER_INITIALIZER;
+    virBufferPtr buf = &bufinit;
+    char *result = NULL;
+    size_t i;
+    int ret = 0;
+
+    for (i = 0; i < ARRAY_CARDINALITY(tests); i++) {
+        virBufferEscapeString(buf, tests[i].format, tests[i].str);
+        result = virBufferContentAndReset(buf);
+        if (!result || STRNEQ(result, tests[i].expected)) {
+            virtTestDifference(stderr, tests[i].expected, result);
+            ret = -1;
+        }
+        VIR_FREE(result);
+    }
+
+    /* Indentation is applied once, like with virBufferAsprintf */
+    virBufferAdjustIndent(buf, 2);
+    virBufferEscapeString(buf, "<a>%s</a>\n", "x\ny");
+    virBufferEscapeString(buf, "<b>%s", "&\n");
+    virBufferEscapeString(buf, "%s</b>\n", "z");
+    virBufferEscapeString(buf, "<c>%s</c>\n", NULL);
+    result = virBufferContentAndReset(buf);
+    if (!result ||
+        STRNEQ(result, "  <a>x\ny</a>\n  <b>&amp;\n  z</b>\n")) {
+        virtTestDifference(stderr, "  <a>x\ny</a>\n  <b>&amp;\n  z</b>\n",
+                           result);
+        ret = -1;
+    }
+    VIR_FREE(result);
+
+    return ret;
+}
+
+
+/* The byte by byte escaping virBufferEscapeString used to do */
+static char *
+testBufEscapeReference(const char *str)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    const char *cur;
+
+    if (strcspn(str, "<>&'\"") == strlen(str)) {
+        virBufferAdd(&buf, str, -1);
+        goto done;
+    }
+
+    for (cur = str; *cur; cur++) {
+        if (*cur == '<')
+            virBufferAddLit(&buf, "&lt;");
+        else if (*cur == '>')
+            virBufferAddLit(&buf, "&gt;");
+        else if (*cur == '&')
+            virBufferAddLit(&buf, "&amp;");
+        else if (*cur == '"')
+            virBufferAddLit(&buf, "&quot;");
+        else if (*cur == '\'')
+            virBufferAddLit(&buf, "&apos;");
+        else if ((unsigned char)*cur >= 0x20 || *cur == '\n' ||
+                 *cur == '\t' || *cur == '\r')
+            virBufferAddChar(&buf, *cur);
+    }
+
+ done:
+    virBufferAddLit(&buf, "");
+    return virBufferContentAndReset(&buf);
+}
+
+static int testBufEscapeStringRandom(const void *data ATTRIBUTE_UNUSED)
+{
+    /* Mostly plain bytes, so that whole words get skipped too */
+    static const char alphabet[] =
+        "abcdefghijklmnopqrstuvwxyz0123456789 <>&'\"\x01\x1f\x7f\x80\xff\n\t";
+    virBuffer bufinit = VIR_BUFFER_INITIALIZER;
+    virBufferPtr buf = &bufinit;
+    char str[64];
+    char *expected = NULL;
+    char *result = NULL;
+    unsigned int seed = 1;
+    size_t i, j, len;
+    int ret = -1;
+
+    for (i = 0; i < 20000; i++) {
+        len = i % (sizeof(str) - 1);
+        for (j = 0; j < len; j++) {
+            seed = seed * 1103515245 + 12345;
+            /* Make a special character rare in most strings */
+            if (i % 4 && (seed >> 16) % 8)
+                str[j] = alphabet[(seed >> 16) % 36];
+            else
+                str[j] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+        }
+        str[len] = '\0';
+
+        virBufferEscapeString(buf, "%s", str);
+        if (!(result = virBufferContentAndReset(buf)) ||
+            !(expected = testBufEscapeReference(str)))
+            goto cleanup;
+
+        if (STRNEQ(result, expected)) {
+            virtTestDifference(stderr, expected, result);
+            goto cleanup;
+        }
+        VIR_FREE(result);
+        VIR_FREE(expected);
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(result);
+    VIR_FREE(expected);
+    return ret;
+}
+
+
+struct testBenchData {
+    const char *name;
+    const char *str;
+};
+
+/* Not much of a test, but run with VIR_TEST_DEBUG=1 it reports how
+ * long building a large document of escaped strings takes */
+static int testBufEscapeStringBench(const void *data)
+{
+    const struct testBenchData *info = data;
+    virBuffer bufinit = VIR_BUFFER_INITIALIZER;
+    virBufferPtr buf = &bufinit;
+    const size_t iterations = 200000;
+    unsigned long long start, end;
+    char *result = NULL;
+    size_t len;
+    size_t i;
+    int ret = -1;
+
+    if (virTimeMillisNow(&start) < 0)
+        return -1;
+
+    virBufferAdjustIndent(buf, 4);
+    for (i = 0; i < iterations; i++)
+        virBufferEscapeString(buf, "<source file='%s'/>\n", info->str);
+
+    if (virTimeMillisNow(&end) < 0 ||
+        !(result = virBufferContentAndReset(buf)))
+        goto cleanup;
+
+    len = strlen(result);
+    if (len % iterations) {
+        TEST_ERROR("Unexpected document length %zu", len);
+        goto cleanup;
+    }
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%s: %zu strings, %zu bytes in %llu ms\n",
+                info->name, iterations, len, end - start);
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(result);
+    return ret;
+}
+
 
 static int
 mymain(void)
@@ -218,6 +407,25 @@ mymain(void)
     DO_TEST("Auto-indentation", testBufAutoIndent, 0);
     DO_TEST("Trim", testBufTrim, 0);
 
+    if (virtTestRun("Buf: EscapeString", testBufEscapeString, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Buf: EscapeString random",
+                    testBufEscapeStringRandom, NULL) < 0)
+        ret = -1;
+
+#define DO_BENCH(msg, str)                                             \
+    do {                                                               \
+        struct testBenchData data = { msg, str };                      \
+        if (virtTestRun("Buf: EscapeString bench " msg,                \
+                        testBufEscapeStringBench, &data) < 0)          \
+            ret = -1;                                                  \
+    } while (0)
+
+    DO_BENCH("plain",
+             "/var/lib/libvirt/images/guest-with-a-rather-long-name.qcow2");
+    DO_BENCH("escaped",
+             "/var/lib/libvirt/images/guest's <disk> & backing.qcow2");
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
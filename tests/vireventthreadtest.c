@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+
+#include "testutils.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virthread.h"
+#include "virtime.h"
+#include "vireventthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.eventthreadtest");
+
+#define TEST_DEBUG(...)                         \
+    do {                                        \
+        if (virTestGetDebug())                  \
+            fprintf(stderr, __VA_ARGS__);       \
+    } while (0)
+
+struct testEventThreadData {
+    virMutex lock;
+    virCond cond;
+    virEventThreadPtr thr;
+    int fds[2];
+    size_t called;
+    size_t freed;
+    bool removeSelf;
+    virEventThreadPtr cycle;    /* reference dropped by the free callback */
+};
+
+
+static void
+testEventThreadCallback(int watch,
+                        int fd,
+                        int events ATTRIBUTE_UNUSED,
+                        void *opaque)
+{
+    struct testEventThreadData *data = opaque;
+    char c;
+
+    ignore_value(read(fd, &c, 1));
+
+    if (data->removeSelf)
+        virEventThreadRemoveHandle(data->thr, watch);
+
+    virMutexLock(&data->lock);
+    data->called++;
+    virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+static void
+testEventThreadFree(void *opaque)
+{
+    struct testEventThreadData *data = opaque;
+
+    virObjectUnref(data->cycle);
+
+    virMutexLock(&data->lock);
+    data->cycle = NULL;
+    data->freed++;
+    virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+/* Waits up to five seconds for *counter to reach @want.
+ * Must be called with data->lock held. */
+static int
+testEventThreadWait(struct testEventThreadData *data,
+                    size_t *counter,
+                    size_t want)
+{
+    unsigned long long deadline;
+
+    if (virTimeMillisNow(&deadline) < 0)
+        return -1;
+    deadline += 5 * 1000;
+
+    while (*counter < want) {
+        if (virCondWaitUntil(&data->cond, &data->lock, deadline) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testEventThreadSetup(struct testEventThreadData *data,
+                     bool removeSelf)
+{
+    memset(data, 0, sizeof(*data));
+    data->fds[0] = data->fds[1] = -1;
+    data->removeSelf = removeSelf;
+
+    if (virMutexInit(&data->lock) < 0)
+        return -1;
+    if (virCondInit(&data->cond) < 0) {
+        virMutexDestroy(&data->lock);
+        return -1;
+    }
+
+    if (pipe(data->fds) < 0 ||
+        !(data->thr = virEventThreadNew("test")))
+        return -1;
+
+    return 0;
+}
+
+
+static void
+testEventThreadTeardown(struct testEventThreadData *data)
+{
+    if (data->thr) {
+        virEventThreadStop(data->thr);
+        virObjectUnref(data->thr);
+    }
+    VIR_FORCE_CLOSE(data->fds[0]);
+    VIR_FORCE_CLOSE(data->fds[1]);
+    virCondDestroy(&data->cond);
+    virMutexDestroy(&data->lock);
+}
+
+
+static int
+testEventThreadDispatch(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testEventThreadData data;
+    virEventThreadStats stats;
+    size_t i;
+    int ret = -1;
+
+    if (testEventThreadSetup(&data, false) < 0)
+        goto cleanup;
+
+    if (virEventThreadAddHandle(data.thr, data.fds[0],
+                                VIR_EVENT_HANDLE_READABLE,
+                                testEventThreadCallback, &data, NULL) < 0)
+        goto cleanup;
+
+    for (i = 1; i <= 3; i++) {
+        if (safewrite(data.fds[1], "x", 1) != 1)
+            goto cleanup;
+
+        virMutexLock(&data.lock);
+        if (testEventThreadWait(&data, &data.called, i) < 0) {
+            virMutexUnlock(&data.lock);
+            TEST_DEBUG("callback %zu did not run\n", i);
+            goto cleanup;
+        }
+        virMutexUnlock(&data.lock);
+    }
+
+    /* The counters are only updated once the callback returned */
+    for (i = 0; i < 5000; i++) {
+        virEventThreadGetStats(data.thr, &stats);
+        if (stats.dispatches >= 3)
+            break;
+        usleep(1000);
+    }
+
+    if (stats.handles != 1 ||
+        stats.dispatches < 3 ||
+        stats.wakeups < 3 ||
+        stats.readyMax != 1) {
+        TEST_DEBUG("unexpected stats handles=%zu dispatches=%llu "
+                   "wakeups=%llu readyMax=%zu\n",
+                   stats.handles, stats.dispatches,
+                   stats.wakeups, stats.readyMax);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    testEventThreadTeardown(&data);
+    return ret;
+}
+
+
+static int
+testEventThreadRemoveSelf(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testEventThreadData data;
+    int watch;
+    int ret = -1;
+
+    if (testEventThreadSetup(&data, true) < 0)
+        goto cleanup;
+
+    if ((watch = virEventThreadAddHandle(data.thr, data.fds[0],
+                                         VIR_EVENT_HANDLE_READABLE,
+                                         testEventThreadCallback, &data,
+                                         testEventThreadFree)) < 0)
+        goto cleanup;
+
+    if (safewrite(data.fds[1], "xx", 2) != 2)
+        goto cleanup;
+
+    virMutexLock(&data.lock);
+    if (testEventThreadWait(&data, &data.freed, 1) < 0) {
+        virMutexUnlock(&data.lock);
+        TEST_DEBUG("handle was not freed\n");
+        goto cleanup;
+    }
+
+    /* The second byte must not be dispatched anymore */
+    if (data.called != 1 || data.freed != 1) {
+        TEST_DEBUG("called=%zu freed=%zu\n", data.called, data.freed);
+        virMutexUnlock(&data.lock);
+        goto cleanup;
+    }
+    virMutexUnlock(&data.lock);
+
+    if (virEventThreadRemoveHandle(data.thr, watch) != -1)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    testEventThreadTeardown(&data);
+    return ret;
+}
+
+
+static int
+testEventThreadStop(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testEventThreadData data;
+    int ret = -1;
+
+    if (testEventThreadSetup(&data, false) < 0)
+        goto cleanup;
+
+    if (virEventThreadAddHandle(data.thr, data.fds[0],
+                                VIR_EVENT_HANDLE_READABLE,
+                                testEventThreadCallback, &data,
+                                testEventThreadFree) < 0)
+        goto cleanup;
+
+    virEventThreadStop(data.thr);
+
+    if (virEventThreadAddHandle(data.thr, data.fds[0],
+                                VIR_EVENT_HANDLE_READABLE,
+                                testEventThreadCallback, &data,
+                                NULL) != -1) {
+        TEST_DEBUG("handle added to stopped loop\n");
+        goto cleanup;
+    }
+    virResetLastError();
+
+    /* Handles still registered are released by the exiting
+     * loop thread */
+    virObjectUnref(data.thr);
+    data.thr = NULL;
+
+    virMutexLock(&data.lock);
+    if (testEventThreadWait(&data, &data.freed, 1) < 0) {
+        virMutexUnlock(&data.lock);
+        TEST_DEBUG("handle was not freed\n");
+        goto cleanup;
+    }
+    ret = data.called == 0 ? 0 : -1;
+    virMutexUnlock(&data.lock);
+
+ cleanup:
+    testEventThreadTeardown(&data);
+    return ret;
+}
+
+
+/* Like a monitor, the handle's opaque data holds a reference on the
+ * loop serving it, which must not keep either of them alive */
+static int
+testEventThreadStopCycle(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testEventThreadData data;
+    int ret = -1;
+
+    if (testEventThreadSetup(&data, false) < 0)
+        goto cleanup;
+
+    data.cycle = virObjectRef(data.thr);
+    if (virEventThreadAddHandle(data.thr, data.fds[0],
+                                VIR_EVENT_HANDLE_READABLE,
+                                testEventThreadCallback, &data,
+                                testEventThreadFree) < 0) {
+        virObjectUnref(data.cycle);
+        goto cleanup;
+    }
+
+    virEventThreadStop(data.thr);
+    virObjectUnref(data.thr);
+    data.thr = NULL;
+
+    virMutexLock(&data.lock);
+    if (testEventThreadWait(&data, &data.freed, 1) < 0) {
+        virMutexUnlock(&data.lock);
+        TEST_DEBUG("handle was not freed\n");
+        goto cleanup;
+    }
+    virMutexUnlock(&data.lock);
+
+    ret = 0;
+ cleanup:
+    testEventThreadTeardown(&data);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Dispatch", testEventThreadDispatch, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Remove from callback", testEventThreadRemoveSelf,
+                    NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Stop", testEventThreadStop, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Stop with reference cycle", testEventThreadStopCycle,
+                    NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
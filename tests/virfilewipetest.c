@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "testutils.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virfilewipe.h"
+#include "virlog.h"
+#include "virstring.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.filewipetest");
+
+#define SCRATCHDIRTEMPLATE abs_builddir "/virfilewipedata-XXXXXX"
+
+#define MiB (1024 * 1024)
+
+/* A sparse file with data extents far enough apart to be handed
+ * to different worker threads */
+#define TEST_FILE_SIZE (200 * MiB)
+
+static const off_t testExtents[] = { 0, 70 * MiB, 140 * MiB + 123 };
+#define TEST_EXTENT_SIZE (MiB + 17)
+
+static char *scratchdir;
+
+
+static int
+testCreateFile(const char *name,
+               char **path,
+               int *fd)
+{
+    char *buf = NULL;
+    size_t i;
+    int ret = -1;
+
+    *fd = -1;
+
+    if (virAsprintf(path, "%s/%s", scratchdir, name) < 0)
+        goto cleanup;
+
+    if ((*fd = open(*path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0) {
+        fprintf(stderr, "Cannot create %s\n", *path);
+        goto cleanup;
+    }
+
+    if (ftruncate(*fd, TEST_FILE_SIZE) < 0 ||
+        VIR_ALLOC_N(buf, TEST_EXTENT_SIZE) < 0)
+        goto cleanup;
+
+    memset(buf, 'x', TEST_EXTENT_SIZE);
+
+    for (i = 0; i < ARRAY_CARDINALITY(testExtents); i++) {
+        if (pwrite(*fd, buf, TEST_EXTENT_SIZE,
+                   testExtents[i]) != TEST_EXTENT_SIZE) {
+            fprintf(stderr, "Cannot write %s\n", *path);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
+
+/* Check that [offset, offset + length) reads back as zeroes
+ * and that the data outside of it was left alone */
+static int
+testCheckFile(int fd,
+              off_t offset,
+              off_t length)
+{
+    char *buf = NULL;
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, TEST_EXTENT_SIZE) < 0)
+        return -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(testExtents); i++) {
+        if (pread(fd, buf, TEST_EXTENT_SIZE,
+                  testExtents[i]) != TEST_EXTENT_SIZE)
+            goto cleanup;
+
+        for (j = 0; j < TEST_EXTENT_SIZE; j++) {
+            off_t pos = testExtents[i] + j;
+            char expect = pos >= offset && pos < offset + length ? 0 : 'x';
+
+            if (buf[j] != expect) {
+                fprintf(stderr, "Expected %d at offset %llu, got %d\n",
+                        expect, (unsigned long long) pos, buf[j]);
+                goto cleanup;
+            }
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
+
+static int
+testCheckStats(virFileWipeStatsPtr stats,
+               off_t length,
+               bool offload)
+{
+    unsigned long long total = stats->skipped + stats->discarded +
+        stats->zeroed + stats->written;
+
+    if (total != length) {
+        fprintf(stderr, "Expected %llu bytes to be accounted for, got %llu\n",
+                (unsigned long long) length, total);
+        return -1;
+    }
+
+    if (!offload && (stats->discarded || stats->zeroed)) {
+        fprintf(stderr, "Expected plain writes only\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+testProgress(unsigned long long done,
+             unsigned long long total,
+             void *opaque)
+{
+    unsigned long long *last = opaque;
+
+    if (done > total || done < *last)
+        *last = ULLONG_MAX;
+    else
+        *last = done;
+}
+
+
+struct testWipeData {
+    const char *name;
+    off_t offset;
+    off_t length;
+    unsigned int workers;
+    unsigned int flags;
+};
+
+
+static int
+testWipe(const void *opaque)
+{
+    const struct testWipeData *data = opaque;
+    virFileWipeParams params;
+    virFileWipeStats stats;
+    unsigned long long progress = 0;
+    char *path = NULL;
+    struct stat before;
+    struct stat after;
+    int fd = -1;
+    int ret = -1;
+
+    memset(&params, 0, sizeof(params));
+    params.workers = data->workers;
+    params.bufsize = 64 * 1024;
+    params.progress = testProgress;
+    params.opaque = &progress;
+
+    if (testCreateFile(data->name, &path, &fd) < 0 ||
+        fstat(fd, &before) < 0)
+        goto cleanup;
+
+    if (virFileWipeZero(fd, path, data->offset, data->length,
+                        &params, &stats, data->flags) < 0)
+        goto cleanup;
+
+    if (testCheckFile(fd, data->offset, data->length) < 0 ||
+        testCheckStats(&stats, data->length,
+                       !(data->flags & VIR_FILE_WIPE_NO_OFFLOAD)) < 0)
+        goto cleanup;
+
+    if (progress != data->length) {
+        fprintf(stderr, "Expected final progress %llu, got %llu\n",
+                (unsigned long long) data->length, progress);
+        goto cleanup;
+    }
+
+    if (fstat(fd, &after) < 0)
+        goto cleanup;
+
+    if (after.st_size != before.st_size ||
+        ((data->flags & VIR_FILE_WIPE_KEEP_ALLOCATION) &&
+         after.st_blocks < before.st_blocks)) {
+        fprintf(stderr, "Unexpected size/allocation change from %llu/%llu "
+                "to %llu/%llu\n",
+                (unsigned long long) before.st_size,
+                (unsigned long long) before.st_blocks,
+                (unsigned long long) after.st_size,
+                (unsigned long long) after.st_blocks);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+testWipeThrottle(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virFileWipeParams params;
+    unsigned long long start;
+    unsigned long long end;
+    char *path = NULL;
+    int fd = -1;
+    int ret = -1;
+
+    /* The first data extent at 2 MiB/s in 5 requests, the last of
+     * which must not be issued earlier than half a second in */
+    memset(&params, 0, sizeof(params));
+    params.workers = 4;
+    params.bufsize = 256 * 1024;
+    params.bandwidth = 2 * MiB;
+
+    if (testCreateFile("throttle", &path, &fd) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&start) < 0 ||
+        virFileWipeZero(fd, path, 0, TEST_EXTENT_SIZE, &params, NULL,
+                        VIR_FILE_WIPE_NO_OFFLOAD) < 0 ||
+        virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    if (end - start < 500) {
+        fprintf(stderr, "Wipe took %llu ms, expected at least 500 ms\n",
+                end - start);
+        goto cleanup;
+    }
+
+    if (testCheckFile(fd, 0, TEST_EXTENT_SIZE) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    char dir[] = SCRATCHDIRTEMPLATE;
+    int ret = 0;
+
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "Cannot create scratch directory");
+        return EXIT_FAILURE;
+    }
+    scratchdir = dir;
+
+#define DO_TEST(name, offset, length, workers, flags)                   \
+    do {                                                                \
+        struct testWipeData data = {                                    \
+            name, offset, length, workers, flags,                       \
+        };                                                              \
+        if (virtTestRun("Wipe " name, testWipe, &data) < 0)             \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("whole", 0, TEST_FILE_SIZE, 0, 0);
+    DO_TEST("whole-keep", 0, TEST_FILE_SIZE, 0,
+            VIR_FILE_WIPE_KEEP_ALLOCATION);
+    DO_TEST("whole-write", 0, TEST_FILE_SIZE, 0,
+            VIR_FILE_WIPE_NO_OFFLOAD);
+    DO_TEST("single", 0, TEST_FILE_SIZE, 1, 0);
+    DO_TEST("unaligned", 511, 140 * MiB + 1000, 3, 0);
+    DO_TEST("unaligned-keep", 511, 140 * MiB + 1000, 3,
+            VIR_FILE_WIPE_KEEP_ALLOCATION);
+    DO_TEST("unaligned-write", 511, 140 * MiB + 1000, 3,
+            VIR_FILE_WIPE_NO_OFFLOAD);
+    DO_TEST("empty", 4 * MiB, 60 * MiB, 2, 0);
+
+    if (virtTestRun("Wipe throttle", testWipeThrottle, NULL) < 0)
+        ret = -1;
+
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(dir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "testutils.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virfilewriter.h"
+#include "virlog.h"
+#include "virobject.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.filewritertest");
+
+#define SCRATCHDIRTEMPLATE abs_builddir "/virfilewriterdata-XXXXXX"
+
+/* Long enough for the worker thread never to kick in on its own */
+#define TEST_DELAY_NEVER (3600 * 1000)
+
+static char *scratchdir;
+
+
+static int
+testRewriteString(int fd, void *opaque)
+{
+    const char *str = opaque;
+    size_t len = strlen(str);
+
+    if (safewrite(fd, str, len) != len)
+        return -1;
+
+    return 0;
+}
+
+
+static void
+testFreeString(void *opaque)
+{
+    char *str = opaque;
+
+    VIR_FREE(str);
+}
+
+
+static int
+testQueueString(virFileWriterPtr writer,
+                const char *path,
+                const char *str)
+{
+    char *copy;
+
+    if (VIR_STRDUP(copy, str) < 0)
+        return -1;
+
+    return virFileWriterQueue(writer, path, S_IRUSR | S_IWUSR,
+                              testRewriteString, copy, testFreeString);
+}
+
+
+static int
+testCheckFile(const char *path,
+              const char *expect)
+{
+    char *actual = NULL;
+    int ret = -1;
+
+    if (!expect) {
+        if (virFileExists(path)) {
+            fprintf(stderr, "File %s should not exist\n", path);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (virFileReadAll(path, 1024, &actual) < 0)
+        return -1;
+
+    if (STRNEQ(actual, expect)) {
+        virtTestDifference(stderr, expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(actual);
+    return ret;
+}
+
+
+static int
+testCheckStats(virFileWriterPtr writer,
+               unsigned long long queued,
+               unsigned long long coalesced,
+               unsigned long long written)
+{
+    virFileWriterStats stats;
+
+    virFileWriterGetStats(writer, &stats);
+
+    if (stats.queued != queued ||
+        stats.coalesced != coalesced ||
+        stats.written != written ||
+        stats.failed != 0) {
+        fprintf(stderr,
+                "Expected queued=%llu coalesced=%llu written=%llu failed=0, "
+                "got queued=%llu coalesced=%llu written=%llu failed=%llu\n",
+                queued, coalesced, written,
+                stats.queued, stats.coalesced, stats.written, stats.failed);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testCoalesce(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virFileWriterPtr writer = NULL;
+    char *path = NULL;
+    char *other = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/coalesce.xml", scratchdir) < 0 ||
+        virAsprintf(&other, "%s/other.xml", scratchdir) < 0)
+        goto cleanup;
+
+    if (!(writer = virFileWriterNew(TEST_DELAY_NEVER)))
+        goto cleanup;
+
+    if (testQueueString(writer, path, "first\n") < 0 ||
+        testQueueString(writer, other, "other\n") < 0 ||
+        testQueueString(writer, path, "second\n") < 0 ||
+        testQueueString(writer, path, "third\n") < 0)
+        goto cleanup;
+
+    if (testCheckFile(path, NULL) < 0)
+        goto cleanup;
+
+    if (virFileWriterFlush(writer) < 0)
+        goto cleanup;
+
+    if (testCheckFile(path, "third\n") < 0 ||
+        testCheckFile(other, "other\n") < 0 ||
+        testCheckStats(writer, 4, 2, 2) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(writer);
+    VIR_FREE(path);
+    VIR_FREE(other);
+    return ret;
+}
+
+
+static int
+testRewrite(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virFileWriterPtr writer = NULL;
+    char *path = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/rewrite.xml", scratchdir) < 0)
+        goto cleanup;
+
+    if (!(writer = virFileWriterNew(TEST_DELAY_NEVER)))
+        goto cleanup;
+
+    if (testQueueString(writer, path, "stale\n") < 0)
+        goto cleanup;
+
+    /* The synchronous write must supersede the queued one */
+    if (virFileWriterRewrite(writer, path, S_IRUSR | S_IWUSR,
+                             testRewriteString, (void *) "sync\n") < 0)
+        goto cleanup;
+
+    if (testCheckFile(path, "sync\n") < 0)
+        goto cleanup;
+
+    if (virFileWriterFlush(writer) < 0)
+        goto cleanup;
+
+    if (testCheckFile(path, "sync\n") < 0 ||
+        testCheckStats(writer, 1, 1, 1) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(writer);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+testCancel(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virFileWriterPtr writer = NULL;
+    char *path = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/cancel.xml", scratchdir) < 0)
+        goto cleanup;
+
+    if (!(writer = virFileWriterNew(TEST_DELAY_NEVER)))
+        goto cleanup;
+
+    if (testQueueString(writer, path, "gone\n") < 0)
+        goto cleanup;
+
+    virFileWriterCancel(writer, path);
+    if (virFileWriterFlush(writer) < 0)
+        goto cleanup;
+
+    if (testCheckFile(path, NULL) < 0 ||
+        testCheckStats(writer, 1, 0, 0) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(writer);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+testBackground(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virFileWriterPtr writer = NULL;
+    char *path = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/background.xml", scratchdir) < 0)
+        goto cleanup;
+
+    if (!(writer = virFileWriterNew(10)))
+        goto cleanup;
+
+    if (testQueueString(writer, path, "background\n") < 0)
+        goto cleanup;
+
+    /* Give the worker thread up to 5 seconds */
+    for (i = 0; i < 500 && !virFileExists(path); i++)
+        usleep(10 * 1000);
+
+    if (testCheckFile(path, "background\n") < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(writer);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+testDispose(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virFileWriterPtr writer = NULL;
+    char *path = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/dispose.xml", scratchdir) < 0)
+        goto cleanup;
+
+    if (!(writer = virFileWriterNew(TEST_DELAY_NEVER)))
+        goto cleanup;
+
+    if (testQueueString(writer, path, "pending\n") < 0)
+        goto cleanup;
+
+    /* Pending updates must not be lost when the writer goes away */
+    virObjectUnref(writer);
+    writer = NULL;
+
+    if (testCheckFile(path, "pending\n") < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(writer);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    char dir[] = SCRATCHDIRTEMPLATE;
+    int ret = 0;
+
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "Cannot create scratch directory");
+        return EXIT_FAILURE;
+    }
+    scratchdir = dir;
+
+    if (virtTestRun("Coalesce", testCoalesce, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Rewrite", testRewrite, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Cancel", testCancel, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Background", testBackground, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Dispose", testDispose, NULL) < 0)
+        ret = -1;
+
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(dir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
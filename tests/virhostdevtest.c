@@ -32,6 +32,8 @@
 # include <fcntl.h>
 # include "virlog.h"
 # include "virhostdev.h"
+# include "virstring.h"
+# include "virthread.h"
 
 # define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -410,6 +412,175 @@ testVirHostdevUpdateActivePCIHostdevs(const void *oaque ATTRIBUTE_UNUSED)
     return ret;
 }
 
+/* Devices to reset, in the order they are passed to virHostdev */
+static const char *resetDevs[] = {
+    "0000:00:04.0", "0001:01:00.0", "0000:0b:00.0", "0000:00:06.0",
+    "0000:00:05.0", "0001:01:00.1", "0000:0b:00.1",
+};
+
+/* The sets of devices which have to be reset one after another, as
+ * logged by the mock when their config space is written to.
+ * 0000:00:04.0 and 0000:00:05.0 share an IOMMU group, the others
+ * share a bus. Devices on bus 0b have no PM reset and therefore get
+ * a secondary bus reset through the 0000:00:1c.0 bridge. */
+static const char *resetSets[][5] = {
+    { "0000:00:04.0", "0000:00:05.0", NULL },
+    { "0001:01:00.0", "0001:01:00.1", NULL },
+    { "0000:00:1c.0", "0000:0b:00.0", "0000:00:1c.0", "0000:0b:00.1", NULL },
+    { "0000:00:06.0", NULL },
+};
+
+/*
+ * Check that each set from @resetSets was reset in order by a thread
+ * of its own, which is the calling one for the first set.
+ */
+static int
+testVirHostdevCheckResets(void)
+{
+    char *path = NULL;
+    char *buf = NULL;
+    char **lines = NULL;
+    unsigned long long *tids = NULL;
+    size_t nlines;
+    size_t nresets = 0;
+    size_t i, j, k;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/resets", getenv("LIBVIRT_FAKE_SYSFS_DIR")) < 0 ||
+        virFileReadAll(path, 4096, &buf) < 0 ||
+        !(lines = virStringSplit(buf, "\n", 0)))
+        goto cleanup;
+
+    /* Lines are "<thread> <device>", and the list ends with an empty one */
+    for (nlines = 0; lines[nlines] && *lines[nlines]; nlines++);
+
+    if (VIR_ALLOC_N(tids, nlines) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nlines; i++) {
+        char *id;
+
+        if (virStrToLong_ull(lines[i], &id, 10, &tids[i]) < 0 || *id != ' ') {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "Malformed reset log line '%s'", lines[i]);
+            goto cleanup;
+        }
+        memmove(lines[i], id + 1, strlen(id));
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(resetSets); i++) {
+        unsigned long long tid = 0;
+        size_t nsame = 0;
+
+        for (j = 0, k = 0; resetSets[i][j]; j++, k++) {
+            while (k < nlines && STRNEQ(lines[k], resetSets[i][j]))
+                k++;
+            if (k == nlines || (j > 0 && tids[k] != tid)) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               "%s not reset after %s by the same thread",
+                               resetSets[i][j], resetSets[i][0]);
+                goto cleanup;
+            }
+            tid = tids[k];
+        }
+
+        for (k = 0; k < nlines; k++) {
+            if (tids[k] == tid)
+                nsame++;
+        }
+
+        if (nsame != j) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "Thread resetting %s also reset other devices",
+                           resetSets[i][0]);
+            goto cleanup;
+        }
+
+        if ((i == 0) != (tid == virThreadSelfID())) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "%s reset by an unexpected thread",
+                           resetSets[i][0]);
+            goto cleanup;
+        }
+        nresets += j;
+    }
+
+    if (nlines != nresets) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Expected %zu resets, got %zu", nresets, nlines);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    VIR_FREE(buf);
+    VIR_FREE(tids);
+    virStringFreeList(lines);
+    return ret;
+}
+
+static int
+testVirHostdevResetPCIGroups(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainHostdevDefPtr defs[ARRAY_CARDINALITY(resetDevs)] = { NULL };
+    virPCIDevicePtr devs[ARRAY_CARDINALITY(resetDevs)] = { NULL };
+    size_t ndevs = ARRAY_CARDINALITY(resetDevs);
+    char *path = NULL;
+    size_t i;
+    int ret = -1;
+
+    for (i = 0; i < ndevs; i++) {
+        virDomainHostdevSubsysPCIPtr pcisrc;
+        unsigned int domain, bus, slot, function;
+
+        if (sscanf(resetDevs[i], "%x:%x:%x.%x",
+                   &domain, &bus, &slot, &function) != 4 ||
+            !(defs[i] = virDomainHostdevDefAlloc()) ||
+            !(devs[i] = virPCIDeviceNew(domain, bus, slot, function)) ||
+            virPCIDeviceSetStubDriver(devs[i], "pci-stub") < 0)
+            goto cleanup;
+
+        defs[i]->mode = VIR_DOMAIN_HOSTDEV_MODE_SUBSYS;
+        defs[i]->source.subsys.type = VIR_DOMAIN_HOSTDEV_SUBSYS_TYPE_PCI;
+        pcisrc = &defs[i]->source.subsys.u.pci;
+        pcisrc->addr.domain = domain;
+        pcisrc->addr.bus = bus;
+        pcisrc->addr.slot = slot;
+        pcisrc->addr.function = function;
+        pcisrc->backend = VIR_DOMAIN_HOSTDEV_PCI_BACKEND_KVM;
+
+        if (virHostdevPCINodeDeviceDetach(mgr, devs[i]) < 0)
+            goto cleanup;
+    }
+
+    /* Forget about resets done while detaching */
+    if (virAsprintf(&path, "%s/resets", getenv("LIBVIRT_FAKE_SYSFS_DIR")) < 0)
+        goto cleanup;
+    unlink(path);
+
+    if (virHostdevPreparePCIDevices(mgr, drv_name, dom_name, uuid,
+                                    defs, ndevs, 0) < 0)
+        goto cleanup;
+
+    ret = testVirHostdevCheckResets();
+
+    virHostdevReAttachPCIDevices(mgr, drv_name, dom_name, defs, ndevs, NULL);
+
+ cleanup:
+    for (i = 0; i < ndevs; i++) {
+        if (devs[i])
+            ignore_value(virHostdevPCINodeDeviceReAttach(mgr, devs[i]));
+        virPCIDeviceFree(devs[i]);
+        virDomainHostdevDefFree(defs[i]);
+    }
+    VIR_FREE(path);
+    return ret;
+}
+
 # define FAKESYSFSDIRTEMPLATE abs_builddir "/fakesysfsdir-XXXXXX"
 
 static int
@@ -454,6 +625,7 @@ mymain(void)
         DO_TEST(testVirHostdevReAttachPCIHostdevs_managed);
     }
     DO_TEST(testVirHostdevUpdateActivePCIHostdevs);
+    DO_TEST(testVirHostdevResetPCIGroups);
 
     myCleanup();
 
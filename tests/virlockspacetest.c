@@ -30,6 +30,8 @@
 #include "viralloc.h"
 #include "virfile.h"
 #include "virlog.h"
+#include "virstring.h"
+#include "virtime.h"
 
 #include "virlockspace.h"
 
@@ -338,6 +340,160 @@ static int testLockSpaceResourceLockPath(const void *args ATTRIBUTE_UNUSED)
     return ret;
 }
 
+static int testLockSpaceResourceLockSet(const void *args ATTRIBUTE_UNUSED)
+{
+    virLockSpacePtr lockspace;
+    const char *names[] = { "foo", "bar", "wibble" };
+    const char *dupnames[] = { "foo", "bar", "foo" };
+    unsigned int flags[] = {
+        VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE,
+        VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE,
+        VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE,
+    };
+    int ret = -1;
+
+    rmdir(LOCKSPACE_DIR);
+
+    if (!(lockspace = virLockSpaceNew(LOCKSPACE_DIR)))
+        goto cleanup;
+
+    if (virLockSpaceAcquireResource(lockspace, "bar", geteuid(),
+                                    VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE) < 0)
+        goto cleanup;
+
+    /* One member of the set is busy, so none may be acquired */
+    if (virLockSpaceAcquireResources(lockspace, ARRAY_CARDINALITY(names),
+                                     names, flags, geteuid()) == 0)
+        goto cleanup;
+
+    if (virFileExists(LOCKSPACE_DIR "/foo") ||
+        virFileExists(LOCKSPACE_DIR "/wibble"))
+        goto cleanup;
+
+    if (virLockSpaceReleaseResource(lockspace, "bar", geteuid()) < 0)
+        goto cleanup;
+
+    if (virLockSpaceAcquireResources(lockspace, ARRAY_CARDINALITY(names),
+                                     names, flags, geteuid()) < 0)
+        goto cleanup;
+
+    if (!virFileExists(LOCKSPACE_DIR "/foo") ||
+        !virFileExists(LOCKSPACE_DIR "/bar") ||
+        !virFileExists(LOCKSPACE_DIR "/wibble"))
+        goto cleanup;
+
+    /* Releasing a set with a member we don't own must release nothing */
+    if (virLockSpaceReleaseResources(lockspace, ARRAY_CARDINALITY(names),
+                                     names, geteuid() + 1) == 0)
+        goto cleanup;
+
+    if (!virFileExists(LOCKSPACE_DIR "/foo"))
+        goto cleanup;
+
+    /* Nor may a set naming an exclusive lock twice */
+    if (virLockSpaceReleaseResources(lockspace, ARRAY_CARDINALITY(dupnames),
+                                     dupnames, geteuid()) == 0)
+        goto cleanup;
+
+    if (!virFileExists(LOCKSPACE_DIR "/foo") ||
+        !virFileExists(LOCKSPACE_DIR "/bar"))
+        goto cleanup;
+
+    if (virLockSpaceReleaseResources(lockspace, ARRAY_CARDINALITY(names),
+                                     names, geteuid()) < 0)
+        goto cleanup;
+
+    if (virFileExists(LOCKSPACE_DIR "/foo") ||
+        virFileExists(LOCKSPACE_DIR "/bar") ||
+        virFileExists(LOCKSPACE_DIR "/wibble"))
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virLockSpaceFree(lockspace);
+    rmdir(LOCKSPACE_DIR);
+    return ret;
+}
+
+
+/* Leases taken by a domain with a large number of disks */
+#define BENCH_DISKS 128
+#define BENCH_ROUNDS 20
+
+/*
+ * Compare acquiring and releasing the leases of a many-disk
+ * domain one by one against doing it as a set. Timings are
+ * only reported in verbose mode, never checked.
+ */
+static int testLockSpaceResourceSetBench(const void *args ATTRIBUTE_UNUSED)
+{
+    virLockSpacePtr lockspace;
+    char *names[BENCH_DISKS] = { NULL };
+    unsigned int flags[BENCH_DISKS];
+    unsigned long long t0, t1, t2;
+    unsigned long long single = 0, batch = 0;
+    size_t i, j;
+    int ret = -1;
+
+    rmdir(LOCKSPACE_DIR);
+
+    if (!(lockspace = virLockSpaceNew(LOCKSPACE_DIR)))
+        goto cleanup;
+
+    for (i = 0; i < BENCH_DISKS; i++) {
+        if (virAsprintf(&names[i], "disk%zu", i) < 0)
+            goto cleanup;
+        flags[i] = VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE;
+    }
+
+    for (j = 0; j < BENCH_ROUNDS; j++) {
+        if (virTimeMillisNow(&t0) < 0)
+            goto cleanup;
+
+        for (i = 0; i < BENCH_DISKS; i++) {
+            if (virLockSpaceAcquireResource(lockspace, names[i], geteuid(),
+                                            flags[i]) < 0)
+                goto cleanup;
+        }
+        for (i = 0; i < BENCH_DISKS; i++) {
+            if (virLockSpaceReleaseResource(lockspace, names[i],
+                                            geteuid()) < 0)
+                goto cleanup;
+        }
+
+        if (virTimeMillisNow(&t1) < 0)
+            goto cleanup;
+
+        if (virLockSpaceAcquireResources(lockspace, BENCH_DISKS,
+                                         (const char **)names, flags,
+                                         geteuid()) < 0 ||
+            virLockSpaceReleaseResources(lockspace, BENCH_DISKS,
+                                         (const char **)names,
+                                         geteuid()) < 0)
+            goto cleanup;
+
+        if (virTimeMillisNow(&t2) < 0)
+            goto cleanup;
+
+        single += t1 - t0;
+        batch += t2 - t1;
+    }
+
+    if (virTestGetVerbose())
+        fprintf(stderr, "\n%d disks x %d rounds: single %llums, set %llums\n",
+                BENCH_DISKS, BENCH_ROUNDS, single, batch);
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < BENCH_DISKS; i++)
+        VIR_FREE(names[i]);
+    virLockSpaceFree(lockspace);
+    rmdir(LOCKSPACE_DIR);
+    return ret;
+}
+
 
 
 static int
@@ -368,6 +524,12 @@ mymain(void)
     if (virtTestRun("Lockspace res full path", testLockSpaceResourceLockPath, NULL) < 0)
         ret = -1;
 
+    if (virtTestRun("Lockspace res lock set", testLockSpaceResourceLockSet, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Lockspace res set bench", testLockSpaceResourceSetBench, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
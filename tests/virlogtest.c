@@ -19,9 +19,16 @@
 
 #include <config.h>
 
+#include <sys/wait.h>
+
 #include "testutils.h"
 
 #include "virlog.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.logtest");
 
 struct testLogMatchData {
     const char *str;
@@ -43,6 +50,263 @@ testLogMatch(const void *opaque)
 }
 
 
+#define TEST_ASYNC_THREADS 4
+#define TEST_ASYNC_MESSAGES 500
+
+struct testLogAsyncData {
+    char *msgs[TEST_ASYNC_THREADS * TEST_ASYNC_MESSAGES * 2];
+    size_t nmsgs;
+    size_t nerrors;
+    size_t ndropped;
+};
+
+
+/* Called with the log lock held, so no further locking is needed */
+static void
+testLogAsyncOutput(virLogSourcePtr src ATTRIBUTE_UNUSED,
+                   virLogPriority priority,
+                   const char *filename ATTRIBUTE_UNUSED,
+                   int linenr ATTRIBUTE_UNUSED,
+                   const char *funcname ATTRIBUTE_UNUSED,
+                   const char *timestamp ATTRIBUTE_UNUSED,
+                   virLogMetadataPtr metadata ATTRIBUTE_UNUSED,
+                   unsigned int flags ATTRIBUTE_UNUSED,
+                   const char *rawstr,
+                   const char *str ATTRIBUTE_UNUSED,
+                   void *opaque)
+{
+    struct testLogAsyncData *data = opaque;
+
+    if (STRPREFIX(rawstr, "libvirt version:"))
+        return;
+
+    if (strstr(rawstr, "log messages were dropped")) {
+        data->ndropped++;
+        return;
+    }
+
+    if (priority == VIR_LOG_ERROR)
+        data->nerrors++;
+
+    if (data->nmsgs < ARRAY_CARDINALITY(data->msgs))
+        ignore_value(VIR_STRDUP_QUIET(data->msgs[data->nmsgs++], rawstr));
+}
+
+
+static int
+testLogAsyncSetup(struct testLogAsyncData *data,
+                  size_t maxBytes)
+{
+    memset(data, 0, sizeof(*data));
+
+    if (virLogReset() < 0 ||
+        virLogDefineOutput(testLogAsyncOutput, NULL, data, VIR_LOG_DEBUG,
+                           VIR_LOG_TO_STDERR, NULL, 0) < 0)
+        return -1;
+    virLogSetDefaultPriority(VIR_LOG_DEBUG);
+
+    return virLogSetAsync(maxBytes);
+}
+
+
+static void
+testLogAsyncTeardown(struct testLogAsyncData *data)
+{
+    size_t i;
+
+    virLogReset();
+    for (i = 0; i < data->nmsgs; i++)
+        VIR_FREE(data->msgs[i]);
+}
+
+
+static void
+testLogAsyncWorker(void *opaque)
+{
+    size_t id = (size_t) opaque;
+    size_t i;
+
+    for (i = 0; i < TEST_ASYNC_MESSAGES; i++)
+        VIR_INFO("thread %zu message %zu", id, i);
+}
+
+
+static int
+testLogAsyncOrder(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testLogAsyncData data;
+    virThread threads[TEST_ASYNC_THREADS];
+    size_t next[TEST_ASYNC_THREADS] = { 0 };
+    size_t i;
+    int ret = -1;
+
+    if (testLogAsyncSetup(&data, 1024 * 1024) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_ASYNC_THREADS; i++) {
+        if (virThreadCreate(&threads[i], true,
+                            testLogAsyncWorker, (void *) i) < 0)
+            goto cleanup;
+    }
+    for (i = 0; i < TEST_ASYNC_THREADS; i++)
+        virThreadJoin(&threads[i]);
+
+    virLogFlush();
+
+    /* Messages of each thread must come out in the order they
+     * were logged */
+    virLogLock();
+    for (i = 0; i < data.nmsgs; i++) {
+        size_t id, nr;
+
+        if (sscanf(data.msgs[i], "thread %zu message %zu", &id, &nr) != 2 ||
+            id >= TEST_ASYNC_THREADS || nr != next[id]) {
+            virLogUnlock();
+            fprintf(stderr, "unexpected message '%s'\n", data.msgs[i]);
+            goto cleanup;
+        }
+        next[id]++;
+    }
+    virLogUnlock();
+
+    if (data.nmsgs != TEST_ASYNC_THREADS * TEST_ASYNC_MESSAGES ||
+        data.ndropped != 0) {
+        fprintf(stderr, "got %zu messages, %zu drop reports\n",
+                data.nmsgs, data.ndropped);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    testLogAsyncTeardown(&data);
+    return ret;
+}
+
+
+static int
+testLogAsyncDrop(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testLogAsyncData data;
+    size_t i;
+    int ret = -1;
+
+    /* Room for a handful of messages only */
+    if (testLogAsyncSetup(&data, 64) < 0)
+        goto cleanup;
+
+    /* Keep the writer from draining the queue meanwhile, the first
+     * message makes sure our filters are up to date, which needs the
+     * lock too */
+    VIR_INFO("thread 0 message 0");
+    virLogLock();
+    for (i = 1; i < TEST_ASYNC_MESSAGES; i++)
+        VIR_INFO("thread 0 message %zu", i);
+    virLogUnlock();
+
+    /* Stopping writes out everything still queued */
+    if (virLogSetAsync(0) < 0)
+        goto cleanup;
+
+    if (data.nmsgs == 0 || data.nmsgs >= TEST_ASYNC_MESSAGES ||
+        data.ndropped == 0) {
+        fprintf(stderr, "got %zu messages, %zu drop reports\n",
+                data.nmsgs, data.ndropped);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    testLogAsyncTeardown(&data);
+    return ret;
+}
+
+
+static int
+testLogAsyncError(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testLogAsyncData data;
+    int ret = -1;
+
+    if (testLogAsyncSetup(&data, 1024 * 1024) < 0)
+        goto cleanup;
+
+    VIR_INFO("thread 0 message 0");
+    VIR_ERROR("thread 0 message 1");
+
+    /* Errors are written right away, after what was queued before */
+    virLogLock();
+    if (data.nmsgs != 2 || data.nerrors != 1 ||
+        STRNEQ(data.msgs[1], "thread 0 message 1")) {
+        fprintf(stderr, "got %zu messages, %zu errors\n",
+                data.nmsgs, data.nerrors);
+        virLogUnlock();
+        goto cleanup;
+    }
+    virLogUnlock();
+
+    ret = 0;
+ cleanup:
+    testLogAsyncTeardown(&data);
+    return ret;
+}
+
+
+/* A child process logs synchronously, even when asked for
+ * asynchronous logging by the environment before it exec()s */
+static int
+testLogAsyncFork(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testLogAsyncData data;
+    pid_t pid;
+    int status;
+    int ret = -1;
+
+    if (testLogAsyncSetup(&data, 1024 * 1024) < 0)
+        goto cleanup;
+
+    if (virLogGetAsync() != 1024 * 1024) {
+        fprintf(stderr, "unexpected buffer size %zu\n", virLogGetAsync());
+        goto cleanup;
+    }
+
+    /* Like virFork, so that the child doesn't inherit a held lock */
+    virLogLock();
+    pid = fork();
+    virLogUnlock();
+
+    if (pid < 0)
+        goto cleanup;
+
+    if (pid == 0) {
+        size_t nmsgs = data.nmsgs;
+
+        if (virLogGetAsync() != 0 ||
+            setenv("LIBVIRT_LOG_ASYNC", "1024", 1) < 0)
+            _exit(EXIT_FAILURE);
+        virLogSetFromEnv();
+
+        /* Nobody would write out a queued message */
+        VIR_INFO("thread 0 message 0");
+        _exit(virLogGetAsync() == 0 && data.nmsgs == nmsgs + 1 ?
+              EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (waitpid(pid, &status, 0) != pid ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        fprintf(stderr, "child did not log synchronously\n");
+        goto cleanup;
+    }
+
+    if (virLogSetAsync(0) < 0 || virLogGetAsync() != 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    testLogAsyncTeardown(&data);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -61,6 +325,15 @@ mymain(void)
 
     TEST_LOG_MATCH("libvirt:  error : cannot execute binary /usr/libexec/libvirt_lxc: No such file or directory", false);
 
+    if (virtTestRun("Async ordering", testLogAsyncOrder, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Async drops", testLogAsyncDrop, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Async errors", testLogAsyncError, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Async fork", testLogAsyncFork, NULL) < 0)
+        ret = -1;
+
     return ret;
 }
 
@@ -29,6 +29,7 @@
 #include "virlog.h"
 #include "virstring.h"
 #include "rpc/virnetmessage.h"
+#include "rpc/virnetxdr.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
@@ -455,10 +456,19 @@ static int testMessagePayloadDecode(const void *args ATTRIBUTE_UNUSED)
     return ret;
 }
 
-static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
+typedef enum {
+    TEST_STREAM_ENCODE_RAW,     /* copied in by EncodePayloadRaw */
+    TEST_STREAM_ENCODE_RESERVE, /* filled in between Reserve and Commit */
+    TEST_STREAM_ENCODE_REF,     /* left in place by EncodePayloadRef */
+} testStreamEncodeMode;
+
+static int testMessagePayloadStreamEncode(const void *args)
 {
+    const testStreamEncodeMode *mode = args;
     char stream[] = "The quick brown fox jumps over the lazy dog";
     virNetMessagePtr msg = virNetMessageNew(true);
+    size_t headerLen = 28;
+    char *data;
     static const char expect[] = {
         0x00, 0x00, 0x00, 0x47,  /* Length */
         0x11, 0x22, 0x33, 0x44,  /* Program */
@@ -495,8 +505,42 @@ static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
     if (virNetMessageEncodeHeader(msg) < 0)
         goto cleanup;
 
-    if (virNetMessageEncodePayloadRaw(msg, stream, strlen(stream)) < 0)
+    switch (*mode) {
+    case TEST_STREAM_ENCODE_RAW:
+        if (virNetMessageEncodePayloadRaw(msg, stream, strlen(stream)) < 0)
+            goto cleanup;
+        break;
+
+    case TEST_STREAM_ENCODE_RESERVE:
+        /* Reserving more than is used must not show on the wire */
+        if (virNetMessageReservePayloadRaw(msg, 1024, &data) < 0)
+            goto cleanup;
+        memcpy(data, stream, strlen(stream));
+        if (virNetMessageCommitPayloadRaw(msg, strlen(stream)) < 0)
+            goto cleanup;
+        break;
+
+    case TEST_STREAM_ENCODE_REF:
+        if (virNetMessageEncodePayloadRef(msg, stream, strlen(stream)) < 0)
+            goto cleanup;
+
+        if (msg->bufferLength != headerLen ||
+            msg->payload != stream ||
+            msg->payloadLength != strlen(stream)) {
+            VIR_DEBUG("Expect header length %zu and payload %p/%zu, "
+                      "got %zu and %p/%zu", headerLen,
+                      stream, strlen(stream), msg->bufferLength,
+                      msg->payload, msg->payloadLength);
+            goto cleanup;
+        }
+
+        if (memcmp(expect, msg->buffer, headerLen) != 0) {
+            virtTestDifferenceBin(stderr, expect, msg->buffer, headerLen);
+            goto cleanup;
+        }
+        ret = 0;
         goto cleanup;
+    }
 
     if (ARRAY_CARDINALITY(expect) != msg->bufferLength) {
         VIR_DEBUG("Expect message length %zu got %zu",
@@ -522,10 +566,339 @@ static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
 }
 
 
+static int testMessageBufferCache(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessagePtr msg = NULL;
+    virNetMessageBufferStats before;
+    virNetMessageBufferStats after;
+    char *buf;
+    int ret = -1;
+
+    if (!(msg = virNetMessageNew(true)) ||
+        virNetMessageSetBufferLength(msg, VIR_NET_MESSAGE_LEN_MAX) < 0)
+        goto cleanup;
+
+    if (msg->bufferLength != VIR_NET_MESSAGE_LEN_MAX ||
+        msg->bufferSize != VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX) {
+        VIR_DEBUG("Unexpected buffer length %zu size %zu",
+                  msg->bufferLength, msg->bufferSize);
+        goto cleanup;
+    }
+
+    /* A released buffer is handed out again */
+    buf = msg->buffer;
+    virNetMessageFree(msg);
+    virNetMessageGetBufferStats(&before);
+
+    if (!(msg = virNetMessageNew(true)) ||
+        virNetMessageSetBufferLength(msg, VIR_NET_MESSAGE_LEN_MAX) < 0)
+        goto cleanup;
+    virNetMessageGetBufferStats(&after);
+
+    if (msg->buffer != buf ||
+        after.reuses != before.reuses + 1 ||
+        after.allocs != before.allocs ||
+        after.cached != before.cached - 1) {
+        VIR_DEBUG("Buffer %p was not reused (got %p)", buf, msg->buffer);
+        goto cleanup;
+    }
+
+    /* Growing keeps the data and moves on to the next size class */
+    memcpy(msg->buffer, "\x00\x01\x02\x03", VIR_NET_MESSAGE_LEN_MAX);
+    if (virNetMessageSetBufferLength(msg, VIR_NET_MESSAGE_INITIAL +
+                                     VIR_NET_MESSAGE_LEN_MAX + 1) < 0)
+        goto cleanup;
+
+    if (msg->bufferSize != VIR_NET_MESSAGE_INITIAL * 4 +
+        VIR_NET_MESSAGE_LEN_MAX ||
+        memcmp(msg->buffer, "\x00\x01\x02\x03",
+               VIR_NET_MESSAGE_LEN_MAX) != 0) {
+        VIR_DEBUG("Unexpected buffer size %zu after growing",
+                  msg->bufferSize);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+/* Full stream packets are sent and received all the time, so they
+ * must come from a size class that is cached, not from the top one */
+static int testMessageBufferStream(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessagePtr msg = NULL;
+    virNetMessageBufferStats before;
+    virNetMessageBufferStats after;
+    size_t classSize = VIR_NET_MESSAGE_INITIAL * 16 + VIR_NET_MESSAGE_LEN_MAX;
+    char *buf = NULL;
+    char *data;
+    size_t i;
+    int ret = -1;
+
+    for (i = 0; i < 2; i++) {
+        if (!(msg = virNetMessageNew(false)))
+            goto cleanup;
+
+        msg->header.type = VIR_NET_STREAM;
+        msg->header.status = VIR_NET_CONTINUE;
+
+        virNetMessageGetBufferStats(&before);
+
+        if (virNetMessageEncodeHeader(msg) < 0 ||
+            virNetMessageReservePayloadRaw(msg,
+                                           VIR_NET_MESSAGE_STREAM_CHUNK_MAX,
+                                           &data) < 0)
+            goto cleanup;
+        memset(data, 'x', VIR_NET_MESSAGE_STREAM_CHUNK_MAX);
+        if (virNetMessageCommitPayloadRaw(msg,
+                                          VIR_NET_MESSAGE_STREAM_CHUNK_MAX) < 0)
+            goto cleanup;
+
+        virNetMessageGetBufferStats(&after);
+
+        if (msg->bufferSize != classSize) {
+            VIR_DEBUG("Stream packet of %zu bytes got a buffer of %zu",
+                      msg->bufferLength, msg->bufferSize);
+            goto cleanup;
+        }
+
+        /* The second packet reuses the buffer of the first one */
+        if (i == 1 &&
+            (msg->buffer != buf ||
+             after.reuses <= before.reuses ||
+             after.allocs != before.allocs)) {
+            VIR_DEBUG("Buffer %p was not reused (got %p)", buf, msg->buffer);
+            goto cleanup;
+        }
+
+        buf = msg->buffer;
+        virNetMessageFree(msg);
+        msg = NULL;
+    }
+
+    /* Receiving a full packet sizes the buffer from the length word */
+    if (!(msg = virNetMessageNew(false)) ||
+        virNetMessageSetBufferLength(msg, VIR_NET_MESSAGE_LEN_MAX +
+                                     VIR_NET_MESSAGE_HEADER_MAX +
+                                     VIR_NET_MESSAGE_STREAM_CHUNK_MAX) < 0)
+        goto cleanup;
+
+    if (msg->buffer != buf) {
+        VIR_DEBUG("Buffer %p was not reused for receiving (got %p)",
+                  buf, msg->buffer);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+static int testMessagePayloadEncodeLarge(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessageError err;
+    virNetMessageError decoded;
+    virNetMessagePtr msg = virNetMessageNew(true);
+    virNetMessageBufferStats before;
+    virNetMessageBufferStats after;
+    size_t len = VIR_NET_MESSAGE_INITIAL * 3;
+    int ret = -1;
+
+    memset(&err, 0, sizeof(err));
+    memset(&decoded, 0, sizeof(decoded));
+
+    if (!msg)
+        return -1;
+
+    err.code = VIR_ERR_INTERNAL_ERROR;
+    err.domain = VIR_FROM_RPC;
+    err.level = VIR_ERR_ERROR;
+
+    if (VIR_ALLOC(err.message) < 0 ||
+        VIR_ALLOC_N(*err.message, len + 1) < 0)
+        goto cleanup;
+    memset(*err.message, 'x', len);
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_REPLY;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_ERROR;
+
+    virNetMessageGetBufferStats(&before);
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageError,
+                                   &err) < 0)
+        goto cleanup;
+
+    virNetMessageGetBufferStats(&after);
+
+    /* The payload needs a 1 MiB buffer, which should not take
+     * more than one attempt per size class to get to */
+    if (after.encodeRetries == before.encodeRetries ||
+        after.encodeRetries > before.encodeRetries + 2 ||
+        msg->bufferLength <= len) {
+        VIR_DEBUG("Unexpected %llu retries for %zu bytes",
+                  after.encodeRetries - before.encodeRetries,
+                  msg->bufferLength);
+        goto cleanup;
+    }
+
+    /* Read it back as if it had just come off the wire */
+    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+    if (virNetMessageDecodeLength(msg) < 0 ||
+        virNetMessageDecodeHeader(msg) < 0 ||
+        virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageError,
+                                   &decoded) < 0)
+        goto cleanup;
+
+    if (!decoded.message ||
+        STRNEQ(*decoded.message, *err.message)) {
+        VIR_DEBUG("Decoded message does not match");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    xdr_free((xdrproc_t)xdr_virNetMessageError, (void*)&err);
+    xdr_free((xdrproc_t)xdr_virNetMessageError, (void*)&decoded);
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+static int testMessagePayloadDecodeArena(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessageError err;
+    virNetMessageError decoded;
+    virNetMessagePtr msg = virNetMessageNew(true);
+    virNetXDRArenaPtr arena = NULL;
+    virNetXDRArenaStats stats;
+    unsigned long long allocs = 0;
+    const size_t iterations = 1000;
+    size_t i;
+    int ret = -1;
+
+    memset(&err, 0, sizeof(err));
+
+    if (!msg)
+        return -1;
+
+    err.code = VIR_ERR_INTERNAL_ERROR;
+    err.domain = VIR_FROM_RPC;
+    err.level = VIR_ERR_ERROR;
+
+    if (VIR_ALLOC(err.message) < 0 ||
+        VIR_STRDUP(*err.message, "Hello World") < 0 ||
+        VIR_ALLOC(err.str1) < 0 ||
+        VIR_STRDUP(*err.str1, "One") < 0 ||
+        VIR_ALLOC(err.str2) < 0 ||
+        VIR_STRDUP(*err.str2, "Two") < 0 ||
+        VIR_ALLOC(err.dom) < 0 ||
+        VIR_STRDUP(err.dom->name, "Domain") < 0)
+        goto cleanup;
+    memset(err.dom->uuid, 0x42, sizeof(err.dom->uuid));
+    err.dom->id = 7;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_REPLY;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_ERROR;
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageError,
+                                   &err) < 0)
+        goto cleanup;
+
+    if (!(arena = virNetXDRArenaNew(4096)) ||
+        virNetXDRArenaSetCurrent(arena) < 0)
+        goto cleanup;
+
+    for (i = 0; i < iterations; i++) {
+        memset(&decoded, 0, sizeof(decoded));
+        msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+        if (virNetMessageDecodeLength(msg) < 0 ||
+            virNetMessageDecodeHeader(msg) < 0 ||
+            virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageError,
+                                       &decoded) < 0)
+            goto cleanup;
+
+        if (!decoded.message || STRNEQ(*decoded.message, "Hello World") ||
+            !decoded.str1 || STRNEQ(*decoded.str1, "One") ||
+            !decoded.str2 || STRNEQ(*decoded.str2, "Two") ||
+            decoded.str3 || decoded.net ||
+            !decoded.dom || STRNEQ(decoded.dom->name, "Domain") ||
+            decoded.dom->id != 7 ||
+            memcmp(decoded.dom->uuid, err.dom->uuid,
+                   sizeof(err.dom->uuid)) != 0) {
+            VIR_DEBUG("Decoded error does not match");
+            goto cleanup;
+        }
+
+        virNetXDRArenaGetStats(arena, &stats);
+        if (i == 0)
+            allocs = stats.allocs;
+        virNetXDRArenaReset(arena);
+    }
+
+    /* Every pointer and string would have been an allocation
+     * of its own, yet the arena only went to the heap once */
+    virNetXDRArenaGetStats(arena, &stats);
+    if (allocs != 8 ||
+        stats.allocs != allocs * iterations ||
+        stats.blocks != 1 ||
+        stats.resets != iterations) {
+        VIR_DEBUG("Unexpected arena stats allocs=%llu blocks=%llu "
+                  "resets=%llu", stats.allocs, stats.blocks, stats.resets);
+        goto cleanup;
+    }
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%zu decodes: %llu heap allocations without "
+                "arena, %llu with\n",
+                iterations, stats.allocs, stats.blocks);
+
+    /* A truncated payload fails, leaving the arena to clean up */
+    memset(&decoded, 0, sizeof(decoded));
+    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+    if (virNetMessageDecodeLength(msg) < 0 ||
+        virNetMessageDecodeHeader(msg) < 0)
+        goto cleanup;
+    msg->bufferLength -= 8;
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageError,
+                                   &decoded) == 0) {
+        VIR_DEBUG("Truncated payload was decoded");
+        goto cleanup;
+    }
+    virResetLastError();
+    virNetXDRArenaReset(arena);
+
+    ret = 0;
+ cleanup:
+    ignore_value(virNetXDRArenaSetCurrent(NULL));
+    virNetXDRArenaFree(arena);
+    xdr_free((xdrproc_t)xdr_virNetMessageError, (void*)&err);
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
     int ret = 0;
+    testStreamEncodeMode raw = TEST_STREAM_ENCODE_RAW;
+    testStreamEncodeMode reserve = TEST_STREAM_ENCODE_RESERVE;
+    testStreamEncodeMode ref = TEST_STREAM_ENCODE_REF;
 
     signal(SIGPIPE, SIG_IGN);
 
@@ -541,7 +914,25 @@ mymain(void)
     if (virtTestRun("Message Payload Decode", testMessagePayloadDecode, NULL) < 0)
         ret = -1;
 
-    if (virtTestRun("Message Payload Stream Encode", testMessagePayloadStreamEncode, NULL) < 0)
+    if (virtTestRun("Message Payload Stream Encode", testMessagePayloadStreamEncode, &raw) < 0)
+        ret = -1;
+
+    if (virtTestRun("Message Payload Stream Reserve", testMessagePayloadStreamEncode, &reserve) < 0)
+        ret = -1;
+
+    if (virtTestRun("Message Payload Stream Ref", testMessagePayloadStreamEncode, &ref) < 0)
+        ret = -1;
+
+    if (virtTestRun("Message Buffer Cache", testMessageBufferCache, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Message Buffer Stream", testMessageBufferStream, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Message Payload Encode Large", testMessagePayloadEncodeLarge, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Message Payload Decode Arena", testMessagePayloadDecodeArena, NULL) < 0)
         ret = -1;
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
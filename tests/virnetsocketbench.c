@@ -0,0 +1,349 @@
+/*
+ * virnetsocketbench.c: RPC stream data throughput benchmarks
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Pushes stream data packets through a UNIX socket pair, either the
+ * way stream data used to be sent, copied into legacy sized messages,
+ * or written along with the header from where the data lives. Like
+ * virapibench, every workload prints one JSON object on a line of
+ * its own.
+ */
+
+#include <config.h>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "internal.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virstring.h"
+#include "virthread.h"
+
+#include "rpc/virnetsocket.h"
+#include "rpc/virnetmessage.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+typedef struct _benchWorkload benchWorkload;
+struct _benchWorkload {
+    const char *name;
+    bool zerocopy;
+};
+
+typedef struct _benchWriter benchWriter;
+struct _benchWriter {
+    virNetSocketPtr sock;
+    const benchWorkload *workload;
+    unsigned long long bytes;
+    int ret;
+};
+
+
+static unsigned long long
+benchNowUS(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+
+static size_t
+benchChunk(const benchWorkload *workload)
+{
+    return workload->zerocopy ? VIR_NET_MESSAGE_STREAM_CHUNK_MAX :
+                                VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX;
+}
+
+
+static void
+benchWriterRun(void *opaque)
+{
+    benchWriter *data = opaque;
+    size_t chunk = benchChunk(data->workload);
+    virNetMessagePtr msg = NULL;
+    char *payload = NULL;
+    unsigned long long sent = 0;
+
+    data->ret = -1;
+
+    if (VIR_ALLOC_N(payload, chunk) < 0 ||
+        !(msg = virNetMessageNew(false)))
+        goto cleanup;
+
+    while (sent < data->bytes) {
+        virNetMessageClear(msg);
+        msg->header.type = VIR_NET_STREAM;
+        msg->header.status = VIR_NET_CONTINUE;
+
+        if (virNetMessageEncodeHeader(msg) < 0)
+            goto cleanup;
+
+        if (data->workload->zerocopy) {
+            if (virNetMessageEncodePayloadRef(msg, payload, chunk) < 0)
+                goto cleanup;
+
+            while (msg->payloadOffset < msg->payloadLength) {
+                struct iovec iov[2];
+                ssize_t rv;
+
+                iov[0].iov_base = msg->buffer + msg->bufferOffset;
+                iov[0].iov_len = msg->bufferLength - msg->bufferOffset;
+                iov[1].iov_base = (char *)msg->payload + msg->payloadOffset;
+                iov[1].iov_len = msg->payloadLength - msg->payloadOffset;
+
+                if ((rv = virNetSocketWritev(data->sock, iov, 2)) < 0)
+                    goto cleanup;
+                if (rv <= iov[0].iov_len) {
+                    msg->bufferOffset += rv;
+                } else {
+                    msg->bufferOffset = msg->bufferLength;
+                    msg->payloadOffset += rv - iov[0].iov_len;
+                }
+            }
+        } else {
+            if (virNetMessageEncodePayloadRaw(msg, payload, chunk) < 0)
+                goto cleanup;
+
+            while (msg->bufferOffset < msg->bufferLength) {
+                ssize_t rv = virNetSocketWrite(data->sock,
+                                               msg->buffer + msg->bufferOffset,
+                                               msg->bufferLength - msg->bufferOffset);
+                if (rv < 0)
+                    goto cleanup;
+                msg->bufferOffset += rv;
+            }
+        }
+
+        sent += chunk;
+    }
+
+    data->ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    VIR_FREE(payload);
+}
+
+
+static int
+benchReaderRun(virNetSocketPtr sock,
+               unsigned long long bytes)
+{
+    virNetMessagePtr msg = virNetMessageNew(false);
+    unsigned long long got = 0;
+    int ret = -1;
+
+    if (!msg)
+        return -1;
+
+    while (got < bytes) {
+        ssize_t rv;
+
+        virNetMessageClear(msg);
+        msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+        if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0)
+            goto cleanup;
+
+        while (msg->bufferOffset < msg->bufferLength) {
+            if ((rv = virNetSocketRead(sock, msg->buffer + msg->bufferOffset,
+                                       msg->bufferLength - msg->bufferOffset)) < 0)
+                goto cleanup;
+            if (rv == 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("unexpected end of stream"));
+                goto cleanup;
+            }
+            msg->bufferOffset += rv;
+
+            if (msg->bufferOffset == VIR_NET_MESSAGE_LEN_MAX &&
+                msg->bufferLength == VIR_NET_MESSAGE_LEN_MAX &&
+                virNetMessageDecodeLength(msg) < 0)
+                goto cleanup;
+        }
+
+        if (virNetMessageDecodeHeader(msg) < 0)
+            goto cleanup;
+
+        got += msg->bufferLength - msg->bufferOffset;
+    }
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+static int
+benchRunWorkload(const benchWorkload *workload,
+                 unsigned long long bytes)
+{
+    virNetSocketPtr socks[2] = { NULL, NULL };
+    int fds[2] = { -1, -1 };
+    benchWriter data;
+    virThread thread;
+    unsigned long long start;
+    unsigned long long elapsed;
+    size_t i;
+    int ret = -1;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        virReportSystemError(errno, "%s", _("unable to create socket pair"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (virNetSocketNewConnectSockFD(fds[i], &socks[i]) < 0)
+            goto cleanup;
+        fds[i] = -1;
+        if (virNetSocketSetBlocking(socks[i], true) < 0)
+            goto cleanup;
+    }
+
+    data.sock = socks[0];
+    data.workload = workload;
+    data.bytes = bytes;
+
+    start = benchNowUS();
+    if (virThreadCreate(&thread, true, benchWriterRun, &data) < 0) {
+        virReportSystemError(errno, "%s", _("unable to create thread"));
+        goto cleanup;
+    }
+
+    if (benchReaderRun(socks[1], bytes) < 0) {
+        virNetSocketClose(socks[0]);
+        virThreadJoin(&thread);
+        goto cleanup;
+    }
+    virThreadJoin(&thread);
+    elapsed = benchNowUS() - start;
+
+    if (data.ret < 0)
+        goto cleanup;
+
+    printf("{\"workload\": \"%s\", \"version\": %d, \"bytes\": %llu, "
+           "\"packet_bytes\": %zu, \"seconds\": %.3f, "
+           "\"mib_per_sec\": %.1f}\n",
+           workload->name, LIBVIR_VERSION_NUMBER, bytes,
+           benchChunk(workload), elapsed / 1e6,
+           elapsed ? bytes * 1e6 / elapsed / (1024 * 1024) : 0.0);
+    fflush(stdout);
+
+    ret = 0;
+ cleanup:
+    if (ret < 0)
+        fprintf(stderr, "%s: %s\n", workload->name, virGetLastErrorMessage());
+    for (i = 0; i < 2; i++) {
+        virObjectUnref(socks[i]);
+        VIR_FORCE_CLOSE(fds[i]);
+    }
+    return ret;
+}
+
+
+static const benchWorkload workloads[] = {
+    { "stream-copied", false },
+    { "stream-vectored", true },
+};
+
+
+static void
+benchUsage(const char *argv0)
+{
+    size_t i;
+
+    fprintf(stderr,
+            "Usage: %s [OPTIONS] [WORKLOAD...]\n\n"
+            "  -s, --size MIB         stream data to send, 128 MiB by default\n"
+            "  -h, --help             show this message\n\n"
+            "Workloads:\n", argv0);
+    for (i = 0; i < ARRAY_CARDINALITY(workloads); i++)
+        fprintf(stderr, "  %s\n", workloads[i].name);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    struct option opts[] = {
+        { "size", required_argument, NULL, 's' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    unsigned int size = 128;
+    size_t i;
+    int c, j;
+    int ret = EXIT_FAILURE;
+
+    if (virInitialize() < 0) {
+        fprintf(stderr, "unable to initialize libvirt\n");
+        return EXIT_FAILURE;
+    }
+
+    while ((c = getopt_long(argc, argv, "s:h", opts, NULL)) != -1) {
+        switch (c) {
+        case 's':
+            if (virStrToLong_ui(optarg, NULL, 10, &size) < 0 ||
+                size == 0) {
+                fprintf(stderr, "invalid size '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'h':
+            benchUsage(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            benchUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (j = optind; j < argc; j++) {
+        for (i = 0; i < ARRAY_CARDINALITY(workloads); i++) {
+            if (STREQ(argv[j], workloads[i].name))
+                break;
+        }
+        if (i == ARRAY_CARDINALITY(workloads)) {
+            fprintf(stderr, "unknown workload '%s'\n", argv[j]);
+            benchUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    ret = EXIT_SUCCESS;
+    for (i = 0; i < ARRAY_CARDINALITY(workloads); i++) {
+        bool selected = optind == argc;
+
+        for (j = optind; j < argc && !selected; j++)
+            selected = STREQ(argv[j], workloads[i].name);
+
+        if (selected &&
+            benchRunWorkload(workloads + i, size * 1024ULL * 1024) < 0)
+            ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
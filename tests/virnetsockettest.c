@@ -34,8 +34,10 @@
 #include "virlog.h"
 #include "virfile.h"
 #include "virstring.h"
+#include "virthread.h"
 
 #include "rpc/virnetsocket.h"
+#include "rpc/virnetmessage.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
@@ -333,6 +335,215 @@ static int testSocketUNIXAddrs(const void *data ATTRIBUTE_UNUSED)
     return ret;
 }
 
+# define STREAM_TEST_PACKETS 3
+
+struct testStreamData {
+    virNetSocketPtr sock;
+    bool zerocopy;
+    int ret;
+};
+
+static char testStreamPattern(size_t offset)
+{
+    return (offset * 7 + offset / 251) & 0xff;
+}
+
+/* Sends STREAM_TEST_PACKETS full stream data packets, either copied
+ * into the message buffer or written along with the header from where
+ * the data lives */
+static void testStreamWriter(void *opaque)
+{
+    struct testStreamData *data = opaque;
+    size_t chunk = data->zerocopy ? VIR_NET_MESSAGE_STREAM_CHUNK_MAX :
+                                    VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX;
+    virNetMessagePtr msg = NULL;
+    char *payload = NULL;
+    size_t i, j;
+
+    data->ret = -1;
+
+    if (VIR_ALLOC_N(payload, chunk) < 0 ||
+        !(msg = virNetMessageNew(false)))
+        goto cleanup;
+
+    for (i = 0; i < STREAM_TEST_PACKETS; i++) {
+        for (j = 0; j < chunk; j++)
+            payload[j] = testStreamPattern(i * chunk + j);
+
+        virNetMessageClear(msg);
+        msg->header.type = VIR_NET_STREAM;
+        msg->header.status = VIR_NET_CONTINUE;
+
+        if (virNetMessageEncodeHeader(msg) < 0)
+            goto cleanup;
+
+        if (data->zerocopy) {
+            if (virNetMessageEncodePayloadRef(msg, payload, chunk) < 0)
+                goto cleanup;
+
+            while (msg->payloadOffset < msg->payloadLength) {
+                struct iovec iov[2];
+                ssize_t rv;
+
+                iov[0].iov_base = msg->buffer + msg->bufferOffset;
+                iov[0].iov_len = msg->bufferLength - msg->bufferOffset;
+                iov[1].iov_base = (char *)msg->payload + msg->payloadOffset;
+                iov[1].iov_len = msg->payloadLength - msg->payloadOffset;
+
+                if ((rv = virNetSocketWritev(data->sock, iov, 2)) < 0)
+                    goto cleanup;
+                if (rv <= iov[0].iov_len) {
+                    msg->bufferOffset += rv;
+                } else {
+                    msg->bufferOffset = msg->bufferLength;
+                    msg->payloadOffset += rv - iov[0].iov_len;
+                }
+            }
+        } else {
+            if (virNetMessageEncodePayloadRaw(msg, payload, chunk) < 0)
+                goto cleanup;
+
+            while (msg->bufferOffset < msg->bufferLength) {
+                ssize_t rv = virNetSocketWrite(data->sock,
+                                               msg->buffer + msg->bufferOffset,
+                                               msg->bufferLength - msg->bufferOffset);
+                if (rv < 0)
+                    goto cleanup;
+                msg->bufferOffset += rv;
+            }
+        }
+    }
+
+    data->ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    VIR_FREE(payload);
+}
+
+static int testStreamReader(virNetSocketPtr sock, size_t chunk)
+{
+    virNetMessagePtr msg = virNetMessageNew(false);
+    size_t got = 0;
+    size_t i;
+    int ret = -1;
+
+    if (!msg)
+        return -1;
+
+    while (got < STREAM_TEST_PACKETS * chunk) {
+        ssize_t rv;
+
+        virNetMessageClear(msg);
+        msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+        if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0)
+            goto cleanup;
+
+        while (msg->bufferOffset < msg->bufferLength) {
+            if ((rv = virNetSocketRead(sock, msg->buffer + msg->bufferOffset,
+                                       msg->bufferLength - msg->bufferOffset)) < 0)
+                goto cleanup;
+            msg->bufferOffset += rv;
+
+            if (msg->bufferOffset == VIR_NET_MESSAGE_LEN_MAX &&
+                msg->bufferLength == VIR_NET_MESSAGE_LEN_MAX &&
+                virNetMessageDecodeLength(msg) < 0)
+                goto cleanup;
+        }
+
+        if (virNetMessageDecodeHeader(msg) < 0 ||
+            msg->header.type != VIR_NET_STREAM) {
+            VIR_DEBUG("Expected a stream packet");
+            goto cleanup;
+        }
+
+        if (msg->bufferLength - msg->bufferOffset != chunk) {
+            VIR_DEBUG("Expected %zu bytes of data, got %zu", chunk,
+                      msg->bufferLength - msg->bufferOffset);
+            goto cleanup;
+        }
+
+        for (i = msg->bufferOffset; i < msg->bufferLength; i++, got++) {
+            if (msg->buffer[i] != testStreamPattern(got)) {
+                VIR_DEBUG("Stream data differ at offset %zu", got);
+                goto cleanup;
+            }
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+static int testSocketStream(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNetSocketPtr lsock = NULL; /* Listen socket */
+    virNetSocketPtr ssock = NULL; /* Server socket */
+    virNetSocketPtr csock = NULL; /* Client socket */
+    struct testStreamData data;
+    virThread thread;
+    size_t i;
+    int ret = -1;
+    char *path = NULL;
+    char *tmpdir;
+    char template[] = "/tmp/libvirt_XXXXXX";
+
+    tmpdir = mkdtemp(template);
+    if (tmpdir == NULL) {
+        VIR_WARN("Failed to create temporary directory");
+        goto cleanup;
+    }
+    if (virAsprintf(&path, "%s/test.sock", tmpdir) < 0)
+        goto cleanup;
+
+    if (virNetSocketNewListenUNIX(path, 0700, -1, getegid(), &lsock) < 0)
+        goto cleanup;
+
+    if (virNetSocketListen(lsock, 0) < 0)
+        goto cleanup;
+
+    if (virNetSocketNewConnectUNIX(path, false, NULL, &csock) < 0)
+        goto cleanup;
+
+    if (virNetSocketAccept(lsock, &ssock) < 0 || !ssock)
+        goto cleanup;
+
+    if (virNetSocketSetBlocking(csock, true) < 0 ||
+        virNetSocketSetBlocking(ssock, true) < 0)
+        goto cleanup;
+
+    for (i = 0; i < 2; i++) {
+        data.sock = csock;
+        data.zerocopy = i == 1;
+
+        if (virThreadCreate(&thread, true, testStreamWriter, &data) < 0)
+            goto cleanup;
+
+        if (testStreamReader(ssock, data.zerocopy ?
+                             VIR_NET_MESSAGE_STREAM_CHUNK_MAX :
+                             VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX) < 0) {
+            virNetSocketClose(csock);
+            virThreadJoin(&thread);
+            goto cleanup;
+        }
+        virThreadJoin(&thread);
+        if (data.ret < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(path);
+    virObjectUnref(lsock);
+    virObjectUnref(ssock);
+    virObjectUnref(csock);
+    if (tmpdir)
+        rmdir(tmpdir);
+    return ret;
+}
+
 static int testSocketCommandNormal(const void *data ATTRIBUTE_UNUSED)
 {
     virNetSocketPtr csock = NULL; /* Client socket */
@@ -501,6 +712,9 @@ mymain(void)
     if (virtTestRun("Socket UNIX Addrs", testSocketUNIXAddrs, NULL) < 0)
         ret = -1;
 
+    if (virtTestRun("Socket stream data", testSocketStream, NULL) < 0)
+        ret = -1;
+
     if (virtTestRun("Socket External Command /dev/zero", testSocketCommandNormal, NULL) < 0)
         ret = -1;
     if (virtTestRun("Socket External Command /dev/does-not-exist", testSocketCommandFail, NULL) < 0)
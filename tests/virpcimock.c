@@ -30,9 +30,11 @@
 # include <sys/stat.h>
 # include <stdarg.h>
 # include <dirent.h>
+# include <pthread.h>
 # include "viralloc.h"
 # include "virstring.h"
 # include "virfile.h"
+# include "virthread.h"
 # include "dirname.h"
 
 static int (*realaccess)(const char *path, int mode);
@@ -43,6 +45,7 @@ static int (*real__xstat)(int ver, const char *path, struct stat *sb);
 static char *(*realcanonicalize_file_name)(const char *path);
 static int (*realopen)(const char *path, int flags, ...);
 static int (*realclose)(int fd);
+static ssize_t (*realwrite)(int fd, const void *buf, size_t count);
 static DIR * (*realopendir)(const char *name);
 
 /* Don't make static, since it causes problems with clang
@@ -99,6 +102,16 @@ char *fakesysfsdir;
  * instead. The advantage is we don't need any self growing array to hold the
  * partial writes and construct them back. We can let all the writes finish,
  * and then just read the file content back.
+ *
+ * /sys/bus/pci/devices/<device>/config
+ *   Writes to the config space are how devices get reset. When such a file
+ *   is closed after having been written to, a line "<thread> <device>" is
+ *   appended to the 'resets' file in the stub tree, so that tests can check
+ *   which devices were reset, by which thread and in what order. For a
+ *   secondary bus reset the parent bridge shows up right before the device.
+ *
+ * Devices can be put into an IOMMU group, in which case the usual
+ * /sys/bus/pci/devices/<device>/iommu_group symlink is created.
  */
 
 /*
@@ -127,6 +140,7 @@ struct pciDevice {
     int vendor;
     int device;
     int class;
+    int iommuGroup;             /* IOMMU group number. 0 if in no group */
     struct pciDriver *driver;   /* Driver attached. NULL if attached to no driver */
 };
 
@@ -135,6 +149,12 @@ struct fdCallback {
     char *path;
 };
 
+struct configFd {
+    int fd;
+    char *id;           /* Device the config space belongs to */
+    bool written;
+};
+
 struct pciDevice **pciDevices = NULL;
 size_t nPCIDevices = 0;
 
@@ -144,6 +164,13 @@ size_t nPCIDrivers = 0;
 struct fdCallback *callbacks = NULL;
 size_t nCallbacks = 0;
 
+struct configFd *configFds = NULL;
+size_t nConfigFds = 0;
+
+/* Devices are reset from several threads at once, so guard the state
+ * above. Recursive because handling a close() may close() files. */
+static pthread_mutex_t mockLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
 static void init_env(void);
 
 static int pci_device_autobind(struct pciDevice *dev);
@@ -269,6 +296,8 @@ add_fd(int fd, const char *path)
     int ret = -1;
     size_t i;
 
+    pthread_mutex_lock(&mockLock);
+
     if (find_fd(fd, &i)) {
         struct fdCallback cb = callbacks[i];
         ABORT("FD %d %s already present in the array as %d %s",
@@ -284,6 +313,7 @@ add_fd(int fd, const char *path)
     callbacks[nCallbacks++].fd = fd;
     ret = 0;
  cleanup:
+    pthread_mutex_unlock(&mockLock);
     return ret;
 }
 
@@ -293,6 +323,8 @@ remove_fd(int fd)
     int ret = -1;
     size_t i;
 
+    pthread_mutex_lock(&mockLock);
+
     if (find_fd(fd, &i)) {
         struct fdCallback cb = callbacks[i];
 
@@ -308,9 +340,93 @@ remove_fd(int fd)
 
     ret = 0;
  cleanup:
+    pthread_mutex_unlock(&mockLock);
     return ret;
 }
 
+static bool
+find_config_fd(int fd, size_t *indx)
+{
+    size_t i;
+
+    for (i = 0; i < nConfigFds; i++) {
+        if (configFds[i].fd == fd) {
+            *indx = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int
+add_config_fd(int fd, const char *path)
+{
+    const char *id = path + strlen(PCI_SYSFS_PREFIX "devices/");
+    struct configFd cfg = { .fd = fd };
+    int ret = -1;
+
+    pthread_mutex_lock(&mockLock);
+
+    if (VIR_STRNDUP_QUIET(cfg.id, id, strchr(id, '/') - id) < 0 ||
+        VIR_APPEND_ELEMENT_QUIET(configFds, nConfigFds, cfg) < 0) {
+        VIR_FREE(cfg.id);
+        errno = ENOMEM;
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    pthread_mutex_unlock(&mockLock);
+    return ret;
+}
+
+static void
+mark_config_fd(int fd)
+{
+    size_t i;
+
+    pthread_mutex_lock(&mockLock);
+    if (find_config_fd(fd, &i))
+        configFds[i].written = true;
+    pthread_mutex_unlock(&mockLock);
+}
+
+static void
+remove_config_fd(int fd)
+{
+    size_t i;
+    char *resets = NULL;
+    char *line = NULL;
+    int logfd = -1;
+
+    pthread_mutex_lock(&mockLock);
+
+    if (!find_config_fd(fd, &i))
+        goto cleanup;
+
+    if (configFds[i].written) {
+        if (virAsprintfQuiet(&resets, "%s/resets", fakesysfsdir) < 0 ||
+            virAsprintfQuiet(&line, "%llu %s\n", virThreadSelfID(),
+                             configFds[i].id) < 0)
+            ABORT_OOM();
+
+        if ((logfd = realopen(resets, O_WRONLY|O_APPEND|O_CREAT, 0666)) < 0 ||
+            realwrite(logfd, line, strlen(line)) != (ssize_t) strlen(line))
+            ABORT("Unable to log reset to: %s", resets);
+    }
+
+    VIR_FREE(configFds[i].id);
+    VIR_DELETE_ELEMENT(configFds, i, nConfigFds);
+
+ cleanup:
+    pthread_mutex_unlock(&mockLock);
+    if (logfd >= 0)
+        realclose(logfd);
+    VIR_FREE(resets);
+    VIR_FREE(line);
+}
+
 
 /*
  * PCI Device functions
@@ -387,6 +503,25 @@ pci_device_new_from_stub(const struct pciDevice *data)
         ABORT("@tmp overflow");
     make_file(devpath, "class", tmp, -1);
 
+    if (dev->iommuGroup) {
+        char *grouppath;
+        char *linkpath;
+
+        if (virAsprintfQuiet(&grouppath, "%s/iommu_groups/%d",
+                             fakesysfsdir, dev->iommuGroup) < 0 ||
+            virAsprintfQuiet(&linkpath, "%s/iommu_group", devpath) < 0)
+            ABORT_OOM();
+
+        if (virFileMakePath(grouppath) < 0)
+            ABORT("Unable to create: %s", grouppath);
+
+        if (symlink(grouppath, linkpath) < 0)
+            ABORT("Unable to create symlink: %s", linkpath);
+
+        VIR_FREE(grouppath);
+        VIR_FREE(linkpath);
+    }
+
     if (pci_device_autobind(dev) < 0)
         ABORT("Unable to bind: %s", data->id);
 
@@ -795,6 +930,7 @@ init_syms(void)
     LOAD_SYM(canonicalize_file_name);
     LOAD_SYM(open);
     LOAD_SYM(close);
+    LOAD_SYM(write);
     LOAD_SYM(opendir);
 }
 
@@ -838,6 +974,12 @@ init_env(void)
     MAKE_PCI_DEVICE("0000:0a:01.0", 0x8086, 0x0047);
     MAKE_PCI_DEVICE("0000:0a:02.0", 0x8286, 0x0048);
     MAKE_PCI_DEVICE("0000:0a:03.0", 0x8386, 0x0048);
+    MAKE_PCI_DEVICE("0000:00:04.0", 0x8086, 0x0048, .iommuGroup = 4);
+    MAKE_PCI_DEVICE("0000:00:05.0", 0x8086, 0x0048, .iommuGroup = 4);
+    MAKE_PCI_DEVICE("0000:00:06.0", 0x8086, 0x0048, .iommuGroup = 6);
+    MAKE_PCI_DEVICE("0000:00:1c.0", 0x8086, 0x244e, .class = 0x060400);
+    MAKE_PCI_DEVICE("0000:0b:00.0", 0x8086, 0x0048);
+    MAKE_PCI_DEVICE("0000:0b:00.1", 0x8086, 0x0048);
 }
 
 
@@ -992,6 +1134,13 @@ open(const char *path, int flags, ...)
         ret = -1;
     }
 
+    if (ret >= 0 && STRPREFIX(path, PCI_SYSFS_PREFIX "devices/") &&
+        STREQ(last_component(path), "config") &&
+        add_config_fd(ret, path) < 0) {
+        realclose(ret);
+        ret = -1;
+    }
+
     VIR_FREE(newpath);
     return ret;
 }
@@ -1014,11 +1163,21 @@ opendir(const char *path)
     return ret;
 }
 
+ssize_t
+write(int fd, const void *buf, size_t count)
+{
+    init_syms();
+
+    mark_config_fd(fd);
+    return realwrite(fd, buf, count);
+}
+
 int
 close(int fd)
 {
     if (remove_fd(fd) < 0)
         return -1;
+    remove_config_fd(fd);
     return realclose(fd);
 }
 #else
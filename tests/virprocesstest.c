@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "testutils.h"
+
+#ifndef WIN32
+
+# include <sys/resource.h>
+# include <sys/wait.h>
+
+# include "viralloc.h"
+# include "virfile.h"
+# include "virlog.h"
+# define __VIR_PROCESS_PRIV_H_ALLOW__
+# include "virprocesspriv.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.processtest");
+
+enum {
+    TEST_CHILD_EXIT,            /* dies of SIGTERM */
+    TEST_CHILD_SLOW,            /* exits a little while after SIGTERM */
+    TEST_CHILD_IGNORE,          /* survives SIGTERM */
+};
+
+struct testKillInfo {
+    int child;
+    bool force;
+    bool nopidfd;
+    int expect;
+};
+
+static volatile sig_atomic_t terminated;
+
+static void
+testChildTerm(int sig ATTRIBUTE_UNUSED)
+{
+    terminated = 1;
+}
+
+static void ATTRIBUTE_NORETURN
+testChildMain(int child, int fd)
+{
+    sigset_t mask, oldmask;
+
+    /* SIGTERM can't slip in between checking for it and waiting */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, &oldmask);
+
+    if (child == TEST_CHILD_IGNORE)
+        signal(SIGTERM, SIG_IGN);
+    else if (child == TEST_CHILD_SLOW)
+        signal(SIGTERM, testChildTerm);
+
+    if (safewrite(fd, "1", 1) != 1)
+        _exit(EXIT_FAILURE);
+
+    while (!terminated)
+        sigsuspend(&oldmask);
+
+    usleep(100 * 1000);
+    _exit(EXIT_SUCCESS);
+}
+
+static pid_t
+testChildStart(int child)
+{
+    int pipefd[2];
+    char c;
+    pid_t pid;
+
+    if (pipe(pipefd) < 0)
+        return -1;
+
+    if ((pid = fork()) == 0) {
+        VIR_FORCE_CLOSE(pipefd[0]);
+        testChildMain(child, pipefd[1]);
+    }
+
+    VIR_FORCE_CLOSE(pipefd[1]);
+    if (pid > 0 && saferead(pipefd[0], &c, 1) != 1) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        pid = -1;
+    }
+    VIR_FORCE_CLOSE(pipefd[0]);
+
+    return pid;
+}
+
+
+/* Lower the file descriptor limit and use up all the descriptors
+ * below it, so that pidfd_open fails and the polling fallback is
+ * taken */
+static struct rlimit savedLimit;
+static int *spareFDs;
+static size_t nspareFDs;
+
+static int
+testUseUpFDs(void)
+{
+    struct rlimit limit;
+    int fd;
+
+    if (getrlimit(RLIMIT_NOFILE, &savedLimit) < 0)
+        return -1;
+
+    limit = savedLimit;
+    limit.rlim_cur = 64;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+        return -1;
+
+    while ((fd = dup(STDERR_FILENO)) >= 0) {
+        if (VIR_APPEND_ELEMENT(spareFDs, nspareFDs, fd) < 0) {
+            VIR_FORCE_CLOSE(fd);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void
+testReleaseFDs(void)
+{
+    while (nspareFDs)
+        VIR_FORCE_CLOSE(spareFDs[--nspareFDs]);
+    VIR_FREE(spareFDs);
+    ignore_value(setrlimit(RLIMIT_NOFILE, &savedLimit));
+}
+
+
+static int
+testKillPainfully(const void *opaque)
+{
+    const struct testKillInfo *info = opaque;
+    pid_t pid;
+    int rc;
+    int ret = -1;
+
+    if ((pid = testChildStart(info->child)) < 0) {
+        fprintf(stderr, "Cannot start child process\n");
+        return -1;
+    }
+
+    if (info->nopidfd && testUseUpFDs() < 0) {
+        fprintf(stderr, "Cannot use up file descriptors\n");
+        goto cleanup;
+    }
+
+    rc = virProcessKillPainfully(pid, info->force);
+
+    if (info->nopidfd)
+        testReleaseFDs();
+
+    if (rc != info->expect) {
+        fprintf(stderr, "Expected %d, got %d\n", info->expect, rc);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return ret;
+}
+
+
+static int
+testKillPainfullyGone(const void *opaque ATTRIBUTE_UNUSED)
+{
+    pid_t pid;
+    int rc;
+
+    if ((pid = testChildStart(TEST_CHILD_EXIT)) < 0) {
+        fprintf(stderr, "Cannot start child process\n");
+        return -1;
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+
+    if ((rc = virProcessKillPainfully(pid, false)) != 0) {
+        fprintf(stderr, "Expected 0, got %d\n", rc);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    /* Don't wait out the full grace period for children ignoring SIGTERM */
+    virProcessSetKillTimeouts(1000, 5000);
+
+# define DO_TEST(name, child, force, nopidfd, expect)                   \
+    do {                                                                \
+        struct testKillInfo info = { child, force, nopidfd, expect };   \
+        if (virtTestRun("Kill painfully " name,                        \
+                        testKillPainfully, &info) < 0)                  \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("exit", TEST_CHILD_EXIT, false, false, 1);
+    DO_TEST("slow", TEST_CHILD_SLOW, false, false, 1);
+    DO_TEST("exit polling", TEST_CHILD_EXIT, false, true, 1);
+    DO_TEST("slow polling", TEST_CHILD_SLOW, false, true, 1);
+    /* takes the full grace period before SIGKILL */
+    DO_TEST("ignore", TEST_CHILD_IGNORE, true, false, 1);
+
+    if (virtTestRun("Kill painfully gone", testKillPainfullyGone, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WIN32 */
@@ -0,0 +1,599 @@
+/*
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+
+#include "testutils.h"
+#include "viralloc.h"
+#include "virthread.h"
+#include "virthreadpool.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define TEST_DEBUG(...)                         \
+    do {                                        \
+        if (virTestGetDebug())                  \
+            fprintf(stderr, __VA_ARGS__);       \
+    } while (0)
+
+#define TEST_MAX_JOBS 4096
+
+struct testThreadPoolData {
+    virMutex lock;
+    virCond cond;
+    bool gateOpen;
+    size_t done;
+    int order[TEST_MAX_JOBS];
+    size_t runningLong;
+    size_t maxRunningLong;
+    size_t startedLong;
+};
+
+/* Job data encodes the job number, and whether it waits for the gate */
+#define TEST_JOB_GATED 0x10000
+#define TEST_JOB_LONG  0x20000
+#define TEST_JOB_ID(data) ((int) ((size_t) (data) & 0xffff))
+
+
+static void
+testThreadPoolJob(void *jobdata, void *opaque)
+{
+    struct testThreadPoolData *data = opaque;
+    size_t job = (size_t) jobdata;
+
+    virMutexLock(&data->lock);
+    if (job & TEST_JOB_LONG) {
+        data->startedLong++;
+        if (++data->runningLong > data->maxRunningLong)
+            data->maxRunningLong = data->runningLong;
+        virCondBroadcast(&data->cond);
+    }
+    if (job & TEST_JOB_GATED) {
+        while (!data->gateOpen)
+            ignore_value(virCondWait(&data->cond, &data->lock));
+    }
+    if (job & TEST_JOB_LONG)
+        data->runningLong--;
+    if (data->done < TEST_MAX_JOBS)
+        data->order[data->done] = TEST_JOB_ID(jobdata);
+    data->done++;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+/* Waits up to five seconds for *counter to reach @want.
+ * Must be called with data->lock held. */
+static int
+testThreadPoolWait(struct testThreadPoolData *data,
+                   size_t *counter,
+                   size_t want)
+{
+    unsigned long long deadline;
+
+    if (virTimeMillisNow(&deadline) < 0)
+        return -1;
+    deadline += 5 * 1000;
+
+    while (*counter < want) {
+        if (virCondWaitUntil(&data->cond, &data->lock, deadline) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testThreadPoolSetup(struct testThreadPoolData *data)
+{
+    memset(data, 0, sizeof(*data));
+
+    if (virMutexInit(&data->lock) < 0)
+        return -1;
+    if (virCondInit(&data->cond) < 0) {
+        virMutexDestroy(&data->lock);
+        return -1;
+    }
+    return 0;
+}
+
+
+static void
+testThreadPoolOpenGate(struct testThreadPoolData *data)
+{
+    virMutexLock(&data->lock);
+    data->gateOpen = true;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+static void
+testThreadPoolTeardown(struct testThreadPoolData *data,
+                       virThreadPoolPtr pool)
+{
+    testThreadPoolOpenGate(data);
+    virThreadPoolFree(pool);
+    virCondDestroy(&data->cond);
+    virMutexDestroy(&data->lock);
+}
+
+
+static int
+testThreadPoolSend(virThreadPoolPtr pool,
+                   unsigned int priority,
+                   const void *key,
+                   size_t job)
+{
+    return virThreadPoolSendJobFull(pool, priority, key, (void *) job);
+}
+
+
+static int
+testThreadPoolOrder(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testThreadPoolData data;
+    virThreadPoolPtr pool = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (testThreadPoolSetup(&data) < 0)
+        return -1;
+
+    /* A single worker runs jobs without a key in order */
+    if (!(pool = virThreadPoolNew(0, 1, 0, testThreadPoolJob, &data)))
+        goto cleanup;
+
+    for (i = 0; i < 100; i++) {
+        if (virThreadPoolSendJob(pool, 0, (void *) i) < 0)
+            goto cleanup;
+    }
+
+    virMutexLock(&data.lock);
+    if (testThreadPoolWait(&data, &data.done, 100) < 0) {
+        virMutexUnlock(&data.lock);
+        goto cleanup;
+    }
+    for (i = 0; i < 100; i++) {
+        if (data.order[i] != i) {
+            TEST_DEBUG("job %d ran as %zu\n", data.order[i], i);
+            virMutexUnlock(&data.lock);
+            goto cleanup;
+        }
+    }
+    virMutexUnlock(&data.lock);
+
+    ret = 0;
+ cleanup:
+    testThreadPoolTeardown(&data, pool);
+    return ret;
+}
+
+
+static int
+testThreadPoolFairness(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testThreadPoolData data;
+    virThreadPoolPtr pool = NULL;
+    int busy;
+    int quiet;
+    size_t i;
+    size_t lastQuiet = 0;
+    int ret = -1;
+
+    if (testThreadPoolSetup(&data) < 0)
+        return -1;
+
+    if (!(pool = virThreadPoolNew(1, 1, 0, testThreadPoolJob, &data)))
+        goto cleanup;
+
+    /* Hold the worker, then queue lots of jobs for one key and a few
+     * for another */
+    if (testThreadPoolSend(pool, 0, NULL, TEST_JOB_GATED | 1000) < 0)
+        goto cleanup;
+    for (i = 0; i < 50; i++) {
+        if (testThreadPoolSend(pool, 0, &busy, i) < 0)
+            goto cleanup;
+    }
+    for (i = 0; i < 5; i++) {
+        if (testThreadPoolSend(pool, 0, &quiet, 100 + i) < 0)
+            goto cleanup;
+    }
+
+    testThreadPoolOpenGate(&data);
+
+    virMutexLock(&data.lock);
+    if (testThreadPoolWait(&data, &data.done, 56) < 0) {
+        virMutexUnlock(&data.lock);
+        goto cleanup;
+    }
+    for (i = 0; i < 56; i++) {
+        if (data.order[i] >= 100 && data.order[i] < 1000)
+            lastQuiet = i;
+    }
+    virMutexUnlock(&data.lock);
+
+    /* The keys take turns, so the few jobs don't wait for all of
+     * the others */
+    if (lastQuiet > 11) {
+        TEST_DEBUG("last job of the second key ran as %zu\n", lastQuiet);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    testThreadPoolTeardown(&data, pool);
+    return ret;
+}
+
+
+static int
+testThreadPoolLong(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testThreadPoolData data;
+    virThreadPoolPtr pool = NULL;
+    int keys[3];
+    size_t i;
+    int ret = -1;
+
+    if (testThreadPoolSetup(&data) < 0)
+        return -1;
+
+    if (!(pool = virThreadPoolNew(4, 4, 0, testThreadPoolJob, &data)))
+        goto cleanup;
+    virThreadPoolSetLongJobLimit(pool, 1);
+
+    for (i = 0; i < 3; i++) {
+        if (testThreadPoolSend(pool, VIR_THREAD_POOL_PRIORITY_LONG, &keys[i],
+                               TEST_JOB_GATED | TEST_JOB_LONG | i) < 0)
+            goto cleanup;
+
+        /* Make sure it's the first one that runs */
+        if (i == 0) {
+            virMutexLock(&data.lock);
+            if (testThreadPoolWait(&data, &data.startedLong, 1) < 0) {
+                virMutexUnlock(&data.lock);
+                goto cleanup;
+            }
+            virMutexUnlock(&data.lock);
+        }
+    }
+    for (i = 0; i < 10; i++) {
+        if (testThreadPoolSend(pool, 0, NULL, 10 + i) < 0)
+            goto cleanup;
+    }
+    /* Has to wait for the long job sent before it with the same key */
+    if (testThreadPoolSend(pool, 0, &keys[1], 20) < 0)
+        goto cleanup;
+
+    /* Other jobs run while the long one holds its worker */
+    virMutexLock(&data.lock);
+    if (testThreadPoolWait(&data, &data.done, 10) < 0 ||
+        data.startedLong != 1) {
+        TEST_DEBUG("done=%zu startedLong=%zu\n", data.done, data.startedLong);
+        virMutexUnlock(&data.lock);
+        goto cleanup;
+    }
+    for (i = 0; i < data.done; i++) {
+        if (data.order[i] == 20) {
+            TEST_DEBUG("job overtook the long job sent before it\n");
+            virMutexUnlock(&data.lock);
+            goto cleanup;
+        }
+    }
+    virMutexUnlock(&data.lock);
+
+    testThreadPoolOpenGate(&data);
+
+    virMutexLock(&data.lock);
+    if (testThreadPoolWait(&data, &data.done, 14) < 0 ||
+        data.maxRunningLong != 1) {
+        TEST_DEBUG("done=%zu maxRunningLong=%zu\n",
+                   data.done, data.maxRunningLong);
+        virMutexUnlock(&data.lock);
+        goto cleanup;
+    }
+    virMutexUnlock(&data.lock);
+
+    ret = 0;
+ cleanup:
+    testThreadPoolTeardown(&data, pool);
+    return ret;
+}
+
+
+/* Every job sent to idle workers wakes up a worker of its own, even
+ * if they are sent faster than the workers wake up */
+static int
+testThreadPoolWakeup(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testThreadPoolData data;
+    virThreadPoolPtr pool = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (testThreadPoolSetup(&data) < 0)
+        return -1;
+
+    if (!(pool = virThreadPoolNew(4, 4, 0, testThreadPoolJob, &data)))
+        goto cleanup;
+
+    /* Let the workers go to sleep */
+    usleep(100 * 1000);
+
+    /* Marked long to count them as they start, as they all hold
+     * their worker until the gate opens */
+    for (i = 0; i < 4; i++) {
+        if (testThreadPoolSend(pool, 0, NULL,
+                               TEST_JOB_GATED | TEST_JOB_LONG | i) < 0)
+            goto cleanup;
+    }
+
+    virMutexLock(&data.lock);
+    if (testThreadPoolWait(&data, &data.startedLong, 4) < 0) {
+        TEST_DEBUG("startedLong=%zu\n", data.startedLong);
+        virMutexUnlock(&data.lock);
+        goto cleanup;
+    }
+    virMutexUnlock(&data.lock);
+
+    ret = 0;
+ cleanup:
+    testThreadPoolTeardown(&data, pool);
+    return ret;
+}
+
+
+static int
+testThreadPoolPriority(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testThreadPoolData data;
+    virThreadPoolPtr pool = NULL;
+    int ret = -1;
+
+    if (testThreadPoolSetup(&data) < 0)
+        return -1;
+
+    if (!(pool = virThreadPoolNew(1, 1, 1, testThreadPoolJob, &data)))
+        goto cleanup;
+
+    if (testThreadPoolSend(pool, 0, NULL, TEST_JOB_GATED | 1) < 0 ||
+        testThreadPoolSend(pool, 0, NULL, 2) < 0 ||
+        testThreadPoolSend(pool, VIR_THREAD_POOL_PRIORITY_HIGH, NULL, 3) < 0)
+        goto cleanup;
+
+    /* Only the high priority job can run while the worker is busy */
+    virMutexLock(&data.lock);
+    if (testThreadPoolWait(&data, &data.done, 1) < 0 ||
+        data.order[0] != 3) {
+        virMutexUnlock(&data.lock);
+        goto cleanup;
+    }
+    virMutexUnlock(&data.lock);
+
+    ret = 0;
+ cleanup:
+    testThreadPoolTeardown(&data, pool);
+    return ret;
+}
+
+
+struct testThreadPoolSender {
+    virThreadPoolPtr pool;
+    size_t first;
+    int rc;
+};
+
+static void
+testThreadPoolSendMany(void *opaque)
+{
+    struct testThreadPoolSender *sender = opaque;
+    size_t i;
+
+    for (i = 0; i < 1000; i++) {
+        if (testThreadPoolSend(sender->pool, i % 5 == 0, sender,
+                               sender->first + i) < 0)
+            sender->rc = -1;
+    }
+}
+
+
+static int
+testThreadPoolStress(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testThreadPoolData data;
+    struct testThreadPoolSender senders[4];
+    virThread threads[4];
+    virThreadPoolPtr pool = NULL;
+    bool seen[4000] = { false };
+    size_t i;
+    int ret = -1;
+
+    if (testThreadPoolSetup(&data) < 0)
+        return -1;
+
+    if (!(pool = virThreadPoolNew(2, 8, 2, testThreadPoolJob, &data)))
+        goto cleanup;
+
+    for (i = 0; i < 4; i++) {
+        senders[i].pool = pool;
+        senders[i].first = i * 1000;
+        senders[i].rc = 0;
+        if (virThreadCreate(&threads[i], true,
+                            testThreadPoolSendMany, &senders[i]) < 0)
+            goto cleanup;
+    }
+    for (i = 0; i < 4; i++) {
+        virThreadJoin(&threads[i]);
+        if (senders[i].rc < 0)
+            goto cleanup;
+    }
+
+    /* Every job runs exactly once */
+    virMutexLock(&data.lock);
+    if (testThreadPoolWait(&data, &data.done, 4000) < 0) {
+        virMutexUnlock(&data.lock);
+        goto cleanup;
+    }
+    for (i = 0; i < 4000; i++) {
+        if (seen[data.order[i]]) {
+            virMutexUnlock(&data.lock);
+            goto cleanup;
+        }
+        seen[data.order[i]] = true;
+    }
+    virMutexUnlock(&data.lock);
+
+    ret = 0;
+ cleanup:
+    testThreadPoolTeardown(&data, pool);
+    return ret;
+}
+
+
+struct testThreadPoolBatchData {
+    virMutex lock;
+    virCond cond;
+    size_t maxWorkers;
+    size_t running;
+    size_t maxRunning;
+    bool timedOut;
+    size_t *calls;
+};
+
+static void
+testThreadPoolBatchJob(size_t job,
+                       void *opaque)
+{
+    struct testThreadPoolBatchData *data = opaque;
+    unsigned long long deadline = 0;
+
+    ignore_value(virTimeMillisNow(&deadline));
+    deadline += 5 * 1000;
+
+    virMutexLock(&data->lock);
+    data->calls[job]++;
+    if (++data->running > data->maxRunning)
+        data->maxRunning = data->running;
+    virCondBroadcast(&data->cond);
+
+    /* Hold on until every worker got a job, which shows they run
+     * in parallel */
+    while (!data->timedOut && data->maxRunning < data->maxWorkers) {
+        if (virCondWaitUntil(&data->cond, &data->lock, deadline) < 0)
+            data->timedOut = true;
+    }
+    data->running--;
+    virMutexUnlock(&data->lock);
+}
+
+
+struct testThreadPoolBatchParams {
+    size_t njobs;
+    size_t maxWorkers;
+};
+
+static int
+testThreadPoolBatch(const void *opaque)
+{
+    const struct testThreadPoolBatchParams *params = opaque;
+    struct testThreadPoolBatchData data;
+    size_t i;
+    int ret = -1;
+
+    memset(&data, 0, sizeof(data));
+    if (virMutexInit(&data.lock) < 0)
+        return -1;
+    if (virCondInit(&data.cond) < 0) {
+        virMutexDestroy(&data.lock);
+        return -1;
+    }
+
+    data.maxWorkers = params->maxWorkers;
+    if (data.maxWorkers > params->njobs)
+        data.maxWorkers = params->njobs;
+    if (VIR_ALLOC_N(data.calls, params->njobs + 1) < 0)
+        goto cleanup;
+
+    virThreadPoolRunBatch(params->njobs, params->maxWorkers,
+                          testThreadPoolBatchJob, &data);
+
+    /* Every job runs exactly once, and nothing past the end */
+    for (i = 0; i <= params->njobs; i++) {
+        if (data.calls[i] != (i < params->njobs)) {
+            TEST_DEBUG("job %zu ran %zu times\n", i, data.calls[i]);
+            goto cleanup;
+        }
+    }
+
+    if (data.maxRunning != data.maxWorkers) {
+        TEST_DEBUG("%zu jobs ran at once, expected %zu\n",
+                   data.maxRunning, data.maxWorkers);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(data.calls);
+    virCondDestroy(&data.cond);
+    virMutexDestroy(&data.lock);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Order", testThreadPoolOrder, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Fairness", testThreadPoolFairness, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Long jobs", testThreadPoolLong, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Wakeup", testThreadPoolWakeup, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Priority", testThreadPoolPriority, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Stress", testThreadPoolStress, NULL) < 0)
+        ret = -1;
+
+#define DO_TEST_BATCH(njobs, maxWorkers)                                \
+    do {                                                                \
+        struct testThreadPoolBatchParams p = { njobs, maxWorkers };     \
+        if (virtTestRun("Batch " #njobs " jobs in " #maxWorkers         \
+                        " workers", testThreadPoolBatch, &p) < 0)       \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_BATCH(0, 4);
+    DO_TEST_BATCH(1, 4);
+    DO_TEST_BATCH(3, 4);
+    DO_TEST_BATCH(100, 1);
+    DO_TEST_BATCH(100, 4);
+    DO_TEST_BATCH(1000, 16);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
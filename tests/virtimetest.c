@@ -100,6 +100,55 @@ testTimeLocalOffset(const void *args)
 }
 
 
+struct testTimeBackOffData {
+    unsigned long long first;
+    unsigned long long timeout;
+    const unsigned long long *delays;   /* zero terminated */
+};
+
+/* Walk the retry loop through time as if each delay was slept
+ * exactly, starting at an arbitrary point in time */
+static int
+testTimeBackOff(const void *args)
+{
+    const struct testTimeBackOffData *data = args;
+    virTimeBackOffVar var;
+    unsigned long long now = 1000000;
+    unsigned long long delay;
+    size_t i;
+
+    if (virTimeBackOffStart(&var, data->first, data->timeout) < 0)
+        return -1;
+    var.limit_t = now + data->timeout;
+
+    /* The first attempt must not be delayed */
+    if (!virTimeBackOffNext(&var, now, &delay) || delay != 0) {
+        VIR_DEBUG("First attempt delayed by %llu ms", delay);
+        return -1;
+    }
+
+    for (i = 0; data->delays[i]; i++) {
+        if (!virTimeBackOffNext(&var, now, &delay)) {
+            VIR_DEBUG("Gave up after %zu attempts, expected more", i + 1);
+            return -1;
+        }
+        if (delay != data->delays[i]) {
+            VIR_DEBUG("Attempt %zu: expected delay %llu ms, got %llu ms",
+                      i + 2, data->delays[i], delay);
+            return -1;
+        }
+        now += delay;
+    }
+
+    if (virTimeBackOffNext(&var, now, &delay)) {
+        VIR_DEBUG("Kept trying after the timeout");
+        return -1;
+    }
+
+    return 0;
+}
+
+
 /* return true if the date is Jan 1 or Dec 31 (localtime) */
 static bool
 isNearYearEnd(void)
@@ -220,6 +269,21 @@ mymain(void)
                          ((-10 * 60) +  0) * 60);
     }
 
+#define TEST_BACKOFF(name, first, timeout, ...)                         \
+    do {                                                                \
+        static const unsigned long long delays[] = { __VA_ARGS__, 0 };  \
+        struct testTimeBackOffData data = { first, timeout, delays };   \
+        if (virtTestRun("Backoff " name, testTimeBackOff, &data) < 0)   \
+            ret = -1;                                                   \
+    } while (0)
+
+    /* the last wait is cut short by the timeout */
+    TEST_BACKOFF("short", 1, 300, 1, 2, 4, 8, 16, 32, 64, 128, 45);
+    /* waits never grow beyond 200 ms */
+    TEST_BACKOFF("capped", 1, 1000,
+                 1, 2, 4, 8, 16, 32, 64, 128, 200, 200, 200, 145);
+    TEST_BACKOFF("start", 10, 500, 10, 20, 40, 80, 160, 190);
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
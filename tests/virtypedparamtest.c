@@ -0,0 +1,215 @@
+/*
+ * virtypedparamtest.c: Test the typed parameter helpers
+ *
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+
+#include "testutils.h"
+#include "virtypedparam.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Enough to exercise the hash index, including a few resizes */
+#define TEST_LIST_SIZE 5000
+
+static int
+testTypedParamList(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virTypedParamListPtr list = NULL;
+    virTypedParameterPtr params = NULL;
+    virTypedParameterPtr param;
+    char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    int nparams = 0;
+    size_t i;
+    int ret = -1;
+
+    if (!(list = virTypedParamListNew()))
+        goto cleanup;
+
+    for (i = 0; i < TEST_LIST_SIZE; i++) {
+        snprintf(name, sizeof(name), "block.%zu.rd.reqs", i);
+        if (virTypedParamListAddULLong(list, name, i) < 0)
+            goto cleanup;
+    }
+    if (virTypedParamListAddString(list, "block.name", "vda") < 0 ||
+        virTypedParamListAddBoolean(list, "block.ok", true) < 0)
+        goto cleanup;
+
+    if (virTypedParamListAddULLong(list, "block.17.rd.reqs", 0) == 0) {
+        fprintf(stderr, "duplicate parameter was accepted\n");
+        goto cleanup;
+    }
+    virResetLastError();
+
+    for (i = 0; i < TEST_LIST_SIZE; i++) {
+        snprintf(name, sizeof(name), "block.%zu.rd.reqs", i);
+        if (!(param = virTypedParamListGet(list, name)) ||
+            param->type != VIR_TYPED_PARAM_ULLONG ||
+            param->value.ul != i) {
+            fprintf(stderr, "lookup of '%s' failed\n", name);
+            goto cleanup;
+        }
+    }
+    if (virTypedParamListGet(list, "block.rd.reqs")) {
+        fprintf(stderr, "lookup of a missing parameter succeeded\n");
+        goto cleanup;
+    }
+
+    if ((nparams = virTypedParamListSteal(list, &params)) < 0)
+        goto cleanup;
+
+    if (nparams != TEST_LIST_SIZE + 2 || list->npar ||
+        STRNEQ(params[TEST_LIST_SIZE].value.s, "vda")) {
+        fprintf(stderr, "unexpected array of %d parameters\n", nparams);
+        goto cleanup;
+    }
+
+    /* The emptied list must be usable again */
+    if (virTypedParamListAddInt(list, "block.17.rd.reqs", 1) < 0 ||
+        !virTypedParamListGet(list, "block.17.rd.reqs"))
+        goto cleanup;
+
+    virTypedParamListFree(list);
+    if (!(list = virTypedParamListNewFromParams(&params, nparams)))
+        goto cleanup;
+    nparams = 0;
+
+    if (params ||
+        !(param = virTypedParamListGet(list, "block.4321.rd.reqs")) ||
+        param->value.ul != 4321) {
+        fprintf(stderr, "lookup in an adopted array failed\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virTypedParamListFree(list);
+    virTypedParamsFree(params, nparams);
+    return ret;
+}
+
+
+static int
+testTypedParamListDuplicate(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virTypedParamListPtr list = NULL;
+    virTypedParameterPtr params = NULL;
+    char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(params, TEST_LIST_SIZE) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_LIST_SIZE; i++) {
+        snprintf(name, sizeof(name), "vcpu.%zu.time",
+                 i == TEST_LIST_SIZE - 1 ? 42 : i);
+        if (virTypedParameterAssign(params + i, name,
+                                    VIR_TYPED_PARAM_ULLONG, 0ULL) < 0)
+            goto cleanup;
+    }
+
+    if ((list = virTypedParamListNewFromParams(&params, TEST_LIST_SIZE))) {
+        fprintf(stderr, "array with duplicate names was adopted\n");
+        goto cleanup;
+    }
+    virResetLastError();
+
+    /* The array stays with the caller on failure */
+    if (!params)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virTypedParamListFree(list);
+    virTypedParamsFree(params, TEST_LIST_SIZE);
+    return ret;
+}
+
+
+static int
+testTypedParamsValidate(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virTypedParameter params[3];
+    int ret = -1;
+
+    memset(params, 0, sizeof(params));
+    if (virTypedParameterAssign(params, "weight",
+                                VIR_TYPED_PARAM_UINT, 10) < 0 ||
+        virTypedParameterAssign(params + 1, "cap",
+                                VIR_TYPED_PARAM_ULLONG, 20ULL) < 0 ||
+        virTypedParameterAssign(params + 2, "weight",
+                                VIR_TYPED_PARAM_UINT, 30) < 0)
+        goto cleanup;
+
+    if (virTypedParamsValidate(params, 2,
+                               "cap", VIR_TYPED_PARAM_ULLONG,
+                               "period", VIR_TYPED_PARAM_ULLONG,
+                               "weight", VIR_TYPED_PARAM_UINT,
+                               NULL) < 0)
+        goto cleanup;
+
+    if (virTypedParamsValidate(params, 3,
+                               "cap", VIR_TYPED_PARAM_ULLONG,
+                               "weight", VIR_TYPED_PARAM_UINT,
+                               NULL) == 0) {
+        fprintf(stderr, "duplicate parameter passed validation\n");
+        goto cleanup;
+    }
+
+    if (virTypedParamsValidate(params, 2,
+                               "weight", VIR_TYPED_PARAM_UINT,
+                               NULL) == 0) {
+        fprintf(stderr, "unknown parameter passed validation\n");
+        goto cleanup;
+    }
+
+    if (virTypedParamsValidate(params, 1, NULL) == 0) {
+        fprintf(stderr, "parameter passed validation with no names\n");
+        goto cleanup;
+    }
+    virResetLastError();
+
+    ret = 0;
+ cleanup:
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Typed param list", testTypedParamList, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Typed param list duplicates",
+                    testTypedParamListDuplicate, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Typed params validate",
+                    testTypedParamsValidate, NULL) < 0)
+        ret = -1;
+
+    return ret;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -1516,6 +1516,7 @@ vshDomainSorter(const void *a, const void *b)
 struct vshDomainList {
     virDomainPtr *domains;
     size_t ndomains;
+    int *states; /* state of each domain, -2 for saved, if known */
 };
 typedef struct vshDomainList *vshDomainListPtr;
 
@@ -1531,6 +1532,8 @@ vshDomainListFree(vshDomainListPtr domlist)
         }
         VIR_FREE(domlist->domains);
     }
+    if (domlist)
+        VIR_FREE(domlist->states);
     VIR_FREE(domlist);
 }
 
@@ -1753,6 +1756,110 @@ vshDomainListCollect(vshControl *ctl, unsigned int flags)
     return list;
 }
 
+/* Listing filters which virConnectGetAllDomainStats applies itself */
+#define VSH_DOMAIN_LIST_STATS_FILTERS                   \
+    (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |          \
+     VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |      \
+     VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE)
+
+static int
+vshDomainStatsRecordSorter(const void *a, const void *b)
+{
+    virDomainStatsRecordPtr *ra = (virDomainStatsRecordPtr *) a;
+    virDomainStatsRecordPtr *rb = (virDomainStatsRecordPtr *) b;
+
+    return vshDomainSorter(&(*ra)->dom, &(*rb)->dom);
+}
+
+/*
+ * Collect the domain list together with the state of each domain
+ * using a single virConnectGetAllDomainStats call, rather than
+ * querying every domain separately. Autostart and managed save
+ * filters are evaluated here from the returned stats. Returns
+ * NULL if the filters can't be handled this way or the daemon
+ * doesn't support the needed stats groups, in which case the
+ * caller should fall back to vshDomainListCollect.
+ */
+static vshDomainListPtr
+vshDomainListCollectStats(vshControl *ctl, unsigned int flags, bool managed)
+{
+    vshDomainListPtr list = NULL;
+    virDomainStatsRecordPtr *records = NULL;
+    virDomainStatsRecordPtr record;
+    unsigned int stats = VIR_DOMAIN_STATS_STATE;
+    int nrecords;
+    int state;
+    int autostart;
+    int mansave;
+    size_t i;
+
+    if (flags & ~(VSH_DOMAIN_LIST_STATS_FILTERS |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_AUTOSTART |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_MANAGEDSAVE))
+        return NULL;
+
+    if (VSH_MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_AUTOSTART))
+        stats |= VIR_DOMAIN_STATS_AUTOSTART;
+    if (managed || VSH_MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_MANAGEDSAVE))
+        stats |= VIR_DOMAIN_STATS_MANAGEDSAVE;
+
+    if ((nrecords = virConnectGetAllDomainStats(ctl->conn, stats, &records,
+                                                (flags & VSH_DOMAIN_LIST_STATS_FILTERS) |
+                                                VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS)) < 0) {
+        vshResetLibvirtError();
+        return NULL;
+    }
+
+    if (nrecords)
+        qsort(records, nrecords, sizeof(*records), vshDomainStatsRecordSorter);
+
+    list = vshMalloc(ctl, sizeof(*list));
+    list->domains = vshCalloc(ctl, nrecords, sizeof(*list->domains));
+    list->states = vshCalloc(ctl, nrecords, sizeof(*list->states));
+    list->ndomains = 0;
+
+    for (i = 0; i < nrecords; i++) {
+        record = records[i];
+        autostart = mansave = 0;
+
+        if (virTypedParamsGetInt(record->params, record->nparams,
+                                 "state.state", &state) != 1 ||
+            ((stats & VIR_DOMAIN_STATS_AUTOSTART) &&
+             virTypedParamsGetBoolean(record->params, record->nparams,
+                                      "autostart.enabled", &autostart) != 1) ||
+            ((stats & VIR_DOMAIN_STATS_MANAGEDSAVE) &&
+             virTypedParamsGetBoolean(record->params, record->nparams,
+                                      "managedsave.present", &mansave) != 1)) {
+            vshResetLibvirtError();
+            vshDomainListFree(list);
+            list = NULL;
+            goto cleanup;
+        }
+
+        if (VSH_MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_AUTOSTART) &&
+            !((VSH_MATCH(VIR_CONNECT_LIST_DOMAINS_AUTOSTART) && autostart) ||
+              (VSH_MATCH(VIR_CONNECT_LIST_DOMAINS_NO_AUTOSTART) && !autostart)))
+            continue;
+
+        if (VSH_MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_MANAGEDSAVE) &&
+            !((VSH_MATCH(VIR_CONNECT_LIST_DOMAINS_MANAGEDSAVE) && mansave) ||
+              (VSH_MATCH(VIR_CONNECT_LIST_DOMAINS_NO_MANAGEDSAVE) && !mansave)))
+            continue;
+
+        if (managed && state == VIR_DOMAIN_SHUTOFF && mansave)
+            state = -2;
+
+        virDomainRef(record->dom);
+        list->domains[list->ndomains] = record->dom;
+        list->states[list->ndomains] = state;
+        list->ndomains++;
+    }
+
+ cleanup:
+    virDomainStatsRecordListFree(records);
+    return list;
+}
+
 static const vshCmdOptDef opts_list[] = {
     {.name = "inactive",
      .type = VSH_OT_BOOL,
@@ -1890,7 +1997,12 @@ cmdList(vshControl *ctl, const vshCmd *cmd)
     if (!optUUID && !optName)
         optTable = true;
 
-    if (!(list = vshDomainListCollect(ctl, flags)))
+    /* The state column is all that needs to be fetched per domain,
+     * so try getting it for all of them at once */
+    if (optTable)
+        list = vshDomainListCollectStats(ctl, flags, managed);
+
+    if (!list && !(list = vshDomainListCollect(ctl, flags)))
         goto cleanup;
 
     /* print table header in legacy mode */
@@ -1915,15 +2027,19 @@ cmdList(vshControl *ctl, const vshCmd *cmd)
         else
             ignore_value(virStrcpyStatic(id_buf, "-"));
 
-        state = vshDomainState(ctl, dom, NULL);
+        if (list->states) {
+            state = list->states[i];
+        } else {
+            state = vshDomainState(ctl, dom, NULL);
 
-        /* Domain could've been removed in the meantime */
-        if (state < 0)
-            continue;
+            /* Domain could've been removed in the meantime */
+            if (state < 0)
+                continue;
 
-        if (optTable && managed && state == VIR_DOMAIN_SHUTOFF &&
-            virDomainHasManagedSaveImage(dom, 0) > 0)
-            state = -2;
+            if (optTable && managed && state == VIR_DOMAIN_SHUTOFF &&
+                virDomainHasManagedSaveImage(dom, 0) > 0)
+                state = -2;
+        }
 
         if (optTable) {
             if (optTitle) {
@@ -1997,6 +2113,18 @@ static const vshCmdOptDef opts_domstats[] = {
      .type = VSH_OT_BOOL,
      .help = N_("report domain block device statistics"),
     },
+    {.name = "autostart",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain autostart setting"),
+    },
+    {.name = "managed-save",
+     .type = VSH_OT_BOOL,
+     .help = N_("report presence of domain managed save image"),
+    },
+    {.name = "monitor",
+     .type = VSH_OT_BOOL,
+     .help = N_("report hypervisor monitor connection statistics"),
+    },
     {.name = "list-active",
      .type = VSH_OT_BOOL,
      .help = N_("list only active domains"),
@@ -2041,6 +2169,10 @@ static const vshCmdOptDef opts_domstats[] = {
      .type = VSH_OT_BOOL,
      .help = N_("add backing chain information to block stats"),
     },
+    {.name = "watch",
+     .type = VSH_OT_INT,
+     .help = N_("repeat every <interval> seconds, showing how counters changed"),
+    },
     {.name = "domain",
      .type = VSH_OT_ARGV,
      .flags = VSH_OFLAG_NONE,
@@ -2050,11 +2182,34 @@ static const vshCmdOptDef opts_domstats[] = {
 };
 
 
+/* Find the record of @dom in the NULL terminated list @records */
+static virDomainStatsRecordPtr
+vshDomainStatsFindRecord(virDomainStatsRecordPtr *records,
+                         virDomainPtr dom)
+{
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    unsigned char other[VIR_UUID_BUFLEN];
+
+    if (!records || virDomainGetUUID(dom, uuid) < 0)
+        return NULL;
+
+    for (; *records; records++) {
+        if (virDomainGetUUID((*records)->dom, other) == 0 &&
+            memcmp(uuid, other, VIR_UUID_BUFLEN) == 0)
+            return *records;
+    }
+
+    return NULL;
+}
+
 static bool
 vshDomainStatsPrintRecord(vshControl *ctl ATTRIBUTE_UNUSED,
                           virDomainStatsRecordPtr record,
+                          virDomainStatsRecordPtr prev,
                           bool raw ATTRIBUTE_UNUSED)
 {
+    virTypedParameterPtr par;
+    virTypedParameterPtr old;
     char *param;
     size_t i;
 
@@ -2063,12 +2218,30 @@ vshDomainStatsPrintRecord(vshControl *ctl ATTRIBUTE_UNUSED,
     /* XXX: Implement pretty-printing */
 
     for (i = 0; i < record->nparams; i++) {
-        if (!(param = vshGetTypedParamValue(ctl, record->params + i)))
-            return false;
+        par = record->params + i;
 
-        vshPrint(ctl, "  %s=%s\n", record->params[i].field, param);
+        if (!(param = vshGetTypedParamValue(ctl, par)))
+            return false;
 
+        vshPrint(ctl, "  %s=%s", par->field, param);
         VIR_FREE(param);
+
+        /* Counters are 64 bit wide, show how much they moved since
+         * the previous sample when watching */
+        if (prev &&
+            (par->type == VIR_TYPED_PARAM_ULLONG ||
+             par->type == VIR_TYPED_PARAM_LLONG) &&
+            (old = virTypedParamsGet(prev->params, prev->nparams,
+                                     par->field)) &&
+            old->type == par->type) {
+            if (par->type == VIR_TYPED_PARAM_ULLONG)
+                vshPrint(ctl, " (%+lld)",
+                         (long long) (par->value.ul - old->value.ul));
+            else
+                vshPrint(ctl, " (%+lld)", par->value.l - old->value.l);
+        }
+
+        vshPrint(ctl, "\n");
     }
 
     vshPrint(ctl, "\n");
@@ -2083,10 +2256,13 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
     virDomainPtr dom;
     size_t ndoms = 0;
     virDomainStatsRecordPtr *records = NULL;
+    virDomainStatsRecordPtr *prev = NULL;
     virDomainStatsRecordPtr *next;
     bool raw = vshCommandOptBool(cmd, "raw");
     int flags = 0;
     const vshCmdOpt *opt = NULL;
+    unsigned int watch = 0;
+    int rv;
     bool ret = false;
 
     if (vshCommandOptBool(cmd, "state"))
@@ -2107,6 +2283,26 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "block"))
         stats |= VIR_DOMAIN_STATS_BLOCK;
 
+    if (vshCommandOptBool(cmd, "autostart"))
+        stats |= VIR_DOMAIN_STATS_AUTOSTART;
+
+    if (vshCommandOptBool(cmd, "managed-save"))
+        stats |= VIR_DOMAIN_STATS_MANAGEDSAVE;
+
+    if (vshCommandOptBool(cmd, "monitor"))
+        stats |= VIR_DOMAIN_STATS_MONITOR;
+
+    if (vshCommandOptUInt(cmd, "watch", &watch) < 0) {
+        vshError(ctl, "%s", _("Unable to parse watch interval"));
+        return false;
+    }
+
+    if (vshCommandOptBool(cmd, "watch") &&
+        (watch == 0 || watch > INT_MAX / 1000)) {
+        vshError(ctl, "%s", _("Invalid watch interval"));
+        return false;
+    }
+
     if (vshCommandOptBool(cmd, "list-active"))
         flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE;
 
@@ -2150,28 +2346,55 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
             if (VIR_INSERT_ELEMENT(domlist, ndoms - 1, ndoms, dom) < 0)
                 goto cleanup;
         }
+    }
 
-        if (virDomainListGetStats(domlist,
-                                  stats,
-                                  &records,
-                                  flags) < 0)
+    while (true) {
+        if (domlist) {
+            if (virDomainListGetStats(domlist,
+                                      stats,
+                                      &records,
+                                      flags) < 0)
+                goto cleanup;
+        } else {
+            if ((virConnectGetAllDomainStats(ctl->conn,
+                                             stats,
+                                             &records,
+                                             flags)) < 0)
+                goto cleanup;
+        }
+
+        for (next = records; *next; next++) {
+            if (!vshDomainStatsPrintRecord(ctl, *next,
+                                           vshDomainStatsFindRecord(prev,
+                                                                    (*next)->dom),
+                                           raw))
+                goto cleanup;
+        }
+
+        if (!watch)
+            break;
+
+        /* Keep this sample around to compute the changes against */
+        virDomainStatsRecordListFree(prev);
+        prev = records;
+        records = NULL;
+        fflush(stdout);
+
+        if (vshEventStart(ctl, watch * 1000) < 0)
             goto cleanup;
-    } else {
-       if ((virConnectGetAllDomainStats(ctl->conn,
-                                        stats,
-                                        &records,
-                                        flags)) < 0)
-           goto cleanup;
-    }
+        rv = vshEventWait(ctl);
+        vshEventCleanup(ctl);
 
-    for (next = records; *next; next++) {
-        if (!vshDomainStatsPrintRecord(ctl, *next, raw))
+        if (rv < 0)
             goto cleanup;
+        if (rv != VSH_EVENT_TIMEOUT)
+            break;
     }
 
     ret = true;
  cleanup:
     virDomainStatsRecordListFree(records);
+    virDomainStatsRecordListFree(prev);
     virDomainListFree(domlist);
 
     return ret;
@@ -9526,6 +9526,10 @@ static const vshCmdOptDef opts_migrate[] = {
      .type = VSH_OT_STRING,
      .help = N_("listen address that destination should bind to for incoming migration")
     },
+    {.name = "tunnel-streams",
+     .type = VSH_OT_INT,
+     .help = N_("number of parallel streams to stripe tunnelled migration over")
+    },
     {.name = "dname",
      .type = VSH_OT_STRING,
      .help = N_("rename to new name during migration (if supported)")
@@ -9556,6 +9560,8 @@ doMigrate(void *opaque)
     virTypedParameterPtr params = NULL;
     int nparams = 0;
     int maxparams = 0;
+    int streams = 0;
+    int rv;
     virConnectPtr dconn = data->dconn;
 
     sigemptyset(&sigmask);
@@ -9590,6 +9596,20 @@ doMigrate(void *opaque)
                                 VIR_MIGRATE_PARAM_LISTEN_ADDRESS, opt) < 0)
         goto save_error;
 
+    if ((rv = vshCommandOptInt(cmd, "tunnel-streams", &streams)) < 0) {
+        vshError(ctl, "%s", _("migrate: Invalid number of tunnel streams"));
+        goto out;
+    } else if (rv > 0) {
+        if (streams < 1) {
+            vshError(ctl, "%s", _("migrate: Invalid number of tunnel streams"));
+            goto out;
+        }
+        if (virTypedParamsAddInt(&params, &nparams, &maxparams,
+                                 VIR_MIGRATE_PARAM_TUNNEL_STREAMS,
+                                 streams) < 0)
+            goto save_error;
+    }
+
     if (vshCommandOptStringReq(ctl, cmd, "dname", &opt) < 0)
         goto out;
     if (opt &&